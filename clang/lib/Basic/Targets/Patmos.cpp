@@ -12,12 +12,24 @@
 
 #include "Patmos.h"
 #include "clang/Basic/MacroBuilder.h"
+#include "clang/Basic/TargetBuiltins.h"
 #include "llvm/ADT/StringSwitch.h"
 #include "llvm/Support/TargetParser.h"
 
 using namespace clang;
 using namespace clang::targets;
 
+static const Builtin::Info BuiltinInfo[] = {
+#define BUILTIN(ID, TYPE, ATTRS)                                               \
+  {#ID, TYPE, ATTRS, nullptr, ALL_LANGUAGES, nullptr},
+#include "clang/Basic/BuiltinsPatmos.def"
+};
+
+ArrayRef<Builtin::Info> PatmosTargetInfo::getTargetBuiltins() const {
+  return llvm::makeArrayRef(BuiltinInfo, clang::Patmos::LastTSBuiltin -
+                                             Builtin::FirstTSBuiltin);
+}
+
 ArrayRef<const char *> PatmosTargetInfo::getGCCRegNames() const {
   static const char *const GCCRegNames[] = {
       // CPU register names
@@ -96,10 +108,28 @@ void PatmosTargetInfo::getTargetDefines(const LangOptions &Opts,
   Builder.defineMacro("__patmos__");
   Builder.defineMacro("__PATMOS__");
 
+  // Qualifiers for the typed memories, matching the address spaces the
+  // backend selects the typed loads and stores by.
+  Builder.defineMacro("__patmos_spm", "__attribute__((address_space(1)))");
+  Builder.defineMacro("__patmos_uncached", "__attribute__((address_space(3)))");
+
   if (SoftFloat)
     Builder.defineMacro("SOFT_FLOAT", "1");
 }
 
+/// The processors of Patmos.td.
+static constexpr llvm::StringLiteral ValidCPUNames[] = {
+    {"generic"}, {"de2-115"}, {"de2-115-4core"}};
+
+bool PatmosTargetInfo::isValidCPUName(StringRef Name) const {
+  return llvm::is_contained(ValidCPUNames, Name);
+}
+
+void PatmosTargetInfo::fillValidCPUList(
+    SmallVectorImpl<StringRef> &Values) const {
+  Values.append(std::begin(ValidCPUNames), std::end(ValidCPUNames));
+}
+
 /// Return true if has this feature, need to sync with handleTargetFeatures.
 bool PatmosTargetInfo::hasFeature(StringRef Feature) const {
   return llvm::StringSwitch<bool>(Feature)
@@ -111,12 +141,11 @@ bool PatmosTargetInfo::hasFeature(StringRef Feature) const {
 /// Perform initialization based on the user configured set of features.
 bool PatmosTargetInfo::handleTargetFeatures(std::vector<std::string> &Features,
                                            DiagnosticsEngine &Diags) {
+  // The Patmos instruction set has no floating point instructions, the
+  // backend always calls the soft-float routines of compiler-rt. Accept
+  // +hard-float for compatibility, but keep announcing soft-float, such that
+  // code selecting its implementation by SOFT_FLOAT matches the generated
+  // code.
   SoftFloat = true;
-  for (unsigned i = 0, e = Features.size(); i != e; ++i) {
-    if (Features[i] == "+hard-float")
-      SoftFloat = false;
-    if (Features[i] == "+soft-float")
-      SoftFloat = true;
-  }
   return true;
 }
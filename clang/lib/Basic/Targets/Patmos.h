@@ -32,6 +32,9 @@ public:
     LongLongAlign = 32;
     LongDoubleAlign = 32;
     SuitableAlign = 32;
+    // Atomic loads and stores are uncached accesses, read-modify-write
+    // operations call the __sync_* functions of the runtime
+    MaxAtomicPromoteWidth = MaxAtomicInlineWidth = 32;
     // Keep {|} as they are in inline asm
     NoAsmVariants = true;
     resetDataLayout(
@@ -39,17 +42,19 @@ public:
         );
   }
 
+  bool isValidCPUName(StringRef Name) const override;
+
+  void fillValidCPUList(SmallVectorImpl<StringRef> &Values) const override;
+
   bool setCPU(const std::string &Name) override {
-    if (!isValidCPUName(Name))
-      return false;
-    // We don't have any special CPUs
-    return true;
+    // The processors only differ in the code generation, see Patmos.td
+    return isValidCPUName(Name);
   }
 
   void getTargetDefines(const LangOptions &Opts,
                         MacroBuilder &Builder) const override;
 
-  ArrayRef<Builtin::Info> getTargetBuiltins() const override { return None; }
+  ArrayRef<Builtin::Info> getTargetBuiltins() const override;
 
   BuiltinVaListKind getBuiltinVaListKind() const override {
     return TargetInfo::VoidPtrBuiltinVaList;
@@ -41,6 +41,7 @@
 #include "llvm/IR/IntrinsicsBPF.h"
 #include "llvm/IR/IntrinsicsHexagon.h"
 #include "llvm/IR/IntrinsicsNVPTX.h"
+#include "llvm/IR/IntrinsicsPatmos.h"
 #include "llvm/IR/IntrinsicsPowerPC.h"
 #include "llvm/IR/IntrinsicsR600.h"
 #include "llvm/IR/IntrinsicsRISCV.h"
@@ -5446,6 +5447,8 @@ static Value *EmitTargetArchBuiltinExpr(CodeGenFunction *CGF,
   case llvm::Triple::bpfeb:
   case llvm::Triple::bpfel:
     return CGF->EmitBPFBuiltinExpr(BuiltinID, E);
+  case llvm::Triple::patmos:
+    return CGF->EmitPatmosBuiltinExpr(BuiltinID, E);
   case llvm::Triple::x86:
   case llvm::Triple::x86_64:
     return CGF->EmitX86BuiltinExpr(BuiltinID, E);
@@ -11968,6 +11971,102 @@ Value *CodeGenFunction::EmitBPFBuiltinExpr(unsigned BuiltinID,
   }
 }
 
+Value *CodeGenFunction::EmitPatmosBuiltinExpr(unsigned BuiltinID,
+                                              const CallExpr *E) {
+  // A DMA table entry of the network interface is local I/O memory. Word 0
+  // holds the number of words and the active bit, which the network
+  // interface clears when the transfer completes, word 1 holds the
+  // destination and source offsets. The words are accessed by volatile
+  // local loads and stores, the store of the active bit comes last.
+  if (BuiltinID == Patmos::BI__builtin_patmos_dma_start ||
+      BuiltinID == Patmos::BI__builtin_patmos_dma_done) {
+    Value *Ptr = EmitScalarExpr(E->getArg(0));
+    Ptr = Builder.CreatePointerBitCastOrAddrSpaceCast(Ptr,
+                                                      Int32Ty->getPointerTo(1));
+    Address Status(Ptr, Int32Ty, CharUnits::fromQuantity(4));
+    Value *Active = Builder.getInt32(1u << 31);
+
+    if (BuiltinID == Patmos::BI__builtin_patmos_dma_done) {
+      Value *Busy = Builder.CreateAnd(
+          Builder.CreateLoad(Status, /*IsVolatile=*/true), Active);
+      return Builder.CreateZExt(Builder.CreateIsNull(Busy), IntTy);
+    }
+
+    Value *Dst = EmitScalarExpr(E->getArg(1));
+    Value *Src = EmitScalarExpr(E->getArg(2));
+    Value *Words = EmitScalarExpr(E->getArg(3));
+    Value *Offsets =
+        Builder.CreateOr(Builder.CreateShl(Dst, 16),
+                         Builder.CreateAnd(Src, Builder.getInt32(0xffff)));
+    Builder.CreateStore(Offsets, Builder.CreateConstInBoundsGEP(Status, 1),
+                        /*IsVolatile=*/true);
+    return Builder.CreateStore(Builder.CreateOr(Words, Active), Status,
+                               /*IsVolatile=*/true);
+  }
+
+  switch (BuiltinID) {
+  case Patmos::BI__builtin_patmos_cycles:
+    return Builder.CreateCall(CGM.getIntrinsic(Intrinsic::patmos_cycles));
+  case Patmos::BI__builtin_patmos_usecs:
+    return Builder.CreateCall(CGM.getIntrinsic(Intrinsic::patmos_usecs));
+  case Patmos::BI__builtin_patmos_cycles64: {
+    // Reading the low word latches the high word.
+    Value *Lo = Builder.CreateCall(CGM.getIntrinsic(Intrinsic::patmos_cycles));
+    Value *Hi =
+        Builder.CreateCall(CGM.getIntrinsic(Intrinsic::patmos_cycles_hi));
+    return Builder.CreateOr(
+        Builder.CreateShl(Builder.CreateZExt(Hi, Int64Ty), 32),
+        Builder.CreateZExt(Lo, Int64Ty));
+  }
+  case Patmos::BI__builtin_patmos_mfs: {
+    Optional<llvm::APSInt> SReg =
+        E->getArg(0)->getIntegerConstantExpr(getContext());
+    assert(SReg && "special register must be a constant");
+    return Builder.CreateCall(CGM.getIntrinsic(Intrinsic::patmos_mfs),
+                              Builder.getInt32(SReg->getZExtValue()));
+  }
+  default:
+    break;
+  }
+
+  // The typed memories are selected by the backend from the address space of
+  // the access: 1 is the local scratchpad, 3 bypasses the data cache.
+  unsigned AddrSpace;
+  bool IsStore;
+  switch (BuiltinID) {
+  default:
+    return nullptr;
+  case Patmos::BI__builtin_patmos_lwm:
+    AddrSpace = 3;
+    IsStore = false;
+    break;
+  case Patmos::BI__builtin_patmos_swm:
+    AddrSpace = 3;
+    IsStore = true;
+    break;
+  case Patmos::BI__builtin_patmos_lwl:
+    AddrSpace = 1;
+    IsStore = false;
+    break;
+  case Patmos::BI__builtin_patmos_swl:
+    AddrSpace = 1;
+    IsStore = true;
+    break;
+  }
+
+  // The accesses are volatile, they are typically used for memory-mapped
+  // devices and buffers shared with DMA transfers.
+  Value *Ptr = EmitScalarExpr(E->getArg(0));
+  Ptr = Builder.CreatePointerBitCastOrAddrSpaceCast(
+      Ptr, Int32Ty->getPointerTo(AddrSpace));
+  Address Addr(Ptr, Int32Ty, CharUnits::fromQuantity(4));
+
+  if (IsStore)
+    return Builder.CreateStore(EmitScalarExpr(E->getArg(1)), Addr,
+                               /*IsVolatile=*/true);
+  return Builder.CreateLoad(Addr, /*IsVolatile=*/true);
+}
+
 llvm::Value *CodeGenFunction::
 BuildVector(ArrayRef<llvm::Value*> Ops) {
   assert((Ops.size() & (Ops.size() - 1)) == 0 &&
@@ -432,6 +432,16 @@ MDNode *LoopInfo::createMetadata(
     LoopProperties.push_back(
         MDNode::get(Ctx, MDString::get(Ctx, "llvm.loop.mustprogress")));
 
+  if (Attrs.HasLoopBound) {
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(Ctx);
+    Metadata *Vals[] = {MDString::get(Ctx, "llvm.loop.bound"),
+                        ConstantAsMetadata::get(ConstantInt::get(
+                            Int32Ty, Attrs.LoopBoundMin)),
+                        ConstantAsMetadata::get(ConstantInt::get(
+                            Int32Ty, Attrs.LoopBoundMax))};
+    LoopProperties.push_back(MDNode::get(Ctx, Vals));
+  }
+
   assert(!!AccGroup == Attrs.IsParallel &&
          "There must be an access group iff the loop is parallel");
   if (Attrs.IsParallel) {
@@ -452,7 +462,8 @@ LoopAttributes::LoopAttributes(bool IsParallel)
       VectorizeScalable(LoopAttributes::Unspecified), InterleaveCount(0),
       UnrollCount(0), UnrollAndJamCount(0),
       DistributeEnable(LoopAttributes::Unspecified), PipelineDisabled(false),
-      PipelineInitiationInterval(0), MustProgress(false) {}
+      PipelineInitiationInterval(0), MustProgress(false), HasLoopBound(false),
+      LoopBoundMin(0), LoopBoundMax(0) {}
 
 void LoopAttributes::clear() {
   IsParallel = false;
@@ -469,6 +480,9 @@ void LoopAttributes::clear() {
   PipelineDisabled = false;
   PipelineInitiationInterval = 0;
   MustProgress = false;
+  HasLoopBound = false;
+  LoopBoundMin = 0;
+  LoopBoundMax = 0;
 }
 
 LoopInfo::LoopInfo(BasicBlock *Header, const LoopAttributes &Attrs,
@@ -493,7 +507,7 @@ LoopInfo::LoopInfo(BasicBlock *Header, const LoopAttributes &Attrs,
       Attrs.UnrollEnable == LoopAttributes::Unspecified &&
       Attrs.UnrollAndJamEnable == LoopAttributes::Unspecified &&
       Attrs.DistributeEnable == LoopAttributes::Unspecified && !StartLoc &&
-      !EndLoc && !Attrs.MustProgress)
+      !EndLoc && !Attrs.MustProgress && !Attrs.HasLoopBound)
     return;
 
   TempLoopID = MDNode::getTemporary(Header->getContext(), None);
@@ -545,6 +559,11 @@ void LoopInfo::finish() {
     AfterJam.PipelineDisabled = Attrs.PipelineDisabled;
     AfterJam.PipelineInitiationInterval = Attrs.PipelineInitiationInterval;
 
+    // jamming does not change the iterations of this loop
+    BeforeJam.HasLoopBound = AfterJam.HasLoopBound = Attrs.HasLoopBound;
+    BeforeJam.LoopBoundMin = AfterJam.LoopBoundMin = Attrs.LoopBoundMin;
+    BeforeJam.LoopBoundMax = AfterJam.LoopBoundMax = Attrs.LoopBoundMax;
+
     // If this loop is subject of an unroll-and-jam by the parent loop, and has
     // an unroll-and-jam annotation itself, we have to decide whether to first
     // apply the parent's unroll-and-jam or this loop's unroll-and-jam. The
@@ -599,6 +618,13 @@ void LoopInfoStack::push(BasicBlock *Header, clang::ASTContext &Ctx,
                          const llvm::DebugLoc &EndLoc, bool MustProgress) {
   // Identify loop hint attributes from Attrs.
   for (const auto *Attr : Attrs) {
+    // The loop bound is part of the loop ID, which is kept on the latches by
+    // the loop passes.
+    if (const LoopBoundAttr *LB = dyn_cast<LoopBoundAttr>(Attr)) {
+      setLoopBound(LB->getMin(), LB->getMax());
+      continue;
+    }
+
     const LoopHintAttr *LH = dyn_cast<LoopHintAttr>(Attr);
     const OpenCLUnrollHintAttr *OpenCLHint =
         dyn_cast<OpenCLUnrollHintAttr>(Attr);
@@ -81,6 +81,14 @@ struct LoopAttributes {
 
   /// Value for whether the loop is required to make progress.
   bool MustProgress;
+
+  /// Whether the loop has a llvm.loop.bound of the WCET analysis.
+  bool HasLoopBound;
+
+  /// Values for llvm.loop.bound metadata, the minimum and maximum number of
+  /// iterations.
+  unsigned LoopBoundMin;
+  unsigned LoopBoundMax;
 };
 
 /// Information used when generating a structured loop.
@@ -285,6 +293,13 @@ public:
   /// Set no progress for the next loop pushed.
   void setMustProgress(bool P) { StagedAttrs.MustProgress = P; }
 
+  /// Set the loop bound for the next loop pushed.
+  void setLoopBound(unsigned Min, unsigned Max) {
+    StagedAttrs.HasLoopBound = true;
+    StagedAttrs.LoopBoundMin = Min;
+    StagedAttrs.LoopBoundMax = Max;
+  }
+
 private:
   /// Returns true if there is LoopInfo on the stack.
   bool hasInfo() const { return !Active.empty(); }
@@ -812,9 +812,9 @@ void CodeGenFunction::EmitIfStmt(const IfStmt &S) {
 // Emits loop bounds on the given conditional branch (assuming its
 // the branch that controls the condition of the loop.
 //
-// Current implementation overwrites any "llvm.loop" attribute on the
-// instruction, meaning it doesn't play well with other loop hints,
-// e.g. "unroll".
+// The bound is also part of the loop ID of the LoopStack on the latches,
+// which the loop passes keep. A branch that already has a loop ID is such a
+// latch, e.g., the condition of a do-while loop, and is left alone.
 void CodeGenFunction::EmitCondBrBounds(llvm::LLVMContext &Context,
                                        llvm::BranchInst *CondBr,
                                        const ArrayRef<const Attr *> &Attrs) {
@@ -825,7 +825,7 @@ void CodeGenFunction::EmitCondBrBounds(llvm::LLVMContext &Context,
 
   // Look for any loopbound attribute
   auto foundLB = std::find_if(Attrs.begin(), Attrs.end(),is_bound);
-  if( foundLB != Attrs.end() ) {
+  if (foundLB != Attrs.end() && !CondBr->getMetadata("llvm.loop")) {
     auto LB = dyn_cast<LoopBoundAttr>(*foundLB); // Guaranteed to work
 
     const char *MetadataName = "llvm.loop.bound";
@@ -11204,6 +11204,19 @@ public:
       Fn->addFnAttr("sp-root");
       Fn->addFnAttr(llvm::Attribute::NoInline);
     }
+    // Inlined, the branches would be converted as those of the caller
+    if (FD->hasAttr<ConstantTimeAttr>()) {
+      Fn->addFnAttr("patmos-constant-time");
+      Fn->addFnAttr(llvm::Attribute::NoInline);
+    }
+    // Bounds for the stack cache analysis of recursive code
+    if (const auto *A = FD->getAttr<RecursionDepthAttr>())
+      Fn->addFnAttr("patmos-recursion-depth", llvm::utostr(A->getDepth()));
+    // Interrupt handlers save their context and return with xret
+    if (FD->hasAttr<PatmosInterruptAttr>()) {
+      Fn->addFnAttr("interrupt");
+      Fn->addFnAttr(llvm::Attribute::NoInline);
+    }
   }
 };
 }
@@ -37,6 +37,7 @@
 #include "llvm/Option/Arg.h"
 #include "llvm/Option/ArgList.h"
 #include "llvm/Option/Option.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Format.h"
@@ -175,6 +176,129 @@ Arg* patmos::PatmosBaseTool::GetOptLevel(const ArgList &Args, char &Lvl) const {
   return 0;
 }
 
+/// The known Patmos boards, the first one is the default.
+static const patmos::PatmosBaseTool::PatmosBoard PatmosBoards[] = {
+  // name       memory    shadow  SC    MC
+  { "de2-115",  0x200000, 0x8000, 2048, 4096 },
+};
+
+patmos::PatmosBaseTool::PatmosBoard
+patmos::PatmosBaseTool::getBoard(const ArgList &Args) const {
+  const Driver &D = TC.getDriver();
+  PatmosBoard Board = PatmosBoards[0];
+
+  if (Arg *A = Args.getLastArg(options::OPT_mpatmos_board_EQ)) {
+    auto It = llvm::find_if(PatmosBoards, [&](const PatmosBoard &B) {
+      return A->getValue() == StringRef(B.Name);
+    });
+    if (It != std::end(PatmosBoards))
+      Board = *It;
+    else
+      D.Diag(diag::err_drv_invalid_value) << A->getAsString(Args)
+                                          << A->getValue();
+  }
+
+  if (Arg *A = Args.getLastArg(options::OPT_mpatmos_memory_size_EQ)) {
+    uint64_t Size;
+    if (StringRef(A->getValue()).getAsInteger(0, Size) ||
+        Size <= 2 * Board.ShadowStackSize || Size > 0x80000000)
+      D.Diag(diag::err_drv_invalid_int_value) << A->getAsString(Args)
+                                              << A->getValue();
+    else
+      Board.MemorySize = Size;
+  }
+
+  return Board;
+}
+
+void patmos::PatmosBaseTool::AddBoardCacheArgs(const ArgList &Args,
+                                               ArgStringList &CmdArgs) const
+{
+  bool HasStackCacheSize = false, HasMethodCacheSize = false;
+  for (const Arg *A : Args.filtered(options::OPT_mllvm)) {
+    StringRef Value = A->getValue();
+    HasStackCacheSize |= Value.startswith("-mpatmos-stack-cache-size");
+    HasMethodCacheSize |= Value.startswith("-mpatmos-method-cache-size");
+  }
+
+  // The processor carries its cache sizes, unless a board is given as well
+  if (Arg *A = Args.getLastArg(options::OPT_mcpu_EQ)) {
+    CmdArgs.push_back(Args.MakeArgString(Twine("-mcpu=") + A->getValue()));
+    if (!Args.hasArg(options::OPT_mpatmos_board_EQ))
+      return;
+  }
+
+  PatmosBoard Board = getBoard(Args);
+  if (!HasStackCacheSize)
+    CmdArgs.push_back(Args.MakeArgString("-mpatmos-stack-cache-size=" +
+                                         Twine(Board.StackCacheSize)));
+  if (!HasMethodCacheSize)
+    CmdArgs.push_back(Args.MakeArgString("-mpatmos-method-cache-size=" +
+                                         Twine(Board.MethodCacheSize)));
+}
+
+/// Return true if debug information is requested by -g.
+static bool hasDebugInfo(const ArgList &Args)
+{
+  const Arg *A = Args.getLastArg(options::OPT_g_Group);
+  return A && !A->getOption().matches(options::OPT_g0) &&
+         !A->getOption().matches(options::OPT_ggdb0);
+}
+
+/// Return true if the DWARF is split by -gsplit-dwarf, and whether the .dwo
+/// sections are kept in the object file in Single. Invalid values are
+/// diagnosed by the compile job.
+static bool getSplitDwarf(const ArgList &Args, bool &Single)
+{
+  const Arg *A = Args.getLastArg(options::OPT_gsplit_dwarf,
+                                 options::OPT_gsplit_dwarf_EQ,
+                                 options::OPT_gno_split_dwarf);
+  if (!A || A->getOption().matches(options::OPT_gno_split_dwarf))
+    return false;
+
+  StringRef Value = A->getOption().matches(options::OPT_gsplit_dwarf) ?
+                    "split" : A->getValue();
+  Single = Value == "single";
+  return Single || Value == "split";
+}
+
+/// Return true if the debug sections are compressed by -gz.
+static bool hasCompressedDebugSections(const ArgList &Args)
+{
+  const Arg *A = Args.getLastArg(options::OPT_gz_EQ);
+  return A && StringRef(A->getValue()) == "zlib" && llvm::zlib::isAvailable();
+}
+
+void patmos::PatmosBaseTool::AddDebugCodeGenArgs(const ArgList &Args,
+                                                 const InputInfo &Output,
+                                                 unsigned Partitions,
+                                                 ArgStringList &CmdArgs) const
+{
+  if (!hasDebugInfo(Args))
+    return;
+
+  if (hasCompressedDebugSections(Args))
+    CmdArgs.push_back("-mpatmos-compress-debug-sections=zlib");
+
+  // the .dwo files are named like the output, .dwo sections kept in the
+  // objects end up in the output as well
+  bool Single;
+  if (!Output.isFilename() || !getSplitDwarf(Args, Single))
+    return;
+
+  for (unsigned i = 0; i < Partitions; i++) {
+    SmallString<128> DwoFile(Output.getFilename());
+    if (!Single)
+      llvm::sys::path::replace_extension(DwoFile,
+                                         i == 0 ? "dwo" : Twine(i) + ".dwo");
+    CmdArgs.push_back(Args.MakeArgString("-split-dwarf-file=" +
+                                         Twine(DwoFile)));
+    if (!Single)
+      CmdArgs.push_back(Args.MakeArgString("-split-dwarf-output=" +
+                                           Twine(DwoFile)));
+  }
+}
+
 std::string patmos::PatmosBaseTool::getLibPath(const char* LibName) const {
   auto path = TC.GetFilePath(LibName);
   if (!llvm::sys::fs::exists(path)) {
@@ -186,6 +310,59 @@ std::string patmos::PatmosBaseTool::getLibPath(const char* LibName) const {
   return path;
 }
 
+/// Return true if functions are emitted into sections of their own, which
+/// the linker needs to remove or fold them. The libraries linked with native
+/// objects are compiled as a whole, their unused functions are removed by
+/// the linker.
+static bool hasFunctionSections(const ArgList &Args)
+{
+  return Args.hasFlag(options::OPT_ffunction_sections,
+                      options::OPT_fno_function_sections,
+                      Args.hasArg(options::OPT_mpatmos_native_objects)) ||
+         Args.hasArg(options::OPT_mpatmos_icf);
+}
+
+/// Return true if the input II is linked as native object by
+/// -mpatmos-native-objects, i.e., if it is not a bitcode file or archive.
+/// Objects compiled by this invocation do not exist yet, they are native.
+static bool isNativeInput(const InputInfo &II)
+{
+  if (!II.isFilename())
+    return false;
+  llvm::file_magic Magic;
+  if (llvm::identify_magic(II.getFilename(), Magic))
+    return true;
+  return Magic != llvm::file_magic::bitcode &&
+         Magic != llvm::file_magic::archive;
+}
+
+/// Return true if data objects are emitted into sections of their own.
+static bool hasDataSections(const ArgList &Args)
+{
+  return Args.hasFlag(options::OPT_fdata_sections,
+                      options::OPT_fno_data_sections, false);
+}
+
+void patmos::PatmosBaseTool::AddSectionCodeGenArgs(const ArgList &Args,
+                                                   ArgStringList &CmdArgs) const
+{
+  // the code of a function and its size words, i.e., all its subfunctions,
+  // go into a single section
+  if (hasFunctionSections(Args))
+    CmdArgs.push_back("-function-sections");
+  if (hasDataSections(Args))
+    CmdArgs.push_back("-data-sections");
+
+  // the linker only folds functions whose address is not taken
+  if (Args.hasArg(options::OPT_mpatmos_icf))
+    CmdArgs.push_back("-addrsig");
+
+  // the linker analyses the whole program of native objects by their
+  // summaries
+  if (Args.hasArg(options::OPT_mpatmos_native_objects))
+    CmdArgs.push_back("-mpatmos-emit-summary");
+}
+
 void patmos::PatmosBaseTool::PrepareLink1Inputs(
     const llvm::opt::ArgList &Args,
     const InputInfoList &Inputs,
@@ -239,6 +416,9 @@ void patmos::PatmosBaseTool::PrepareLink3Inputs(
 
   LinkInputs.push_back(Args.MakeArgString(getLibPath("lib/libc.a")));
   LinkInputs.push_back(Args.MakeArgString("--override=" + getLibPath("lib/libm.a")));
+  // the word-at-a-time string routines replace those of newlib, if requested
+  if (Args.hasArg(options::OPT_mpatmos_word_string))
+    LinkInputs.push_back(Args.MakeArgString("--override=" + getLibPath("lib/libclang_rt.string.a")));
   LinkInputs.push_back(Args.MakeArgString(getLibPath("lib/libpatmos.a")));
 
   LinkInputs.push_back(Args.MakeArgString("--internalize-public-api-file=" + getLibPath("lib/libsyms.lst")));
@@ -258,6 +438,12 @@ void patmos::PatmosBaseTool::PrepareLink4Inputs(
   // All of compiler-rt must always be available
   LinkInputs.push_back(Args.MakeArgString(getLibPath("lib/librt.a")));
 
+  // the profile runtime writes the counters of -fprofile-instr-generate and
+  // -fprofile-generate to the UART
+  if (ToolChain::needsProfileRT(Args))
+    LinkInputs.push_back(Args.MakeArgString(
+                             getLibPath("lib/libclang_rt.profile.a")));
+
   if(Args.hasArg(options::OPT_v)) {
     LinkInputs.push_back("-v");
   }
@@ -372,6 +558,10 @@ bool patmos::PatmosBaseTool::ConstructOptJob(const Tool &Creator,
     OptArgs.push_back("--std-link-opts");
   }
 
+  // do not carry the debug information of the libraries into the program
+  if (!hasDebugInfo(Args))
+    OptArgs.push_back("--strip-debug");
+
   //----------------------------------------------------------------------------
   // append output and input files
 
@@ -440,6 +630,11 @@ void patmos::PatmosBaseTool::ConstructLLCJob(const Tool &Creator,
       A->renderAsInput(Args, LLCArgs);
     }
   }
+  AddBoardCacheArgs(Args, LLCArgs);
+  if (Args.hasArg(options::OPT_mpatmos_profile))
+    LLCArgs.push_back("-mpatmos-profile");
+  AddDebugCodeGenArgs(Args, Output, 1, LLCArgs);
+  AddSectionCodeGenArgs(Args, LLCArgs);
 
   //----------------------------------------------------------------------------
   // generate object file
@@ -464,6 +659,120 @@ void patmos::PatmosBaseTool::ConstructLLCJob(const Tool &Creator,
       LLCExec, LLCArgs, Inputs, Output));
 }
 
+void patmos::PatmosBaseTool::ConstructPatmosLinkJob(const Tool &Creator,
+    Compilation &C, const JobAction &JA,
+    const InputInfo &Output, const InputInfoList &Inputs,
+    const ArgStringList &OutputFilenames, const ArgList &Args) const
+{
+  ArgStringList LinkArgs;
+
+  //----------------------------------------------------------------------------
+  // append -O and -m options
+
+  char OptLevel;
+  if (GetOptLevel(Args, OptLevel)) {
+    // -Ofast/-O4/-O5.. are not supported, use -O3 instead
+    if (!strchr("0123sz", OptLevel))
+      OptLevel = '3';
+    LinkArgs.push_back(Args.MakeArgString(Twine("-O") + Twine(OptLevel)));
+  } else {
+    LinkArgs.push_back("-O0");
+  }
+
+  for (ArgList::const_iterator
+         it = Args.begin(), ie = Args.end(); it != ie; ++it) {
+    Arg *A = *it;
+
+    if (A->getOption().matches(options::OPT_mllvm)) {
+      A->claim();
+      A->renderAsInput(Args, LinkArgs);
+    }
+  }
+  AddBoardCacheArgs(Args, LinkArgs);
+  if (Args.hasArg(options::OPT_mpatmos_profile))
+    LinkArgs.push_back("-mpatmos-profile");
+  AddDebugCodeGenArgs(Args, Output, OutputFilenames.size(), LinkArgs);
+  AddSectionCodeGenArgs(Args, LinkArgs);
+
+  // do not carry the debug information of the libraries into the program
+  if (!hasDebugInfo(Args))
+    LinkArgs.push_back("-strip-debug");
+
+  //----------------------------------------------------------------------------
+  // append the libraries, in the order of the separate link jobs
+
+  LinkArgs.push_back(Args.MakeArgString("-crt=" + getLibPath("lib/crt0.o")));
+  LinkArgs.push_back(Args.MakeArgString("-crt=" + getLibPath("lib/crtbegin.o")));
+  LinkArgs.push_back(Args.MakeArgString("-crt=" + getLibPath("lib/crtend.o")));
+
+  LinkArgs.push_back(Args.MakeArgString("-lib=" + getLibPath("lib/libc.a")));
+  LinkArgs.push_back(Args.MakeArgString("-lib=" + getLibPath("lib/libpatmos.a")));
+  LinkArgs.push_back(Args.MakeArgString("-override-lib=" + getLibPath("lib/libm.a")));
+  if (Args.hasArg(options::OPT_mpatmos_word_string))
+    LinkArgs.push_back(Args.MakeArgString("-override-lib=" + getLibPath("lib/libclang_rt.string.a")));
+
+  LinkArgs.push_back(Args.MakeArgString("-rt=" + getLibPath("lib/librt.a")));
+  if (ToolChain::needsProfileRT(Args))
+    LinkArgs.push_back(Args.MakeArgString(
+                           "-rt=" + getLibPath("lib/libclang_rt.profile.a")));
+
+  // Don't hide symbols that are expected to be public
+  LinkArgs.push_back(Args.MakeArgString("--internalize-public-api-file=" + getLibPath("lib/libsyms.lst")));
+
+  if (Arg *A = Args.getLastArg(options::OPT_mpatmos_codegen_cache_EQ)) {
+    LinkArgs.push_back(Args.MakeArgString(Twine("-cache-dir=") +
+                                          A->getValue()));
+  }
+
+  // the native objects may use any symbol of the libraries, which are
+  // compiled as a whole and cached, if a cache is given
+  bool NativeObjects = Args.hasArg(options::OPT_mpatmos_native_objects);
+  if (NativeObjects) {
+    LinkArgs.push_back("-keep-public");
+    LinkArgs.push_back("-link-all-members");
+  }
+
+  // let the server link, which keeps the libraries resident, patmos-link
+  // links by itself if the server is not running
+  if (Arg *A = Args.getLastArg(options::OPT_mpatmos_link_server_EQ)) {
+    LinkArgs.push_back(Args.MakeArgString(Twine("-connect=") +
+                                          A->getValue()));
+  }
+
+  // keep the module of every stage, named like the output
+  if (Args.hasArg(options::OPT_save_temps) && Output.isFilename()) {
+    LinkArgs.push_back(Args.MakeArgString(
+                        Twine("-save-temps=") + Output.getFilename()));
+  }
+
+  if(Args.hasArg(options::OPT_v)) {
+    LinkArgs.push_back("-v");
+  }
+
+  //----------------------------------------------------------------------------
+  // append output and input files
+
+  assert(!OutputFilenames.empty());
+  for (const char *OutputFilename : OutputFilenames) {
+    LinkArgs.push_back("-o");
+    LinkArgs.push_back(OutputFilename);
+  }
+
+  for (InputInfoList::const_iterator
+          it = Inputs.begin(), ie = Inputs.end(); it != ie; ++it) {
+     const InputInfo &II = *it;
+
+     if (II.isFilename() && !(NativeObjects && isNativeInput(II))) {
+       LinkArgs.push_back(II.getFilename());
+     }
+  }
+
+  const char *LinkExec = Args.MakeArgString(get_patmos_tool(TC, "patmos-link"));
+  C.addCommand(std::make_unique<Command>(
+      JA, Creator, ResponseFileSupport::AtFileCurCP(),
+      LinkExec, LinkArgs, Inputs, Output));
+}
+
 static std::string get_patmos_lld(const ToolChain &TC, DiagnosticsEngine &Diag)
 {
   char *gold_envvar = getenv("PATMOS_GOLD");
@@ -498,18 +807,31 @@ void patmos::PatmosBaseTool::ConstructLLDJob(const Tool &Creator,
 
   LDArgs.push_back("-nostdlib");
   LDArgs.push_back("-static");
-  // String merging seems to also change data saved as floats or doubles. Disable it to avoid the unwanted changes.
-  LDArgs.push_back("-O0");
 
+  // remove unused functions and data, and fold identical functions, at the
+  // granularity of their sections; -Wl,--no-gc-sections still overrides it
+  if (hasFunctionSections(Args) || hasDataSections(Args))
+    LDArgs.push_back("--gc-sections");
+  if (Args.hasArg(options::OPT_mpatmos_icf))
+    LDArgs.push_back("--icf=safe");
+  if (Args.hasArg(options::OPT_mpatmos_native_objects))
+    LDArgs.push_back("--patmos-check-summaries");
+
+  // the heap takes the lower half of the memory, the shadow stack and the
+  // stack cache grow down from its end
+  PatmosBoard Board = getBoard(Args);
   LDArgs.push_back("--defsym");
   LDArgs.push_back("__heap_start=end");
   LDArgs.push_back("--defsym");
-  LDArgs.push_back("__heap_end=0x100000");
+  LDArgs.push_back(Args.MakeArgString("__heap_end=0x" +
+                       llvm::utohexstr(Board.MemorySize / 2, true)));
   if (AddStackSymbols) {
     LDArgs.push_back("--defsym");
-    LDArgs.push_back("_shadow_stack_base=0x1f8000");
+    LDArgs.push_back(Args.MakeArgString("_shadow_stack_base=0x" +
+        llvm::utohexstr(Board.MemorySize - Board.ShadowStackSize, true)));
     LDArgs.push_back("--defsym");
-    LDArgs.push_back("_stack_cache_base=0x200000");
+    LDArgs.push_back(Args.MakeArgString("_stack_cache_base=0x" +
+                         llvm::utohexstr(Board.MemorySize, true)));
   }
 
   // Do not append arguments given from the Commandline before
@@ -527,6 +849,18 @@ void patmos::PatmosBaseTool::ConstructLLDJob(const Tool &Creator,
   if (Args.hasArg(options::OPT_v))
     LDArgs.push_back("-verbose");
 
+  if (const Arg *A = Args.getLastArg(options::OPT_gz_EQ)) {
+    StringRef Value = A->getValue();
+    if (Value != "none" && Value != "zlib")
+      C.getDriver().Diag(diag::err_drv_unsupported_option_argument)
+        << A->getOption().getName() << Value;
+    else if (Value == "zlib" && !llvm::zlib::isAvailable())
+      C.getDriver().Diag(diag::warn_debug_compression_unavailable);
+    else if (hasDebugInfo(Args))
+      LDArgs.push_back(Args.MakeArgString("--compress-debug-sections=" +
+                                          Twine(Value)));
+  }
+
   //----------------------------------------------------------------------------
   // append output file for code generation
 
@@ -566,10 +900,12 @@ void patmos::Compile::ConstructJob(Compilation &C, const JobAction &JA,
     BackendJobAction prelink_job((Action*) &JA, types::TY_LLVM_BC);
 
     if( C.getActions().size() > 0 &&
-        matchesJob(**C.getActions().begin(), types::TY_Image, Action::LinkJobClass)
+        matchesJob(**C.getActions().begin(), types::TY_Image, Action::LinkJobClass) &&
+        !Args.hasArg(options::OPT_mpatmos_native_objects)
     ){
       // The ultimate job is to produce an executable, therefore, produce only bitcode
-      // which is compiled into machine code in FinalLink
+      // which is compiled into machine code in FinalLink, unless native objects
+      // are linked
       Clang::ConstructJob(C, prelink_job, Output, Inputs, Args, LinkingOutput);
     } else {
       // We just need an object file
@@ -598,6 +934,45 @@ void patmos::FinalLink::ConstructJob(Compilation &C, const JobAction &JA,
                                const ArgList &Args,
                                const char *LinkingOutput) const
 {
+  Arg *PartitionsArg = Args.getLastArg(options::OPT_mpatmos_codegen_partitions_EQ);
+  bool NativeObjects = Args.hasArg(options::OPT_mpatmos_native_objects);
+  if (NativeObjects ||
+      Args.hasFlag(options::OPT_mpatmos_in_process_link,
+                   options::OPT_mno_patmos_in_process_link,
+                   PartitionsArg != nullptr ||
+                   Args.hasArg(options::OPT_mpatmos_codegen_cache_EQ) ||
+                   Args.hasArg(options::OPT_mpatmos_link_server_EQ))) {
+    unsigned Partitions = 1;
+    if (PartitionsArg &&
+        (StringRef(PartitionsArg->getValue()).getAsInteger(10, Partitions) ||
+         Partitions == 0)) {
+      C.getDriver().Diag(diag::err_drv_invalid_int_value)
+        << PartitionsArg->getAsString(Args) << PartitionsArg->getValue();
+      Partitions = 1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // build a single LINK, OPT and LLC command, with one object per partition
+    ArgStringList LLDInputs;
+    for (unsigned i = 0; i < Partitions; i++) {
+      std::string Suffix = i == 0 ? "o" : (Twine(i) + ".o").str();
+      LLDInputs.push_back(CreateOutputFilename(C, Output, "link-",
+                                               Args.MakeArgString(Suffix),
+                                               false));
+    }
+    ConstructPatmosLinkJob(*this, C, JA, Output, Inputs, LLDInputs, Args);
+
+    // the native objects follow the start-up code and libraries
+    if (NativeObjects)
+      for (const InputInfo &II : Inputs)
+        if (isNativeInput(II))
+          LLDInputs.push_back(II.getFilename());
+
+    ConstructLLDJob(*this, C, JA, Output, Inputs, Output.getFilename(),
+        LLDInputs, Args, true);
+    return;
+  }
+
   //////////////////////////////////////////////////////////////////////////////
   // build LINK 1 command
   const char *link1Out = CreateOutputFilename(C, Output, "link-", "bc", false);
@@ -54,9 +54,42 @@ public:
   PatmosBaseTool(const clang::driver::toolchains::PatmosToolChain &TC): TC(TC)
   {}
 
+  /// PatmosBoard - Memory map and cache sizes of a Patmos board.
+  struct PatmosBoard {
+    const char *Name;
+    /// Size of the main memory, the stack cache spills to its end.
+    uint64_t MemorySize;
+    /// Size of the shadow stack, placed below the stack cache spill area.
+    uint64_t ShadowStackSize;
+    unsigned StackCacheSize;
+    unsigned MethodCacheSize;
+  };
+
 protected:
   const clang::driver::toolchains::PatmosToolChain &TC;
 
+  /// Get the board selected by -mpatmos-board=, with the memory size given
+  /// by -mpatmos-memory-size=, if any.
+  PatmosBoard getBoard(const llvm::opt::ArgList &Args) const;
+
+  /// Add the processor given by -mcpu and the cache sizes of the board as
+  /// options for code generation. The cache sizes are not added if they are
+  /// given by -mllvm, or if only a processor is given.
+  void AddBoardCacheArgs(const llvm::opt::ArgList &Args,
+                         llvm::opt::ArgStringList &CmdArgs) const;
+
+  /// Add the options for the split DWARF and the compressed debug sections
+  /// of the code generated for Output, in the given number of partitions.
+  void AddDebugCodeGenArgs(const llvm::opt::ArgList &Args,
+                           const InputInfo &Output, unsigned Partitions,
+                           llvm::opt::ArgStringList &CmdArgs) const;
+
+  /// Add the options for code generation that emit every function or data
+  /// object into a section of its own, for -ffunction-sections,
+  /// -fdata-sections and -mpatmos-icf.
+  void AddSectionCodeGenArgs(const llvm::opt::ArgList &Args,
+                             llvm::opt::ArgStringList &CmdArgs) const;
+
   const char * CreateOutputFilename(Compilation &C, const InputInfo &Output,
                                     const char * TmpPrefix,
                                     const char *Suffix,
@@ -106,6 +139,16 @@ protected:
                     const char *InputFilename,
                     const llvm::opt::ArgList &TCArgs) const;
 
+  /// Construct a single patmos-link job, which links, optimizes and compiles
+  /// the program and libraries within one process. Code is generated in
+  /// parallel into one object file per output file.
+  void ConstructPatmosLinkJob(const Tool &Creator, Compilation &C,
+                              const JobAction &JA,
+                              const InputInfo &Output,
+                              const InputInfoList &Inputs,
+                              const llvm::opt::ArgStringList &OutputFilenames,
+                              const llvm::opt::ArgList &TCArgs) const;
+
   void ConstructLLDJob(const Tool &Creator, Compilation &C,
                         const JobAction &JA,
                         const InputInfo &Output,
@@ -0,0 +1,137 @@
+/*===---- patmos_dma.h - Patmos scratchpad DMA transfers -------------------===
+ *
+ * Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ *
+ *===-----------------------------------------------------------------------===
+ *
+ * Asynchronous DMA transfers of the network interface of multicore Patmos
+ * platforms (T-CREST) from the local scratchpad to the scratchpad of another
+ * core, and a double buffer to overlap computation and communication.
+ *
+ * The network interface has a table of DMA entries, one per channel, in the
+ * local I/O space. A transfer copies whole words between the communication
+ * scratchpads, whose addresses are the same on all cores. The defaults are
+ * the addresses of the T-CREST network interface, define the macros before
+ * including this file for other platforms.
+ *
+ * Waiting polls the table entry. Its loop bound is the worst-case number of
+ * polls until a transfer completes, which depends on the schedule of the
+ * network, define PATMOS_DMA_MAX_POLLS for the WCET analysis.
+ *
+ *===-----------------------------------------------------------------------===
+ */
+
+#ifndef __PATMOS_DMA_H
+#define __PATMOS_DMA_H
+
+#ifndef __patmos__
+#error "patmos_dma.h is only available for Patmos."
+#endif
+
+#ifndef PATMOS_DMA_TABLE
+#define PATMOS_DMA_TABLE 0xE0000000u
+#endif
+
+#ifndef PATMOS_DMA_SPM_BASE
+#define PATMOS_DMA_SPM_BASE 0xE8000000u
+#endif
+
+#ifndef PATMOS_DMA_MAX_POLLS
+#define PATMOS_DMA_MAX_POLLS 1024
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define __DEFAULT_FN_ATTRS __attribute__((__always_inline__, __nodebug__))
+
+/* The DMA table entry of a channel, two words each. */
+static __inline__ void *__DEFAULT_FN_ATTRS
+__patmos_dma_entry(unsigned __channel) {
+  return (void *)(PATMOS_DMA_TABLE + __channel * 8);
+}
+
+/* The word offset of a scratchpad address. */
+static __inline__ unsigned __DEFAULT_FN_ATTRS
+__patmos_dma_offset(const volatile __patmos_spm void *__p) {
+  return ((unsigned)__p - PATMOS_DMA_SPM_BASE) / 4;
+}
+
+/* Return non-zero if the last transfer of the channel has completed. */
+static __inline__ int __DEFAULT_FN_ATTRS patmos_dma_done(unsigned __channel) {
+  return __builtin_patmos_dma_done(__patmos_dma_entry(__channel));
+}
+
+/* Wait until the last transfer of the channel has completed. */
+static __inline__ void __DEFAULT_FN_ATTRS patmos_dma_wait(unsigned __channel) {
+  _Pragma("loopbound min 0 max PATMOS_DMA_MAX_POLLS")
+  while (!patmos_dma_done(__channel))
+    ;
+}
+
+/* Start a transfer of __size bytes, rounded up to words, from the local
+ * scratchpad to the scratchpad of the core the channel is routed to. Return
+ * zero without starting it if the last transfer of the channel is still
+ * active. */
+static __inline__ int __DEFAULT_FN_ATTRS
+patmos_dma_start(unsigned __channel, volatile __patmos_spm void *__dst,
+                 const volatile __patmos_spm void *__src, unsigned __size) {
+  if (!patmos_dma_done(__channel))
+    return 0;
+  __builtin_patmos_dma_start(__patmos_dma_entry(__channel),
+                             __patmos_dma_offset(__dst),
+                             __patmos_dma_offset(__src), (__size + 3) / 4);
+  return 1;
+}
+
+/* A double buffer of a producer. One buffer is filled while the other one
+ * is transferred to the matching buffer of the consumer. */
+typedef struct {
+  unsigned channel;
+  unsigned current;
+  volatile __patmos_spm void *local[2];
+  volatile __patmos_spm void *remote[2];
+} patmos_dma_dbuf;
+
+static __inline__ void __DEFAULT_FN_ATTRS
+patmos_dma_dbuf_init(patmos_dma_dbuf *__db, unsigned __channel,
+                     volatile __patmos_spm void *__local0,
+                     volatile __patmos_spm void *__local1,
+                     volatile __patmos_spm void *__remote0,
+                     volatile __patmos_spm void *__remote1) {
+  __db->channel = __channel;
+  __db->current = 0;
+  __db->local[0] = __local0;
+  __db->local[1] = __local1;
+  __db->remote[0] = __remote0;
+  __db->remote[1] = __remote1;
+}
+
+/* The buffer to fill next. Its last transfer has completed. */
+static __inline__ volatile __patmos_spm void *__DEFAULT_FN_ATTRS
+patmos_dma_dbuf_current(const patmos_dma_dbuf *__db) {
+  return __db->local[__db->current];
+}
+
+/* Send __size bytes of the current buffer and switch to the other one. This
+ * waits for the transfer of the other buffer only, which the caller filled
+ * before the last computation. */
+static __inline__ void __DEFAULT_FN_ATTRS
+patmos_dma_dbuf_send(patmos_dma_dbuf *__db, unsigned __size) {
+  unsigned __cur = __db->current;
+  patmos_dma_wait(__db->channel);
+  patmos_dma_start(__db->channel, __db->remote[__cur], __db->local[__cur],
+                   __size);
+  __db->current = __cur ^ 1;
+}
+
+#undef __DEFAULT_FN_ATTRS
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* __PATMOS_DMA_H */
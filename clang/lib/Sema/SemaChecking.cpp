@@ -1658,6 +1658,11 @@ bool Sema::CheckTSBuiltinFunctionCall(const TargetInfo &TI, unsigned BuiltinID,
   case llvm::Triple::riscv32:
   case llvm::Triple::riscv64:
     return CheckRISCVBuiltinFunctionCall(TI, BuiltinID, TheCall);
+  case llvm::Triple::patmos:
+    // the special registers s0 to s15
+    if (BuiltinID == Patmos::BI__builtin_patmos_mfs)
+      return SemaBuiltinConstantArgRange(TheCall, 0, 0, 15);
+    return false;
   }
 }
 
@@ -7313,6 +7313,32 @@ static void handleRISCVInterruptAttr(Sema &S, Decl *D,
   D->addAttr(::new (S.Context) RISCVInterruptAttr(S.Context, AL, Kind));
 }
 
+static void handlePatmosInterruptAttr(Sema &S, Decl *D,
+                                      const ParsedAttr &AL) {
+  if (!AL.checkExactlyNumArgs(S, 0))
+    return;
+
+  if (!isFunctionOrMethod(D)) {
+    S.Diag(D->getLocation(), diag::warn_attribute_wrong_decl_type)
+      << "'interrupt'" << ExpectedFunction;
+    return;
+  }
+
+  if (hasFunctionProto(D) && getFunctionOrMethodNumParams(D) != 0) {
+    S.Diag(D->getLocation(), diag::warn_interrupt_attribute_invalid)
+      << /*Patmos*/ 3 << 0;
+    return;
+  }
+
+  if (!getFunctionOrMethodResultType(D)->isVoidType()) {
+    S.Diag(D->getLocation(), diag::warn_interrupt_attribute_invalid)
+      << /*Patmos*/ 3 << 1;
+    return;
+  }
+
+  D->addAttr(::new (S.Context) PatmosInterruptAttr(S.Context, AL));
+}
+
 static void handleInterruptAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
   // Dispatch the interrupt attribute based on the current target.
   switch (S.Context.getTargetInfo().getTriple().getArch()) {
@@ -7337,6 +7363,9 @@ static void handleInterruptAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
   case llvm::Triple::riscv64:
     handleRISCVInterruptAttr(S, D, AL);
     break;
+  case llvm::Triple::patmos:
+    handlePatmosInterruptAttr(S, D, AL);
+    break;
   default:
     handleARMInterruptAttr(S, D, AL);
     break;
@@ -8108,6 +8137,18 @@ static AttrTy *mergeEnforceTCBAttrImpl(Sema &S, Decl *D, const AttrTy &AL) {
   return ::new(Context) AttrTy(Context, AL, AL.getTCBName());
 }
 
+static void handleRecursionDepthAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
+  uint32_t Depth;
+  if (!checkUInt32Argument(S, AL, AL.getArgAsExpr(0), Depth))
+    return;
+  if (Depth == 0) {
+    S.Diag(AL.getLoc(), diag::err_attribute_requires_positive_integer)
+        << AL << /*positive*/ 0;
+    return;
+  }
+  D->addAttr(::new (S.Context) RecursionDepthAttr(S.Context, AL, Depth));
+}
+
 static void handleSinglePathAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
   // check the attribute arguments.
   if (AL.getNumArgs()) {
@@ -8122,6 +8163,20 @@ static void handleSinglePathAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
   D->addAttr(::new (S.Context) SinglePathAttr(S.Context, AL));
 }
 
+static void handleConstantTimeAttr(Sema &S, Decl *D, const ParsedAttr &AL) {
+  // check the attribute arguments.
+  if (AL.getNumArgs()) {
+    S.Diag(AL.getLoc(), diag::err_attribute_wrong_number_arguments) << AL;
+    return;
+  }
+  // Attribute can only be applied to function types.
+  if (!isa<FunctionDecl>(D)) {
+    S.Diag(AL.getLoc(), diag::err_attribute_wrong_decl_type) << AL;
+    return;
+  }
+  D->addAttr(::new (S.Context) ConstantTimeAttr(S.Context, AL));
+}
+
 EnforceTCBAttr *Sema::mergeEnforceTCBAttr(Decl *D, const EnforceTCBAttr &AL) {
   return mergeEnforceTCBAttrImpl<EnforceTCBAttr, EnforceTCBLeafAttr>(
       *this, D, AL);
@@ -8799,6 +8854,12 @@ static void ProcessDeclAttribute(Sema &S, Scope *scope, Decl *D,
   case ParsedAttr::AT_SinglePath:
     handleSinglePathAttr(S, D, AL);
     break;
+  case ParsedAttr::AT_ConstantTime:
+    handleConstantTimeAttr(S, D, AL);
+    break;
+  case ParsedAttr::AT_RecursionDepth:
+    handleRecursionDepthAttr(S, D, AL);
+    break;
   }
 }
 
@@ -0,0 +1,67 @@
+/* ===-- addsf3.c - Implement __addsf3 -------------------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements single precision addition for the compiler_rt
+ * library, as single-path and optimized for Patmos. Subtractions use the
+ * generic __subsf3, which flips the sign of b.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a + b */
+COMPILER_RT_ABI fp_t
+__addsf3(fp_t a, fp_t b)
+{
+    rep_t aRep = toRep(a);
+    rep_t bRep = toRep(b);
+    rep_t aAbs = aRep & absMask;
+    rep_t bAbs = bRep & absMask;
+
+    /* x is the operand with the larger magnitude, it determines the sign and
+     * the exponent of the result */
+    rep_t swap = bAbs > aAbs;
+    rep_t x = swap ? bRep : aRep;
+    rep_t y = swap ? aRep : bRep;
+    rep_t sub = (x ^ y) & signBit;
+
+    int xe, ye;
+    rep_t xm = sf_unpack(x, &xe) << 3;
+    rep_t ym = sf_unpack(y, &ye) << 3;
+
+    /* align y, keeping the shifted out bits as sticky bit */
+    int d = xe - ye;
+    d = d > 31 ? 31 : d;
+    rep_t sticky = (ym & ~(~REP_C(0) << d)) != 0;
+    ym = (ym >> d) | sticky;
+
+    int e = xe;
+    rep_t m = sub ? xm - ym : xm + ym;
+    m = sf_normalize_carry(m, &e);
+
+    /* after a cancellation, shift the leading bit back to bit 26. Too small
+     * exponents are fixed by sf_round_pack, the shifted in bits are zero. */
+    int s = clzsi(m | 1) - 5;
+    m <<= s;
+    e -= s;
+
+    rep_t r = sf_round_pack(x & signBit, e, m);
+
+    /* exact zeros are positive, unless both operands are negative zeros */
+    r = m == 0 ? (sub ? 0 : x & signBit) : r;
+
+    /* infinities and NaNs */
+    rep_t xAbs = x & absMask;
+    rep_t yAbs = y & absMask;
+    r = xAbs == infRep ? x : r;
+    r = (xAbs == infRep) & (yAbs == infRep) & (sub != 0) ? qnanRep : r;
+    r = xAbs > infRep ? x | quietBit : r;
+    return fromRep(r);
+}
@@ -0,0 +1,107 @@
+/* ===-- atomic.c - Implement the __sync_* functions for Patmos ------------===
+ *
+ *               The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements the __sync_* functions the Patmos backend calls for
+ * atomic read-modify-write operations, compare-and-swap and fences, see
+ * PatmosISelLowering.cpp. Atomic loads and stores are inline uncached
+ * accesses and do not call into the runtime.
+ *
+ * Patmos has no atomic instructions. Every operation holds a lock while it
+ * reads and writes the memory through the uncached bypass. The lock and the
+ * invalidation of the data cache are platform specific, the platform, e.g.,
+ * the T-CREST multicore with its hardware lock unit, provides them by
+ * defining:
+ *
+ *   void __patmos_lock_acquire(void);
+ *   void __patmos_lock_release(void);
+ *   void __patmos_dcache_invalidate(void);
+ *
+ * The weak defaults do nothing, which is only correct on a single core
+ * without preemption.
+ *
+ * The WCET of an operation is the call, the worst-case time to acquire the
+ * lock, i.e., the lock unit's worst-case waiting time for the other cores,
+ * one uncached load and one uncached store, and the release. A fence costs
+ * the call and the invalidation, plus the misses of the following cached
+ * loads.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "../int_lib.h"
+
+#define _UNCACHED __attribute__((address_space(3)))
+
+__attribute__((weak)) void __patmos_lock_acquire(void) {}
+__attribute__((weak)) void __patmos_lock_release(void) {}
+__attribute__((weak)) void __patmos_dcache_invalidate(void) {}
+
+/* The __sync_* names are builtins of the compiler and cannot be defined
+ * directly, the functions are renamed by an assembler label instead. */
+#define SYNC_NAME(op, n) __patmos_sync_##op##_##n
+#define SYNC_DECL(type, op, n, ...)                                            \
+  COMPILER_RT_ABI type SYNC_NAME(op, n)(__VA_ARGS__)                           \
+      __asm__(SYMBOL_NAME(__sync_##op##_##n));                                 \
+  COMPILER_RT_ABI type SYNC_NAME(op, n)(__VA_ARGS__)
+
+/* Returns the old value at p, stores the value of the expression new */
+#define SYNC_FETCH_AND(op, type, n, new)                                       \
+  SYNC_DECL(type, fetch_and_##op, n, type *p, type v) {                        \
+    volatile _UNCACHED type *u = (volatile _UNCACHED type *)p;                 \
+    __patmos_lock_acquire();                                                   \
+    type old = *u;                                                             \
+    *u = (new);                                                                \
+    __patmos_lock_release();                                                   \
+    return old;                                                                \
+  }
+
+#define SYNC_ALL(type, stype, n)                                               \
+  SYNC_FETCH_AND(add, type, n, old + v)                                        \
+  SYNC_FETCH_AND(sub, type, n, old - v)                                        \
+  SYNC_FETCH_AND(and, type, n, old & v)                                        \
+  SYNC_FETCH_AND(or, type, n, old | v)                                         \
+  SYNC_FETCH_AND(xor, type, n, old ^ v)                                        \
+  SYNC_FETCH_AND(nand, type, n, ~(old & v))                                    \
+  SYNC_FETCH_AND(umin, type, n, old < v ? old : v)                             \
+  SYNC_FETCH_AND(umax, type, n, old > v ? old : v)                             \
+  SYNC_FETCH_AND(min, type, n, (stype)old < (stype)v ? old : v)                \
+  SYNC_FETCH_AND(max, type, n, (stype)old > (stype)v ? old : v)                \
+                                                                               \
+  SYNC_DECL(type, lock_test_and_set, n, type *p, type v) {                     \
+    volatile _UNCACHED type *u = (volatile _UNCACHED type *)p;                 \
+    __patmos_lock_acquire();                                                   \
+    type old = *u;                                                             \
+    *u = v;                                                                    \
+    __patmos_lock_release();                                                   \
+    return old;                                                                \
+  }                                                                            \
+                                                                               \
+  SYNC_DECL(type, val_compare_and_swap, n, type *p, type cmp, type v) {        \
+    volatile _UNCACHED type *u = (volatile _UNCACHED type *)p;                 \
+    __patmos_lock_acquire();                                                   \
+    type old = *u;                                                             \
+    if (old == cmp)                                                            \
+      *u = v;                                                                  \
+    __patmos_lock_release();                                                   \
+    return old;                                                                \
+  }
+
+SYNC_ALL(su_int, si_int, 4)
+SYNC_ALL(uint16_t, int16_t, 2)
+SYNC_ALL(uint8_t, int8_t, 1)
+
+/* Orders the memory accesses of all cores, the uncached stores are already
+ * visible in the memory, later cached loads must not hit stale data. */
+
+COMPILER_RT_ABI void __patmos_sync_synchronize(void)
+    __asm__(SYMBOL_NAME(__sync_synchronize));
+COMPILER_RT_ABI void __patmos_sync_synchronize(void) {
+  __asm__ volatile("" ::: "memory");
+  __patmos_dcache_invalidate();
+}
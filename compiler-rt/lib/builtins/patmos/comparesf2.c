@@ -0,0 +1,64 @@
+/* ===-- comparesf2.c - Implement single precision comparisons -------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements the single precision comparisons for the compiler_rt
+ * library, as single-path and optimized for Patmos. See the generic
+ * comparesf2.c for the semantics of the results.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+#include "../fp_compare_impl.inc"
+
+/* Compare a and b, returning unordered for NaNs. */
+static __inline CMP_RESULT sf_compare(fp_t a, fp_t b, CMP_RESULT unordered)
+{
+    rep_t aRep = toRep(a);
+    rep_t bRep = toRep(b);
+    rep_t aAbs = aRep & absMask;
+    rep_t bAbs = bRep & absMask;
+
+    /* flip the magnitude bits of negative numbers, such that the values
+     * compare as signed integers */
+    srep_t aKey = aRep ^ ((srep_t)aRep >> 31 & absMask);
+    srep_t bKey = bRep ^ ((srep_t)bRep >> 31 & absMask);
+    CMP_RESULT r = (aKey > bKey) - (aKey < bKey);
+
+    /* +0 == -0 */
+    r = (aAbs | bAbs) == 0 ? LE_EQUAL : r;
+    r = (aAbs > infRep) | (bAbs > infRep) ? unordered : r;
+    return r;
+}
+
+COMPILER_RT_ABI CMP_RESULT __lesf2(fp_t a, fp_t b)
+{
+    return sf_compare(a, b, LE_UNORDERED);
+}
+
+#if defined(__ELF__)
+/* Alias for libgcc compatibility */
+COMPILER_RT_ALIAS(__lesf2, __cmpsf2)
+#endif
+COMPILER_RT_ALIAS(__lesf2, __eqsf2)
+COMPILER_RT_ALIAS(__lesf2, __ltsf2)
+COMPILER_RT_ALIAS(__lesf2, __nesf2)
+
+COMPILER_RT_ABI CMP_RESULT __gesf2(fp_t a, fp_t b)
+{
+    return sf_compare(a, b, GE_UNORDERED);
+}
+
+COMPILER_RT_ALIAS(__gesf2, __gtsf2)
+
+COMPILER_RT_ABI CMP_RESULT __unordsf2(fp_t a, fp_t b)
+{
+    return ((toRep(a) & absMask) > infRep) | ((toRep(b) & absMask) > infRep);
+}
@@ -0,0 +1,60 @@
+/* ===-- divsf3.c - Implement __divsf3 -------------------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements single precision division for the compiler_rt
+ * library, as single-path and optimized for Patmos.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a / b */
+COMPILER_RT_ABI fp_t
+__divsf3(fp_t a, fp_t b)
+{
+    rep_t aRep = toRep(a);
+    rep_t bRep = toRep(b);
+    rep_t aAbs = aRep & absMask;
+    rep_t bAbs = bRep & absMask;
+    rep_t sign = (aRep ^ bRep) & signBit;
+
+    int ae, be;
+    rep_t am = sf_unpack_normalized(aRep, &ae);
+    rep_t bm = sf_unpack_normalized(bRep, &be);
+
+    /* scale the dividend such that the quotient is in [1, 2) */
+    rep_t lt = am < bm;
+    am <<= lt;
+    int e = ae - be + exponentBias - lt;
+
+    /* Branch-free restoring division for the 27 bits of the significand and
+     * the guard bits, as in __udivsi3. The remainder stays below 2^25. */
+    rep_t r = am;
+    rep_t q = 0;
+    #pragma loopbound min 27 max 27
+    for (int i = 0; i < 27; i++) {
+        rep_t ge = r >= bm;
+        r -= bm & -ge;
+        q = (q << 1) | ge;
+        r <<= 1;
+    }
+    rep_t m = q | (r != 0);
+
+    rep_t res = sf_round_pack(sign, e, m);
+
+    /* zeros, infinities and NaNs */
+    res = (aAbs == 0) | (bAbs == infRep) ? sign : res;
+    res = (aAbs == infRep) | (bAbs == 0) ? sign | infRep : res;
+    res = ((aAbs == 0) & (bAbs == 0)) | ((aAbs == infRep) & (bAbs == infRep)) ?
+            qnanRep : res;
+    res = bAbs > infRep ? bRep | quietBit : res;
+    res = aAbs > infRep ? aRep | quietBit : res;
+    return fromRep(res);
+}
@@ -0,0 +1,32 @@
+/* ===-- fixsfsi.c - Implement __fixsfsi -----------------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements __fixsfsi for the compiler_rt library,
+ * as single-path and optimized for Patmos.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a converted to an int, rounding toward zero. Values out of range
+ * saturate, as in the generic implementation. */
+COMPILER_RT_ABI si_int
+__fixsfsi(fp_t a)
+{
+    rep_t aRep = toRep(a);
+    int exponent = (int)((aRep & absMask) >> significandBits) - exponentBias;
+    su_int abs = sf_to_uint(aRep, exponent);
+    rep_t neg = aRep & signBit;
+
+    si_int r = neg ? -(si_int)abs : (si_int)abs;
+    r = exponent < 0 ? 0 : r;
+    r = exponent > 30 ? (neg ? INT_MIN : INT_MAX) : r;
+    return r;
+}
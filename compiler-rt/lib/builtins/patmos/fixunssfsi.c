@@ -0,0 +1,30 @@
+/* ===-- fixunssfsi.c - Implement __fixunssfsi -----------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements __fixunssfsi for the compiler_rt library,
+ * as single-path and optimized for Patmos.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a converted to an unsigned int, rounding toward zero. Negative
+ * values become zero, values out of range saturate. */
+COMPILER_RT_ABI su_int
+__fixunssfsi(fp_t a)
+{
+    rep_t aRep = toRep(a);
+    int exponent = (int)((aRep & absMask) >> significandBits) - exponentBias;
+    su_int r = sf_to_uint(aRep, exponent);
+    r = exponent < 0 ? 0 : r;
+    r = exponent > 31 ? ~(su_int)0 : r;
+    r = aRep & signBit ? 0 : r;
+    return r;
+}
@@ -0,0 +1,26 @@
+/* ===-- floatsisf.c - Implement __floatsisf -------------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements __floatsisf for the compiler_rt library,
+ * as single-path and optimized for Patmos.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a converted to a float */
+COMPILER_RT_ABI fp_t
+__floatsisf(si_int a)
+{
+    rep_t sign = (rep_t)a & signBit;
+    su_int abs = sign ? -(su_int)a : (su_int)a;
+    rep_t r = sf_from_uint(sign, abs);
+    return fromRep(a == 0 ? 0 : r);
+}
@@ -0,0 +1,24 @@
+/* ===-- floatunsisf.c - Implement __floatunsisf ---------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements __floatunsisf for the compiler_rt library,
+ * as single-path and optimized for Patmos.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a converted to a float */
+COMPILER_RT_ABI fp_t
+__floatunsisf(su_int a)
+{
+    rep_t r = sf_from_uint(0, a);
+    return fromRep(a == 0 ? 0 : r);
+}
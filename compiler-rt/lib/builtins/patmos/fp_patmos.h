@@ -0,0 +1,98 @@
+/* ===-- fp_patmos.h - Single precision helpers for Patmos -----------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * Helpers shared by the single precision soft-float routines for Patmos.
+ *
+ * The routines are written without data-dependent branches: special cases
+ * are computed alongside the regular result and selected at the end, which
+ * the compiler maps to predicated instructions. Significands are kept with
+ * the implicit bit at bit 26, followed by the 23 fraction bits and three
+ * bits for guard, round and sticky.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#ifndef FP_PATMOS_HEADER
+#define FP_PATMOS_HEADER
+
+#define SINGLE_PRECISION
+#include "../fp_lib.h"
+
+/* Split a into its significand, with the implicit bit at bit 23 for normal
+ * numbers, and its biased exponent, which is 1 for subnormal numbers. */
+static __inline rep_t sf_unpack(rep_t aRep, int *exp) {
+    int e = (aRep >> significandBits) & maxExponent;
+    rep_t m = (aRep & significandMask) | ((rep_t)(e != 0) << significandBits);
+    *exp = e + (e == 0);
+    return m;
+}
+
+/* Like sf_unpack, but shifts the significands of subnormal numbers up such
+ * that the leading bit is at bit 23, adjusting the exponent accordingly. The
+ * significand of zero stays zero. */
+static __inline rep_t sf_unpack_normalized(rep_t aRep, int *exp) {
+    int e;
+    rep_t m = sf_unpack(aRep, &e);
+    int s = clzsi(m | 1) - (typeWidth - 1 - significandBits);
+    *exp = e - s;
+    return m << s;
+}
+
+/* Round the significand m (leading bit at bit 26 or below, see above) to
+ * nearest even and pack it with the sign and the biased exponent e. Results
+ * below the normal range are denormalized, results above it become infinity.
+ * The significand must not be zero. */
+static __inline rep_t sf_round_pack(rep_t sign, int e, rep_t m) {
+    /* denormalize, keeping the shifted out bits as sticky bit */
+    int s = 1 - e;
+    s = s < 0 ? 0 : s;
+    s = s > 31 ? 31 : s;
+    rep_t sticky = (m & ~(~REP_C(0) << s)) != 0;
+    m = (m >> s) | sticky;
+    e = e < 1 ? 1 : e;
+
+    /* the implicit bit is added to the exponent, such that a subnormal result
+     * becomes normal if rounding carries into it */
+    rep_t r = ((rep_t)(e - 1) << significandBits) + (m >> 3);
+    rep_t grs = m & 7;
+    r += (grs > 4) | ((grs == 4) & r & 1);
+
+    r = e >= maxExponent ? infRep : r;
+    return sign | r;
+}
+
+/* Normalize a significand that may have carried into bit 27. */
+static __inline rep_t sf_normalize_carry(rep_t m, int *e) {
+    rep_t carry = m >> 27;
+    *e += carry;
+    return (m >> carry) | (m & carry);
+}
+
+/* Convert the non-zero magnitude a with the given sign to single precision,
+ * rounding to nearest even. */
+static __inline rep_t sf_from_uint(rep_t sign, su_int a) {
+    /* move the leading bit to bit 26, keeping shifted out bits as sticky */
+    int lz = clzsi(a | 1);
+    int s = 5 - lz;
+    s = s < 0 ? 0 : s;
+    rep_t sticky = (a & ~(~REP_C(0) << s)) != 0;
+    rep_t m = ((a >> s) | sticky) << (s == 0 ? lz - 5 : 0);
+    return sf_round_pack(sign, exponentBias + 31 - lz, m);
+}
+
+/* Return the magnitude of a truncated to an integer, for unbiased exponents
+ * in [0, 31]. */
+static __inline su_int sf_to_uint(rep_t aRep, int exponent) {
+    rep_t m = (aRep & significandMask) | implicitBit;
+    /* the significand is moved to the top first, such that a single right
+     * shift truncates */
+    return (m << 8) >> (31 - (exponent & 31));
+}
+
+#endif /* FP_PATMOS_HEADER */
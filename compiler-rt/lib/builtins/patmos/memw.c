@@ -0,0 +1,58 @@
+/* ===-- memw.c - Implement __patmos_memcpy_w and __patmos_memset_w --------===
+ *
+ *               The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements the word-aligned memcpy and memset helpers the Patmos
+ * backend calls for large copies of constant size.
+ *
+ * The backend never calls the helpers with more than
+ * PATMOS_MEM_HELPER_MAX_WORDS words, the loops are bounded accordingly for
+ * the WCET analysis.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "../int_lib.h"
+
+#define PATMOS_MEM_HELPER_MAX_WORDS 16384
+
+/* Copies n words from s to d, both must be word aligned. */
+
+COMPILER_RT_ABI void
+__patmos_memcpy_w(su_int *d, const su_int *s, su_int n)
+{
+    if (n & 1) {
+        *d++ = *s++;
+    }
+    /* two words per iteration, both loads are issued before the stores */
+    #pragma loopbound min 0 max 8192
+    for (n >>= 1; n != 0; n--) {
+        su_int a = s[0];
+        su_int b = s[1];
+        d[0] = a;
+        d[1] = b;
+        d += 2;
+        s += 2;
+    }
+}
+
+/* Sets n words at d to w, d must be word aligned. */
+
+COMPILER_RT_ABI void
+__patmos_memset_w(su_int *d, su_int w, su_int n)
+{
+    if (n & 1) {
+        *d++ = w;
+    }
+    #pragma loopbound min 0 max 8192
+    for (n >>= 1; n != 0; n--) {
+        d[0] = w;
+        d[1] = w;
+        d += 2;
+    }
+}
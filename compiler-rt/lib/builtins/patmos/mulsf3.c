@@ -0,0 +1,49 @@
+/* ===-- mulsf3.c - Implement __mulsf3 -------------------------------------===
+ *
+ *                     The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements single precision multiplication for the compiler_rt
+ * library, as single-path and optimized for Patmos.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "fp_patmos.h"
+
+/* Returns: a * b */
+COMPILER_RT_ABI fp_t
+__mulsf3(fp_t a, fp_t b)
+{
+    rep_t aRep = toRep(a);
+    rep_t bRep = toRep(b);
+    rep_t aAbs = aRep & absMask;
+    rep_t bAbs = bRep & absMask;
+    rep_t sign = (aRep ^ bRep) & signBit;
+
+    int ae, be;
+    rep_t am = sf_unpack_normalized(aRep, &ae);
+    rep_t bm = sf_unpack_normalized(bRep, &be);
+
+    /* a single multu, the product of the significands is in [2^46, 2^48).
+     * Keep 27 or 28 bits and fold the rest into the sticky bit. */
+    du_int p = (du_int)am * bm;
+    rep_t m = (rep_t)(p >> 20) | (((rep_t)p & 0xfffff) != 0);
+    int e = ae + be - exponentBias;
+    m = sf_normalize_carry(m, &e);
+
+    rep_t r = sf_round_pack(sign, e, m);
+    r = (aAbs == 0) | (bAbs == 0) ? sign : r;
+
+    /* infinities and NaNs */
+    r = (aAbs == infRep) | (bAbs == infRep) ? sign | infRep : r;
+    r = ((aAbs == infRep) & (bAbs == 0)) | ((bAbs == infRep) & (aAbs == 0)) ?
+          qnanRep : r;
+    r = bAbs > infRep ? bRep | quietBit : r;
+    r = aAbs > infRep ? aRep | quietBit : r;
+    return fromRep(r);
+}
@@ -0,0 +1,62 @@
+/* ===-- profile.c - Access the profile records of -mpatmos-profile --------===
+ *
+ *               The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements the access to the profile records the Patmos backend
+ * creates with -mpatmos-profile, see PatmosProfileInstrumentation.cpp. The
+ * records of all modules are collected by the linker in the section
+ * patmos_profile. The program dumps them with __patmos_profile_foreach at a
+ * point of its choice, e.g., at the end of main, through its own output.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include "../int_lib.h"
+
+/* In sync with PatmosProfileInstrumentation.cpp */
+struct __patmos_profile_record {
+    du_int cycles;
+    su_int count;
+    su_int kind;
+    const char *name;
+    su_int line;
+};
+
+typedef void (*__patmos_profile_fn)(const char *name, su_int kind,
+                                    su_int line, su_int count, du_int cycles);
+
+/* Defined by the linker if any module was instrumented */
+extern struct __patmos_profile_record __start_patmos_profile[]
+    __attribute__((weak));
+extern struct __patmos_profile_record __stop_patmos_profile[]
+    __attribute__((weak));
+
+/* Calls fn for every profile record that was executed. */
+
+COMPILER_RT_ABI void
+__patmos_profile_foreach(__patmos_profile_fn fn)
+{
+    struct __patmos_profile_record *r;
+    for (r = __start_patmos_profile; r != __stop_patmos_profile; r++) {
+        if (r->count)
+            fn(r->name, r->kind, r->line, r->count, r->cycles);
+    }
+}
+
+/* Clears all profile records, e.g., after the initialization of the
+ * program. */
+
+COMPILER_RT_ABI void
+__patmos_profile_reset(void)
+{
+    struct __patmos_profile_record *r;
+    for (r = __start_patmos_profile; r != __stop_patmos_profile; r++) {
+        r->cycles = 0;
+        r->count = 0;
+    }
+}
@@ -0,0 +1,209 @@
+/* ===-- string.c - Implement strlen, strcmp, memcmp and memchr -----------===
+ *
+ *               The LLVM Compiler Infrastructure
+ *
+ * This file is dual licensed under the MIT and the University of Illinois Open
+ * Source Licenses. See LICENSE.TXT for details.
+ *
+ * ===----------------------------------------------------------------------===
+ *
+ * This file implements word-at-a-time versions of strlen, strcmp, memcmp and
+ * memchr for Patmos, which replace the byte-wise generic versions of newlib.
+ * The driver links them as an override library after libc if
+ * -mpatmos-word-string is given.
+ *
+ * Aligned words are read as a whole and checked for a zero byte without a
+ * branch per byte. Patmos is big endian, the byte at the lowest address is
+ * the most significant byte of a word, so words compare like strings. Loads
+ * never cross the word containing the end of the string or buffer, the
+ * routines do not read beyond the words the generic versions access.
+ *
+ * WCET: the loop bounds assume strings and buffers of at most
+ * PATMOS_STRING_MAX_BYTES bytes, longer arguments invalidate them. In
+ * single-path code every loop runs to its bound, each call then costs the
+ * time of the longest argument. Both
+ * macros can be changed when building the library, the main loops handle two
+ * words per iteration and are bounded by PATMOS_STRING_MAX_ITERATIONS, which
+ * must be PATMOS_STRING_MAX_BYTES / 8. Besides the main loop, each routine
+ * takes at most 3 bytes to reach an aligned word, and at most 4 bytes (7 for
+ * memchr) to locate the end in the last words. strcmp and memcmp fall back
+ * to a loop over all bytes if the arguments are aligned differently.
+ *
+ * ===----------------------------------------------------------------------===
+ */
+
+#include <stddef.h>
+
+#include "../int_lib.h"
+
+#ifndef PATMOS_STRING_MAX_BYTES
+#define PATMOS_STRING_MAX_BYTES 8192
+#endif
+
+#ifndef PATMOS_STRING_MAX_ITERATIONS
+#define PATMOS_STRING_MAX_ITERATIONS 1024
+#endif
+
+/* Words may alias the characters of the strings. */
+typedef su_int __attribute__((__may_alias__)) word_t;
+
+#define ONES 0x01010101U
+#define HIGHS 0x80808080U
+
+/* Returns the high bit of each zero byte of w, exact for every byte. */
+static inline su_int zero_bytes(su_int w)
+{
+    return ~(((w & ~HIGHS) + ~HIGHS) | w | ~HIGHS);
+}
+
+/* Returns the index of the first byte flagged in m, m must not be zero. */
+static inline su_int first_byte(su_int m)
+{
+    return (m < 0x80000000U) + (m < 0x00800000U) + (m < 0x00008000U);
+}
+
+static inline int is_aligned(const void *p)
+{
+    return ((su_int)p & 3) == 0;
+}
+
+size_t strlen(const char *s)
+{
+    const char *p = s;
+    #pragma loopbound min 0 max 3
+    for (; !is_aligned(p); p++) {
+        if (*p == 0)
+            return p - s;
+    }
+
+    const word_t *w = (const word_t *)p;
+    su_int m;
+    #pragma loopbound min 0 max PATMOS_STRING_MAX_ITERATIONS
+    for (;;) {
+        if ((m = zero_bytes(w[0])) != 0)
+            break;
+        if ((m = zero_bytes(w[1])) != 0) {
+            w++;
+            break;
+        }
+        w += 2;
+    }
+    return (const char *)w - s + first_byte(m);
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+
+    if ((((su_int)p1 ^ (su_int)p2) & 3) == 0) {
+        #pragma loopbound min 0 max 3
+        for (; !is_aligned(p1); p1++, p2++) {
+            if (*p1 == 0 || *p1 != *p2)
+                return *p1 - *p2;
+        }
+
+        /* skip the equal words, the rest is compared byte-wise below */
+        const word_t *w1 = (const word_t *)p1;
+        const word_t *w2 = (const word_t *)p2;
+        #pragma loopbound min 0 max PATMOS_STRING_MAX_ITERATIONS
+        for (;;) {
+            su_int a = w1[0];
+            if (a != w2[0] || zero_bytes(a) != 0)
+                break;
+            a = w1[1];
+            if (a != w2[1] || zero_bytes(a) != 0) {
+                w1++;
+                w2++;
+                break;
+            }
+            w1 += 2;
+            w2 += 2;
+        }
+        p1 = (const unsigned char *)w1;
+        p2 = (const unsigned char *)w2;
+    }
+
+    #pragma loopbound min 0 max PATMOS_STRING_MAX_BYTES
+    while (*p1 != 0 && *p1 == *p2) {
+        p1++;
+        p2++;
+    }
+    return *p1 - *p2;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+
+    if ((((su_int)p1 ^ (su_int)p2) & 3) == 0) {
+        #pragma loopbound min 0 max 3
+        for (; n != 0 && !is_aligned(p1); n--, p1++, p2++) {
+            if (*p1 != *p2)
+                return *p1 - *p2;
+        }
+
+        /* big-endian words compare like their bytes */
+        const word_t *w1 = (const word_t *)p1;
+        const word_t *w2 = (const word_t *)p2;
+        #pragma loopbound min 0 max PATMOS_STRING_MAX_ITERATIONS
+        for (; n >= 8; n -= 8, w1 += 2, w2 += 2) {
+            su_int a = w1[0], b = w2[0];
+            if (a != b)
+                return a < b ? -1 : 1;
+            a = w1[1];
+            b = w2[1];
+            if (a != b)
+                return a < b ? -1 : 1;
+        }
+        if (n >= 4) {
+            su_int a = w1[0], b = w2[0];
+            if (a != b)
+                return a < b ? -1 : 1;
+            w1++;
+            w2++;
+            n -= 4;
+        }
+        p1 = (const unsigned char *)w1;
+        p2 = (const unsigned char *)w2;
+    }
+
+    #pragma loopbound min 0 max PATMOS_STRING_MAX_BYTES
+    for (; n != 0; n--, p1++, p2++) {
+        if (*p1 != *p2)
+            return *p1 - *p2;
+    }
+    return 0;
+}
+
+void *memchr(const void *s, int c, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    unsigned char b = (unsigned char)c;
+
+    #pragma loopbound min 0 max 3
+    for (; n != 0 && !is_aligned(p); n--, p++) {
+        if (*p == b)
+            return (void *)p;
+    }
+
+    /* the bytes equal to c become zero bytes */
+    const word_t *w = (const word_t *)p;
+    su_int pattern = b * ONES;
+    su_int m;
+    #pragma loopbound min 0 max PATMOS_STRING_MAX_ITERATIONS
+    for (; n >= 8; n -= 8, w += 2) {
+        if ((m = zero_bytes(w[0] ^ pattern)) != 0)
+            return (void *)((const unsigned char *)w + first_byte(m));
+        if ((m = zero_bytes(w[1] ^ pattern)) != 0)
+            return (void *)((const unsigned char *)(w + 1) + first_byte(m));
+    }
+
+    #pragma loopbound min 0 max 7
+    for (p = (const unsigned char *)w; n != 0; n--, p++) {
+        if (*p == b)
+            return (void *)p;
+    }
+    return NULL;
+}
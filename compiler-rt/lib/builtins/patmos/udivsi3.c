@@ -19,21 +19,19 @@
 COMPILER_RT_ABI su_int
 __udivsi3(su_int n, su_int d)
 {
-    /* This has ~430 cycles, bundling compiler should be able to bring this down to ~230 cycles 
-     * Should still be better than original C without branches due to lower data dependencies 
-     * TODO The compiler should be able to lower this to the code below in the future. */
+    /* Branch-free restoring division, one quotient bit per iteration. The
+     * quotient is shifted in from the right instead of setting bit i, which
+     * avoids long immediates. The compiler expands the same sequence inline
+     * with -mpatmos-inline-div. */
     unsigned r = 0;
     unsigned q = 0;
     #pragma loopbound min 32 max 32
     for (int i = 31; i >= 0; i--) {
-	r <<= 1;
-	// r[0] = n[i] -> should be p1 = btest n, i; (p1) or r = r, 1
-	r |= (n >> i) & 1;
-	if (r >= d) {
-	    r -= d;
-	    // should be bset!
-	    q |= (1 << i);
-	}
+        /* r < d before the shift, and r < 2^31 as long as d >= 2^31 */
+        r = (r << 1) | ((n >> i) & 1);
+        unsigned ge = r >= d;
+        r -= d & -ge;
+        q = (q << 1) | ge;
     }
     return q;
 }
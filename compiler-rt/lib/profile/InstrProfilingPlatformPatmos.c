@@ -0,0 +1,158 @@
+/*===- InstrProfilingPlatformPatmos.c - Profile data Patmos platform ------===*\
+|*
+|* Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+|* See https://llvm.org/LICENSE.txt for license information.
+|* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+|*
+\*===----------------------------------------------------------------------===*/
+/*
+ * This file implements the profile output for Patmos, which has no file
+ * system. At exit, or when __llvm_profile_write_file is called, the raw
+ * profile is written to the UART as hex digits, between two marker lines:
+ *
+ *   LLVM-PROFILE-BEGIN
+ *   <up to 32 bytes per line, as hex digits>
+ *   LLVM-PROFILE-END
+ *
+ * The host recovers the raw profile from the captured output, e.g., by
+ *
+ *   sed -n '/^LLVM-PROFILE-BEGIN/,/^LLVM-PROFILE-END/{//!p}' uart.log \
+ *     | xxd -r -p > default.profraw
+ *
+ * Alternatively, __llvm_profile_write_buffer writes the raw profile to
+ * memory, from where a debugger or the simulator extracts it.
+ *
+ * The sections of the profile data are registered at run time, see
+ * InstrProfilingPlatformOther.c.
+ */
+
+#if defined(__patmos__)
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "InstrProfiling.h"
+#include "InstrProfilingInternal.h"
+
+/* The UART of the Patmos boards is accessed by local loads and stores */
+#define PATMOS_IODEV __attribute__((address_space(1)))
+#define PATMOS_UART_STATUS ((volatile PATMOS_IODEV unsigned *)0xF0080000)
+#define PATMOS_UART_DATA ((volatile PATMOS_IODEV unsigned *)0xF0080004)
+#define PATMOS_UART_TRE 0x1
+
+#define BYTES_PER_LINE 32
+
+static void putChar(char C) {
+  while (!(*PATMOS_UART_STATUS & PATMOS_UART_TRE))
+    ;
+  *PATMOS_UART_DATA = (unsigned char)C;
+}
+
+static void putString(const char *S) {
+  while (*S)
+    putChar(*S++);
+}
+
+/* The number of bytes on the current line of hex digits */
+static unsigned LineBytes;
+
+static void putByte(uint8_t B) {
+  static const char Hex[] = "0123456789abcdef";
+  putChar(Hex[B >> 4]);
+  putChar(Hex[B & 0xf]);
+  if (++LineBytes == BYTES_PER_LINE) {
+    putChar('\n');
+    LineBytes = 0;
+  }
+}
+
+static uint32_t uartWriter(ProfDataWriter *This, ProfDataIOVec *IOVecs,
+                           uint32_t NumIOVecs) {
+  uint32_t I;
+  size_t J;
+  for (I = 0; I < NumIOVecs; I++) {
+    size_t Length = IOVecs[I].ElmSize * IOVecs[I].NumElm;
+    const uint8_t *Data = (const uint8_t *)IOVecs[I].Data;
+    if (!Data && !IOVecs[I].UseZeroPadding)
+      continue;
+    for (J = 0; J < Length; J++)
+      putByte(Data ? Data[J] : 0);
+  }
+  return 0;
+}
+
+/* There are no other threads, the interrupts of the program must not use
+ * value profiling. */
+COMPILER_RT_VISIBILITY
+uint32_t lprofBoolCmpXchg(void **Ptr, void *OldV, void *NewV) {
+  if (*Ptr != OldV)
+    return 0;
+  *Ptr = NewV;
+  return 1;
+}
+
+COMPILER_RT_VISIBILITY
+void *lprofPtrFetchAdd(void **Mem, long ByteIncr) {
+  void *Old = *Mem;
+  *((char **)Mem) += ByteIncr;
+  return Old;
+}
+
+COMPILER_RT_VISIBILITY
+int __llvm_profile_write_file(void) {
+  ProfDataWriter Writer;
+
+  if (lprofProfileDumped())
+    return 0;
+
+  /* Check if there is llvm/runtime version mismatch. */
+  if (GET_VERSION(__llvm_profile_get_version()) != INSTR_PROF_RAW_VERSION) {
+    putString("LLVM Profile Error: runtime and instrumentation version "
+              "mismatch\n");
+    return -1;
+  }
+
+  putString("LLVM-PROFILE-BEGIN\n");
+
+  Writer.Write = uartWriter;
+  Writer.WriterCtx = 0;
+  LineBytes = 0;
+  if (lprofWriteData(&Writer, lprofGetVPDataReader(), 0))
+    return -1;
+  if (LineBytes)
+    putChar('\n');
+
+  putString("LLVM-PROFILE-END\n");
+  return 0;
+}
+
+COMPILER_RT_VISIBILITY
+int __llvm_profile_dump(void) {
+  int rc = __llvm_profile_write_file();
+  lprofSetProfileDumped(1);
+  return rc;
+}
+
+static void writeFileWithoutReturn(void) { __llvm_profile_write_file(); }
+
+COMPILER_RT_VISIBILITY
+int __llvm_profile_register_write_file_atexit(void) {
+  static int HasBeenRegistered = 0;
+
+  if (HasBeenRegistered)
+    return 0;
+
+  lprofSetupValueProfiler();
+
+  HasBeenRegistered = 1;
+  return atexit(writeFileWithoutReturn);
+}
+
+/* This method is invoked by the runtime initialization hook
+ * InstrProfilingRuntime.o if it is linked in. */
+COMPILER_RT_VISIBILITY
+void __llvm_profile_initialize(void) {
+  __llvm_profile_register_write_file_atexit();
+}
+
+#endif
@@ -8,9 +8,16 @@
 //===----------------------------------------------------------------------===//
 
 #include "InputFiles.h"
+#include "OutputSections.h"
+#include "SymbolTable.h"
 #include "Symbols.h"
 #include "SyntheticSections.h"
 #include "Target.h"
+#include "Writer.h"
+#include "lld/Common/ErrorHandler.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/CRC.h"
 
 using namespace llvm;
 using namespace llvm::object;
@@ -26,6 +33,7 @@ public:
   Patmos();
   RelExpr getRelExpr(RelType type, const Symbol &s,
                      const uint8_t *loc) const override;
+  int64_t getImplicitAddend(const uint8_t *buf, RelType type) const override;
   void relocate(uint8_t *loc, const Relocation &rel,
                 uint64_t val) const override;
 };
@@ -78,6 +86,42 @@ static uint32_t extractBits(uint64_t v, uint32_t begin, uint32_t end) {
   return (v & ((1ULL << (begin + 1)) - 1)) >> end;
 }
 
+// getImplicitAddend - read the addend that the assembler encoded into the
+// immediate of the data/instruction, Patmos uses REL relocations
+//// @param buf   Location Pointer to data/instruction the patching is needed
+//// @param type  What Relocation Type needed to be applied
+//
+// The addend must be known to the linker, not just added to the relocated
+// value in place: relocations against mergeable sections, e.g., of float
+// constants, use the section symbol and the addend to find the referenced
+// piece, which is moved when identical pieces are merged.
+int64_t Patmos::getImplicitAddend(const uint8_t *buf, RelType type) const {
+  switch (type) {
+  case R_PATMOS_NONE:
+    return 0;
+  case R_PATMOS_CFLI_ABS:
+    return static_cast<int64_t>(read32be(buf) & 0x3FFFFF) << 2;
+  case R_PATMOS_CFLI_PCREL:
+    return SignExtend64<22>(read32be(buf) & 0x3FFFFF) * 4;
+  case R_PATMOS_ALUI_ABS:
+    return read32be(buf) & 0xFFF;
+  case R_PATMOS_ALUL_ABS:
+    return read64be(buf) & 0xFFFFFFFF;
+  case R_PATMOS_MEMB_ABS:
+    return SignExtend64<7>(read32be(buf) & 0x7F);
+  case R_PATMOS_MEMH_ABS:
+    return SignExtend64<7>(read32be(buf) & 0x7F) * 2;
+  case R_PATMOS_MEMW_ABS:
+    return SignExtend64<7>(read32be(buf) & 0x7F) * 4;
+  case R_PATMOS_ABS_32:
+    return SignExtend64<32>(read32be(buf));
+  default:
+    internalLinkerError(getErrorLocation(buf),
+                        "cannot read addend for relocation " + toString(type));
+    return 0;
+  }
+}
+
 
 // relocate - patch data/instruction depending on the relocation type
 //// @param loc   Location Pointer to data/instruction where patching is needed
@@ -154,17 +198,10 @@ void Patmos::relocate(uint8_t *loc, const Relocation &rel, uint64_t val) const {
     return;
   }
   case R_PATMOS_ABS_32: {
-    // Relocate 32 bit word, absolute (unsigned), in bytes
-    checkUInt(loc, static_cast<int64_t>(val), 32, rel);
-    
-    uint64_t out =  read32be(loc);
-    uint32_t temp =  extractBits(val, 31, 0);
-    out += temp;
-
-    checkIntUInt(loc, out, 32, rel);
+    // Relocate 32 bit word, absolute, in bytes, the addend is part of val
+    checkIntUInt(loc, val, 32, rel);
 
-    write32be(loc,out);
-    
+    write32be(loc, extractBits(val, 31, 0));
     return;
   }
   case R_PATMOS_CFLI_PCREL: {
@@ -183,6 +220,283 @@ void Patmos::relocate(uint8_t *loc, const Relocation &rel, uint64_t val) const {
   }
 }
 
+// checkPatmosSubfunction - check the size word of the subfunction starting at
+// the function symbol sym in the written output
+static void checkPatmosSubfunction(const Symbol &sym) {
+  auto *d = dyn_cast<Defined>(&sym);
+  if (!d || !d->isFunc())
+    return;
+  auto *isec = dyn_cast_or_null<InputSection>(d->section);
+  if (!isec || !isec->isLive() || !(isec->flags & SHF_EXECINSTR) ||
+      !isec->getParent() || isec->getParent()->type == SHT_NOBITS)
+    return;
+
+  // The size word precedes the first subfunction within the same input
+  // section, see PatmosTargetELFStreamer::EmitFStart. Its alignment is that
+  // of the input section, which is kept by the layout.
+  if (d->value < 4 || d->value > isec->getSize()) {
+    error(toString(isec) + ": function " + toString(sym) +
+          " has no subfunction size word");
+    return;
+  }
+
+  const uint8_t *loc = Out::bufferStart + isec->getParent()->offset +
+                       isec->outSecOff + d->value - 4;
+  uint32_t size = read32be(loc);
+  if (size == 0 || size % 4 != 0 || size > isec->getSize() - d->value ||
+      (d->size && size > d->size))
+    error(toString(isec) + ": subfunction size word of " + toString(sym) +
+          " (" + Twine(size) + ") does not match the layout");
+}
+
+// checkPatmosSubfunctions - validate the method cache size words of all
+// functions, for --patmos-check-subfunctions
+void elf::checkPatmosSubfunctions() {
+  for (Symbol *sym : symtab->symbols())
+    checkPatmosSubfunction(*sym);
+
+  for (ELFFileBase *file : objectFiles)
+    for (Symbol *sym : file->getLocalSymbols())
+      checkPatmosSubfunction(*sym);
+}
+
+// startsPatmosSubfunction - check whether the function symbol sym starts a
+// subfunction at the beginning of its input section, i.e., right after the
+// size word at offset 0
+static bool startsPatmosSubfunction(const Symbol &sym) {
+  auto *d = dyn_cast<Defined>(&sym);
+  if (!d || !d->isFunc() || d->value != 4)
+    return false;
+  auto *isec = dyn_cast_or_null<InputSection>(d->section);
+  if (!isec || isec->getSize() < 8)
+    return false;
+
+  // The size word is resolved by the assembler, it is part of the contents
+  uint32_t size = read32be(isec->data().data());
+  return size != 0 && size % 4 == 0 && size <= isec->getSize() - 4;
+}
+
+// markPatmosUnfoldableSections - keep the code sections unique that do not
+// start with a subfunction, for --icf
+//
+// The method cache loads subfunctions as a whole, starting at the size word,
+// and the only way into a subfunction is through a call or a brcf to its
+// start. Code in a section without a size word at its start, e.g., of
+// hand-written assembly, may be reached by falling through from the
+// preceding section, which is not moved along with a folded section. The
+// size word itself and the branches within a section are compared as part
+// of the contents, the implicit addends of the relocations of Patmos as well.
+void elf::markPatmosUnfoldableSections() {
+  DenseSet<const SectionBase *> foldable;
+  for (ELFFileBase *file : objectFiles)
+    for (Symbol *sym : file->getSymbols())
+      if (startsPatmosSubfunction(*sym))
+        foldable.insert(cast<Defined>(sym)->section);
+
+  for (InputSectionBase *sec : inputSections)
+    if ((sec->flags & SHF_EXECINSTR) && !foldable.count(sec))
+      sec->keepUnique = true;
+}
+
+namespace {
+// The flags of a function in a .patmos.summary section, see
+// PatmosAsmPrinter::emitSummaries
+enum : uint32_t {
+  SF_SinglePathRoot = 1 << 0,
+  SF_SinglePathReachable = 1 << 1,
+  SF_SinglePathMaybe = 1 << 2,
+  SF_IndirectCalls = 1 << 3,
+  SF_SinglePathShared = 1 << 4
+};
+
+// The summary of a function, identified by its address
+struct PatmosSummary {
+  const InputSection *sec;
+  uint32_t flags;
+  uint32_t stackCacheBytes;
+  SmallVector<uint64_t, 4> callees;
+};
+} // namespace
+
+// getPatmosSummaryAddress - return the address referenced by the word at
+// offset off of the summary section sec, or 0 if it is not relocated or
+// refers to discarded code
+static uint64_t
+getPatmosSummaryAddress(const InputSection *sec,
+                        const DenseMap<uint64_t, const Symbol *> &relocated,
+                        uint64_t off) {
+  auto it = relocated.find(off);
+  if (it == relocated.end())
+    return 0;
+  auto *d = dyn_cast<Defined>(it->second);
+  if (!d || !d->section || !d->section->isLive())
+    return 0;
+  // local functions are referenced by the section symbol and the addend
+  int64_t addend = SignExtend64<32>(read32be(sec->data().data() + off));
+  return d->getVA(addend);
+}
+
+// readPatmosSummaries - read the function summaries of the section sec
+static void readPatmosSummaries(const InputSection *sec,
+                                DenseMap<uint64_t, PatmosSummary> &summaries) {
+  DenseMap<uint64_t, const Symbol *> relocated;
+  ObjFile<ELF32BE> *file = sec->getFile<ELF32BE>();
+  for (const ELF32BE::Rel &rel : sec->relsOrRelas<ELF32BE>().rels)
+    relocated[rel.r_offset] = &file->getRelocTargetSym(rel);
+
+  ArrayRef<uint8_t> data = sec->data();
+  auto malformed = [&]() {
+    error(toString(sec) + ": malformed .patmos.summary section");
+  };
+  if (data.size() < 4 || data.size() % 4 != 0 || read32be(data.data()) != 1)
+    return malformed();
+
+  uint64_t off = 4;
+  while (off < data.size()) {
+    if (data.size() - off < 16)
+      return malformed();
+    PatmosSummary summary;
+    summary.sec = sec;
+    uint64_t addr = getPatmosSummaryAddress(sec, relocated, off);
+    summary.flags = read32be(data.data() + off + 4);
+    summary.stackCacheBytes = read32be(data.data() + off + 8);
+    uint32_t numCallees = read32be(data.data() + off + 12);
+    off += 16;
+    if ((data.size() - off) / 4 < numCallees)
+      return malformed();
+    for (uint32_t i = 0; i < numCallees; i++, off += 4)
+      if (uint64_t callee = getPatmosSummaryAddress(sec, relocated, off))
+        summary.callees.push_back(callee);
+
+    // folded or discarded functions have no address
+    if (addr)
+      summaries.try_emplace(addr, std::move(summary));
+  }
+}
+
+// checkPatmosSummaries - check the calls of single-path code and report the
+// worst-case stack cache usage below the entry, using the summaries of the
+// separately compiled objects, for --patmos-check-summaries
+//
+// Each object only knows the functions it defines. Single-path code must only
+// call functions that are single-path code as well, which is checked for
+// callees defined in other objects here. Objects without summaries, or
+// indirect calls, make the reported stack cache usage a lower bound.
+void elf::checkPatmosSummaries() {
+  DenseMap<uint64_t, PatmosSummary> summaries;
+  for (InputSectionBase *sec : inputSections)
+    if (auto *isec = dyn_cast<InputSection>(sec))
+      if (isec->name == ".patmos.summary")
+        readPatmosSummaries(isec, summaries);
+  if (errorCount())
+    return;
+
+  // name the functions by their symbols, for the diagnostics
+  DenseMap<uint64_t, const Symbol *> names;
+  auto addName = [&](const Symbol *sym) {
+    auto *d = dyn_cast<Defined>(sym);
+    if (d && d->isFunc() && d->section && d->section->isLive())
+      names.try_emplace(d->getVA(), sym);
+  };
+  for (Symbol *sym : symtab->symbols())
+    addName(sym);
+  for (ELFFileBase *file : objectFiles)
+    for (Symbol *sym : file->getLocalSymbols())
+      addName(sym);
+  auto getName = [&](uint64_t addr) {
+    auto it = names.find(addr);
+    return it != names.end() ? toString(*it->second)
+                             : "0x" + utohexstr(addr);
+  };
+
+  const uint32_t sp = SF_SinglePathRoot | SF_SinglePathReachable;
+  const uint32_t spCallee = SF_SinglePathReachable | SF_SinglePathMaybe |
+                            SF_SinglePathShared;
+  for (auto &entry : summaries) {
+    const PatmosSummary &summary = entry.second;
+    if (!(summary.flags & sp))
+      continue;
+    if (summary.flags & SF_IndirectCalls)
+      error(toString(summary.sec) + ": single-path function " +
+            getName(entry.first) + " has indirect calls");
+    for (uint64_t callee : summary.callees) {
+      auto it = summaries.find(callee);
+      if (it != summaries.end() && !(it->second.flags & spCallee))
+        error(toString(summary.sec) + ": single-path function " +
+              getName(entry.first) + " calls " + getName(callee) +
+              ", which is not single-path code");
+    }
+  }
+
+  // the worst-case stack cache usage of the call graph below the entry, in
+  // depth-first order; a cycle of calls makes it unbounded
+  auto *start = dyn_cast_or_null<Defined>(symtab->find(config->entry));
+  if (!start || !start->section || !summaries.count(start->getVA()))
+    return;
+
+  DenseMap<uint64_t, uint64_t> usage;
+  DenseSet<uint64_t> active;
+  bool lowerBound = false;
+  std::string recursive;
+  std::function<uint64_t(uint64_t)> visit = [&](uint64_t addr) -> uint64_t {
+    auto known = usage.find(addr);
+    if (known != usage.end())
+      return known->second;
+    auto it = summaries.find(addr);
+    if (it == summaries.end()) {
+      lowerBound = true;
+      return 0;
+    }
+    if (!active.insert(addr).second) {
+      if (recursive.empty())
+        recursive = getName(addr);
+      return 0;
+    }
+    if (it->second.flags & SF_IndirectCalls)
+      lowerBound = true;
+
+    uint64_t calls = 0;
+    for (uint64_t callee : it->second.callees)
+      calls = std::max(calls, visit(callee));
+    active.erase(addr);
+    return usage[addr] = it->second.stackCacheBytes + calls;
+  };
+  uint64_t total = visit(start->getVA());
+
+  if (!recursive.empty())
+    message("stack cache usage of " + toString(*start) +
+            ": unbounded, recursion through " + recursive);
+  else
+    message("stack cache usage of " + toString(*start) + ": " +
+            (lowerBound ? "at least " : "") + Twine(total) + " bytes");
+}
+
+// writePatmosChecksum - store the CRC-32 of the file contents of all loadable
+// segments into the word at __patmos_checksum, for --patmos-checksum
+//
+// The checksum word itself is zero while the checksum is computed, such that
+// the bootloader can verify the loaded image by clearing it.
+void elf::writePatmosChecksum() {
+  auto *d = dyn_cast_or_null<Defined>(symtab->find("__patmos_checksum"));
+  OutputSection *osec = d && d->section ? d->section->getOutputSection()
+                                        : nullptr;
+  if (!osec || osec->type == SHT_NOBITS || d->getVA() % 4 != 0) {
+    error("--patmos-checksum requires an aligned word at __patmos_checksum");
+    return;
+  }
+
+  uint8_t *loc = Out::bufferStart + osec->offset + (d->getVA() - osec->addr);
+  write32be(loc, 0);
+
+  uint32_t crc = 0;
+  for (PhdrEntry *p : mainPart->phdrs)
+    if (p->p_type == PT_LOAD)
+      crc = llvm::crc32(crc, makeArrayRef(Out::bufferStart + p->p_offset,
+                                          p->p_filesz));
+
+  write32be(loc, crc);
+}
+
 TargetInfo *elf::getPatmosTargetInfo() {
   static Patmos target;
   return &target;
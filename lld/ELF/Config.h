@@ -222,6 +222,10 @@ struct Configuration {
   bool timeTraceEnabled;
   bool tocOptimize;
   bool pcRelOptimize;
+  bool patmosPackSubfunctions;
+  bool patmosCheckSubfunctions;
+  bool patmosCheckSummaries;
+  bool patmosChecksum;
   bool undefinedVersion;
   bool unique;
   bool useAndroidRelrTags = false;
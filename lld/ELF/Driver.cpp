@@ -325,6 +325,18 @@ static void checkOptions() {
   if (config->pcRelOptimize && config->emachine != EM_PPC64)
     error("--pcrel-optimize is only supported on PowerPC64 targets");
 
+  if (config->patmosPackSubfunctions && config->emachine != EM_PATMOS)
+    error("--patmos-pack-subfunctions is only supported on Patmos targets");
+
+  if (config->patmosCheckSubfunctions && config->emachine != EM_PATMOS)
+    error("--patmos-check-subfunctions is only supported on Patmos targets");
+
+  if (config->patmosCheckSummaries && config->emachine != EM_PATMOS)
+    error("--patmos-check-summaries is only supported on Patmos targets");
+
+  if (config->patmosChecksum && config->emachine != EM_PATMOS)
+    error("--patmos-checksum is only supported on Patmos targets");
+
   if (config->pie && config->shared)
     error("-shared and -pie may not be used together");
 
@@ -1459,6 +1471,13 @@ static void setConfigs(opt::InputArgList &args) {
       args.hasFlag(OPT_toc_optimize, OPT_no_toc_optimize, m == EM_PPC64);
   config->pcRelOptimize =
       args.hasFlag(OPT_pcrel_optimize, OPT_no_pcrel_optimize, m == EM_PPC64);
+  config->patmosPackSubfunctions =
+      args.hasFlag(OPT_patmos_pack_subfunctions,
+                   OPT_no_patmos_pack_subfunctions, false);
+  config->patmosCheckSubfunctions = args.hasArg(OPT_patmos_check_subfunctions);
+  config->patmosCheckSummaries = args.hasArg(OPT_patmos_check_summaries);
+  config->patmosChecksum =
+      args.hasArg(OPT_patmos_checksum) && !args.hasArg(OPT_relocatable);
 }
 
 static bool isFormatBinary(StringRef s) {
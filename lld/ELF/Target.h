@@ -219,6 +219,10 @@ unsigned getPPC64GlobalEntryToLocalEntryOffset(uint8_t stOther);
 void writePrefixedInstruction(uint8_t *loc, uint64_t insn);
 
 void addPPC64SaveRestore();
+void checkPatmosSubfunctions();
+void checkPatmosSummaries();
+void markPatmosUnfoldableSections();
+void writePatmosChecksum();
 uint64_t getPPC64TocBase();
 uint64_t getAArch64Page(uint64_t expr);
 
@@ -587,6 +587,12 @@ template <class ELFT> void Writer<ELFT>::run() {
         writeTrapInstr();
       writeHeader();
       writeSections();
+      if (config->patmosCheckSubfunctions)
+        checkPatmosSubfunctions();
+      if (config->patmosCheckSummaries)
+        checkPatmosSummaries();
+      if (config->patmosChecksum)
+        writePatmosChecksum();
     } else {
       writeSectionsBinary();
     }
@@ -1393,6 +1399,19 @@ static void sortSection(OutputSection *sec,
       if (auto *isd = dyn_cast<InputSectionDescription>(b))
         sortISDBySectionOrder(isd, order);
 
+  // Patmos loads subfunctions into the method cache as a whole, each starting
+  // at an aligned size word. Placing code sections with larger alignment
+  // first reduces the padding between them. An explicit order takes
+  // precedence.
+  if (config->patmosPackSubfunctions && order.empty() &&
+      (sec->flags & SHF_EXECINSTR))
+    for (SectionCommand *b : sec->commands)
+      if (auto *isd = dyn_cast<InputSectionDescription>(b))
+        llvm::stable_sort(isd->sections,
+                          [](const InputSection *a, const InputSection *b) {
+                            return a->alignment > b->alignment;
+                          });
+
   if (script->hasSectionsCommand)
     return;
 
@@ -0,0 +1,126 @@
+//===- PatmosAsmParser.cpp - Throughput of the Patmos assembly parser -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Parse a generated stream of Patmos assembly, in the style of the compiler
+// output and the hand-written runtime, i.e., bundles, guards, predicate
+// combinations, memory operands and long immediates, and report the parsed
+// bytes and instructions per second.
+//
+//===----------------------------------------------------------------------===//
+
+#include "benchmark/benchmark.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+extern "C" void LLVMInitializePatmosTargetInfo();
+extern "C" void LLVMInitializePatmosTargetMC();
+extern "C" void LLVMInitializePatmosAsmParser();
+
+static const char *const PatmosTriple = "patmos-unknown-unknown-elf";
+
+/// The instructions of one group of the generated stream.
+static const unsigned GroupInstrs = 10;
+
+/// generateAssembly - Return Groups groups of GroupInstrs instructions.
+static std::string generateAssembly(unsigned Groups) {
+  std::string Asm;
+  raw_string_ostream OS(Asm);
+  OS << "\t.text\n";
+  for (unsigned i = 0; i < Groups; i++) {
+    unsigned R = 1 + i % 20;
+    OS << "{\tadd\t$r" << R << " = $r" << R + 1 << ", $r" << R + 2 << "\n"
+       << "\tsub\t($p1) $r" << R + 3 << " = $r" << R + 4 << ", " << i % 4096
+       << " }\n"
+       << "\tlwc\t$r" << R << " = [$r" << R + 5 << " + " << i % 64 << "]\n"
+       << "\tli\t$r" << R + 1 << " = " << 0x10000 + i << "\n"
+       << "{\tcmpule\t$p1 = $r" << R << ", $r" << R + 2 << "\n"
+       << "\tpand\t$p2 = $p1, !$p3 }\n"
+       << "{\tswc\t[$r" << R + 3 << " + 1] = $r" << R << "\n"
+       << "\tmov\t$r" << R + 4 << " = $r" << R + 5 << " }\n"
+       << "\t// a comment as in the runtime\n"
+       << "\tor\t(!$p2) $r" << R << " = $r" << R << ", 1\n"
+       << "\tnop\n";
+  }
+  return OS.str();
+}
+
+static void BM_PatmosAssemble(benchmark::State &State) {
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(PatmosTriple, Error);
+  if (!T) {
+    State.SkipWithError("The Patmos target is not available");
+    return;
+  }
+
+  Triple TheTriple(PatmosTriple);
+  MCTargetOptions MCOptions;
+  std::unique_ptr<MCRegisterInfo> MRI(T->createMCRegInfo(PatmosTriple));
+  std::unique_ptr<MCAsmInfo> MAI(
+      T->createMCAsmInfo(*MRI, PatmosTriple, MCOptions));
+  std::unique_ptr<MCSubtargetInfo> STI(
+      T->createMCSubtargetInfo(PatmosTriple, "", ""));
+  std::unique_ptr<MCInstrInfo> MCII(T->createMCInstrInfo());
+
+  std::string Asm = generateAssembly(State.range(0));
+
+  for (auto _ : State) {
+    SourceMgr SrcMgr;
+    SrcMgr.AddNewSourceBuffer(MemoryBuffer::getMemBuffer(Asm, "<bench>"),
+                              SMLoc());
+    MCContext Ctx(TheTriple, MAI.get(), MRI.get(), STI.get(), &SrcMgr,
+                  &MCOptions);
+    std::unique_ptr<MCObjectFileInfo> MOFI(
+        T->createMCObjectFileInfo(Ctx, /*PIC=*/false));
+    Ctx.setObjectFileInfo(MOFI.get());
+
+    std::unique_ptr<MCStreamer> Str(T->createNullStreamer(Ctx));
+    std::unique_ptr<MCAsmParser> Parser(
+        createMCAsmParser(SrcMgr, Ctx, *Str, *MAI));
+    std::unique_ptr<MCTargetAsmParser> TAP(
+        T->createMCAsmParser(*STI, *Parser, *MCII, MCOptions));
+    Parser->setTargetParser(*TAP);
+
+    if (Parser->Run(/*NoInitialTextSection=*/false)) {
+      State.SkipWithError("Cannot parse the generated assembly");
+      return;
+    }
+  }
+
+  State.SetBytesProcessed(State.iterations() * Asm.size());
+  State.SetItemsProcessed(State.iterations() * State.range(0) * GroupInstrs);
+}
+BENCHMARK(BM_PatmosAssemble)
+    ->RangeMultiplier(8)
+    ->Range(64, 32768)
+    ->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+  LLVMInitializePatmosTargetInfo();
+  LLVMInitializePatmosTargetMC();
+  LLVMInitializePatmosAsmParser();
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,278 @@
+//===- PatmosPasses.cpp - Scaling of the expensive Patmos passes ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Compile synthetic single-path functions of growing size and loop nesting
+// depth for Patmos and report the time of the phases of the Patmos timer
+// group as counters, i.e., the single-path scope tree, the predicate
+// allocation, the block pairing of the single-path bundling, the single-path
+// reduction itself, the method cache region formation of the function
+// splitter and the dataflow of the stack cache analysis.
+//
+// The time of a benchmark is the time of the whole code generation, the
+// complexity fit of each family shows how it scales with the number of
+// diamonds of the synthetic function.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "benchmark/benchmark.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+using namespace llvm;
+
+extern "C" void LLVMInitializePatmosTargetInfo();
+extern "C" void LLVMInitializePatmosTarget();
+extern "C" void LLVMInitializePatmosTargetMC();
+extern "C" void LLVMInitializePatmosAsmPrinter();
+
+static const char *const PatmosTriple = "patmos-unknown-unknown-elf";
+
+/// The number of iterations of every synthetic loop.
+static const unsigned LoopTrips = 4;
+
+/// The timers of the Patmos timer group, reported as counters.
+static const char *const PhaseTimers[] = {
+    "sp-scope-tree", "sp-reg-alloc", "sp-bundling-merge", "sp-reduce",
+    "function-splitter-regions", "sca-dataflow"};
+
+/// setLoopBound - Attach the loop bound to the back edge of a loop, as the
+/// frontend does for '#pragma loopbound'.
+static void setLoopBound(BranchInst *BackEdge, unsigned Bound) {
+  LLVMContext &Ctx = BackEdge->getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Metadata *Ops[] = {
+      MDString::get(Ctx, "llvm.loop.bound"),
+      ValueAsMetadata::get(ConstantInt::get(Int32Ty, Bound)),
+      ValueAsMetadata::get(ConstantInt::get(Int32Ty, Bound))};
+
+  SmallVector<Metadata *, 2> LoopMD(1);
+  LoopMD.push_back(MDNode::get(Ctx, Ops));
+  MDNode *LoopID = MDNode::get(Ctx, LoopMD);
+  LoopID->replaceOperandWith(0, LoopID);
+  BackEdge->setMetadata("llvm.loop", LoopID);
+}
+
+/// buildScope - Emit Width diamonds that update Acc from the Data array,
+/// followed by a loop around a nested scope while Depth is not zero. Return
+/// the final value of Acc.
+static Value *buildScope(IRBuilder<> &B, Function *F, Value *Data,
+                         Value *Acc, unsigned Width, unsigned Depth) {
+  LLVMContext &Ctx = F->getContext();
+  Type *Int32Ty = B.getInt32Ty();
+
+  for (unsigned k = 0; k < Width; k++) {
+    Value *Ptr = B.CreateConstInBoundsGEP1_32(Int32Ty, Data, k % 16);
+    Value *V = B.CreateLoad(Int32Ty, Ptr);
+    Value *Bit = B.CreateAnd(B.CreateXor(V, Acc), 1u << (k % 5));
+    Value *Cond = B.CreateICmpNE(Bit, B.getInt32(0));
+
+    BasicBlock *Then = BasicBlock::Create(Ctx, "then", F);
+    BasicBlock *Else = BasicBlock::Create(Ctx, "else", F);
+    BasicBlock *Join = BasicBlock::Create(Ctx, "join", F);
+    B.CreateCondBr(Cond, Then, Else);
+
+    B.SetInsertPoint(Then);
+    Value *Sum = B.CreateAdd(Acc, B.CreateMul(V, B.getInt32(k + 1)));
+    B.CreateBr(Join);
+
+    B.SetInsertPoint(Else);
+    Value *Mix = B.CreateXor(Acc, B.CreateLShr(V, k % 7));
+    B.CreateBr(Join);
+
+    B.SetInsertPoint(Join);
+    PHINode *Phi = B.CreatePHI(Int32Ty, 2);
+    Phi->addIncoming(Sum, Then);
+    Phi->addIncoming(Mix, Else);
+    Acc = Phi;
+  }
+
+  if (Depth == 0)
+    return Acc;
+
+  BasicBlock *Preheader = B.GetInsertBlock();
+  BasicBlock *Header = BasicBlock::Create(Ctx, "loop", F);
+  B.CreateBr(Header);
+
+  B.SetInsertPoint(Header);
+  PHINode *I = B.CreatePHI(Int32Ty, 2);
+  PHINode *LoopAcc = B.CreatePHI(Int32Ty, 2);
+  I->addIncoming(B.getInt32(0), Preheader);
+  LoopAcc->addIncoming(Acc, Preheader);
+
+  Value *BodyAcc = buildScope(B, F, Data, LoopAcc, Width, Depth - 1);
+  Value *Next = B.CreateAdd(I, B.getInt32(1));
+  BasicBlock *Latch = B.GetInsertBlock();
+  BasicBlock *Exit = BasicBlock::Create(Ctx, "exit", F);
+  setLoopBound(B.CreateCondBr(B.CreateICmpULT(Next, B.getInt32(LoopTrips)),
+                              Header, Exit),
+               LoopTrips);
+  I->addIncoming(Next, Latch);
+  LoopAcc->addIncoming(BodyAcc, Latch);
+
+  B.SetInsertPoint(Exit);
+  return BodyAcc;
+}
+
+/// buildModule - Return a module with the single-path root 'bench' of the
+/// given shape, called by 'main'.
+static std::unique_ptr<Module> buildModule(LLVMContext &Ctx,
+                                           const TargetMachine &TM,
+                                           unsigned Width, unsigned Depth) {
+  auto M = std::make_unique<Module>("patmos-bench", Ctx);
+  M->setTargetTriple(PatmosTriple);
+  M->setDataLayout(TM.createDataLayout());
+
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  ArrayType *DataTy = ArrayType::get(Int32Ty, 16);
+  auto *Data = new GlobalVariable(*M, DataTy, false,
+                                  GlobalValue::InternalLinkage,
+                                  ConstantAggregateZero::get(DataTy), "data");
+
+  Function *Bench = Function::Create(
+      FunctionType::get(Int32Ty, {Int32Ty->getPointerTo()}, false),
+      GlobalValue::ExternalLinkage, "bench", *M);
+  IRBuilder<> B(BasicBlock::Create(Ctx, "entry", Bench));
+  B.CreateRet(buildScope(B, Bench, Bench->getArg(0), B.getInt32(1), Width,
+                         Depth));
+
+  Function *Main = Function::Create(FunctionType::get(Int32Ty, false),
+                                    GlobalValue::ExternalLinkage, "main", *M);
+  B.SetInsertPoint(BasicBlock::Create(Ctx, "entry", Main));
+  B.CreateRet(B.CreateCall(
+      Bench, {B.CreateConstInBoundsGEP2_32(DataTy, Data, 0, 0)}));
+  return M;
+}
+
+/// createTargetMachine - Return the Patmos target machine, or null.
+static std::unique_ptr<TargetMachine> createTargetMachine() {
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(PatmosTriple, Error);
+  if (!T)
+    return nullptr;
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      PatmosTriple, "", "", TargetOptions(), None, None, CodeGenOpt::Default));
+}
+
+/// collectPhaseTimes - Add the wall times of the Patmos timer group since
+/// the last call to Times and reset all timers.
+static void collectPhaseTimes(StringMap<double> &Times) {
+  // drop the pass timers of the legacy pass manager first, they would be
+  // printed at exit and their names are not valid JSON keys
+  reportAndResetTimings(&nulls());
+
+  std::string JSON;
+  raw_string_ostream OS(JSON);
+  TimerGroup::printAllJSONValues(OS, "");
+  OS.flush();
+
+  std::string Prefix = "\"time." + std::string(PatmosTimerGroupName) + ".";
+  StringRef Rest(JSON);
+  while (!Rest.empty()) {
+    StringRef Line;
+    std::tie(Line, Rest) = Rest.split('\n');
+    Line = Line.trim().rtrim(',');
+    if (!Line.consume_front(Prefix))
+      continue;
+
+    StringRef Name, Value;
+    std::tie(Name, Value) = Line.split("\": ");
+    if (!Name.consume_back(".wall"))
+      continue;
+    double Seconds;
+    if (!Value.trim().getAsDouble(Seconds))
+      Times[Name] += Seconds;
+  }
+
+  TimerGroup::clearAll();
+}
+
+static void compile(benchmark::State &State, unsigned Width, unsigned Depth) {
+  std::unique_ptr<TargetMachine> TM = createTargetMachine();
+  if (!TM) {
+    State.SkipWithError("The Patmos target is not available");
+    return;
+  }
+
+  StringMap<double> Times;
+  for (auto _ : State) {
+    State.PauseTiming();
+    LLVMContext Ctx;
+    std::unique_ptr<Module> M = buildModule(Ctx, *TM, Width, Depth);
+    SmallString<0> Object;
+    raw_svector_ostream OS(Object);
+    legacy::PassManager PM;
+    if (TM->addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile)) {
+      State.SkipWithError("Cannot emit Patmos object files");
+      return;
+    }
+    State.ResumeTiming();
+
+    PM.run(*M);
+
+    State.PauseTiming();
+    collectPhaseTimes(Times);
+    State.ResumeTiming();
+  }
+
+  for (const char *Phase : PhaseTimers)
+    State.counters[Phase] =
+        benchmark::Counter(Times.lookup(Phase),
+                           benchmark::Counter::kAvgIterations);
+  State.SetComplexityN(Width * (Depth + 1));
+}
+
+/// BM_PatmosWidth - Grow the number of diamonds per loop level.
+static void BM_PatmosWidth(benchmark::State &State) {
+  compile(State, State.range(0), 2);
+}
+BENCHMARK(BM_PatmosWidth)
+    ->RangeMultiplier(2)
+    ->Range(8, 256)
+    ->Complexity()
+    ->Unit(benchmark::kMillisecond);
+
+/// BM_PatmosDepth - Grow the nesting depth of the loops.
+static void BM_PatmosDepth(benchmark::State &State) {
+  compile(State, 8, State.range(0));
+}
+BENCHMARK(BM_PatmosDepth)
+    ->DenseRange(0, 8, 2)
+    ->Complexity()
+    ->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+  LLVMInitializePatmosTargetInfo();
+  LLVMInitializePatmosTarget();
+  LLVMInitializePatmosTargetMC();
+  LLVMInitializePatmosAsmPrinter();
+
+  // the phases are only timed with -time-passes, 'bench' is compiled as
+  // single-path code and the stack cache analysis runs on all functions
+  TimePassesIsEnabled = true;
+  const char *Options[] = {argv[0], "-mpatmos-singlepath=bench",
+                           "-mpatmos-enable-stack-cache-analysis"};
+  cl::ParseCommandLineOptions(array_lengthof(Options), Options);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
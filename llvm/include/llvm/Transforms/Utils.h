@@ -14,9 +14,12 @@
 #ifndef LLVM_TRANSFORMS_UTILS_H
 #define LLVM_TRANSFORMS_UTILS_H
 
+#include <functional>
+
 namespace llvm {
 
 class ModulePass;
+class Function;
 class FunctionPass;
 class Pass;
 
@@ -45,7 +48,8 @@ extern char &InstructionNamerID;
 // LowerSwitch - This pass converts SwitchInst instructions into a sequence of
 // chained binary branch instructions.
 //
-FunctionPass *createLowerSwitchPass();
+FunctionPass *
+createLowerSwitchPass(std::function<bool(const Function &)> Ftor = nullptr);
 extern char &LowerSwitchID;
 
 //===----------------------------------------------------------------------===//
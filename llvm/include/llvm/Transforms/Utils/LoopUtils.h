@@ -308,6 +308,19 @@ TransformationMode hasLICMVersioningTransformation(const Loop *L);
 void addStringMetadataToLoop(Loop *TheLoop, const char *MDString,
                              unsigned V = 0);
 
+/// Returns the "llvm.loop.bound" of the loop, the minimum and maximum number
+/// of taken backedges given by the user for the WCET analysis, if any.
+bool getLoopBound(const Loop *TheLoop, unsigned &Min, unsigned &Max);
+
+/// Set the "llvm.loop.bound" of the loop by keeping other values intact.
+void setLoopBound(Loop *TheLoop, unsigned Min, unsigned Max);
+
+/// Adjust the "llvm.loop.bound" of the loop, if any, after the first
+/// \p PeelCount iterations were peeled off and the remaining iterations were
+/// unrolled \p UnrollCount times, with the exits of all copies retained or
+/// the left-over iterations executed by a remainder loop.
+void updateLoopBound(Loop *TheLoop, unsigned PeelCount, unsigned UnrollCount);
+
 /// Returns a loop's estimated trip count based on branch weight metadata.
 /// In addition if \p EstimatedLoopInvocationWeight is not null it is
 /// initialized with weight of loop's latch leading to the exit.
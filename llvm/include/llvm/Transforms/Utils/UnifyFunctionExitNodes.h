@@ -16,21 +16,28 @@
 
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include <functional>
 
 namespace llvm {
 
 class UnifyFunctionExitNodesLegacyPass : public FunctionPass {
 public:
   static char ID; // Pass identification, replacement for typeid
-  UnifyFunctionExitNodesLegacyPass();
+  UnifyFunctionExitNodesLegacyPass(
+      std::function<bool(const Function &)> Ftor = nullptr);
 
   // We can preserve non-critical-edgeness when we unify function exit nodes
   void getAnalysisUsage(AnalysisUsage &AU) const override;
 
   bool runOnFunction(Function &F) override;
+
+private:
+  /// Only unify the exits of the functions this predicate holds for.
+  std::function<bool(const Function &)> PredicateFtor;
 };
 
-Pass *createUnifyFunctionExitNodesPass();
+Pass *createUnifyFunctionExitNodesPass(
+    std::function<bool(const Function &)> Ftor = nullptr);
 
 class UnifyFunctionExitNodesPass
     : public PassInfoMixin<UnifyFunctionExitNodesPass> {
@@ -1000,6 +1000,89 @@ void RuntimeDyldELF::resolveBPFRelocation(const SectionEntry &Section,
   }
 }
 
+int64_t RuntimeDyldELF::getPatmosImplicitAddend(uint8_t *Placeholder,
+                                                uint32_t Type) const {
+  switch (Type) {
+  default:
+    return 0;
+  case ELF::R_PATMOS_CFLI_ABS:
+    return static_cast<int64_t>(readBytesUnaligned(Placeholder, 4) & 0x3FFFFF)
+           << 2;
+  case ELF::R_PATMOS_CFLI_PCREL:
+    return SignExtend64<22>(readBytesUnaligned(Placeholder, 4) & 0x3FFFFF) * 4;
+  case ELF::R_PATMOS_ALUI_ABS:
+    return readBytesUnaligned(Placeholder, 4) & 0xFFF;
+  case ELF::R_PATMOS_ALUL_ABS:
+    // the immediate is the second word of the instruction
+    return readBytesUnaligned(Placeholder + 4, 4);
+  case ELF::R_PATMOS_MEMB_ABS:
+    return SignExtend64<7>(readBytesUnaligned(Placeholder, 4) & 0x7F);
+  case ELF::R_PATMOS_MEMH_ABS:
+    return SignExtend64<7>(readBytesUnaligned(Placeholder, 4) & 0x7F) * 2;
+  case ELF::R_PATMOS_MEMW_ABS:
+    return SignExtend64<7>(readBytesUnaligned(Placeholder, 4) & 0x7F) * 4;
+  case ELF::R_PATMOS_ABS_32:
+    return SignExtend64<32>(readBytesUnaligned(Placeholder, 4));
+  }
+}
+
+void RuntimeDyldELF::resolvePatmosRelocation(const SectionEntry &Section,
+                                             uint64_t Offset, uint64_t Value,
+                                             uint32_t Type, int64_t Addend) {
+  uint8_t *LocalAddress = Section.getAddressWithOffset(Offset);
+  uint64_t FinalAddress = Section.getLoadAddressWithOffset(Offset);
+  int64_t Result = Value + Addend;
+
+  // Patch the immediate Imm of Bits bits into the instruction word at
+  // LocalAddress, the same way lld does for a linked executable.
+  auto patch = [&](int64_t Imm, unsigned Bits, bool Signed) {
+    if (Signed ? !isIntN(Bits, Imm) : !isUIntN(Bits, Imm))
+      report_fatal_error("Patmos relocation " + Twine(Type) +
+                         " out of range at " + Twine::utohexstr(FinalAddress));
+    uint32_t Mask = (1u << Bits) - 1;
+    uint32_t Insn = readBytesUnaligned(LocalAddress, 4);
+    writeBytesUnaligned((Insn & ~Mask) | (Imm & Mask), LocalAddress, 4);
+  };
+
+  switch (Type) {
+  default:
+    report_fatal_error("Relocation type not implemented yet!");
+    break;
+  case ELF::R_PATMOS_NONE:
+    break;
+  case ELF::R_PATMOS_CFLI_ABS:
+    patch(Result >> 2, 22, false);
+    break;
+  case ELF::R_PATMOS_CFLI_PCREL:
+    patch((Result - (int64_t)FinalAddress) >> 2, 22, true);
+    break;
+  case ELF::R_PATMOS_ALUI_ABS:
+    patch(Result, 12, false);
+    break;
+  case ELF::R_PATMOS_ALUL_ABS:
+    if (!isUInt<32>(Result))
+      report_fatal_error("Patmos relocation " + Twine(Type) +
+                         " out of range at " + Twine::utohexstr(FinalAddress));
+    writeBytesUnaligned(Result, LocalAddress + 4, 4);
+    break;
+  case ELF::R_PATMOS_MEMB_ABS:
+    patch(Result, 7, true);
+    break;
+  case ELF::R_PATMOS_MEMH_ABS:
+    patch(Result >> 1, 7, true);
+    break;
+  case ELF::R_PATMOS_MEMW_ABS:
+    patch(Result >> 2, 7, true);
+    break;
+  case ELF::R_PATMOS_ABS_32:
+    if (!isInt<32>(Result) && !isUInt<32>(Result))
+      report_fatal_error("Patmos relocation " + Twine(Type) +
+                         " out of range at " + Twine::utohexstr(FinalAddress));
+    writeBytesUnaligned(Result, LocalAddress, 4);
+    break;
+  }
+}
+
 // The target location for the relocation is described by RE.SectionID and
 // RE.Offset.  RE.SectionID can be used to find the SectionEntry.  Each
 // SectionEntry has three members describing its location.
@@ -1065,6 +1148,9 @@ void RuntimeDyldELF::resolveRelocation(const SectionEntry &Section,
   case Triple::bpfeb:
     resolveBPFRelocation(Section, Offset, Value, Type, Addend);
     break;
+  case Triple::patmos:
+    resolvePatmosRelocation(Section, Offset, Value, Type, Addend);
+    break;
   default:
     llvm_unreachable("Unsupported CPU type!");
   }
@@ -1870,6 +1956,12 @@ RuntimeDyldELF::processRelocationRef(
     } else {
       processSimpleRelocation(SectionID, Offset, RelType, Value);
     }
+  } else if (Arch == Triple::patmos) {
+    // Patmos uses REL relocations, the addend is in the relocated immediate
+    uint8_t *Placeholder = reinterpret_cast<uint8_t *>(
+        computePlaceholderAddress(SectionID, Offset));
+    Value.Addend += getPatmosImplicitAddend(Placeholder, RelType);
+    processSimpleRelocation(SectionID, Offset, RelType, Value);
   } else {
     if (Arch == Triple::x86) {
       Value.Addend += support::ulittle32_t::ref(computePlaceholderAddress(SectionID, Offset));
@@ -2219,6 +2311,7 @@ size_t RuntimeDyldELF::getGOTEntrySize() {
   case Triple::x86:
   case Triple::arm:
   case Triple::thumb:
+  case Triple::patmos:
     Result = sizeof(uint32_t);
     break;
   case Triple::mips:
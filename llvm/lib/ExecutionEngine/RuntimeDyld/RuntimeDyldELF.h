@@ -60,6 +60,13 @@ class RuntimeDyldELF : public RuntimeDyldImpl {
   void resolveBPFRelocation(const SectionEntry &Section, uint64_t Offset,
                             uint64_t Value, uint32_t Type, int64_t Addend);
 
+  void resolvePatmosRelocation(const SectionEntry &Section, uint64_t Offset,
+                               uint64_t Value, uint32_t Type, int64_t Addend);
+
+  /// Read the implicit addend of a Patmos REL relocation from the immediate
+  /// of the relocated instruction or data word.
+  int64_t getPatmosImplicitAddend(uint8_t *Placeholder, uint32_t Type) const;
+
   unsigned getMaxStubSize() const override {
     if (Arch == Triple::aarch64 || Arch == Triple::aarch64_be)
       return 20; // movz; movk; movk; movk; br
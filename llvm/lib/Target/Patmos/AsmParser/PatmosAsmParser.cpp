@@ -79,7 +79,10 @@ public:
   void EatToEndOfStatement();
 
 private:
-  bool ParseOperand(OperandVector &Operands, unsigned OpNo);
+  /// ParseOperand - Parse the operand OpNo of an instruction.
+  /// \param PredSrcOps - if true, the source operands of the instruction
+  /// might be predicates, see hasPredSrcOperands
+  bool ParseOperand(OperandVector &Operands, unsigned OpNo, bool PredSrcOps);
 
   /// Parses the instruction guard, e.g. '(!$p1)', or produces the default instead.
   bool ParseGuard(SMLoc NameLoc, OperandVector &Operands);
@@ -101,8 +104,9 @@ private:
   /// ParseToken - Check if the Lexer is currently over the given token kind, and add it as operand if so.
   bool ParseToken(OperandVector &Operands, AsmToken::TokenKind Kind);
 
-  /// isPredSrcOperand - Check whether the operand might be a predicate source operand (i.e., has a negate flag)
-  bool isPredSrcOperand(StringRef Mnemonic, unsigned OpNo);
+  /// hasPredSrcOperands - Check whether the source operands of the mnemonic
+  /// might be predicate source operands (i.e., have a negate flag)
+  bool hasPredSrcOperands(StringRef Mnemonic);
 
   bool ParseDirectiveWord(unsigned Size, SMLoc L);
 
@@ -369,12 +373,14 @@ MatchAndEmitInstruction(SMLoc IDLoc, unsigned &Opcode,
         if (HasALUlVariant(Inst.getOpcode(), ALUlOpcode)){
           if (InBundle) {
             return Error(IDLoc, "long immediate instruction cannot be in the second slot of a bundle");
-          } else {
+          } else if (BundleCounter) {
             // If we have an expression and can use ALUl, do so
             Inst.setOpcode(ALUlOpcode);
             // ALUl counts as two operations
             BundleCounter++;
           }
+          // Otherwise keep the ALUi instruction, the assembler relaxes it to
+          // ALUl unless the expression is resolved to a 12 bit value.
         }
       } else {
         assert(MCO.isImm() && "expected immediate operand for ALUi format");
@@ -624,8 +630,8 @@ ParsePredicateOperand(OperandVector &Operands, bool checkClass)  {
     PatmosOperand *Op = (PatmosOperand*)&*Operands.back();
     if (!Op->isReg()) return Error(Lexer.getLoc(), "magic happened: we found a register but the operand is not a register");
 
-    // TODO There really should be a nicer way of doing this, but we do not have access to the RegisterInfo stuff here
-    if (PatmosInstPrinter::getRegisterName(Op->getReg())[0] != 'p') {
+    const MCRegisterInfo *MRI = getParser().getContext().getRegisterInfo();
+    if (!MRI->getRegClass(Patmos::PRegsRegClassID).contains(Op->getReg())) {
       // Not a predicate register, do not emit a flag operand
       if (flag) {
         Error(StartLoc, "Negation of registers other than predicates is invalid.");
@@ -641,7 +647,7 @@ ParsePredicateOperand(OperandVector &Operands, bool checkClass)  {
 }
 
 bool PatmosAsmParser::
-ParseOperand(OperandVector &Operands, unsigned OpNo)  {
+ParseOperand(OperandVector &Operands, unsigned OpNo, bool PredSrcOps)  {
   MCAsmLexer &Lexer = getLexer();
 
   // Handle all the various operand types here: Imm, reg, memory, predicate, label
@@ -656,9 +662,8 @@ ParseOperand(OperandVector &Operands, unsigned OpNo)  {
     return ParsePredicateOperand(Operands);
   }
   if (Lexer.is(AsmToken::Dollar)) {
-
-    StringRef Mnemonic = ((PatmosOperand*)&*Operands[0])->getToken();
-    if (isPredSrcOperand(Mnemonic, OpNo)) {
+    // only src operands, only combine ops
+    if (PredSrcOps && OpNo > 0) {
       return ParsePredicateOperand(Operands, true);
     }
 
@@ -781,10 +786,17 @@ bool PatmosAsmParser::
 ParseInstruction(ParseInstructionInfo &Info, StringRef Name, SMLoc NameLoc,
                  OperandVector &Operands)
 {
-  ParsePrefix(NameLoc, Operands, Name);
-
   MCAsmLexer &Lexer = getLexer();
-  if (Name == "{") {
+  bool StartsBundle = Name == "{";
+
+  // Most instructions neither start nor end a bundle, only look at the
+  // prefix if they might.
+  if (StartsBundle || Lexer.is(AsmToken::LCurly) ||
+      Lexer.is(AsmToken::RCurly)) {
+    ParsePrefix(NameLoc, Operands, Name);
+  }
+
+  if (StartsBundle) {
     // The prefix has some tokens. Therefore, 'Name' doesn't contain
     // the mnemonic. We need it to do so.	
     if (Lexer.isNot(AsmToken::Identifier) && Lexer.isNot(AsmToken::String)) {
@@ -813,6 +825,7 @@ ParseInstruction(ParseInstructionInfo &Info, StringRef Name, SMLoc NameLoc,
 
   ParseGuard(NameLoc, Operands);
 
+  bool PredSrcOps = hasPredSrcOperands(Mnemonic);
   unsigned OpNo = 0;
 
   // If there are no more operands then finish
@@ -854,7 +867,7 @@ ParseInstruction(ParseInstructionInfo &Info, StringRef Name, SMLoc NameLoc,
       return Error(TokLoc, "missing separator between operands or instructions");
     }
 
-    if (ParseOperand(Operands, OpNo)) {
+    if (ParseOperand(Operands, OpNo, PredSrcOps)) {
       EatToEndOfStatement();
       return true;
     }
@@ -957,22 +970,17 @@ bool PatmosAsmParser::ParseDirectiveFStart(SMLoc L) {
   return false;
 }
 
-bool PatmosAsmParser::isPredSrcOperand(StringRef Mnemonic, unsigned OpNo)
+bool PatmosAsmParser::hasPredSrcOperands(StringRef Mnemonic)
 {
-  // only src operands, only combine ops
-  if (OpNo == 0) return false;
-
   // We check if the src op is actually a predicate register later in the
-  // parse method
-  if (Mnemonic == "por"  || Mnemonic == "pand" ||
-      Mnemonic == "pxor") return true;
-  if (Mnemonic == "pmov" || Mnemonic == "pnot" ||
-      Mnemonic == "pset" || Mnemonic == "pclr") return true;
+  // parse method.
   // Note that mov might actually move between predicate and registers
   // (in the future)
-  if (Mnemonic == "mov") return true;
-
-  return false;
+  return StringSwitch<bool>(Mnemonic)
+    .Cases("por", "pand", "pxor", true)
+    .Cases("pmov", "pnot", "pset", "pclr", true)
+    .Case("mov", true)
+    .Default(false);
 }
 
 void PatmosAsmParser::EatToEndOfStatement() {
@@ -20,6 +20,8 @@
 #include "llvm/MC/MCInstrInfo.h"
 #include "llvm/MC/MCAsmInfo.h"
 #include "llvm/MC/MCExpr.h"
+#include "llvm/MC/MCSchedule.h"
+#include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Format.h"
@@ -46,6 +48,10 @@ void PatmosInstPrinter::printInst(const MCInst *MI, uint64_t Address,
 
   printInstruction(MI, Address, O);
 
+  if (AnnotateTiming && CommentStream) {
+    annotateTiming(MI, STI);
+  }
+
   // Last instruction in bundle must not have the bundle bit set.
   if (!isBundled(MI) && InBundle) {
     O << " }";
@@ -55,6 +61,93 @@ void PatmosInstPrinter::printInst(const MCInst *MI, uint64_t Address,
   printAnnotation(O, Annot);
 }
 
+bool PatmosInstPrinter::applyTargetSpecificCLOption(StringRef Opt) {
+  if (Opt == "timing") {
+    AnnotateTiming = true;
+    return true;
+  }
+  return false;
+}
+
+/// getDelaySlotBundles - Return the number of delay slot bundles of a
+/// delayed control-flow instruction, in sync with
+/// PatmosSubtarget::getCFLDelaySlotCycles.
+static unsigned getDelaySlotBundles(unsigned Opcode, const MCInstrDesc &MID) {
+  if (!MID.hasDelaySlot()) {
+    return 0;
+  }
+  switch (Opcode) {
+  case Patmos::BRCFu:  case Patmos::BRCF:
+  case Patmos::BRCFRu: case Patmos::BRCFR:
+  case Patmos::BRCFTu: case Patmos::BRCFT:
+  case Patmos::BRCFTOu: case Patmos::BRCFTO:
+    return 3;
+  }
+  return MID.isCall() || MID.isReturn() ? 3 : 2;
+}
+
+/// getIssueCycles - Return the cycles MID occupies the pipeline according to
+/// the scheduling model, i.e., the stall cycles of non-delayed control flow.
+static unsigned getIssueCycles(const MCInstrDesc &MID,
+                               const MCSubtargetInfo &STI) {
+  const MCSchedModel &SM = STI.getSchedModel();
+  if (!SM.hasInstrSchedModel()) {
+    return 1;
+  }
+  const MCSchedClassDesc *SC = SM.getSchedClassDesc(MID.getSchedClass());
+  if (!SC->isValid() || SC->isVariant()) {
+    return 1;
+  }
+  unsigned Cycles = 1;
+  for (const MCWriteProcResEntry *I = STI.getWriteProcResBegin(SC),
+                                 *E = STI.getWriteProcResEnd(SC); I != E; ++I) {
+    Cycles = std::max(Cycles, (unsigned)I->Cycles);
+  }
+  return Cycles;
+}
+
+void PatmosInstPrinter::annotateTiming(const MCInst *MI,
+                                       const MCSubtargetInfo &STI) {
+  const MCInstrDesc &MID = MII.get(MI->getOpcode());
+
+  if (getPatmosFormat(MID.TSFlags) == PatmosII::FrmALUl) {
+    *CommentStream << "long immediate, both slots\n";
+  }
+
+  BundleCycles = std::max(BundleCycles, getIssueCycles(MID, STI));
+  if (isPatmosCFL(MI->getOpcode(), MID.TSFlags)) {
+    BundleHasCFL = true;
+    BundleDelaySlots = std::max(BundleDelaySlots,
+                                getDelaySlotBundles(MI->getOpcode(), MID));
+  }
+
+  // The rest is done at the end of the bundle
+  if (isBundled(MI)) {
+    return;
+  }
+
+  BlockCycles += BundleCycles;
+
+  bool EndsBlock = false;
+  if (RemainingDelaySlots) {
+    *CommentStream << "delay slot " << DelaySlots - RemainingDelaySlots + 1
+                   << " of " << DelaySlots << "\n";
+    EndsBlock = --RemainingDelaySlots == 0;
+  } else if (BundleHasCFL) {
+    DelaySlots = RemainingDelaySlots = BundleDelaySlots;
+    EndsBlock = BundleDelaySlots == 0;
+  }
+
+  if (EndsBlock) {
+    *CommentStream << "block: " << BlockCycles << " cycles\n";
+    BlockCycles = 0;
+  }
+
+  BundleCycles = 0;
+  BundleHasCFL = false;
+  BundleDelaySlots = 0;
+}
+
 void PatmosInstPrinter::printInstPrefix(const MCInst *MI, raw_ostream &O) {
 
   // First instruction in bundle?
@@ -25,10 +25,30 @@ namespace llvm {
 
     bool InBundle;
 
+    /// Annotate long immediates, delay slots and the static cycles of blocks
+    /// as comments, enabled by the disassembler option 'timing'.
+    bool AnnotateTiming;
+
+    /// The delay slot bundles of the last delayed control-flow instruction,
+    /// and how many of them remain.
+    unsigned DelaySlots;
+    unsigned RemainingDelaySlots;
+
+    /// The static cycles of the current bundle and block.
+    unsigned BundleCycles;
+    unsigned BlockCycles;
+
+    /// Whether the current bundle contains control flow, and the number of
+    /// its delay slot bundles.
+    bool BundleHasCFL;
+    unsigned BundleDelaySlots;
+
   public:
     PatmosInstPrinter(const MCAsmInfo &mai, const MCInstrInfo &mii,
 	                    const MCRegisterInfo &mri)
-        : MCInstPrinter(mai, mii, mri), InBundle(false)
+        : MCInstPrinter(mai, mii, mri), InBundle(false), AnnotateTiming(false),
+          DelaySlots(0), RemainingDelaySlots(0), BundleCycles(0),
+          BlockCycles(0), BundleHasCFL(false), BundleDelaySlots(0)
     {
       switch (mai.getAssemblerDialect()) {
       case 0: PrintBytes = PrintAsEncoded; break;
@@ -40,6 +60,8 @@ namespace llvm {
     void printInst(const MCInst *MI, uint64_t Address, StringRef Annot,
                    const MCSubtargetInfo &STI, raw_ostream &O) override;
 
+    bool applyTargetSpecificCLOption(StringRef Opt) override;
+
     void printInstPrefix(const MCInst *MI, raw_ostream &O);
 
     void printOperand(const MCInst *MI, unsigned OpNo,
@@ -63,6 +85,10 @@ namespace llvm {
 
   private:
     bool isBundled(const MCInst *MI) const;
+
+    /// annotateTiming - Emit the timing comments of MI to the comment
+    /// stream, the static cycles of a block after its last bundle.
+    void annotateTiming(const MCInst *MI, const MCSubtargetInfo &STI);
   };
 }
 
@@ -14,8 +14,10 @@
 #include "MCTargetDesc/PatmosAsmBackend.h"
 #include "MCTargetDesc/PatmosFixupKinds.h"
 #include "MCTargetDesc/PatmosMCTargetDesc.h"
+#include "PatmosInstrInfo.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCAsmLayout.h"
 #include "llvm/MC/MCAssembler.h"
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCDirectives.h"
@@ -23,6 +25,7 @@
 #include "llvm/MC/MCFixupKindInfo.h"
 #include "llvm/MC/MCObjectWriter.h"
 #include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/MCSymbolELF.h"
 #include "llvm/MC/MCTargetOptions.h"
 #include "llvm/MC/MCValue.h"
 #include "llvm/Support/EndianStream.h"
@@ -118,7 +121,8 @@ getFixupKindInfo(MCFixupKind Kind) const {
     { "FK_Patmos_abs_CFLi",    10,     22,   0 }, // 2 bit shifted, unsigned, for call
     { "FK_Patmos_abs_ALUl",    32,     32,   0 }, // ALU immediate, unsigned
     { "FK_Patmos_stc",         14,     18,   0 }, // 2 bit shifted, unsigned, for stack control
-    { "FK_Patmos_PCrel",       10,     22,   MCFixupKindInfo::FKF_IsPCRel }, // 2 bit shifted, signed, PC relative
+    { "FK_Patmos_PCrel",       10,     22,   MCFixupKindInfo::FKF_IsPCRel |
+                                             MCFixupKindInfo::FKF_IsTarget }, // 2 bit shifted, signed, PC relative
   };
 
   if (Kind < FirstTargetFixupKind)
@@ -129,6 +133,71 @@ getFixupKindInfo(MCFixupKind Kind) const {
   return Infos[Kind - FirstTargetFixupKind];
 }
 
+bool PatmosAsmBackend::evaluateTargetFixup(const MCAssembler &Asm,
+                                           const MCAsmLayout &Layout,
+                                           const MCFixup &Fixup,
+                                           const MCFragment *DF,
+                                           const MCValue &Target,
+                                           uint64_t &Value, bool &WasForced) {
+  assert(Fixup.getKind() == (MCFixupKind)FK_Patmos_PCrel &&
+         "Unexpected target fixup kind");
+  WasForced = false;
+
+  // The displacement, as for all PC-relative fixups. If a relocation is
+  // needed, the object writer computes its addend itself.
+  const MCSymbolRefExpr *A = Target.getSymA();
+  const MCSymbolRefExpr *B = Target.getSymB();
+  Value = Target.getConstant();
+  if (A && A->getSymbol().isDefined())
+    Value += Layout.getSymbolOffset(A->getSymbol());
+  if (B && B->getSymbol().isDefined())
+    Value -= Layout.getSymbolOffset(B->getSymbol());
+  Value -= Layout.getFragmentOffset(DF) + Fixup.getOffset();
+
+  if (!A || B || A->getKind() != MCSymbolRefExpr::VK_None)
+    return false;
+
+  // Patmos programs are linked statically, so a symbol defined in the same
+  // section is the branch target in the final program unless it is weak,
+  // even if the symbol is global. Generic ELF only resolves local symbols.
+  const MCSymbolELF &Sym = cast<MCSymbolELF>(A->getSymbol());
+  if (!Sym.isDefined() || Sym.isVariable() ||
+      &Sym.getSection() != DF->getParent())
+    return false;
+
+  return Sym.getBinding() != ELF::STB_WEAK &&
+         Sym.getType() != ELF::STT_GNU_IFUNC;
+}
+
+bool PatmosAsmBackend::mayNeedRelaxation(const MCInst &Inst,
+                                         const MCSubtargetInfo &STI) const {
+  // The immediate of ALUi instructions is the last operand before the bundle
+  // marker. Only stand-alone instructions are emitted with an expression, the
+  // ALUl variant must not be bundled.
+  unsigned ALUlOpcode;
+  return HasALUlVariant(Inst.getOpcode(), ALUlOpcode) &&
+         Inst.getOperand(Inst.getNumOperands() - 2).isExpr();
+}
+
+bool PatmosAsmBackend::fixupNeedsRelaxation(const MCFixup &Fixup,
+                                            uint64_t Value,
+                                            const MCRelaxableFragment *DF,
+                                            const MCAsmLayout &Layout) const {
+  // Unresolved fixups are relaxed by fixupNeedsRelaxationAdvanced already,
+  // since the ALUi format has no relocation for most addresses.
+  assert(Fixup.getKind() == (MCFixupKind)FK_Patmos_abs_ALUi &&
+         "Unexpected fixup kind for relaxation");
+  return !isUInt<12>(Value);
+}
+
+void PatmosAsmBackend::relaxInstruction(MCInst &Inst,
+                                        const MCSubtargetInfo &STI) const {
+  unsigned ALUlOpcode;
+  if (!HasALUlVariant(Inst.getOpcode(), ALUlOpcode))
+    llvm_unreachable("Relaxing an instruction without ALUl variant");
+  Inst.setOpcode(ALUlOpcode);
+}
+
 /// WriteNopData - Write an (optimal) nop sequence of Count bytes
 /// to the given output. If the target cannot generate such a sequence,
 /// it should return an error.
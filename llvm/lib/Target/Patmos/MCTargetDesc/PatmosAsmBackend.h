@@ -43,6 +43,14 @@ public:
 
   const MCFixupKindInfo &getFixupKindInfo(MCFixupKind Kind) const override;
 
+  /// evaluateTargetFixup - Resolve PC-relative branches to all symbols
+  /// defined in the same section that cannot be preempted, not only to
+  /// local symbols.
+  bool evaluateTargetFixup(const MCAssembler &Asm, const MCAsmLayout &Layout,
+                           const MCFixup &Fixup, const MCFragment *DF,
+                           const MCValue &Target, uint64_t &Value,
+                           bool &WasForced) override;
+
   unsigned getNumFixupKinds() const override {
     return Patmos::NumTargetFixupKinds;
   }
@@ -51,24 +59,22 @@ public:
   /// @{
 
   /// MayNeedRelaxation - Check whether the given instruction may need
-  /// relaxation.
+  /// relaxation, i.e., whether it is an ALUi instruction with an expression
+  /// as immediate that might not fit into 12 bits.
   ///
   /// \param Inst - The instruction to test.
   bool mayNeedRelaxation(const MCInst &Inst,
-                         const MCSubtargetInfo &STI) const override {
-    // TODO return true for small immediates (?)
-    return false;
-  }
+                         const MCSubtargetInfo &STI) const override;
 
   /// fixupNeedsRelaxation - Target specific predicate for whether a given
   /// fixup requires the associated instruction to be relaxed.
   bool fixupNeedsRelaxation(const MCFixup &Fixup, uint64_t Value,
                             const MCRelaxableFragment *DF,
-                            const MCAsmLayout &Layout) const override {
-    // FIXME.
-    llvm_unreachable("RelaxInstruction() unimplemented");
-    return false;
-  }
+                            const MCAsmLayout &Layout) const override;
+
+  /// relaxInstruction - Relax an ALUi instruction to its ALUl variant.
+  void relaxInstruction(MCInst &Inst,
+                        const MCSubtargetInfo &STI) const override;
 
   bool writeNopData(raw_ostream &OS, uint64_t Count, const MCSubtargetInfo *STI) const override;
 
@@ -155,53 +155,6 @@ inline static unsigned getPatmosImmediateSize(uint64_t TSFlags) {
   return 0;
 }
 
-/// getPatmosRegisterNumbering - Given the enum value for some register,
-/// return the number that it corresponds to (the binary representation).
-inline static unsigned getPatmosRegisterNumbering(unsigned RegEnum)
-{
-  // TODO get this from tblgen somehow? (from PatmosReg.Num)
-
-  using namespace Patmos;
-  switch (RegEnum) {
-  case NoRegister: return 0; // Required for default P0 guard
-  case R0:  case S0:  case P0:  return 0;
-  case R1:  case S1:  case P1:  return 1;
-  case R2:  case SL:  case P2:  return 2;
-  case R3:  case SH:  case P3:  return 3;
-  case R4:  case S4:  case P4:  return 4;
-  case R5:  case SS:  case P5:  return 5;
-  case R6:  case ST:  case P6:  return 6;
-  case R7:  case SRB: case P7:  return 7;
-  case R8:  case SRO: return 8;
-  case R9:  case SXB: return 9;
-  case R10: case SXO: return 10;
-  case R11: case S11: return 11;
-  case R12: case S12: return 12;
-  case R13: case S13: return 13;
-  case R14: case S14: return 14;
-  case R15: case S15: return 15;
-
-  case R16: return 16;
-  case R17: return 17;
-  case R18: return 18;
-  case R19: return 19;
-  case R20: return 20;
-  case R21: return 21;
-  case R22: return 22;
-  case R23: return 23;
-  case R24: return 24;
-  case R25: return 25;
-  case R26: return 26;
-  case R27: return 27;
-  case R28: return 28;
-  case RTR: return 29;
-  case RFP: return 30;
-  case RSP: return 31;
-  default:
-    llvm_unreachable("Unknown Patmos register!");
-  }
-}
-
 }
 
 #endif
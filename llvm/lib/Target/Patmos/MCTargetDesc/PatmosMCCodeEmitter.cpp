@@ -24,6 +24,7 @@
 #include "llvm/MC/MCInstrInfo.h"
 #include "llvm/MC/MCRegisterInfo.h"
 #include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Support/EndianStream.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
@@ -34,12 +35,13 @@ class PatmosMCCodeEmitter : public MCCodeEmitter {
   void operator=(const PatmosMCCodeEmitter &); // DO NOT IMPLEMENT
 
   const MCInstrInfo &MCII;
+  const MCRegisterInfo &MRI;
   MCContext &Ctx;
 
 public:
-  PatmosMCCodeEmitter(const MCInstrInfo &mcii, const MCRegisterInfo &MRI, 
+  PatmosMCCodeEmitter(const MCInstrInfo &mcii, const MCRegisterInfo &mri,
                       MCContext &ctx) :
-            MCII(mcii) , Ctx(ctx) {}
+            MCII(mcii), MRI(mri), Ctx(ctx) {}
 
   ~PatmosMCCodeEmitter() override {}
 
@@ -71,15 +73,14 @@ public:
 
   /****** Helper functions to emit binary code ******/
 
-  void EmitByte(unsigned char C, raw_ostream &OS) const {
-    OS << (char)C;
-  }
-
   void EmitInstruction(uint64_t Val, unsigned Size, raw_ostream &OS) const {
-    // Output the instruction encoding in big endian byte order.
-    for (unsigned i = 0; i < Size; ++i) {
-      unsigned Shift = (Size - 1 - i) * 8;
-      EmitByte((Val >> Shift) & 0xff, OS);
+    // Output the instruction encoding in big endian byte order, the words of
+    // ALUl instructions at once.
+    if (Size == 8) {
+      support::endian::write<uint64_t>(OS, Val, support::big);
+    } else {
+      assert(Size == 4 && "Unexpected instruction size");
+      support::endian::write<uint32_t>(OS, Val, support::big);
     }
   }
 
@@ -88,9 +89,8 @@ public:
   unsigned getImmediateEncoding(const MCInst &MI, const MCOperand &MO,
                            SmallVectorImpl<MCFixup> &Fixups) const;
 
-  void addSymbolRefFixups(const MCInst &MI, const MCOperand& MO,
-                                          const MCSymbolRefExpr* Expr,
-                                          SmallVectorImpl<MCFixup> &Fixups) const;
+  void addExprFixups(const MCInst &MI, const MCOperand& MO,
+                     SmallVectorImpl<MCFixup> &Fixups) const;
 
 }; // class PatmosMCCodeEmitter
 }  // namespace
@@ -148,9 +148,9 @@ unsigned PatmosMCCodeEmitter::
 getMachineOpValue(const MCInst &MI, const MCOperand &MO,
                   SmallVectorImpl<MCFixup> &Fixups) const {
   if (MO.isReg()) {
-    unsigned Reg = MO.getReg();
-    unsigned RegNo = getPatmosRegisterNumbering(Reg);
-    return RegNo;
+    // The encodings are generated from the register definitions, the
+    // default P0 guard might have no register.
+    return MRI.getEncodingValue(MO.getReg());
   } else {
     return getImmediateEncoding(MI, MO, Fixups);
   }
@@ -191,37 +191,26 @@ PatmosMCCodeEmitter::getImmediateEncoding(const MCInst &MI, const MCOperand& MO,
   const MCExpr *Expr = MO.getExpr();
   MCExpr::ExprKind Kind = Expr->getKind();
 
-  if (Kind == MCExpr::Binary) {
-    const MCBinaryExpr* BinOp = static_cast<const MCBinaryExpr*>(Expr);
-    Expr = BinOp->getLHS();
-    Kind = Expr->getKind();
-
-    // TODO handle Symbol - Constant? Handle Symbol - Symbol ?
-
-    llvm_unreachable("Binary expressions are currently not supported.");
-  }
-
   if (Kind == MCExpr::Constant) {
-    // TODO do we need this?? Emit as immediate
-    llvm_unreachable("Constant symbols not yet implemented.");
+    return static_cast<unsigned>(cast<MCConstantExpr>(Expr)->getValue());
   }
 
-  if (Kind != MCExpr::SymbolRef) {
+  if (Kind != MCExpr::SymbolRef && Kind != MCExpr::Binary) {
     // TODO do we need to support Unary, Target or even more
     llvm_unreachable("Unsupported expression type.");
   }
 
-  // This adds the whole expression as fixup, not just the symbol part
-  addSymbolRefFixups(MI, MO, cast<MCSymbolRefExpr>(Expr), Fixups);
+  // This adds the whole expression as fixup, e.g., symbol differences are
+  // resolved by the assembler when the layout is known
+  addExprFixups(MI, MO, Fixups);
 
   // All of the information is in the fixup.
   return 0;
 }
 
 void
-PatmosMCCodeEmitter::addSymbolRefFixups(const MCInst &MI, const MCOperand& MO,
-                                        const MCSymbolRefExpr* Expr,
-                                        SmallVectorImpl<MCFixup> &Fixups) const
+PatmosMCCodeEmitter::addExprFixups(const MCInst &MI, const MCOperand& MO,
+                                   SmallVectorImpl<MCFixup> &Fixups) const
 {
   using namespace Patmos;
 
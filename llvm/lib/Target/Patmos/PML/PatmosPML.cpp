@@ -0,0 +1,746 @@
+//===-- PatmosPML.cpp - Machine code flow facts in YAML and binary PML. ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Writers and readers of the YAML and binary encodings of PML, see
+// PatmosPML.h.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PatmosPML.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/YAMLParser.h"
+#include "llvm/Support/YAMLTraits.h"
+
+using namespace llvm;
+using namespace llvm::pml;
+
+static_assert(sizeof(BinaryHeader) == 56, "unexpected binary PML layout");
+static_assert(sizeof(BinaryInstruction) == 36, "unexpected binary PML layout");
+
+/// malformed - Return an error on an invalid PML document.
+static Error malformed(const Twine &Msg) {
+  return createStringError(inconvertibleErrorCode(),
+                           "malformed PML document: " + Msg);
+}
+
+Error Writer::write(const Document &Doc) {
+  writeHeader(Doc.Triple);
+  for (const Function &F : Doc.Functions)
+    writeFunction(F);
+  return finish(Doc.LoopBounds);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// YAML encoding
+
+/// writeQuoted - Write a string as quoted YAML scalar.
+static void writeQuoted(raw_ostream &OS, StringRef S) {
+  OS << '"' << yaml::escape(S) << '"';
+}
+
+/// writeNameList - Write the block names as YAML flow sequence.
+static void writeNameList(raw_ostream &OS, ArrayRef<unsigned> Names) {
+  OS << "[";
+  for (unsigned i = 0; i < Names.size(); i++)
+    OS << (i ? ", " : " ") << Names[i];
+  OS << " ]";
+}
+
+void YAMLWriter::writeHeader(StringRef Triple) {
+  OS << "---\n"
+     << "format: pml-0.1\n"
+     << "triple: " << Triple << "\n";
+  HasFunctions = false;
+}
+
+void YAMLWriter::writeFunction(const Function &F) {
+  if (!HasFunctions)
+    OS << "machine-functions:\n";
+  HasFunctions = true;
+
+  OS << "  - name: " << F.Name << "\n"
+     << "    level: machinecode\n"
+     << "    mapsto: ";
+  writeQuoted(OS, F.MapsTo);
+  OS << "\n"
+     << "    blocks:\n";
+
+  for (const Block &B : F.Blocks) {
+    OS << "      - name: " << B.Name << "\n";
+    if (!B.MapsTo.empty()) {
+      OS << "        mapsto: ";
+      writeQuoted(OS, B.MapsTo);
+      OS << "\n";
+    }
+
+    OS << "        predecessors: ";
+    writeNameList(OS, B.Predecessors);
+    OS << "\n        successors: ";
+    writeNameList(OS, B.Successors);
+    OS << "\n";
+    if (!B.Loops.empty()) {
+      OS << "        loops: ";
+      writeNameList(OS, B.Loops);
+      OS << "\n";
+    }
+
+    if (B.Instructions.empty()) {
+      OS << "        instructions: []\n";
+      continue;
+    }
+
+    OS << "        instructions:\n";
+    for (const Instruction &I : B.Instructions) {
+      OS << "          - index: " << I.Index << "\n"
+         << "            opcode: " << I.Opcode << "\n"
+         << "            size: " << I.Size << "\n";
+      if (I.Bundled)
+        OS << "            bundled: true\n";
+
+      if (!I.BranchType.empty()) {
+        OS << "            branch-type: " << I.BranchType << "\n"
+           << "            branch-delay-slots: " << I.DelaySlots << "\n";
+      }
+      if (!I.Callees.empty()) {
+        OS << "            callees: [";
+        for (unsigned i = 0; i < I.Callees.size(); i++) {
+          OS << (i ? ", " : " ");
+          writeQuoted(OS, I.Callees[i]);
+        }
+        OS << " ]\n";
+      }
+      if (!I.Targets.empty()) {
+        OS << "            branch-targets: ";
+        writeNameList(OS, I.Targets);
+        OS << "\n";
+      }
+
+      if (I.StackCacheArgument)
+        OS << "            stack-cache-argument: " << *I.StackCacheArgument
+           << "\n";
+      if (I.StackCacheSpill)
+        OS << "            stack-cache-spill: " << *I.StackCacheSpill << "\n";
+      if (I.StackCacheFill)
+        OS << "            stack-cache-fill: " << *I.StackCacheFill << "\n";
+      if (!I.DataCacheClass.empty())
+        OS << "            data-cache: " << I.DataCacheClass << "\n";
+    }
+  }
+
+  // every subfunction spans the blocks up to the next region entry, in
+  // layout order
+  OS << "    subfunctions:\n";
+  for (const Subfunction &S : F.Subfunctions) {
+    OS << "      - name: " << S.Name << "\n"
+       << "        blocks: ";
+    writeNameList(OS, S.Blocks);
+    OS << "\n";
+  }
+}
+
+Error YAMLWriter::finish(ArrayRef<LoopBound> LoopBounds) {
+  if (!LoopBounds.empty()) {
+    OS << "flowfacts:\n";
+    for (const LoopBound &LB : LoopBounds) {
+      OS << "  - scope: { function: " << LB.Function << ", loop: "
+         << LB.Header << " }\n"
+         << "    lhs: [ { factor: 1, program-point: { function: "
+         << LB.Function << ", block: " << LB.Header << " } } ]\n"
+         << "    op: less-equal\n"
+         << "    rhs: " << LB.Bound << "\n"
+         << "    level: machinecode\n"
+         << "    origin: llvm.mc\n"
+         << "    classification: loop-local\n";
+    }
+  }
+  OS << "...\n";
+  return Error::success();
+}
+
+namespace {
+  /// The flow facts as written by YAMLWriter::finish.
+  struct YAMLProgramPoint {
+    unsigned Function = 0;
+    unsigned Block = 0;
+  };
+
+  struct YAMLTerm {
+    int Factor = 0;
+    YAMLProgramPoint ProgramPoint;
+  };
+
+  struct YAMLScope {
+    unsigned Function = 0;
+    Optional<unsigned> Loop;
+  };
+
+  struct YAMLFlowFact {
+    YAMLScope Scope;
+    std::vector<YAMLTerm> LHS;
+    std::string Op;
+    unsigned RHS = 0;
+    std::string Level;
+    std::string Origin;
+    std::string Classification;
+  };
+
+  struct YAMLDocument {
+    std::string Format;
+    Document &Doc;
+    std::vector<YAMLFlowFact> FlowFacts;
+
+    YAMLDocument(Document &doc) : Doc(doc) {}
+  };
+} // end of anonymous namespace
+
+LLVM_YAML_IS_SEQUENCE_VECTOR(pml::Instruction)
+LLVM_YAML_IS_SEQUENCE_VECTOR(pml::Block)
+LLVM_YAML_IS_SEQUENCE_VECTOR(pml::Subfunction)
+LLVM_YAML_IS_SEQUENCE_VECTOR(pml::Function)
+LLVM_YAML_IS_FLOW_SEQUENCE_VECTOR(YAMLTerm)
+LLVM_YAML_IS_SEQUENCE_VECTOR(YAMLFlowFact)
+
+namespace llvm {
+namespace yaml {
+  template <> struct MappingTraits<pml::Instruction> {
+    static void mapping(IO &io, pml::Instruction &I) {
+      io.mapRequired("index", I.Index);
+      io.mapRequired("opcode", I.Opcode);
+      io.mapRequired("size", I.Size);
+      io.mapOptional("bundled", I.Bundled, false);
+      io.mapOptional("branch-type", I.BranchType, std::string());
+      io.mapOptional("branch-delay-slots", I.DelaySlots, 0u);
+      io.mapOptional("callees", I.Callees);
+      io.mapOptional("branch-targets", I.Targets);
+      io.mapOptional("stack-cache-argument", I.StackCacheArgument);
+      io.mapOptional("stack-cache-spill", I.StackCacheSpill);
+      io.mapOptional("stack-cache-fill", I.StackCacheFill);
+      io.mapOptional("data-cache", I.DataCacheClass, std::string());
+    }
+  };
+
+  template <> struct MappingTraits<pml::Block> {
+    static void mapping(IO &io, pml::Block &B) {
+      io.mapRequired("name", B.Name);
+      io.mapOptional("mapsto", B.MapsTo, std::string());
+      io.mapOptional("predecessors", B.Predecessors);
+      io.mapOptional("successors", B.Successors);
+      io.mapOptional("loops", B.Loops);
+      io.mapOptional("instructions", B.Instructions);
+    }
+  };
+
+  template <> struct MappingTraits<pml::Subfunction> {
+    static void mapping(IO &io, pml::Subfunction &S) {
+      io.mapRequired("name", S.Name);
+      io.mapRequired("blocks", S.Blocks);
+    }
+  };
+
+  template <> struct MappingTraits<pml::Function> {
+    static void mapping(IO &io, pml::Function &F) {
+      std::string Level;
+      io.mapRequired("name", F.Name);
+      io.mapRequired("level", Level);
+      io.mapRequired("mapsto", F.MapsTo);
+      io.mapOptional("blocks", F.Blocks);
+      io.mapOptional("subfunctions", F.Subfunctions);
+      if (Level != "machinecode")
+        io.setError("unsupported function level '" + Level + "'");
+    }
+  };
+
+  template <> struct MappingTraits<YAMLProgramPoint> {
+    static void mapping(IO &io, YAMLProgramPoint &P) {
+      io.mapRequired("function", P.Function);
+      io.mapRequired("block", P.Block);
+    }
+  };
+
+  template <> struct MappingTraits<YAMLTerm> {
+    static void mapping(IO &io, YAMLTerm &T) {
+      io.mapRequired("factor", T.Factor);
+      io.mapRequired("program-point", T.ProgramPoint);
+    }
+  };
+
+  template <> struct MappingTraits<YAMLScope> {
+    static void mapping(IO &io, YAMLScope &S) {
+      io.mapRequired("function", S.Function);
+      io.mapOptional("loop", S.Loop);
+    }
+  };
+
+  template <> struct MappingTraits<YAMLFlowFact> {
+    static void mapping(IO &io, YAMLFlowFact &F) {
+      io.mapRequired("scope", F.Scope);
+      io.mapRequired("lhs", F.LHS);
+      io.mapRequired("op", F.Op);
+      io.mapRequired("rhs", F.RHS);
+      io.mapRequired("level", F.Level);
+      io.mapOptional("origin", F.Origin, std::string());
+      io.mapOptional("classification", F.Classification, std::string());
+    }
+  };
+
+  template <> struct MappingTraits<YAMLDocument> {
+    static void mapping(IO &io, YAMLDocument &D) {
+      io.mapRequired("format", D.Format);
+      io.mapOptional("triple", D.Doc.Triple, std::string());
+      io.mapOptional("machine-functions", D.Doc.Functions);
+      io.mapOptional("flowfacts", D.FlowFacts);
+    }
+  };
+} // end namespace yaml
+} // end namespace llvm
+
+/// checkFunction - Check that all blocks referenced by F exist.
+static Error checkFunction(const Function &F) {
+  DenseSet<unsigned> Names;
+  for (const Block &B : F.Blocks) {
+    if (!Names.insert(B.Name).second)
+      return malformed("duplicate block " + Twine(B.Name) + " in function " +
+                       Twine(F.Name));
+  }
+
+  auto check = [&](ArrayRef<unsigned> List) -> Error {
+    for (unsigned Name : List) {
+      if (!Names.count(Name))
+        return malformed("unknown block " + Twine(Name) + " in function " +
+                         Twine(F.Name));
+    }
+    return Error::success();
+  };
+
+  for (const Block &B : F.Blocks) {
+    if (Error E = check(B.Predecessors)) return E;
+    if (Error E = check(B.Successors)) return E;
+    if (Error E = check(B.Loops)) return E;
+    for (const Instruction &I : B.Instructions) {
+      if (Error E = check(I.Targets)) return E;
+    }
+  }
+  for (const Subfunction &S : F.Subfunctions) {
+    if (Error E = check(S.Name)) return E;
+    if (Error E = check(S.Blocks)) return E;
+  }
+  return Error::success();
+}
+
+Error pml::readYAML(StringRef Buffer, Document &Doc) {
+  YAMLDocument D(Doc);
+  yaml::Input In(Buffer);
+  In >> D;
+  if (In.error())
+    return malformed(In.error().message());
+  if (D.Format != "pml-0.1")
+    return malformed("unsupported format '" + D.Format + "'");
+
+  for (const Function &F : Doc.Functions) {
+    if (Error E = checkFunction(F))
+      return E;
+  }
+
+  // only the loop bounds of the machine code are supported
+  for (const YAMLFlowFact &FF : D.FlowFacts) {
+    if (FF.Level != "machinecode" || FF.Op != "less-equal" || !FF.Scope.Loop ||
+        FF.LHS.size() != 1 || FF.LHS[0].Factor != 1 ||
+        FF.LHS[0].ProgramPoint.Function != FF.Scope.Function ||
+        FF.LHS[0].ProgramPoint.Block != *FF.Scope.Loop)
+      return malformed("unsupported flow fact in function " +
+                       Twine(FF.Scope.Function));
+
+    LoopBound LB;
+    LB.Function = FF.Scope.Function;
+    LB.Header = *FF.Scope.Loop;
+    LB.Bound = FF.RHS;
+    Doc.LoopBounds.push_back(LB);
+  }
+  return Error::success();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary encoding
+
+static uint8_t encodeBranchType(StringRef BranchType) {
+  return StringSwitch<uint8_t>(BranchType)
+    .Case("call", BT_Call)
+    .Case("return", BT_Return)
+    .Case("indirect", BT_Indirect)
+    .Case("conditional", BT_Conditional)
+    .Case("unconditional", BT_Unconditional)
+    .Default(BT_None);
+}
+
+static StringRef decodeBranchType(uint8_t BranchType) {
+  switch (BranchType) {
+  case BT_Call:          return "call";
+  case BT_Return:        return "return";
+  case BT_Indirect:      return "indirect";
+  case BT_Conditional:   return "conditional";
+  case BT_Unconditional: return "unconditional";
+  }
+  return "";
+}
+
+uint32_t BinaryWriter::getString(StringRef S) {
+  auto I = Strings.insert(std::make_pair(S, (uint32_t)StringTable.size()));
+  if (I.second) {
+    StringTable += S;
+    StringTable += '\0';
+  }
+  return I.first->second;
+}
+
+void BinaryWriter::writeHeader(StringRef triple) {
+  Start = OS.tell();
+  Triple = getString(triple);
+
+  // the header is written again by finish
+  BinaryHeader Header;
+  memset(&Header, 0, sizeof(Header));
+  writeRecord(Header);
+}
+
+void BinaryWriter::writeFunction(const Function &F) {
+  FunctionIndices[F.Name] = FunctionOffsets.size();
+  FunctionOffsets.push_back(OS.tell());
+
+  DenseMap<unsigned, unsigned> Dense;
+  for (unsigned i = 0; i < F.Blocks.size(); i++)
+    Dense[F.Blocks[i].Name] = i;
+
+  std::vector<ulittle32_t> Pool;
+  auto addList = [&](ArrayRef<unsigned> Names) {
+    uint32_t First = Pool.size();
+    for (unsigned Name : Names) {
+      assert(Dense.count(Name) && "unknown block in PML function");
+      Pool.push_back(ulittle32_t(Dense.lookup(Name)));
+    }
+    return First;
+  };
+
+  std::vector<BinaryBlock> Blocks;
+  std::vector<BinaryInstruction> Instructions;
+  uint32_t Offset = 0;
+  for (const Block &B : F.Blocks) {
+    BinaryBlock BB;
+    BB.Name = B.Name;
+    BB.MapsTo = B.MapsTo.empty() ? NoString : getString(B.MapsTo);
+    BB.FirstInstruction = Instructions.size();
+    BB.NumInstructions = B.Instructions.size();
+    BB.Offset = Offset;
+    BB.Predecessors = addList(B.Predecessors);
+    BB.NumPredecessors = B.Predecessors.size();
+    BB.Successors = addList(B.Successors);
+    BB.NumSuccessors = B.Successors.size();
+    BB.Loops = addList(B.Loops);
+    BB.NumLoops = B.Loops.size();
+    Blocks.push_back(BB);
+
+    for (unsigned Header : B.Loops)
+      HeaderIndices[std::make_pair(F.Name, Header)] = Dense.lookup(Header);
+
+    for (const Instruction &I : B.Instructions) {
+      BinaryInstruction BI;
+      BI.Opcode = getString(I.Opcode);
+      BI.Size = I.Size;
+      BI.Flags = (I.Bundled ? IF_Bundled : 0) |
+                 (I.StackCacheArgument ? IF_HasStackCacheArgument : 0) |
+                 (I.StackCacheSpill ? IF_HasStackCacheSpill : 0) |
+                 (I.StackCacheFill ? IF_HasStackCacheFill : 0) |
+                 (I.DataCacheClass == "always-hit" ? IF_AlwaysHit : 0) |
+                 (I.DataCacheClass == "first-miss" ? IF_FirstMiss : 0);
+      BI.BranchType = encodeBranchType(I.BranchType);
+      BI.DelaySlots = I.DelaySlots;
+      BI.Callees = Pool.size();
+      BI.NumCallees = I.Callees.size();
+      for (const std::string &Callee : I.Callees)
+        Pool.push_back(ulittle32_t(getString(Callee)));
+      BI.Targets = addList(I.Targets);
+      BI.NumTargets = I.Targets.size();
+      BI.StackCacheArgument = I.StackCacheArgument.getValueOr(0);
+      BI.StackCacheSpill = I.StackCacheSpill.getValueOr(0);
+      BI.StackCacheFill = I.StackCacheFill.getValueOr(0);
+      Instructions.push_back(BI);
+      Offset += I.Size;
+    }
+  }
+
+  std::vector<BinarySubfunction> Subfunctions;
+  for (const Subfunction &S : F.Subfunctions) {
+    BinarySubfunction BS;
+    BS.Entry = Dense.lookup(S.Name);
+    BS.Blocks = addList(S.Blocks);
+    BS.NumBlocks = S.Blocks.size();
+    Subfunctions.push_back(BS);
+  }
+
+  BinaryFunction BF;
+  BF.Name = F.Name;
+  BF.MapsTo = getString(F.MapsTo);
+  BF.NumBlocks = Blocks.size();
+  BF.NumInstructions = Instructions.size();
+  BF.NumSubfunctions = Subfunctions.size();
+  BF.PoolSize = Pool.size();
+  writeRecord(BF);
+  for (const BinaryBlock &BB : Blocks)
+    writeRecord(BB);
+  for (const BinaryInstruction &BI : Instructions)
+    writeRecord(BI);
+  for (const BinarySubfunction &BS : Subfunctions)
+    writeRecord(BS);
+  for (const ulittle32_t &W : Pool)
+    writeRecord(W);
+}
+
+Error BinaryWriter::finish(ArrayRef<LoopBound> LoopBounds) {
+  BinaryHeader Header;
+  memcpy(Header.Magic, BinaryMagic, sizeof(Header.Magic));
+  Header.Version = BinaryVersion;
+  Header.Triple = Triple;
+  Header.NumFunctions = FunctionOffsets.size();
+  Header.NumLoopBounds = LoopBounds.size();
+  Header.Reserved = 0;
+
+  Header.FunctionTable = OS.tell() - Start;
+  for (uint64_t Offset : FunctionOffsets)
+    writeRecord(ulittle64_t(Offset - Start));
+
+  Header.LoopBoundTable = OS.tell() - Start;
+  for (const LoopBound &LB : LoopBounds) {
+    auto F = FunctionIndices.find(LB.Function);
+    auto H = HeaderIndices.find(std::make_pair(LB.Function, LB.Header));
+    if (F == FunctionIndices.end() || H == HeaderIndices.end())
+      return malformed("loop bound on unknown loop " + Twine(LB.Header) +
+                       " in function " + Twine(LB.Function));
+
+    BinaryLoopBound BL;
+    BL.Function = F->second;
+    BL.Header = H->second;
+    BL.Bound = LB.Bound;
+    writeRecord(BL);
+  }
+
+  Header.StringTable = OS.tell() - Start;
+  Header.StringTableSize = StringTable.size();
+  OS << StringTable;
+
+  OS.pwrite(reinterpret_cast<const char*>(&Header), sizeof(Header), Start);
+  return Error::success();
+}
+
+bool BinaryReader::isBinary(StringRef Buffer) {
+  return Buffer.startswith(StringRef(BinaryMagic, sizeof(BinaryMagic)));
+}
+
+Expected<BinaryReader> BinaryReader::create(MemoryBufferRef Buffer) {
+  BinaryReader R(Buffer.getBuffer());
+  R.Header = R.getRecord<BinaryHeader>(0);
+  if (!R.Header || !isBinary(R.Buffer))
+    return malformed("no binary PML header");
+  if (R.Header->Version != BinaryVersion)
+    return malformed("unsupported binary PML version " +
+                     Twine(R.Header->Version));
+
+  if (!R.getRecord<ulittle64_t>(R.Header->FunctionTable,
+                                R.Header->NumFunctions) ||
+      !R.getRecord<BinaryLoopBound>(R.Header->LoopBoundTable,
+                                    R.Header->NumLoopBounds) ||
+      !R.getRecord<char>(R.Header->StringTable, R.Header->StringTableSize))
+    return malformed("tables exceed the file");
+
+  // all strings are terminated
+  if (R.Header->StringTableSize != 0 &&
+      R.Buffer[R.Header->StringTable + R.Header->StringTableSize - 1] != '\0')
+    return malformed("unterminated string table");
+
+  return R;
+}
+
+Expected<StringRef> BinaryReader::getString(uint32_t Offset) const {
+  if (Offset >= Header->StringTableSize)
+    return malformed("invalid string offset " + Twine(Offset));
+  return StringRef(Buffer.data() + Header->StringTable + Offset);
+}
+
+StringRef BinaryReader::getTriple() const {
+  Expected<StringRef> Triple = getString(Header->Triple);
+  if (!Triple) {
+    consumeError(Triple.takeError());
+    return "";
+  }
+  return *Triple;
+}
+
+Expected<const BinaryFunction*> BinaryReader::getFunction(unsigned Index)
+                                                                         const {
+  if (Index >= Header->NumFunctions)
+    return malformed("invalid function index " + Twine(Index));
+  const ulittle64_t &Offset =
+                  getRecord<ulittle64_t>(Header->FunctionTable)[Index];
+  const BinaryFunction *BF = getRecord<BinaryFunction>(Offset);
+  if (!BF)
+    return malformed("function record exceeds the file");
+  return BF;
+}
+
+Error BinaryReader::readFunction(unsigned Index, Function &F) const {
+  Expected<const BinaryFunction*> BFOrErr = getFunction(Index);
+  if (!BFOrErr)
+    return BFOrErr.takeError();
+  const BinaryFunction &BF = **BFOrErr;
+
+  // locate the records following the function
+  uint64_t Offset = reinterpret_cast<const char*>(&BF) - Buffer.data() +
+                    sizeof(BinaryFunction);
+  const BinaryBlock *Blocks = getRecord<BinaryBlock>(Offset, BF.NumBlocks);
+  Offset += (uint64_t)BF.NumBlocks * sizeof(BinaryBlock);
+  const BinaryInstruction *Instructions =
+                     getRecord<BinaryInstruction>(Offset, BF.NumInstructions);
+  Offset += (uint64_t)BF.NumInstructions * sizeof(BinaryInstruction);
+  const BinarySubfunction *Subfunctions =
+                     getRecord<BinarySubfunction>(Offset, BF.NumSubfunctions);
+  Offset += (uint64_t)BF.NumSubfunctions * sizeof(BinarySubfunction);
+  const ulittle32_t *Pool = getRecord<ulittle32_t>(Offset, BF.PoolSize);
+  if (!Blocks || !Instructions || !Subfunctions || !Pool)
+    return malformed("records of function " + Twine(BF.Name) +
+                     " exceed the file");
+
+  auto readList = [&](uint32_t First, uint32_t Size,
+                      std::vector<unsigned> &Names) -> Error {
+    if (First > BF.PoolSize || Size > BF.PoolSize - First)
+      return malformed("list exceeds the pool of function " + Twine(BF.Name));
+    for (uint32_t i = First; i < First + Size; i++) {
+      if (Pool[i] >= BF.NumBlocks)
+        return malformed("invalid block index in function " + Twine(BF.Name));
+      Names.push_back(Blocks[Pool[i]].Name);
+    }
+    return Error::success();
+  };
+
+  F = Function();
+  F.Name = BF.Name;
+  Expected<StringRef> MapsTo = getString(BF.MapsTo);
+  if (!MapsTo)
+    return MapsTo.takeError();
+  F.MapsTo = MapsTo->str();
+
+  for (unsigned b = 0; b < BF.NumBlocks; b++) {
+    const BinaryBlock &BB = Blocks[b];
+    F.Blocks.emplace_back();
+    Block &B = F.Blocks.back();
+    B.Name = BB.Name;
+    if (BB.MapsTo != NoString) {
+      Expected<StringRef> MapsTo = getString(BB.MapsTo);
+      if (!MapsTo)
+        return MapsTo.takeError();
+      B.MapsTo = MapsTo->str();
+    }
+    if (Error E = readList(BB.Predecessors, BB.NumPredecessors,
+                           B.Predecessors))
+      return E;
+    if (Error E = readList(BB.Successors, BB.NumSuccessors, B.Successors))
+      return E;
+    if (Error E = readList(BB.Loops, BB.NumLoops, B.Loops))
+      return E;
+
+    if (BB.FirstInstruction > BF.NumInstructions ||
+        BB.NumInstructions > BF.NumInstructions - BB.FirstInstruction)
+      return malformed("instructions of block " + Twine(BB.Name) +
+                       " exceed function " + Twine(BF.Name));
+
+    for (unsigned i = 0; i < BB.NumInstructions; i++) {
+      const BinaryInstruction &BI = Instructions[BB.FirstInstruction + i];
+      B.Instructions.emplace_back();
+      Instruction &I = B.Instructions.back();
+      I.Index = i;
+      Expected<StringRef> Opcode = getString(BI.Opcode);
+      if (!Opcode)
+        return Opcode.takeError();
+      I.Opcode = Opcode->str();
+      I.Size = BI.Size;
+      I.Bundled = BI.Flags & IF_Bundled;
+      I.BranchType = decodeBranchType(BI.BranchType).str();
+      I.DelaySlots = BI.DelaySlots;
+
+      if (BI.Callees > BF.PoolSize || BI.NumCallees > BF.PoolSize - BI.Callees)
+        return malformed("list exceeds the pool of function " +
+                         Twine(BF.Name));
+      for (uint32_t c = BI.Callees; c < BI.Callees + BI.NumCallees; c++) {
+        Expected<StringRef> Callee = getString(Pool[c]);
+        if (!Callee)
+          return Callee.takeError();
+        I.Callees.push_back(Callee->str());
+      }
+      if (Error E = readList(BI.Targets, BI.NumTargets, I.Targets))
+        return E;
+
+      if (BI.Flags & IF_HasStackCacheArgument)
+        I.StackCacheArgument = (unsigned)BI.StackCacheArgument;
+      if (BI.Flags & IF_HasStackCacheSpill)
+        I.StackCacheSpill = (unsigned)BI.StackCacheSpill;
+      if (BI.Flags & IF_HasStackCacheFill)
+        I.StackCacheFill = (unsigned)BI.StackCacheFill;
+      if (BI.Flags & IF_AlwaysHit)
+        I.DataCacheClass = "always-hit";
+      else if (BI.Flags & IF_FirstMiss)
+        I.DataCacheClass = "first-miss";
+    }
+  }
+
+  for (unsigned s = 0; s < BF.NumSubfunctions; s++) {
+    const BinarySubfunction &BS = Subfunctions[s];
+    if (BS.Entry >= BF.NumBlocks)
+      return malformed("invalid block index in function " + Twine(BF.Name));
+    F.Subfunctions.emplace_back();
+    Subfunction &S = F.Subfunctions.back();
+    S.Name = Blocks[BS.Entry].Name;
+    if (Error E = readList(BS.Blocks, BS.NumBlocks, S.Blocks))
+      return E;
+  }
+  return Error::success();
+}
+
+Error BinaryReader::readLoopBounds(std::vector<LoopBound> &LoopBounds) const {
+  const BinaryLoopBound *BLs =
+      getRecord<BinaryLoopBound>(Header->LoopBoundTable, Header->NumLoopBounds);
+  for (unsigned i = 0; i < Header->NumLoopBounds; i++) {
+    Expected<const BinaryFunction*> BF = getFunction(BLs[i].Function);
+    if (!BF)
+      return BF.takeError();
+
+    // the block records directly follow the function record
+    const BinaryBlock *Blocks = getRecord<BinaryBlock>(
+        reinterpret_cast<const char*>(*BF) - Buffer.data() +
+        sizeof(BinaryFunction), (*BF)->NumBlocks);
+    if (!Blocks || BLs[i].Header >= (*BF)->NumBlocks)
+      return malformed("invalid loop header in function " +
+                       Twine((*BF)->Name));
+
+    LoopBound LB;
+    LB.Function = (*BF)->Name;
+    LB.Header = Blocks[BLs[i].Header].Name;
+    LB.Bound = BLs[i].Bound;
+    LoopBounds.push_back(LB);
+  }
+  return Error::success();
+}
+
+Error BinaryReader::read(Document &Doc) const {
+  Doc = Document();
+  Doc.Triple = getTriple().str();
+  for (unsigned i = 0; i < getNumFunctions(); i++) {
+    Doc.Functions.emplace_back();
+    if (Error E = readFunction(i, Doc.Functions.back()))
+      return E;
+  }
+  return readLoopBounds(Doc.LoopBounds);
+}
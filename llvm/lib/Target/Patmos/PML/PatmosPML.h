@@ -0,0 +1,342 @@
+//===-- PatmosPML.h - Machine code flow facts in YAML and binary PML. -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The machine code part of PML documents, as exported by -mpatmos-serialize,
+// and its two encodings:
+//  - YAML, as read by platin, and
+//  - a compact binary encoding, which can be memory mapped and accessed
+//    without decoding the entire file.
+//
+// Both writers stream the document one function at a time, only the loop
+// bounds are passed at the end.
+//
+// The binary encoding consists of
+//  - a header, see BinaryHeader,
+//  - the function records, each followed by its block, instruction and
+//    subfunction records and a pool of 32-bit words holding their lists,
+//  - a table of the file offsets of the function records,
+//  - the loop bound records, and
+//  - a string table of NUL terminated strings.
+// Blocks and instructions are identified by their dense index within their
+// function, functions by their index in the function table. All integers are
+// little endian. Instruction addresses are not stored, they are given by the
+// sizes of the preceding instructions, starting at the function relative
+// offset of their block.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _LLVM_TARGET_PATMOS_PML_PATMOSPML_H_
+#define _LLVM_TARGET_PATMOS_PML_PATMOSPML_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace pml {
+
+  /// Instruction - A single, i.e., not bundled, machine instruction.
+  struct Instruction {
+    /// The index of the instruction within its block.
+    unsigned Index = 0;
+    std::string Opcode;
+    unsigned Size = 0;
+    /// True for the second slot of a bundle.
+    bool Bundled = false;
+    /// The branch type, see getBranchType, or an empty string.
+    std::string BranchType;
+    unsigned DelaySlots = 0;
+    /// The callees of a call, "__any" if they are unknown.
+    std::vector<std::string> Callees;
+    /// The names of the blocks branched to.
+    std::vector<unsigned> Targets;
+    Optional<unsigned> StackCacheArgument;
+    Optional<unsigned> StackCacheSpill;
+    Optional<unsigned> StackCacheFill;
+    /// The classification of a data cache load, "always-hit" or
+    /// "first-miss", or an empty string if it may miss.
+    std::string DataCacheClass;
+  };
+
+  /// Block - A machine basic block, named by its number.
+  struct Block {
+    unsigned Name = 0;
+    /// The name of the bitcode block, if any.
+    std::string MapsTo;
+    std::vector<unsigned> Predecessors;
+    std::vector<unsigned> Successors;
+    /// The headers of the enclosing loops, from the innermost one.
+    std::vector<unsigned> Loops;
+    std::vector<Instruction> Instructions;
+  };
+
+  /// Subfunction - A method cache region, named by its entry block.
+  struct Subfunction {
+    unsigned Name = 0;
+    std::vector<unsigned> Blocks;
+  };
+
+  /// Function - A machine function, named by its function number.
+  struct Function {
+    unsigned Name = 0;
+    /// The name of the bitcode function.
+    std::string MapsTo;
+    std::vector<Block> Blocks;
+    std::vector<Subfunction> Subfunctions;
+  };
+
+  /// LoopBound - A loop bound flow fact: the maximum number of executions of
+  /// the header block per entry of the loop.
+  struct LoopBound {
+    unsigned Function = 0;
+    unsigned Header = 0;
+    unsigned Bound = 0;
+  };
+
+  /// Document - An entire machine code PML document.
+  struct Document {
+    std::string Triple;
+    std::vector<Function> Functions;
+    std::vector<LoopBound> LoopBounds;
+  };
+
+  /// Writer - Stream a PML document, one function at a time.
+  class Writer {
+  public:
+    virtual ~Writer() {}
+
+    /// writeHeader - Start the document.
+    virtual void writeHeader(StringRef Triple) = 0;
+
+    /// writeFunction - Append a machine function to the document.
+    virtual void writeFunction(const Function &F) = 0;
+
+    /// finish - Write the loop bounds and complete the document.
+    virtual Error finish(ArrayRef<LoopBound> LoopBounds) = 0;
+
+    /// write - Write an entire document.
+    Error write(const Document &Doc);
+  };
+
+  /// YAMLWriter - Write PML as a YAML document.
+  class YAMLWriter : public Writer {
+  private:
+    raw_ostream &OS;
+    bool HasFunctions = false;
+
+  public:
+    YAMLWriter(raw_ostream &os) : OS(os) {}
+
+    void writeHeader(StringRef Triple) override;
+    void writeFunction(const Function &F) override;
+    Error finish(ArrayRef<LoopBound> LoopBounds) override;
+  };
+
+  /// The magic number and version of the binary encoding.
+  static const char BinaryMagic[4] = { 'P', 'M', 'L', 'B' };
+  static const unsigned BinaryVersion = 1;
+
+  /// NoString - The string table offset of absent strings.
+  static const uint32_t NoString = ~0u;
+
+  typedef support::ulittle32_t ulittle32_t;
+  typedef support::ulittle64_t ulittle64_t;
+
+  /// The branch types of instruction records.
+  enum BinaryBranchType : uint8_t {
+    BT_None, BT_Call, BT_Return, BT_Indirect, BT_Conditional, BT_Unconditional
+  };
+
+  /// The flags of instruction records.
+  enum BinaryInstructionFlags : uint8_t {
+    IF_Bundled               = 1 << 0,
+    IF_HasStackCacheArgument = 1 << 1,
+    IF_HasStackCacheSpill    = 1 << 2,
+    IF_HasStackCacheFill     = 1 << 3,
+    IF_AlwaysHit             = 1 << 4,
+    IF_FirstMiss             = 1 << 5
+  };
+
+  struct BinaryHeader {
+    char Magic[4];
+    ulittle32_t Version;
+    /// The target triple, in the string table.
+    ulittle32_t Triple;
+    ulittle32_t NumFunctions;
+    ulittle32_t NumLoopBounds;
+    ulittle32_t Reserved;
+    /// The file offset of the table of 64-bit function record offsets.
+    ulittle64_t FunctionTable;
+    ulittle64_t LoopBoundTable;
+    ulittle64_t StringTable;
+    ulittle64_t StringTableSize;
+  };
+
+  struct BinaryFunction {
+    ulittle32_t Name;
+    ulittle32_t MapsTo;
+    ulittle32_t NumBlocks;
+    ulittle32_t NumInstructions;
+    ulittle32_t NumSubfunctions;
+    /// The number of words in the pool of the function.
+    ulittle32_t PoolSize;
+  };
+
+  /// BinaryBlock - A block record, lists are given by their first word in the
+  /// pool of the function and their length, and hold dense block indices.
+  struct BinaryBlock {
+    ulittle32_t Name;
+    ulittle32_t MapsTo;
+    /// The dense index of the first instruction of the block.
+    ulittle32_t FirstInstruction;
+    ulittle32_t NumInstructions;
+    /// The offset of the first instruction of the block in bytes, relative to
+    /// the function.
+    ulittle32_t Offset;
+    ulittle32_t Predecessors;
+    ulittle32_t NumPredecessors;
+    ulittle32_t Successors;
+    ulittle32_t NumSuccessors;
+    ulittle32_t Loops;
+    ulittle32_t NumLoops;
+  };
+
+  /// BinaryInstruction - An instruction record, callees are string table
+  /// offsets in the pool, targets dense block indices.
+  struct BinaryInstruction {
+    ulittle32_t Opcode;
+    uint8_t Size;
+    uint8_t Flags;
+    uint8_t BranchType;
+    uint8_t DelaySlots;
+    ulittle32_t Callees;
+    ulittle32_t NumCallees;
+    ulittle32_t Targets;
+    ulittle32_t NumTargets;
+    ulittle32_t StackCacheArgument;
+    ulittle32_t StackCacheSpill;
+    ulittle32_t StackCacheFill;
+  };
+
+  struct BinarySubfunction {
+    /// The dense index of the entry block.
+    ulittle32_t Entry;
+    ulittle32_t Blocks;
+    ulittle32_t NumBlocks;
+  };
+
+  struct BinaryLoopBound {
+    /// The index of the function in the function table.
+    ulittle32_t Function;
+    /// The dense index of the header block.
+    ulittle32_t Header;
+    ulittle32_t Bound;
+  };
+
+  /// BinaryWriter - Write PML in the binary encoding. The header is written
+  /// again when the document is finished, the stream must thus support
+  /// pwrite. Only the string table and the loop headers are kept in memory.
+  class BinaryWriter : public Writer {
+  private:
+    raw_pwrite_stream &OS;
+
+    uint64_t Start = 0;
+    uint32_t Triple = NoString;
+
+    /// The string table and the offsets of the strings in it.
+    std::string StringTable;
+    StringMap<uint32_t> Strings;
+
+    /// The file offsets of the function records.
+    std::vector<uint64_t> FunctionOffsets;
+
+    /// The function index and dense block indices of the loop headers, by
+    /// function and block name.
+    DenseMap<unsigned, unsigned> FunctionIndices;
+    DenseMap<std::pair<unsigned, unsigned>, unsigned> HeaderIndices;
+
+    /// getString - Return the string table offset of S.
+    uint32_t getString(StringRef S);
+
+    template<typename T>
+    void writeRecord(const T &R) {
+      OS.write(reinterpret_cast<const char*>(&R), sizeof(T));
+    }
+
+  public:
+    BinaryWriter(raw_pwrite_stream &os) : OS(os) {}
+
+    void writeHeader(StringRef Triple) override;
+    void writeFunction(const Function &F) override;
+    Error finish(ArrayRef<LoopBound> LoopBounds) override;
+  };
+
+  /// BinaryReader - Access a memory mapped PML document in the binary
+  /// encoding. Only the header is checked when the reader is created, the
+  /// records of a function are checked when it is read.
+  class BinaryReader {
+  private:
+    StringRef Buffer;
+    const BinaryHeader *Header = nullptr;
+
+    BinaryReader(StringRef buffer) : Buffer(buffer) {}
+
+    /// getRecord - Return the record at Offset, or null if it exceeds the
+    /// buffer.
+    template<typename T>
+    const T *getRecord(uint64_t Offset, uint64_t Count = 1) const {
+      if (Offset > Buffer.size() || Count > (Buffer.size() - Offset) / sizeof(T))
+        return nullptr;
+      return reinterpret_cast<const T*>(Buffer.data() + Offset);
+    }
+
+  public:
+    /// create - Return a reader for Buffer, or an error if it is no valid
+    /// binary PML document.
+    static Expected<BinaryReader> create(MemoryBufferRef Buffer);
+
+    /// isBinary - Return true if Buffer starts like a binary PML document.
+    static bool isBinary(StringRef Buffer);
+
+    unsigned getNumFunctions() const { return Header->NumFunctions; }
+    unsigned getNumLoopBounds() const { return Header->NumLoopBounds; }
+
+    /// getString - Return the string at Offset of the string table.
+    Expected<StringRef> getString(uint32_t Offset) const;
+
+    StringRef getTriple() const;
+
+    /// getFunction - Return the record of the function at Index, without
+    /// checking the records that follow it.
+    Expected<const BinaryFunction*> getFunction(unsigned Index) const;
+
+    /// readFunction - Decode the function at Index.
+    Error readFunction(unsigned Index, Function &F) const;
+
+    /// readLoopBounds - Decode the loop bounds.
+    Error readLoopBounds(std::vector<LoopBound> &LoopBounds) const;
+
+    /// read - Decode the entire document.
+    Error read(Document &Doc) const;
+  };
+
+  /// readYAML - Parse a YAML PML document.
+  Error readYAML(StringRef Buffer, Document &Doc);
+
+} // end namespace pml
+} // end namespace llvm
+
+#endif // _LLVM_TARGET_PATMOS_PML_PATMOSPML_H_
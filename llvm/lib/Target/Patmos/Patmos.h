@@ -18,6 +18,9 @@
 #include "MCTargetDesc/PatmosMCTargetDesc.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
 
 
 namespace llvm {
@@ -27,28 +30,77 @@ namespace llvm {
   class formatted_raw_ostream;
   class PassRegistry;
 
+  /// The timer group of the expensive phases of the Patmos passes, reported
+  /// by -time-passes in addition to the times of the passes.
+  constexpr const char *PatmosTimerGroupName = "patmos";
+  constexpr const char *PatmosTimerGroupDescription = "Patmos Code Generation";
+
+  /// PatmosPhaseScope - Measure an expensive phase of a Patmos pass, in the
+  /// Patmos timer group of -time-passes, which also reports the change of the
+  /// heap usage, and as a scope of the -ftime-trace profile, with the heap
+  /// usage at its start and the Unit it processes, e.g., the function.
+  class PatmosPhaseScope {
+    NamedRegionTimer Timer;
+    TimeTraceScope Trace;
+  public:
+    PatmosPhaseScope(StringRef Name, StringRef Description,
+                     StringRef Unit = "")
+      : Timer(Name, Description, PatmosTimerGroupName,
+              PatmosTimerGroupDescription, TimePassesIsEnabled),
+        Trace(Description, [&]() {
+          return (Unit.empty() ? Twine() : Twine(Unit) + " ").str() +
+                 "heap " + std::to_string(sys::Process::GetMallocUsage());
+        }) {}
+  };
+
   void initializePatmosCallGraphBuilderPass(PassRegistry&);
+  void initializePatmosCallGraphCachePass(PassRegistry&);
   void initializePatmosStackCacheAnalysisInfoPass(PassRegistry&);
   void initializePatmosPostRASchedulerPass(PassRegistry&);
   void initializePatmosPMLProfileImportPasS(PassRegistry&);
 
   FunctionPass *createPatmosISelDag(PatmosTargetMachine &TM, llvm::CodeGenOpt::Level OptLevel);
-  ModulePass   *createPatmosSPClonePass();
+  FunctionPass *createPatmosSPLoopBoundPass();
+  FunctionPass *createPatmosSPSwitchLookupPass();
+  FunctionPass *createPatmosLoopBoundVerifierPass();
+  FunctionPass *createPatmosBoundedAllocasPass();
+  FunctionPass *createPatmosSPMTilingPass();
+  ModulePass   *createPatmosProfileInstrumentationPass();
+  ModulePass   *createPatmosSPClonePass(const PatmosTargetMachine &tm);
   MachineFunctionPass *createPatmosSPMarkPass(PatmosTargetMachine &tm);
   FunctionPass *createPatmosSinglePathInfoPass(const PatmosTargetMachine &tm);
   FunctionPass *createPatmosSPPreparePass(const PatmosTargetMachine &tm);
+  FunctionPass *createPatmosSPUnrollPass(const PatmosTargetMachine &tm);
+  ModulePass   *createPatmosSPFrameCoalescingPass(const PatmosTargetMachine &tm);
   FunctionPass *createPatmosSPBundlingPass(const PatmosTargetMachine &tm);
   FunctionPass *createPatmosSPReducePass(const PatmosTargetMachine &tm);
   FunctionPass *createSPSchedulerPass(const PatmosTargetMachine &tm);
+  FunctionPass *createPatmosSPTimingPass(const PatmosTargetMachine &tm);
   FunctionPass *createPatmosDelaySlotFillerPass(const PatmosTargetMachine &tm,
                                                 bool ForceDisable);
   FunctionPass *createPatmosFunctionSplitterPass(PatmosTargetMachine &tm);
   FunctionPass *createPatmosDelaySlotKillerPass(PatmosTargetMachine &tm);
+  FunctionPass *createPatmosLongImmSplitPass(PatmosTargetMachine &tm);
+  FunctionPass *createPatmosPeepholePass(PatmosTargetMachine &tm);
+  FunctionPass *createPatmosPredicateCSEPass(PatmosTargetMachine &tm);
   FunctionPass *createPatmosEnsureAlignmentPass(PatmosTargetMachine &tm);
+  FunctionPass *createPatmosConstantTimeCheckPass(PatmosTargetMachine &tm);
+  FunctionPass *createPatmosDataCacheAnalysisPass(PatmosTargetMachine &tm);
+  FunctionPass *createPatmosBlockFrequenciesPass();
   FunctionPass *createPatmosIntrinsicEliminationPass();
+  FunctionPass *createPatmosEnsurePlacementPass(
+                                             const PatmosTargetMachine &tm);
+  FunctionPass *createPatmosPredSpillCoalescingPass(
+                                                const PatmosTargetMachine &tm);
   ModulePass *createPatmosCallGraphBuilder();
+  ModulePass *createPatmosDeadFunctionEliminationPass();
   ModulePass *createPatmosStackCacheAnalysis(const PatmosTargetMachine &tm);
   ModulePass *createPatmosStackCacheAnalysisInfo(const PatmosTargetMachine &tm);
+  ModulePass *createPatmosFunctionOrderingPass(const std::string &OrderFile);
+  ModulePass *createPatmosPMLExportPass(const PatmosTargetMachine &tm,
+                                        const std::string &PMLFile);
+  ModulePass *createPatmosWCETEstimatePass(const PatmosTargetMachine &tm,
+                                           const std::string &ReportFile);
 
   extern char &PatmosPostRASchedulerID;
 } // end namespace llvm;
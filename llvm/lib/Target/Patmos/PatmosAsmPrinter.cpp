@@ -19,7 +19,9 @@
 #include "TargetInfo/PatmosTargetInfo.h"
 #include "InstPrinter/PatmosInstPrinter.h"
 #include "MCTargetDesc/PatmosTargetStreamer.h"
+#include "SinglePath/PatmosSinglePathInfo.h"
 #include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/BinaryFormat/ELF.h"
 #include "llvm/IR/Function.h"
 #include "llvm/CodeGen/AsmPrinter.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
@@ -27,6 +29,7 @@
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCSectionELF.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/MC/MCParser/MCAsmParser.h"
@@ -47,18 +50,69 @@ static cl::opt<bool> EnableBasicBlockSymbols(
            "named like the IR basic blocks."),
   cl::Hidden);
 
+/// EnableBlockAnnotations - If enabled, every basic block is annotated with
+/// its statically scheduled cycles and the sources of stalls.
+static cl::opt<bool> EnableBlockAnnotations(
+  "mpatmos-annotate-blocks",
+  cl::init(false),
+  cl::desc("Annotate basic blocks with their cycles, dual-issue rate, NOPs, "
+           "stall sources and method cache region."),
+  cl::Hidden);
+
+/// EmitSummaries - If enabled, the stack cache usage, the callees and the
+/// single-path kind of every function are emitted for the linker, which
+/// analyses the whole program of separately compiled objects with them.
+static cl::opt<bool> EmitSummaries(
+  "mpatmos-emit-summary",
+  cl::init(false),
+  cl::desc("Emit a .patmos.summary section with the stack cache usage, "
+           "callees and single-path kind of the functions, for the linker."),
+  cl::Hidden);
+
+/// The version of the .patmos.summary format, see emitSummaries.
+static const unsigned SummaryVersion = 1;
+
+/// The flags of a function in the .patmos.summary section.
+enum SummaryFlags {
+  SF_SinglePathRoot      = 1 << 0,
+  SF_SinglePathReachable = 1 << 1,
+  SF_SinglePathMaybe     = 1 << 2,
+  SF_IndirectCalls       = 1 << 3,
+  SF_SinglePathShared    = 1 << 4
+};
+
 
 
 void PatmosAsmPrinter::emitFunctionEntryLabel() {
   // Create a temp label that will be emitted at the end of the first cache block (at the end of the function
   // if the function has only one cache block)
   CurrCodeEnd = OutContext.createTempSymbol();
+  CurrRegion = 0;
 
   // emit a function/subfunction start directive
   EmitFStart(CurrentFnSymForSize, CurrCodeEnd, FStartAlignment, TM.getMCSubtargetInfo());
 
   // Now emit the normal function label
   AsmPrinter::emitFunctionEntryLabel();
+
+  // Print the execution time of single-path code if it was computed
+  auto PMFI = MF->getInfo<PatmosMachineFunctionInfo>();
+  if (PMFI->getSinglePathCycles() > -1) {
+    OutStreamer->GetCommentOS() << "Single-path cycles: "
+                                << (PMFI->isSinglePathCyclesExact() ? "" : ">= ")
+                                << PMFI->getSinglePathCycles() << "\n";
+    OutStreamer->AddBlankLine();
+  }
+
+  // Print the WCET estimate if it was computed
+  if (PMFI->hasWCETEstimate()) {
+    OutStreamer->GetCommentOS() << "WCET estimate: ";
+    if (PMFI->getWCETEstimate() < 0)
+      OutStreamer->GetCommentOS() << "unbounded\n";
+    else
+      OutStreamer->GetCommentOS() << PMFI->getWCETEstimate() << " cycles\n";
+    OutStreamer->AddBlankLine();
+  }
 }
 
 void PatmosAsmPrinter::emitBasicBlockStart(const MachineBasicBlock &MBB) {
@@ -82,6 +136,7 @@ void PatmosAsmPrinter::emitBasicBlockStart(const MachineBasicBlock &MBB) {
 
     // create new end symbol
     CurrCodeEnd = OutContext.createTempSymbol();
+    CurrRegion++;
 
     // mark subfunction labels as function labels
     OutStreamer->emitSymbolAttribute(SymStart, MCSA_ELF_TypeFunction);
@@ -141,6 +196,64 @@ void PatmosAsmPrinter::emitBasicBlockBegin(const MachineBasicBlock &MBB) {
     OutStreamer->AddBlankLine();
   }
 
+  if (EnableBlockAnnotations)
+    emitBlockAnnotation(MBB);
+}
+
+void PatmosAsmPrinter::emitBlockAnnotation(const MachineBasicBlock &MBB) {
+  const PatmosInstrInfo &TII = *PTM->getInstrInfo();
+  const PatmosSubtarget &STI = *PTM->getSubtargetImpl();
+
+  unsigned Bundles = 0, DualIssue = 0, Nops = 0, Stalls = 0;
+  std::vector<StringRef> StallSources;
+  for (const MachineInstr &MI : MBB) {
+    if (TII.isPseudo(&MI))
+      continue;
+
+    // every bundle issues in a single cycle
+    Bundles++;
+
+    unsigned Slots = 0;
+    MachineBasicBlock::const_instr_iterator II = MI.getIterator();
+    if (MI.isBundle())
+      ++II;
+    do {
+      if (!II->isPseudo()) {
+        Slots++;
+        if (II->getOpcode() == Patmos::NOP)
+          Nops++;
+      }
+
+      // non-delayed control-flow instructions stall for their delay slots
+      if ((II->isBranch() || II->isCall() || II->isReturn()) &&
+          !II->hasDelaySlot())
+        Stalls += STI.getDelaySlotCycles(*II);
+
+      if (TII.mayStall(&*II)) {
+        StringRef Name = TII.getName(II->getOpcode());
+        if (!is_contained(StallSources, Name))
+          StallSources.push_back(Name);
+      }
+      ++II;
+    } while (II != MBB.instr_end() && II->isInsideBundle());
+
+    if (Slots > 1)
+      DualIssue++;
+  }
+
+  OutStreamer->GetCommentOS() << "Block: " << Bundles + Stalls << " cycles ("
+                              << Stalls << " stall), " << Bundles
+                              << " bundles, "
+                              << (Bundles ? DualIssue * 100 / Bundles : 0)
+                              << "% dual-issue, " << Nops << " nops, region "
+                              << CurrRegion << "\n";
+  if (!StallSources.empty()) {
+    OutStreamer->GetCommentOS() << "May stall:";
+    for (StringRef Name : StallSources)
+      OutStreamer->GetCommentOS() << " " << Name;
+    OutStreamer->GetCommentOS() << "\n";
+  }
+  OutStreamer->AddBlankLine();
 }
 
 
@@ -163,6 +276,79 @@ void PatmosAsmPrinter::emitBasicBlockEnd(const MachineBasicBlock &MBB) {
 void PatmosAsmPrinter::emitFunctionBodyEnd() {
   // Emit the end symbol of the last cache block
   OutStreamer->emitLabel(CurrCodeEnd);
+
+  if (EmitSummaries)
+    addSummary();
+}
+
+void PatmosAsmPrinter::emitEndOfAsmFile(Module &M) {
+  if (EmitSummaries && !Summaries.empty())
+    emitSummaries();
+  Summaries.clear();
+}
+
+void PatmosAsmPrinter::addSummary() {
+  const PatmosMachineFunctionInfo *PMFI =
+                                       MF->getInfo<PatmosMachineFunctionInfo>();
+  FunctionSummary Summary;
+  Summary.Sym = CurrentFnSym;
+  Summary.StackCacheBytes = PMFI->getStackCacheReservedBytes();
+
+  Summary.Flags = 0;
+  if (PatmosSinglePathInfo::isRoot(*MF))
+    Summary.Flags |= SF_SinglePathRoot;
+  if (PatmosSinglePathInfo::isReachable(*MF))
+    Summary.Flags |= SF_SinglePathReachable;
+  if (PatmosSinglePathInfo::isMaybe(*MF))
+    Summary.Flags |= SF_SinglePathMaybe;
+  if (PatmosSinglePathInfo::isShared(*MF))
+    Summary.Flags |= SF_SinglePathShared;
+
+  for (const MachineBasicBlock &MBB : *MF) {
+    for (const MachineInstr &MI : MBB.instrs()) {
+      if (!MI.isCall())
+        continue;
+
+      MCSymbol *Callee = nullptr;
+      for (const MachineOperand &MO : MI.operands()) {
+        if (MO.isGlobal())
+          Callee = getSymbol(MO.getGlobal());
+        else if (MO.isSymbol())
+          Callee = GetExternalSymbolSymbol(MO.getSymbolName());
+      }
+      if (!Callee)
+        Summary.Flags |= SF_IndirectCalls;
+      else if (!is_contained(Summary.Callees, Callee))
+        Summary.Callees.push_back(Callee);
+    }
+  }
+  Summaries.push_back(std::move(Summary));
+}
+
+void PatmosAsmPrinter::emitSummaries() {
+  // The section consists of 32 bit words, the version followed by one
+  // record per function:
+  //   the address of the function,
+  //   its SummaryFlags,
+  //   the bytes it reserves in the stack cache,
+  //   the number of its direct callees, followed by their addresses.
+  // The addresses are relocated, the linker finds the symbols by the
+  // relocations.
+  MCSection *Section = OutContext.getELFSection(".patmos.summary",
+                                                ELF::SHT_PROGBITS, 0);
+  OutStreamer->SwitchSection(Section);
+  OutStreamer->emitValueToAlignment(4);
+  OutStreamer->emitInt32(SummaryVersion);
+
+  for (const FunctionSummary &Summary : Summaries) {
+    OutStreamer->emitValue(MCSymbolRefExpr::create(Summary.Sym, OutContext),
+                           4);
+    OutStreamer->emitInt32(Summary.Flags);
+    OutStreamer->emitInt32(Summary.StackCacheBytes);
+    OutStreamer->emitInt32(Summary.Callees.size());
+    for (MCSymbol *Callee : Summary.Callees)
+      OutStreamer->emitValue(MCSymbolRefExpr::create(Callee, OutContext), 4);
+  }
 }
 
 void PatmosAsmPrinter::emitDotSize(MCSymbol *SymStart, MCSymbol *SymEnd) {
@@ -498,11 +684,13 @@ static void EmitGCCInlineAsmStr(const char *AsmStr, const MachineInstr *MI,
   OS << '\n' << (char)0;  // null terminate string.
 }
 
-/// This method has been copied from lib/CodeGen/AsmPrinterAsmPrinterInlineAsm.cpp
-/// since its 'emitInlineAsm" method is private, but we need it to get the
-/// size of instructions in inline assembly.
+/// The following methods have been copied from
+/// lib/CodeGen/AsmPrinterAsmPrinterInlineAsm.cpp since its 'emitInlineAsm"
+/// method is private, but we need it to get the size of instructions in
+/// inline assembly.
 /// We copied the code needed to make the size work.
-void PatmosAsmPrinter::mockEmitInlineAsmForSizeCount(const MachineInstr *MI) const {
+void PatmosAsmPrinter::expandInlineAsm(const MachineInstr *MI,
+                                       SmallVectorImpl<char> &Str) {
   assert(MI->isInlineAsm() && "printInlineAsm only works on inline asms");
 
   // Count the number of register definitions to find the asm string.
@@ -523,15 +711,16 @@ void PatmosAsmPrinter::mockEmitInlineAsmForSizeCount(const MachineInstr *MI) con
 
   // Emit the inline asm to a temporary string so we can emit it through
   // EmitInlineAsm.
-  SmallString<256> StringData;
-  raw_svector_ostream OS(StringData);
-  AsmPrinter *AP = (AsmPrinter*)this;
-  EmitGCCInlineAsmStr(AsmStr, MI, MMI, (int)MAI->getAssemblerDialect(), AP, (unsigned)0, OS);
+  raw_svector_ostream OS(Str);
+  EmitGCCInlineAsmStr(AsmStr, MI, MMI, (int)MAI->getAssemblerDialect(), this,
+                      (unsigned)0, OS);
+}
 
+void PatmosAsmPrinter::parseInlineAsm(StringRef Str) {
   std::unique_ptr<MemoryBuffer> Buffer;
   // The inline asm source manager will outlive AsmStr, so make a copy of the
   // string for SourceMgr to own.
-  Buffer = MemoryBuffer::getMemBufferCopy(OS.str(), "<inline asm>");
+  Buffer = MemoryBuffer::getMemBufferCopy(Str, "<inline asm>");
   auto srcMgr = SourceMgr();
   unsigned BufNum = srcMgr.AddNewSourceBuffer(std::move(Buffer), SMLoc());
 
@@ -33,9 +33,25 @@ namespace llvm {
     // symbol to use for the end of the currently emitted subfunction
     MCSymbol *CurrCodeEnd;
 
+    // index of the currently emitted method cache region in the function
+    unsigned CurrRegion;
+
+    /// FunctionSummary - The link-time summary of an emitted function, see
+    /// emitSummaries.
+    struct FunctionSummary {
+      MCSymbol *Sym;
+      unsigned Flags;
+      unsigned StackCacheBytes;
+      std::vector<MCSymbol*> Callees;
+    };
+
+    /// Summaries - The summaries of the functions emitted so far.
+    std::vector<FunctionSummary> Summaries;
+
   public:
     PatmosAsmPrinter(TargetMachine &TM, std::unique_ptr<MCStreamer> Streamer)
-      : AsmPrinter(TM, std::move(Streamer)), MCInstLowering(OutContext, *this), CurrCodeEnd(0)
+      : AsmPrinter(TM, std::move(Streamer)), MCInstLowering(OutContext, *this), CurrCodeEnd(0),
+        CurrRegion(0)
     {
       if (!(PTM = static_cast<PatmosTargetMachine*>(&TM))) {
         llvm_unreachable("PatmosAsmPrinter must be initialized with a Patmos target configuration.");
@@ -61,6 +77,8 @@ namespace llvm {
 
     void emitFunctionBodyEnd() override;
 
+    void emitEndOfAsmFile(Module &M) override;
+
     // called in the framework for instruction printing
     void emitInstruction(const MachineInstr *MI) override;
 
@@ -84,7 +102,13 @@ namespace llvm {
     bool PrintAsmMemoryOperand(const MachineInstr *MI, unsigned OpNo,
                                const char *ExtraCode, raw_ostream &OS) override;
 
-    void mockEmitInlineAsmForSizeCount(const MachineInstr *MI) const;
+    /// expandInlineAsm - Substitute the operands of the inline asm MI into
+    /// its asm string, as the final emission does.
+    void expandInlineAsm(const MachineInstr *MI, SmallVectorImpl<char> &Str);
+
+    /// parseInlineAsm - Parse the expanded inline asm Str and emit the
+    /// instructions to the output streamer of this printer.
+    void parseInlineAsm(StringRef Str);
   private:
     /// mark the start of an subfunction relocation area.
     void EmitFStart(MCSymbol *SymStart, MCSymbol *SymEnd,
@@ -92,6 +116,18 @@ namespace llvm {
                     const MCSubtargetInfo *STI);
 
     bool isFStart(const MachineBasicBlock *MBB) const;
+
+    /// addSummary - Record the stack cache usage, the callees and the
+    /// single-path kind of the current function for emitSummaries.
+    void addSummary();
+
+    /// emitSummaries - Emit the summaries of all functions into the
+    /// .patmos.summary section, for the analyses of the linker.
+    void emitSummaries();
+
+    /// emitBlockAnnotation - Print the static cycles, bundle usage, NOPs,
+    /// stall sources and method cache region of MBB as comment.
+    void emitBlockAnnotation(const MachineBasicBlock &MBB);
   };
 
 } // end of llvm namespace
@@ -0,0 +1,75 @@
+//===-- PatmosBlockFrequencies.cpp - Store block frequencies --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass stores the frequencies of all basic blocks, as computed by the
+// MachineBlockFrequencyInfo, in the PatmosAnalysisInfo of the function.
+// Later stages that cannot request analyses themselves, e.g., the stack cache
+// frame layout in the frame lowering, can then weight the code by its
+// execution frequency.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosMachineFunctionInfo.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-framelowering"
+
+namespace {
+
+  class PatmosBlockFrequencies : public MachineFunctionPass {
+  private:
+    static char ID;
+  public:
+
+    PatmosBlockFrequencies() : MachineFunctionPass(ID) {}
+
+    StringRef getPassName() const override {
+      return "Patmos Store Block Frequencies";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<MachineBlockFrequencyInfo>();
+      AU.setPreservesAll();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      const MachineBlockFrequencyInfo &MBFI =
+                                     getAnalysis<MachineBlockFrequencyInfo>();
+      PatmosAnalysisInfo &PAI =
+                  MF.getInfo<PatmosMachineFunctionInfo>()->getAnalysisInfo();
+
+      for (MachineFunction::iterator i = MF.begin(), ie = MF.end();
+           i != ie; ++i)
+      {
+        // the frequencies are relative to MBFI.getEntryFreq()
+        uint64_t Freq = MBFI.getBlockFreq(&*i).getFrequency();
+        PAI.setFrequency(&*i, Freq);
+
+        LLVM_DEBUG(dbgs() << "MBB#" << i->getNumber() << " frequency "
+                          << Freq << "\n");
+      }
+
+      return false;
+    }
+  };
+
+  char PatmosBlockFrequencies::ID = 0;
+} // end of anonymous namespace
+
+FunctionPass *llvm::createPatmosBlockFrequenciesPass() {
+  return new PatmosBlockFrequencies();
+}
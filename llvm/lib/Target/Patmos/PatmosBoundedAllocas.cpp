@@ -0,0 +1,166 @@
+//===-- PatmosBoundedAllocas.cpp - Make bounded dynamic allocas static. ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Replace dynamic allocas with a small, provable upper bound on their size by
+// static allocas of the bound.
+//
+// Dynamic allocas need a frame pointer and adjust the stack pointer of the
+// shadow stack at run time, around every call of the function. Variable
+// length arrays used as temporary buffers often have a small bound, e.g., if
+// their length is checked or masked before, which lazy value info can prove.
+// An alloca that is not part of a cycle of the CFG is executed at most once
+// per invocation of its function, so a static frame object of the bound size
+// serves it equally well.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-bounded-allocas"
+
+STATISTIC(NumStaticAllocas, "Number of bounded dynamic allocas made static");
+
+static cl::opt<unsigned> MaxBoundedAllocaSize(
+  "mpatmos-max-bounded-alloca",
+  cl::init(256),
+  cl::desc("Largest bound in bytes for which a dynamic alloca is replaced by "
+           "a static one (default: 256, 0 to disable)."),
+  cl::Hidden);
+
+namespace {
+
+class PatmosBoundedAllocas : public FunctionPass {
+private:
+  /// Blocks that are part of a cycle of the CFG, found by findCyclicBlocks.
+  SmallPtrSet<const BasicBlock*, 16> CyclicBlocks;
+
+  /// findCyclicBlocks - Collect the blocks that may be executed repeatedly
+  /// within one invocation of F, including irreducible cycles.
+  void findCyclicBlocks(Function &F) {
+    CyclicBlocks.clear();
+    for (scc_iterator<Function*> I = scc_begin(&F); !I.isAtEnd(); ++I) {
+      if (!I.hasCycle())
+        continue;
+      for (BasicBlock *BB : *I)
+        CyclicBlocks.insert(BB);
+    }
+  }
+
+  /// getBoundedCount - Return the bound of the number of elements allocated
+  /// by AI if its size is bounded by MaxBoundedAllocaSize, or 0.
+  uint64_t getBoundedCount(AllocaInst *AI, LazyValueInfo &LVI) const {
+    const DataLayout &DL = AI->getModule()->getDataLayout();
+    Value *Count = AI->getArraySize();
+    uint64_t ElementSize = DL.getTypeAllocSize(AI->getAllocatedType());
+    if (!Count->getType()->isIntegerTy() || ElementSize == 0 ||
+        ElementSize > MaxBoundedAllocaSize)
+      return 0;
+
+    ConstantRange Range = LVI.getConstantRange(Count, AI);
+    APInt Max = Range.getUnsignedMax();
+    if (Max.getActiveBits() > 32 ||
+        Max.getZExtValue() * ElementSize > MaxBoundedAllocaSize)
+      return 0;
+
+    // allocate at least one element, such that the address is unique
+    return std::max<uint64_t>(Max.getZExtValue(), 1);
+  }
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+
+  PatmosBoundedAllocas() : FunctionPass(ID) {
+    initializeLazyValueInfoWrapperPassPass(*PassRegistry::getPassRegistry());
+  }
+
+  /// getPassName - Return the pass' name.
+  StringRef getPassName() const override {
+    return "Patmos Bounded Allocas";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<LazyValueInfoWrapperPass>();
+    AU.setPreservesCFG();
+  }
+
+  bool runOnFunction(Function &F) override;
+};
+
+} // end anonymous namespace
+
+char PatmosBoundedAllocas::ID = 0;
+
+FunctionPass *llvm::createPatmosBoundedAllocasPass() {
+  return new PatmosBoundedAllocas();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosBoundedAllocas::runOnFunction(Function &F) {
+  if (MaxBoundedAllocaSize == 0 || skipFunction(F)) return false;
+
+  std::vector<AllocaInst*> Dynamic;
+  for (BasicBlock &BB : F) {
+    for (Instruction &I : BB) {
+      AllocaInst *AI = dyn_cast<AllocaInst>(&I);
+      if (AI && !AI->isStaticAlloca() && !AI->isSwiftError())
+        Dynamic.push_back(AI);
+    }
+  }
+  if (Dynamic.empty())
+    return false;
+
+  LazyValueInfo &LVI = getAnalysis<LazyValueInfoWrapperPass>().getLVI();
+  findCyclicBlocks(F);
+
+  BasicBlock &Entry = F.getEntryBlock();
+  bool changed = false;
+  for (AllocaInst *AI : Dynamic) {
+    // allocas within cycles need new memory in every iteration
+    if (CyclicBlocks.count(AI->getParent()))
+      continue;
+
+    uint64_t Count = getBoundedCount(AI, LVI);
+    if (Count == 0)
+      continue;
+
+    Value *Size = ConstantInt::get(AI->getArraySize()->getType(), Count);
+    AllocaInst *Static = new AllocaInst(AI->getAllocatedType(),
+                                        AI->getType()->getAddressSpace(),
+                                        Size, AI->getAlign(), "",
+                                        &*Entry.getFirstInsertionPt());
+    Static->takeName(AI);
+    Static->setDebugLoc(AI->getDebugLoc());
+
+    LLVM_DEBUG(dbgs() << "Bounded alloca of " << Count << " elements in "
+                      << F.getName() << ": " << *Static << "\n");
+
+    AI->replaceAllUsesWith(Static);
+    AI->eraseFromParent();
+    NumStaticAllocas++;
+    changed = true;
+  }
+  return changed;
+}
@@ -15,19 +15,47 @@
 #include "llvm/IR/Module.h"
 #include "llvm/CodeGen/MachineMemOperand.h"
 #include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/YAMLParser.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <set>
 
 using namespace llvm;
 
 #define DEBUG_TYPE "patmos-call-graph-builder"
 
-INITIALIZE_PASS(PatmosCallGraphBuilder, "patmos-mcg",
-                "Patmos Call Graph Builder", false, true)
+STATISTIC(CallGraphsBuilt,  "Number of machine-level call graphs constructed");
+STATISTIC(CallGraphsReused, "Number of machine-level call graphs reused");
+
+/// NarrowAddressTaken - Option to ignore uses of a function that do not
+/// make it a target of indirect calls in the module.
+static cl::opt<bool> NarrowAddressTaken(
+  "mpatmos-mcg-narrow-address-taken",
+  cl::init(false),
+  cl::desc("Consider only functions as targets of indirect calls whose "
+           "address is taken by other than callback uses and references in "
+           "llvm.used (default: false)."),
+  cl::Hidden);
+
+static cl::opt<std::string> MCGExport("mpatmos-mcg-serialize",
+  cl::desc("Export the machine-level call graph to FILE (YAML)"),
+  cl::init(""), cl::Hidden);
+
+INITIALIZE_PASS(PatmosCallGraphCache, "patmos-mcg-cache",
+                "Patmos Call Graph Cache", false, true)
+INITIALIZE_PASS_BEGIN(PatmosCallGraphBuilder, "patmos-mcg",
+                      "Patmos Call Graph Builder", false, true)
+INITIALIZE_PASS_DEPENDENCY(PatmosCallGraphCache)
+INITIALIZE_PASS_END(PatmosCallGraphBuilder, "patmos-mcg",
+                    "Patmos Call Graph Builder", false, true)
 
 namespace llvm {
+  char PatmosCallGraphCache::ID = 0;
   char PatmosCallGraphBuilder::ID = 0;
 
   const char *MCallGraph::EntrySymbol = "_start";
@@ -212,6 +240,66 @@ namespace llvm {
     return retval;
   }
 
+  hash_code MCallGraph::getTypeHash(Type *T, bool Nested)
+  {
+    if (T == NULL)
+      return hash_value(0);
+
+    if (PointerType *PT = dyn_cast<PointerType>(T)) {
+      // nested pointers might be matched by pointers to empty structs
+      if (Nested)
+        return hash_value((unsigned)Type::PointerTyID);
+
+      return hash_combine((unsigned)Type::PointerTyID, PT->getAddressSpace(),
+                          getTypeHash(PT->getElementType(), true));
+    }
+
+    // types nested without pointers cannot be recursive
+    DenseMap<Type*, hash_code>::iterator known(TypeHashes.find(T));
+    if (known != TypeHashes.end())
+      return known->second;
+
+    hash_code H = hash_combine((unsigned)T->getTypeID(),
+                               T->getNumContainedTypes());
+    if (IntegerType *IT = dyn_cast<IntegerType>(T))
+      H = hash_combine(H, IT->getBitWidth());
+    else if (FunctionType *FT = dyn_cast<FunctionType>(T))
+      H = hash_combine(H, FT->isVarArg());
+    else if (StructType *ST = dyn_cast<StructType>(T))
+      H = hash_combine(H, ST->isLiteral(), ST->isPacked());
+    else if (ArrayType *AT = dyn_cast<ArrayType>(T))
+      H = hash_combine(H, AT->getNumElements());
+
+    for (unsigned i = 0, e = T->getNumContainedTypes(); i != e; ++i)
+      H = hash_combine(H, getTypeHash(T->getContainedType(i), true));
+
+    TypeHashes[T] = H;
+    return H;
+  }
+
+  bool MCallGraph::isIsomorphicUnknownNode(MCGNode *N, Type *T)
+  {
+    if (areTypesIsomorphic(N->getType(), T)) {
+      // mark all elements with -1 as 1
+      for(equivalent_types_t::iterator j(EQ.begin()), je(EQ.end()); j != je;
+          j++) {
+        j->second = j->second * j->second;
+      }
+      return true;
+    }
+    else {
+      // erase all elements with -1
+      for(equivalent_types_t::iterator j(EQ.begin()), je(EQ.end());
+          j != je;) {
+        if (j->second == -1)
+          EQ.erase(j++);
+        else
+          j++;
+      }
+      return false;
+    }
+  }
+
   bool MCallGraph::isInSCC(MachineInstr *MI)
   {
     if (!MI)
@@ -236,50 +324,61 @@ namespace llvm {
   MCGNode *MCallGraph::makeMCGNode(MachineFunction *MF)
   {
     // does a call graph node for the machine function exist?
-    for(MCGNodes::const_iterator i(Nodes.begin()), ie(Nodes.end()); i != ie;
-        i++) {
-      if ((*i)->getMF() == MF)
-        return *i;
-    }
+    MCGNode *&MCGN = FunctionNodes[MF];
+    if (MCGN)
+      return MCGN;
 
     // construct a new call graph node for the MachineFunction
-    MCGNode *newMCGN = new MCGNode(MF);
-    Nodes.push_back(newMCGN);
+    MCGN = new (NodeAllocator.Allocate()) MCGNode(MF);
+    Nodes.push_back(MCGN);
 
-    return newMCGN;
+    return MCGN;
   }
 
   MCGNode *MCallGraph::getUnknownNode(Type *T)
   {
-    // does a call graph node for the Type exist?
-    for(MCGNodes::const_iterator i(Nodes.begin()), ie(Nodes.end()); i != ie;
-        i++) {
-      if ((*i)->isUnknown()) {
-        if (areTypesIsomorphic((*i)->getType(), T)) {
-          // mark all elements with -1 as 1
-          for(equivalent_types_t::iterator j(EQ.begin()), je(EQ.end()); j != je;
-              j++) {
-            j->second = j->second * j->second;
-          }
+    bool isWildcard = isEmptyStructPointer(T);
+    size_t H = getTypeHash(T, false);
+
+    // does a call graph node for the Type exist? Only nodes of the same hash
+    // and pointers to empty structs may match, in the order of construction.
+    if (isWildcard) {
+      for(MCGNodes::const_iterator i(UnknownNodes.begin()),
+          ie(UnknownNodes.end()); i != ie; i++) {
+        if (isIsomorphicUnknownNode(*i, T))
           return *i;
-        }
-        else {
-          // erase all elements with -1
-          for(equivalent_types_t::iterator j(EQ.begin()), je(EQ.end());
-              j != je;) {
-            if (j->second == -1)
-              EQ.erase(j++);
-            else
-              j++;
-          }
-        }
+      }
+    }
+    else {
+      std::vector<unsigned> Candidates;
+      type_buckets_t::const_iterator bucket(UnknownNodesByHash.find(H));
+      if (bucket != UnknownNodesByHash.end())
+        Candidates = bucket->second;
+      if (T && T->isPointerTy()) {
+        std::vector<unsigned> Tmp;
+        std::merge(Candidates.begin(), Candidates.end(),
+                   UnknownWildcards.begin(), UnknownWildcards.end(),
+                   std::back_inserter(Tmp));
+        Candidates.swap(Tmp);
+      }
+
+      for(std::vector<unsigned>::const_iterator i(Candidates.begin()),
+          ie(Candidates.end()); i != ie; i++) {
+        if (isIsomorphicUnknownNode(UnknownNodes[*i], T))
+          return UnknownNodes[*i];
       }
     }
 
     // construct a new call graph node for the Type
-    MCGNode *newMCGN = new MCGNode(T);
+    MCGNode *newMCGN = new (NodeAllocator.Allocate()) MCGNode(T);
     Nodes.push_back(newMCGN);
 
+    if (isWildcard)
+      UnknownWildcards.push_back(UnknownNodes.size());
+    else
+      UnknownNodesByHash[H].push_back(UnknownNodes.size());
+    UnknownNodes.push_back(newMCGN);
+
     return newMCGN;
   }
 
@@ -291,10 +390,13 @@ namespace llvm {
     bool is_site_in_SCC = isInSCC(MI);
 
     // allocate the call site
-    MCGSite *newSite = new MCGSite(Caller, MI, Callee, is_site_in_SCC);
+    MCGSite *newSite = new (SiteAllocator.Allocate())
+                                  MCGSite(Caller, MI, Callee, is_site_in_SCC);
 
     // store the site with the graph
     Sites.push_back(newSite);
+    if (MI)
+      InstrSites[MI] = newSite;
 
     // append the site to the caller call graph node
     Caller->Sites.push_back(newSite);
@@ -379,17 +481,60 @@ namespace llvm {
     ViewGraph(*this, "MCallGraph");
   }
 
-  MCallGraph::~MCallGraph()
+  void MCallGraph::serialize(raw_ostream &OS) const
   {
-    for(MCGNodes::const_iterator i(Nodes.begin()), ie(Nodes.end());
-        i != ie; i++) {
-      delete *i;
-    }
+    OS << "---\n"
+       << "format: pml-0.1\n"
+       << "callgraph:\n";
 
-    for(MCGSites::const_iterator i(Sites.begin()), ie(Sites.end()); i != ie;
+    for(MCGNodes::const_iterator i(Nodes.begin()), ie(Nodes.end()); i != ie;
         i++) {
-      delete *i;
+      OS << "  - " << ((*i)->isUnknown() ? "unknown" : "function") << ": \""
+         << yaml::escape((*i)->getLabel()) << "\"\n"
+         << "    live: " << ((*i)->isDead() ? "false" : "true") << "\n"
+         << "    in-scc: " << ((*i)->isInSCC() ? "true" : "false") << "\n";
+
+      if ((*i)->getSites().empty())
+        continue;
+
+      OS << "    calls:\n";
+      for(MCGSites::const_iterator j((*i)->getSites().begin()),
+          je((*i)->getSites().end()); j != je; j++) {
+        OS << "      - callee: \""
+           << yaml::escape((*j)->getCallee()->getLabel()) << "\"\n";
+        if (MachineInstr *MI = (*j)->getMI()) {
+          MachineBasicBlock *MBB = MI->getParent();
+          OS << "        block: " << MBB->getNumber() << "\n"
+             << "        index: "
+             << std::distance(MBB->instr_begin(),
+                              MachineBasicBlock::instr_iterator(MI)) << "\n";
+        }
+        OS << "        in-scc: " << ((*j)->isInSCC() ? "true" : "false")
+           << "\n";
+      }
     }
+    OS << "...\n";
+  }
+
+  void MCallGraph::clear()
+  {
+    NodeAllocator.DestroyAll();
+    SiteAllocator.DestroyAll();
+
+    Nodes.clear();
+    Sites.clear();
+    EQ.clear();
+    FunctionNodes.clear();
+    InstrSites.clear();
+    UnknownNodes.clear();
+    UnknownNodesByHash.clear();
+    UnknownWildcards.clear();
+    TypeHashes.clear();
+  }
+
+  MCallGraph::~MCallGraph()
+  {
+    clear();
   }
 
   //----------------------------------------------------------------------------
@@ -407,7 +552,7 @@ namespace llvm {
     auto &MMI = getAnalysis<MachineModuleInfoWrapperPass>().getMMI();
 
     // make a call graph node, also for functions that are never called.
-    MCGNode *MCGN = MCG.makeMCGNode(MF);
+    MCGNode *MCGN = MCG->makeMCGNode(MF);
 
     for(MachineFunction::iterator i(MF->begin()), ie(MF->end()); i != ie;
         i++) {
@@ -415,37 +560,81 @@ namespace llvm {
           je(i->instr_end()); j != je; j++) {
 
         if (j->isCall()) {
-          // get target
-          const MachineOperand &MO(j->getOperand(2));
+          // construct a new call site
+          MCG->makeMCGSite(MCGN, &*j, MCG->getCalleeNode(M, MMI, *j));
+        }
+      }
+    }
+  }
 
-          const Function *F = NULL;
-          Type *T = NULL;
+  MCGNode *MCallGraph::getCalleeNode(const Module &M, MachineModuleInfo &MMI,
+                                      const MachineInstr &MI)
+  {
+    // get target
+    const MachineOperand &MO(MI.getOperand(2));
 
-          // try to find the target of the call
-          if (MO.isGlobal()) {
-            // is the global value a function?
-            F = dyn_cast<Function>(MO.getGlobal());
-          }
-          else if (MO.isSymbol()) {
-            // find the function in the current module
-            F = dyn_cast_or_null<Function>(M.getNamedValue(MO.getSymbolName()));
-          }
+    const Function *F = NULL;
+    Type *T = NULL;
 
-          if (j->hasOneMemOperand()) {
-            // try at least to get the function's type
-            const Value *Callee = (*j->memoperands_begin())->getValue();
-            T = Callee ? Callee->getType() : NULL;
-          }
+    // try to find the target of the call
+    if (MO.isGlobal()) {
+      // is the global value a function?
+      F = dyn_cast<Function>(MO.getGlobal());
+    }
+    else if (MO.isSymbol()) {
+      // find the function in the current module
+      F = dyn_cast_or_null<Function>(M.getNamedValue(MO.getSymbolName()));
+    }
 
-          // does a MachineFunction exist for F?
-          MachineFunction *MF = F ? MMI.getMachineFunction(*F) : NULL;
+    if (MI.hasOneMemOperand()) {
+      // try at least to get the function's type
+      const Value *Callee = (*MI.memoperands_begin())->getValue();
+      T = Callee ? Callee->getType() : NULL;
+    }
 
-          // construct a new call site
-          MCG.makeMCGSite(MCGN, &*j,
-                          MF ? MCG.makeMCGNode(MF) : MCG.getUnknownNode(T));
+    // does a MachineFunction exist for F?
+    MachineFunction *MF = F ? MMI.getMachineFunction(*F) : NULL;
+
+    return MF ? makeMCGNode(MF) : getUnknownNode(T);
+  }
+
+  bool MCallGraph::isUpToDate(const Module &M, MachineModuleInfo &MMI)
+  {
+    unsigned NumFunctions = 0, NumCalls = 0;
+    for(Module::const_iterator i(M.begin()), ie(M.end()); i != ie; i++) {
+      MachineFunction *MF = MMI.getMachineFunction(*i);
+      if (!MF)
+        continue;
+
+      NumFunctions++;
+      MCGNode *MCGN = getNode(MF);
+      if (!MCGN)
+        return false;
+
+      for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
+          j++) {
+        for(MachineBasicBlock::instr_iterator k(j->instr_begin()),
+            ke(j->instr_end()); k != ke; k++) {
+          if (!k->isCall())
+            continue;
+
+          // the call instruction may have been replaced by one at the same
+          // address, check its callee as well. The UNKNOWN nodes are
+          // constructed on demand, but looked up first, so the graph only
+          // grows here if it is out of date anyway.
+          NumCalls++;
+          MCGSite *MCGS = getSite(&*k);
+          if (!MCGS || MCGS->getCaller() != MCGN ||
+              MCGS->getCallee() != getCalleeNode(M, MMI, *k))
+            return false;
         }
       }
     }
+
+    // no function and no call have been removed, the call sites of external
+    // callers have no call instruction
+    return NumFunctions == FunctionNodes.size() &&
+           NumCalls == InstrSites.size();
   }
 
   MCGNode *PatmosCallGraphBuilder::getMCGNode(const Module &M, const char *name)
@@ -459,7 +648,7 @@ namespace llvm {
       MachineFunction *MF = MMI.getMachineFunction(*F);
 
       if (MF)
-        return MCG.makeMCGNode(MF);
+        return MCG->makeMCGNode(MF);
     }
 
     return NULL;
@@ -497,6 +686,18 @@ namespace llvm {
     // get the machine-level module information for M.
     auto &MMI = getAnalysis<MachineModuleInfoWrapperPass>().getMMI();
 
+    // reuse the call graph of a previous run, unless a pass changed the calls
+    // or functions since
+    PatmosCallGraphCache &PCGC = getAnalysis<PatmosCallGraphCache>();
+    MCG = PCGC.getCallGraph(M);
+    if (MCG && MCG->isUpToDate(M, MMI)) {
+      LLVM_DEBUG(dbgs() << "Reusing the machine-level call graph\n");
+      CallGraphsReused++;
+      return false;
+    }
+    MCG = PCGC.makeCallGraph(M);
+    CallGraphsBuilt++;
+
     // visit all functions in the module
     for(Module::const_iterator i(M.begin()), ie(M.end()); i != ie; i++) {
       // get the machine-level function
@@ -504,7 +705,7 @@ namespace llvm {
 
       // find all call-sites in the MachineFunction
       if (MF) {
-        MCGNode *MCGN = MCG.makeMCGNode(MF);
+        MCGNode *MCGN = MCG->makeMCGNode(MF);
 
         // visit each call site within that function
         visitCallSites(M, MF);
@@ -512,26 +713,40 @@ namespace llvm {
         // represent external callers
         auto &F = MF->getFunction();
         Type *T = F.getType();
-        if (i->hasAddressTaken() && F.getName() != MCallGraph::EntrySymbol) {
-          MCG.makeMCGSite(MCG.getUnknownNode(T), NULL, MCGN);
+        bool isAddressTaken = NarrowAddressTaken ?
+                     F.hasAddressTaken(NULL, true, true, true) :
+                     F.hasAddressTaken();
+        if (isAddressTaken && F.getName() != MCallGraph::EntrySymbol) {
+          MCG->makeMCGSite(MCG->getUnknownNode(T), NULL, MCGN);
         }
       }
     }
 
     // discover live/dead functions
-    MCGNode *entry = MCG.getEntryNode();
+    MCGNode *entry = MCG->getEntryNode();
     if (entry)
       markLive(entry);
 
     // Mark live nodes to be within SCCs (loops or recursion)
-    MCG.markNodesInSCC();
+    MCG->markNodesInSCC();
 
     LLVM_DEBUG(
         std::error_code tmp;
       raw_fd_ostream of("mcg.dot", tmp);
-      WriteGraph(of, MCG);
+      WriteGraph(of, *MCG);
     );
 
+    if (!MCGExport.empty()) {
+      std::error_code err;
+      raw_fd_ostream OS(MCGExport, err, sys::fs::OF_Text);
+      if (err) {
+        errs() << "Error: Failed to open call graph export '" << MCGExport
+               << "': " << err.message() << "\n";
+      } else {
+        MCG->serialize(OS);
+      }
+    }
+
     return false;
   }
 }
@@ -21,14 +21,18 @@
 #include "llvm/Pass.h"
 #include "llvm/IR/Type.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/DOTGraphTraits.h"
 #include "llvm/Support/GraphWriter.h"
 
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
 
 using namespace llvm;
 
@@ -225,13 +229,49 @@ namespace llvm {
     /// The graph's call sites.
     MCGSites Sites;
 
+    /// Arenas of the graph's nodes and call sites, which are freed all at
+    /// once by clear.
+    SpecificBumpPtrAllocator<MCGNode> NodeAllocator;
+    SpecificBumpPtrAllocator<MCGSite> SiteAllocator;
+
     typedef std::map<std::pair<Type *, Type *>, int> equivalent_types_t;
     equivalent_types_t EQ;
 
+    /// The call graph nodes of the MachineFunctions.
+    DenseMap<const MachineFunction*, MCGNode*> FunctionNodes;
+
+    /// The call sites of the call instructions.
+    DenseMap<const MachineInstr*, MCGSite*> InstrSites;
+
+    /// The UNKNOWN nodes, in the order of their construction.
+    MCGNodes UnknownNodes;
+
+    /// The UNKNOWN nodes, as indices into UnknownNodes, by the structural hash
+    /// of their type.
+    typedef std::unordered_map<size_t, std::vector<unsigned> > type_buckets_t;
+    type_buckets_t UnknownNodesByHash;
+
+    /// The UNKNOWN nodes whose type is a pointer to an empty struct, which are
+    /// isomorphic to every pointer type.
+    std::vector<unsigned> UnknownWildcards;
+
+    /// Known structural hashes of types nested in function types.
+    DenseMap<Type*, hash_code> TypeHashes;
+
     /// areTypesIsomorphic - check whether two types are isomorphic.
     /// This is taken from LinkModules.cpp.
     int areTypesIsomorphic(Type *DstTy, Type *SrcTy);
 
+    /// getTypeHash - Return a structural hash of the type, such that
+    /// isomorphic types have the same hash. Pointers nested in the type are
+    /// not distinguished, since a pointer to an empty struct is considered
+    /// isomorphic to every other pointer.
+    hash_code getTypeHash(Type *T, bool Nested);
+
+    /// isIsomorphicUnknownNode - Check whether the type of an UNKNOWN node is
+    /// isomorphic to the given type.
+    bool isIsomorphicUnknownNode(MCGNode *N, Type *T);
+
     // check if a call site is in some form of an SCC (loop)
     bool isInSCC(MachineInstr *MI);
 
@@ -278,6 +318,18 @@ namespace llvm {
       return NULL;
     }
 
+    /// getNode - Return the call graph node of the MachineFunction, or NULL.
+    MCGNode *getNode(const MachineFunction *MF) const
+    {
+      return FunctionNodes.lookup(MF);
+    }
+
+    /// getSite - Return the call site of the call instruction, or NULL.
+    MCGSite *getSite(const MachineInstr *MI) const
+    {
+      return InstrSites.lookup(MI);
+    }
+
     /// makeMCGNode - Return a call graph node for the MachineFunction. The node
     /// is either newly constructed, or, if one exists, a node from the nodes
     /// set associated with the MachineFunction is returned.
@@ -294,12 +346,29 @@ namespace llvm {
     /// executed multiple times (either within a loop or due to recursion).
     void markNodesInSCC();
 
+    /// getCalleeNode - Return the call graph node called by the call
+    /// instruction, an UNKNOWN node if the callee has no MachineFunction.
+    MCGNode *getCalleeNode(const Module &M, MachineModuleInfo &MMI,
+                           const MachineInstr &MI);
+
+    /// isUpToDate - Check whether the call graph still matches the
+    /// MachineFunctions of the module, i.e., every function and every call
+    /// instruction has its node and call site, with the same callee.
+    bool isUpToDate(const Module &M, MachineModuleInfo &MMI);
+
     /// dump - print all call sites of the call graph to the debug stream.
     void dump() const;
 
     /// view - show a DOT dump of the call graph.
     void view() const;
 
+    /// serialize - write the call graph in YAML, listing each node with its
+    /// call sites, e.g., for WCET analysis tools.
+    void serialize(raw_ostream &OS) const;
+
+    /// clear - Free all nodes and call sites of the call graph.
+    void clear();
+
     /// Free the call graph and all its nodes and call sites.
     virtual ~MCallGraph();
   };
@@ -343,12 +412,46 @@ namespace llvm {
     void view();
   };
 
+  /// Pass to keep the call graph of the module. The PatmosCallGraphBuilder
+  /// is a module pass, every machine function pass that does not preserve it
+  /// discards it, the graph itself is kept here and reused as long as it is
+  /// up to date.
+  class PatmosCallGraphCache : public ImmutablePass {
+  private:
+    /// The call graph, or NULL.
+    std::unique_ptr<MCallGraph> MCG;
+
+    /// The module of the call graph.
+    const Module *M;
+  public:
+    /// Pass ID
+    static char ID;
+
+    PatmosCallGraphCache() : ImmutablePass(ID), M(NULL) {
+      initializePatmosCallGraphCachePass(*PassRegistry::getPassRegistry());
+    }
+
+    /// getCallGraph - Return the call graph of the module, or NULL if it has
+    /// not been constructed yet.
+    MCallGraph *getCallGraph(const Module &m) const {
+      return M == &m ? MCG.get() : NULL;
+    }
+
+    /// makeCallGraph - Return a new, empty call graph for the module, which
+    /// replaces the previous one.
+    MCallGraph *makeCallGraph(const Module &m) {
+      MCG.reset(new MCallGraph());
+      M = &m;
+      return MCG.get();
+    }
+  };
+
   /// Pass to construct the call graph at the machine-level of the current
   /// module.
   class PatmosCallGraphBuilder: public MachineModulePass {
   private:
-    /// A call graph.
-    MCallGraph MCG;
+    /// A call graph, owned by the PatmosCallGraphCache.
+    MCallGraph *MCG;
 
     /// markLive_ - Mark the node and all its callees as live.
     void markLive_(MCGNode *N);
@@ -359,7 +462,7 @@ namespace llvm {
     /// Pass ID
     static char ID;
 
-    PatmosCallGraphBuilder() : MachineModulePass(ID) {
+    PatmosCallGraphBuilder() : MachineModulePass(ID), MCG(NULL) {
     }
 
     /// getAnalysisUsage - Inform the pass manager that nothing is modified
@@ -367,32 +470,33 @@ namespace llvm {
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.setPreservesAll();
       AU.addRequired<MachineModuleInfoWrapperPass>();
+      AU.addRequired<PatmosCallGraphCache>();
 
       ModulePass::getAnalysisUsage(AU);
     }
 
     MCallGraph *getCallGraph() {
-      return &MCG;
+      return MCG;
     }
 
     /// getNodes - Return the graph's nodes.
     const MCGNodes &getNodes() const {
-      return MCG.getNodes();
+      return MCG->getNodes();
     }
 
     /// getNodes - Return the graph's nodes.
     MCGNodes &getNodes() {
-      return MCG.getNodes();
+      return MCG->getNodes();
     }
 
     /// getSites - Return the graph's call sites.
     const MCGSites &getSites() const {
-      return MCG.getSites();
+      return MCG->getSites();
     }
 
     /// getSites - Return the graph's call sites.
     MCGSites &getSites() {
-      return MCG.getSites();
+      return MCG->getSites();
     }
 
     /// getMCGNode - Return the call graph node of the function with the given
@@ -406,30 +510,19 @@ namespace llvm {
     /// getMCGNode - Return the call graph node of the function with the given
     /// name.
     MCGNode *getEntryNode() const {
-      return MCG.getEntryNode();
+      return MCG->getEntryNode();
     }
 
     /// getMCGNode - Return the call graph node of the given function.
     MCGNode *getNode(const MachineFunction *MF) const {
-      for(MCGNodes::const_iterator i(MCG.getNodes().begin()),
-          ie(MCG.getNodes().end()); i != ie; i++) {
-        if ((*i)->getMF() == MF)
-          return *i;
-      }
-      return NULL;
+      return MCG->getNode(MF);
     }
 
-    /// getMCGNode - Return the call graph node of the given function.
+    /// getSites - Return the call sites of the given call instruction.
     MCGSites getSites(const MachineInstr *MI) {
-      const MachineFunction *MF = MI->getParent()->getParent();
-      MCGNode *N = getNode(MF);
-
       MCGSites result;
-      for(MCGSites::const_iterator i(N->getSites().begin()),
-          ie(N->getSites().end()); i != ie; i++) {
-        if ((*i)->getMI() == MI)
-          result.push_back(*i);
-      }
+      if (MCGSite *site = MCG->getSite(MI))
+        result.push_back(site);
 
       return result;
     }
@@ -438,6 +531,12 @@ namespace llvm {
     /// module.
     bool runOnMachineModule(const Module &M) override;
 
+    /// releaseMemory - Forget the call graph, the pass reuses it from the
+    /// PatmosCallGraphCache when it runs again, unless it is out of date.
+    void releaseMemory() override {
+      MCG = NULL;
+    }
+
     /// getPassName - Return the pass' name.
     StringRef getPassName() const override {
       return "Patmos Call Graph Builder";
@@ -537,7 +636,7 @@ namespace llvm {
     }
 
     static bool isNodeHidden(const MCGNode *N,
-                             const MCallGraph G) {
+                             const MCallGraph &G) {
       return false;
     }
 
@@ -0,0 +1,110 @@
+//===-- PatmosConstantTime.cpp - Check branches of constant-time code. ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Functions with the "patmos-constant-time" attribute are a light-weight
+// alternative to single-path code: the if-converter predicates their
+// branches regardless of the cost and of the cache analyses, see
+// PatmosInstrInfo::isConstantTime(), but they are not cloned, and their
+// loops and calls are left as they are.
+//
+// This pass runs after the if-converter and warns about each conditional
+// or indirect branch left over, which may make the execution time depend on
+// the data. Loops with an exact loop bound, which leave through their latch
+// only, iterate a constant number of times, their back branch is fine.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosTargetMachine.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-constant-time"
+
+STATISTIC(DataDependentBranches,
+          "Number of branches left in constant-time functions");
+
+namespace {
+
+  class PatmosConstantTimeCheck : public MachineFunctionPass {
+  private:
+    const PatmosInstrInfo &TII;
+
+    static char ID;
+  public:
+
+    PatmosConstantTimeCheck(PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID), TII(*tm.getInstrInfo()) {}
+
+    StringRef getPassName() const override {
+      return "Patmos Constant-Time Check";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesAll();
+      AU.addRequired<MachineLoopInfo>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      if (MF.empty() || !TII.isConstantTime(MF.front()))
+        return false;
+
+      MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+      for (MachineBasicBlock &MBB : MF) {
+        for (MachineInstr &MI : MBB.terminators()) {
+          if (MI.isIndirectBranch() ||
+              (MI.isConditionalBranch() && !isCountedLoopBranch(MLI, MBB))) {
+            warn(MF, MI);
+            break;
+          }
+        }
+      }
+      return false;
+    }
+
+  private:
+    /// isCountedLoopBranch - Return true if MBB is the only exiting block
+    /// and the latch of a loop with an exact loop bound.
+    static bool isCountedLoopBranch(const MachineLoopInfo &MLI,
+                                    const MachineBasicBlock &MBB) {
+      const MachineLoop *L = MLI.getLoopFor(&MBB);
+      if (!L || L->getLoopLatch() != &MBB || L->getExitingBlock() != &MBB)
+        return false;
+      std::pair<int,int> Bounds = getLoopBounds(L->getHeader());
+      return Bounds.second >= 0 && Bounds.first == Bounds.second;
+    }
+
+    /// warn - Report a branch left in a constant-time function.
+    static void warn(const MachineFunction &MF, const MachineInstr &MI) {
+      errs() << "Warning: ";
+      if (const DebugLoc &DL = MI.getDebugLoc()) {
+        DL.print(errs());
+        errs() << ": ";
+      }
+      errs() << "Data-dependent branch left in constant-time function '"
+             << MF.getName() << "', in block '"
+             << MI.getParent()->getFullName() << "'.\n";
+      DataDependentBranches++; // STATISTIC
+    }
+  };
+
+  char PatmosConstantTimeCheck::ID = 0;
+} // end of anonymous namespace
+
+FunctionPass *llvm::createPatmosConstantTimeCheckPass(PatmosTargetMachine &tm) {
+  return new PatmosConstantTimeCheck(tm);
+}
@@ -0,0 +1,436 @@
+//===-- PatmosDataCacheAnalysis.cpp - Classify the data cache loads. ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A static analysis of the data cache, with the geometry of the subtarget,
+// see PatmosSubtarget::getDataCacheSize(), classifying the loads of the data
+// cache as
+//  - always-hit, by a must analysis of the LRU ages of the cached lines, or
+//  - first-miss, if all lines a loop accesses persist in the cache, i.e.,
+//    a load misses at most once each time its innermost loop is entered.
+// The classification is stored in the flags of the memory operands, see
+// MOAlwaysHit and MOFirstMiss, and used by mayStall(), the scheduler, the
+// WCET estimate and the PML export.
+//
+// The addresses are not known before linking, so the lines are symbolic: a
+// line is a constant offset of an object whose address does not change
+// during the execution of the function, i.e., of a global, an argument or a
+// value computed in the entry block. Aligned objects are split into lines,
+// the others into chunks of their alignment, which lie within a line each.
+// Since the set of a line is not known either, any other access ages all
+// lines younger than the line it accesses, and accesses of unknown lines,
+// stores and predicated loads age all of them. Calls and inline assembly
+// leave an unknown cache behind.
+//
+// A loop is persistent if it has no calls and the data cache accesses in it
+// belong to at most as many objects as the cache has ways, each of them
+// taking at most as many lines as the cache has sets: every set then holds
+// at most one line of each object.
+//
+// The analysis runs before the if-converter and the post-RA scheduler, and
+// again on the final code, before it is timed and exported.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-dcache-analysis"
+
+STATISTIC(NumAlwaysHit,  "Number of data cache loads classified always-hit");
+STATISTIC(NumFirstMiss,  "Number of data cache loads classified first-miss");
+STATISTIC(NumDCacheLoads, "Number of data cache loads analyzed");
+
+static cl::opt<bool> EnableDataCacheAnalysis("mpatmos-data-cache-analysis",
+  cl::init(true),
+  cl::desc("Classify the loads of the data cache as always-hit or "
+           "first-miss."),
+  cl::Hidden);
+
+namespace {
+
+  /// CacheLine - A symbolic line: an object and the offset of a line, or of
+  /// a chunk of the alignment of the object, i.e., the line holding that
+  /// byte.
+  typedef std::pair<const Value*, int64_t> CacheLine;
+
+  /// CacheState - Upper bounds of the LRU ages of the lines that are cached
+  /// for sure.
+  typedef std::map<CacheLine, unsigned> CacheState;
+
+  /// Access - A data cache access, see getAccess.
+  struct Access {
+    enum AccessKind {
+      /// An access of a single symbolic line.
+      AK_Line,
+      /// An access of some line of a global of known size.
+      AK_Object,
+      /// An access of an unknown line.
+      AK_Unknown
+    };
+
+    AccessKind Kind = AK_Unknown;
+    const Value *Object = nullptr;
+    CacheLine Line;
+  };
+
+  class PatmosDataCacheAnalysis : public MachineFunctionPass {
+  private:
+    const PatmosInstrInfo &TII;
+    const PatmosSubtarget &STI;
+
+    /// The classification of the loads of the current function.
+    DenseMap<MachineInstr*, MachineMemOperand::Flags> Classes;
+
+    static char ID;
+  public:
+    PatmosDataCacheAnalysis(PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID), TII(*tm.getInstrInfo()),
+        STI(*tm.getSubtargetImpl()) {}
+
+    StringRef getPassName() const override {
+      return "Patmos Data Cache Analysis";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesCFG();
+      AU.addRequired<MachineLoopInfo>();
+      AU.addPreserved<MachineLoopInfo>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override;
+
+  private:
+    /// isDataCacheAccess - Return true if MI accesses the data cache.
+    bool isDataCacheAccess(const MachineInstr &MI) const {
+      return !MI.isBundle() && !MI.isCall() && !MI.isInlineAsm() &&
+             (MI.mayLoad() || MI.mayStore()) && !TII.isPseudo(&MI) &&
+             TII.getMemType(MI) == PatmosII::MEM_C;
+    }
+
+    /// clobbersCache - Return true if MI leaves an unknown cache behind.
+    static bool clobbersCache(const MachineInstr &MI) {
+      return MI.isCall() ||
+             (MI.isInlineAsm() && (MI.mayLoad() || MI.mayStore()));
+    }
+
+    /// getAccess - Return the line or object a data cache access accesses.
+    Access getAccess(const MachineInstr &MI) const;
+
+    /// update - Update the cache state by an access, return true if it
+    /// accesses a line that is cached for sure.
+    bool update(CacheState &State, const MachineInstr &MI) const;
+
+    /// join - Join the state of an incoming edge into the state of a block.
+    static void join(CacheState &State, const CacheState &In);
+
+    /// age - Age all lines of the state younger than Age.
+    void age(CacheState &State, unsigned Age) const;
+
+    /// analyzeMust - Classify the always-hit loads.
+    void analyzeMust(MachineFunction &MF);
+
+    /// getLines - Return the maximum number of lines GV takes.
+    uint64_t getLines(const GlobalVariable *GV) const;
+
+    /// isPersistent - Return true if all lines L accesses persist.
+    bool isPersistent(const MachineLoop *L) const;
+  };
+
+} // end anonymous namespace
+
+char PatmosDataCacheAnalysis::ID = 0;
+
+FunctionPass *
+llvm::createPatmosDataCacheAnalysisPass(PatmosTargetMachine &tm) {
+  return new PatmosDataCacheAnalysis(tm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// isInvariant - Return true if the address of Object does not change during
+/// the execution of the function.
+static bool isInvariant(const Value *Object) {
+  if (isa<GlobalValue>(Object) || isa<Argument>(Object))
+    return true;
+  // the entry block is executed once per call
+  const Instruction *I = dyn_cast<Instruction>(Object);
+  return I && I->getParent() == &I->getFunction()->getEntryBlock();
+}
+
+Access PatmosDataCacheAnalysis::getAccess(const MachineInstr &MI) const {
+  Access A;
+  if (!MI.hasOneMemOperand())
+    return A;
+  const MachineMemOperand *MMO = *MI.memoperands_begin();
+  const Value *V = MMO->getValue();
+  if (!V || MMO->isVolatile() || MMO->getSize() == 0)
+    return A;
+
+  const DataLayout &DL = MI.getMF()->getDataLayout();
+  unsigned LineSize = STI.getDataCacheLineSize();
+
+  int64_t BaseOffset = 0;
+  const Value *Base = GetPointerBaseWithConstantOffset(V, BaseOffset, DL);
+  if (isInvariant(Base)) {
+    // the alignment of the base, also as implied by the access
+    Align BaseAlign = std::max(Base->getPointerAlignment(DL),
+                               commonAlignment(MMO->getBaseAlign(),
+                                               (uint64_t)BaseOffset));
+    int64_t Granule = std::min<uint64_t>(BaseAlign.value(), LineSize);
+    int64_t Offset = BaseOffset + MMO->getOffset();
+    // the granule is a power of two, round down to the start of the chunks
+    int64_t Chunk = Offset & -Granule;
+    int64_t Last = (Offset + (int64_t)MMO->getSize() - 1) & -Granule;
+    if (Chunk == Last) {
+      A.Kind = Access::AK_Line;
+      A.Object = Base;
+      A.Line = CacheLine(Base, Chunk);
+      return A;
+    }
+  }
+
+  const GlobalVariable *GV = dyn_cast<GlobalVariable>(getUnderlyingObject(V));
+  if (GV && GV->getValueType()->isSized()) {
+    A.Kind = Access::AK_Object;
+    A.Object = GV;
+  }
+  return A;
+}
+
+void PatmosDataCacheAnalysis::age(CacheState &State, unsigned Age) const {
+  unsigned Ways = STI.getDataCacheWays();
+  for (auto I = State.begin(), E = State.end(); I != E; ) {
+    if (I->second < Age && ++I->second >= Ways)
+      I = State.erase(I);
+    else
+      ++I;
+  }
+}
+
+bool PatmosDataCacheAnalysis::update(CacheState &State,
+                                     const MachineInstr &MI) const {
+  if (clobbersCache(MI)) {
+    State.clear();
+    return false;
+  }
+  if (!isDataCacheAccess(MI))
+    return false;
+
+  // stores and predicated loads may or may not load a line, in some set
+  Access A = getAccess(MI);
+  if (A.Kind != Access::AK_Line || !MI.mayLoad() || MI.mayStore() ||
+      TII.isPredicated(MI)) {
+    age(State, UINT_MAX);
+    return false;
+  }
+
+  auto L = State.find(A.Line);
+  bool Hit = L != State.end();
+  age(State, Hit ? L->second : UINT_MAX);
+  State[A.Line] = 0;
+  return Hit;
+}
+
+void PatmosDataCacheAnalysis::join(CacheState &State, const CacheState &In) {
+  for (auto I = State.begin(), E = State.end(); I != E; ) {
+    auto L = In.find(I->first);
+    if (L == In.end()) {
+      I = State.erase(I);
+    } else {
+      I->second = std::max(I->second, L->second);
+      ++I;
+    }
+  }
+}
+
+void PatmosDataCacheAnalysis::analyzeMust(MachineFunction &MF) {
+  // the states at the block entries, missing while no predecessor has been
+  // visited
+  DenseMap<const MachineBasicBlock*, CacheState> Ins;
+  DenseMap<const MachineBasicBlock*, CacheState> Outs;
+  Ins[&MF.front()];
+
+  ReversePostOrderTraversal<MachineFunction*> RPOT(&MF);
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (MachineBasicBlock *MBB : RPOT) {
+      auto In = Ins.find(MBB);
+      if (In == Ins.end())
+        continue;
+
+      CacheState State = In->second;
+      for (const MachineInstr &MI : MBB->instrs())
+        update(State, MI);
+
+      auto Out = Outs.find(MBB);
+      if (Out != Outs.end() && Out->second == State)
+        continue;
+      Outs[MBB] = State;
+
+      for (MachineBasicBlock *Succ : MBB->successors()) {
+        auto SuccIn = Ins.find(Succ);
+        if (SuccIn == Ins.end()) {
+          Ins[Succ] = State;
+          Changed = true;
+        } else {
+          CacheState Old = SuccIn->second;
+          join(SuccIn->second, State);
+          Changed |= Old != SuccIn->second;
+        }
+      }
+    }
+  }
+
+  // classify the loads by the fixpoint
+  for (MachineBasicBlock &MBB : MF) {
+    auto In = Ins.find(&MBB);
+    if (In == Ins.end())
+      continue;
+    CacheState State = In->second;
+    for (MachineInstr &MI : MBB.instrs()) {
+      if (update(State, MI))
+        Classes[&MI] = MOAlwaysHit;
+    }
+  }
+}
+
+uint64_t PatmosDataCacheAnalysis::getLines(const GlobalVariable *GV) const {
+  const DataLayout &DL = GV->getParent()->getDataLayout();
+  uint64_t LineSize = STI.getDataCacheLineSize();
+  uint64_t Lines = (DL.getTypeAllocSize(GV->getValueType()) + LineSize - 1) /
+                   LineSize;
+  if (GV->getPointerAlignment(DL).value() < LineSize)
+    Lines++;
+  return Lines;
+}
+
+bool PatmosDataCacheAnalysis::isPersistent(const MachineLoop *L) const {
+  // the globals accessed anywhere and the range of the offsets of the
+  // accessed lines of the other objects
+  std::map<const Value*, std::pair<int64_t, int64_t>> Chunks;
+  std::map<const Value*, uint64_t> Lines;
+  for (const MachineBasicBlock *MBB : L->blocks()) {
+    for (const MachineInstr &MI : MBB->instrs()) {
+      if (clobbersCache(MI))
+        return false;
+      if (!isDataCacheAccess(MI))
+        continue;
+
+      Access A = getAccess(MI);
+      switch (A.Kind) {
+      case Access::AK_Unknown:
+        return false;
+      case Access::AK_Object:
+        Lines[A.Object] = getLines(cast<GlobalVariable>(A.Object));
+        break;
+      case Access::AK_Line: {
+        int64_t First = A.Line.second;
+        auto C = Chunks.insert(std::make_pair(A.Object,
+                                              std::make_pair(First, First)));
+        C.first->second.first = std::min(C.first->second.first, First);
+        C.first->second.second = std::max(C.first->second.second, First);
+        break;
+      }
+      }
+    }
+  }
+
+  // the lines of a global accessed anywhere include all chunks of it
+  for (auto &C : Chunks) {
+    if (Lines.count(C.first))
+      continue;
+    int64_t Range = C.second.second - C.second.first;
+    uint64_t Size = Range / STI.getDataCacheLineSize() + 2;
+    if (const GlobalVariable *GV = dyn_cast<GlobalVariable>(C.first))
+      if (GV->getValueType()->isSized())
+        Size = std::min(Size, getLines(GV));
+    Lines[C.first] = Size;
+  }
+
+  if (Lines.size() > STI.getDataCacheWays())
+    return false;
+  for (auto &O : Lines)
+    if (O.second > STI.getDataCacheSets())
+      return false;
+  return true;
+}
+
+bool PatmosDataCacheAnalysis::runOnMachineFunction(MachineFunction &MF) {
+  if (!EnableDataCacheAnalysis)
+    return false;
+
+  LLVM_DEBUG(dbgs() << "Data cache analysis of " << MF.getName() << "\n");
+
+  Classes.clear();
+  analyzeMust(MF);
+
+  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+  DenseMap<const MachineLoop*, bool> Persistent;
+  for (MachineBasicBlock &MBB : MF) {
+    MachineLoop *L = MLI.getLoopFor(&MBB);
+    if (L && !Persistent.count(L))
+      Persistent[L] = isPersistent(L);
+  }
+
+  // tag the loads by new memory operands, the old ones may be shared with
+  // copies of the load in other contexts
+  bool Changed = false;
+  for (MachineBasicBlock &MBB : MF) {
+    MachineLoop *L = MLI.getLoopFor(&MBB);
+    for (MachineInstr &MI : MBB.instrs()) {
+      if (!isDataCacheAccess(MI) || !MI.mayLoad())
+        continue;
+      NumDCacheLoads++; // STATISTIC
+
+      MachineMemOperand::Flags Class = Classes.lookup(&MI);
+      if (Class == MOAlwaysHit)
+        NumAlwaysHit++; // STATISTIC
+      else if (L && Persistent[L]) {
+        Class = MOFirstMiss;
+        NumFirstMiss++; // STATISTIC
+      }
+      LLVM_DEBUG(if (Class) dbgs() << "  "
+                   << (Class == MOAlwaysHit ? "always-hit" : "first-miss")
+                   << ": " << MI);
+
+      SmallVector<MachineMemOperand*, 2> MMOs;
+      bool Update = false;
+      for (MachineMemOperand *MMO : MI.memoperands()) {
+        MachineMemOperand::Flags Flags =
+          (MMO->getFlags() & ~(MOAlwaysHit | MOFirstMiss)) | Class;
+        Update |= Flags != MMO->getFlags();
+        MMOs.push_back(MF.getMachineMemOperand(MMO, Flags));
+      }
+      if (Update) {
+        MI.setMemRefs(MF, MMOs);
+        Changed = true;
+      }
+    }
+  }
+  return Changed;
+}
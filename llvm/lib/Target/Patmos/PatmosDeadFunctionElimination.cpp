@@ -0,0 +1,172 @@
+//===-- PatmosDeadFunctionElimination.cpp - Remove uncalled functions -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass deletes the machine functions that cannot be called anymore
+// according to the machine-level call graph.
+//
+// Single-path code generation clones every function reachable from a
+// single-path root before code generation, and the single-path marking only
+// afterwards rewrites the calls of single-path code to the clones. Originals
+// only ever called from single-path code and clones never called from it
+// thus survive until emission, are transformed, split and analysed by all
+// later passes, and end up in the binary. The marking reduces the unneeded
+// "sp-maybe" clones to a single return, this pass removes them completely.
+//
+// A function is removed if it has local linkage, its address is not taken
+// and it is not reachable from any other function in the call graph.
+// Externally visible functions are always kept, other modules may call them.
+//
+// The removed functions are erased from the module as well, such that no
+// later pass creates a new machine function for them. Since the marking only
+// rewrites the machine-level calls, the IR of live functions may still call a
+// removed function. These calls are never executed and are replaced by calls
+// to undef. The pass therefore is a module pass modifying the IR, not a
+// machine module pass.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "patmos-dead-functions"
+
+#include "Patmos.h"
+#include "PatmosCallGraphBuilder.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+STATISTIC(NumDeadFunctions, "Number of uncalled machine functions removed");
+
+static cl::opt<bool> EnableDeadFunctionElimination(
+  "mpatmos-eliminate-dead-functions",
+  cl::init(false),
+  cl::desc("Remove local functions that are not called after single-path "
+           "marking (default: false)."),
+  cl::Hidden);
+
+namespace {
+  class PatmosDeadFunctionElimination : public ModulePass {
+  private:
+    /// isRoot - Check whether F has to be kept, even if it is not called.
+    static bool isRoot(const Function &F);
+
+  public:
+    /// Pass ID
+    static char ID;
+
+    PatmosDeadFunctionElimination() : ModulePass(ID)
+    {
+      initializePatmosCallGraphBuilderPass(*PassRegistry::getPassRegistry());
+    }
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override
+    {
+      return "Patmos Dead Machine Function Elimination";
+    }
+
+    /// getAnalysisUsage - Specify which passes this pass depends on. The
+    /// call graph is not preserved, it refers to the removed functions.
+    void getAnalysisUsage(AnalysisUsage &AU) const override
+    {
+      AU.addRequired<MachineModuleInfoWrapperPass>();
+      AU.addPreserved<MachineModuleInfoWrapperPass>();
+      AU.addRequired<PatmosCallGraphBuilder>();
+      ModulePass::getAnalysisUsage(AU);
+    }
+
+    /// runOnModule - Remove the uncalled functions of the module.
+    bool runOnModule(Module &M) override;
+  };
+
+  char PatmosDeadFunctionElimination::ID = 0;
+}
+
+/// createPatmosDeadFunctionEliminationPass - Returns a new
+/// PatmosDeadFunctionElimination.
+ModulePass *llvm::createPatmosDeadFunctionEliminationPass() {
+  return new PatmosDeadFunctionElimination();
+}
+
+bool PatmosDeadFunctionElimination::isRoot(const Function &F)
+{
+  // the callers of address-taken functions are not known, other modules may
+  // call externally visible functions
+  return F.hasAddressTaken() || !F.hasLocalLinkage();
+}
+
+bool PatmosDeadFunctionElimination::runOnModule(Module &M)
+{
+  if (!EnableDeadFunctionElimination)
+    return false;
+
+  auto &MMI = getAnalysis<MachineModuleInfoWrapperPass>().getMMI();
+  const MCallGraph &G(*getAnalysis<PatmosCallGraphBuilder>().getCallGraph());
+
+  // mark all functions reachable from a root as live
+  std::set<const MCGNode*> Live;
+  std::vector<const MCGNode*> Worklist;
+  for (const MCGNode *N : G.getNodes()) {
+    if (N->isUnknown() || !isRoot(N->getMF()->getFunction()))
+      continue;
+    Live.insert(N);
+    Worklist.push_back(N);
+  }
+
+  while (!Worklist.empty()) {
+    const MCGNode *N = Worklist.back();
+    Worklist.pop_back();
+
+    // the sites of the UNKNOWN nodes lead to the address-taken functions
+    for (const MCGSite *S : N->getSites()) {
+      if (Live.insert(S->getCallee()).second)
+        Worklist.push_back(S->getCallee());
+    }
+  }
+
+  // collect the dead functions first, the call graph refers to their
+  // MachineFunctions
+  std::set<const MachineFunction*> DeadMFs;
+  for (const MCGNode *N : G.getNodes()) {
+    if (!N->isUnknown() && !Live.count(N))
+      DeadMFs.insert(N->getMF());
+  }
+
+  std::vector<Function*> Dead;
+  for (Function &F : M) {
+    if (DeadMFs.count(MMI.getMachineFunction(F)))
+      Dead.push_back(&F);
+  }
+
+  // the dead functions may call each other, drop their bodies before
+  // erasing any of them
+  for (Function *F : Dead) {
+    LLVM_DEBUG(dbgs() << "Removing uncalled function " << F->getName()
+                      << "\n");
+    MMI.deleteMachineFunctionFor(*F);
+    F->dropAllReferences();
+    NumDeadFunctions++; // bump STATISTIC
+  }
+
+  // the remaining calls of live functions were rewritten at machine level
+  for (Function *F : Dead) {
+    F->replaceAllUsesWith(UndefValue::get(F->getType()));
+    F->eraseFromParent();
+  }
+
+  return !Dead.empty();
+}
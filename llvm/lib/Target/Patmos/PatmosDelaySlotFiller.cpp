@@ -12,8 +12,11 @@
 // instructions. If no instructions can be moved into the delay slot, then a
 // NOP is inserted.
 //
-// At the current state, only instructions from the local basic are considered
-// (not the targets of branches).
+// Instructions from the local basic block are considered first. Remaining
+// delay slots of direct branches are filled with the leading instructions of
+// the branch target or the fall-through block, if that block has no other
+// predecessor. These instructions are guarded by the branch condition, so
+// they only take effect on the path to their block.
 //
 // As a post-processing step, NOPs are inserted after loads again, where
 // necessary.
@@ -36,11 +39,14 @@
 #include "PatmosInstrInfo.h"
 #include "PatmosTargetMachine.h"
 #include "PatmosRegisterInfo.h"
+#include "llvm/CodeGen/MachineBranchProbabilityInfo.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/CodeGen/TargetRegisterInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
@@ -54,6 +60,7 @@ using namespace llvm;
 
 STATISTIC( FilledSlots, "Number of delay slots filled");
 STATISTIC( FilledNOPs,  "Number of delay slots filled with NOPs");
+STATISTIC( FilledSuccSlots, "Number of delay slots filled from a successor");
 
 STATISTIC( SkippedLoadNOPs, "Number of loads not requiring a NOP");
 STATISTIC( InsertedLoadNOPs, "Number of NOPs inserted after loads");
@@ -68,6 +75,12 @@ static cl::opt<bool> DisableDelaySlotFiller(
   cl::desc("Disable the Patmos delay slot filler."),
   cl::Hidden);
 
+static cl::opt<bool> DisableSuccessorFill(
+  "mpatmos-disable-delay-filler-successors",
+  cl::init(false),
+  cl::desc("Only fill delay slots with instructions of the local block."),
+  cl::Hidden);
+
 namespace {
 
   class DelayHazardInfo;
@@ -85,20 +98,36 @@ namespace {
     const PatmosInstrInfo *TII;
     const TargetRegisterInfo *TRI;
 
+    /// Remarks on delay slots that are left as NOPs.
+    MachineOptimizationRemarkEmitter *ORE;
+
+    /// The branch probabilities, or null if the function has no profile.
+    const MachineBranchProbabilityInfo *MBPI;
+
     PatmosDelaySlotFiller(const PatmosTargetMachine &tm, bool disable)
       : MachineFunctionPass(ID), ForceDisableFiller(disable), TM(tm),
         TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())),
-        TRI(tm.getRegisterInfo()) { }
+        TRI(tm.getRegisterInfo()), ORE(nullptr), MBPI(nullptr) { }
 
     StringRef getPassName() const override {
       return "Patmos Delay Slot Filler";
     }
 
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<MachineOptimizationRemarkEmitterPass>();
+      AU.addRequired<MachineBranchProbabilityInfo>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
     bool runOnMachineFunction(MachineFunction &F) {
       LLVM_DEBUG(dbgs() << "\n********** Patmos Delay Slot Filler **********\n");
       LLVM_DEBUG(dbgs() << "********** Function: " << F.getFunction().getName() << "**********\n");
       LLVM_DEBUG(F.dump());
 
+      ORE = &getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
+      // only measured probabilities are worth deviating from the target
+      MBPI = F.getFunction().hasProfileData() ?
+             &getAnalysis<MachineBranchProbabilityInfo>() : nullptr;
 
       bool Changed = false;
       // FIXME: check if Post-RA scheduler is enabled (by option or Subtarget),
@@ -149,6 +178,20 @@ namespace {
                     const MachineBasicBlock::iterator I,
                     SmallSet<MachineInstr*, 16> &FillerInstrs);
 
+    /// fillSlotFromSuccessor - Move up to NumSlots leading instructions of
+    /// the target or fall-through block of the branch I into its delay slots,
+    /// right after I, guarding them by the branch condition.
+    /// \return the number of instructions moved.
+    unsigned fillSlotFromSuccessor(MachineBasicBlock &MBB,
+                    const MachineBasicBlock::iterator I, unsigned NumSlots,
+                    SmallSet<MachineInstr*, 16> &FillerInstrs);
+
+    /// isSuccessorFiller - Check if an instruction can be moved from its
+    /// block into a delay slot of a predecessor, guarded by Pred if Pred is
+    /// not empty.
+    bool isSuccessorFiller(const MachineInstr &MI,
+                           ArrayRef<MachineOperand> Pred) const;
+
     /// insertNOPAfter - Insert a nop after an instruction I, or split the
     /// bundle I.
     void insertNOPAfter(MachineBasicBlock &MBB,
@@ -161,7 +204,9 @@ namespace {
   public:
 
     DelayHazardInfo(PatmosDelaySlotFiller &pdsf, const MachineInstr &I)
-      : PDSF(pdsf), MI(I), sawLoad(false), sawStore(false), sawSTC(false) { }
+      : PDSF(pdsf), MI(I), sawLoad(false), sawStore(false), sawSTC(false),
+        RegDefs(pdsf.TRI->getNumRegUnits()),
+        RegUses(pdsf.TRI->getNumRegUnits()) { }
 
     void insertDefsUses(MachineInstr *MI);
     bool hasHazard(MachineBasicBlock &MBB,
@@ -172,16 +217,21 @@ namespace {
     void appendCandidate(MachineInstr *MI) { Candidates.push_back(MI); }
 
   protected:
-    bool isRegInSet(const SmallSet<unsigned, 32> &RegSet,
-                    unsigned reg) const;
+    /// insertReg - Add the register units of reg to the set.
+    /// \return false if all units were already in the set.
+    bool insertReg(BitVector &RegSet, unsigned reg) const;
+
+    bool isRegInSet(const BitVector &RegSet, unsigned reg) const;
   private:
     const PatmosDelaySlotFiller &PDSF;
     const MachineInstr &MI;
     bool sawLoad;
     bool sawStore;
     bool sawSTC; // stack control instruction
-    SmallSet<unsigned, 32> RegDefs;
-    SmallSet<unsigned, 32> RegUses;
+    /// The register units defined and used by the instructions between a
+    /// candidate and the delay slot.
+    BitVector RegDefs;
+    BitVector RegUses;
     SmallVector<MachineInstr *, 16> Candidates;
   };
 
@@ -252,7 +302,13 @@ fillSlotForCtrlFlow(MachineBasicBlock &MBB, const MachineBasicBlock::iterator I,
 
   unsigned CFLDelaySlots = TM.getSubtargetImpl()->getDelaySlotCycles(*I);
 
+  // why the local scan stopped, and the instructions skipped due to hazards,
+  // reported if NOPs remain
+  StringRef StopReason = "filler disabled";
+  unsigned NumHazards = 0;
+
   if (!DisableDelaySlotFiller && !ForceDisableFiller) {
+    StopReason = "reached block start";
 
     // initialize sets
     DI.insertDefsUses(&*I);
@@ -267,6 +323,14 @@ fillSlotForCtrlFlow(MachineBasicBlock &MBB, const MachineBasicBlock::iterator I,
            DI.getNumCandidates() == CFLDelaySlots ||
            J->isInlineAsm() || J->isLabel() ) {
         LLVM_DEBUG( dbgs() << " -- break at: " << *J );
+        if (J->hasDelaySlot())
+          StopReason = "reached delayed control-flow instruction";
+        else if (FillerInstrs.count(&*J))
+          StopReason = "reached filler of another delay slot";
+        else if (J->isInlineAsm())
+          StopReason = "reached inline assembly";
+        else if (J->isLabel())
+          StopReason = "reached label";
         break;
       }
       // skip debug value
@@ -277,6 +341,7 @@ fillSlotForCtrlFlow(MachineBasicBlock &MBB, const MachineBasicBlock::iterator I,
       if (DI.hasHazard(MBB, J)) {
         // update dependencies
         DI.insertDefsUses(&*J);
+        NumHazards++;
         LLVM_DEBUG( dbgs() << " -- skip: " << *J );
         continue;
       }
@@ -287,9 +352,33 @@ fillSlotForCtrlFlow(MachineBasicBlock &MBB, const MachineBasicBlock::iterator I,
     }
   }
 
+  // fill the remaining slots from the successor first, the local fillers and
+  // NOPs are inserted in front of them.
+  unsigned NumSucc = 0;
+  if (!DisableDelaySlotFiller && !ForceDisableFiller && !DisableSuccessorFill &&
+      DI.getNumCandidates() < CFLDelaySlots) {
+    NumSucc = fillSlotFromSuccessor(MBB, I,
+                                    CFLDelaySlots - DI.getNumCandidates(),
+                                    FillerInstrs);
+  }
+
+  if (DI.getNumCandidates() + NumSucc < CFLDelaySlots) {
+    unsigned NumNOPs = CFLDelaySlots - DI.getNumCandidates() - NumSucc;
+    ORE->emit([&]() {
+      return MachineOptimizationRemarkMissed(DEBUG_TYPE, "DelaySlotNOP",
+                                             I->getDebugLoc(), &MBB)
+             << ore::NV("NOPs", NumNOPs) << " of "
+             << ore::NV("DelaySlots", CFLDelaySlots)
+             << " delay slots of " << TII->getName(I->getOpcode())
+             << " left as NOPs: " << ore::NV("Reason", StopReason)
+             << ", " << ore::NV("Hazards", NumHazards)
+             << " instructions skipped due to hazards";
+    });
+  }
+
   // move instructions / insert NOPs
   MachineBasicBlock::iterator NI = std::next(I);
-  for (unsigned i=0; i<CFLDelaySlots; i++) {
+  for (unsigned i=0; i<CFLDelaySlots - NumSucc; i++) {
     if (i < DI.getNumCandidates()) {
       MachineInstr *FillMI = DI.getCandidate(i);
       MBB.splice(std::next(I), &MBB, FillMI);
@@ -307,6 +396,110 @@ fillSlotForCtrlFlow(MachineBasicBlock &MBB, const MachineBasicBlock::iterator I,
 
 }
 
+bool PatmosDelaySlotFiller::isSuccessorFiller(const MachineInstr &MI,
+                                         ArrayRef<MachineOperand> Pred) const
+{
+  if (MI.isBundled() || MI.isDebugInstr() || MI.isPseudo() ||
+      MI.isInlineAsm() || MI.isLabel() || MI.hasDelaySlot() ||
+      MI.isTerminator() || MI.isCall() || TII->isStackControl(&MI))
+    return false;
+
+  // same restrictions as for local fillers
+  if (MI.getOpcode() == Patmos::MUL || MI.getOpcode() == Patmos::MULU)
+    return false;
+  if (MI.hasUnmodeledSideEffects() && !TII->isSideEffectFreeSRegAccess(&MI))
+    return false;
+
+  if (Pred.empty())
+    return true;
+
+  // The instruction must be guarded by the branch condition, and must not
+  // change the guard of the following fillers.
+  if (!MI.isPredicable() || TII->isPredicated(MI) ||
+      MI.modifiesRegister(Pred[0].getReg(), TRI))
+    return false;
+
+  return true;
+}
+
+unsigned PatmosDelaySlotFiller::
+fillSlotFromSuccessor(MachineBasicBlock &MBB,
+                      const MachineBasicBlock::iterator I, unsigned NumSlots,
+                      SmallSet<MachineInstr *, 16> &FillerInstrs) {
+  if (!I->isBranch() || I->isIndirectBranch() || I->isBundled())
+    return 0;
+
+  // Find the block executed after the delay slots on some path, and the
+  // condition of that path.
+  SmallVector<MachineOperand, 2> Pred;
+  MachineBasicBlock *Succ = TII->getBranchTarget(&*I);
+  if (TII->isPredicated(*I)) {
+    TII->getPredicateOperands(*I, Pred);
+  }
+
+  auto isFillable = [&](const MachineBasicBlock *B) {
+    return B && B != &MBB && B->pred_size() == 1 && !B->hasAddressTaken() &&
+           !B->isEHPad() && !B->empty();
+  };
+
+  // the fall-through block of a conditional branch at the end of MBB
+  MachineBasicBlock *FallThrough = nullptr;
+  MachineFunction::iterator Next = std::next(MBB.getIterator());
+  if (!Pred.empty() && std::next(I) == MBB.end() &&
+      Next != MBB.getParent()->end() && MBB.isSuccessor(&*Next) &&
+      isFillable(&*Next))
+    FallThrough = &*Next;
+
+  // fill from the fall-through block if the target is not possible, or if
+  // the profile says the fall-through block is more likely
+  if (FallThrough &&
+      (!isFillable(Succ) ||
+       (MBPI && MBPI->getEdgeProbability(&MBB, FallThrough) >
+                MBPI->getEdgeProbability(&MBB, Succ)))) {
+    SmallVector<MachineOperand, 2> FallThroughPred(Pred);
+    if (!TII->reverseBranchCondition(FallThroughPred)) {
+      Succ = FallThrough;
+      Pred = FallThroughPred;
+    }
+  }
+
+  if (!isFillable(Succ))
+    return 0;
+
+  unsigned Moved = 0;
+  MachineBasicBlock::iterator InsertPt = std::next(I);
+  while (Moved < NumSlots && !Succ->empty()) {
+    MachineInstr &MI = Succ->front();
+    if (!isSuccessorFiller(MI, Pred))
+      break;
+
+    MI.removeFromParent();
+    MBB.insert(InsertPt, &MI);
+    if (!Pred.empty())
+      TII->PredicateInstruction(MI, Pred);
+
+    // The registers read by the filler might be live on the other path, the
+    // defined registers are now live-in to the successor.
+    MI.clearKillInfo();
+    for (const MachineOperand &MO : MI.operands()) {
+      if (MO.isReg() && MO.isDef() && MO.getReg() &&
+          !Succ->isLiveIn(MO.getReg()))
+        Succ->addLiveIn(MO.getReg());
+    }
+
+    FillerInstrs.insert(&MI);
+    ++FilledSuccSlots;
+    ++Moved;
+    LLVM_DEBUG( dbgs() << " -- filler from BB#" << Succ->getNumber()
+                       << ": " << MI );
+  }
+
+  if (Moved)
+    Succ->sortUniqueLiveIns();
+
+  return Moved;
+}
+
 void PatmosDelaySlotFiller::insertNOPAfter(MachineBasicBlock &MBB,
                     const MachineBasicBlock::iterator I)
 {
@@ -440,8 +633,8 @@ void DelayHazardInfo::insertDefsUses(MachineInstr *MI) {
   unsigned e = (MI->isCall() || MI->isReturn(MachineInstr::AllInBundle))
                       ? MCID.getNumOperands() : MI->getNumOperands();
 
-  if (MI->isCall())   RegDefs.insert(Patmos::SRB);
-  if (MI->isReturn()) RegUses.insert(Patmos::SRB);
+  if (MI->isCall())   insertReg(RegDefs, Patmos::SRB);
+  if (MI->isReturn()) insertReg(RegUses, Patmos::SRB);
 
   LLVM_DEBUG(dbgs() << " ---- regs: [");
   for (unsigned i = 0; i != e; ++i) {
@@ -452,9 +645,9 @@ void DelayHazardInfo::insertDefsUses(MachineInstr *MI) {
 
     bool inserted = false;
     if (MO.isDef())
-      inserted = RegDefs.insert(reg).second;
+      inserted = insertReg(RegDefs, reg);
     else if (MO.isUse())
-      inserted = RegUses.insert(reg).second;
+      inserted = insertReg(RegUses, reg);
 
     if (inserted) {
       LLVM_DEBUG(dbgs() << " " << PrintReg(reg, *PDSF.TRI) );
@@ -554,16 +747,26 @@ bool DelayHazardInfo::hasHazard(MachineBasicBlock &MBB,
 }
 
 
+bool DelayHazardInfo::insertReg(BitVector &RegSet, unsigned reg) const {
+  bool inserted = false;
+  for (MCRegUnitIterator UI(reg, PDSF.TRI); UI.isValid(); ++UI) {
+    if (!RegSet.test(*UI)) {
+      RegSet.set(*UI);
+      inserted = true;
+    }
+  }
+  return inserted;
+}
+
 //returns true if the reg or its alias is in the RegSet.
-bool DelayHazardInfo::isRegInSet(const SmallSet<unsigned, 32> &RegSet,
+bool DelayHazardInfo::isRegInSet(const BitVector &RegSet,
                                  unsigned reg) const {
 
-  // Check Reg and all aliased Registers.
-  for (MCRegAliasIterator AI(reg, PDSF.TRI, true);
-       AI.isValid(); ++AI)
-    if (RegSet.count(*AI)) {
+  // Registers alias iff they share a register unit.
+  for (MCRegUnitIterator UI(reg, PDSF.TRI); UI.isValid(); ++UI)
+    if (RegSet.test(*UI)) {
       LLVM_DEBUG(dbgs() << " ---- alias: "
-                  << PrintReg(*AI, *PDSF.TRI) << "\n");
+                  << PrintReg(reg, *PDSF.TRI) << "\n");
       return true;
     }
   return false;
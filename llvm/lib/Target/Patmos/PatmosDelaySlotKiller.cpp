@@ -12,6 +12,11 @@
 // instructions are NOPs, the instruction is replaced with a
 // non-delayed control-flow instruction.
 //
+// If only some of the slots are filled, the decision is made per instruction
+// by weighing the cycles of the filled slots, which are lost by the
+// non-delayed form, against the code size of the NOPs. The filler
+// instructions are then moved in front of the non-delayed instruction.
+//
 //===----------------------------------------------------------------------===//
 
 #include "Patmos.h"
@@ -34,6 +39,15 @@ using namespace llvm;
 #define DEBUG_TYPE "delay-slot-killer"
 
 STATISTIC( KilledSlots, "Number of eliminated delay slots");
+STATISTIC( HoistedSlots, "Number of delay slot instructions moved in front of "
+                         "a non-delayed instruction");
+
+static cl::opt<unsigned> CFLSizeWeight("mpatmos-cfl-size-weight",
+  cl::init(50),
+  cl::desc("Cost of a word of code in percent of a cycle, used to decide "
+           "whether partially filled delay slots are replaced by the "
+           "non-delayed form (default: 50)."),
+  cl::Hidden);
 
 namespace {
 
@@ -73,6 +87,17 @@ namespace {
     ///
     bool killDelaySlots(MachineBasicBlock &MBB);
 
+    /// preferNonDelayed - Check if the non-delayed form is cheaper than a
+    /// delayed instruction with NumFilled useful instructions and NumNops
+    /// NOPs in its delay slots.
+    bool preferNonDelayed(unsigned NumFilled, unsigned NumNops) const;
+
+    /// canHoistFillers - Check if the instructions in the delay slots of the
+    /// instruction (or bundle) CFL can be executed before it.
+    bool canHoistFillers(MachineBasicBlock &MBB,
+                         MachineBasicBlock::iterator CFL,
+                         ArrayRef<MachineBasicBlock::iterator> Fillers) const;
+
   };
 
   char PatmosDelaySlotKiller::ID = 0;
@@ -116,22 +141,44 @@ bool PatmosDelaySlotKiller::killDelaySlots(MachineBasicBlock &MBB) {
           Opcode == Patmos::BRCFRu ||
           Opcode == Patmos::BRCFT ||
           Opcode == Patmos::BRCFTu ||
+          Opcode == Patmos::BRCFTO ||
+          Opcode == Patmos::BRCFTOu ||
           Opcode == Patmos::CALL ||
           Opcode == Patmos::CALLR ||
           Opcode == Patmos::RET ||
           Opcode == Patmos::XRET) {
 
-        bool onlyNops = true;
+        SmallVector<MachineBasicBlock::iterator, 4> fillers;
         unsigned maxCount = TM.getSubtargetImpl()->getDelaySlotCycles(*I);
         unsigned count = 0;
+        // NOPs between the fillers might be required for load or multiply
+        // latencies, only leading fillers are moved.
+        bool sawNop = false, leading = true;
         for (MachineBasicBlock::iterator K = std::next(I), E = MBB.end();
              K != E && count < maxCount; ++K, ++count) {
           TII->skipPseudos(MBB, K);
+          if (K == E) break;
           if (K->getOpcode() != Patmos::NOP) {
-            onlyNops = false;
+            fillers.push_back(K);
+            leading &= !sawNop;
+          } else {
+            sawNop = true;
           }
         }
-        if (onlyNops) {
+
+        bool kill = fillers.empty() ||
+                    (leading &&
+                     preferNonDelayed(fillers.size(), count - fillers.size()) &&
+                     canHoistFillers(MBB, I, fillers));
+        if (kill) {
+          // move the useful instructions in front of the CFL, only NOPs
+          // remain in the delay slots.
+          for (unsigned i = 0; i < fillers.size(); i++) {
+            MBB.splice(I, &MBB, fillers[i]);
+            HoistedSlots++;
+          }
+          count -= fillers.size();
+
           unsigned NewOpcode = 0;
           switch(Opcode) {
           case Patmos::BR:     NewOpcode = Patmos::BRND; break;
@@ -146,6 +193,8 @@ bool PatmosDelaySlotKiller::killDelaySlots(MachineBasicBlock &MBB) {
           case Patmos::BRCFRu: NewOpcode = Patmos::BRCFRNDu; break;
           case Patmos::BRCFT:  NewOpcode = Patmos::BRCFTND; break;
           case Patmos::BRCFTu: NewOpcode = Patmos::BRCFTNDu; break;
+          case Patmos::BRCFTO: NewOpcode = Patmos::BRCFTOND; break;
+          case Patmos::BRCFTOu:NewOpcode = Patmos::BRCFTONDu; break;
           case Patmos::CALL:   NewOpcode = Patmos::CALLND; break;
           case Patmos::CALLR:  NewOpcode = Patmos::CALLRND; break;
           case Patmos::RET:    NewOpcode = Patmos::RETND; break;
@@ -169,3 +218,84 @@ bool PatmosDelaySlotKiller::killDelaySlots(MachineBasicBlock &MBB) {
   }
   return Changed;
 }
+
+bool PatmosDelaySlotKiller::preferNonDelayed(unsigned NumFilled,
+                                             unsigned NumNops) const {
+  if (TM.getSubtargetImpl()->getCFLType() == PatmosSubtarget::CFL_NON_DELAYED)
+    return true;
+
+  // The non-delayed form stalls for all delay slots, i.e., the filled slots
+  // cost a cycle each, but saves the NOPs.
+  return NumFilled * 100 < NumNops * CFLSizeWeight;
+}
+
+bool PatmosDelaySlotKiller::canHoistFillers(MachineBasicBlock &MBB,
+                       MachineBasicBlock::iterator CFL,
+                       ArrayRef<MachineBasicBlock::iterator> Fillers) const {
+  const TargetRegisterInfo *TRI = TM.getSubtargetImpl()->getRegisterInfo();
+
+  // The fillers get closer to the instructions before the CFL, check the
+  // latencies of loads and multiplications in front of it.
+  SmallVector<const MachineInstr*, 4> LongLatency;
+  MachineBasicBlock::iterator P = CFL;
+  for (unsigned i = 0; i < 2 && P != MBB.begin(); i++) {
+    P = TII->prevNonPseudo(MBB, P);
+    MachineBasicBlock::const_instr_iterator PI = P.getInstrIterator();
+    MachineBasicBlock::const_instr_iterator PE = std::next(PI);
+    if (PI->isBundle()) {
+      for (++PI, PE = PI; PE != MBB.instr_end() && PE->isInsideBundle(); ++PE) ;
+    }
+    for (; PI != PE; ++PI) {
+      if (PI->mayLoad() || PI->getOpcode() == Patmos::MUL ||
+          PI->getOpcode() == Patmos::MULU)
+        LongLatency.push_back(&*PI);
+    }
+  }
+
+  // collect the instructions of the CFL bundle, they must not see different
+  // register values when the fillers are executed first.
+  SmallVector<const MachineInstr*, 4> CFLInstrs;
+  MachineBasicBlock::const_instr_iterator MI = CFL.getInstrIterator();
+  if (CFL->isBundle()) {
+    for (++MI; MI != MBB.instr_end() && MI->isInsideBundle(); ++MI)
+      CFLInstrs.push_back(&*MI);
+  } else {
+    CFLInstrs.push_back(&*MI);
+  }
+
+  for (unsigned i = 0; i < Fillers.size(); i++) {
+    MachineBasicBlock::const_instr_iterator FI = Fillers[i].getInstrIterator();
+    MachineBasicBlock::const_instr_iterator FE = std::next(FI);
+    if (FI->isBundle()) {
+      for (++FI, FE = FI; FE != MBB.instr_end() && FE->isInsideBundle(); ++FE) ;
+    }
+
+    for (; FI != FE; ++FI) {
+      if (FI->hasDelaySlot() || FI->isInlineAsm() || FI->isCall() ||
+          FI->isReturn() || FI->isBranch() || FI->hasUnmodeledSideEffects())
+        return false;
+
+      for (unsigned j = 0; j < LongLatency.size(); j++) {
+        for (const MachineOperand &MO : LongLatency[j]->operands()) {
+          if (MO.isReg() && MO.isDef() && MO.getReg() &&
+              FI->readsRegister(MO.getReg(), TRI))
+            return false;
+        }
+      }
+
+      for (unsigned j = 0; j < CFLInstrs.size(); j++) {
+        for (const MachineOperand &MO : CFLInstrs[j]->operands()) {
+          if (!MO.isReg() || !MO.getReg()) continue;
+
+          // the filler must not define registers the CFL reads or writes,
+          // and must not read registers the CFL writes.
+          if (FI->modifiesRegister(MO.getReg(), TRI))
+            return false;
+          if (MO.isDef() && FI->readsRegister(MO.getReg(), TRI))
+            return false;
+        }
+      }
+    }
+  }
+  return true;
+}
@@ -9,30 +9,65 @@
 //
 // This pass ensures the alignment of functions, subfunctions and basic blocks.
 //
+// Without a method cache, i.e., with an instruction cache, the first block of
+// an innermost loop is also aligned to a cache line, i.e., a memory burst, if
+// the loop then spans fewer lines and its loop bound says it is hot. The
+// padding is executed at most once per entry of the loop, a line saved is a
+// miss saved on each entry. The method cache loads whole regions at once, a
+// loop within a region never loads a block by itself, so code is not padded
+// there.
+//
 //===----------------------------------------------------------------------===//
 
 #include "Patmos.h"
 #include "PatmosMachineFunctionInfo.h"
 #include "PatmosTargetMachine.h"
 #include "PatmosSubtarget.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
+
+#include <map>
+
 using namespace llvm;
 
+#define DEBUG_TYPE "patmos-ensure-alignment"
+
+STATISTIC(AlignedLoops, "Number of loops aligned to cache lines");
+
+static cl::opt<bool> EnableLoopAlignment("mpatmos-align-loops",
+  cl::init(true),
+  cl::desc("Align innermost loops to cache lines if this saves a line, "
+           "without a method cache (default: true)."),
+  cl::Hidden);
+
+static cl::opt<int> LoopAlignmentMinIterations(
+  "mpatmos-align-loops-min-iterations",
+  cl::init(4),
+  cl::desc("Align only loops with a loop bound of at least this many "
+           "iterations, or without a bound (default: 4)."),
+  cl::Hidden);
+
 namespace {
 
   class PatmosEnsureAlignment : public MachineFunctionPass {
   private:
+    const PatmosInstrInfo &TII;
+    const PatmosSubtarget &STI;
+
     unsigned MinSubfunctionAlignment;
 
     static char ID;
   public:
 
     PatmosEnsureAlignment(PatmosTargetMachine &tm)
-      : MachineFunctionPass(ID)
+      : MachineFunctionPass(ID), TII(*tm.getInstrInfo()),
+        STI(*tm.getSubtargetImpl())
     {
       const PatmosSubtarget *PST = tm.getSubtargetImpl();
 
@@ -43,6 +78,12 @@ namespace {
       return "Patmos Ensure Alignment";
     }
 
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesCFG();
+      AU.addRequired<MachineLoopInfo>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
     bool runOnMachineFunction(MachineFunction &MF) {
       const PatmosMachineFunctionInfo *PMFI =
                                        MF.getInfo<PatmosMachineFunctionInfo>();
@@ -71,6 +112,90 @@ namespace {
         }
       }
 
+      if (EnableLoopAlignment && !STI.hasMethodCache())
+        Changed |= alignLoops(MF);
+
+      return Changed;
+    }
+
+  private:
+    /// getBlockSize - Return the size of the code of MBB in bytes.
+    unsigned getBlockSize(const MachineBasicBlock &MBB) const {
+      unsigned Size = 0;
+      for (const MachineInstr &MI : MBB)
+        Size += TII.getInstrSize(&MI);
+      return Size;
+    }
+
+    /// getLines - Return the number of cache lines the code from Start to
+    /// Start + Size touches.
+    static unsigned getLines(unsigned Start, unsigned Size, unsigned Line) {
+      if (Size == 0)
+        return 0;
+      return (Start + Size - 1) / Line - Start / Line + 1;
+    }
+
+    /// alignLoops - Align the first block of hot innermost loops to a cache
+    /// line if this reduces the lines the loop spans.
+    bool alignLoops(MachineFunction &MF) {
+      const MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+      unsigned Line = STI.getMemoryBurstSize();
+
+      // the offsets are only known relative to the alignment of the function
+      if (Line < 2 || Line > MF.getAlignment().value())
+        return false;
+
+      // the loops whose blocks are laid out in a row, by their first block
+      std::map<const MachineBasicBlock*, unsigned> Loops;
+      for (MachineFunction::iterator i = MF.begin(), ie = MF.end();
+           i != ie; ++i)
+      {
+        MachineLoop *L = MLI.getLoopFor(&*i);
+        if (!L || !L->isInnermost() || L->getHeader() != &*i)
+          continue;
+
+        int MaxBound = getLoopBounds(&*i).second;
+        if (MaxBound >= 0 && MaxBound < LoopAlignmentMinIterations)
+          continue;
+
+        MachineFunction::iterator Top = i;
+        while (Top != MF.begin() && L->contains(&*std::prev(Top)))
+          --Top;
+        MachineFunction::iterator End = Top;
+        unsigned Size = 0, Blocks = 0;
+        while (End != ie && L->contains(&*End)) {
+          Size += getBlockSize(*End);
+          ++Blocks;
+          ++End;
+        }
+        if (Blocks == L->getNumBlocks() && Top != MF.begin())
+          Loops[&*Top] = Size;
+      }
+
+      // the code starts after the size word of the function
+      bool Changed = false;
+      unsigned Offset = 4;
+      for (MachineBasicBlock &MBB : MF) {
+        Offset = alignTo(Offset, MBB.getAlignment());
+
+        auto L = Loops.find(&MBB);
+        if (L != Loops.end() && MBB.getAlignment().value() < Line) {
+          unsigned Size = L->second;
+          if (getLines(alignTo(Offset, Line), Size, Line) <
+              getLines(Offset, Size, Line))
+          {
+            LLVM_DEBUG(dbgs() << "Align loop at BB#" << MBB.getNumber()
+                              << " of " << Size << " bytes at offset "
+                              << Offset << "\n");
+            MBB.setAlignment(Align(Line));
+            Offset = alignTo(Offset, Line);
+            AlignedLoops++;
+            Changed = true;
+          }
+        }
+
+        Offset += getBlockSize(MBB);
+      }
       return Changed;
     }
   };
@@ -0,0 +1,329 @@
+//===-- PatmosEnsurePlacement.cpp - Place stack cache ensures. ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Shrink, sink and remove the ensure instructions placed after calls by the
+// frame lowering.
+//
+// The frame lowering ensures the entire stack cache frame after every call.
+// This pass propagates the live area of the frame, i.e., the highest address
+// accessed by stack cache loads and stores before the next ensure, upwards
+// through the CFG, see also propagateLiveArea of the stack cache analysis.
+// Ensures are then
+//  - removed if nothing of the frame is accessed before the next ensure,
+//    e.g., between back-to-back calls,
+//  - moved into their successors, if nothing is accessed before the end of
+//    their block and the successors have no other predecessors, such that
+//    paths not using the frame do not fill it,
+//  - moved down to the first access within their block, and
+//  - shrunk to the live area.
+//
+// Predicated ensures, after calls predicated by the if-converter, are only
+// removed or shrunk.
+//
+// Unlike the stack cache analysis this does not require the call graph nor
+// the ILP solver, the function is considered on its own.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosFrameLowering.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "SinglePath/PatmosSinglePathInfo.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-ensure-placement"
+
+STATISTIC(RemovedEnsures, "Number of ensures removed");
+STATISTIC(SunkEnsures,    "Number of ensures moved into their successors");
+STATISTIC(ShrunkEnsures,  "Number of ensures shrunk to the live area");
+
+namespace {
+
+  class PatmosEnsurePlacement : public MachineFunctionPass {
+  private:
+    const PatmosInstrInfo &TII;
+    const PatmosFrameLowering &PFL;
+
+    /// The size of the live area at the entry of each block, in bytes.
+    DenseMap<const MachineBasicBlock*, unsigned> LiveIns;
+
+    MachineOptimizationRemarkEmitter *ORE;
+
+    static char ID;
+
+    /// isEnsure - Return true if MI is an unpredicated ensure, which serves
+    /// all following accesses to the frame.
+    bool isEnsure(const MachineInstr &MI) const {
+      return MI.getOpcode() == Patmos::SENSi && !TII.isPredicated(MI);
+    }
+
+    /// isPredicatedEnsure - Return true if MI is a predicated ensure, e.g.,
+    /// after a call predicated by the if-converter. It serves the following
+    /// accesses only if it executes, it is shrunk or removed but not moved.
+    bool isPredicatedEnsure(const MachineInstr &MI) const {
+      return MI.getOpcode() == Patmos::SENSi && TII.isPredicated(MI);
+    }
+
+    /// isBarrier - Return true if no ensure may be moved across MI.
+    bool isBarrier(const MachineInstr &MI) const {
+      switch (MI.getOpcode()) {
+      case Patmos::SRESi:
+      case Patmos::SENSi: case Patmos::SENSr:
+      case Patmos::SFREEi:
+      case Patmos::SSPILLi: case Patmos::SSPILLr:
+        return true;
+      }
+      return MI.isCall() || MI.isInlineAsm() || MI.isTerminator();
+    }
+
+    /// getLiveAreaSize - Bound the area of the stack cache frame accessed by
+    /// MI, in bytes.
+    unsigned getLiveAreaSize(const MachineInstr &MI) const {
+      unsigned scale = 1, base, offset;
+      switch (MI.getOpcode()) {
+      case Patmos::SWS:
+        scale = 4; base = 2; offset = 3;
+        break;
+      case Patmos::SHS:
+        scale = 2; base = 2; offset = 3;
+        break;
+      case Patmos::SBS:
+        base = 2; offset = 3;
+        break;
+      case Patmos::LWS:
+        scale = 4; base = 3; offset = 4;
+        break;
+      case Patmos::LHS: case Patmos::LHUS:
+        scale = 2; base = 3; offset = 4;
+        break;
+      case Patmos::LBS: case Patmos::LBUS:
+        base = 3; offset = 4;
+        break;
+      case Patmos::SENSr:
+      case Patmos::INLINEASM:
+      case Patmos::INLINEASM_BR:
+        return PFL.getEffectiveStackCacheSize();
+      default:
+        return 0;
+      }
+
+      if (MI.getOperand(base).getReg() != Patmos::R0 ||
+          !MI.getOperand(offset).isImm())
+        return PFL.getEffectiveStackCacheSize();
+
+      return scale * (MI.getOperand(offset).getImm() + 1);
+    }
+
+    /// getLiveOut - Return the size of the live area at the end of MBB.
+    unsigned getLiveOut(const MachineBasicBlock &MBB) const {
+      unsigned LiveOut = 0;
+      for (const MachineBasicBlock *Succ : MBB.successors())
+        LiveOut = std::max(LiveOut, LiveIns.lookup(Succ));
+      return LiveOut;
+    }
+
+    /// propagateLiveArea - Compute the size of the live area at the entry of
+    /// all blocks.
+    void propagateLiveArea(MachineFunction &MF) {
+      LiveIns.clear();
+
+      bool Changed = true;
+      while (Changed) {
+        Changed = false;
+        for (MachineBasicBlock *MBB : post_order(&MF)) {
+          unsigned Live = getLiveOut(*MBB);
+          for (auto I = MBB->rbegin(), E = MBB->rend(); I != E; ++I) {
+            if (isEnsure(*I))
+              Live = 0;
+            else
+              Live = std::max(Live, getLiveAreaSize(*I));
+          }
+
+          if (Live > LiveIns.lookup(MBB)) {
+            LiveIns[MBB] = Live;
+            Changed = true;
+          }
+        }
+      }
+    }
+
+    /// getEnsureWords - Return the ensure size covering Live bytes, in words.
+    unsigned getEnsureWords(unsigned Live) const {
+      return PFL.getAlignedStackCacheFrameSize(Live) / 4;
+    }
+
+    /// placeEnsure - Shrink, sink or remove the ensure MI. Return true if
+    /// anything changed.
+    bool placeEnsure(MachineInstr &MI) {
+      MachineBasicBlock &MBB = *MI.getParent();
+      unsigned Words = MI.getOperand(2).getImm();
+
+      // find the live area up to the end of the block and the first access
+      MachineBasicBlock::iterator FirstAccess = MBB.end();
+      unsigned Live = 0;
+      bool ReachesEnd = true;
+      for (MachineBasicBlock::iterator I = std::next(MI.getIterator()),
+           E = MBB.end(); I != E; ++I) {
+        if (isEnsure(*I)) {
+          ReachesEnd = false;
+          break;
+        }
+
+        unsigned Size = getLiveAreaSize(*I);
+        if ((Size || isBarrier(*I)) && FirstAccess == MBB.end())
+          FirstAccess = I;
+        Live = std::max(Live, Size);
+      }
+
+      unsigned LiveOut = ReachesEnd ? getLiveOut(MBB) : 0;
+
+      // nothing of the frame is used before the next ensure
+      if (Live == 0 && LiveOut == 0) {
+        LLVM_DEBUG(dbgs() << "Remove " << MI);
+        ORE->emit([&]() {
+          return MachineOptimizationRemark(DEBUG_TYPE, "EnsureRemoved",
+                                           MI.getDebugLoc(), &MBB)
+                 << "removed ensure of " << ore::NV("Words", Words)
+                 << " words, the frame is not accessed before the next ensure";
+        });
+        MI.eraseFromParent();
+        RemovedEnsures++;
+        return true;
+      }
+
+      // only successors use the frame, ensure on their entry if possible
+      bool Predicated = isPredicatedEnsure(MI);
+      bool CanSink = Live == 0 && ReachesEnd && !MBB.succ_empty() &&
+                     !Predicated;
+      for (MachineBasicBlock *Succ : MBB.successors()) {
+        if (Succ->pred_size() != 1 || Succ->isEHPad() || Succ == &MBB)
+          CanSink = false;
+      }
+
+      if (CanSink) {
+        for (MachineBasicBlock *Succ : MBB.successors()) {
+          unsigned SuccLive = LiveIns.lookup(Succ);
+          if (SuccLive == 0)
+            continue;
+
+          AddDefaultPred(BuildMI(*Succ, Succ->begin(), MI.getDebugLoc(),
+                                 TII.get(Patmos::SENSi)))
+            .addImm(std::min(Words, getEnsureWords(SuccLive)));
+        }
+
+        LLVM_DEBUG(dbgs() << "Sink into successors " << MI);
+        ORE->emit([&]() {
+          return MachineOptimizationRemark(DEBUG_TYPE, "EnsureSunk",
+                                           MI.getDebugLoc(), &MBB)
+                 << "sunk ensure of " << ore::NV("Words", Words)
+                 << " words into the successors of the block";
+        });
+        MI.eraseFromParent();
+        SunkEnsures++;
+        return true;
+      }
+
+      // shrink to the live area
+      bool Changed = false;
+      unsigned NewWords = std::min(Words, getEnsureWords(std::max(Live,
+                                                                  LiveOut)));
+      if (NewWords < Words) {
+        MI.getOperand(2).setImm(NewWords);
+        ShrunkEnsures++;
+        Changed = true;
+      }
+
+      // move down to the first access, the predicate may be redefined before
+      if (!Predicated && FirstAccess != std::next(MI.getIterator())) {
+        MBB.splice(FirstAccess, &MBB, MI.getIterator());
+        Changed = true;
+      }
+
+      ORE->emit([&]() {
+        MachineOptimizationRemarkMissed R(DEBUG_TYPE, "EnsureKept",
+                                          MI.getDebugLoc(), &MBB);
+        R << "ensure of " << ore::NV("Words", NewWords)
+          << " words not removed: ";
+        if (Live)
+          R << ore::NV("LiveBytes", Live)
+            << " bytes of the frame are accessed in the block";
+        else
+          R << ore::NV("LiveBytes", LiveOut)
+            << " bytes of the frame are accessed by successors it cannot be "
+               "sunk into";
+        return R;
+      });
+      return Changed;
+    }
+
+  public:
+    PatmosEnsurePlacement(const PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID), TII(*tm.getInstrInfo()),
+        PFL(*static_cast<const PatmosFrameLowering*>(
+                                   tm.getSubtargetImpl()->getFrameLowering())),
+        ORE(nullptr)
+    {
+    }
+
+    StringRef getPassName() const override {
+      return "Patmos Ensure Placement";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesCFG();
+      AU.addRequired<MachineOptimizationRemarkEmitterPass>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      // single-path code reserves and ensures its frames itself
+      if (PatmosSinglePathInfo::isEnabled(MF))
+        return false;
+
+      ORE = &getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
+      propagateLiveArea(MF);
+
+      // visit successors after their predecessors, such that sunk ensures are
+      // placed again
+      bool Changed = false;
+      std::vector<MachineInstr*> Ensures;
+      ReversePostOrderTraversal<MachineFunction*> RPOT(&MF);
+      for (MachineBasicBlock *MBB : RPOT) {
+        Ensures.clear();
+        for (MachineInstr &MI : *MBB) {
+          if (isEnsure(MI) || isPredicatedEnsure(MI))
+            Ensures.push_back(&MI);
+        }
+
+        for (MachineInstr *MI : Ensures)
+          Changed |= placeEnsure(*MI);
+      }
+
+      return Changed;
+    }
+  };
+
+  char PatmosEnsurePlacement::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosEnsurePlacementPass - Returns a new PatmosEnsurePlacement pass.
+FunctionPass *
+llvm::createPatmosEnsurePlacementPass(const PatmosTargetMachine &tm) {
+  return new PatmosEnsurePlacement(tm);
+}
@@ -11,7 +11,6 @@
 //
 //===----------------------------------------------------------------------===//
 
-#define DEBUG_TYPE "patmos-framelowering"
 #include "PatmosFrameLowering.h"
 #include "PatmosInstrInfo.h"
 #include "PatmosMachineFunctionInfo.h"
@@ -20,10 +19,13 @@
 #include "PatmosTargetMachine.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Function.h"
+#include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
+#include "llvm/CodeGen/MachinePostDominators.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/RegisterScavenging.h"
 #include "llvm/IR/DataLayout.h"
@@ -31,11 +33,34 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 
+#define DEBUG_TYPE "patmos-framelowering"
+
 using namespace llvm;
 
 namespace llvm {
   /// Count the number of FIs overflowing into the shadow stack
   STATISTIC(FIsNotFitSC, "FIs that did not fit in the stack cache");
+
+  /// Count the number of spill slots overflowing into the shadow stack
+  STATISTIC(SpillsNotFitSC, "Spill slots that did not fit in the stack cache");
+
+  /// Count the number of local variables assigned to the stack cache
+  STATISTIC(LocalsOnSC, "Non-escaping locals assigned to the stack cache");
+
+  /// Count the bytes of the stack cache frames, including the padding to the
+  /// block size
+  STATISTIC(SCFrameBytes, "Bytes of stack cache frames");
+
+  /// Count the bytes of the stack cache frames that are not used by any frame
+  /// object, i.e., alignment padding and the padding to the block size
+  STATISTIC(SCFramePaddingBytes, "Bytes of stack cache frames lost to padding");
+
+  /// Count the stack cache frames split into the frame reserved at the entry
+  /// and a stack cache region
+  STATISTIC(SCFramesSplit, "Stack cache frames split at a region");
+
+  /// Count the bytes of the stack cache frames no longer reserved at calls
+  STATISTIC(SCRegionBytes, "Bytes of stack cache frames reserved by regions");
 }
 
 /// DisableStackCache - Command line option to disable the usage of the stack 
@@ -50,6 +75,34 @@ static cl::opt<bool> EnableBlockAlignedStackCache
           ("mpatmos-enable-block-aligned-stack-cache", cl::init(false),
            cl::desc("Enable the use of Patmos' block-aligned stack cache"));
 
+/// EnableStackCacheLocals - Command line option to assign local scalars whose
+/// address is never taken to the stack cache (disabled by default).
+static cl::opt<bool> EnableStackCacheLocals
+          ("mpatmos-stack-cache-locals", cl::init(false),
+           cl::desc("Assign non-escaping local scalars to Patmos' stack cache "
+                    "(default: false)."));
+
+/// EnableShrinkWrap - Command line option to place the reservation of the
+/// stack frames around the blocks accessing them (disabled by default).
+static cl::opt<bool> EnableShrinkWrap
+          ("mpatmos-shrink-wrap", cl::init(false),
+           cl::desc("Reserve and free the stack frames only on the paths "
+                    "that use them (shrink-wrapping)"));
+
+/// EnableFrameSplitting - Command line option to reserve the stack cache
+/// objects of a call-free region only within that region (disabled by
+/// default).
+static cl::opt<bool> EnableFrameSplitting
+          ("mpatmos-split-stack-cache-frames", cl::init(false),
+           cl::desc("Reserve the stack cache objects only used within a "
+                    "region without calls at the region's entry (default: "
+                    "false)."),
+           cl::Hidden);
+
+/// MaxStackCacheLocalSize - Largest local variable assigned to the stack
+/// cache by EnableStackCacheLocals, in bytes.
+static const int64_t MaxStackCacheLocalSize = 8;
+
 bool PatmosFrameLowering::hasFP(const MachineFunction &MF) const {
   const MachineFrameInfo &MFI = MF.getFrameInfo();
 
@@ -62,10 +115,23 @@ bool PatmosFrameLowering::hasFP(const MachineFunction &MF) const {
           MFI.isFrameAddressTaken());
 }
 
+bool PatmosFrameLowering::isInterruptHandler(const MachineFunction &MF) {
+  return MF.getFunction().hasFnAttribute("interrupt");
+}
+
 static unsigned int align(unsigned int offset, unsigned int alignment) {
   return ((offset + alignment - 1) / alignment) * alignment;
 }
 
+bool
+PatmosFrameLowering::enableShrinkWrapping(const MachineFunction &MF) const {
+  // Single-path code reserves its frames itself, see
+  // PatmosSPFrameCoalescing. The frame pointer is set up at the entry.
+  // Interrupt handlers must save the interrupted context in any case.
+  return EnableShrinkWrap && !PatmosSinglePathInfo::isEnabled(MF) &&
+         !hasFP(MF) && !isInterruptHandler(MF);
+}
+
 unsigned PatmosFrameLowering::getEffectiveStackCacheSize() const
 {
   return EnableBlockAlignedStackCache ? 
@@ -95,6 +161,7 @@ void PatmosFrameLowering::assignFIsToStackCache(MachineFunction &MF,
   PatmosMachineFunctionInfo &PMFI = *MF.getInfo<PatmosMachineFunctionInfo>();
   const std::vector<CalleeSavedInfo> &CSI = MFI.getCalleeSavedInfo();
   const TargetRegisterInfo *TRI = STC.getRegisterInfo();
+  const PatmosInstrInfo &TII = *STC.getInstrInfo();
 
   assert(MFI.isCalleeSavedInfoValid());
 
@@ -129,10 +196,334 @@ void PatmosFrameLowering::assignFIsToStackCache(MachineFunction &MF,
     if (MFI.isSpillSlotObjectIndex(FI))
       SCFIs[FI] = true;
   }
+
+  if (!EnableStackCacheLocals)
+    return;
+
+  // find all FIs whose address escapes, i.e., that are not only accessed
+  // directly by loads and stores
+  BitVector Accessed(MFI.getObjectIndexEnd());
+  BitVector Escaping(MFI.getObjectIndexEnd());
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB) {
+      if (MI.isDebugInstr())
+        continue;
+
+      for (unsigned i = 0, e = MI.getNumOperands(); i != e; i++) {
+        const MachineOperand &MO = MI.getOperand(i);
+        if (!MO.isFI() || MO.getIndex() < 0)
+          continue;
+
+        Accessed.set(MO.getIndex());
+        if (!TII.isDirectFrameAccess(MI, i))
+          Escaping.set(MO.getIndex());
+      }
+    }
+  }
+
+  // local scalars whose address is never taken cannot be aliased
+  for(unsigned FI = 0, FIe = MFI.getObjectIndexEnd(); FI != FIe; FI++) {
+    if (SCFIs[FI] || !Accessed[FI] || Escaping[FI] ||
+        MFI.isDeadObjectIndex(FI) || MFI.isVariableSizedObjectIndex(FI) ||
+        MFI.getObjectSize(FI) > MaxStackCacheLocalSize)
+      continue;
+
+    SCFIs[FI] = true;
+    LocalsOnSC++;
+  }
 }
 
 
 
+/// getStackCacheObjectBytes - Return the total size of the frame objects
+/// assigned to the stack cache.
+static unsigned getStackCacheObjectBytes(const MachineFrameInfo &MFI,
+                                         const BitVector &SCFIs) {
+  unsigned Bytes = 0;
+  for (unsigned FI : SCFIs.set_bits()) {
+    if (!MFI.isDeadObjectIndex(FI))
+      Bytes += MFI.getObjectSize(FI);
+  }
+  return Bytes;
+}
+
+/// layoutFrameObjects - Place the given frame objects densely, by decreasing
+/// alignment, starting at offset 0.
+/// @param Assign - update the offsets of the objects.
+/// @return The size of the layout.
+static unsigned layoutFrameObjects(MachineFrameInfo &MFI,
+                                   std::vector<unsigned> FIs, bool Assign) {
+  std::stable_sort(FIs.begin(), FIs.end(), [&](unsigned a, unsigned b) {
+    return MFI.getObjectAlign(a) > MFI.getObjectAlign(b);
+  });
+
+  unsigned Offset = 0;
+  for (unsigned FI : FIs) {
+    Offset = align(Offset, MFI.getObjectAlign(FI).value());
+    if (Assign) {
+      LLVM_DEBUG(dbgs() << "PatmosSC: FI: " << FI << " on SC: " << Offset
+                  << "(" << MFI.getObjectOffset(FI) << ")\n");
+      MFI.setObjectOffset(FI, Offset);
+    }
+    Offset += MFI.getObjectSize(FI);
+  }
+  return Offset;
+}
+
+unsigned PatmosFrameLowering::packStackCacheObjects(MachineFunction &MF,
+                                                    BitVector &SCFIs) const
+{
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  const PatmosInstrInfo &TII = *STC.getInstrInfo();
+  PatmosAnalysisInfo &PAI =
+                      MF.getInfo<PatmosMachineFunctionInfo>()->getAnalysisInfo();
+
+  // weight the cycles the accesses to each object would cost on the shadow
+  // stack by the frequency of their block, such that spill slots reloaded in
+  // hot loops are kept on the stack cache rather than objects whose address
+  // is only computed. Blocks created after the frequencies were computed
+  // count as the entry. Without frequencies, all objects weigh the same and
+  // are picked in order.
+  int64_t EntryFreq = PAI.getFrequency(&MF.front());
+  std::vector<uint64_t> Weights(MFI.getObjectIndexEnd(), 0);
+  for (auto &MBB : MF) {
+    if (EntryFreq < 0)
+      break;
+    int64_t Freq = PAI.getFrequency(&MBB, EntryFreq);
+    for (auto &MI : MBB) {
+      for (unsigned i = 0, e = MI.getNumOperands(); i != e; i++) {
+        const MachineOperand &MO = MI.getOperand(i);
+        if (MO.isFI() && MO.getIndex() >= 0)
+          Weights[MO.getIndex()] += Freq * TII.getShadowStackAccessCost(MI, i);
+      }
+    }
+  }
+
+  // hottest objects per byte first
+  std::vector<unsigned> Candidates;
+  for(unsigned FI = 0, FIe = MFI.getObjectIndexEnd(); FI != FIe; FI++) {
+    if (SCFIs[FI] && !MFI.isDeadObjectIndex(FI))
+      Candidates.push_back(FI);
+  }
+  std::stable_sort(Candidates.begin(), Candidates.end(),
+                   [&](unsigned a, unsigned b) {
+    return (double)Weights[a] / std::max<int64_t>(MFI.getObjectSize(a), 1) >
+           (double)Weights[b] / std::max<int64_t>(MFI.getObjectSize(b), 1);
+  });
+
+  // pick objects as long as the dense layout fits into the stack cache. The
+  // layout by decreasing alignment avoids padding between the objects, such
+  // that the frame occupies as few blocks as possible.
+  // frame lowering is no pass of its own, the remarks are emitted without
+  // hotness
+  MachineOptimizationRemarkEmitter ORE(MF, nullptr);
+  std::vector<unsigned> Picked;
+  for (unsigned FI : Candidates) {
+    Picked.push_back(FI);
+    if (align(layoutFrameObjects(MFI, Picked, false),
+              getEffectiveStackCacheBlockSize()) >
+        getEffectiveStackCacheSize()) {
+      LLVM_DEBUG(dbgs() << "PatmosSC: FI: " << FI << " (weight "
+                        << Weights[FI] << ") does not fit on SC\n");
+      Picked.pop_back();
+      SCFIs[FI] = false;
+      FIsNotFitSC++;
+      if (MFI.isSpillSlotObjectIndex(FI))
+        SpillsNotFitSC++;
+      ORE.emit([&]() {
+        return MachineOptimizationRemarkMissed(DEBUG_TYPE, "ShadowStackObject",
+                                               DebugLoc(), &MF.front())
+               << "frame object " << ore::NV("FrameIndex", FI) << " of "
+               << ore::NV("Size", MFI.getObjectSize(FI))
+               << " bytes placed on the shadow stack: does not fit into the "
+               << ore::NV("StackCacheSize", getEffectiveStackCacheSize())
+               << " bytes stack cache";
+      });
+    }
+  }
+
+  return layoutFrameObjects(MFI, Picked, true);
+}
+
+/// getStackCacheRegion - Collect the blocks between Entry and Exit, if they
+/// form a single-entry single-exit region not containing any of the Barriers
+/// nor the function entry.
+/// @return False if the blocks do not form such a region.
+static bool
+getStackCacheRegion(MachineFunction &MF, MachineBasicBlock *Entry,
+                    MachineBasicBlock *Exit,
+                    const DomTreeBase<MachineBasicBlock> &DT,
+                    const PostDomTreeBase<MachineBasicBlock> &PDT,
+                    const std::set<const MachineBasicBlock*> &Barriers,
+                    std::set<const MachineBasicBlock*> &Blocks)
+{
+  if (!Entry || !Exit || Entry == &MF.front() || !DT.dominates(Entry, Exit) ||
+      !PDT.dominates(Exit, Entry))
+    return false;
+
+  Blocks.clear();
+  for (auto &MBB : MF) {
+    if (DT.isReachableFromEntry(&MBB) && DT.dominates(Entry, &MBB) &&
+        PDT.dominates(Exit, &MBB))
+      Blocks.insert(&MBB);
+  }
+
+  // the region is only entered through its entry and left through its exit,
+  // such that the reserve and the free are executed exactly once
+  for (const MachineBasicBlock *MBB : Blocks) {
+    if (Barriers.count(MBB))
+      return false;
+
+    for (const MachineBasicBlock *Pred : MBB->predecessors()) {
+      if ((MBB == Entry) == (Blocks.count(Pred) != 0))
+        return false;
+    }
+    for (const MachineBasicBlock *Succ : MBB->successors()) {
+      if ((MBB == Exit) == (Blocks.count(Succ) != 0))
+        return false;
+    }
+  }
+  return true;
+}
+
+unsigned PatmosFrameLowering::splitStackCacheFrame(MachineFunction &MF,
+                                                   const BitVector &SCFIs,
+                                                   unsigned Size) const
+{
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  PatmosMachineFunctionInfo &PMFI = *MF.getInfo<PatmosMachineFunctionInfo>();
+  unsigned BlockSize = getEffectiveStackCacheBlockSize();
+
+  // single-path code coalesces its frames, with shrink-wrapping the frame is
+  // not reserved at the entry. Without calls, nothing is gained.
+  if (!EnableFrameSplitting || PatmosSinglePathInfo::isEnabled(MF) ||
+      MFI.getSavePoint() || !MFI.hasCalls() || Size == 0)
+    return Size;
+
+  // find the blocks accessing the stack cache objects, and the blocks that
+  // must not be part of a region
+  std::vector<std::vector<MachineBasicBlock*> > Users(MFI.getObjectIndexEnd());
+  std::set<const MachineBasicBlock*> Barriers;
+  for (auto &MBB : MF) {
+    if (MBB.isEHPad() || MBB.hasAddressTaken() || MBB.succ_empty())
+      Barriers.insert(&MBB);
+
+    for (auto &MI : MBB) {
+      if (MI.isCall() || MI.isInlineAsm())
+        Barriers.insert(&MBB);
+
+      for (const MachineOperand &MO : MI.operands()) {
+        if (!MO.isFI() || MO.getIndex() < 0 || !SCFIs[MO.getIndex()])
+          continue;
+        std::vector<MachineBasicBlock*> &U = Users[MO.getIndex()];
+        if (U.empty() || U.back() != &MBB)
+          U.push_back(&MBB);
+      }
+    }
+  }
+
+  DomTreeBase<MachineBasicBlock> DT;
+  DT.recalculate(MF);
+  PostDomTreeBase<MachineBasicBlock> PDT;
+  PDT.recalculate(MF);
+
+  // the objects used by the register scavenger may be accessed anywhere
+  int ScavengingFI = STC.getRegisterInfo()->requiresRegisterScavenging(MF) ?
+                     (int)PMFI.getRegScavengingFI() : -1;
+
+  // try the region enclosing the accesses of each object, the region of an
+  // object also serves all objects accessed only within it
+  std::vector<unsigned> All;
+  for (unsigned FI : SCFIs.set_bits()) {
+    if (!MFI.isDeadObjectIndex(FI))
+      All.push_back(FI);
+  }
+  unsigned BestSize = align(Size, BlockSize);
+  unsigned BestRegionSize = 0;
+  MachineBasicBlock *BestEntry = NULL, *BestExit = NULL;
+  std::set<const MachineBasicBlock*> BestBlocks;
+  BitVector BestFIs;
+  std::set<std::pair<MachineBasicBlock*, MachineBasicBlock*> > Tried;
+  for (unsigned FI : All) {
+    if ((int)FI == ScavengingFI || Users[FI].empty())
+      continue;
+
+    MachineBasicBlock *Entry = Users[FI].front(), *Exit = Users[FI].front();
+    for (MachineBasicBlock *MBB : Users[FI]) {
+      if (!DT.isReachableFromEntry(MBB)) {
+        Entry = NULL;
+        break;
+      }
+      Entry = DT.findNearestCommonDominator(Entry, MBB);
+      Exit = Exit ? PDT.findNearestCommonDominator(Exit, MBB) : NULL;
+    }
+
+    std::set<const MachineBasicBlock*> Blocks;
+    if (!Tried.insert(std::make_pair(Entry, Exit)).second ||
+        !getStackCacheRegion(MF, Entry, Exit, DT, PDT, Barriers, Blocks))
+      continue;
+
+    // split the objects into those of the region and the remaining frame
+    BitVector RegionFIs(MFI.getObjectIndexEnd());
+    std::vector<unsigned> FrameObjects, RegionObjects;
+    for (unsigned Other : All) {
+      bool InRegion = (int)Other != ScavengingFI && !Users[Other].empty() &&
+                      std::all_of(Users[Other].begin(), Users[Other].end(),
+                                  [&](const MachineBasicBlock *MBB) {
+                                    return Blocks.count(MBB) != 0;
+                                  });
+      if (InRegion) {
+        RegionFIs.set(Other);
+        RegionObjects.push_back(Other);
+      } else {
+        FrameObjects.push_back(Other);
+      }
+    }
+
+    unsigned FrameSize = align(layoutFrameObjects(MFI, FrameObjects, false),
+                               BlockSize);
+    unsigned RegionSize = align(layoutFrameObjects(MFI, RegionObjects, false),
+                                BlockSize);
+    if (getAlignedStackCacheFrameSize(FrameSize) >=
+            getAlignedStackCacheFrameSize(BestSize) ||
+        getAlignedStackCacheFrameSize(FrameSize) +
+            getAlignedStackCacheFrameSize(RegionSize) >
+        getEffectiveStackCacheSize())
+      continue;
+
+    BestSize = FrameSize;
+    BestRegionSize = getAlignedStackCacheFrameSize(RegionSize);
+    BestEntry = Entry;
+    BestExit = Exit;
+    BestBlocks.swap(Blocks);
+    BestFIs = RegionFIs;
+  }
+
+  if (!BestEntry)
+    return Size;
+
+  LLVM_DEBUG(dbgs() << "PatmosSC: split frame of " << MF.getName()
+                    << ", region " << printMBBReference(*BestEntry) << " to "
+                    << printMBBReference(*BestExit) << " reserves "
+                    << BestRegionSize << " bytes\n");
+
+  // the region objects are placed at the top of the stack, the frame below
+  std::vector<unsigned> FrameObjects, RegionObjects;
+  for (unsigned FI : All) {
+    if (BestFIs[FI])
+      RegionObjects.push_back(FI);
+    else
+      FrameObjects.push_back(FI);
+  }
+  layoutFrameObjects(MFI, RegionObjects, true);
+  PMFI.setStackCacheRegion(BestEntry, BestExit, BestBlocks, BestFIs,
+                           BestRegionSize);
+  SCFramesSplit++;
+  SCRegionBytes += BestRegionSize;
+
+  return layoutFrameObjects(MFI, FrameObjects, true);
+}
+
 unsigned PatmosFrameLowering::assignFrameObjects(MachineFunction &MF,
                                                  bool UseStackCache) const
 {
@@ -149,8 +540,12 @@ unsigned PatmosFrameLowering::assignFrameObjects(MachineFunction &MF,
 
   // assign new offsets to FIs
 
-  // next stack slot in stack cache
-  unsigned int SCOffset = 0;
+  // the objects on the stack cache are packed up-front, the hottest first if
+  // block frequencies are known, the others go to the shadow stack
+  unsigned int SCOffset = UseStackCache ? packStackCacheObjects(MF, SCFIs) : 0;
+  // objects only used within a region without calls may be reserved there
+  if (UseStackCache)
+    SCOffset = splitStackCacheFrame(MF, SCFIs, SCOffset);
   // next stack slot in shadow stack
   // Also reserve space for the call frame if we do not use a frame pointer.
   // This must be in sync with PatmosRegisterInfo::eliminateCallFramePseudoInstr
@@ -172,38 +567,12 @@ unsigned PatmosFrameLowering::assignFrameObjects(MachineFunction &MF,
     // be sure to catch some special stack objects not expected for Patmos
     assert(!MFI.isFixedObjectIndex(FI) && !MFI.isObjectPreAllocated(FI));
 
-    // assigned to stack cache or shadow stack?
-    if (SCFIs[FI]) {
-      // alignment
-      unsigned int next_SCOffset = align(SCOffset, FIalignment.value());
-
-      // check if the FI still fits into the SC
-      if (align(next_SCOffset + FIsize, getEffectiveStackCacheBlockSize()) <=
-          getEffectiveStackCacheSize()) {
-        LLVM_DEBUG(dbgs() << "PatmosSC: FI: " << FI << " on SC: " << next_SCOffset
-                    << "(" << MFI.getObjectOffset(FI) << ")\n");
-
-        // reassign stack offset
-        MFI.setObjectOffset(FI, next_SCOffset);
-
-        // reserve space on the stack cache
-        SCOffset = next_SCOffset + FIsize;
-
-        // the FI is assigned to the SC, process next FI
-        continue;
-      }
-      else {
-        // the FI did not fit in the SC -- fall-through and put it on the 
-        // shadow stack
-        SCFIs[FI] = false;
-        FIsNotFitSC++;
-      }
-    }
+    // already placed on the stack cache
+    if (SCFIs[FI])
+      continue;
 
     // assign the FI to the shadow stack
     {
-      assert(!SCFIs[FI]);
-
       // alignment
       SSOffset = align(SSOffset, FIalignment.value());
 
@@ -223,6 +592,12 @@ unsigned PatmosFrameLowering::assignFrameObjects(MachineFunction &MF,
 
   assert(stackCacheSize <= getEffectiveStackCacheSize());
 
+  if (stackCacheSize) {
+    unsigned alignedSize = getAlignedStackCacheFrameSize(stackCacheSize);
+    SCFrameBytes += alignedSize;
+    SCFramePaddingBytes += alignedSize - getStackCacheObjectBytes(MFI, SCFIs);
+  }
+
   // align shadow stack. call arguments are already included in SSOffset
   unsigned stackSize = align(SSOffset, getStackAlignment());
 
@@ -280,8 +655,8 @@ void PatmosFrameLowering::patchCallSites(MachineFunction &MF) const {
   for (MachineFunction::iterator i(MF.begin()), ie(MF.end()); i != ie; ++i) {
     for (MachineBasicBlock::iterator j(i->begin()), je=(i->end()); j != je;
          j++) {
-      // a call site?
-      if (j->isCall()) {
+      // a call site? tail calls do not return here.
+      if (j->isCall() && !j->isReturn()) {
         MachineBasicBlock::iterator p(std::next(j));
         emitSTC(MF, *i, p, Patmos::SENSi);
       }
@@ -289,6 +664,28 @@ void PatmosFrameLowering::patchCallSites(MachineFunction &MF) const {
   }
 }
 
+void PatmosFrameLowering::emitStackCacheRegion(MachineFunction &MF) const {
+  PatmosMachineFunctionInfo &PMFI = *MF.getInfo<PatmosMachineFunctionInfo>();
+  unsigned Bytes = PMFI.getStackCacheRegionBytes();
+  if (!Bytes)
+    return;
+
+  const TargetInstrInfo &TII = *STC.getInstrInfo();
+  MachineBasicBlock &Entry = *PMFI.getStackCacheRegionEntry();
+  MachineBasicBlock &Exit = *PMFI.getStackCacheRegionExit();
+
+  // the region contains no calls, the ensures after calls only ensure the
+  // remaining frame
+  DebugLoc DL = Entry.empty() ? DebugLoc() : Entry.front().getDebugLoc();
+  AddDefaultPred(BuildMI(Entry, Entry.begin(), DL, TII.get(Patmos::SRESi)))
+    .addImm(Bytes / 4);
+
+  MachineBasicBlock::iterator Term = Exit.getFirstTerminator();
+  DL = Term != Exit.end() ? Term->getDebugLoc() : DebugLoc();
+  AddDefaultPred(BuildMI(Exit, Term, DL, TII.get(Patmos::SFREEi)))
+    .addImm(Bytes / 4);
+}
+
 void PatmosFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock &MBB) const {
   const TargetInstrInfo *TII = STC.getInstrInfo();
 
@@ -298,8 +695,11 @@ void PatmosFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock &M
   //----------------------------------------------------------------------------
   // Handle the stack cache -- if enabled.
 
-  // assign some FIs to the stack cache if possible
-  unsigned stackSize = assignFrameObjects(MF, !DisableStackCache);
+  // assign some FIs to the stack cache if possible. Interrupt handlers keep
+  // their frame on the shadow stack, a reserve could spill the frame of the
+  // interrupted code.
+  unsigned stackSize = assignFrameObjects(MF, !DisableStackCache &&
+                                              !isInterruptHandler(MF));
 
   if (!DisableStackCache) {
     // emit a reserve instruction
@@ -308,6 +708,9 @@ void PatmosFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock &M
 
     // patch all call sites
     patchCallSites(MF);
+
+    // reserve the objects of the stack cache region, if the frame is split
+    emitStackCacheRegion(MF);
   }
 
   //----------------------------------------------------------------------------
@@ -335,10 +738,11 @@ void PatmosFrameLowering::emitPrologue(MachineFunction &MF, MachineBasicBlock &M
 
 void PatmosFrameLowering::emitEpilogue(MachineFunction &MF,
                                        MachineBasicBlock &MBB) const {
-  MachineBasicBlock::iterator MBBI = MBB.getLastNonDebugInstr();
+  // with shrink-wrapping, the restore point need not end with a return
+  MachineBasicBlock::iterator MBBI = MBB.getFirstTerminator();
   MachineFrameInfo &MFI            = MF.getFrameInfo();
   const TargetInstrInfo *TII       = STC.getInstrInfo();
-  DebugLoc dl                      = MBBI->getDebugLoc();
+  DebugLoc dl = MBBI != MBB.end() ? MBBI->getDebugLoc() : DebugLoc();
 
   //----------------------------------------------------------------------------
   // Handle Stack Cache
@@ -347,6 +751,16 @@ void PatmosFrameLowering::emitEpilogue(MachineFunction &MF,
   MachineInstr *MI = emitSTC(MF, MBB, MBBI, Patmos::SFREEi);
   if (MI) MI->setFlag(MachineInstr::FrameSetup);
 
+  // interrupt handlers return to the interrupted code via SXB and SXO
+  if (isInterruptHandler(MF) && MBBI != MBB.end() &&
+      MBBI->getOpcode() == Patmos::RET) {
+    MachineInstrBuilder XRet = BuildMI(MBB, MBBI, dl, TII->get(Patmos::XRET));
+    for (unsigned i = 0, e = MBBI->getNumExplicitOperands(); i != e; ++i)
+      XRet.add(MBBI->getOperand(i));
+    MBB.erase(MBBI);
+    MBBI = XRet.getInstr();
+  }
+
   //----------------------------------------------------------------------------
   // Handle Shadow Stack
 
@@ -424,6 +838,16 @@ void PatmosFrameLowering::processFunctionBeforeCalleeSavedScan(
     }
   }
 
+  // The callees of interrupt handlers may spill the stack cache frame of the
+  // interrupted code, remember the spill pointer to ensure that frame again
+  // before returning. See restoreCalleeSavedRegisters.
+  if (isInterruptHandler(MF) && MFI.hasCalls() && !DisableStackCache) {
+    const TargetRegisterClass &RC = Patmos::RRegsRegClass;
+    int fi = MFI.CreateStackObject(TRI->getSpillSize(RC),
+                                   TRI->getSpillAlign(RC), false);
+    PMFI.setInterruptSSFI(fi);
+  }
+
   if (TRI->requiresRegisterScavenging(MF)) {
     const TargetRegisterClass &RC = Patmos::RRegsRegClass;
     int fi = MFI.CreateStackObject(TRI->getSpillSize(RC), TRI->getSpillAlign(RC), false);
@@ -432,6 +856,54 @@ void PatmosFrameLowering::processFunctionBeforeCalleeSavedScan(
   }
 }
 
+void PatmosFrameLowering::determineCalleeSaves(MachineFunction &MF,
+                                               BitVector &SavedRegs,
+                                               RegScavenger *RS) const {
+  TargetFrameLowering::determineCalleeSaves(MF, SavedRegs, RS);
+
+  if (MF.getFunction().hasFnAttribute(Attribute::Naked))
+    return;
+
+  if (isInterruptHandler(MF)) {
+    // Save every register modified by the handler. The register masks of the
+    // calls hold the registers clobbered by the callees, which are exact for
+    // callees compiled before under IPRA and the calling convention
+    // otherwise. The predicates are saved together with S0, which aliases
+    // them.
+    const MachineRegisterInfo &MRI = MF.getRegInfo();
+    const PatmosMachineFunctionInfo &PMFI =
+                                   *MF.getInfo<PatmosMachineFunctionInfo>();
+    for (const MCPhysReg *CSR = MRI.getCalleeSavedRegs(); *CSR; ++CSR) {
+      if (MRI.isPhysRegModified(*CSR))
+        SavedRegs.set(*CSR);
+    }
+    // RTR is used by the function splitter after the frame is set up
+    SavedRegs.set(Patmos::RTR);
+    // special registers are saved through R9
+    for (unsigned Reg : SavedRegs.set_bits()) {
+      if (Patmos::SRegsRegClass.contains(Reg)) {
+        SavedRegs.set(Patmos::R9);
+        break;
+      }
+    }
+    // temporaries to ensure the stack cache frame of the interrupted code
+    if (PMFI.getInterruptSSFI() != -1) {
+      SavedRegs.set(Patmos::R9);
+      SavedRegs.set(Patmos::R10);
+    }
+    return;
+  }
+
+  // The callers account for the clobbered registers of functions that do not
+  // save their callee saved registers under IPRA, but not for reserved
+  // registers, e.g., the return information or the frame pointer.
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  for (const MCPhysReg *CSR = MRI.getCalleeSavedRegs(); *CSR; ++CSR) {
+    if (MRI.isReserved(*CSR) && MRI.isPhysRegModified(*CSR))
+      SavedRegs.set(*CSR);
+  }
+}
+
 bool
 PatmosFrameLowering::spillCalleeSavedRegisters(MachineBasicBlock &MBB,
                                                MachineBasicBlock::iterator MI,
@@ -483,6 +955,15 @@ PatmosFrameLowering::spillCalleeSavedRegisters(MachineBasicBlock &MBB,
     spilledSize += 4;
   }
 
+  // remember the spill pointer of the interrupted code, R9 is saved already
+  if (PMFI.getInterruptSSFI() != -1) {
+    TII.copyPhysReg(MBB, MI, DL, Patmos::R9, Patmos::SS, false);
+    std::prev(MI)->setFlag(MachineInstr::FrameSetup);
+    TII.storeRegToStackSlot(MBB, MI, Patmos::R9, true,
+        PMFI.getInterruptSSFI(), &Patmos::RRegsRegClass, TRI);
+    std::prev(MI)->setFlag(MachineInstr::FrameSetup);
+  }
+
   return true;
 }
 
@@ -509,7 +990,30 @@ PatmosFrameLowering::restoreCalleeSavedRegisters(MachineBasicBlock &MBB,
       .addReg(Patmos::RFP);
   }
 
-  // restore the callee saved registers
+  // Ensure the stack cache frame of the interrupted code that was cached at
+  // the entry of the handler, i.e., the words between the stack top, which
+  // is unchanged, and the saved spill pointer. The callees of the handler
+  // may have spilled them. R9 and R10 are restored below.
+  if (PMFI.getInterruptSSFI() != -1) {
+    TII.loadRegFromStackSlot(MBB, MI, Patmos::R10, PMFI.getInterruptSSFI(),
+                             &Patmos::RRegsRegClass, TRI);
+    std::prev(MI)->setFlag(MachineInstr::FrameSetup);
+    TII.copyPhysReg(MBB, MI, DL, Patmos::R9, Patmos::ST, false);
+    std::prev(MI)->setFlag(MachineInstr::FrameSetup);
+    AddDefaultPred(BuildMI(MBB, MI, DL, TII.get(Patmos::SUBr), Patmos::R9))
+      .addReg(Patmos::R10).addReg(Patmos::R9)
+      .setMIFlag(MachineInstr::FrameSetup);
+    AddDefaultPred(BuildMI(MBB, MI, DL, TII.get(Patmos::SRi), Patmos::R9))
+      .addReg(Patmos::R9).addImm(2)
+      .setMIFlag(MachineInstr::FrameSetup);
+    AddDefaultPred(BuildMI(MBB, MI, DL, TII.get(Patmos::SENSr)))
+      .addReg(Patmos::R9)
+      .setMIFlag(MachineInstr::FrameSetup);
+  }
+
+  // restore the callee saved registers. R9 is the temporary for the special
+  // registers, it is restored last if it is saved, e.g., by interrupts.
+  int R9FI = -1;
   for (unsigned i = CSI.size(); i != 0; --i) {
     unsigned Reg = CSI[i-1].getReg();
     unsigned tmpReg = Reg;
@@ -518,6 +1022,11 @@ PatmosFrameLowering::restoreCalleeSavedRegisters(MachineBasicBlock &MBB,
     if (Patmos::PRegsRegClass.contains(Reg))
         continue;
 
+    if (Reg == Patmos::R9) {
+      R9FI = CSI[i-1].getFrameIdx();
+      continue;
+    }
+
     // Spill S0 to a register instead to a slot if there is a free register
     if (Reg == Patmos::S0 && PMFI.getS0SpillReg()) {
       TII.copyPhysReg(MBB, MI, DL, Reg, PMFI.getS0SpillReg(), true);
@@ -542,6 +1051,12 @@ PatmosFrameLowering::restoreCalleeSavedRegisters(MachineBasicBlock &MBB,
     }
   }
 
+  if (R9FI != -1) {
+    TII.loadRegFromStackSlot(MBB, MI, Patmos::R9, R9FI,
+                             &Patmos::RRegsRegClass, TRI);
+    std::prev(MI)->setFlag(MachineInstr::FrameSetup);
+  }
+
   return true;
 }
 
@@ -23,28 +23,31 @@ class PatmosFrameLowering : public TargetFrameLowering {
 protected:
   const PatmosSubtarget &STC;
 
-  /// getEffectiveStackCacheSize - Return the size of the stack cache that can
-  /// be used by the compiler.
-  /// \see EnableBlockAlignedStackCache
-  unsigned getEffectiveStackCacheSize() const;
-
-  /// getEffectiveStackCacheBlockSize - Return the size of the stack cache's 
-  /// blocks as seen from the instruction set architecture.
-  /// \see EnableBlockAlignedStackCache
-  unsigned getEffectiveStackCacheBlockSize() const;
-
-  /// getAlignedStackCacheFrameSize - Return the frame size aligned to the 
-  /// effective stack cache block size.
-  /// \see EnableBlockAlignedStackCache
-  /// \see getEffectiveStackCacheBlockSize
-  unsigned getAlignedStackCacheFrameSize(unsigned frameSize) const;
-
   /// assignFIsToStackCache - Assign some FIs to the stack cache.
-  /// Currently this is only done for spill slots.
+  /// This is done for spill slots, callee-saved registers, single-path
+  /// storage and local scalars whose address is never taken.
   /// @param SCFIs - should be set to true for all indices of frame objects
   ///                that should be assigned to the stack cache.
   void assignFIsToStackCache(MachineFunction &MF, BitVector &SCFIs) const;
 
+  /// packStackCacheObjects - Assign offsets to the FIs marked in SCFIs
+  /// according to the block frequencies in the PatmosAnalysisInfo, if known:
+  /// the objects whose accesses would cost the most cycles on the shadow
+  /// stack, see PatmosInstrInfo::getShadowStackAccessCost, are placed on the
+  /// stack cache, densely packed, the others are unmarked in SCFIs.
+  /// @return The size of the stack cache frame.
+  unsigned packStackCacheObjects(MachineFunction &MF, BitVector &SCFIs) const;
+
+  /// splitStackCacheFrame - Move the stack cache objects only accessed
+  /// within a single-entry single-exit region without calls out of the
+  /// frame reserved at the entry, if this makes the frame smaller at the
+  /// call sites. The objects are reserved on top of the frame by the entry of
+  /// the region and freed by its exit, see emitStackCacheRegion.
+  /// @param Size - the size of the packed stack cache objects.
+  /// @return The size of the stack cache objects reserved at the entry.
+  unsigned splitStackCacheFrame(MachineFunction &MF, const BitVector &SCFIs,
+                                unsigned Size) const;
+
   /// assignFrameObjects - Fix the layout of the stack frame, assign FIs to
   /// either stack cache or shadow stack, and update all stack offsets.
   /// Also reserves space for the call frame if no frame pointer is used.
@@ -66,11 +69,31 @@ protected:
   /// \see assignFIsToStackCache
   /// \see PatmosMachineFunctionInfo
   void patchCallSites(MachineFunction &MF) const;
+
+  /// emitStackCacheRegion - Emit the reserve and free of the stack cache
+  /// region chosen by splitStackCacheFrame, if any.
+  void emitStackCacheRegion(MachineFunction &MF) const;
 public:
   explicit PatmosFrameLowering(const PatmosSubtarget &sti, const DataLayout* DL)
         : TargetFrameLowering(StackGrowsDown, DL->getStackAlignment(), 0), STC(sti) {
     }
 
+  /// getEffectiveStackCacheSize - Return the size of the stack cache that can
+  /// be used by the compiler.
+  /// \see EnableBlockAlignedStackCache
+  unsigned getEffectiveStackCacheSize() const;
+
+  /// getEffectiveStackCacheBlockSize - Return the size of the stack cache's 
+  /// blocks as seen from the instruction set architecture.
+  /// \see EnableBlockAlignedStackCache
+  unsigned getEffectiveStackCacheBlockSize() const;
+
+  /// getAlignedStackCacheFrameSize - Return the frame size aligned to the 
+  /// effective stack cache block size.
+  /// \see EnableBlockAlignedStackCache
+  /// \see getEffectiveStackCacheBlockSize
+  unsigned getAlignedStackCacheFrameSize(unsigned frameSize) const;
+
   /// emitProlog/emitEpilog - These methods insert prolog and epilog code into
   /// the function.
   void emitPrologue(MachineFunction &MF,
@@ -80,11 +103,28 @@ public:
 
   bool hasFP(const MachineFunction &MF) const override;
 
+  /// isInterruptHandler - Return true if the function is an interrupt
+  /// handler, which returns with xret and saves every register it clobbers.
+  static bool isInterruptHandler(const MachineFunction &MF);
+
+  /// enableShrinkWrapping - Allow the prologue and epilogue, including the
+  /// reservation of the stack cache frame, to be placed around the blocks
+  /// that need the frame, instead of the entry and the returns.
+  bool enableShrinkWrapping(const MachineFunction &MF) const override;
+
   /// processFunctionBeforeCalleeSavedScan - This method is called immediately
   /// before PrologEpilogInserter scans the physical registers used to determine
   /// what callee saved registers should be spilled. This method is optional.
   virtual void processFunctionBeforeCalleeSavedScan(MachineFunction &MF,
                                                  RegScavenger *RS = NULL) const;
+  /// determineCalleeSaves - Determine the callee saved registers to spill.
+  /// Reserved registers are always saved if they are modified, even if
+  /// interprocedural register allocation lets the callers handle the other
+  /// callee saved registers. Interrupt handlers save all registers clobbered
+  /// by themselves or their callees.
+  void determineCalleeSaves(MachineFunction &MF, BitVector &SavedRegs,
+                            RegScavenger *RS = nullptr) const override;
+
   bool spillCalleeSavedRegisters(MachineBasicBlock &MBB,
                                  MachineBasicBlock::iterator MI,
                                  ArrayRef<CalleeSavedInfo> CSI,
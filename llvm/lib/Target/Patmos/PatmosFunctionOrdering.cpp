@@ -0,0 +1,259 @@
+//===-- PatmosFunctionOrdering.cpp - Order functions by call affinity. ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Compute an order of the functions of a module that places callers next to
+// their hot callees, such that they are less likely to evict each other from
+// the method cache.
+//
+// The order is computed on the machine-level call graph, following the
+// greedy chain merging of Pettis and Hansen: every function starts in a chain
+// of its own, and the chains of the two ends of the heaviest remaining call
+// graph edge are merged, oriented such that the two functions end up as close
+// as possible. The weight of an edge is the sum of the frequencies of its call
+// sites relative to the caller's entry, if block frequencies are known, or the
+// number of call sites, counting call sites within loops or recursion with
+// LoopWeight.
+//
+// The order is written to a file, one symbol per line, in the format of lld's
+// --symbol-ordering-file. The linker can only reorder sections, so this
+// requires -ffunction-sections. The subfunctions formed by the function
+// splitter stay within the section of their function.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosCallGraphBuilder.h"
+#include "PatmosMachineFunctionInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-function-ordering"
+
+STATISTIC(OrderedFunctions, "Number of functions written to the ordering");
+STATISTIC(MergedChains,     "Number of function chains merged by affinity");
+
+static cl::opt<unsigned> LoopWeight(
+  "mpatmos-function-order-loop-weight",
+  cl::init(8),
+  cl::desc("Weight of a call site within a loop or recursion, if no block "
+           "frequencies are known (default: 8)."),
+  cl::Hidden);
+
+namespace {
+  class PatmosFunctionOrdering : public MachineModulePass {
+  private:
+    /// A call graph edge between two functions, with its accumulated weight.
+    struct affinity {
+      MCGNode *A, *B;
+      double Weight;
+    };
+
+    /// Order the edges by decreasing weight, ties are broken by the order of
+    /// the nodes in the call graph to stay deterministic.
+    struct SortAffinity {
+      const DenseMap<MCGNode*, unsigned> &Index;
+
+      SortAffinity(const DenseMap<MCGNode*, unsigned> &index) : Index(index) {}
+
+      bool operator()(const affinity &lhs, const affinity &rhs) const {
+        if (lhs.Weight != rhs.Weight)
+          return lhs.Weight > rhs.Weight;
+        if (lhs.A != rhs.A)
+          return Index.lookup(lhs.A) < Index.lookup(rhs.A);
+        return Index.lookup(lhs.B) < Index.lookup(rhs.B);
+      }
+    };
+
+    /// A chain of functions, placed next to each other.
+    typedef std::vector<MCGNode*> chain;
+
+    /// The file to write the ordering to.
+    std::string OrderFile;
+
+    /// getSiteWeight - Return the relative execution frequency of a call site
+    /// with respect to the entry of its caller.
+    double getSiteWeight(const MCGSite *S) const
+    {
+      MachineInstr *MI = S->getMI();
+      MachineFunction *MF = MI->getMF();
+      PatmosAnalysisInfo &PAI =
+                  MF->getInfo<PatmosMachineFunctionInfo>()->getAnalysisInfo();
+
+      int64_t entry = PAI.getFrequency(&MF->front());
+      int64_t freq = PAI.getFrequency(MI->getParent());
+      if (entry > 0 && freq >= 0)
+        return (double)freq / (double)entry;
+
+      return S->isInSCC() ? LoopWeight : 1.0;
+    }
+
+    /// getPosition - Return the position of the node in the chain.
+    static unsigned getPosition(const chain &C, MCGNode *N)
+    {
+      return std::find(C.begin(), C.end(), N) - C.begin();
+    }
+
+    /// mergeChains - Append the chains of the two nodes of an edge, such that
+    /// the distance between the nodes is minimal. The chain of B is cleared.
+    static void mergeChains(chain &CA, MCGNode *A, chain &CB, MCGNode *B)
+    {
+      unsigned posA = getPosition(CA, A);
+      unsigned posB = getPosition(CB, B);
+
+      // distance between A and B if CB follows CA, or if CA follows CB
+      unsigned AB = (CA.size() - posA) + posB;
+      unsigned BA = (CB.size() - posB) + posA;
+
+      if (AB <= BA) {
+        CA.insert(CA.end(), CB.begin(), CB.end());
+      }
+      else {
+        CA.insert(CA.begin(), CB.begin(), CB.end());
+      }
+      CB.clear();
+    }
+
+  public:
+    /// Pass ID
+    static char ID;
+
+    PatmosFunctionOrdering(const std::string &orderFile) :
+        MachineModulePass(ID), OrderFile(orderFile)
+    {
+    }
+
+    /// getAnalysisUsage - Inform the pass manager that nothing is modified.
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+      AU.setPreservesAll();
+      AU.addRequired<PatmosCallGraphBuilder>();
+
+      ModulePass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineModule(const Module &M) override
+    {
+      PatmosCallGraphBuilder &PCGB(getAnalysis<PatmosCallGraphBuilder>());
+      const MCallGraph &G(*PCGB.getCallGraph());
+
+      // number the known functions and put each into its own chain
+      const MCGNodes &nodes(G.getNodes());
+      DenseMap<MCGNode*, unsigned> index;
+      std::vector<chain> chains;
+      for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
+          i++) {
+        if ((*i)->isUnknown())
+          continue;
+
+        index[*i] = chains.size();
+        chains.push_back(chain(1, *i));
+      }
+
+      // accumulate the weights of the call sites between two functions,
+      // regardless of the direction of the call
+      std::map<std::pair<unsigned, unsigned>, double> weights;
+      const MCGSites &sites(G.getSites());
+      for(MCGSites::const_iterator i(sites.begin()), ie(sites.end()); i != ie;
+          i++) {
+        MCGNode *caller = (*i)->getCaller();
+        MCGNode *callee = (*i)->getCallee();
+        if (caller == callee || callee->isUnknown() || caller->isUnknown())
+          continue;
+
+        unsigned a = index[caller], b = index[callee];
+        weights[std::make_pair(std::min(a, b), std::max(a, b))] +=
+                                                           getSiteWeight(*i);
+      }
+
+      std::vector<affinity> edges;
+      edges.reserve(weights.size());
+      for(std::map<std::pair<unsigned, unsigned>, double>::iterator
+          i(weights.begin()), ie(weights.end()); i != ie; i++) {
+        affinity e;
+        e.A = chains[i->first.first].front();
+        e.B = chains[i->first.second].front();
+        e.Weight = i->second;
+        edges.push_back(e);
+      }
+      std::sort(edges.begin(), edges.end(), SortAffinity(index));
+
+      // merge the chains along the heaviest edges first. chainOf maps a node
+      // index to the index of the chain holding the node.
+      std::vector<unsigned> chainOf(chains.size());
+      for(unsigned i = 0; i < chainOf.size(); i++)
+        chainOf[i] = i;
+
+      for(std::vector<affinity>::iterator i(edges.begin()), ie(edges.end());
+          i != ie; i++) {
+        unsigned ca = chainOf[index[i->A]], cb = chainOf[index[i->B]];
+        if (ca == cb)
+          continue;
+
+        // merge the smaller chain into the larger one
+        MCGNode *A = i->A, *B = i->B;
+        if (chains[ca].size() < chains[cb].size()) {
+          std::swap(ca, cb);
+          std::swap(A, B);
+        }
+
+        for(chain::iterator j(chains[cb].begin()), je(chains[cb].end());
+            j != je; j++) {
+          chainOf[index[*j]] = ca;
+        }
+        mergeChains(chains[ca], A, chains[cb], B);
+        MergedChains++;
+
+        LLVM_DEBUG(dbgs() << "Merge " << A->getLabel() << " and "
+                          << B->getLabel() << " (" << i->Weight << ")\n");
+      }
+
+      std::error_code err;
+      raw_fd_ostream OS(OrderFile, err, sys::fs::OF_Text);
+      if (err) {
+        errs() << "Error: Failed to open function ordering file '"
+               << OrderFile << "': " << err.message() << "\n";
+        return false;
+      }
+
+      // emit the chains in the order of the functions in the call graph. Dead
+      // functions are kept, the module might not contain the program's entry.
+      for(std::vector<chain>::iterator i(chains.begin()), ie(chains.end());
+          i != ie; i++) {
+        for(chain::iterator j(i->begin()), je(i->end()); j != je; j++) {
+          OS << (*j)->getMF()->getName() << "\n";
+          OrderedFunctions++;
+        }
+      }
+
+      return false;
+    }
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override {
+      return "Patmos Function Ordering";
+    }
+  };
+
+  char PatmosFunctionOrdering::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosFunctionOrderingPass - Returns a new PatmosFunctionOrdering
+/// writing the ordering to OrderFile.
+ModulePass *
+llvm::createPatmosFunctionOrderingPass(const std::string &OrderFile) {
+  return new PatmosFunctionOrdering(OrderFile);
+}
@@ -43,9 +43,51 @@
 //       method cache, add the entire loop to the region. Otherwise, start a new
 //       region at all successors of the header.
 //
+// With -mpatmos-function-splitter-frequencies, the block frequencies guide
+// the region formation: ready blocks are visited hottest first, so that hot
+// paths fill up a region before cold code does, and loops at least as hot as
+// the region they are added to may grow the region up to the maximum
+// subfunction size, rather than paying a BRCF transfer on every iteration.
+//
+// The splitter also lays out the blocks of each region. A fall-through that
+// is not laid out after its block costs a branch and its delay slots, visiting
+// the hottest blocks first only pays off if the region runs out of space. The
+// fall-through is thus taken next if it is about as hot as the hottest ready
+// block, or if the region still has room for both of them
+// (-mpatmos-function-splitter-keep-fallthroughs).
+//
+// With -mpatmos-function-splitter-wcet, worst-case execution counts derived
+// from the loop bounds take the place of the block frequencies. Bounded loops
+// containing calls are then kept within a single region, in spite of
+// -mpatmos-split-call-blocks, if the loop and the entry regions of its callees
+// fit into the method cache together.
+//
+// With -mpatmos-function-splitter-cold, cold code gets regions of its own:
+// blocks that only lead to code that does not return, e.g., to calls of
+// abort or other noreturn functions, to unreachable code, to returns after
+// calls of cold functions or, with a profile, to returns never executed. A
+// cold block is never added to a hot region and vice versa, i.e., the error
+// paths are reached by BRCF and do not use up the size of the hot regions.
+// Blocks of loops and jump table targets are never cold.
+//
+// The region sizes are counted in method cache blocks: a region occupies
+// whole blocks and the cache holds at most one region per block, i.e., the
+// preferred sizes are rounded up to whole blocks, and the callees kept with
+// a loop must fit into the remaining blocks. With LRU replacement
+// (-mpatmos-method-cache-replacement), blocks with calls to small leaf
+// functions are not split from their region in spite of
+// -mpatmos-split-call-blocks, as the region stays cached during the call.
+//
 // Jump tables require some special handling, since either all targets of the
 // table either have to be region entries or have to be in the same region as 
 // all indirect branches using that table.
+//
+// With -mpatmos-function-splitter-relative-jumptables, jump tables that are
+// dispatched by the usual SHADD2l/LWC sequence are exempt from this. The
+// branch is rewritten to load the base of the target's region from a second
+// table and to branch with brcf base, target - base, such that each target
+// can be placed in any region, becoming a region entry only if it ends up in
+// another region than the branch.
 // 
 //===----------------------------------------------------------------------===//
 
@@ -67,20 +109,26 @@
 #include "PatmosMachineFunctionInfo.h"
 #include "PatmosSubtarget.h"
 #include "PatmosTargetMachine.h"
+#include "TargetInfo/PatmosTargetInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/ADT/GraphTraits.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/MachinePostDominators.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineJumpTableInfo.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/MC/MCInst.h"
 #include "llvm/MC/MCInstrDesc.h"
 #include "llvm/MC/MCSectionELF.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -88,7 +136,9 @@
 #include "llvm/Support/GraphWriter.h"
 #include "llvm/Support/DOTGraphTraits.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/Timer.h"
+#include "llvm/Support/YAMLParser.h"
 #include "llvm/Target/TargetLoweringObjectFile.h"
 
 #include <map>
@@ -124,17 +174,82 @@ static cl::opt<int> PreferSCCSize(
     cl::desc("Preferred maximum size for SCC subfunctions, defaults to "
              "mpatmos-preferred-subfunction-size if 0. (default: 0)"));
 
-static cl::opt<int> MaxSubfunctionSize(
-    "mpatmos-max-subfunction-size",
-    cl::init(1024),
-    cl::desc("Maximum size of subfunctions after function splitting, defaults "
-             "to the method cache size if set to 0. (default: 1024)"));
-
 static cl::opt<bool> SplitCallBlocks(
     "mpatmos-split-call-blocks",
     cl::init(true),
     cl::desc("Split basic blocks containing calls into own subfunctions."));
 
+/// SplitBlocksToPreferredSize - Option to split basic blocks that do not fit
+/// into the preferred subfunction size.
+static cl::opt<bool> SplitBlocksToPreferredSize(
+    "mpatmos-split-blocks-to-preferred-size",
+    cl::init(false),
+    cl::desc("Split basic blocks larger than mpatmos-preferred-subfunction-size "
+             "instead of only those larger than mpatmos-max-subfunction-size, "
+             "e.g., for unrolled code with a small method cache. "
+             "(default: false)"));
+
+/// RelativeJumpTables - Option to dispatch jump tables relative to the base
+/// of the target's region.
+static cl::opt<bool> RelativeJumpTables(
+    "mpatmos-function-splitter-relative-jumptables",
+    cl::init(false),
+    cl::desc("Dispatch jump tables through a second table holding the base of "
+             "each target's region, so that the targets are not required to "
+             "be all region entries or all in the region of the branch. "
+             "(default: false)"));
+
+/// UseBlockFrequencies - Option to form regions by block frequencies.
+static cl::opt<bool> UseBlockFrequencies(
+    "mpatmos-function-splitter-frequencies",
+    cl::init(false),
+    cl::desc("Grow regions along the hottest blocks and keep hot loops within "
+             "a single region up to mpatmos-max-subfunction-size, using the "
+             "machine block frequencies. (default: only for functions with "
+             "profile data)"));
+
+/// useBlockFrequencies - Return true if the regions of MF are formed by block
+/// frequencies, by default if they are measured by a profile.
+static bool useBlockFrequencies(const MachineFunction &MF) {
+  if (UseBlockFrequencies.getNumOccurrences())
+    return UseBlockFrequencies;
+  return MF.getFunction().hasProfileData();
+}
+
+/// KeepFallthroughs - Option to lay out fall-throughs after their blocks as
+/// long as the region has room for the hotter blocks too.
+static cl::opt<bool> KeepFallthroughs(
+    "mpatmos-function-splitter-keep-fallthroughs",
+    cl::init(true),
+    cl::desc("Lay out a fall-through after its block, rather than a hotter "
+             "block, if the region has room for both. (default: true)"),
+    cl::Hidden);
+
+/// WCETSplitting - Option to form regions by worst-case execution counts.
+static cl::opt<bool> WCETSplitting(
+    "mpatmos-function-splitter-wcet",
+    cl::init(false),
+    cl::desc("Form regions by the worst-case execution counts given by the "
+             "loop bounds, keeping bounded loops together with the entry "
+             "regions of their callees if they fit into the method cache. "
+             "(default: false)"));
+
+static cl::opt<unsigned> WCETDefaultBound(
+    "mpatmos-function-splitter-wcet-default-bound",
+    cl::init(100),
+    cl::desc("Iteration count assumed for loops without bounds by "
+             "mpatmos-function-splitter-wcet. (default: 100)"),
+    cl::Hidden);
+
+/// SplitColdBlocks - Option to split cold blocks into regions of their own.
+static cl::opt<bool> SplitColdBlocks(
+    "mpatmos-function-splitter-cold",
+    cl::init(false),
+    cl::desc("Split blocks only leading to noreturn calls, unreachable code "
+             "or, with profile data, to unexecuted returns into regions of "
+             "their own, outside the size of the hot regions. "
+             "(default: false)"));
+
 /// EnableShowCFGs - Option to enable the rendering of annotated CFGs.
 static cl::opt<bool> EnableShowCFGs(
   "mpatmos-function-splitter-cfgs",
@@ -142,6 +257,16 @@ static cl::opt<bool> EnableShowCFGs(
   cl::desc("Show CFGs after the Patmos function splitter."),
   cl::Hidden);
 
+/// SplitterThreads - Option to specify the number of threads analysing the SCCs
+/// of a function concurrently.
+static cl::opt<unsigned> SplitterThreads(
+    "mpatmos-function-splitter-threads",
+    cl::init(1),
+    cl::desc("Number of threads collecting the entries and sizes of "
+             "independent SCCs concurrently (0 = number of hardware threads). "
+             "(default: 1)"),
+    cl::Hidden);
+
 static cl::opt<std::string> StatsFile(
     "mpatmos-function-splitter-stats",
     cl::desc("Write splitting statistics to the given file"),
@@ -152,6 +277,12 @@ static cl::opt<bool> AppendStatsFile(
     cl::desc("Append to splitting statistics file instead of recreating it"),
     cl::Hidden);
 
+static cl::opt<std::string> ReportFile(
+    "mpatmos-function-splitter-report",
+    cl::desc("Write a YAML report of the regions of all split functions and "
+             "the code added by splitting to the given file"),
+    cl::Hidden);
+
 namespace llvm {
 
   #define DEBUG_TYPE "patmos-function-splitter"
@@ -169,11 +300,23 @@ namespace llvm {
   STATISTIC(NOPsInserted, "NOPs inserted by function splitter");
   STATISTIC(PostDomsFound, "Post dominators checked");
   STATISTIC(PostDomsAdded, "Post dominators added by increasing region size");
+  STATISTIC(RelativeDispatches, "Jump tables dispatched relative to the "
+                                "region bases of their targets");
+  STATISTIC(SplitLargeBlocks, "Basic blocks split off large basic blocks");
+  STATISTIC(HotSCCsKept, "Hot SCCs checked against the maximum region size");
+  STATISTIC(LRUCallsKept, "Calls kept within their region by LRU "
+                          "replacement");
+  STATISTIC(FallthroughsKept, "Fall-throughs laid out before hotter blocks "
+                              "fitting into the region");
+  STATISTIC(ColdBlocks, "Blocks found to be cold");
+  STATISTIC(ColdBlocksSplit, "Cold blocks split off hot regions");
 
   class ablock;
   class agraph;
 
   typedef std::vector<ablock*> ablocks;
+  /// execution counts or frequencies of the basic blocks
+  typedef std::map<const MachineBasicBlock*, double> ablock_weights;
   /// must be a list, not a vector, to keep iterator valid
   typedef std::list<unsigned> idlist;
   typedef std::set<unsigned> idset;
@@ -204,6 +347,12 @@ namespace llvm {
     /// contains a call.
     bool HasCallinSCC;
 
+    /// The known functions called by the block.
+    std::set<const Function*> Callees;
+
+    /// Flag indicating whether the block contains calls to unknown functions.
+    bool HasUnknownCallee;
+
     /// Indices of the jump table that this node references.
     idset JTIDs;
 
@@ -221,6 +370,17 @@ namespace llvm {
     /// For loop headers: blocks in the SCC of the loop header
     ablocks SCC;
 
+    /// The execution frequency or worst-case count of the block, relative to
+    /// the hottest block of the function, or 1.0 if neither is used.
+    double Frequency;
+
+    /// The absolute execution frequency or worst-case count of the block.
+    double Count;
+
+    /// Flag indicating whether the block only leads to cold code.
+    /// \see computeColdBlocks
+    bool IsCold;
+
     /// The region assigned to a basic block. This is computed late by 
     /// computeRegions. This can either be NULL if not yet assigned,
     /// the region of the predecessor if the block is found the first time,
@@ -241,9 +401,10 @@ namespace llvm {
     ablock(PatmosTargetMachine &PTM, unsigned id, agraph* g,
            MachineBasicBlock *mbb = NULL)
     : ID(id), G(g), MBB(mbb), FallthroughTarget(0),
-      HasCall(false), HasCallinSCC(false),
+      HasCall(false), HasCallinSCC(false), HasUnknownCallee(false),
       NumBranches(0), Size(0),
-      SCCSize(0), Region(NULL), NumPreds(0)
+      SCCSize(0), Frequency(1.0), Count(1.0), IsCold(false), Region(NULL),
+      NumPreds(0)
     {
       const PatmosInstrInfo *PII = PTM.getInstrInfo();
 
@@ -260,6 +421,13 @@ namespace llvm {
           if (PII->hasCall(mi))
             HasCall = true;
 
+          if (mi->isCall() || mi->isInlineAsm()) {
+            SmallSet<const Function*,2> callees;
+            if (!PII->getCallees(*mi, callees) && mi->isCall())
+              HasUnknownCallee = true;
+            Callees.insert(callees.begin(), callees.end());
+          }
+
           if (mi->isBranch())
             NumBranches++;
         }
@@ -347,12 +515,15 @@ namespace llvm {
     bool operator()(const ready_block &lhs, const ready_block &rhs) const {
       // On the ready list, we sort by highest criticality first, then
       // lowest ID first
-      if (lhs.criticality > rhs.criticality) return true;
+      if (lhs.criticality != rhs.criticality)
+        return lhs.criticality > rhs.criticality;
       return lhs.block->ID < rhs.block->ID;
     }
-  } SortCritCmp;
+  };
 
-  typedef std::vector<ready_block> ready_set;
+  /// The ready list, ordered by SortCrit. The criticality of a block does not
+  /// change while it is ready, so a given block can be looked up directly.
+  typedef std::set<ready_block, SortCrit> ready_set;
 
   /// agraph - a transformed copy of the CFG.
   class agraph
@@ -384,26 +555,64 @@ namespace llvm {
 
     MachinePostDominatorTree &MPDT;
 
+    /// Block frequencies or worst-case execution counts, or NULL if regions
+    /// are not formed by either.
+    const ablock_weights *Weights;
+
+    /// Remarks on the branches rewritten to cache-fill branches.
+    MachineOptimizationRemarkEmitter &ORE;
+
+    /// The blocks of the basic blocks of the function.
+    std::map<const MachineBasicBlock*, ablock*> MBBtoA;
+
+    /// Flags indicating which jump tables are dispatched relative to the base
+    /// of their targets' regions, indexed by the jump table index.
+    /// \see matchRelativeDispatch
+    std::vector<bool> RelativeJTs;
+
+    /// The tables of region bases created for relative jump tables, by the
+    /// index of the jump table.
+    std::map<unsigned, unsigned> BaseTables;
+
+    /// Membership marks of blocks, indexed by block ID. A block is a member of
+    /// the set marked last if its mark equals MarkStamp.
+    /// \see markBlocks
+    std::vector<unsigned> Marks;
+    unsigned MarkStamp;
+
+    /// Arenas of the graph's blocks and edges, which are freed all at once
+    /// with the graph.
+    SpecificBumpPtrAllocator<ablock> BlockAllocator;
+    SpecificBumpPtrAllocator<aedge> EdgeAllocator;
+
+    /// makeEdge - Allocate a new edge of the graph.
+    aedge *makeEdge(ablock *src, ablock *dst)
+    {
+      return new (EdgeAllocator.Allocate()) aedge(src, dst);
+    }
+
     /// Construct a graph from a machine function.
     agraph(MachineFunction *mf, PatmosTargetMachine &tm,
            MachinePostDominatorTree &mpdt, unsigned int preferredRegionSize,
-           unsigned int preferredSCCSize, unsigned int maxRegionSize)
+           unsigned int preferredSCCSize, unsigned int maxRegionSize,
+           const ablock_weights *weights,
+           MachineOptimizationRemarkEmitter &ore)
     : MF(mf), PTM(tm), STC(*tm.getSubtargetImpl()),
       PII(*tm.getInstrInfo()),
       PreferredRegionSize(preferredRegionSize),
       PreferredSCCSize(preferredSCCSize), MaxRegionSize(maxRegionSize),
-      MPDT(mpdt)
+      MPDT(mpdt), Weights(weights), ORE(ore), MarkStamp(0)
     {
       Blocks.reserve(mf->size());
 
       // create blocks
       unsigned id = 0;
-      std::map<const MachineBasicBlock*, ablock*> MBBtoA;
       ablock *pred = 0;
       for(MachineFunction::iterator i(mf->begin()), ie(mf->end());
           i != ie; i++) {
         // make a block
-        ablock *ab = new ablock(PTM, id++, this, &*i);
+        ablock *ab = new (BlockAllocator.Allocate()) ablock(PTM, id++, this,
+                                                            &*i);
 
         // Keep track of fallthough edges
         if (pred && mayFallThrough(PTM, pred->MBB)) {
@@ -416,6 +625,9 @@ namespace llvm {
         Blocks.push_back(ab);
       }
 
+      if (Weights)
+        computeFrequencies();
+
       // create edges
       for(MachineFunction::const_iterator i(mf->begin()), ie(mf->end());
           i != ie; i++) {
@@ -429,7 +641,7 @@ namespace llvm {
           ablock *d = MBBtoA[*j];
 
           // make and store the edge
-          aedge *e = new aedge(s, d);
+          aedge *e = makeEdge(s, d);
           Edges.insert(std::make_pair(s, e));
         }
       }
@@ -445,6 +657,8 @@ namespace llvm {
         std::vector<bool> visited;
         visited.resize(JTs.size());
 
+        findRelativeJumpTables();
+
         // Build up jumptable infos
         for (size_t idx = 0; idx < JTs.size(); idx++) {
 
@@ -519,6 +733,17 @@ namespace llvm {
             }
           }
 
+          // Relative jump tables allow each target to be placed in any region,
+          // keep the edges to the targets.
+          bool relative = true;
+          for (idlist::iterator jit = jtids.begin(); jit != jtids.end(); jit++)
+            relative &= RelativeJTs[*jit];
+          if (relative) {
+            LLVM_DEBUG(dbgs() << "Relative jump-table dispatch for "
+                              << jtids.size() << " jump-tables\n");
+            continue;
+          }
+
           // Redirect all edges to the jump-table entries to a new header
           aedge_vector ingoing;
           findIngoingEdges(entries, ingoing);
@@ -542,6 +767,203 @@ namespace llvm {
       return PTM.getInstrInfo()->mayFallthrough(*MBB);
     }
 
+    /// Size of the code added by rewriteRelativeDispatch in front of a
+    /// jump-table branch: a SHADD2l with a long immediate, a LWC, a NOP for
+    /// the load and a SUB.
+    static const unsigned RelativeDispatchSize = 20;
+
+    /// matchRelativeDispatch - Check whether a jump-table branch can be
+    /// dispatched relative to the base of its target's region, i.e., whether
+    /// the address of the jump-table entry is computed by a SHADD2l from the
+    /// table index and loaded by a LWC in the same block (as for BR_JT) and
+    /// RTR is available as temporary from the SHADD2l to the end of the
+    /// branch's delay slots. The loaded target address must not be used
+    /// after the branch.
+    /// @return The SHADD2l computing the address, or NULL.
+    MachineInstr *matchRelativeDispatch(MachineInstr *BR) const
+    {
+      MachineBasicBlock *MBB = BR->getParent();
+      Register target = BR->getOperand(2).getReg();
+      unsigned index = BR->getOperand(3).getIndex();
+
+      // the target address is dead after the branch, the dispatch overwrites
+      // it with the offset
+      for(MachineBasicBlock::succ_iterator i(MBB->succ_begin()),
+          ie(MBB->succ_end()); i != ie; i++) {
+        if ((*i)->isLiveIn(target))
+          return NULL;
+      }
+      for(MachineBasicBlock::instr_iterator i(std::next(BR->getIterator())),
+          ie(MBB->instr_end()); i != ie; i++) {
+        if (i->readsRegister(target) || i->readsRegister(Patmos::RTR) ||
+            i->modifiesRegister(Patmos::RTR))
+          return NULL;
+      }
+
+      // find the load of the jump-table entry and the address computation
+      MachineInstr *load = NULL;
+      for(MachineBasicBlock::instr_iterator i(BR->getIterator());
+          i != MBB->instr_begin();) {
+        MachineInstr *MI = &*--i;
+        if (MI->isBundle())
+          continue;
+
+        if (MI->readsRegister(Patmos::RTR) || MI->modifiesRegister(Patmos::RTR))
+          return NULL;
+
+        if (!load) {
+          if (!MI->modifiesRegister(target))
+            continue;
+
+          if (MI->getOpcode() != Patmos::LWC || PII.isPredicated(*MI) ||
+              !MI->getOperand(3).isReg() || !MI->getOperand(4).isImm() ||
+              MI->getOperand(4).getImm() != 0)
+            return NULL;
+          load = MI;
+        }
+        else if (MI->modifiesRegister(load->getOperand(3).getReg())) {
+          if (MI->getOpcode() != Patmos::SHADD2l || PII.isPredicated(*MI) ||
+              !MI->getOperand(4).isJTI() ||
+              MI->getOperand(4).getIndex() != (int)index)
+            return NULL;
+
+          // the new address computation is placed before the bundle of the
+          // SHADD2l, which thus must not access RTR either
+          MachineBasicBlock::instr_iterator j(MI->getIterator());
+          while (j->isBundledWithPred()) j--;
+          for(; j != MI->getIterator(); j++) {
+            if (j->readsRegister(Patmos::RTR) ||
+                j->modifiesRegister(Patmos::RTR))
+              return NULL;
+          }
+          return MI;
+        }
+      }
+
+      return NULL;
+    }
+
+    /// findRelativeJumpTables - Find the jump tables that can be dispatched
+    /// relative to the base of the target's region, and account for the
+    /// code added to the jump-table branches.
+    /// \see RelativeJTs
+    void findRelativeJumpTables()
+    {
+      const std::vector<MachineJumpTableEntry> &JTs =
+                                       MF->getJumpTableInfo()->getJumpTables();
+      std::vector<unsigned> uses(JTs.size(), 0);
+      RelativeJTs.assign(JTs.size(), RelativeJumpTables);
+
+      if (!RelativeJumpTables)
+        return;
+
+      for(MachineFunction::iterator i(MF->begin()), ie(MF->end()); i != ie;
+          i++) {
+        for(MachineBasicBlock::instr_iterator j(i->instr_begin()),
+            je(i->instr_end()); j != je; j++) {
+          if (j->getOpcode() != Patmos::BRT && j->getOpcode() != Patmos::BRTu)
+            continue;
+
+          unsigned index = j->getOperand(3).getIndex();
+          uses[index]++;
+          if (!matchRelativeDispatch(&*j))
+            RelativeJTs[index] = false;
+        }
+      }
+
+      for(unsigned i = 0; i < JTs.size(); i++) {
+        if (!uses[i])
+          RelativeJTs[i] = false;
+      }
+
+      // reserve space for the dispatch code
+      for(MachineFunction::iterator i(MF->begin()), ie(MF->end()); i != ie;
+          i++) {
+        for(MachineBasicBlock::instr_iterator j(i->instr_begin()),
+            je(i->instr_end()); j != je; j++) {
+          if ((j->getOpcode() == Patmos::BRT ||
+               j->getOpcode() == Patmos::BRTu) &&
+              RelativeJTs[j->getOperand(3).getIndex()]) {
+            MBBtoA[&*i]->Size += RelativeDispatchSize;
+          }
+        }
+      }
+    }
+
+    /// getBaseTable - Get a jump table holding the region entry of each target
+    /// of the given jump table.
+    unsigned getBaseTable(unsigned index)
+    {
+      std::map<unsigned, unsigned>::iterator it = BaseTables.find(index);
+      if (it != BaseTables.end())
+        return it->second;
+
+      MachineJumpTableInfo *MJTI = MF->getJumpTableInfo();
+      std::vector<MachineBasicBlock*> bases;
+      const std::vector<MachineBasicBlock*> &JTBBs(
+                                             MJTI->getJumpTables()[index].MBBs);
+      for(std::vector<MachineBasicBlock*>::const_iterator i(JTBBs.begin()),
+          ie(JTBBs.end()); i != ie; i++) {
+        bases.push_back(MBBtoA[*i]->Region->MBB);
+      }
+
+      unsigned base = MJTI->createJumpTableIndex(bases);
+      BaseTables[index] = base;
+      RelativeDispatches++;
+      return base;
+    }
+
+    /// rewriteRelativeDispatch - Rewrite a jump-table branch to branch to the
+    /// offset of the target relative to the base of the target's region:
+    ///   RTR = SHADD2l index, base-table    (before the address computation)
+    ///   ...
+    ///   RTR = LWC RTR, 0
+    ///   NOP
+    ///   target = SUB target, RTR
+    ///   brcf RTR, target
+    /// The new instructions are inserted before II, the bundle of BR.
+    /// @return The opcode of the rewritten branch, changing its delay slots.
+    unsigned rewriteRelativeDispatch(MachineInstr *BR,
+                                     MachineBasicBlock::instr_iterator II)
+    {
+      MachineBasicBlock &MBB = *BR->getParent();
+      MachineInstr *shadd = matchRelativeDispatch(BR);
+      assert(shadd && "Jump-table dispatch changed after region formation");
+
+      Register target = BR->getOperand(2).getReg();
+      MachineOperand JT = BR->getOperand(3);
+      unsigned base = getBaseTable(JT.getIndex());
+
+      MachineBasicBlock::instr_iterator SI(shadd);
+      while (SI->isBundledWithPred()) SI--;
+      AddDefaultPred(BuildMI(MBB, SI, DebugLoc(), PII.get(Patmos::SHADD2l),
+                             Patmos::RTR))
+        .addReg(shadd->getOperand(3).getReg())
+        .addJumpTableIndex(base);
+
+      AddDefaultPred(BuildMI(MBB, II, DebugLoc(), PII.get(Patmos::LWC),
+                             Patmos::RTR))
+        .addReg(Patmos::RTR).addImm(0);
+      AddDefaultPred(BuildMI(MBB, II, DebugLoc(), PII.get(Patmos::NOP)));
+      AddDefaultPred(BuildMI(MBB, II, DebugLoc(), PII.get(Patmos::SUBr),
+                             target))
+        .addReg(target).addReg(Patmos::RTR);
+
+      // branch to base + offset
+      unsigned opcode = BR->getOpcode() == Patmos::BRT ? Patmos::BRCFTO
+                                                       : Patmos::BRCFTOu;
+      BR->RemoveOperand(3);
+      BR->RemoveOperand(2);
+      BR->setDesc(PII.get(opcode));
+      BR->addOperand(*MF, MachineOperand::CreateReg(Patmos::RTR, false, false,
+                                                    true));
+      BR->addOperand(*MF, MachineOperand::CreateReg(target, false, false,
+                                                    true));
+      BR->addOperand(*MF, JT);
+
+      return opcode;
+    }
+
     static unsigned int getInstrSize(MachineInstr *MI, PatmosTargetMachine &PTM)
     {
       return PTM.getInstrInfo()->getInstrSize(MI);
@@ -587,14 +1009,120 @@ namespace llvm {
       }
     }
 
+    /// computeFrequencies - Assign the relative execution frequency of each
+    /// block, scaled to the hottest block of the function.
+    /// \see Weights
+    void computeFrequencies()
+    {
+      double maxFreq = 0.0;
+      ablock *pred = NULL;
+      for(ablocks::iterator i(Blocks.begin()), ie(Blocks.end()); i != ie; i++) {
+        (*i)->Frequency = getWeight((*i)->MBB);
+
+        // blocks split off large blocks are not known to the frequency info,
+        // they execute as often as the block they were split from.
+        if ((*i)->Frequency == 0.0 && pred && pred->FallthroughTarget == *i)
+          (*i)->Frequency = pred->Frequency;
+
+        maxFreq = std::max(maxFreq, (*i)->Frequency);
+        pred = *i;
+      }
+
+      for(ablocks::iterator i(Blocks.begin()), ie(Blocks.end()); i != ie; i++) {
+        (*i)->Count = (*i)->Frequency;
+        (*i)->Frequency = maxFreq > 0.0 ? (*i)->Frequency / maxFreq : 1.0;
+      }
+    }
+
+    /// getWeight - Return the absolute frequency or execution count of a basic
+    /// block, or 0 if unknown.
+    double getWeight(const MachineBasicBlock *MBB) const
+    {
+      ablock_weights::const_iterator w(Weights->find(MBB));
+      return w != Weights->end() ? w->second : 0.0;
+    }
+
+    /// fitsWithCallees - Check if a region of the given size and the entry
+    /// regions of all functions called within the blocks fit into the method
+    /// cache together. Every region occupies whole cache blocks, many small
+    /// regions thus fill the cache before their bytes do. With leavesOnly,
+    /// the callees must be compiled functions without calls that fit into a
+    /// single region, i.e., they do not load any other region.
+    bool fitsWithCallees(unsigned size, const ablocks &scc,
+                         bool leavesOnly) const
+    {
+      std::set<const Function*> callees;
+      bool unknown = false;
+      for(ablocks::const_iterator i(scc.begin()), ie(scc.end()); i != ie; i++) {
+        callees.insert((*i)->Callees.begin(), (*i)->Callees.end());
+        unknown |= (*i)->HasUnknownCallee;
+      }
+      if (unknown && leavesOnly)
+        return false;
+
+      MachineModuleInfo &MMI = MF->getMMI();
+      unsigned blocks = STC.getMethodCacheBlocks(size);
+      if (unknown)
+        blocks += STC.getMethodCacheBlocks(PreferredRegionSize);
+      for(std::set<const Function*>::iterator i(callees.begin()),
+          ie(callees.end()); i != ie; i++) {
+        // the callee's entry region is at most as large as the function, if
+        // the function has been compiled already.
+        unsigned entry_size = PreferredRegionSize;
+        if (MachineFunction *CMF = MMI.getMachineFunction(**i)) {
+          unsigned fun_size = 0;
+          for(MachineFunction::iterator j(CMF->begin()), je(CMF->end());
+              j != je; j++) {
+            fun_size += getBBSize(&*j, PTM);
+          }
+          if (leavesOnly && (CMF->getFrameInfo().hasCalls() ||
+                             fun_size > PreferredRegionSize))
+            return false;
+          entry_size = std::min(entry_size, fun_size);
+        }
+        else if (leavesOnly)
+          return false;
+        blocks += STC.getMethodCacheBlocks(entry_size);
+      }
+      return blocks <= STC.getMethodCacheEntries();
+    }
+
+    /// markBlocks - Mark the given blocks as the current member set, replacing
+    /// any previously marked set.
+    void markBlocks(const ablocks &blocks)
+    {
+      Marks.resize(Blocks.size(), 0);
+      MarkStamp++;
+      for(ablocks::const_iterator i(blocks.begin()), ie(blocks.end()); i != ie;
+          i++) {
+        Marks[(*i)->ID] = MarkStamp;
+      }
+    }
+
+    /// isMarked - Return true if the block is in the set marked last.
+    bool isMarked(const ablock *block) const
+    {
+      return block->ID < Marks.size() && Marks[block->ID] == MarkStamp;
+    }
+
     /// createHeader - Create a new artificial header, and redirect edges
     /// to the new header.
     ablock *createHeader(ablock_set &headers, aedge_vector &entering)
     {
       // create header
-      ablock *header = new ablock(PTM, Blocks.size(), this);
+      ablock *header = new (BlockAllocator.Allocate())
+                                             ablock(PTM, Blocks.size(), this);
       Blocks.push_back(header);
 
+      // the header is entered as often as the hottest of its targets
+      if (Weights) {
+        header->Frequency = 0.0;
+        for(ablock_set::iterator j(headers.begin()), je(headers.end());
+            j != je; j++) {
+          header->Frequency = std::max(header->Frequency, (*j)->Frequency);
+        }
+      }
+
       // redirect edges leading to the headers
       for(aedge_vector::iterator j(entering.begin()), je(entering.end());
           j != je; j++) {
@@ -604,7 +1132,7 @@ namespace llvm {
       // make edges from the new header to the old ones
       for(ablock_set::iterator j(headers.begin()), je(headers.end());
           j != je; j++) {
-        aedge *e = new aedge(header, *j);
+        aedge *e = makeEdge(header, *j);
         Edges.insert(std::make_pair(header, e));
       }
 
@@ -622,7 +1150,7 @@ namespace llvm {
           j != je; j++)
       {
         if (last) {
-          aedge *e = new aedge(last, *j);
+          aedge *e = makeEdge(last, *j);
           Edges.insert(std::make_pair(last, e));
         }
         last = *j;
@@ -630,7 +1158,7 @@ namespace llvm {
 
       // connect the last block to the header
       if (last) {
-        aedge *e = new aedge(last, header);
+        aedge *e = makeEdge(last, header);
         Edges.insert(std::make_pair(last, e));
       }
     }
@@ -641,9 +1169,10 @@ namespace llvm {
     {
       int DFS_index;
       int Low_link;
+      bool On_stack;
 
       /// Default initialization of node infos.
-      tarjan_node_info() : DFS_index(-1), Low_link(-1)
+      tarjan_node_info() : DFS_index(-1), Low_link(-1), On_stack(false)
       {
       }
     };
@@ -676,6 +1205,7 @@ namespace llvm {
 
       // push the node on the stack
       nodes.push_back(node);
+      node_infos[node_id].On_stack = true;
 
       // visit successor nodes and check whether the current node is the root of
       // an SCC
@@ -695,7 +1225,7 @@ namespace llvm {
           node_infos[node_id].Low_link = std::min(node_infos[node_id].Low_link,
                                                   node_infos[dst_id].Low_link);
         }
-        else if (std::find(nodes.begin(), nodes.end(), dst) != nodes.end())
+        else if (node_infos[dst_id].On_stack)
         {
           // i is on the stack --> update low link
           node_infos[node_id].Low_link = std::min(node_infos[node_id].Low_link,
@@ -717,6 +1247,7 @@ namespace llvm {
           scc_result.back().push_back(top);
 
           nodes.pop_back();
+          node_infos[top->ID].On_stack = false;
         } while (top != node);
       }
     }
@@ -744,6 +1275,85 @@ namespace llvm {
       return scc_result;
     }
 
+    /// Hold the entries and the combined size of an SCC, which are collected
+    /// independently of the other SCCs of the graph.
+    struct scc_info
+    {
+      /// The SCC is a single block without self-edge, i.e., not a cycle.
+      bool Trivial;
+
+      /// The blocks of the SCC entered from outside of the SCC.
+      ablock_set Headers;
+
+      /// The edges entering the SCC from outside.
+      aedge_vector Entering;
+
+      /// The combined size of the blocks, for SCCs of more than one block.
+      unsigned int Size;
+
+      /// A block of the SCC contains a call.
+      bool HasCall;
+
+      scc_info() : Trivial(true), Size(0), HasCall(false)
+      {
+      }
+    };
+
+    /// analyzeSCC - Collect the entries and the size of an SCC. This only
+    /// reads the graph, the SCCs of a graph can thus be analysed concurrently.
+    /// @param scc_of The index of the SCC of each block, by block ID.
+    /// @param ingoing The edges leading to each block, by block ID.
+    void analyzeSCC(const ablocks &scc, unsigned index,
+                    const std::vector<unsigned> &scc_of,
+                    const std::vector<aedge_vector> &ingoing,
+                    scc_info &info) const
+    {
+      // skip trivial SCCs
+      if (scc.size() == 1) {
+        // check for self-edges
+        ablock *tmp = *scc.begin();
+        bool has_selfedge = false;
+        for(aedges::const_iterator j(Edges.lower_bound(tmp)),
+            je(Edges.upper_bound(tmp)); j != je && !has_selfedge; j++) {
+          has_selfedge |= (j->second->Src == tmp) &&
+                          (j->second->Dst == tmp);
+        }
+
+        if (!has_selfedge)
+          return;
+      }
+      else if (scc.empty()) {
+        return;
+      }
+      info.Trivial = false;
+
+      for(ablocks::const_iterator k(scc.begin()), ke(scc.end()); k != ke;
+          k++) {
+        const aedge_vector &in = ingoing[(*k)->ID];
+        for(aedge_vector::const_iterator j(in.begin()), je(in.end()); j != je;
+            j++) {
+          if (scc_of[(*j)->Src->ID] != index) {
+            info.Headers.insert((*j)->Dst);
+            info.Entering.push_back(*j);
+          }
+        }
+      }
+
+      // compute the combined size of the SCC.
+      if (scc.size() > 1) {
+        for(ablocks::const_iterator i(scc.begin()), ie(scc.end()); i != ie;
+            i++) {
+          assert(!(*i)->isArtificialHeader() ||
+                 (*i)->isArtificialJumptableHeader());
+          // could be an artificial jumptable header
+          if (!(*i)->isArtificialHeader()) {
+            info.Size += (*i)->Size + getMaxBlockMargin(PTM, (*i)->MBB);
+            info.HasCall |= (*i)->HasCall;
+          }
+        }
+      }
+    }
+
     /// transformSCCs - Transform the graph by removing all cycles, while
     /// preserving dominance.
     /// All SCCs with *more* than one headers are transformed as follows:
@@ -755,7 +1365,12 @@ namespace llvm {
     ///
     /// This is inspired by Ramalingam.
     /// \see G. Ramalingam, On Loops, Dominators, and Dominance Frontiers
-    void transformSCCs()
+    ///
+    /// The entries and sizes of the SCCs found in a round are collected
+    /// first, concurrently on the given pool if there is one. The SCCs are
+    /// then transformed one after the other in the order found by
+    /// scc_tarjan, the result does not depend on the number of threads.
+    void transformSCCs(ThreadPool *Pool)
     {
       // collect all headers
       ablock_set all_headers;
@@ -771,44 +1386,53 @@ namespace llvm {
         // compute SCCs
         scc_vector sccs(scc_tarjan());
 
-        for(scc_vector::iterator i(sccs.begin()), ie(sccs.end()); i != ie;
-            i++) {
-          ablocks &scc = *i;
-
-          // skip trivial SCCs
-          if (scc.size() == 1) {
-            // check for self-edges
-            ablock *tmp = *scc.begin();
-            bool has_selfedge = false;
-            for(aedges::iterator j(Edges.lower_bound(tmp)),
-                je(Edges.upper_bound(tmp)); j != je && !has_selfedge; j++) {
-              has_selfedge |= (j->second->Src == tmp) &&
-                              (j->second->Dst == tmp);
-            }
+        // index the edges by their destination. The SCCs are disjoint and
+        // createHeader only redirects edges to new blocks, so the index stays
+        // valid for all SCCs not processed yet.
+        std::vector<aedge_vector> ingoing(Blocks.size());
+        for(aedges::iterator j(Edges.begin()), je(Edges.end()); j != je;
+            j++) {
+          ingoing[j->second->Dst->ID].push_back(j->second);
+        }
 
-            if (!has_selfedge)
-              continue;
+        // the SCC of each block, to tell the edges entering an SCC
+        std::vector<unsigned> scc_of(Blocks.size());
+        for(unsigned i = 0, ie = sccs.size(); i != ie; i++) {
+          for(ablocks::iterator k(sccs[i].begin()), ke(sccs[i].end());
+              k != ke; k++) {
+            scc_of[(*k)->ID] = i;
           }
-          else if (scc.empty()) {
-            continue;
+        }
+
+        // collect the entries and sizes of all SCCs before transforming any
+        // of them. Single blocks are cheap to check, only larger SCCs are
+        // worth a task of their own.
+        std::vector<scc_info> infos(sccs.size());
+        for(unsigned i = 0, ie = sccs.size(); i != ie; i++) {
+          if (Pool && sccs[i].size() > 1) {
+            Pool->async([this, &sccs, &scc_of, &ingoing, &infos, i]() {
+              analyzeSCC(sccs[i], i, scc_of, ingoing, infos[i]);
+            });
           }
+          else {
+            analyzeSCC(sccs[i], i, scc_of, ingoing, infos[i]);
+          }
+        }
+        if (Pool)
+          Pool->wait();
+
+        for(unsigned i = 0, ie = sccs.size(); i != ie; i++) {
+          ablocks &scc = sccs[i];
+          scc_info &info = infos[i];
+          if (info.Trivial)
+            continue;
 
 #ifdef PATMOS_DUMP_ALL_SCC_DOTS
           write(cnt++);
 #endif
 
-          ablock_set headers;
-          aedge_vector entering;
-          for(aedges::iterator j(Edges.begin()), je(Edges.end()); j != je;
-              j++) {
-            ablock *src = j->second->Src;
-            ablock *dst = j->second->Dst;
-            if (std::find(scc.begin(), scc.end(), src) == scc.end() &&
-                std::find(scc.begin(), scc.end(), dst) != scc.end()) {
-              headers.insert(dst);
-              entering.push_back(j->second);
-            }
-          }
+          ablock_set &headers = info.Headers;
+          aedge_vector &entering = info.Entering;
 
           // check for dead code, this is not supported here.
           if (headers.empty()) {
@@ -842,36 +1466,24 @@ namespace llvm {
           // remove all back-edges to any header.
           // the headers are thus no longer part of any SCC, since they only
           // have incoming edges from blocks not in SCCs.
-          for(aedges::iterator j(Edges.begin()), je(Edges.end()); j != je;) {
-            ablock *src = j->second->Src;
-            ablock *dst = j->second->Dst;
-            if (std::find(scc.begin(), scc.end(), src) != scc.end() &&
-                std::find(headers.begin(), headers.end(),
-                          dst) != headers.end())
-            {
-              BackEdges.insert(std::make_pair(j->first, j->second));
-              Edges.erase(j);
-              j = Edges.begin();
-              changed = true;
-            }
-            else {
-              j++;
+          for(ablocks::iterator k(scc.begin()), ke(scc.end()); k != ke; k++) {
+            for(aedges::iterator j(Edges.lower_bound(*k)),
+                je(Edges.upper_bound(*k)); j != je;) {
+              if (headers.count(j->second->Dst)) {
+                BackEdges.insert(std::make_pair(j->first, j->second));
+                Edges.erase(j++);
+                changed = true;
+              }
+              else {
+                j++;
+              }
             }
           }
 
-          // compute the combined size of the SCC.
+          // the combined size of the SCC.
           if (scc.size() > 1) {
-            unsigned int scc_size = 0;
-            bool has_call_in_scc = false;
-            for(ablocks::iterator i(scc.begin()), ie(scc.end()); i != ie; i++) {
-              assert(!(*i)->isArtificialHeader() ||
-                     (*i)->isArtificialJumptableHeader());
-              // could be an artificial jumptable header
-              if (!(*i)->isArtificialHeader()) {
-                scc_size += (*i)->Size + getMaxBlockMargin(PTM, (*i)->MBB);
-                has_call_in_scc |= (*i)->HasCall;
-              }
-            }
+            unsigned int scc_size = info.Size;
+            bool has_call_in_scc = info.HasCall;
 
 #ifdef PATMOS_TRACE_SCCS
 #ifndef PATMOS_DUMP_ALL_SCC_DOTS
@@ -910,6 +1522,74 @@ namespace llvm {
       }
     }
 
+    /// isColdExit - Return true if a block without successors is cold, i.e.,
+    /// if it does not return, or returns after a call to a cold function or,
+    /// with a profile, is never executed.
+    bool isColdExit(const ablock *block) const
+    {
+      const MachineBasicBlock *MBB = block->MBB;
+      if (std::none_of(MBB->instr_begin(), MBB->instr_end(),
+                       [](const MachineInstr &MI) { return MI.isReturn(); }))
+        return true;
+
+      for(std::set<const Function*>::const_iterator
+          i(block->Callees.begin()), ie(block->Callees.end()); i != ie; i++) {
+        if ((*i)->hasFnAttribute(Attribute::Cold) || (*i)->doesNotReturn())
+          return true;
+      }
+
+      return Weights && MF->getFunction().hasProfileData() &&
+             block->Count == 0.0;
+    }
+
+    /// computeColdBlocks - Mark the blocks all paths of which end in a cold
+    /// exit. A cold block never joins a hot path again, it may thus start a
+    /// region without a transfer on the hot paths. Blocks in SCCs, jump table
+    /// targets and the entry block are never cold.
+    /// \see isColdExit
+    void computeColdBlocks()
+    {
+      std::vector<bool> candidate(Blocks.size(), true);
+      candidate[Blocks.front()->ID] = false;
+      for(ablocks::iterator i(Blocks.begin()), ie(Blocks.end()); i != ie; i++) {
+        ablock *block = *i;
+        if (block->isArtificialHeader() || block->hasAddressTaken() ||
+            !block->JTIDs.empty())
+          candidate[block->ID] = false;
+        for(ablocks::iterator j(block->SCC.begin()), je(block->SCC.end());
+            j != je; j++) {
+          candidate[(*j)->ID] = false;
+        }
+      }
+
+      // the CFG of the blocks, without SCCs, is acyclic, propagate until
+      // nothing changes
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        for(ablocks::reverse_iterator i(Blocks.rbegin()), ie(Blocks.rend());
+            i != ie; i++) {
+          ablock *block = *i;
+          if (block->IsCold || !candidate[block->ID])
+            continue;
+
+          const MachineBasicBlock *MBB = block->MBB;
+          bool cold = MBB->succ_empty() ? isColdExit(block) : true;
+          for(MachineBasicBlock::const_succ_iterator j(MBB->succ_begin()),
+              je(MBB->succ_end()); j != je && cold; j++) {
+            cold = MBBtoA[*j]->IsCold;
+          }
+
+          if (cold) {
+            block->IsCold = true;
+            changed = true;
+            ColdBlocks++;
+            LLVM_DEBUG(dbgs() << "Cold block: " << block->getName() << "\n");
+          }
+        }
+      }
+    }
+
     /// countPredecessors - compute the number of predecessors for each block.
     void countPredecessors()
     {
@@ -919,60 +1599,56 @@ namespace llvm {
       }
     }
 
-    void makeReady(ready_set &ready, ablock *block) {
+    /// getReadyBlock - Return the ready list entry of a block.
+    static ready_block getReadyBlock(ablock *block) {
       ready_block rb;
       rb.block = block;
 
+      // visit hot blocks first, if the frequencies are known
+      rb.criticality = block->Frequency;
 
-      rb.criticality = 1.0;
+      return rb;
+    }
 
+    void makeReady(ready_set &ready, ablock *block) {
       // add the block to the sorted ready list
-      ready.push_back(rb);
-      std::sort(ready.begin(), ready.end(), SortCritCmp);
+      ready.insert(getReadyBlock(block));
     }
 
     bool isReady(ready_set &ready, ablock *block) {
-      for(ready_set::iterator i(ready.begin()), ie(ready.end()); i != ie; i++) {
-        if (i->block == block) return true;
-      }
-      return false;
+      return ready.count(getReadyBlock(block));
     }
 
     /// selectRegion - Chose a region to process next. the order does not really
     /// matter here -- so just make it independent of pointer values.
     ablock *selectRegion(ablock_set &regions)
     {
-      ablock *minID = NULL;
-      for(ablock_set::iterator i(regions.begin()), ie(regions.end()); i != ie;
-          i++) {
-
-        // take the block with the smallest ID first (determinism)
-        if (!minID || minID->ID > (*i)->ID)
-          minID = *i;
-      }
+      // take the block with the smallest ID first (determinism), the regions
+      // are ordered by ID.
+      return regions.empty() ? NULL : *regions.begin();
+    }
 
-      return minID;
+    /// getVisitSize - Return the size a ready block adds to a region if it is
+    /// visited, including its SCC.
+    unsigned getVisitSize(const ablock *block) const
+    {
+      if (block->SCCSize > 0)
+        return block->SCCSize;
+      return block->MBB ? block->Size + getMaxBlockMargin(PTM, block->MBB) : 0;
     }
 
     /// selectBlock - select the next block to be visited.
     /// if the current block is a fall-through, prefer that fall-through, 
     /// otherwise take the block with the smallest ID (deterministic).
-    ready_set::iterator selectBlock(ablock *region, ready_set &ready, ablock *last)
+    ready_set::iterator selectBlock(ablock *region, unsigned region_size,
+                                    ready_set &ready, ablock *last)
     {
-      // check if the fall-through is ready
-      MachineBasicBlock *fallthrough = last && last->FallthroughTarget ?
-                                       last->FallthroughTarget->MBB : NULL;
-
       double maxCrit = ready.begin()->criticality;
 
+      // check if the fall-through is ready
       ready_set::iterator fttarget = ready.end();
-      for(ready_set::iterator i(ready.begin()), ie(ready.end()); i != ie; i++) {
-
-        // check for fall-through
-        if (i->block->MBB == fallthrough) {
-          fttarget = i;
-          break;
-        }
+      if (last && last->FallthroughTarget) {
+        fttarget = ready.find(getReadyBlock(last->FallthroughTarget));
       }
 
       // Prefer the fallthrough block if it is sufficiently critical
@@ -980,6 +1656,16 @@ namespace llvm {
         return fttarget;
       }
 
+      // Otherwise, prefer it as long as the hottest block still fits into the
+      // region after it, it then saves a branch at no cost.
+      if (KeepFallthroughs && fttarget != ready.end() &&
+          last->Region == region &&
+          region_size + getVisitSize(fttarget->block) +
+            getVisitSize(ready.begin()->block) <= PreferredRegionSize) {
+        FallthroughsKept++;
+        return fttarget;
+      }
+
       // Otherwise just use the (deterministic) ordering of the ready list
       return ready.begin();
     }
@@ -1029,6 +1715,8 @@ namespace llvm {
     void emitSCC(ablock *region, ablocks &scc, ready_set &ready,
                  ablock_set &regions, ablocks &order)
     {
+      markBlocks(scc);
+
       // emit blocks and update ready list
       for(ablocks::iterator i(scc.begin()), ie(scc.end()); i != ie; i++) {
         assert((*i)->Region == region || (*i)->Region == NULL);
@@ -1057,7 +1745,7 @@ namespace llvm {
             continue;
           }
           // skip blocks in this SCC
-          if (std::find(scc.begin(), scc.end(), dst) != scc.end()) {
+          if (isMarked(dst)) {
             continue;
           }
 
@@ -1125,6 +1813,14 @@ namespace llvm {
         return true;
       }
 
+      // Cold code gets regions of its own, it is neither loaded with the hot
+      // code nor does it count against the size of the hot regions.
+      if (header->IsCold != region->IsCold) {
+        if (header->IsCold)
+          ColdBlocksSplit++;
+        return false;
+      }
+
       // If a block has its address taken (e.g. is part of a  computed goto),
       // it needs to start a new region.
       for(ablocks::iterator i(scc.begin()), ie(scc.end()); i != ie; i++) {
@@ -1145,6 +1841,39 @@ namespace llvm {
         PostDomsFound++;
       }
 
+      // Keep loops that are at least as hot as the region within the region
+      // as long as they fit into the cache, a split loop would transfer
+      // between regions on each iteration.
+      bool keepCalls = false;
+      if (Weights && header->SCCSize > 0 &&
+          header->Frequency >= region->Frequency)
+      {
+        maxSize = MaxRegionSize;
+        HotSCCsKept++;
+
+        // Calls within the loop do not evict it from the method cache if the
+        // loop and the entry regions of its callees fit into the cache.
+        if (WCETSplitting && has_call &&
+            (region == header || !region->HasCall) &&
+            fitsWithCallees(region_size + scc_size, scc, false))
+        {
+          keepCalls = true;
+        }
+      }
+
+      // With LRU replacement, the region is the most recently used one when
+      // a call leaves it. It is still cached when the call returns if the
+      // callees do not load other regions and fit into the cache together
+      // with it. With FIFO replacement, the region might be the oldest one
+      // and be replaced by the callee in any case.
+      if (!keepCalls && has_call && (region == header || !region->HasCall) &&
+          STC.getMethodCacheReplacement() == PatmosSubtarget::MCR_LRU &&
+          fitsWithCallees(region_size + scc_size, scc, true))
+      {
+        keepCalls = true;
+        LRUCallsKept++;
+      }
+
       // Check for size only after we checked for headers to allow large
       // basic blocks.
       if (region_size + scc_size > maxSize) {
@@ -1154,7 +1883,7 @@ namespace llvm {
       // Split blocks with calls into their own region.
       // If the block has a call, make it a region header. If the current
       // region contains a call, start a new region with this block.
-      if (SplitCallBlocks && (region->HasCall || has_call)) {
+      if (SplitCallBlocks && (region->HasCall || has_call) && !keepCalls) {
         return false;
       }
 
@@ -1192,7 +1921,8 @@ namespace llvm {
       // TODO maybe move the code to decide whether to emit a block or its
       // whole SCC into increaseRegion?
       if (region == block &&
-          block->MBB && block->SCCSize > 0 && !block->HasCallinSCC &&
+          block->MBB && block->SCCSize > 0 &&
+          (!block->HasCallinSCC || WCETSplitting) &&
           !hasRegionHeaders(region, block->SCC) &&
           increaseRegion(region, block, block->SCC, block->SCCSize,
                          block->HasCallinSCC,
@@ -1347,7 +2077,7 @@ namespace llvm {
 
         while(!ready.empty()) {
           // choose the next block to visit
-          ready_set::iterator it = selectBlock(region, ready,
+          ready_set::iterator it = selectBlock(region, region_size, ready,
                                            order.empty() ? NULL : order.back());
           const ready_block next = *it;
           ready.erase(it);
@@ -1546,6 +2276,13 @@ namespace llvm {
         // move to the beginning of the BR bundle
         while (II->isBundledWithPred()) II--;
 
+        // dispatch relative to the region base of the target
+        if ((BR->getOpcode() == Patmos::BRT ||
+             BR->getOpcode() == Patmos::BRTu) &&
+            RelativeJTs[BR->getOperand(3).getIndex()]) {
+          opcode = rewriteRelativeDispatch(BR, II);
+        }
+
         if (PTM.getCodeModel() == CodeModel::Large) {
           // Load target into register when rewriting to BRCF with immediate
           if (opcode == Patmos::BRCF || opcode == Patmos::BRCFu) {
@@ -1586,6 +2323,17 @@ namespace llvm {
         }
 
         BranchRewrites++;
+
+        ORE.emit([&]() {
+          return MachineOptimizationRemarkAnalysis(DEBUG_TYPE, "CacheFillBranch",
+                                                   BR->getDebugLoc(), &MBB)
+                 << "branch from block #" << ore::NV("Block", MBB.getNumber())
+                 << " to #" << ore::NV("Target", target->getNumber())
+                 << " enters another method cache region, rewritten to "
+                 << PII.getName(opcode) << " with "
+                 << ore::NV("NOPs", std::max(cycles, 0))
+                 << " NOPs in its delay slots";
+        });
       }
     }
 
@@ -1642,6 +2390,8 @@ namespace llvm {
             case Patmos::BRCFRu:
             case Patmos::BRCFT:
             case Patmos::BRCFTu:
+            case Patmos::BRCFTO:
+            case Patmos::BRCFTOu:
               break;
 
             // unexpected ?
@@ -1735,6 +2485,18 @@ namespace llvm {
 
             break;
           }
+          // Handle jump-table branches relative to the region base
+          case Patmos::BRCFTO:
+          case Patmos::BRCFTOu:
+          {
+            assert(mi->getNumOperands() == 5);
+
+            unsigned index = mi->getOperand(4).getIndex();
+            MachineJumpTableInfo *MJTI = MF->getJumpTableInfo();
+            MJTI->ReplaceMBBInJumpTable(index, OldSucc, NewSucc);
+
+            break;
+          }
           // handle indirect branches
           case Patmos::BRR:
           case Patmos::BRRu:
@@ -1887,11 +2649,18 @@ namespace llvm {
 
     /// splitBlock - Split a basic block into smaller blocks that each fit into
     /// the method cache.
+    /// Blocks are split once they would exceed MaxSize, or, at an instruction
+    /// that is neither in a delay slot nor within a live range of RTR, once
+    /// they would exceed TargetSize. This way, the pieces of a block are of
+    /// about equal size, rather than leaving a small remainder.
     static unsigned int splitBlock(MachineBasicBlock *MBB, unsigned int MaxSize,
+                                   unsigned int TargetSize,
                                    PatmosTargetMachine &PTM,
                                    MachineDominatorTree &MDT,
                                    MachinePostDominatorTree &MPDT)
     {
+      const PatmosInstrInfo *PII = PTM.getInstrInfo();
+
       unsigned int branchFixup = getMaxBlockMargin(PTM, MBB->getAlignment(), true, false, 1);
 
       // make a new block
@@ -1900,6 +2669,12 @@ namespace llvm {
       unsigned int cache_size = PTM.getSubtargetImpl()->getMethodCacheSize();
 
       unsigned int total_size = 0;
+
+      // remaining delay slot cycles of the last control-flow instruction, and
+      // whether the RTR register is live in between two instructions.
+      int delay_cycles = 0;
+      bool rtr_live = false;
+
       // Note: we need to use an instr_iterator here, otherwise splice fails
       // horribly for some mysterious ilist bug.
       for(MachineBasicBlock::instr_iterator i(MBB->instr_begin()),
@@ -1954,13 +2729,22 @@ namespace llvm {
         assert(!isPatmosCFL(FirstMI->getOpcode(), FirstMI->getDesc().TSFlags)
                || (delay_slot_margin > 0));
 #endif
+        // split early at safe points to get pieces of the target size
+        bool is_safe = delay_cycles <= 0 && !rtr_live;
+        bool exceeds_target = is_safe &&
+                    curr_size > getMaxBlockMargin(PTM, MBB->getAlignment()) &&
+                    curr_size + i_size + delay_slot_margin > TargetSize;
+
         // check block + instruction size + max delay slot size of this instr.
-        if (curr_size + i_size + tmp_live_margin + delay_slot_margin < MaxSize)
+        if (curr_size + i_size + tmp_live_margin + delay_slot_margin < MaxSize &&
+            !exceeds_target)
         {
           curr_size += i_size;
         }
         else
         {
+          SplitLargeBlocks++;
+
           total_size += curr_size;
 
           LLVM_DEBUG(dbgs() << "Splitting basic block at " << total_size << ": "
@@ -2009,6 +2793,17 @@ namespace llvm {
           curr_size = getMaxBlockMargin(PTM, MBB->getAlignment()) + i_size;
           i = MBB->instr_begin();
         }
+
+        // keep track of delay slots and live ranges of RTR
+        if (!PII->isPseudo(&*i) && delay_cycles > 0)
+          delay_cycles--;
+        if (i->hasDelaySlot())
+          delay_cycles = PTM.getSubtargetImpl()->getDelaySlotCycles(*i);
+        if (i->killsRegister(Patmos::RTR))
+          rtr_live = false;
+        if (PTM.getCodeModel() == CodeModel::Large &&
+            i->definesRegister(Patmos::RTR) && !i->isBranch())
+          rtr_live = true;
       }
 
       return total_size + curr_size;
@@ -2030,22 +2825,6 @@ namespace llvm {
       f.close();
     }
 
-    /// Free memory.
-    ~agraph()
-    {
-      for(aedges::iterator i(Edges.begin()), ie(Edges.end()); i != ie; i++) {
-        delete i->second;
-      }
-
-      for(aedges::iterator i(BackEdges.begin()), ie(BackEdges.end()); i != ie;
-          i++) {
-        delete i->second;
-      }
-
-      for(ablocks::iterator i(Blocks.begin()), ie(Blocks.end()); i != ie; i++) {
-        delete *i;
-      }
-    }
   };
 
   /// Pass to split functions into smaller regions that fit into the size limits
@@ -2059,6 +2838,41 @@ namespace llvm {
     PatmosTargetMachine &PTM;
     const PatmosSubtarget &STC;
 
+    /// Code size of all split functions in the module, before and after
+    /// splitting, for the report.
+    /// \see writeReport
+    uint64_t ReportedOrigSize;
+    uint64_t ReportedSize;
+
+    /// Threads to analyse the SCCs of a function concurrently, or NULL.
+    std::unique_ptr<ThreadPool> Pool;
+
+    /// computeFrequencies - Get the frequencies of all blocks of MF.
+    void computeFrequencies(MachineFunction &MF, ablock_weights &Weights)
+    {
+      MachineBlockFrequencyInfo &MBFI =
+                                     getAnalysis<MachineBlockFrequencyInfo>();
+      for(MachineFunction::iterator i(MF.begin()), ie(MF.end()); i != ie; i++) {
+        Weights[&*i] = MBFI.getBlockFreq(&*i).getFrequency();
+      }
+    }
+
+    /// computeWorstCaseCounts - Get the worst-case number of executions of
+    /// all blocks of MF per function call, i.e., the product of the maximum
+    /// iteration counts of the enclosing loops.
+    void computeWorstCaseCounts(MachineFunction &MF, ablock_weights &Weights)
+    {
+      MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+      for(MachineFunction::iterator i(MF.begin()), ie(MF.end()); i != ie; i++) {
+        double count = 1.0;
+        for(MachineLoop *L = MLI.getLoopFor(&*i); L; L = L->getParentLoop()) {
+          int max = getLoopBounds(L->getHeader()).second;
+          count *= (max < 0 ? (double)WCETDefaultBound : (double)max) + 1.0;
+        }
+        Weights[&*i] = count;
+      }
+    }
+
     void writeStats(StringRef Filename, MachineFunction &MF,
                     agraph &G, ablocks &order,
                     unsigned orig_size, const TimeRecord &Time)
@@ -2083,6 +2897,11 @@ namespace llvm {
       int EstRegionSize = 0;
       ablock *Header = *order.begin();
 
+      std::map<const MachineBasicBlock*, ablock*> MBBtoA;
+      for(ablocks::iterator i(order.begin()), ie(order.end()); i != ie; i++) {
+        MBBtoA[(*i)->MBB] = *i;
+      }
+
       ablocks::iterator i(order.begin()), ie(order.end());
 
       while (i != ie) {
@@ -2115,6 +2934,22 @@ namespace llvm {
           f << Header->isSCCHeader() << ", " << Header->SCCSize << ", "
             << Header->HasCallinSCC;
 
+          if (WCETSplitting) {
+            // worst-case number of transfers into the region per call of
+            // the function, assuming each transfer misses in the method cache
+            double Entries = Header->MBB == &MF.front() ? 1.0 : 0.0;
+            for(MachineBasicBlock::pred_iterator p(Header->MBB->pred_begin()),
+                pe(Header->MBB->pred_end()); p != pe; p++) {
+              ablock *Pred = MBBtoA[*p];
+              if (Pred && Pred->Region != Header)
+                Entries += Pred->Count;
+            }
+
+            // , <WC entries>, <WC bytes reloaded>
+            f << ", " << format("%.0f", Entries) << ", "
+              << format("%.0f", Entries * RegionSize);
+          }
+
           f << "\n";
 
           // reset stats
@@ -2129,11 +2964,104 @@ namespace llvm {
       f.close();
     }
 
+    /// writeReport - Append a YAML document describing the regions of MF to
+    /// the report, after the regions have been applied. For each region, the
+    /// report lists its blocks and entries, its size, the number of CFG edges
+    /// entering and leaving the region, i.e., the BRCFs or fall-through
+    /// fixups, the bytes added by rewriting those edges, and the jump tables
+    /// with targets in the region. All sizes are in bytes.
+    void writeReport(StringRef Filename, MachineFunction &MF, ablocks &order,
+                     unsigned orig_size)
+    {
+      std::error_code err;
+      raw_fd_ostream f(Filename, err, sys::fs::OF_Append);
+      if (err) {
+        errs() << "Error: Failed to open function splitter report '"
+               << Filename << "': " << err.message() << "\n";
+        return;
+      }
+
+      std::map<const MachineBasicBlock*, ablock*> MBBtoA;
+      for(ablocks::iterator i(order.begin()), ie(order.end()); i != ie; i++) {
+        MBBtoA[(*i)->MBB] = *i;
+      }
+
+      unsigned size = 0;
+      for(MachineFunction::iterator i(MF.begin()), ie(MF.end()); i != ie; i++) {
+        size += agraph::getBBSize(&*i, PTM);
+      }
+      ReportedOrigSize += orig_size;
+      ReportedSize += size;
+
+      f << "---\n"
+        << "function: \"" << yaml::escape(MF.getName()) << "\"\n"
+        << "original-size: " << orig_size << "\n"
+        << "size: " << size << "\n"
+        << "growth: " << ((int64_t)size - (int64_t)orig_size) << "\n"
+        << "regions:\n";
+
+      ablocks::iterator i(order.begin()), ie(order.end());
+      while (i != ie) {
+        ablock *Header = (*i)->Region;
+
+        unsigned RegionSize = 0, Fixups = 0, EdgesIn = 0, EdgesOut = 0;
+        std::set<unsigned> JTIDs;
+        std::vector<MachineBasicBlock*> Blocks, Entries;
+        for(; i != ie && (*i)->Region == Header; i++) {
+          MachineBasicBlock *MBB = (*i)->MBB;
+          unsigned BBSize = agraph::getBBSize(MBB, PTM);
+          RegionSize += BBSize;
+          Fixups += BBSize > (*i)->Size ? BBSize - (*i)->Size : 0;
+          JTIDs.insert((*i)->JTIDs.begin(), (*i)->JTIDs.end());
+          Blocks.push_back(MBB);
+
+          bool IsEntry = MBB == &MF.front();
+          for(MachineBasicBlock::pred_iterator p(MBB->pred_begin()),
+              pe(MBB->pred_end()); p != pe; p++) {
+            if (MBBtoA[*p]->Region != Header) {
+              EdgesIn++;
+              IsEntry = true;
+            }
+          }
+          if (IsEntry)
+            Entries.push_back(MBB);
+
+          for(MachineBasicBlock::succ_iterator s(MBB->succ_begin()),
+              se(MBB->succ_end()); s != se; s++) {
+            if (MBBtoA[*s]->Region != Header)
+              EdgesOut++;
+          }
+        }
+
+        f << "  - region: \"" << yaml::escape(Header->getName()) << "\"\n"
+          << "    size: " << RegionSize << "\n"
+          << "    fixup-bytes: " << Fixups << "\n"
+          << "    edges-in: " << EdgesIn << "\n"
+          << "    edges-out: " << EdgesOut << "\n"
+          << "    scc: " << (Header->isSCCHeader() ? "true" : "false") << "\n";
+
+        f << "    blocks: [";
+        for(unsigned j = 0; j < Blocks.size(); j++) {
+          f << (j ? ", " : "") << Blocks[j]->getNumber();
+        }
+        f << "]\n    entries: [";
+        for(unsigned j = 0; j < Entries.size(); j++) {
+          f << (j ? ", " : "") << Entries[j]->getNumber();
+        }
+        f << "]\n    jump-tables: [";
+        for(std::set<unsigned>::iterator j(JTIDs.begin()), je(JTIDs.end());
+            j != je; j++) {
+          f << (j != JTIDs.begin() ? ", " : "") << *j;
+        }
+        f << "]\n";
+      }
+    }
+
   public:
     /// PatmosFunctionSplitter - Create a new instance of the function splitter.
     PatmosFunctionSplitter(PatmosTargetMachine &tm) :
       MachineFunctionPass(ID), PTM(tm),
-      STC(*tm.getSubtargetImpl())
+      STC(*tm.getSubtargetImpl()), ReportedOrigSize(0), ReportedSize(0)
     {
     }
 
@@ -2145,6 +3073,11 @@ namespace llvm {
     void getAnalysisUsage(AnalysisUsage &AU) const override {
       AU.addRequired<MachineDominatorTree>();
       AU.addRequired<MachinePostDominatorTree>();
+      AU.addRequired<MachineOptimizationRemarkEmitterPass>();
+      if (WCETSplitting)
+        AU.addRequired<MachineLoopInfo>();
+      else if (UseBlockFrequencies || !UseBlockFrequencies.getNumOccurrences())
+        AU.addRequired<MachineBlockFrequencyInfo>();
       AU.addPreserved<MachineDominatorTree>();
       AU.addPreserved<MachinePostDominatorTree>();
       MachineFunctionPass::getAnalysisUsage(AU);
@@ -2155,6 +3088,34 @@ namespace llvm {
       {
         sys::fs::remove(StatsFile.c_str());
       }
+      if (!ReportFile.empty() && sys::fs::exists(ReportFile))
+      {
+        sys::fs::remove(ReportFile.c_str());
+      }
+      ReportedOrigSize = ReportedSize = 0;
+
+      ThreadPoolStrategy Threads = hardware_concurrency(SplitterThreads);
+      if (Threads.compute_thread_count() > 1)
+        Pool.reset(new ThreadPool(Threads));
+      return false;
+    }
+
+    bool doFinalization(Module &M) override {
+      Pool.reset();
+
+      // summarize the code growth of the whole module
+      if (!ReportFile.empty()) {
+        std::error_code err;
+        raw_fd_ostream f(ReportFile, err, sys::fs::OF_Append);
+        if (!err) {
+          f << "---\n"
+            << "module: \"" << yaml::escape(M.getModuleIdentifier()) << "\"\n"
+            << "original-size: " << ReportedOrigSize << "\n"
+            << "size: " << ReportedSize << "\n"
+            << "growth: " << ((int64_t)ReportedSize - (int64_t)ReportedOrigSize)
+            << "\n";
+        }
+      }
       return false;
     }
 
@@ -2169,9 +3130,9 @@ namespace llvm {
       if (DisableFunctionSplitter)
         return false;
 
-      unsigned max_subfunc_size   = MaxSubfunctionSize  ? MaxSubfunctionSize
-                                                     : STC.getMethodCacheSize();
-      max_subfunc_size = std::min(max_subfunc_size, STC.getMethodCacheSize());
+      // the size budget shared with the unroller and the inliner, see
+      // PatmosTargetTransformInfo
+      unsigned max_subfunc_size = STC.getMaxSubfunctionSize();
 
 
 
@@ -2182,29 +3143,54 @@ namespace llvm {
                                                : prefer_subfunc_size;
       prefer_subfunc_size = std::min(max_subfunc_size, prefer_subfunc_size);
 
+      // A region occupies whole method cache blocks, use all of its last
+      // block.
+      unsigned block_size = STC.getMethodCacheBlockSize();
+      prefer_subfunc_size = std::min(max_subfunc_size,
+                  STC.getMethodCacheBlocks(prefer_subfunc_size) * block_size);
+
       if(prefer_subfunc_size < 64) {
         // We avoid supporting subfunctions smaller than 64 bytes
         // So than we don't have to split in the middle of delay slots
         report_fatal_error("Subfunction size less than 64 bytes!.");
       }
 
-      prefer_scc_size = std::min(max_subfunc_size, prefer_scc_size);
+      prefer_scc_size = std::min(max_subfunc_size,
+                      STC.getMethodCacheBlocks(prefer_scc_size) * block_size);
 
       unsigned total_size = 0;
       bool blocks_splitted = false;
 
+      // blocks larger than this are split
+      unsigned split_size = SplitBlocksToPreferredSize ? prefer_subfunc_size
+                                                       : max_subfunc_size;
+
       MachineDominatorTree &MDT = getAnalysis<MachineDominatorTree>();
       MachinePostDominatorTree &MPDT = getAnalysis<MachinePostDominatorTree>();
 
+      // get the weights before blocks are split, the analyses are not updated
+      ablock_weights Weights;
+      if (WCETSplitting)
+        computeWorstCaseCounts(MF, Weights);
+      else if (useBlockFrequencies(MF))
+        computeFrequencies(MF, Weights);
+      bool UseWeights = WCETSplitting || useBlockFrequencies(MF);
+
       for(MachineFunction::iterator i(MF.begin()), ie(MF.end()); i != ie; i++) {
         unsigned bb_size = agraph::getBBSize(&*i, PTM);
 
         // in case the block is larger than the method cache, split it and
         // update its
         //
-        if (bb_size + agraph::getMaxBlockMargin(PTM, &*i) > max_subfunc_size)
+        unsigned bb_total = bb_size + agraph::getMaxBlockMargin(PTM, &*i);
+        if (bb_total > split_size)
         {
-          bb_size = agraph::splitBlock(&*i, max_subfunc_size, PTM, MDT, MPDT);
+          // split into pieces of about equal size
+          unsigned pieces = (bb_total + split_size - 1) / split_size;
+          unsigned target_size = (bb_total + pieces - 1) / pieces;
+
+          bb_size = agraph::splitBlock(&*i, max_subfunc_size, target_size,
+                                       PTM, MDT, MPDT);
           blocks_splitted = true;
         }
 
@@ -2221,13 +3207,28 @@ namespace llvm {
 
         if (CollectStats) Time -= TimeRecord::getCurrentTime(true);
 
+        PatmosPhaseScope T("function-splitter-regions",
+                           "Method Cache Region Formation", MF.getName());
+
         // construct a copy of the CFG.
         agraph G(&MF, PTM, MPDT,
-                 prefer_subfunc_size, prefer_scc_size, max_subfunc_size);
-        G.transformSCCs();
+                 prefer_subfunc_size, prefer_scc_size, max_subfunc_size,
+                 UseWeights ? &Weights : NULL,
+                 getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE());
+        {
+          PatmosPhaseScope T("function-splitter-sccs",
+                             "Method Cache SCC Transformation", MF.getName());
+          G.transformSCCs(Pool.get());
+        }
+        if (SplitColdBlocks)
+          G.computeColdBlocks();
         // compute regions -- i.e., split the function
         ablocks order;
-        G.computeRegions(order);
+        {
+          PatmosPhaseScope T("function-splitter-compute-regions",
+                             "Method Cache Region Computation", MF.getName());
+          G.computeRegions(order);
+        }
         assert(order.size() == MF.size());
 
         // update the basic block order and rewrite branches
@@ -2239,6 +3240,9 @@ namespace llvm {
           writeStats(StatsFile, MF, G, order, total_size, Time);
         }
 
+        if (!ReportFile.empty())
+          writeReport(ReportFile, MF, order, total_size);
+
         SplitFunctions++;
 
         // Note: We rely on the PatmosEnsureAlignment pass to set alignments,
@@ -2333,7 +3337,7 @@ namespace llvm {
       return G.MF->getFunction().getName().str();
     }
 
-    static bool isNodeHidden(const ablock *, const agraph) {
+    static bool isNodeHidden(const ablock *, const agraph &) {
       return false;
     }
 
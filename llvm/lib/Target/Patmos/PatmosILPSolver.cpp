@@ -0,0 +1,912 @@
+//===-- PatmosILPSolver.cpp - Solve ILPs given in the LP file format. -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The built-in solver reads the subset of the CPLEX LP format emitted by the
+// stack cache analysis and user-supplied bounds and solves the problem with
+// a two-phase simplex on a dense tableau. Integrality of the variables in the
+// Generals and Binaries sections is established by a depth-first
+// branch-and-bound. The ILPs of the stack cache analysis are flow problems on
+// the call graph of an SCC, whose LP relaxation is usually integral already.
+//
+// The external solver writes the problem to a temporary file and calls a
+// program, e.g., a script wrapping lp_solve, to solve it.
+//
+// The caching solver stores the solution of each LP in a file named after the
+// MD5 hash of the LP. The LP completely determines the solution, so cached
+// solutions never become stale. The files are written atomically, such that
+// concurrent compiler runs may share a cache directory.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PatmosILPSolver.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-stack-cache-analysis"
+
+STATISTIC(ILPCacheHits,   "Number of ILP solutions found in the cache.");
+STATISTIC(ILPCacheMisses, "Number of ILP solutions not found in the cache.");
+STATISTIC(ILPFallbacks,   "Number of ILPs passed on to the fallback solver.");
+
+/// Tolerance for comparisons in the simplex.
+static const double Eps = 1e-9;
+
+/// Tolerance for the integrality of a variable.
+static const double IntEps = 1e-6;
+
+static const double Inf = std::numeric_limits<double>::infinity();
+
+/// Maximal number of nodes explored by the branch-and-bound.
+static const unsigned MaxBBNodes = 100000;
+
+/// Maximal number of simplex pivots per LP relaxation.
+static const unsigned MaxPivots = 1000000;
+
+namespace {
+
+  /// A (mixed) integer linear program read from an LP file.
+  struct LinearProgram {
+    enum Sense { LE, GE, EQ };
+
+    /// A constraint sum(Coeffs) <Sense> RHS.
+    struct Row {
+      std::vector<std::pair<unsigned, double> > Coeffs;
+      Sense S;
+      double RHS;
+    };
+
+    bool Maximize = false;
+
+    /// Objective coefficients, bounds and integrality, per variable.
+    std::vector<double> Objective;
+    std::vector<double> Lower, Upper;
+    std::vector<bool> Integer;
+
+    std::vector<Row> Rows;
+
+    /// Map variable names to their index.
+    StringMap<unsigned> Index;
+
+    unsigned getVariable(StringRef Name) {
+      auto Res = Index.insert(std::make_pair(Name, (unsigned)Objective.size()));
+      if (Res.second) {
+        Objective.push_back(0);
+        Lower.push_back(0);
+        Upper.push_back(Inf);
+        Integer.push_back(false);
+      }
+      return Res.first->second;
+    }
+
+    unsigned getNumVariables() const { return Objective.size(); }
+  };
+
+  /// Parser for the subset of the CPLEX LP format used by the stack cache
+  /// analysis.
+  class LPParser {
+    enum TokenKind { TK_End, TK_Name, TK_Number, TK_Plus, TK_Minus, TK_Colon,
+                     TK_LE, TK_GE, TK_EQ };
+
+    struct Token {
+      TokenKind Kind;
+      StringRef Str;
+      double Value;
+    };
+
+    enum Section { S_None, S_Objective, S_Constraints, S_Bounds, S_Generals,
+                   S_Binaries, S_End };
+
+    LinearProgram &LP;
+    std::vector<Token> Tokens;
+    unsigned Cur = 0;
+    std::string Error;
+
+    const Token &tok(unsigned Ahead = 0) const {
+      return Tokens[std::min<size_t>(Cur + Ahead, Tokens.size() - 1)];
+    }
+
+    bool isName(StringRef Str, unsigned Ahead = 0) const {
+      return tok(Ahead).Kind == TK_Name &&
+             tok(Ahead).Str.equals_insensitive(Str);
+    }
+
+    bool isRelOp() const {
+      return tok().Kind == TK_LE || tok().Kind == TK_GE || tok().Kind == TK_EQ;
+    }
+
+    bool error(const Twine &Msg) {
+      Error = Msg.str();
+      return false;
+    }
+
+    /// tokenize - Split the LP into tokens, skipping comments.
+    bool tokenize(StringRef Text);
+
+    /// getSection - Check if the current token starts a section, and skip
+    /// the section keyword if so.
+    Section getSection();
+
+    /// isKeyword - Check if the current token starts a section.
+    bool isKeyword() {
+      unsigned Old = Cur;
+      bool Maximize = LP.Maximize;
+      bool Result = getSection() != S_None;
+      Cur = Old;
+      LP.Maximize = Maximize;
+      return Result;
+    }
+
+    /// skipLabel - Skip a "name:" label of an objective or constraint.
+    void skipLabel() {
+      if (tok().Kind == TK_Name && tok(1).Kind == TK_Colon) Cur += 2;
+    }
+
+    /// parseSense - Parse a relational operator.
+    LinearProgram::Sense parseSense() {
+      TokenKind Kind = tok().Kind;
+      Cur++;
+      return Kind == TK_LE ? LinearProgram::LE :
+             Kind == TK_GE ? LinearProgram::GE : LinearProgram::EQ;
+    }
+
+    /// parseExpression - Parse a linear expression, constants are added to
+    /// Constant.
+    bool parseExpression(std::map<unsigned, double> &Coeffs, double &Constant);
+
+    /// parseValue - Parse a signed number or infinity.
+    bool parseValue(double &Value);
+
+    bool parseObjective();
+    bool parseConstraint();
+    bool parseBound();
+
+  public:
+    LPParser(LinearProgram &lp) : LP(lp) {}
+
+    /// parse - Parse the LP text into LP.
+    bool parse(StringRef Text);
+
+    const std::string &getError() const { return Error; }
+  };
+
+  enum LPStatus { LP_Optimal, LP_Infeasible, LP_Unbounded, LP_Limit };
+
+  /// Depth-first branch-and-bound search over the LP relaxations.
+  class BranchAndBound {
+    const LinearProgram &LP;
+    unsigned Nodes = 0;
+
+  public:
+    bool Found = false;
+    bool Failed = false;
+    double Best = 0;
+
+    BranchAndBound(const LinearProgram &lp) : LP(lp) {}
+
+    void search(std::vector<double> &Lo, std::vector<double> &Up);
+  };
+
+  class PatmosBuiltinILPSolver : public PatmosILPSolver {
+    /// Solver for the ILPs exceeding the limits, or NULL.
+    std::unique_ptr<PatmosILPSolver> Fallback;
+
+  public:
+    PatmosBuiltinILPSolver(std::unique_ptr<PatmosILPSolver> fallback)
+      : Fallback(std::move(fallback)) {}
+
+    bool solve(StringRef Text, double &Objective) override;
+  };
+
+  class PatmosExternalILPSolver : public PatmosILPSolver {
+    std::string Program;
+
+  public:
+    PatmosExternalILPSolver(const std::string &program) : Program(program) {}
+
+    bool solve(StringRef Text, double &Objective) override;
+  };
+
+  class PatmosCachingILPSolver : public PatmosILPSolver {
+    std::unique_ptr<PatmosILPSolver> Solver;
+    std::string Dir;
+
+  public:
+    PatmosCachingILPSolver(std::unique_ptr<PatmosILPSolver> solver,
+                           const std::string &dir)
+      : Solver(std::move(solver)), Dir(dir) {
+      if (std::error_code err = sys::fs::create_directories(Dir)) {
+        errs() << "Warning: Failed to create ILP cache directory '" << Dir
+               << "': " << err.message() << "\n";
+      }
+    }
+
+    bool solve(StringRef Text, double &Objective) override;
+  };
+} // end of anonymous namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool LPParser::tokenize(StringRef Text) {
+  size_t Pos = 0, End = Text.size();
+  while (Pos < End) {
+    char C = Text[Pos];
+    if (isspace(C)) {
+      Pos++;
+      continue;
+    }
+
+    // comments reach until the end of the line
+    if (C == '\\') {
+      while (Pos < End && Text[Pos] != '\n') Pos++;
+      continue;
+    }
+
+    Token T;
+    T.Value = 0;
+    size_t Start = Pos++;
+    if (C == '+') {
+      T.Kind = TK_Plus;
+    } else if (C == '-') {
+      T.Kind = TK_Minus;
+    } else if (C == ':') {
+      T.Kind = TK_Colon;
+    } else if (C == '<' || C == '>' || C == '=') {
+      // accept <, <=, =<, >, >=, =>, and =
+      char D = Pos < End ? Text[Pos] : 0;
+      if (C == '=' && (D == '<' || D == '>')) {
+        C = D;
+        Pos++;
+      } else if (C != '=' && D == '=') {
+        Pos++;
+      }
+      T.Kind = C == '<' ? TK_LE : C == '>' ? TK_GE : TK_EQ;
+    } else if (isdigit(C) ||
+               (C == '.' && Pos < End && isdigit(Text[Pos]))) {
+      std::string Num(Text.substr(Start, 64));
+      char *NumEnd;
+      T.Kind = TK_Number;
+      T.Value = strtod(Num.c_str(), &NumEnd);
+      Pos = Start + (NumEnd - Num.c_str());
+    } else {
+      while (Pos < End && !isspace(Text[Pos]) &&
+             !StringRef("\\+-:<>=").contains(Text[Pos])) {
+        Pos++;
+      }
+      T.Kind = TK_Name;
+    }
+    T.Str = Text.slice(Start, Pos);
+    Tokens.push_back(T);
+  }
+
+  Token T;
+  T.Kind = TK_End;
+  T.Value = 0;
+  Tokens.push_back(T);
+  return true;
+}
+
+LPParser::Section LPParser::getSection() {
+  if (tok().Kind != TK_Name) return S_None;
+
+  Section Sec = S_None;
+  unsigned Len = 1;
+  if (isName("maximize") || isName("maximise") || isName("maximum") ||
+      isName("max")) {
+    LP.Maximize = true;
+    Sec = S_Objective;
+  } else if (isName("minimize") || isName("minimise") ||
+             isName("minimum") || isName("min")) {
+    LP.Maximize = false;
+    Sec = S_Objective;
+  } else if (isName("subject") && isName("to", 1)) {
+    Sec = S_Constraints;
+    Len = 2;
+  } else if (isName("such") && isName("that", 1)) {
+    Sec = S_Constraints;
+    Len = 2;
+  } else if (isName("st") || isName("s.t.") || isName("st.")) {
+    Sec = S_Constraints;
+  } else if (isName("bounds") || isName("bound")) {
+    Sec = S_Bounds;
+  } else if (isName("generals") || isName("general") || isName("gen")) {
+    Sec = S_Generals;
+  } else if (isName("binaries") || isName("binary") || isName("bin")) {
+    Sec = S_Binaries;
+  } else if (isName("end")) {
+    Sec = S_End;
+  }
+
+  // a label of the same name is not a keyword
+  if (Sec != S_None && tok(Len).Kind == TK_Colon) return S_None;
+
+  if (Sec != S_None) Cur += Len;
+  return Sec;
+}
+
+bool LPParser::parseExpression(std::map<unsigned, double> &Coeffs,
+                               double &Constant) {
+  while (true) {
+    double Sign = 1;
+    bool HaveSign = false;
+    while (tok().Kind == TK_Plus || tok().Kind == TK_Minus) {
+      if (tok().Kind == TK_Minus) Sign = -Sign;
+      HaveSign = true;
+      Cur++;
+    }
+
+    double Coeff = 1;
+    bool HaveNumber = false;
+    if (tok().Kind == TK_Number) {
+      Coeff = tok().Value;
+      HaveNumber = true;
+      Cur++;
+    }
+
+    if (tok().Kind == TK_Name && tok(1).Kind != TK_Colon && !isKeyword()) {
+      Coeffs[LP.getVariable(tok().Str)] += Sign * Coeff;
+      Cur++;
+    } else if (HaveNumber) {
+      Constant += Sign * Coeff;
+    } else if (HaveSign) {
+      return error("expected a term after sign");
+    } else {
+      return true;
+    }
+  }
+}
+
+bool LPParser::parseValue(double &Value) {
+  double Sign = 1;
+  unsigned Old = Cur;
+  while (tok().Kind == TK_Plus || tok().Kind == TK_Minus) {
+    if (tok().Kind == TK_Minus) Sign = -Sign;
+    Cur++;
+  }
+
+  if (tok().Kind == TK_Number) {
+    Value = Sign * tok().Value;
+  } else if (isName("inf") || isName("infinity")) {
+    Value = Sign * Inf;
+  } else {
+    Cur = Old;
+    return false;
+  }
+  Cur++;
+  return true;
+}
+
+bool LPParser::parseObjective() {
+  skipLabel();
+
+  unsigned Old = Cur;
+  std::map<unsigned, double> Coeffs;
+  double Constant = 0;
+  if (!parseExpression(Coeffs, Constant)) return false;
+  if (Cur == Old) return error("unexpected token in objective");
+
+  // the constant is irrelevant for the optimal solution
+  for (auto &C : Coeffs) {
+    LP.Objective[C.first] += C.second;
+  }
+  return true;
+}
+
+bool LPParser::parseConstraint() {
+  skipLabel();
+
+  LinearProgram::Row R;
+  std::map<unsigned, double> Coeffs;
+  double Constant = 0;
+  if (!parseExpression(Coeffs, Constant)) return false;
+  if (!isRelOp()) return error("expected relational operator in constraint");
+  R.S = parseSense();
+
+  double RHS;
+  if (!parseValue(RHS) || std::isinf(RHS)) {
+    return error("expected constant right-hand side in constraint");
+  }
+  R.RHS = RHS - Constant;
+
+  for (auto &C : Coeffs) {
+    if (C.second != 0) R.Coeffs.push_back(C);
+  }
+  LP.Rows.push_back(R);
+  return true;
+}
+
+bool LPParser::parseBound() {
+  // x free
+  if (tok().Kind == TK_Name && isName("free", 1)) {
+    unsigned V = LP.getVariable(tok().Str);
+    LP.Lower[V] = -Inf;
+    LP.Upper[V] = Inf;
+    Cur += 2;
+    return true;
+  }
+
+  // l <= x [<= u]
+  double Value;
+  if (parseValue(Value)) {
+    if (!isRelOp()) return error("expected relational operator in bound");
+    LinearProgram::Sense S = parseSense();
+    if (tok().Kind != TK_Name) return error("expected variable in bound");
+    unsigned V = LP.getVariable(tok().Str);
+    Cur++;
+
+    if (S != LinearProgram::GE) LP.Lower[V] = Value;
+    if (S != LinearProgram::LE) LP.Upper[V] = Value;
+
+    if (!isRelOp()) return true;
+    S = parseSense();
+    if (!parseValue(Value)) return error("expected value in bound");
+    if (S != LinearProgram::GE) LP.Upper[V] = Value;
+    if (S != LinearProgram::LE) LP.Lower[V] = Value;
+    return true;
+  }
+
+  // x <= u, x >= l, x = v
+  if (tok().Kind != TK_Name) return error("expected variable in bound");
+  unsigned V = LP.getVariable(tok().Str);
+  Cur++;
+  if (!isRelOp()) return error("expected relational operator in bound");
+  LinearProgram::Sense S = parseSense();
+  if (!parseValue(Value)) return error("expected value in bound");
+  if (S != LinearProgram::GE) LP.Upper[V] = Value;
+  if (S != LinearProgram::LE) LP.Lower[V] = Value;
+  return true;
+}
+
+bool LPParser::parse(StringRef Text) {
+  if (!tokenize(Text)) return false;
+
+  Section Sec = S_None;
+  while (tok().Kind != TK_End) {
+    Section Next = getSection();
+    if (Next == S_End) return true;
+    if (Next != S_None) {
+      Sec = Next;
+      continue;
+    }
+
+    switch (Sec) {
+    case S_Objective:
+      if (!parseObjective()) return false;
+      break;
+    case S_Constraints:
+      if (!parseConstraint()) return false;
+      break;
+    case S_Bounds:
+      if (!parseBound()) return false;
+      break;
+    case S_Generals:
+    case S_Binaries: {
+      if (tok().Kind != TK_Name) return error("expected variable name");
+      unsigned V = LP.getVariable(tok().Str);
+      LP.Integer[V] = true;
+      if (Sec == S_Binaries) {
+        LP.Lower[V] = std::max(LP.Lower[V], 0.0);
+        LP.Upper[V] = std::min(LP.Upper[V], 1.0);
+      }
+      Cur++;
+      break;
+    }
+    default:
+      return error("expected objective function");
+    }
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// solveRelaxation - Solve the LP relaxation of LP with the variable bounds
+/// Lo and Up, using a two-phase simplex on a dense tableau. The values of the
+/// variables are returned in X, the value of the objective in Value.
+static LPStatus solveRelaxation(const LinearProgram &LP,
+                                const std::vector<double> &Lo,
+                                const std::vector<double> &Up,
+                                std::vector<double> &X, double &Value)
+{
+  unsigned NumVars = LP.getNumVariables();
+
+  // Substitute x = Offset + Pos - Neg, with non-negative columns Pos and Neg.
+  // Only variables without lower bound need a Neg column.
+  std::vector<double> Offset(NumVars, 0);
+  std::vector<int> PosCol(NumVars), NegCol(NumVars, -1);
+  unsigned NumStruct = 0;
+  for (unsigned v = 0; v < NumVars; v++) {
+    if (Lo[v] > Up[v] + Eps) return LP_Infeasible;
+    PosCol[v] = NumStruct++;
+    if (std::isinf(Lo[v])) {
+      NegCol[v] = NumStruct++;
+    } else {
+      Offset[v] = Lo[v];
+    }
+  }
+
+  // Constraints over the structural columns, including upper bounds
+  std::vector<LinearProgram::Row> Rows;
+  for (const LinearProgram::Row &R : LP.Rows) {
+    LinearProgram::Row T;
+    T.S = R.S;
+    T.RHS = R.RHS;
+    for (auto &C : R.Coeffs) {
+      T.RHS -= C.second * Offset[C.first];
+      T.Coeffs.push_back(std::make_pair(PosCol[C.first], C.second));
+      if (NegCol[C.first] >= 0) {
+        T.Coeffs.push_back(std::make_pair(NegCol[C.first], -C.second));
+      }
+    }
+    Rows.push_back(T);
+  }
+  for (unsigned v = 0; v < NumVars; v++) {
+    if (std::isinf(Up[v])) continue;
+    LinearProgram::Row T;
+    T.S = LinearProgram::LE;
+    T.RHS = Up[v] - Offset[v];
+    T.Coeffs.push_back(std::make_pair(PosCol[v], 1.0));
+    if (NegCol[v] >= 0) T.Coeffs.push_back(std::make_pair(NegCol[v], -1.0));
+    Rows.push_back(T);
+  }
+
+  // Make all right-hand sides non-negative
+  unsigned NumSlack = 0, NumArt = 0;
+  for (LinearProgram::Row &R : Rows) {
+    if (R.RHS < 0) {
+      R.RHS = -R.RHS;
+      for (auto &C : R.Coeffs) C.second = -C.second;
+      if (R.S != LinearProgram::EQ) {
+        R.S = R.S == LinearProgram::LE ? LinearProgram::GE : LinearProgram::LE;
+      }
+    }
+    if (R.S != LinearProgram::EQ) NumSlack++;
+    if (R.S != LinearProgram::LE) NumArt++;
+  }
+
+  // Columns: structural, slack, and artificial variables, and the RHS. The
+  // last row holds the reduced costs, and the negated objective in the RHS.
+  unsigned M = Rows.size();
+  unsigned ArtStart = NumStruct + NumSlack;
+  unsigned N = ArtStart + NumArt;
+  std::vector<std::vector<double> > T(M + 1, std::vector<double>(N + 1, 0));
+  std::vector<unsigned> Basis(M);
+  std::vector<double> &Obj = T[M];
+
+  unsigned Slack = NumStruct, Art = ArtStart;
+  for (unsigned i = 0; i < M; i++) {
+    for (auto &C : Rows[i].Coeffs) T[i][C.first] += C.second;
+    T[i][N] = Rows[i].RHS;
+    switch (Rows[i].S) {
+    case LinearProgram::LE:
+      T[i][Slack] = 1;
+      Basis[i] = Slack++;
+      break;
+    case LinearProgram::GE:
+      T[i][Slack++] = -1;
+      T[i][Art] = 1;
+      Basis[i] = Art++;
+      break;
+    case LinearProgram::EQ:
+      T[i][Art] = 1;
+      Basis[i] = Art++;
+      break;
+    }
+  }
+
+  auto pivot = [&](unsigned R, unsigned C) {
+    std::vector<double> &PR = T[R];
+    double P = PR[C];
+    for (unsigned j = 0; j <= N; j++) PR[j] /= P;
+    for (unsigned i = 0; i <= M; i++) {
+      if (i == R || T[i][C] == 0) continue;
+      double F = T[i][C];
+      for (unsigned j = 0; j <= N; j++) T[i][j] -= F * PR[j];
+      T[i][C] = 0;
+    }
+    Basis[R] = C;
+  };
+
+  // Set the objective row for the costs Cost, relative to the current basis
+  auto setObjective = [&](const std::vector<double> &Cost) {
+    for (unsigned j = 0; j <= N; j++) Obj[j] = j < N ? Cost[j] : 0;
+    for (unsigned i = 0; i < M; i++) {
+      double CB = Cost[Basis[i]];
+      if (CB == 0) continue;
+      for (unsigned j = 0; j <= N; j++) Obj[j] -= CB * T[i][j];
+    }
+  };
+
+  // Maximize the objective, only columns below Limit may enter the basis.
+  // Use Dantzig's rule, and fall back to Bland's rule to avoid cycling.
+  unsigned Pivots = 0;
+  auto optimize = [&](unsigned Limit) {
+    unsigned Steps = 0;
+    while (true) {
+      bool Bland = Steps++ > 10 * (M + N);
+      int C = -1;
+      for (unsigned j = 0; j < Limit; j++) {
+        if (Obj[j] > Eps && (C < 0 || (!Bland && Obj[j] > Obj[C]))) {
+          C = j;
+          if (Bland) break;
+        }
+      }
+      if (C < 0) return LP_Optimal;
+
+      int R = -1;
+      double Ratio = 0;
+      for (unsigned i = 0; i < M; i++) {
+        if (T[i][C] <= Eps) continue;
+        double Q = T[i][N] / T[i][C];
+        if (R < 0 || Q < Ratio - Eps ||
+            (Q <= Ratio + Eps && Basis[i] < Basis[R])) {
+          R = i;
+          Ratio = Q;
+        }
+      }
+      if (R < 0) return LP_Unbounded;
+
+      if (++Pivots > MaxPivots) return LP_Limit;
+      pivot(R, C);
+    }
+  };
+
+  // Phase 1: minimize the sum of the artificial variables
+  if (NumArt) {
+    std::vector<double> Cost(N, 0);
+    for (unsigned j = ArtStart; j < N; j++) Cost[j] = -1;
+    setObjective(Cost);
+    LPStatus S = optimize(N);
+    if (S != LP_Optimal) return S == LP_Limit ? LP_Limit : LP_Infeasible;
+    if (Obj[N] > 1e-7) return LP_Infeasible;
+
+    // drive remaining (zero) artificial variables out of the basis
+    for (unsigned i = 0; i < M; i++) {
+      if (Basis[i] < ArtStart) continue;
+      for (unsigned j = 0; j < ArtStart; j++) {
+        if (std::abs(T[i][j]) > Eps) {
+          pivot(i, j);
+          break;
+        }
+      }
+    }
+  }
+
+  // Phase 2: optimize the actual objective
+  std::vector<double> Cost(N, 0);
+  double Dir = LP.Maximize ? 1 : -1;
+  for (unsigned v = 0; v < NumVars; v++) {
+    Cost[PosCol[v]] = Dir * LP.Objective[v];
+    if (NegCol[v] >= 0) Cost[NegCol[v]] = -Dir * LP.Objective[v];
+  }
+  setObjective(Cost);
+  LPStatus S = optimize(ArtStart);
+  if (S != LP_Optimal) return S;
+
+  std::vector<double> Y(N, 0);
+  for (unsigned i = 0; i < M; i++) Y[Basis[i]] = T[i][N];
+
+  X.assign(NumVars, 0);
+  Value = 0;
+  for (unsigned v = 0; v < NumVars; v++) {
+    X[v] = Offset[v] + Y[PosCol[v]] - (NegCol[v] >= 0 ? Y[NegCol[v]] : 0);
+    Value += LP.Objective[v] * X[v];
+  }
+  return LP_Optimal;
+}
+
+void BranchAndBound::search(std::vector<double> &Lo, std::vector<double> &Up)
+{
+  if (Failed) return;
+  if (++Nodes > MaxBBNodes) {
+    Failed = true;
+    return;
+  }
+
+  std::vector<double> X;
+  double Value;
+  LPStatus S = solveRelaxation(LP, Lo, Up, X, Value);
+  if (S == LP_Infeasible) return;
+  if (S != LP_Optimal) {
+    Failed = true;
+    return;
+  }
+
+  // the relaxation bounds all solutions of this subtree
+  if (Found && (LP.Maximize ? Value <= Best + IntEps : Value >= Best - IntEps))
+    return;
+
+  // branch on the most fractional integer variable
+  int Branch = -1;
+  double Frac = IntEps;
+  for (unsigned v = 0, e = LP.getNumVariables(); v < e; v++) {
+    if (!LP.Integer[v]) continue;
+    double F = std::abs(X[v] - std::round(X[v]));
+    if (F > Frac) {
+      Branch = v;
+      Frac = F;
+    }
+  }
+
+  if (Branch < 0) {
+    Found = true;
+    Best = Value;
+    return;
+  }
+
+  double Floor = std::floor(X[Branch]);
+  double OldUp = Up[Branch];
+  Up[Branch] = Floor;
+  search(Lo, Up);
+  Up[Branch] = OldUp;
+
+  double OldLo = Lo[Branch];
+  Lo[Branch] = Floor + 1;
+  search(Lo, Up);
+  Lo[Branch] = OldLo;
+}
+
+bool PatmosBuiltinILPSolver::solve(StringRef Text, double &Objective) {
+  LinearProgram LP;
+  LPParser Parser(LP);
+  if (!Parser.parse(Text)) {
+    report_fatal_error(Twine("Failed to parse ILP: ") + Parser.getError());
+  }
+
+  // integer variables have integer bounds
+  std::vector<double> Lo(LP.Lower), Up(LP.Upper);
+  for (unsigned v = 0, e = LP.getNumVariables(); v < e; v++) {
+    if (!LP.Integer[v]) continue;
+    Lo[v] = std::ceil(Lo[v] - IntEps);
+    Up[v] = std::floor(Up[v] + IntEps);
+  }
+
+  BranchAndBound BB(LP);
+  BB.search(Lo, Up);
+
+  LLVM_DEBUG(dbgs() << "ILP with " << LP.getNumVariables() << " variables and "
+                    << LP.Rows.size() << " constraints: "
+                    << (BB.Failed ? "failed" :
+                        !BB.Found ? "infeasible" : "optimal") << "\n");
+
+  // the limits were exceeded, the ILP may still have a solution
+  if (BB.Failed) {
+    if (!Fallback) return false;
+    ILPFallbacks++;
+    return Fallback->solve(Text, Objective);
+  }
+
+  if (!BB.Found) return false;
+
+  Objective = BB.Best;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosExternalILPSolver::solve(StringRef Text, double &Objective) {
+  // write LP file.
+  SmallString<1024> LPname;
+  std::error_code err = sys::fs::createUniqueDirectory("stack", LPname);
+  if (err) {
+    report_fatal_error(Twine("Error creating temp .lp file: ") + err.message());
+  }
+  SmallString<1024> LPdir(LPname);
+
+  sys::path::append(LPname, "scc.lp");
+
+  {
+    raw_fd_ostream OS(LPname, err);
+    if (err) {
+      report_fatal_error("Failed to open file '" + LPname + "' for writing: " +
+                         err.message());
+    }
+    OS << Text;
+  }
+
+  auto progName = sys::findProgramByName(Program);
+  if (!progName) {
+    report_fatal_error(Twine("ILP solver (") + Program + ") not found");
+  }
+
+  StringRef args[] = { Program, LPname };
+  std::string ErrMsg;
+  if (sys::ExecuteAndWait(*progName, args, None, {}, 0, 0, &ErrMsg)) {
+    report_fatal_error(Twine("calling ILP solver (") + Program + "): " + ErrMsg);
+  }
+
+  // read solution
+  std::string SOLname((LPname + ".sol").str());
+  if (!sys::fs::exists(SOLname))
+    report_fatal_error("Failed to read ILP solution");
+
+  bool Solved;
+  {
+    std::ifstream IS(SOLname.c_str());
+    Solved = bool(IS >> Objective);
+  }
+
+  sys::fs::remove(SOLname);
+  sys::fs::remove(LPname);
+  sys::fs::remove(LPdir);
+
+  // the solver reports -1 when solving has failed
+  return Solved && Objective != -1.;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosCachingILPSolver::solve(StringRef Text, double &Objective) {
+  MD5 Hash;
+  Hash.update(Text);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+
+  SmallString<256> SOLname(Dir);
+  sys::path::append(SOLname, Result.digest() + ".sol");
+
+  // reuse a cached solution
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Cached =
+                                                MemoryBuffer::getFile(SOLname);
+  if (Cached && !(*Cached)->getBuffer().trim().getAsDouble(Objective)) {
+    ILPCacheHits++;
+    return true;
+  }
+
+  ILPCacheMisses++;
+  if (!Solver->solve(Text, Objective)) return false;
+
+  // store the solution, failing to do so is not an error
+  std::string Value;
+  raw_string_ostream OS(Value);
+  OS << format("%.17g", Objective) << "\n";
+  OS.flush();
+  consumeError(writeFileAtomically((SOLname + ".tmp%%%%%%").str(), SOLname,
+                                   Value));
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<PatmosILPSolver>
+llvm::createPatmosBuiltinILPSolver(std::unique_ptr<PatmosILPSolver> Fallback) {
+  return std::unique_ptr<PatmosILPSolver>(
+                                new PatmosBuiltinILPSolver(std::move(Fallback)));
+}
+
+std::unique_ptr<PatmosILPSolver>
+llvm::createPatmosExternalILPSolver(const std::string &Program) {
+  return std::unique_ptr<PatmosILPSolver>(new PatmosExternalILPSolver(Program));
+}
+
+std::unique_ptr<PatmosILPSolver>
+llvm::createPatmosCachingILPSolver(std::unique_ptr<PatmosILPSolver> Solver,
+                                   const std::string &Dir) {
+  return std::unique_ptr<PatmosILPSolver>(
+                             new PatmosCachingILPSolver(std::move(Solver), Dir));
+}
@@ -0,0 +1,69 @@
+//===-- PatmosILPSolver.h - Solve ILPs given in the LP file format. -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Interface to solve integer linear programs given in the CPLEX LP format, as
+// constructed by the stack cache analysis.
+//
+// Two backends are available: a built-in solver that runs in-process and an
+// external solver that writes the problem to a temporary file and calls a
+// program to solve it. Either can be wrapped by an on-disk cache of the
+// solutions.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _LLVM_TARGET_PATMOSILPSOLVER_H_
+#define _LLVM_TARGET_PATMOSILPSOLVER_H_
+
+#include "llvm/ADT/StringRef.h"
+
+#include <memory>
+#include <string>
+
+namespace llvm {
+
+  /// PatmosILPSolver - Solve an ILP given in the CPLEX LP format.
+  class PatmosILPSolver {
+  public:
+    virtual ~PatmosILPSolver() {}
+
+    /// solve - Solve the given ILP and return the value of the objective
+    /// function of an optimal solution in Objective.
+    /// @return False if the ILP is infeasible or unbounded, or if it could not
+    /// be solved.
+    virtual bool solve(StringRef LP, double &Objective) = 0;
+  };
+
+  /// createPatmosBuiltinILPSolver - Returns a solver that parses the LP and
+  /// solves it in-process, using a simplex with branch-and-bound.
+  ///
+  /// The solver supports the sections Maximize/Minimize, Subject To, Bounds,
+  /// Generals and Binaries, with constant right-hand sides.
+  ///
+  /// If the branch-and-bound or a relaxation exceeds its limits, the ILP is
+  /// passed on to Fallback, if given, instead of failing. Infeasible and
+  /// unbounded ILPs fail without calling Fallback.
+  std::unique_ptr<PatmosILPSolver> createPatmosBuiltinILPSolver(
+                         std::unique_ptr<PatmosILPSolver> Fallback = nullptr);
+
+  /// createPatmosExternalILPSolver - Returns a solver that writes the LP to a
+  /// temporary file and calls Program with its name. The program is expected
+  /// to write the value of the objective function to a file with the same
+  /// name and an appended suffix .sol, or -1 if solving fails.
+  std::unique_ptr<PatmosILPSolver> createPatmosExternalILPSolver(
+                                                  const std::string &Program);
+
+  /// createPatmosCachingILPSolver - Returns a solver that keeps the solutions
+  /// of Solver in the directory Dir, keyed by a hash of the LP. Solutions are
+  /// reused across compiler runs whenever the same LP is solved again.
+  std::unique_ptr<PatmosILPSolver> createPatmosCachingILPSolver(
+                                      std::unique_ptr<PatmosILPSolver> Solver,
+                                      const std::string &Dir);
+}
+
+#endif // _LLVM_TARGET_PATMOSILPSOLVER_H_
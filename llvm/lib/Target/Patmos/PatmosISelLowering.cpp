@@ -18,9 +18,11 @@
 #include "PatmosMachineFunctionInfo.h"
 #include "PatmosTargetMachine.h"
 #include "PatmosSubtarget.h"
+#include "SinglePath/PatmosSinglePathInfo.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/IntrinsicsPatmos.h"
 #include "llvm/IR/CallingConv.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/GlobalAlias.h"
@@ -30,6 +32,7 @@
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/PseudoSourceValue.h"
+#include "llvm/CodeGen/SelectionDAGAddressAnalysis.h"
 #include "llvm/CodeGen/SelectionDAGISel.h"
 #include "llvm/CodeGen/ValueTypes.h"
 #include "llvm/Support/CommandLine.h"
@@ -39,6 +42,37 @@
 #include "llvm/MC/MCExpr.h"
 using namespace llvm;
 
+static cl::opt<bool> InlineDivision("mpatmos-inline-div",
+  cl::init(false),
+  cl::desc("Expand 32 bit division and remainder by a non-constant divisor "
+           "into an inline, branch-free sequence instead of a libcall."),
+  cl::Hidden);
+
+static cl::opt<bool> EnableTailCalls("mpatmos-enable-tail-calls",
+  cl::init(false),
+  cl::desc("Lower calls in tail position to a branch to the callee after the "
+           "epilogue of the caller, if all arguments are passed in registers."),
+  cl::Hidden);
+
+static cl::opt<bool> DecomposeMul("mpatmos-decompose-mul",
+  cl::init(true),
+  cl::desc("Decompose multiplications by constants into shifts, shadds, "
+           "adds and subtractions that finish no later than the multiplier "
+           "(default: true)."),
+  cl::Hidden);
+
+static cl::opt<bool> MergeBoolLoads("mpatmos-merge-bool-loads",
+  cl::init(false),
+  cl::desc("Read the booleans within an aligned word by a single word load "
+           "and a bit test per boolean (default: false)."),
+  cl::Hidden);
+
+static cl::opt<bool> EnableFastCC("mpatmos-fast-cc",
+  cl::init(false),
+  cl::desc("Pass more arguments and return values in registers for functions "
+           "with the fast calling convention, i.e., internal functions."),
+  cl::Hidden);
+
 
 PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
                                            const PatmosSubtarget &STI) :
@@ -58,6 +92,10 @@ PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
   // condition branches.
   setJumpIsExpensive(true);
 
+  // There are eight predicate registers, which are combined with predicate
+  // instructions instead of being rematerialized next to their uses.
+  setHasMultipleConditionRegisters(true);
+
   setStackPointerRegisterToSaveRestore(Patmos::RSP);
   setBooleanContents(ZeroOrOneBooleanContent);
 
@@ -101,11 +139,22 @@ PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
   setOperationAction(ISD::MULHU, MVT::i32, Expand);
   setOperationAction(ISD::SMUL_LOHI, MVT::i32, Custom);
   setOperationAction(ISD::UMUL_LOHI, MVT::i32, Custom);
-  // Patmos has no DIV, REM or DIVREM operations.
-  setOperationAction(ISD::SDIV, MVT::i32, Expand);
-  setOperationAction(ISD::UDIV, MVT::i32, Expand);
-  setOperationAction(ISD::SREM, MVT::i32, Expand);
-  setOperationAction(ISD::UREM, MVT::i32, Expand);
+  // The fixed-point multiplications expand to S/UMUL_LOHI and a funnel
+  // shift of the high and low word, the saturation and the saturating
+  // additions and subtractions to compares and predicated moves, i.e., all
+  // of them are branch-free.
+  for (unsigned Op : {ISD::SMULFIX, ISD::UMULFIX,
+                      ISD::SMULFIXSAT, ISD::UMULFIXSAT,
+                      ISD::SADDSAT, ISD::UADDSAT,
+                      ISD::SSUBSAT, ISD::USUBSAT})
+    setOperationAction(Op, MVT::i32, Expand);
+  // Patmos has no DIV, REM or DIVREM operations. Divisions by constants are
+  // turned into multiplications by the DAG combiner, using UMUL_LOHI.
+  LegalizeAction DivAction = InlineDivision ? Custom : Expand;
+  setOperationAction(ISD::SDIV, MVT::i32, DivAction);
+  setOperationAction(ISD::UDIV, MVT::i32, DivAction);
+  setOperationAction(ISD::SREM, MVT::i32, DivAction);
+  setOperationAction(ISD::UREM, MVT::i32, DivAction);
   setOperationAction(ISD::SDIVREM, MVT::i32, Expand);
   setOperationAction(ISD::UDIVREM, MVT::i32, Expand);
 
@@ -124,13 +173,15 @@ PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
   setOperationAction(ISD::SMULO, MVT::i32, Expand);
   setOperationAction(ISD::UMULO, MVT::i32, Expand);
 
-  // no bit-fiddling
+  // no bit-fiddling instructions. Bit counts are lowered to branch-free
+  // sequences that schedule well, the generic expansion of byte swaps is as
+  // short as it gets.
   setOperationAction(ISD::BSWAP, MVT::i32, Expand);
-  setOperationAction(ISD::CTTZ , MVT::i32, Expand);
-  setOperationAction(ISD::CTLZ , MVT::i32, Expand);
-  setOperationAction(ISD::CTTZ_ZERO_UNDEF, MVT::i32, Expand);
-  setOperationAction(ISD::CTLZ_ZERO_UNDEF, MVT::i32, Expand);
-  setOperationAction(ISD::CTPOP, MVT::i32, Expand);
+  setOperationAction(ISD::CTTZ , MVT::i32, Custom);
+  setOperationAction(ISD::CTLZ , MVT::i32, Custom);
+  setOperationAction(ISD::CTTZ_ZERO_UNDEF, MVT::i32, Custom);
+  setOperationAction(ISD::CTLZ_ZERO_UNDEF, MVT::i32, Custom);
+  setOperationAction(ISD::CTPOP, MVT::i32, Custom);
 
   setOperationAction(ISD::SIGN_EXTEND, MVT::i8,  Expand);
   setOperationAction(ISD::SIGN_EXTEND, MVT::i16, Expand);
@@ -148,9 +199,13 @@ PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
   setOperationAction(ISD::ROTL , MVT::i32, Expand);
   setOperationAction(ISD::ROTR , MVT::i32, Expand);
 
-  setOperationAction(ISD::SHL_PARTS, MVT::i32,   Expand);
-  setOperationAction(ISD::SRA_PARTS, MVT::i32,   Expand);
-  setOperationAction(ISD::SRL_PARTS, MVT::i32,   Expand);
+  // 64 bit arithmetic, split into halves that can be bundled
+  setOperationAction(ISD::ADD,       MVT::i64,   Custom);
+  setOperationAction(ISD::SUB,       MVT::i64,   Custom);
+  setOperationAction(ISD::SETCC,     MVT::i64,   Custom);
+  setOperationAction(ISD::SHL_PARTS, MVT::i32,   Custom);
+  setOperationAction(ISD::SRA_PARTS, MVT::i32,   Custom);
+  setOperationAction(ISD::SRL_PARTS, MVT::i32,   Custom);
 
   setOperationAction(ISD::SELECT_CC, MVT::i1,    Expand);
   setOperationAction(ISD::SELECT_CC, MVT::i8,    Expand);
@@ -163,7 +218,7 @@ PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
   setOperationAction(ISD::BR_CC,     MVT::i32,   Expand);
   setOperationAction(ISD::BR_CC,     MVT::Other, Expand);
 
-  setOperationAction(ISD::DYNAMIC_STACKALLOC, MVT::i32, Expand);
+  setOperationAction(ISD::DYNAMIC_STACKALLOC, MVT::i32, Custom);
 
   // handling of variadic parameters
   setOperationAction(ISD::VASTART     , MVT::Other, Custom);
@@ -175,6 +230,32 @@ PatmosTargetLowering::PatmosTargetLowering(const PatmosTargetMachine &tm,
   setOperationAction(ISD::STACKRESTORE, MVT::Other, Expand);
 
   setOperationAction(ISD::PCMARKER,  MVT::Other, Expand);
+
+  // Atomic loads and stores are uncached accesses to the main memory, see
+  // PatmosInstrPatterns.td. Patmos has no atomic read-modify-write
+  // instructions, these are calls to the __sync_* functions of the runtime,
+  // which use the hardware lock of the multicore. Wider atomics are
+  // expanded to __atomic_* calls by AtomicExpand.
+  setMaxAtomicSizeInBitsSupported(32);
+  for (unsigned Op : {ISD::ATOMIC_SWAP,      ISD::ATOMIC_CMP_SWAP,
+                      ISD::ATOMIC_LOAD_ADD,  ISD::ATOMIC_LOAD_SUB,
+                      ISD::ATOMIC_LOAD_AND,  ISD::ATOMIC_LOAD_OR,
+                      ISD::ATOMIC_LOAD_XOR,  ISD::ATOMIC_LOAD_NAND,
+                      ISD::ATOMIC_LOAD_MIN,  ISD::ATOMIC_LOAD_MAX,
+                      ISD::ATOMIC_LOAD_UMIN, ISD::ATOMIC_LOAD_UMAX})
+    setOperationAction(Op, MVT::i32, Expand);
+  setOperationAction(ISD::ATOMIC_FENCE, MVT::Other, Custom);
+
+  // reads of the timer and of special registers
+  setOperationAction(ISD::INTRINSIC_W_CHAIN, MVT::Other, Custom);
+
+  // pick conditions for selects that map to a single compare
+  setTargetDAGCombine(ISD::SELECT);
+  // decompose multiplications by constants, share the multiplier between
+  // the low and high word of the same product
+  setTargetDAGCombine(ISD::MUL);
+  // read neighbouring booleans by a single load
+  setTargetDAGCombine(ISD::LOAD);
   // TODO expand floating point stuff?
 
 }
@@ -187,14 +268,394 @@ SDValue PatmosTargetLowering::LowerOperation(SDValue Op,
     case ISD::STORE:              return LowerSTORE(Op,DAG);
     case ISD::SMUL_LOHI:
     case ISD::UMUL_LOHI:          return LowerMUL_LOHI(Op, DAG);
+    case ISD::SDIV:
+    case ISD::UDIV:
+    case ISD::SREM:
+    case ISD::UREM:               return LowerDIVREM(Op, DAG);
+    case ISD::CTLZ:
+    case ISD::CTTZ:
+    case ISD::CTLZ_ZERO_UNDEF:
+    case ISD::CTTZ_ZERO_UNDEF:    return LowerCTLZ_CTTZ(Op, DAG);
+    case ISD::CTPOP:              return LowerCTPOP(Op, DAG);
+    case ISD::SETCC:              return LowerSETCC64(Op, DAG);
+    case ISD::SHL_PARTS:
+    case ISD::SRA_PARTS:
+    case ISD::SRL_PARTS:          return LowerShiftParts(Op, DAG);
     case ISD::VASTART:            return LowerVASTART(Op, DAG);
     case ISD::FRAMEADDR:          return LowerFRAMEADDR(Op, DAG);
+    case ISD::DYNAMIC_STACKALLOC: return LowerDYNAMIC_STACKALLOC(Op, DAG);
     case ISD::RETURNADDR:         return LowerRETURNADDR(Op, DAG);
+    case ISD::ATOMIC_FENCE:       return LowerATOMIC_FENCE(Op, DAG);
+    case ISD::INTRINSIC_W_CHAIN:  return LowerINTRINSIC_W_CHAIN(Op, DAG);
     default:
       llvm_unreachable("unimplemented operation");
   }
 }
 
+bool PatmosTargetLowering::isLegalAddressingMode(const DataLayout &DL,
+                                                 const AddrMode &AM, Type *Ty,
+                                                 unsigned AddrSpace,
+                                                 Instruction *I) const {
+  // No globals, and no index register besides the base. Scaled indices need
+  // a separate shadd/shadd2.
+  if (AM.BaseGV)
+    return false;
+  if (AM.Scale < 0 || AM.Scale > 1 || (AM.Scale == 1 && AM.HasBaseReg))
+    return false;
+
+  // The offset is scaled by the access size. Larger types are accessed by
+  // words, the offset of the last word must fit as well.
+  uint64_t Size = Ty->isSized() ? DL.getTypeStoreSize(Ty) : 1;
+  uint64_t Scale = Size >= 4 ? 4 : (Size == 2 ? 2 : 1);
+  int64_t Offs = AM.BaseOffs;
+  if (Offs < 0 || Offs % Scale != 0)
+    return false;
+
+  int64_t Last = Offs + (Size > 4 ? alignTo(Size, 4) - 4 : 0);
+  return isUInt<7>(Last / Scale);
+}
+
+/// hasSingleCompare - Return true if the comparison maps to a single compare
+/// or bit test instruction.
+static bool hasSingleCompare(SDValue LHS, SDValue RHS, ISD::CondCode CC) {
+  ConstantSDNode *C = dyn_cast<ConstantSDNode>(RHS);
+  if (!C)
+    return true;
+
+  // bit tests only set the predicate if the bit is set
+  if (C->isNullValue() && LHS.getOpcode() == ISD::AND) {
+    SDValue Mask = LHS.getOperand(1);
+    ConstantSDNode *MaskC = dyn_cast<ConstantSDNode>(Mask);
+    bool IsBit = (MaskC && isPowerOf2_32(MaskC->getZExtValue())) ||
+                 (Mask.getOpcode() == ISD::SHL &&
+                  isOneConstant(Mask.getOperand(0)));
+    if (IsBit)
+      return CC != ISD::SETEQ;
+  }
+
+  // compares with short immediates only test for lower or equal
+  if (isUInt<5>(C->getZExtValue())) {
+    switch (CC) {
+      case ISD::SETGT:
+      case ISD::SETGE:
+      case ISD::SETUGT:
+      case ISD::SETUGE:
+        return false;
+      default:
+        return true;
+    }
+  }
+  return true;
+}
+
+SDValue PatmosTargetLowering::PerformSELECTCombine(SDNode *N,
+                                                  DAGCombinerInfo &DCI) const {
+  SDValue Cond = N->getOperand(0);
+  if (Cond.getOpcode() != ISD::SETCC || !Cond.hasOneUse())
+    return SDValue();
+
+  SDValue LHS = Cond.getOperand(0);
+  SDValue RHS = Cond.getOperand(1);
+  ISD::CondCode CC = cast<CondCodeSDNode>(Cond.getOperand(2))->get();
+  EVT OpVT = LHS.getValueType();
+  if (OpVT != MVT::i32 || hasSingleCompare(LHS, RHS, CC))
+    return SDValue();
+
+  // Invert the condition and swap the operands of the select, such that the
+  // predicate comes from a single compare.
+  ISD::CondCode InvCC = ISD::getSetCCInverse(CC, OpVT);
+  if (!hasSingleCompare(LHS, RHS, InvCC))
+    return SDValue();
+
+  SelectionDAG &DAG = DCI.DAG;
+  SDLoc dl(N);
+  SDValue NewCond = DAG.getSetCC(dl, Cond.getValueType(), LHS, RHS, InvCC);
+  return DAG.getSelect(dl, N->getValueType(0), NewCond, N->getOperand(2),
+                       N->getOperand(1));
+}
+
+namespace {
+/// A step of the decomposition of a multiplication by a constant, computing
+/// (A << Shift) + B, (A << Shift) - B or A << Shift of the values of earlier
+/// steps. Value 0 is the multiplicand, value i the result of step i - 1.
+struct MulStep {
+  unsigned Opcode;
+  unsigned A, B;
+  unsigned Shift;
+};
+} // end anonymous namespace
+
+/// getMulStepCost - Return the instructions of the step, a shadd or shadd2
+/// adds the shifted value in one instruction.
+static unsigned getMulStepCost(const MulStep &S) {
+  if (S.Opcode == ISD::SHL || S.Shift == 0)
+    return 1;
+  return S.Opcode == ISD::ADD && S.Shift <= 2 ? 1 : 2;
+}
+
+/// findMulSteps - Find the cheapest steps computing x * C of at most Budget
+/// instructions, appended to the empty Steps. Return the cost, or ~0u if
+/// there is none.
+static unsigned findMulSteps(uint32_t C, unsigned Budget,
+                             SmallVectorImpl<MulStep> &Steps) {
+  if (C == 1)
+    return 0;
+  if (C == 0 || Budget == 0)
+    return ~0u;
+
+  unsigned BestCost = ~0u;
+  SmallVector<MulStep, 4> Best;
+
+  // compute x * Factor first, then apply Last to it or x, e.g., x * 6 is
+  // (x * 3) << 1, x * 7 is (x << 3) - x, and x * 45 is shadd2(x * 9, x * 9)
+  auto Try = [&](uint32_t Factor, MulStep Last, bool FactorIsA,
+                 bool FactorIsB, bool ShiftX = false) {
+    unsigned Cost = getMulStepCost(Last);
+    if (Cost > Budget || Cost >= BestCost)
+      return;
+
+    SmallVector<MulStep, 4> Sub;
+    unsigned SubCost = findMulSteps(Factor, std::min(Budget, BestCost - 1) -
+                                            Cost, Sub);
+    if (SubCost == ~0u || SubCost + Cost >= BestCost)
+      return;
+
+    unsigned F = Sub.size();
+    if (ShiftX) {
+      // the shifted multiplicand, minus the factor
+      Sub.push_back({ISD::SHL, 0, 0, Last.Shift});
+      Last.A = Sub.size();
+      Last.Shift = 0;
+    } else if (FactorIsA) {
+      Last.A = F;
+    }
+    if (FactorIsB)
+      Last.B = F;
+    Sub.push_back(Last);
+
+    BestCost = SubCost + Cost;
+    Best = std::move(Sub);
+  };
+
+  unsigned Zeros = countTrailingZeros(C);
+  if (Zeros) {
+    Try(C >> Zeros, {ISD::SHL, 0, 0, Zeros}, true, false);
+  } else {
+    for (unsigned K = 1; K < 32; K++) {
+      uint32_t Pow = 1u << K;
+      // (x * F << K) + x and (x * F << K) - x
+      if (((C - 1) & (Pow - 1)) == 0)
+        Try((C - 1) >> K, {ISD::ADD, 0, 0, K}, true, false);
+      if (((C + 1) & (Pow - 1)) == 0)
+        Try((C + 1) >> K, {ISD::SUB, 0, 0, K}, true, false);
+      // ((x * F) << K) + x * F and ((x * F) << K) - x * F
+      if (C % (Pow + 1) == 0)
+        Try(C / (Pow + 1), {ISD::ADD, 0, 0, K}, true, true);
+      if (K > 1 && C % (Pow - 1) == 0)
+        Try(C / (Pow - 1), {ISD::SUB, 0, 0, K}, true, true);
+      // (x << K) - x * F
+      if (Pow > C)
+        Try(Pow - C, {ISD::SUB, 0, 0, K}, false, true, true);
+      if (Pow > C)
+        break;
+    }
+  }
+
+  if (BestCost != ~0u)
+    Steps.append(Best.begin(), Best.end());
+  return BestCost;
+}
+
+SDValue PatmosTargetLowering::PerformMULCombine(SDNode *N,
+                                               DAGCombinerInfo &DCI) const {
+  SelectionDAG &DAG = DCI.DAG;
+  EVT VT = N->getValueType(0);
+  SDValue N0 = N->getOperand(0);
+  SDValue N1 = N->getOperand(1);
+  if (VT != MVT::i32)
+    return SDValue();
+  SDLoc dl(N);
+
+  // Use the low word of a product whose high word is needed as well, such
+  // that a single MUL serves both, whose words are read one after another.
+  if (!isa<ConstantSDNode>(N1)) {
+    if (!DCI.isBeforeLegalizeOps())
+      return SDValue();
+    for (SDNode *U : N0->uses()) {
+      unsigned Opc = U->getOpcode();
+      bool Signed = Opc == ISD::MULHS || Opc == ISD::SMUL_LOHI;
+      if (!Signed && Opc != ISD::MULHU && Opc != ISD::UMUL_LOHI)
+        continue;
+
+      SDValue A = U->getOperand(0), B = U->getOperand(1);
+      if (!((A == N0 && B == N1) || (A == N1 && B == N0)))
+        continue;
+
+      SDValue LoHi = DAG.getNode(Signed ? ISD::SMUL_LOHI : ISD::UMUL_LOHI, dl,
+                                 DAG.getVTList(VT, VT), A, B);
+      if (Opc == ISD::MULHS || Opc == ISD::MULHU)
+        DCI.CombineTo(U, LoHi.getValue(1));
+      return LoHi.getValue(0);
+    }
+    return SDValue();
+  }
+
+  // Decompose multiplications by constants into instructions that finish no
+  // later than the multiplication, i.e., the MUL, its latency and the MFS of
+  // the result. They do not need the multiplier, the special registers and
+  // the constant, and they fill the bundles.
+  ConstantSDNode *C = cast<ConstantSDNode>(N1);
+  if (!DecomposeMul || C->isOpaque())
+    return SDValue();
+  APInt Value = C->getAPIntValue();
+  if (Value.isNullValue() || Value.abs().isPowerOf2())
+    return SDValue();
+  // p * c is a predicated load of the constant
+  if (N0.getOpcode() == ISD::ZERO_EXTEND &&
+      N0.getOperand(0).getValueType() == MVT::i1)
+    return SDValue();
+
+  unsigned Budget = 2 + Subtarget.getMULLatency();
+  SmallVector<MulStep, 4> Steps;
+  unsigned Cost = findMulSteps(Value.getZExtValue(), Budget, Steps);
+
+  // a negative factor may be cheaper as the negation of its absolute value
+  bool Negate = false;
+  if (Value.isNegative()) {
+    SmallVector<MulStep, 4> NegSteps;
+    unsigned NegCost = findMulSteps(Value.abs().getZExtValue(), Budget - 1,
+                                    NegSteps);
+    if (NegCost != ~0u && (Cost == ~0u || NegCost + 1 < Cost)) {
+      Steps = std::move(NegSteps);
+      Negate = true;
+      Cost = NegCost + 1;
+    }
+  }
+  if (Cost == ~0u)
+    return SDValue();
+
+  SmallVector<SDValue, 5> Values;
+  Values.push_back(N0);
+  for (const MulStep &S : Steps) {
+    SDValue V = Values[S.A];
+    if (S.Shift)
+      V = DAG.getNode(ISD::SHL, dl, VT, V, DAG.getConstant(S.Shift, dl, VT));
+    if (S.Opcode != ISD::SHL)
+      V = DAG.getNode(S.Opcode, dl, VT, V, Values[S.B]);
+    Values.push_back(V);
+  }
+
+  SDValue Result = Values.back();
+  if (Negate)
+    Result = DAG.getNode(ISD::SUB, dl, VT, DAG.getConstant(0, dl, VT), Result);
+  return Result;
+}
+
+/// isBoolLoad - Return true if the load reads a boolean, i.e., an i1, or an
+/// i8 that is only truncated to i1, as the booleans of C are read.
+static bool isBoolLoad(const LoadSDNode *L) {
+  if (!L->isSimple() || !L->isUnindexed() ||
+      L->getExtensionType() != ISD::NON_EXTLOAD)
+    return false;
+
+  EVT VT = L->getMemoryVT();
+  if (VT == MVT::i1)
+    return true;
+  if (VT != MVT::i8 || !L->hasAnyUseOfValue(0))
+    return false;
+  for (SDNode::use_iterator UI = L->use_begin(), UE = L->use_end(); UI != UE;
+       ++UI) {
+    if (UI.getUse().getResNo() == 0 &&
+        (UI->getOpcode() != ISD::TRUNCATE || UI->getValueType(0) != MVT::i1))
+      return false;
+  }
+  return true;
+}
+
+SDValue PatmosTargetLowering::PerformLOADCombine(SDNode *N,
+                                                DAGCombinerInfo &DCI) const {
+  LoadSDNode *L = cast<LoadSDNode>(N);
+  if (!MergeBoolLoads || !DCI.isBeforeLegalize() || !isBoolLoad(L))
+    return SDValue();
+
+  // the booleans must be within a word of a base aligned to words
+  SelectionDAG &DAG = DCI.DAG;
+  BaseIndexOffset Addr = BaseIndexOffset::match(L, DAG);
+  if (!Addr.getBase().getNode() || Addr.getIndex().getNode() ||
+      !Addr.hasValidOffset())
+    return SDValue();
+  MaybeAlign BaseAlign = DAG.InferPtrAlign(Addr.getBase());
+  if (!BaseAlign || *BaseAlign < Align(4))
+    return SDValue();
+  int64_t WordOffset = Addr.getOffset() & ~int64_t(3);
+
+  // the other booleans of the word read on the same chain, no store is in
+  // between
+  SDValue Chain = L->getChain();
+  SmallVector<std::pair<LoadSDNode *, int64_t>, 4> Bools;
+  SmallPtrSet<SDNode *, 4> Visited;
+  for (SDNode *U : Chain->uses()) {
+    LoadSDNode *O = dyn_cast<LoadSDNode>(U);
+    if (!O || !Visited.insert(O).second || O->getChain() != Chain ||
+        O->getAddressSpace() != L->getAddressSpace() || !isBoolLoad(O))
+      continue;
+
+    int64_t Offset;
+    if (!Addr.equalBaseIndex(BaseIndexOffset::match(O, DAG), DAG, Offset))
+      continue;
+    Offset += Addr.getOffset() - WordOffset;
+    if (Offset >= 0 && Offset < 4)
+      Bools.push_back(std::make_pair(O, Offset));
+  }
+  if (Bools.size() < 2)
+    return SDValue();
+
+  // A byte holds the boolean in its lowest bit, the bytes of a word are
+  // big-endian. The word does not carry the guarantees of the bytes.
+  SDLoc dl(N);
+  MachineMemOperand::Flags Flags = L->getMemOperand()->getFlags() &
+      ~(MachineMemOperand::MODereferenceable | MachineMemOperand::MOInvariant);
+  SDValue Word = DAG.getLoad(
+      MVT::i32, dl, Chain,
+      DAG.getMemBasePlusOffset(Addr.getBase(), TypeSize::Fixed(WordOffset),
+                               dl),
+      L->getPointerInfo().getWithOffset(WordOffset - Addr.getOffset()),
+      Align(4), Flags);
+
+  for (auto &B : Bools) {
+    LoadSDNode *O = B.first;
+    unsigned Bit = 8 * (3 - B.second);
+    SDValue Test = DAG.getSetCC(
+        dl, MVT::i1,
+        DAG.getNode(ISD::AND, dl, MVT::i32, Word,
+                    DAG.getConstant(1u << Bit, dl, MVT::i32)),
+        DAG.getConstant(0, dl, MVT::i32), ISD::SETNE);
+
+    if (O->getMemoryVT() == MVT::i1) {
+      DCI.CombineTo(O, Test, Word.getValue(1));
+      continue;
+    }
+
+    SmallVector<SDNode *, 2> Truncs(O->uses());
+    for (SDNode *T : Truncs)
+      if (T->getOpcode() == ISD::TRUNCATE)
+        DCI.CombineTo(T, Test);
+    DCI.CombineTo(O, DAG.getUNDEF(MVT::i8), Word.getValue(1));
+  }
+  return SDValue(N, 0);
+}
+
+SDValue PatmosTargetLowering::PerformDAGCombine(SDNode *N,
+                                                DAGCombinerInfo &DCI) const {
+  switch (N->getOpcode()) {
+    case ISD::SELECT: return PerformSELECTCombine(N, DCI);
+    case ISD::MUL:    return PerformMULCombine(N, DCI);
+    case ISD::LOAD:   return PerformLOADCombine(N, DCI);
+    default: break;
+  }
+  return SDValue();
+}
+
 EVT PatmosTargetLowering::getSetCCResultType(const DataLayout &DL,
                                              LLVMContext &Context,
                                              EVT VT) const
@@ -216,6 +677,20 @@ const MCExpr * PatmosTargetLowering::LowerCustomJumpTableEntry(
 //                      Custom Lower Operation
 //===----------------------------------------------------------------------===//
 
+void PatmosTargetLowering::ReplaceNodeResults(SDNode *N,
+                                            SmallVectorImpl<SDValue> &Results,
+                                            SelectionDAG &DAG) const {
+  switch (N->getOpcode()) {
+    case ISD::ADD:
+    case ISD::SUB:
+      Results.push_back(LowerADDSUB64(SDValue(N, 0), DAG));
+      break;
+    default:
+      // leave the rest to the type legalizer
+      break;
+  }
+}
+
 SDValue PatmosTargetLowering::LowerLOAD(SDValue Op, SelectionDAG &DAG) const {
   LoadSDNode *load = static_cast<LoadSDNode*>(Op.getNode());
 
@@ -244,6 +719,296 @@ SDValue PatmosTargetLowering::LowerSTORE(SDValue Op, SelectionDAG &DAG) const {
                            store->getMemOperand());
 }
 
+SDValue PatmosTargetLowering::LowerDIVREM(SDValue Op,
+                                          SelectionDAG &DAG) const {
+  unsigned Opc = Op.getOpcode();
+  bool IsSigned = Opc == ISD::SDIV || Opc == ISD::SREM;
+  bool IsRem = Opc == ISD::SREM || Opc == ISD::UREM;
+  EVT VT = Op.getValueType();
+  SDLoc dl(Op);
+
+  assert(VT == MVT::i32 && "Unexpected type for DIV/REM");
+
+  SDValue N = Op.getOperand(0);
+  SDValue D = Op.getOperand(1);
+  SDValue Zero = DAG.getConstant(0, dl, VT);
+  SDValue One = DAG.getConstant(1, dl, VT);
+
+  // Divide the absolute values, the signs are fixed up at the end.
+  SDValue NSign, DSign;
+  if (IsSigned) {
+    SDValue ShAmt = DAG.getConstant(31, dl, VT);
+    NSign = DAG.getNode(ISD::SRA, dl, VT, N, ShAmt);
+    DSign = DAG.getNode(ISD::SRA, dl, VT, D, ShAmt);
+    N = DAG.getNode(ISD::SUB, dl, VT,
+                    DAG.getNode(ISD::XOR, dl, VT, N, NSign), NSign);
+    D = DAG.getNode(ISD::SUB, dl, VT,
+                    DAG.getNode(ISD::XOR, dl, VT, D, DSign), DSign);
+  }
+
+  // Restoring radix-2 division, one quotient bit per step and without
+  // branches. The compare and the subtraction of a step map to a compare
+  // and a predicated instruction.
+  EVT CCVT = getSetCCResultType(DAG.getDataLayout(), *DAG.getContext(), VT);
+  SDValue Q = Zero, R = Zero;
+  for (int i = 31; i >= 0; i--) {
+    SDValue Bit = DAG.getNode(ISD::AND, dl, VT,
+                              DAG.getNode(ISD::SRL, dl, VT, N,
+                                          DAG.getConstant(i, dl, VT)), One);
+    // R is below D before the shift, and below 2^31 if D is not, so the
+    // shift never drops a bit.
+    R = DAG.getNode(ISD::OR, dl, VT,
+                    DAG.getNode(ISD::SHL, dl, VT, R, One), Bit);
+
+    SDValue GE = DAG.getSetCC(dl, CCVT, R, D, ISD::SETUGE);
+    R = DAG.getSelect(dl, VT, GE, DAG.getNode(ISD::SUB, dl, VT, R, D), R);
+
+    if (!IsRem) {
+      Q = DAG.getNode(ISD::OR, dl, VT,
+                      DAG.getNode(ISD::SHL, dl, VT, Q, One),
+                      DAG.getZExtOrTrunc(GE, dl, VT));
+    }
+  }
+
+  SDValue Res = IsRem ? R : Q;
+  if (IsSigned) {
+    // The remainder has the sign of the dividend, the quotient is negative if
+    // the signs of the operands differ.
+    SDValue Sign = IsRem ? NSign : DAG.getNode(ISD::XOR, dl, VT, NSign, DSign);
+    Res = DAG.getNode(ISD::SUB, dl, VT,
+                      DAG.getNode(ISD::XOR, dl, VT, Res, Sign), Sign);
+  }
+  return Res;
+}
+
+/// splitI64 - Return the lower and the upper half of a 64 bit value.
+static std::pair<SDValue, SDValue> splitI64(SDValue V, const SDLoc &dl,
+                                            SelectionDAG &DAG) {
+  SDValue Lo = DAG.getNode(ISD::EXTRACT_ELEMENT, dl, MVT::i32, V,
+                           DAG.getIntPtrConstant(0, dl));
+  SDValue Hi = DAG.getNode(ISD::EXTRACT_ELEMENT, dl, MVT::i32, V,
+                           DAG.getIntPtrConstant(1, dl));
+  return std::make_pair(Lo, Hi);
+}
+
+SDValue PatmosTargetLowering::LowerADDSUB64(SDValue Op,
+                                            SelectionDAG &DAG) const {
+  bool IsAdd = Op.getOpcode() == ISD::ADD;
+  EVT VT = MVT::i32;
+  SDLoc dl(Op);
+
+  assert(Op.getValueType() == MVT::i64 && "Unexpected type for ADD/SUB");
+
+  std::pair<SDValue, SDValue> A = splitI64(Op.getOperand(0), dl, DAG);
+  std::pair<SDValue, SDValue> B = splitI64(Op.getOperand(1), dl, DAG);
+  EVT CCVT = getSetCCResultType(DAG.getDataLayout(), *DAG.getContext(), VT);
+
+  // The halves are independent and go into one bundle. The borrow of a
+  // subtraction only depends on the operands and is computed alongside,
+  // the carry of an addition needs the lower sum. The carry is then added
+  // by a predicated add, instead of materializing it in a register first.
+  unsigned Opc = IsAdd ? ISD::ADD : ISD::SUB;
+  SDValue Lo = DAG.getNode(Opc, dl, VT, A.first, B.first);
+  SDValue Hi = DAG.getNode(Opc, dl, VT, A.second, B.second);
+  SDValue Carry = IsAdd ? DAG.getSetCC(dl, CCVT, Lo, A.first, ISD::SETULT)
+                        : DAG.getSetCC(dl, CCVT, A.first, B.first,
+                                       ISD::SETULT);
+  Hi = DAG.getSelect(dl, VT, Carry,
+                     DAG.getNode(Opc, dl, VT, Hi, DAG.getConstant(1, dl, VT)),
+                     Hi);
+
+  return DAG.getNode(ISD::BUILD_PAIR, dl, MVT::i64, Lo, Hi);
+}
+
+SDValue PatmosTargetLowering::LowerSETCC64(SDValue Op,
+                                           SelectionDAG &DAG) const {
+  ISD::CondCode CC = cast<CondCodeSDNode>(Op.getOperand(2))->get();
+  EVT CCVT = Op.getValueType();
+  SDLoc dl(Op);
+
+  assert(Op.getOperand(0).getValueType() == MVT::i64 &&
+         "Unexpected type for SETCC");
+
+  std::pair<SDValue, SDValue> A = splitI64(Op.getOperand(0), dl, DAG);
+  std::pair<SDValue, SDValue> B = splitI64(Op.getOperand(1), dl, DAG);
+
+  if (CC == ISD::SETEQ || CC == ISD::SETNE) {
+    SDValue LoCmp = DAG.getSetCC(dl, CCVT, A.first, B.first, CC);
+    SDValue HiCmp = DAG.getSetCC(dl, CCVT, A.second, B.second, CC);
+    return DAG.getNode(CC == ISD::SETEQ ? ISD::AND : ISD::OR, dl, CCVT,
+                       LoCmp, HiCmp);
+  }
+
+  // The upper halves decide, unless they are equal. The lower halves are
+  // always compared unsigned, and only the strict compare is needed for the
+  // upper ones.
+  ISD::CondCode HiCC, LoCC;
+  switch (CC) {
+    case ISD::SETLT:  HiCC = ISD::SETLT;  LoCC = ISD::SETULT; break;
+    case ISD::SETLE:  HiCC = ISD::SETLT;  LoCC = ISD::SETULE; break;
+    case ISD::SETGT:  HiCC = ISD::SETGT;  LoCC = ISD::SETUGT; break;
+    case ISD::SETGE:  HiCC = ISD::SETGT;  LoCC = ISD::SETUGE; break;
+    case ISD::SETULT: HiCC = ISD::SETULT; LoCC = ISD::SETULT; break;
+    case ISD::SETULE: HiCC = ISD::SETULT; LoCC = ISD::SETULE; break;
+    case ISD::SETUGT: HiCC = ISD::SETUGT; LoCC = ISD::SETUGT; break;
+    case ISD::SETUGE: HiCC = ISD::SETUGT; LoCC = ISD::SETUGE; break;
+    default:
+      // leave the rest to the type legalizer
+      return SDValue();
+  }
+
+  SDValue HiCmp = DAG.getSetCC(dl, CCVT, A.second, B.second, HiCC);
+  SDValue HiEq = DAG.getSetCC(dl, CCVT, A.second, B.second, ISD::SETEQ);
+  SDValue LoCmp = DAG.getSetCC(dl, CCVT, A.first, B.first, LoCC);
+  return DAG.getNode(ISD::OR, dl, CCVT, HiCmp,
+                     DAG.getNode(ISD::AND, dl, CCVT, HiEq, LoCmp));
+}
+
+SDValue PatmosTargetLowering::LowerShiftParts(SDValue Op,
+                                              SelectionDAG &DAG) const {
+  unsigned Opc = Op.getOpcode();
+  EVT VT = Op.getValueType();
+  SDLoc dl(Op);
+
+  assert(VT == MVT::i32 && "Unexpected type for SHL/SRA/SRL_PARTS");
+
+  SDValue Lo = Op.getOperand(0);
+  SDValue Hi = Op.getOperand(1);
+  SDValue Amt = Op.getOperand(2);
+  SDValue One = DAG.getConstant(1, dl, VT);
+  SDValue Mask = DAG.getConstant(31, dl, VT);
+  EVT CCVT = getSetCCResultType(DAG.getDataLayout(), *DAG.getContext(), VT);
+
+  // The shifters only use the lower five bits of the amount, the masks are
+  // folded into the shifts. The bits crossing over between the halves are
+  // shifted by one and then by 31 - Amt, which is also correct if Amt is a
+  // multiple of 32. Bit 5 of the amount selects between the short and the
+  // long shift.
+  SDValue ShAmt = DAG.getNode(ISD::AND, dl, VT, Amt, Mask);
+  SDValue RevAmt = DAG.getNode(ISD::AND, dl, VT,
+                               DAG.getNode(ISD::XOR, dl, VT, Amt, Mask), Mask);
+  SDValue IsLong = DAG.getSetCC(dl, CCVT,
+                                DAG.getNode(ISD::AND, dl, VT, Amt,
+                                            DAG.getConstant(32, dl, VT)),
+                                DAG.getConstant(0, dl, VT), ISD::SETNE);
+
+  if (Opc == ISD::SHL_PARTS) {
+    SDValue LoS = DAG.getNode(ISD::SHL, dl, VT, Lo, ShAmt);
+    SDValue HiS = DAG.getNode(ISD::OR, dl, VT,
+                              DAG.getNode(ISD::SHL, dl, VT, Hi, ShAmt),
+                              DAG.getNode(ISD::SRL, dl, VT,
+                                          DAG.getNode(ISD::SRL, dl, VT, Lo,
+                                                      One), RevAmt));
+    SDValue Ops[2] = {
+      DAG.getSelect(dl, VT, IsLong, DAG.getConstant(0, dl, VT), LoS),
+      DAG.getSelect(dl, VT, IsLong, LoS, HiS)
+    };
+    return DAG.getMergeValues(Ops, dl);
+  }
+
+  unsigned HiOpc = Opc == ISD::SRA_PARTS ? ISD::SRA : ISD::SRL;
+  SDValue HiS = DAG.getNode(HiOpc, dl, VT, Hi, ShAmt);
+  SDValue LoS = DAG.getNode(ISD::OR, dl, VT,
+                            DAG.getNode(ISD::SRL, dl, VT, Lo, ShAmt),
+                            DAG.getNode(ISD::SHL, dl, VT,
+                                        DAG.getNode(ISD::SHL, dl, VT, Hi,
+                                                    One), RevAmt));
+  SDValue HiL = Opc == ISD::SRA_PARTS ?
+                  DAG.getNode(ISD::SRA, dl, VT, Hi, Mask) :
+                  DAG.getConstant(0, dl, VT);
+  SDValue Ops[2] = {
+    DAG.getSelect(dl, VT, IsLong, HiS, LoS),
+    DAG.getSelect(dl, VT, IsLong, HiL, HiS)
+  };
+  return DAG.getMergeValues(Ops, dl);
+}
+
+SDValue PatmosTargetLowering::LowerCTLZ_CTTZ(SDValue Op,
+                                             SelectionDAG &DAG) const {
+  unsigned Opc = Op.getOpcode();
+  bool IsCTLZ = Opc == ISD::CTLZ || Opc == ISD::CTLZ_ZERO_UNDEF;
+  bool ZeroUndef = Opc == ISD::CTLZ_ZERO_UNDEF || Opc == ISD::CTTZ_ZERO_UNDEF;
+  EVT VT = Op.getValueType();
+  SDLoc dl(Op);
+
+  assert(VT == MVT::i32 && "Unexpected type for CTLZ/CTTZ");
+
+  SDValue X0 = Op.getOperand(0);
+  SDValue Zero = DAG.getConstant(0, dl, VT);
+  EVT CCVT = getSetCCResultType(DAG.getDataLayout(), *DAG.getContext(), VT);
+
+  // Binary search for the first set bit, counting from the top for CTLZ and
+  // from the bottom for CTTZ. Every step tests whether the outermost K bits
+  // are zero and, if so, shifts them out. The updates of a step are
+  // predicated on the same compare, the whole sequence takes 14 cycles.
+  unsigned TestOpc = IsCTLZ ? ISD::SRL : ISD::SHL;
+  unsigned MoveOpc = IsCTLZ ? ISD::SHL : ISD::SRL;
+  SDValue X = X0;
+  SDValue Count = DAG.getConstant(1, dl, VT);
+  for (unsigned K = 16; K > 1; K /= 2) {
+    SDValue Bits = DAG.getNode(TestOpc, dl, VT, X,
+                               DAG.getConstant(32 - K, dl, VT));
+    SDValue IsZero = DAG.getSetCC(dl, CCVT, Bits, Zero, ISD::SETEQ);
+    X = DAG.getSelect(dl, VT, IsZero,
+                      DAG.getNode(MoveOpc, dl, VT, X,
+                                  DAG.getConstant(K, dl, VT)), X);
+    Count = DAG.getSelect(dl, VT, IsZero,
+                          DAG.getNode(ISD::ADD, dl, VT, Count,
+                                      DAG.getConstant(K, dl, VT)), Count);
+  }
+
+  // One of the two outermost bits is set now, unless X is zero.
+  SDValue Last = IsCTLZ ? DAG.getNode(ISD::SRL, dl, VT, X,
+                                      DAG.getConstant(31, dl, VT))
+                        : DAG.getNode(ISD::AND, dl, VT, X,
+                                      DAG.getConstant(1, dl, VT));
+  Count = DAG.getNode(ISD::SUB, dl, VT, Count, Last);
+
+  if (!ZeroUndef) {
+    SDValue IsZero = DAG.getSetCC(dl, CCVT, X0, Zero, ISD::SETEQ);
+    Count = DAG.getSelect(dl, VT, IsZero, DAG.getConstant(32, dl, VT), Count);
+  }
+  return Count;
+}
+
+SDValue PatmosTargetLowering::LowerCTPOP(SDValue Op,
+                                         SelectionDAG &DAG) const {
+  EVT VT = Op.getValueType();
+  SDLoc dl(Op);
+
+  assert(VT == MVT::i32 && "Unexpected type for CTPOP");
+
+  SDValue V = Op.getOperand(0);
+  SDValue One = DAG.getConstant(1, dl, VT);
+  SDValue Two = DAG.getConstant(2, dl, VT);
+  SDValue M55 = DAG.getConstant(0x55555555, dl, VT);
+  SDValue M33 = DAG.getConstant(0x33333333, dl, VT);
+  SDValue M0F = DAG.getConstant(0x0F0F0F0F, dl, VT);
+
+  // Sum up the bits in pairs, nibbles and bytes in parallel.
+  V = DAG.getNode(ISD::SUB, dl, VT, V,
+                  DAG.getNode(ISD::AND, dl, VT,
+                              DAG.getNode(ISD::SRL, dl, VT, V, One), M55));
+  V = DAG.getNode(ISD::ADD, dl, VT,
+                  DAG.getNode(ISD::AND, dl, VT, V, M33),
+                  DAG.getNode(ISD::AND, dl, VT,
+                              DAG.getNode(ISD::SRL, dl, VT, V, Two), M33));
+  V = DAG.getNode(ISD::AND, dl, VT,
+                  DAG.getNode(ISD::ADD, dl, VT, V,
+                              DAG.getNode(ISD::SRL, dl, VT, V,
+                                          DAG.getConstant(4, dl, VT))), M0F);
+
+  // Add up the bytes by shifts instead of a multiplication by 0x01010101,
+  // which would occupy the multiplier and wait for the result in sl.
+  V = DAG.getNode(ISD::ADD, dl, VT, V,
+                  DAG.getNode(ISD::SRL, dl, VT, V,
+                              DAG.getConstant(8, dl, VT)));
+  V = DAG.getNode(ISD::ADD, dl, VT, V,
+                  DAG.getNode(ISD::SRL, dl, VT, V,
+                              DAG.getConstant(16, dl, VT)));
+  return DAG.getNode(ISD::AND, dl, VT, V, DAG.getConstant(0x3f, dl, VT));
+}
+
 SDValue PatmosTargetLowering::LowerMUL_LOHI(SDValue Op,
                                             SelectionDAG &DAG) const {
   unsigned MultOpc;
@@ -261,20 +1026,83 @@ SDValue PatmosTargetLowering::LowerMUL_LOHI(SDValue Op,
   SDValue InChain = DAG.getEntryNode();
   SDValue InGlue = Mul;
 
-  SDValue CopyFromLo = DAG.getCopyFromReg(InChain, dl,
-      Patmos::SL, Ty, InGlue);
-  DAG.ReplaceAllUsesOfValueWith(Op.getValue(0), CopyFromLo);
-  InChain = CopyFromLo.getValue(1);
-  InGlue = CopyFromLo.getValue(2);
+  // Only move the used words out of the special registers, e.g., MULHS,
+  // MULHU and fixed-point multiplications with a scale of 32 need the high
+  // word only. The glued copies cannot be removed later.
+  SDValue CopyFromLo = DAG.getUNDEF(Ty);
+  if (Op.getNode()->hasAnyUseOfValue(0)) {
+    CopyFromLo = DAG.getCopyFromReg(InChain, dl, Patmos::SL, Ty, InGlue);
+    DAG.ReplaceAllUsesOfValueWith(Op.getValue(0), CopyFromLo);
+    InChain = CopyFromLo.getValue(1);
+    InGlue = CopyFromLo.getValue(2);
+  }
 
-  SDValue CopyFromHi = DAG.getCopyFromReg(InChain, dl,
-      Patmos::SH, Ty, InGlue);
-  DAG.ReplaceAllUsesOfValueWith(Op.getValue(1), CopyFromHi);
+  SDValue CopyFromHi = DAG.getUNDEF(Ty);
+  if (Op.getNode()->hasAnyUseOfValue(1)) {
+    CopyFromHi = DAG.getCopyFromReg(InChain, dl, Patmos::SH, Ty, InGlue);
+    DAG.ReplaceAllUsesOfValueWith(Op.getValue(1), CopyFromHi);
+  }
 
   SDValue Vals[] = { CopyFromLo, CopyFromHi };
   return DAG.getMergeValues(Vals, dl);
 }
 
+SDValue PatmosTargetLowering::LowerATOMIC_FENCE(SDValue Op,
+                                                SelectionDAG &DAG) const {
+  // A fence within a single thread only orders the memory accesses of the
+  // thread itself, which the in-order pipeline does anyway.
+  SyncScope::ID FenceSSID =
+      static_cast<SyncScope::ID>(Op.getConstantOperandVal(2));
+  if (FenceSSID == SyncScope::SingleThread)
+    return Op.getOperand(0);
+
+  // Otherwise call __sync_synchronize, which invalidates the data cache
+  return SDValue();
+}
+
+SDValue PatmosTargetLowering::LowerINTRINSIC_W_CHAIN(SDValue Op,
+                                                     SelectionDAG &DAG) const {
+  // The words of the cycle and microsecond counters of the timer in the
+  // local I/O space. Reading a low word latches the high word.
+  static const uint32_t TimerHiCycles = 0xF0020000;
+  static const uint32_t TimerLoCycles = 0xF0020004;
+  static const uint32_t TimerLoUSecs  = 0xF002000C;
+  static const MCPhysReg SpecialRegs[] = {
+    Patmos::S0,  Patmos::S1,  Patmos::SL,  Patmos::SH,
+    Patmos::S4,  Patmos::SS,  Patmos::ST,  Patmos::SRB,
+    Patmos::SRO, Patmos::SXB, Patmos::SXO, Patmos::S11,
+    Patmos::S12, Patmos::S13, Patmos::S14, Patmos::S15
+  };
+
+  SDLoc dl(Op);
+  SDValue Chain = Op.getOperand(0);
+  uint32_t Address;
+  switch (Op.getConstantOperandVal(1)) {
+  case Intrinsic::patmos_cycles:    Address = TimerLoCycles; break;
+  case Intrinsic::patmos_cycles_hi: Address = TimerHiCycles; break;
+  case Intrinsic::patmos_usecs:     Address = TimerLoUSecs;  break;
+  case Intrinsic::patmos_mfs: {
+    uint64_t SReg = Op.getConstantOperandVal(2);
+    if (SReg >= array_lengthof(SpecialRegs))
+      report_fatal_error("Invalid special register s" + Twine(SReg) +
+                         " read in " + DAG.getMachineFunction().getName());
+    // The copy is chained, it stays in order with the other side effects.
+    SDValue Val = DAG.getCopyFromReg(Chain, dl, SpecialRegs[SReg], MVT::i32);
+    return DAG.getMergeValues({Val, Val.getValue(1)}, dl);
+  }
+  default:
+    return SDValue();
+  }
+
+  // A single local load, tagged to be a scheduling boundary, see
+  // PatmosInstrInfo::isTimingRead.
+  SDValue Load = DAG.getLoad(MVT::i32, dl, Chain,
+                             DAG.getConstant(Address, dl, MVT::i32),
+                             MachinePointerInfo(1), Align(4),
+                             MachineMemOperand::MOVolatile | MOTimingRead);
+  return DAG.getMergeValues({Load, Load.getValue(1)}, dl);
+}
+
 SDValue PatmosTargetLowering::LowerRETURNADDR(SDValue Op, SelectionDAG &DAG) const {
   MachineFrameInfo &MFI = DAG.getMachineFunction().getFrameInfo();
   MFI.setReturnAddressIsTaken(true);
@@ -310,12 +1138,64 @@ SDValue PatmosTargetLowering::LowerFRAMEADDR(SDValue Op, SelectionDAG &DAG) cons
   return FrameAddr;
 }
 
+SDValue PatmosTargetLowering::LowerDYNAMIC_STACKALLOC(SDValue Op,
+                                                      SelectionDAG &DAG) const {
+  SDLoc DL(Op);
+  SDValue Chain = Op.getOperand(0);
+  SDValue Size = Op.getOperand(1);
+  MaybeAlign Alignment =
+                   cast<ConstantSDNode>(Op.getOperand(2))->getMaybeAlignValue();
+  EVT VT = Size.getValueType();
+
+  // Functions with dynamic allocas have a frame pointer, the call frames are
+  // allocated below the allocas when the calls are set up, see
+  // PatmosFrameLowering::eliminateCallFramePseudoInstr. Unlike the generic
+  // expansion, the allocation thus needs no call sequence around it. The size
+  // is already rounded to the stack alignment.
+  SDValue SP = DAG.getCopyFromReg(Chain, DL, Patmos::RSP, VT);
+  Chain = SP.getValue(1);
+
+  SDValue NewSP = DAG.getNode(ISD::SUB, DL, VT, SP, Size);
+  if (Alignment && *Alignment > Subtarget.getFrameLowering()->getStackAlign())
+    NewSP = DAG.getNode(ISD::AND, DL, VT, NewSP,
+                        DAG.getConstant(-(uint64_t)Alignment->value(), DL, VT));
+
+  Chain = DAG.getCopyToReg(Chain, DL, Patmos::RSP, NewSP);
+
+  SDValue Ops[2] = { NewSP, Chain };
+  return DAG.getMergeValues(Ops, DL);
+}
+
 //===----------------------------------------------------------------------===//
 //                      Calling Convention Implementation
 //===----------------------------------------------------------------------===//
 
 #include "PatmosGenCallingConv.inc"
 
+/// getArgCC - Return the argument calling convention for CallConv.
+static CCAssignFn *getArgCC(CallingConv::ID CallConv) {
+  return EnableFastCC && CallConv == CallingConv::Fast ? CC_Patmos_Fast
+                                                       : CC_Patmos;
+}
+
+/// getRetCC - Return the return value calling convention for CallConv.
+static CCAssignFn *getRetCC(CallingConv::ID CallConv) {
+  return EnableFastCC && CallConv == CallingConv::Fast ? RetCC_Patmos_Fast
+                                                       : RetCC_Patmos;
+}
+
+bool
+PatmosTargetLowering::CanLowerReturn(CallingConv::ID CallConv,
+                                     MachineFunction &MF, bool isVarArg,
+                                     const SmallVectorImpl<ISD::OutputArg> &Outs,
+                                     LLVMContext &Context) const {
+  // return values that do not fit into the return registers are demoted to
+  // an sret argument
+  SmallVector<CCValAssign, 16> RVLocs;
+  CCState CCInfo(CallConv, isVarArg, MF, RVLocs, Context);
+  return CCInfo.CheckReturn(Outs, getRetCC(CallConv));
+}
+
 SDValue
 PatmosTargetLowering::LowerFormalArguments(SDValue Chain,
                                            CallingConv::ID CallConv, bool isVarArg,
@@ -336,9 +1216,6 @@ PatmosTargetLowering::LowerFormalArguments(SDValue Chain,
 SDValue
 PatmosTargetLowering::LowerCall(CallLoweringInfo &CLI,
                                 SmallVectorImpl<SDValue> &InVals) const {
-  // Patmos target does not yet support tail call optimization.
-  CLI.IsTailCall = false;
-
   switch (CLI.CallConv) {
   default:
     llvm_unreachable("Unsupported calling convention");
@@ -371,7 +1248,7 @@ PatmosTargetLowering::LowerCCCArguments(SDValue Chain,
   SmallVector<CCValAssign, 16> ArgLocs;
 
   CCState CCInfo(CallConv, isVarArg, DAG.getMachineFunction(), ArgLocs, *DAG.getContext());
-  CCInfo.AnalyzeFormalArguments(Ins, CC_Patmos);
+  CCInfo.AnalyzeFormalArguments(Ins, getArgCC(CallConv));
 
   for (unsigned i = 0, e = ArgLocs.size(); i != e; ++i) {
     CCValAssign &VA = ArgLocs[i];
@@ -455,7 +1332,7 @@ PatmosTargetLowering::LowerReturn(SDValue Chain,
   CCState CCInfo(CallConv, isVarArg, DAG.getMachineFunction(), RVLocs, *DAG.getContext());
 
   // Analyze return values.
-  CCInfo.AnalyzeReturn(Outs, RetCC_Patmos);
+  CCInfo.AnalyzeReturn(Outs, getRetCC(CallConv));
 
   SDValue Flag;
   SmallVector<SDValue, 4> RetOps(1, Chain);
@@ -506,12 +1383,20 @@ PatmosTargetLowering::LowerCCCCallTo(CallLoweringInfo &CLI,
   SmallVector<CCValAssign, 16> ArgLocs;
   CCState CCInfo(CallConv, isVarArg, DAG.getMachineFunction(), ArgLocs, *DAG.getContext());
 
-  CCInfo.AnalyzeCallOperands(Outs, CC_Patmos);
+  CCInfo.AnalyzeCallOperands(Outs, getArgCC(CallConv));
 
   // Get a count of how many bytes are to be pushed on the stack.
   unsigned NumBytes = CCInfo.getNextStackOffset();
 
-  Chain = DAG.getCALLSEQ_START(Chain, NumBytes, 0, dl);
+  bool isTailCall = CLI.IsTailCall &&
+                    isEligibleForTailCallOptimization(CLI, ArgLocs, NumBytes);
+  if (CLI.IsTailCall && !isTailCall && CLI.CB && CLI.CB->isMustTailCall())
+    report_fatal_error("failed to perform tail call elimination on a call "
+                       "site marked musttail");
+  CLI.IsTailCall = isTailCall;
+
+  if (!isTailCall)
+    Chain = DAG.getCALLSEQ_START(Chain, NumBytes, 0, dl);
 
   SmallVector<std::pair<unsigned, SDValue>, 4> RegsToPass;
   SmallVector<SDValue, 12> MemOpChains;
@@ -592,6 +1477,21 @@ PatmosTargetLowering::LowerCCCCallTo(CallLoweringInfo &CLI,
     Ops.push_back(DAG.getRegister(RegsToPass[i].first,
                                   RegsToPass[i].second.getValueType()));
 
+  // The tail call terminates the function, the callee returns to our caller.
+  if (isTailCall) {
+    if (InFlag.getNode())
+      Ops.push_back(InFlag);
+
+    DAG.getMachineFunction().getFrameInfo().setHasTailCall();
+    return DAG.getNode(PatmosISD::TAILCALL, dl, MVT::Other, Ops);
+  }
+
+  // Add the registers preserved by the call. With interprocedural register
+  // allocation, the mask is replaced by the registers the callee clobbers.
+  const TargetRegisterInfo *TRI = Subtarget.getRegisterInfo();
+  Ops.push_back(DAG.getRegisterMask(
+      TRI->getCallPreservedMask(DAG.getMachineFunction(), CallConv)));
+
   if (InFlag.getNode())
     Ops.push_back(InFlag);
 
@@ -623,6 +1523,42 @@ PatmosTargetLowering::LowerCCCCallTo(CallLoweringInfo &CLI,
                          DAG, InVals);
 }
 
+bool PatmosTargetLowering::isEligibleForTailCallOptimization(
+                                  CallLoweringInfo &CLI,
+                                  const SmallVectorImpl<CCValAssign> &ArgLocs,
+                                  unsigned NumBytes) const {
+  MachineFunction &MF = CLI.DAG.getMachineFunction();
+  const Function &Caller = MF.getFunction();
+
+  if (!EnableTailCalls || CLI.IsVarArg)
+    return false;
+
+  // The caller's epilogue must run before the branch, single-path code
+  // cannot branch out of the function, interrupt handlers return with xret.
+  if (Caller.hasFnAttribute(Attribute::Naked) ||
+      PatmosSinglePathInfo::isEnabled(MF) ||
+      PatmosFrameLowering::isInterruptHandler(MF))
+    return false;
+
+  // Both functions must agree on the return registers and the shadow stack
+  // must not hold arguments, which would live in the caller's frame.
+  if (CLI.CallConv != Caller.getCallingConv() || NumBytes != 0 ||
+      Caller.hasStructRetAttr())
+    return false;
+
+  for (const CCValAssign &VA : ArgLocs) {
+    if (!VA.isRegLoc())
+      return false;
+  }
+
+  for (const ISD::OutputArg &Out : CLI.Outs) {
+    if (Out.Flags.isByVal() || Out.Flags.isSRet())
+      return false;
+  }
+
+  return true;
+}
+
 /// LowerCallResult - Lower the result values of a call into the
 /// appropriate copies out of appropriate physical registers.
 ///
@@ -637,12 +1573,11 @@ PatmosTargetLowering::LowerCallResult(SDValue Chain, SDValue InFlag,
   SmallVector<CCValAssign, 16> RVLocs;
   CCState CCInfo(CallConv, isVarArg, DAG.getMachineFunction(), RVLocs, *DAG.getContext());
 
-  CCInfo.AnalyzeCallResult(Ins, RetCC_Patmos);
+  CCInfo.AnalyzeCallResult(Ins, getRetCC(CallConv));
 
   // Copy all of the result registers out of their specified physreg.
   for (unsigned i = 0; i != RVLocs.size(); ++i) {
-    assert((RVLocs[i].getLocReg() == Patmos::R1 ||
-            RVLocs[i].getLocReg() == Patmos::R2) && "Invalid return register");
+    assert(RVLocs[i].isRegLoc() && "Invalid return register");
     // We only support i32 return registers, so we copy from i32, no matter what
     // the actual return type in RVLocs[i].getValVT() is.
     SDValue val = DAG.getCopyFromReg( Chain, dl, RVLocs[i].getLocReg(), MVT::i32, InFlag);
@@ -732,6 +1667,7 @@ const char *PatmosTargetLowering::getTargetNodeName(unsigned Opcode) const {
   default: return NULL;
   case PatmosISD::RET_FLAG:           return "PatmosISD::RET_FLAG";
   case PatmosISD::CALL:               return "PatmosISD::CALL";
+  case PatmosISD::TAILCALL:           return "PatmosISD::TAILCALL";
   case PatmosISD::MUL:                return "PatmosISD::MUL";
   case PatmosISD::MULU:               return "PatmosISD::MULU";
   }
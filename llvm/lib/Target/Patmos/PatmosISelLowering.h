@@ -32,6 +32,11 @@ namespace llvm {
       /// multiplication
       MUL, MULU,
 
+      /// TAILCALL - A call in tail position, which branches to the callee
+      /// after the epilogue of the caller. Operand 0 is the chain operand,
+      /// operand 1 the callee, followed by the argument registers.
+      TAILCALL,
+
       /// CALL - These operations represent an abstract call
       /// instruction, which includes a bunch of information.
       CALL = ISD::FIRST_TARGET_MEMORY_OPCODE
@@ -57,6 +62,14 @@ namespace llvm {
     /// LowerOperation - Provide custom lowering hooks for some operations.
     SDValue LowerOperation(SDValue Op, SelectionDAG &DAG) const override;
 
+    /// ReplaceNodeResults - Provide custom lowering hooks for operations with
+    /// an illegal result type, i.e., 64 bit additions and subtractions.
+    void ReplaceNodeResults(SDNode *N, SmallVectorImpl<SDValue> &Results,
+                            SelectionDAG &DAG) const override;
+
+    /// PerformDAGCombine - Provide target specific DAG combines.
+    SDValue PerformDAGCombine(SDNode *N, DAGCombinerInfo &DCI) const override;
+
     /// getTargetNodeName - This method returns the name of a target specific
     /// DAG node.
     const char *getTargetNodeName(unsigned Opcode) const override;
@@ -70,6 +83,18 @@ namespace llvm {
       return 4;
     }
 
+    /// isLegalAddressingMode - Loads and stores only support a base register
+    /// with an unsigned 7 bit offset, scaled by the access size.
+    bool isLegalAddressingMode(const DataLayout &DL, const AddrMode &AM,
+                               Type *Ty, unsigned AddrSpace,
+                               Instruction *I = nullptr) const override;
+
+    /// shouldInsertFencesForAtomic - Atomic loads and stores are selected as
+    /// plain uncached accesses, their ordering is implemented by fences.
+    bool shouldInsertFencesForAtomic(const Instruction *I) const override {
+      return isa<LoadInst>(I) || isa<StoreInst>(I);
+    }
+
     bool isOffsetFoldingLegal(const GlobalAddressSDNode *GA) const {
       // Disallow GlobalAddresses to contain offsets (e.g. x + 4)
       // As patmos-ld doesn't know how to fix that when resolving
@@ -113,6 +138,12 @@ namespace llvm {
     SDValue LowerCCCCallTo(CallLoweringInfo &CLI,
                            SmallVectorImpl<SDValue> &InVals) const;
 
+    /// isEligibleForTailCallOptimization - Check whether the call can be
+    /// lowered to a branch to the callee after the epilogue of the caller.
+    bool isEligibleForTailCallOptimization(CallLoweringInfo &CLI,
+                                  const SmallVectorImpl<CCValAssign> &ArgLocs,
+                                  unsigned NumBytes) const;
+
     SDValue LowerCCCArguments(SDValue Chain,
                               CallingConv::ID CallConv,
                               bool isVarArg,
@@ -135,6 +166,13 @@ namespace llvm {
                                  const SDLoc &dl, SelectionDAG &DAG,
                                  SmallVectorImpl<SDValue> &InVals) const override;
 
+    /// CanLowerReturn - Check whether the return values fit into the return
+    /// registers of the calling convention.
+    bool CanLowerReturn(CallingConv::ID CallConv, MachineFunction &MF,
+                        bool isVarArg,
+                        const SmallVectorImpl<ISD::OutputArg> &Outs,
+                        LLVMContext &Context) const override;
+
     SDValue LowerReturn(SDValue Chain,
                         CallingConv::ID CallConv, bool isVarArg,
                         const SmallVectorImpl<ISD::OutputArg> &Outs,
@@ -145,15 +183,67 @@ namespace llvm {
     /// variadic functions.
     SDValue LowerVASTART(SDValue Op, SelectionDAG &DAG) const;
 
+    /// LowerATOMIC_FENCE - Lower single-thread fences to nothing, other fences
+    /// are calls to __sync_synchronize.
+    SDValue LowerATOMIC_FENCE(SDValue Op, SelectionDAG &DAG) const;
+
+    /// LowerINTRINSIC_W_CHAIN - Lower the reads of the timer to local loads
+    /// and the reads of special registers to copies.
+    SDValue LowerINTRINSIC_W_CHAIN(SDValue Op, SelectionDAG &DAG) const;
+
     /// LowerRETURNADDR - Lower the llvm.returnaddress intrinsic.
     SDValue LowerRETURNADDR(SDValue Op, SelectionDAG &DAG) const;
 
     /// LowerFRAMEADDR - Lower the llvm.frameaddress intrinsic.
     SDValue LowerFRAMEADDR(SDValue Op, SelectionDAG &DAG) const;
 
+    /// LowerDYNAMIC_STACKALLOC - Lower dynamic allocas to a bump of the
+    /// shadow stack pointer.
+    SDValue LowerDYNAMIC_STACKALLOC(SDValue Op, SelectionDAG &DAG) const;
+
     /// LowerMUL_LOHI - Lower Lo/Hi multiplications.
     SDValue LowerMUL_LOHI(SDValue Op, SelectionDAG &DAG) const;
 
+    /// LowerDIVREM - Lower divisions and remainders by a non-constant divisor
+    /// to an inline radix-2 sequence.
+    SDValue LowerDIVREM(SDValue Op, SelectionDAG &DAG) const;
+
+    /// LowerCTLZ_CTTZ - Lower leading and trailing zero counts to a
+    /// branch-free binary search.
+    SDValue LowerCTLZ_CTTZ(SDValue Op, SelectionDAG &DAG) const;
+
+    /// LowerCTPOP - Lower population counts to a sequence of shifts, masks
+    /// and adds.
+    SDValue LowerCTPOP(SDValue Op, SelectionDAG &DAG) const;
+
+    /// PerformSELECTCombine - Invert conditions of selects that would need
+    /// more than a single compare, swapping the operands of the select.
+    SDValue PerformSELECTCombine(SDNode *N, DAGCombinerInfo &DCI) const;
+
+    /// PerformMULCombine - Decompose multiplications by constants into
+    /// shifts, shadds, adds and subtractions, if they are not slower than the
+    /// multiplier, and use the low word of a multiplication whose high word
+    /// is needed as well.
+    SDValue PerformMULCombine(SDNode *N, DAGCombinerInfo &DCI) const;
+
+    /// PerformLOADCombine - Read the booleans within a word aligned to words
+    /// by a single load of the word, each boolean is then a bit test of the
+    /// word instead of a load and a test of its byte.
+    SDValue PerformLOADCombine(SDNode *N, DAGCombinerInfo &DCI) const;
+
+    /// LowerADDSUB64 - Lower 64 bit additions and subtractions, such that
+    /// the halves are computed in parallel and the carry is added by a
+    /// predicated instruction.
+    SDValue LowerADDSUB64(SDValue Op, SelectionDAG &DAG) const;
+
+    /// LowerSETCC64 - Lower comparisons of 64 bit values by comparing the
+    /// halves in parallel and combining the predicates.
+    SDValue LowerSETCC64(SDValue Op, SelectionDAG &DAG) const;
+
+    /// LowerShiftParts - Lower 64 bit shifts by a variable amount, relying on
+    /// the shifters to use only the lower five bits of the amount.
+    SDValue LowerShiftParts(SDValue Op, SelectionDAG &DAG) const;
+
     /// LowerSTORE - Promote i1 store operations to i8.
     SDValue LowerSTORE(SDValue Op, SelectionDAG &DAG) const;
 
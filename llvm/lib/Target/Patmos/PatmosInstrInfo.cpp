@@ -16,8 +16,12 @@
 #include "PatmosInstrInfo.h"
 #include "PatmosMachineFunctionInfo.h"
 #include "PatmosTargetMachine.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/CodeGen/DFAPacketizer.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
@@ -25,18 +29,49 @@
 #include "llvm/CodeGen/PseudoSourceValue.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/MC/MCSectionELF.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/TargetRegistry.h"
 
 using namespace llvm;
 
+static cl::opt<bool> IfCvtMayStall("mpatmos-ifcvt-may-stall",
+  cl::init(true),
+  cl::desc("Let the if-converter predicate loads and stores that may stall "
+           "on a cache miss (default: true)."),
+  cl::Hidden);
+
+static cl::opt<bool> IfCvtCalls("mpatmos-ifcvt-calls",
+  cl::init(true),
+  cl::desc("Let the if-converter predicate calls and returns, together with "
+           "the ensures after the calls and the epilogues before the returns "
+           "(default: true)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> IfCvtMaxCycles("mpatmos-ifcvt-max-cycles",
+  cl::init(32),
+  cl::desc("The maximum cycles of a block the if-converter predicates, "
+           "before bundling (default: 32)."),
+  cl::Hidden);
+
+static cl::opt<bool> OutlineFromLoops("mpatmos-outline-loops",
+  cl::init(false),
+  cl::desc("Let the machine outliner outline sequences from loops, which "
+           "pays the call, the return and possibly two method cache misses "
+           "in every iteration (default: false)."),
+  cl::Hidden);
+
 #define GET_INSTRINFO_CTOR_DTOR
+#define GET_INSTRMAP_INFO
 #include "PatmosGenInstrInfo.inc"
 #include "PatmosGenDFAPacketizer.inc"
 
 PatmosInstrInfo::PatmosInstrInfo(const PatmosTargetMachine &tm)
   : PatmosGenInstrInfo(Patmos::ADJCALLSTACKDOWN, Patmos::ADJCALLSTACKUP),
-    PTM(tm), RI(tm, *this), PST(*tm.getSubtargetImpl()) {}
+    PTM(tm), RI(tm, *this), PST(*tm.getSubtargetImpl()),
+    InlineAsmContext(nullptr) {}
+
+PatmosInstrInfo::~PatmosInstrInfo() = default;
 
 bool PatmosInstrInfo::findCommutedOpIndices(const MachineInstr &MI,
                                             unsigned &SrcOpIdx1,
@@ -71,6 +106,34 @@ bool PatmosInstrInfo::findCommutedOpIndices(const MachineInstr &MI,
   return true;
 }
 
+bool PatmosInstrInfo::isReallyTriviallyReMaterializable(const MachineInstr &MI,
+                                                        AAResults *AA) const {
+  switch (MI.getOpcode())
+  {
+    case Patmos::CMPEQ:  case Patmos::CMPIEQ:
+    case Patmos::CMPNEQ: case Patmos::CMPINEQ:
+    case Patmos::CMPLT:  case Patmos::CMPILT:
+    case Patmos::CMPLE:  case Patmos::CMPILE:
+    case Patmos::CMPULT: case Patmos::CMPIULT:
+    case Patmos::CMPULE: case Patmos::CMPIULE:
+    case Patmos::BTEST:  case Patmos::BTESTI:
+    case Patmos::MOVrp:
+      break;
+    case Patmos::LIi:
+    case Patmos::LIin:
+    case Patmos::LIl:
+      // a long immediate costs two slots of one bundle, a spill costs a store
+      // and a load with a delay slot, rematerializing is still cheaper
+      break;
+    default:
+      return false;
+  }
+
+  // the register allocator checks that the compared values are available at
+  // the new position, only the guard needs to be checked here
+  return !isPredicated(MI);
+}
+
 void PatmosInstrInfo::copyPhysReg(MachineBasicBlock &MBB,
                                   MachineBasicBlock::iterator I, const DebugLoc &DL,
                                   MCRegister DestReg, MCRegister SrcReg,
@@ -230,6 +293,10 @@ bool PatmosInstrInfo::isSchedulingBoundary(const MachineInstr &MI,
   if (MI.getDesc().isTerminator() || MI.isLabel())
     return true;
 
+  // Timing instrumentation must measure exactly the code in between.
+  if (isTimingRead(MI))
+    return true;
+
   // TODO check if we have any other scheduling boundaries (STCs,..)
   //      Ideally, we would like to schedule even over branches and calls
   //      and model everything else as hazards and dependencies.
@@ -273,6 +340,7 @@ bool PatmosInstrInfo::fixOpcodeForGuard(MachineInstr &MI) const {
         case BRCFu: newopc = BRCF; break;
         case BRCFRu:newopc = BRCFR;break;
         case BRCFTu:newopc = BRCFT;break;
+        case BRCFTOu:newopc = BRCFTO;break;
         default:
           assert(MI.isConditionalBranch() ||
                  (MI.isIndirectBranch() && MI.isBarrier()) );
@@ -287,6 +355,7 @@ bool PatmosInstrInfo::fixOpcodeForGuard(MachineInstr &MI) const {
         case BRCF: newopc = BRCFu; break;
         case BRCFR:newopc = BRCFRu;break;
         case BRCFT:newopc = BRCFTu;break;
+        case BRCFTO:newopc = BRCFTOu;break;
         default:
           assert(MI.isUnconditionalBranch() ||
                  (MI.isIndirectBranch() && MI.isBarrier()) );
@@ -551,6 +620,72 @@ PatmosII::MemType PatmosInstrInfo::getMemType(const MachineInstr &MI) const {
 
 }
 
+/// hasCacheClass - Return true if MI is a data cache load with all its memory
+/// operands tagged by Flag.
+static bool hasCacheClass(const MachineInstr &MI,
+                          MachineMemOperand::Flags Flag) {
+  if (!MI.mayLoad() || MI.isBundle() || MI.memoperands_empty())
+    return false;
+  for (const MachineMemOperand *MMO : MI.memoperands())
+    if (!(MMO->getFlags() & Flag))
+      return false;
+  return true;
+}
+
+bool PatmosInstrInfo::isAlwaysHit(const MachineInstr &MI) const {
+  return hasCacheClass(MI, MOAlwaysHit);
+}
+
+bool PatmosInstrInfo::isFirstMiss(const MachineInstr &MI) const {
+  return hasCacheClass(MI, MOFirstMiss);
+}
+
+bool PatmosInstrInfo::isDirectFrameAccess(const MachineInstr &MI,
+                                          unsigned OpNo) const {
+  switch (MI.getOpcode()) {
+    case Patmos::LWC: case Patmos::LWM:
+    case Patmos::LHC: case Patmos::LHM:
+    case Patmos::LHUC: case Patmos::LHUM:
+    case Patmos::LBC: case Patmos::LBM:
+    case Patmos::LBUC: case Patmos::LBUM:
+      return OpNo == 3;
+    case Patmos::SWC: case Patmos::SWM:
+    case Patmos::SHC: case Patmos::SHM:
+    case Patmos::SBC: case Patmos::SBM:
+      return OpNo == 2;
+    default:
+      return false;
+  }
+}
+
+unsigned PatmosInstrInfo::getShadowStackAccessCost(const MachineInstr &MI,
+                                                   unsigned OpNo) const {
+  if (!isDirectFrameAccess(MI, OpNo))
+    return 0;
+
+  // the data cache of the shadow stack is written through, a load is charged
+  // a miss, as the data cache analysis has not run yet
+  return PST.getMemoryBurstCycles();
+}
+
+bool PatmosInstrInfo::isTimingRead(const MachineInstr &MI) const {
+  if (!MI.mayLoad() || MI.isBundle())
+    return false;
+  for (const MachineMemOperand *MMO : MI.memoperands())
+    if (MMO->getFlags() & MOTimingRead)
+      return true;
+  return false;
+}
+
+ArrayRef<std::pair<MachineMemOperand::Flags, const char *>>
+PatmosInstrInfo::getSerializableMachineMemOperandTargetFlags() const {
+  static const std::pair<MachineMemOperand::Flags, const char *> Flags[] = {
+    {MOAlwaysHit, "patmos-always-hit"},
+    {MOFirstMiss, "patmos-first-miss"},
+    {MOTimingRead, "patmos-timing-read"}};
+  return makeArrayRef(Flags);
+}
+
 bool PatmosInstrInfo::isPseudo(const MachineInstr *MI) const {
 
   if (MI->isBundle()) {
@@ -696,19 +831,72 @@ PatmosInstrInfo::createPatmosInstrAnalyzer(MCContext &Ctx,
   return PIA;
 }
 
-unsigned int PatmosInstrInfo::getInstrSize(const MachineInstr *MI) const {
-  if (MI->isInlineAsm()) {
-    PatmosAsmPrinter PAP((PatmosTargetMachine&)PTM,
-        createPatmosInstrAnalyzer(MI->getMF()->getContext(), *PTM.getInstrInfo()));
-    PAP.setMachineModuleInfo(&MI->getMF()->getMMI());
+unsigned int PatmosInstrInfo::getInlineAsmSize(const MachineInstr *MI) const {
+  const char *AsmStr =
+                  MI->getOperand(InlineAsm::MIOp_AsmString).getSymbolName();
+
+  // empty inline asm, e.g., used as compiler barrier
+  if (AsmStr[0] == 0) {
+    return 0;
+  }
+
+  // The operands and the symbols of the parsed inline asm belong to the
+  // MCContext, the printer and the cached sizes are only valid for it.
+  MCContext &Ctx = MI->getMF()->getContext();
+  if (InlineAsmContext != &Ctx) {
+    InlineAsmSizes.clear();
+    ExpandedInlineAsmSizes.clear();
+    InlineAsmPrinter = std::make_unique<PatmosAsmPrinter>(
+        (PatmosTargetMachine&)PTM,
+        createPatmosInstrAnalyzer(Ctx, *PTM.getInstrInfo()));
+    InlineAsmContext = &Ctx;
+  }
+
+  // The expanded asm string, and thus the size, only depends on the asm
+  // string and the operands substituted into it.
+  std::string Key(AsmStr);
+  for (unsigned i = InlineAsm::MIOp_AsmString + 1, e = MI->getNumOperands();
+       i != e; ++i) {
+    size_t H = hash_value(MI->getOperand(i));
+    Key.append(1, '\0');
+    Key.append((const char*)&H, sizeof(H));
+  }
+
+  StringMap<unsigned>::iterator it = InlineAsmSizes.find(Key);
+  if (it != InlineAsmSizes.end()) {
+    return it->second;
+  }
 
-    // This call will parse the inline asm and emit each instruction through PatmosInstrAnalyzer.
-    // PatmosInstrAnalyzer doesn't actually emit the instructions, instead it just sums their sizes.
-    PAP.mockEmitInlineAsmForSizeCount(MI);
+  InlineAsmPrinter->setMachineModuleInfo(&MI->getMF()->getMMI());
 
-    // we then get back the PatmosInstrAnalyzer which now has summed
-    // the size of the instructions in the inline asm.
-    return ((PatmosInstrAnalyzer*)PAP.OutStreamer.get())->getSize();
+  SmallString<256> Expanded;
+  InlineAsmPrinter->expandInlineAsm(MI, Expanded);
+
+  StringMap<unsigned>::iterator eit = ExpandedInlineAsmSizes.find(Expanded);
+  if (eit != ExpandedInlineAsmSizes.end()) {
+    InlineAsmSizes[Key] = eit->second;
+    return eit->second;
+  }
+
+  // This call will parse the inline asm and emit each instruction through PatmosInstrAnalyzer.
+  // PatmosInstrAnalyzer doesn't actually emit the instructions, instead it just sums their sizes.
+  PatmosInstrAnalyzer *PIA =
+      (PatmosInstrAnalyzer*)InlineAsmPrinter->OutStreamer.get();
+  PIA->reset();
+  InlineAsmPrinter->parseInlineAsm(Expanded);
+
+  // we then get back the PatmosInstrAnalyzer which now has summed
+  // the size of the instructions in the inline asm.
+  unsigned Size = PIA->getSize();
+
+  ExpandedInlineAsmSizes[Expanded] = Size;
+  InlineAsmSizes[Key] = Size;
+  return Size;
+}
+
+unsigned int PatmosInstrInfo::getInstrSize(const MachineInstr *MI) const {
+  if (MI->isInlineAsm()) {
+    return getInlineAsmSize(MI);
   }
   else if (MI->isBundle()) {
     const MachineBasicBlock *MBB = MI->getParent();
@@ -754,7 +942,9 @@ bool PatmosInstrInfo::mayStall(const MachineInstr *MI) const {
   } else if (MI->isPseudo()) {
     return false;
   }
-  // We could check for load instructions if they are always-hit.
+  // loads the data cache analysis proved to hit do not stall
+  if (isAlwaysHit(*MI))
+    return false;
   return isPatmosMayStall(MI->getDesc().TSFlags);
 }
 
@@ -768,6 +958,128 @@ bool PatmosInstrInfo::mayStall(const MachineBasicBlock &MBB) const {
   return false;
 }
 
+bool PatmosInstrInfo::isSinglePath(const MachineBasicBlock &MBB) const {
+  return MBB.getParent()->getInfo<PatmosMachineFunctionInfo>()->isSinglePath();
+}
+
+bool PatmosInstrInfo::isConstantTime(const MachineBasicBlock &MBB) const {
+  return MBB.getParent()->getFunction().hasFnAttribute("patmos-constant-time");
+}
+
+bool PatmosInstrInfo::canIfCvtSinglePath(const MachineBasicBlock &MBB) const {
+  for (auto it = MBB.begin(), ie = MBB.end();
+       it != ie; it++)
+  {
+    if (hasCall(&*it) || it->isReturn())
+      return false;
+  }
+  return true;
+}
+
+bool PatmosInstrInfo::canIfCvtCalls(const MachineBasicBlock &MBB) const {
+  if (IfCvtCalls)
+    return true;
+  return canIfCvtSinglePath(MBB);
+}
+
+unsigned
+PatmosInstrInfo::getIfCvtBranchCycles(const MachineBasicBlock &MBB) const {
+  const Function &F = MBB.getParent()->getFunction();
+  bool Local = !PST.hasMethodCache() ||
+               F.getInstructionCount() * 4 <= PST.getMaxSubfunctionSize();
+  return 1 + PST.getCFLDelaySlotCycles(Local);
+}
+
+unsigned PatmosInstrInfo::getIfCvtPredicatedCycles(unsigned NumCycles) const {
+  // predicated code has no dependencies on the code of the other path, it
+  // fills the second slot of the bundles
+  if (PST.enableBundling(PTM.getOptLevel()))
+    return (NumCycles + 1) / 2;
+  return NumCycles;
+}
+
+bool PatmosInstrInfo::canIfCvtMemory(const MachineBasicBlock &MBB) const {
+  for (const MachineInstr &MI : MBB) {
+    if (!mayStall(&MI))
+      continue;
+    // a predicated call or return fills the method cache only if it
+    // executes, like the branched one
+    if ((MI.isCall() || MI.isReturn()) && IfCvtCalls)
+      continue;
+    if (!IfCvtMayStall || MI.isBranch() || MI.isCall() || MI.isReturn() ||
+        MI.isInlineAsm() || !(MI.mayLoad() || MI.mayStore()))
+      return false;
+  }
+  return true;
+}
+
+/// The costs are compared in fractions of cycles, for the probabilities.
+static const uint64_t IfCvtCycleScale = 256;
+
+bool PatmosInstrInfo::isProfitableToIfCvt(MachineBasicBlock &MBB,
+                                          unsigned NumCycles,
+                                          unsigned ExtraPredCycles,
+                                          BranchProbability Probability) const {
+  if (isSinglePath(MBB) || isConstantTime(MBB))
+    return canIfCvtSinglePath(MBB);
+
+  if (NumCycles > IfCvtMaxCycles || !canIfCvtCalls(MBB) ||
+      !canIfCvtMemory(MBB))
+    return false;
+
+  // Branched, the branch always executes, the block with the probability.
+  // Predicated, the block always executes, bundled with the code around it.
+  uint64_t Branched = getIfCvtBranchCycles(MBB) * IfCvtCycleScale +
+                      Probability.scale(NumCycles * IfCvtCycleScale);
+  uint64_t Predicated = getIfCvtPredicatedCycles(NumCycles + ExtraPredCycles) *
+                        IfCvtCycleScale;
+  return Predicated <= Branched;
+}
+
+bool PatmosInstrInfo::isProfitableToIfCvt(MachineBasicBlock &TMBB,
+                                          unsigned NumTCycles,
+                                          unsigned ExtraTCycles,
+                                          MachineBasicBlock &FMBB,
+                                          unsigned NumFCycles,
+                                          unsigned ExtraFCycles,
+                                          BranchProbability Probability) const {
+  if (isSinglePath(TMBB) || isConstantTime(TMBB))
+    return canIfCvtSinglePath(TMBB) && canIfCvtSinglePath(FMBB);
+
+  if (NumTCycles > IfCvtMaxCycles || NumFCycles > IfCvtMaxCycles ||
+      !canIfCvtCalls(TMBB) || !canIfCvtCalls(FMBB) ||
+      !canIfCvtMemory(TMBB) || !canIfCvtMemory(FMBB))
+    return false;
+
+  // Branched, the true block also branches over the false block at its end.
+  // Predicated, both blocks execute and fill the bundles of each other.
+  unsigned BranchCycles = getIfCvtBranchCycles(TMBB);
+  uint64_t Branched =
+      BranchCycles * IfCvtCycleScale +
+      Probability.scale((NumTCycles + BranchCycles) * IfCvtCycleScale) +
+      Probability.getCompl().scale(NumFCycles * IfCvtCycleScale);
+  uint64_t Predicated =
+      getIfCvtPredicatedCycles(NumTCycles + ExtraTCycles + NumFCycles +
+                               ExtraFCycles) * IfCvtCycleScale;
+  return Predicated <= Branched;
+}
+
+bool PatmosInstrInfo::isProfitableToDupForIfCvt(
+    MachineBasicBlock &MBB, unsigned NumCycles,
+    BranchProbability Probability) const {
+  // Keep to simple triangles and diamonds in single-path code
+  if (isSinglePath(MBB))
+    return false;
+  // duplicate whatever it takes to remove a branch of constant-time code
+  if (isConstantTime(MBB))
+    return canIfCvtSinglePath(MBB);
+
+  if (!canIfCvtSinglePath(MBB))
+    return false;
+  // the duplicated code must not cost more than the branch it removes
+  return NumCycles <= getIfCvtBranchCycles(MBB) + 1;
+}
+
 bool PatmosInstrInfo::canRemoveFromSchedule(MachineBasicBlock &MBB,
                                             const MachineBasicBlock::iterator &II) const
 {
@@ -1121,6 +1433,433 @@ reverseBranchCondition(SmallVectorImpl<MachineOperand> &Cond) const {
   return false; //success
 }
 
+namespace {
+  /// PatmosPipelinerLoopInfo - Describes a loop for the MachinePipeliner that
+  /// continues while a compare of an induction variable with its bound holds.
+  ///
+  /// The value compared in iteration i (counting from 0) is
+  /// Init + (i + Offset) * Step. The compare in the kernel is rewritten to use
+  /// a counter of its own, since the compare might end up in any stage of the
+  /// pipelined loop.
+  class PatmosPipelinerLoopInfo : public TargetInstrInfo::PipelinerLoopInfo {
+    const PatmosInstrInfo &PII;
+    MachineRegisterInfo &MRI;
+    MachineInstr *Branch;
+    DebugLoc DL;
+
+    /// The compare of the loop and the position of the induction variable.
+    unsigned CmpOpcode;
+    unsigned IVIdx;
+    bool BoundIsImm;
+    int64_t BoundImm;
+    Register BoundReg;
+
+    /// The induction variable.
+    Register Init;
+    int64_t Step;
+    int64_t Offset;
+
+    /// The flag of the loop branch, and whether it exits the loop.
+    int64_t BrFlag;
+    bool CondExits;
+
+    MachineBasicBlock *Preheader;
+
+    /// emitAdd - Emit Dst = Base + Imm before I.
+    void emitAdd(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                 Register Dst, Register Base, int64_t Imm) const
+    {
+      unsigned Opc;
+      if (Imm >= 0)
+        Opc = Imm <= 0xFFF ? Patmos::ADDi : Patmos::ADDl;
+      else
+        Opc = -Imm <= 0xFFF ? Patmos::SUBi : Patmos::SUBl;
+
+      AddDefaultPred(BuildMI(MBB, I, DL, PII.get(Opc), Dst))
+        .addReg(Base).addImm(Imm >= 0 ? Imm : -Imm);
+    }
+
+    /// emitCompare - Emit a copy of the loop compare for the value Val
+    /// before I and return the exit condition in Cond.
+    void emitCompare(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                     Register Val, SmallVectorImpl<MachineOperand> &Cond) const
+    {
+      Register P = MRI.createVirtualRegister(&Patmos::PRegsRegClass);
+      MachineInstrBuilder MIB =
+        AddDefaultPred(BuildMI(MBB, I, DL, PII.get(CmpOpcode), P));
+      for (unsigned i = 3; i < 5; i++) {
+        if (i == IVIdx)
+          MIB.addReg(Val);
+        else if (BoundIsImm)
+          MIB.addImm(BoundImm);
+        else
+          MIB.addReg(BoundReg);
+      }
+
+      Cond.push_back(MachineOperand::CreateReg(P, false));
+      Cond.push_back(MachineOperand::CreateImm(CondExits ? BrFlag
+                                                         : (BrFlag ? 0 : -1)));
+    }
+
+  public:
+    PatmosPipelinerLoopInfo(const PatmosInstrInfo &PII,
+                            MachineInstr *Branch, MachineInstr *Cmp,
+                            unsigned IVIdx, Register Init, int64_t Step,
+                            int64_t Offset, int64_t BrFlag, bool CondExits)
+    : PII(PII), MRI(Branch->getMF()->getRegInfo()), Branch(Branch),
+      DL(Branch->getDebugLoc()), CmpOpcode(Cmp->getOpcode()), IVIdx(IVIdx),
+      BoundIsImm(false), BoundImm(0), Init(Init), Step(Step), Offset(Offset),
+      BrFlag(BrFlag), CondExits(CondExits), Preheader(0)
+    {
+      const MachineOperand &Bound = Cmp->getOperand(IVIdx == 3 ? 4 : 3);
+      if (Bound.isImm()) {
+        BoundIsImm = true;
+        BoundImm = Bound.getImm();
+      }
+      else {
+        BoundReg = Bound.getReg();
+      }
+    }
+
+    bool shouldIgnoreForPipelining(const MachineInstr *MI) const override {
+      return MI == Branch;
+    }
+
+    Optional<bool>
+    createTripCountGreaterCondition(int TC, MachineBasicBlock &MBB,
+                        SmallVectorImpl<MachineOperand> &Cond) override {
+      // The loop executes more than TC iterations if it continues after
+      // iteration TC - 1. The condition branches to the epilog otherwise.
+      Register Val = MRI.createVirtualRegister(&Patmos::RRegsRegClass);
+      emitAdd(MBB, MBB.end(), Val, Init, (TC - 1 + Offset) * Step);
+      emitCompare(MBB, MBB.end(), Val, Cond);
+      return {};
+    }
+
+    void setPreheader(MachineBasicBlock *NewPreheader) override {
+      Preheader = NewPreheader;
+    }
+
+    void adjustTripCount(int TripCountAdjust) override {
+      assert(Preheader && TripCountAdjust <= 0);
+
+      MachineBasicBlock *Kernel = 0;
+      for (MachineBasicBlock::succ_iterator I = Preheader->succ_begin(),
+           E = Preheader->succ_end(); I != E; ++I) {
+        if ((*I)->isSuccessor(*I))
+          Kernel = *I;
+      }
+
+      MachineBasicBlock *TBB = 0, *FBB = 0;
+      SmallVector<MachineOperand, 2> KCond;
+      if (!Kernel || PII.analyzeBranch(*Kernel, TBB, FBB, KCond) ||
+          KCond.empty()) {
+        report_fatal_error("Unexpected kernel of a pipelined loop.");
+      }
+      MachineInstr *KCmp = MRI.getVRegDef(KCond[0].getReg());
+
+      // Iteration j of the kernel has to compare the value of iteration
+      // j - TripCountAdjust in the stage of the compare. A new counter,
+      // starting one step before that, provides the value.
+      Register Start = MRI.createVirtualRegister(&Patmos::RRegsRegClass);
+      Register Ctr = MRI.createVirtualRegister(&Patmos::RRegsRegClass);
+      Register CtrNext = MRI.createVirtualRegister(&Patmos::RRegsRegClass);
+
+      emitAdd(*Preheader, Preheader->getFirstTerminator(), Start, Init,
+              (Offset - TripCountAdjust - 1) * Step);
+      BuildMI(*Kernel, Kernel->begin(), DL, PII.get(TargetOpcode::PHI), Ctr)
+        .addReg(Start).addMBB(Preheader)
+        .addReg(CtrNext).addMBB(Kernel);
+      emitAdd(*Kernel, KCmp, CtrNext, Ctr, Step);
+      KCmp->getOperand(IVIdx).setReg(CtrNext);
+
+      // Keep the loop bounds of the kernel in sync for the WCET analysis.
+      std::pair<int,int> Bounds = getLoopBounds(Kernel);
+      if (Bounds.second >= 0) {
+        setLoopBounds(Kernel, std::max(Bounds.first + TripCountAdjust, 0),
+                              std::max(Bounds.second + TripCountAdjust, 0));
+      }
+    }
+
+    void disposed() override {}
+  };
+}
+
+std::unique_ptr<TargetInstrInfo::PipelinerLoopInfo>
+PatmosInstrInfo::analyzeLoopForPipelining(MachineBasicBlock *LoopBB) const {
+  if (isSinglePath(*LoopBB))
+    return nullptr;
+
+  MachineBasicBlock *TBB = 0, *FBB = 0;
+  SmallVector<MachineOperand, 2> Cond;
+  if (analyzeBranch(*LoopBB, TBB, FBB, Cond) || Cond.empty())
+    return nullptr;
+
+  bool CondExits;
+  if (TBB == LoopBB)
+    CondExits = false;
+  else if (FBB == LoopBB)
+    CondExits = true;
+  else
+    return nullptr;
+
+  // The predicate of the branch is computed by a compare in the loop, only
+  // used by the branch.
+  const MachineRegisterInfo &MRI = LoopBB->getParent()->getRegInfo();
+  Register P = Cond[0].getReg();
+  if (!P.isVirtual() || !MRI.hasOneNonDBGUse(P))
+    return nullptr;
+
+  MachineInstr *Cmp = MRI.getVRegDef(P);
+  if (!Cmp || Cmp->getParent() != LoopBB || isPredicated(*Cmp))
+    return nullptr;
+
+  switch (Cmp->getOpcode()) {
+    case Patmos::CMPEQ:  case Patmos::CMPNEQ:
+    case Patmos::CMPLT:  case Patmos::CMPLE:
+    case Patmos::CMPULT: case Patmos::CMPULE:
+    case Patmos::CMPIEQ:  case Patmos::CMPINEQ:
+    case Patmos::CMPILT:  case Patmos::CMPILE:
+    case Patmos::CMPIULT: case Patmos::CMPIULE:
+      break;
+    default:
+      return nullptr;
+  }
+
+  // Find the induction variable and a loop-invariant bound.
+  for (unsigned IVIdx = 3; IVIdx < 5; IVIdx++) {
+    const MachineOperand &IV = Cmp->getOperand(IVIdx);
+    const MachineOperand &Bound = Cmp->getOperand(IVIdx == 3 ? 4 : 3);
+    if (!IV.isReg() || !IV.getReg().isVirtual())
+      continue;
+    if (Bound.isReg() && (!Bound.getReg().isVirtual() ||
+                          !MRI.getVRegDef(Bound.getReg()) ||
+                          MRI.getVRegDef(Bound.getReg())->getParent() == LoopBB))
+      continue;
+
+    MachineInstr *Def = MRI.getVRegDef(IV.getReg());
+    MachineInstr *Phi = Def, *Inc = 0;
+    int64_t Offset = 0;
+    if (Def && !Def->isPHI()) {
+      if (Def->getNumOperands() < 4)
+        continue;
+      Inc = Def;
+      Phi = Inc->getOperand(3).isReg() ?
+                          MRI.getVRegDef(Inc->getOperand(3).getReg()) : 0;
+      Offset = 1;
+    }
+    if (!Phi || !Phi->isPHI() || Phi->getParent() != LoopBB ||
+        Phi->getNumOperands() != 5)
+      continue;
+
+    // Get the initial value and the update of the PHI
+    Register Init, Next;
+    for (unsigned i = 1; i < 5; i += 2) {
+      if (Phi->getOperand(i + 1).getMBB() == LoopBB)
+        Next = Phi->getOperand(i).getReg();
+      else
+        Init = Phi->getOperand(i).getReg();
+    }
+    if (!Init || !Next || (Inc && Inc->getOperand(0).getReg() != Next))
+      continue;
+
+    Inc = MRI.getVRegDef(Next);
+    if (!Inc || Inc->getParent() != LoopBB)
+      continue;
+
+    int64_t Step;
+    switch (Inc->getOpcode()) {
+      case Patmos::ADDi: case Patmos::ADDl:
+        Step = Inc->getOperand(4).getImm();
+        break;
+      case Patmos::SUBi: case Patmos::SUBl:
+        Step = -Inc->getOperand(4).getImm();
+        break;
+      default:
+        continue;
+    }
+    if (Step == 0 || isPredicated(*Inc) ||
+        Inc->getOperand(3).getReg() != Phi->getOperand(0).getReg())
+      continue;
+
+    return std::make_unique<PatmosPipelinerLoopInfo>(*this,
+                        &*LoopBB->getFirstTerminator(), Cmp, IVIdx, Init, Step,
+                        Offset, Cond[1].getImm(), CondExits);
+  }
+
+  return nullptr;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Machine outliner
+//
+
+/// How an outlined function is called and returns, there is only a CALL and
+/// a RET.
+enum PatmosOutlinerConstructionID {
+  PatmosOutlinerDefault
+};
+
+/// Flags of the blocks outlined from, see isMBBSafeToOutlineFrom.
+enum PatmosOutlinerMBBFlags {
+  PatmosOutlinerInLoop = 0x1
+};
+
+/// The special registers an outlined sequence must not access: the return
+/// addresses overwritten by the call, and the stack cache pointers the stack
+/// control of the function manages. Loads and stores of the stack cache only
+/// read ST, which the call leaves unchanged.
+static const MCPhysReg OutlinerSRegs[] = {
+  Patmos::SRB, Patmos::SRO, Patmos::SXB, Patmos::SXO, Patmos::SS, Patmos::ST
+};
+
+/// isInCycle - Return true if MBB is reachable from its successors.
+static bool isInCycle(MachineBasicBlock &MBB) {
+  SmallPtrSet<MachineBasicBlock*, 16> Visited;
+  SmallVector<MachineBasicBlock*, 16> Worklist(MBB.succ_begin(),
+                                               MBB.succ_end());
+  while (!Worklist.empty()) {
+    MachineBasicBlock *Succ = Worklist.pop_back_val();
+    if (Succ == &MBB)
+      return true;
+    if (Visited.insert(Succ).second)
+      Worklist.append(Succ->succ_begin(), Succ->succ_end());
+  }
+  return false;
+}
+
+bool PatmosInstrInfo::isFunctionSafeToOutlineFrom(
+    MachineFunction &MF, bool OutlineFromLinkOnceODRs) const {
+  const Function &F = MF.getFunction();
+
+  // the linker may drop the function including the outlined code it calls
+  if (!OutlineFromLinkOnceODRs && F.hasLinkOnceODRLinkage())
+    return false;
+
+  // the code is expected in the section of the function
+  if (F.hasSection())
+    return false;
+
+  // single-path code is converted already, its timing must not change
+  if (MF.empty() || isSinglePath(MF.front()))
+    return false;
+
+  // the return address of a leaf function stays in SRB and SRO
+  return MF.getFrameInfo().hasCalls();
+}
+
+bool PatmosInstrInfo::isMBBSafeToOutlineFrom(MachineBasicBlock &MBB,
+                                             unsigned &Flags) const {
+  if (!TargetInstrInfo::isMBBSafeToOutlineFrom(MBB, Flags))
+    return false;
+
+  if (isInCycle(MBB))
+    Flags |= PatmosOutlinerInLoop;
+  return true;
+}
+
+outliner::OutlinedFunction PatmosInstrInfo::getOutliningCandidateInfo(
+    std::vector<outliner::Candidate> &RepeatedSequenceLocs) const {
+
+  // The call overwrites the return address, which must not be live across
+  // the candidate. In a loop, the call and return are paid every iteration,
+  // and the method cache may miss the outlined function and the caller each
+  // time.
+  llvm::erase_if(RepeatedSequenceLocs, [&](outliner::Candidate &C) {
+    C.initLRU(RI);
+    return !C.LRU.available(Patmos::SRB) || !C.LRU.available(Patmos::SRO) ||
+           (!OutlineFromLoops && (C.Flags & PatmosOutlinerInLoop));
+  });
+
+  if (RepeatedSequenceLocs.size() < 2)
+    return outliner::OutlinedFunction();
+
+  unsigned SequenceSize = 0;
+  for (auto I = RepeatedSequenceLocs[0].front(),
+            E = std::next(RepeatedSequenceLocs[0].back()); I != E; ++I)
+    SequenceSize += getInstrSize(&*I);
+
+  // The delay slots of calls and returns are NOPs, unless the scheduler
+  // finds something to put there.
+  unsigned CFLSize = 4 * (1 + PST.getCFLDelaySlotCycles(false));
+  for (auto &C : RepeatedSequenceLocs)
+    C.setCallInfo(PatmosOutlinerDefault, CFLSize);
+
+  // The outlined function is preceded by its size word and aligned for the
+  // method cache.
+  unsigned FunctionSize = alignTo(4 + SequenceSize + CFLSize,
+                                  PST.getMinSubfunctionAlignment());
+  return outliner::OutlinedFunction(RepeatedSequenceLocs, SequenceSize,
+                                    FunctionSize - SequenceSize,
+                                    PatmosOutlinerDefault);
+}
+
+outliner::InstrType
+PatmosInstrInfo::getOutliningType(MachineBasicBlock::iterator &MIT,
+                                  unsigned Flags) const {
+  MachineInstr &MI = *MIT;
+
+  if (MI.isDebugInstr() || MI.isKill() || MI.isImplicitDef())
+    return outliner::InstrType::Invisible;
+
+  if (MI.isCFIInstruction())
+    return outliner::InstrType::Invisible;
+
+  if (MI.isPosition() || MI.isBundle() || MI.isInlineAsm())
+    return outliner::InstrType::Illegal;
+
+  // branches, calls and returns with their delay slots
+  if (MI.isTerminator() || MI.isCall() || MI.isReturn() ||
+      MI.hasDelaySlot() || isPseudo(&MI))
+    return outliner::InstrType::Illegal;
+
+  // the stack cache frame belongs to the function
+  if (isStackControl(&MI))
+    return outliner::InstrType::Illegal;
+
+  for (MCPhysReg Reg : OutlinerSRegs) {
+    if (MI.modifiesRegister(Reg, &RI) ||
+        (Reg != Patmos::ST && MI.readsRegister(Reg, &RI)))
+      return outliner::InstrType::Illegal;
+  }
+
+  // blocks, constant pools and jump tables are local to the function
+  for (const MachineOperand &MO : MI.operands()) {
+    if (MO.isMBB() || MO.isBlockAddress() || MO.isCPI() || MO.isJTI() ||
+        MO.isFI() || MO.isTargetIndex())
+      return outliner::InstrType::Illegal;
+  }
+
+  return outliner::InstrType::Legal;
+}
+
+void PatmosInstrInfo::buildOutlinedFrame(
+    MachineBasicBlock &MBB, MachineFunction &MF,
+    const outliner::OutlinedFunction &OF) const {
+  // the call frame information of the callers does not apply here
+  for (auto I = MBB.begin(), E = MBB.end(); I != E;) {
+    MachineInstr &MI = *I++;
+    if (MI.isCFIInstruction())
+      MI.eraseFromParent();
+  }
+
+  MBB.addLiveIn(Patmos::SRB);
+  MBB.addLiveIn(Patmos::SRO);
+
+  AddDefaultPred(BuildMI(MBB, MBB.end(), DebugLoc(), get(Patmos::RET)));
+}
+
+MachineBasicBlock::iterator PatmosInstrInfo::insertOutlinedCall(
+    Module &M, MachineBasicBlock &MBB, MachineBasicBlock::iterator &It,
+    MachineFunction &MF, const outliner::Candidate &C) const {
+  It = MBB.insert(It, AddDefaultPred(BuildMI(MF, DebugLoc(), get(Patmos::CALL)))
+                      .addGlobalAddress(M.getNamedValue(MF.getName()))
+                      .getInstr());
+  return It;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -15,6 +15,7 @@
 #define _LLVM_TARGET_PATMOS_INSTRINFO_H_
 
 #include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/MC/MCContext.h"
@@ -31,9 +32,22 @@
 
 namespace llvm {
 
+class PatmosAsmPrinter;
 class PatmosTargetMachine;
 class PatmosSubtarget;
 
+/// The classification of data cache loads by the data cache analysis, kept
+/// in the flags of their memory operands: the load always hits, or it misses
+/// at most once per entry of its loop.
+static const MachineMemOperand::Flags MOAlwaysHit =
+    MachineMemOperand::MOTargetFlag1;
+static const MachineMemOperand::Flags MOFirstMiss =
+    MachineMemOperand::MOTargetFlag2;
+/// The reads of the timer by the timing intrinsics, which are scheduling
+/// boundaries.
+static const MachineMemOperand::Flags MOTimingRead =
+    MachineMemOperand::MOTargetFlag3;
+
 // TODO move this class into a separate header, track call sites and stack
 // cache control instructions, use in CallGraphBuilder, ...
 class PatmosInstrAnalyzer : public MCStreamer {
@@ -121,9 +135,31 @@ class PatmosInstrInfo : public PatmosGenInstrInfo {
   const PatmosTargetMachine &PTM;
   const PatmosRegisterInfo RI;
   const PatmosSubtarget &PST;
+
+  /// The printer parsing inline asm into a PatmosInstrAnalyzer, created
+  /// once for the MCContext of InlineAsmContext.
+  /// \see getInlineAsmSize
+  mutable std::unique_ptr<PatmosAsmPrinter> InlineAsmPrinter;
+  mutable const MCContext *InlineAsmContext;
+
+  /// Sizes of inline assembler instructions, keyed by the asm string and
+  /// its operands. Computing the size requires to parse the inline asm.
+  /// \see getInlineAsmSize
+  mutable StringMap<unsigned> InlineAsmSizes;
+
+  /// Sizes of inline assembler instructions, keyed by the asm string with
+  /// the operands substituted, shared by all asm strings expanding to it.
+  mutable StringMap<unsigned> ExpandedInlineAsmSizes;
+
+  /// getInlineAsmSize - get the size of an inline asm instruction, parsing
+  /// the inline asm only the first time an asm string is seen with the
+  /// same operands.
+  unsigned int getInlineAsmSize(const MachineInstr *MI) const;
 public:
   explicit PatmosInstrInfo(const PatmosTargetMachine &TM);
 
+  ~PatmosInstrInfo() override;
+
   /// getRegisterInfo - TargetInstrInfo is a superset of MRegister info.  As
   /// such, whenever a client has an instance of instruction info, it should
   /// always be able to get register info as well (through this method).
@@ -138,6 +174,12 @@ public:
   bool findCommutedOpIndices(const MachineInstr &MI, unsigned &SrcOpIdx1,
                              unsigned &SrcOpIdx2) const override;
 
+  /// isReallyTriviallyReMaterializable - Unpredicated compares and loads of
+  /// immediates are rematerializable, a compare is cheaper than spilling and
+  /// reloading a predicate as long as the compared values are still live.
+  bool isReallyTriviallyReMaterializable(const MachineInstr &MI,
+                                         AAResults *AA) const override;
+
   void copyPhysReg(MachineBasicBlock &MBB,
                    MachineBasicBlock::iterator I, const DebugLoc &DL,
                    MCRegister DstReg, MCRegister SrcReg,
@@ -246,6 +288,35 @@ public:
   /// MI must be either a load or a store instruction.
   PatmosII::MemType getMemType(const MachineInstr &MI) const;
 
+  /// isAlwaysHit - Return true if MI is a data cache load the data cache
+  /// analysis classified as always-hit.
+  bool isAlwaysHit(const MachineInstr &MI) const;
+
+  /// isFirstMiss - Return true if MI is a data cache load the data cache
+  /// analysis classified as first-miss, i.e., it misses at most once each
+  /// time its loop is entered.
+  bool isFirstMiss(const MachineInstr &MI) const;
+
+  /// isDirectFrameAccess - Return true if operand OpNo of MI is the frame
+  /// index of a load or store with an address that can be rewritten to the
+  /// stack cache, i.e., the address of the frame object is not taken.
+  bool isDirectFrameAccess(const MachineInstr &MI, unsigned OpNo) const;
+
+  /// getShadowStackAccessCost - Return the cycles the access of MI to the
+  /// frame index at operand OpNo costs more if the frame object is placed on
+  /// the shadow stack instead of the stack cache. Stores and bypassing loads
+  /// always go to the main memory, data cache loads may miss. Operands that
+  /// only compute the address of the object cost nothing.
+  unsigned getShadowStackAccessCost(const MachineInstr &MI,
+                                    unsigned OpNo) const;
+
+  /// isTimingRead - Return true if MI reads the timer for the timing
+  /// intrinsics, see PatmosTargetLowering::LowerINTRINSIC_W_CHAIN.
+  bool isTimingRead(const MachineInstr &MI) const;
+
+  ArrayRef<std::pair<MachineMemOperand::Flags, const char *>>
+  getSerializableMachineMemOperandTargetFlags() const override;
+
   /// isPseudo - check if the given machine instruction is emitted, i.e.,
   /// if the instruction is either inline asm or has some FU assigned to it.
   bool isPseudo(const MachineInstr *MI) const;
@@ -296,6 +367,12 @@ public:
   /// Correctly deals with inline assembler and bundles.
   unsigned int getInstrSize(const MachineInstr *MI) const;
 
+  /// getInstSizeInBytes - Return the size of an instruction, i.e., eight
+  /// bytes for long immediates, see getInstrSize.
+  unsigned getInstSizeInBytes(const MachineInstr &MI) const override {
+    return getInstrSize(&MI);
+  }
+
   /// hasCall - check if there is a call in this instruction.
   /// Correctly deals with inline assembler and bundles.
   bool hasCall(const MachineInstr *MI) const;
@@ -308,6 +385,46 @@ public:
   /// miss and stall the CPU. Not checking for instruction fetch related stalls.
   bool mayStall(const MachineBasicBlock &MBB) const;
 
+  /// isSinglePath - return true if the MBB is part of a function that is
+  /// converted to single-path code.
+  bool isSinglePath(const MachineBasicBlock &MBB) const;
+
+  /// canIfCvtSinglePath - return true if the if-converter may predicate the
+  /// MBB of a single-path function. Both paths are executed in single-path
+  /// code anyway, the conversion only saves predicate definitions. Calls and
+  /// returns must stay unpredicated for the single-path transformation.
+  bool canIfCvtSinglePath(const MachineBasicBlock &MBB) const;
+
+  /// canIfCvtCalls - return true if the if-converter may predicate the calls
+  /// and returns of the MBB of a function that is not single-path. The
+  /// frame lowering placed the ensures after the calls and the epilogues
+  /// before the returns already, they are predicated along, such that a
+  /// conditional call or an early return is a single predicated instruction.
+  bool canIfCvtCalls(const MachineBasicBlock &MBB) const;
+
+  /// isConstantTime - return true if the MBB is part of a function with the
+  /// "patmos-constant-time" attribute. The if-converter predicates its blocks
+  /// like those of single-path code, regardless of their cost.
+  bool isConstantTime(const MachineBasicBlock &MBB) const;
+
+  /// getIfCvtBranchCycles - return the cycles of a branch of the MBB that the
+  /// if-converter removes: the branch and its delay slots, which are NOPs
+  /// unless the delay slot filler finds something to put there. A function
+  /// larger than a method cache region is split, its branches may transfer
+  /// to another region and take the longer delay of a cache fill.
+  unsigned getIfCvtBranchCycles(const MachineBasicBlock &MBB) const;
+
+  /// getIfCvtPredicatedCycles - return the cycles of NumCycles of predicated
+  /// code, after bundling.
+  unsigned getIfCvtPredicatedCycles(unsigned NumCycles) const;
+
+  /// canIfCvtMemory - return true if the if-converter may predicate the
+  /// stalling instructions of the MBB. Predicated loads and stores of the
+  /// data cache and the main memory only stall if they execute, the cache
+  /// analyses account for them like for unpredicated ones. Branches with a
+  /// cache fill are never predicated, calls and returns if canIfCvtCalls.
+  bool canIfCvtMemory(const MachineBasicBlock &MBB) const;
+
   /// canRemoveFromSchedule - check if the given instruction can be removed
   /// without creating any hazards to surrounding instructions.
   bool canRemoveFromSchedule(MachineBasicBlock &MBB,
@@ -368,6 +485,50 @@ public:
   bool reverseBranchCondition(SmallVectorImpl<MachineOperand> &Cond)
                               const override;
 
+  /// analyzeLoopForPipelining - Analyze a single-block loop that is
+  /// controlled by a compare of an induction variable with a loop-invariant
+  /// bound, for the MachinePipeliner.
+  std::unique_ptr<PipelinerLoopInfo>
+  analyzeLoopForPipelining(MachineBasicBlock *LoopBB) const override;
+
+  /////////////////////////////////////////////////////////////////////////////
+  // Machine outliner
+  /////////////////////////////////////////////////////////////////////////////
+
+  /// isFunctionSafeToOutlineFrom - Single-path functions are never outlined
+  /// from, leaf functions keep their return address in SRB and SRO to the
+  /// end, which the call of an outlined function overwrites.
+  bool isFunctionSafeToOutlineFrom(MachineFunction &MF,
+                                   bool OutlineFromLinkOnceODRs) const override;
+
+  /// isMBBSafeToOutlineFrom - Flag the blocks within a cycle of the CFG, the
+  /// call of an outlined function in a loop is paid in every iteration.
+  bool isMBBSafeToOutlineFrom(MachineBasicBlock &MBB,
+                              unsigned &Flags) const override;
+
+  /// getOutliningCandidateInfo - Drop the candidates at which SRB or SRO are
+  /// live, and those in loops. Calls and returns cost their delay slots, the
+  /// outlined function its size word and the alignment for the method cache.
+  outliner::OutlinedFunction getOutliningCandidateInfo(
+      std::vector<outliner::Candidate> &RepeatedSequenceLocs) const override;
+
+  /// getOutliningType - Control flow, stack control and the special registers
+  /// of the return address and the stack cache stay in their function.
+  outliner::InstrType getOutliningType(MachineBasicBlock::iterator &MIT,
+                                       unsigned Flags) const override;
+
+  /// buildOutlinedFrame - The outlined function has no stack cache frame, it
+  /// returns by a RET to the return address of its call.
+  void buildOutlinedFrame(MachineBasicBlock &MBB, MachineFunction &MF,
+                          const outliner::OutlinedFunction &OF) const override;
+
+  /// insertOutlinedCall - Call the outlined function by a CALL, without an
+  /// ensure, the stack cache is left as it is by the outlined function.
+  MachineBasicBlock::iterator
+  insertOutlinedCall(Module &M, MachineBasicBlock &MBB,
+                     MachineBasicBlock::iterator &It, MachineFunction &MF,
+                     const outliner::Candidate &C) const override;
+
   /////////////////////////////////////////////////////////////////////////////
   // Predication and IfConversion
   /////////////////////////////////////////////////////////////////////////////
@@ -415,18 +576,7 @@ public:
   /// of our confidence that it will be properly predicted.
   bool isProfitableToIfCvt(MachineBasicBlock &MBB, unsigned NumCycles,
                            unsigned ExtraPredCycles,
-                           BranchProbability Probability) const override {
-
-    const MCInstrDesc &MCID = std::prev(MBB.end())->getDesc();
-    if (MCID.isReturn() || MCID.isCall())
-      return false;
-    if (NumCycles > 8)
-      return false;
-
-    // We do not handle predicated instructions that may stall the pipeline
-    // properly in the cache analyses, so we do not convert them for now.
-    return !mayStall(MBB);
-  }
+                           BranchProbability Probability) const override;
 
   /// Second variant of isProfitableToIfCvt. This one
   /// checks for the case where two basic blocks from true and false path
@@ -438,20 +588,7 @@ public:
                       unsigned NumTCycles, unsigned ExtraTCycles,
                       MachineBasicBlock &FMBB,
                       unsigned NumFCycles, unsigned ExtraFCycles,
-                      BranchProbability Probability) const override {
-    const MCInstrDesc &TMCID = std::prev(TMBB.end())->getDesc();
-    if (TMCID.isReturn() || TMCID.isCall())
-      return false;
-    const MCInstrDesc &FMCID = std::prev(FMBB.end())->getDesc();
-    if (FMCID.isReturn() || FMCID.isCall())
-      return false;
-    if ((NumTCycles + NumFCycles) > 16)
-      return false;
-
-    // We do not handle predicated instructions that may stall the pipeline
-    // properly in the cache analyses, so we do not convert them for now.
-    return !mayStall(TMBB) && !mayStall(FMBB);
-  }
+                      BranchProbability Probability) const override;
 
   /// isProfitableToDupForIfCvt - Return true if it's profitable for
   /// if-converter to duplicate instructions of specified accumulated
@@ -460,12 +597,7 @@ public:
   /// Probability, and Confidence is a measure of our confidence that it
   /// will be properly predicted.
   bool isProfitableToDupForIfCvt(MachineBasicBlock &MBB, unsigned NumCycles,
-                                 BranchProbability Probability) const override {
-    const MCInstrDesc &MCID = std::prev(MBB.end())->getDesc();
-    if (MCID.isReturn() || MCID.isCall())
-      return false;
-    return NumCycles <= 4;
-  }
+                                 BranchProbability Probability) const override;
 
 }; // PatmosInstrInfo
 
@@ -476,6 +608,16 @@ const MachineInstrBuilder &AddDefaultPred(const MachineInstrBuilder &MIB) {
 }
 
 
+namespace Patmos {
+  /// getALUlOpcode - Return the long immediate form of a binary arithmetic
+  /// instruction of the register form, or -1. Generated by TableGen.
+  LLVM_READONLY int getALUlOpcode(uint16_t Opcode);
+
+  /// getALUiOpcode - Return the short immediate form of a binary arithmetic
+  /// instruction of the register form, or -1. Generated by TableGen.
+  LLVM_READONLY int getALUiOpcode(uint16_t Opcode);
+}
+
 static inline
 bool HasALUlVariant(unsigned Opcode, unsigned &ALUlOpcode) {
   using namespace Patmos;
@@ -493,6 +635,27 @@ bool HasALUlVariant(unsigned Opcode, unsigned &ALUlOpcode) {
   }
 }
 
+/// IsPredicateDef - check if the instruction with the given opcode only
+/// computes a predicate from its operands, i.e., is a compare or a predicate
+/// combination.
+static inline
+bool IsPredicateDef(unsigned Opcode) {
+  using namespace Patmos;
+
+  switch (Opcode) {
+  case CMPEQ:  case CMPNEQ:  case CMPLT:  case CMPLE:  case CMPULT:
+  case CMPULE: case BTEST:
+  case CMPIEQ: case CMPINEQ: case CMPILT: case CMPILE: case CMPIULT:
+  case CMPIULE: case BTESTI:
+  case ISODD:  case MOVrp:
+  case POR:    case PAND:    case PXOR:   case PNOT:   case PMOV:
+  case PSET:   case PCLR:
+    return true;
+  default:
+    return false;
+  }
+}
+
 /// HasPCrelImmediate - check if the instruction with the given opcode and
 /// MID has a PC relative immediate (Format == CFLi && Opcode == BR/BRu).
 static inline
@@ -15,13 +15,45 @@
 #include "PatmosIntrinsicElimination.h"
 #include "SinglePath/PatmosSinglePathInfo.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "patmos-intrinsic-elimination"
 
+STATISTIC(StraightLined, "Number of memory intrinsics expanded without a loop");
+STATISTIC(Looped,        "Number of memory intrinsics expanded into a loop");
+STATISTIC(Bypassed,      "Number of llvm.memcpy reading through bypass loads");
+
+/// The address space of uncached accesses, which bypass the data cache.
+static const unsigned UncachedAddrSpace = 3;
+
+static cl::opt<unsigned> InlineSize(
+  "mpatmos-mem-intrinsic-inline-size",
+  cl::init(64),
+  cl::desc("Maximum size in bytes of a llvm.memcpy/memset that is expanded "
+           "without a loop (default: 64)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> FrameInlineSize(
+  "mpatmos-mem-intrinsic-frame-inline-size",
+  cl::init(128),
+  cl::desc("Maximum size in bytes of a llvm.memcpy/memset between stack "
+           "frame objects that is expanded without a loop, such that the "
+           "accesses use the stack cache (default: 128)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> BypassSize(
+  "mpatmos-mem-intrinsic-bypass-size",
+  cl::init(0),
+  cl::desc("Minimum size in bytes of a llvm.memcpy that reads its source "
+           "with loads bypassing the data cache, such that bulk copies do not "
+           "evict the working set (default: 0, disabled)."),
+  cl::Hidden);
+
 char PatmosIntrinsicElimination::ID = 0;
 
 FunctionPass *llvm::createPatmosIntrinsicEliminationPass() {
@@ -146,6 +178,116 @@ static void eliminate(
   BranchInst::Create(successor, memset_loop_end);
 }
 
+/// Returns the widest access size in bytes, up to a word, that is compatible
+/// with the given alignment.
+static unsigned getAccessSize(Align A) {
+  return std::min<uint64_t>(A.value(), 4);
+}
+
+/// Returns a pointer to the given byte offset of Base, casted to an integer
+/// of Size bytes.
+static Value *getAccessPtr(IRBuilder<> &builder, Value *Base, uint64_t Offset,
+                           unsigned Size) {
+  auto AS = cast<PointerType>(Base->getType())->getAddressSpace();
+  auto *ptr = builder.CreateBitCast(Base, builder.getInt8PtrTy(AS));
+  if (Offset)
+    ptr = builder.CreateConstInBoundsGEP1_32(builder.getInt8Ty(), ptr, Offset);
+  return builder.CreateBitCast(ptr,
+                               PointerType::get(builder.getIntNTy(Size * 8), AS));
+}
+
+/// Marks the given load of a copy as non-temporal if it should bypass the data
+/// cache.
+static void setBypass(LoadInst *Load, bool Bypass) {
+  if (!Bypass)
+    return;
+  auto &Ctx = Load->getContext();
+  Load->setMetadata(LLVMContext::MD_nontemporal,
+    MDNode::get(Ctx, ConstantAsMetadata::get(
+                       ConstantInt::get(Type::getInt32Ty(Ctx), 1))));
+}
+
+/// Copies Len bytes from Src to Dest using a straight sequence of loads and
+/// stores of the widest size allowed by the alignment.
+/// All accesses use constant offsets from the given pointers, accesses to
+/// stack objects can therefore use the stack cache.
+static void emitCopy(IRBuilder<> &builder, Value *Dest, Value *Src,
+                     uint64_t Len, Align DestAlign, Align SrcAlign,
+                     bool Bypass = false) {
+  uint64_t off = 0;
+  while (off < Len) {
+    Align da = commonAlignment(DestAlign, off);
+    Align sa = commonAlignment(SrcAlign, off);
+    unsigned size = getAccessSize(std::min(da, sa));
+    while (size > Len - off)
+      size /= 2;
+
+    auto *ty = builder.getIntNTy(size * 8);
+    auto *val = builder.CreateAlignedLoad(ty, getAccessPtr(builder, Src, off, size),
+                                          MaybeAlign(size), "llvm.memcpy.tmp");
+    setBypass(val, Bypass);
+    builder.CreateAlignedStore(val, getAccessPtr(builder, Dest, off, size),
+                               MaybeAlign(size));
+    off += size;
+  }
+}
+
+/// Sets Len bytes at Dest to the byte that is repeated in Word.
+/// Full words are stored with the alignment of the destination, the tail uses
+/// half-words and bytes.
+static void emitSet(IRBuilder<> &builder, Value *Dest, Value *Word,
+                    uint64_t Len, Align DestAlign) {
+  uint64_t off = 0;
+  while (off < Len) {
+    unsigned size = 4;
+    while (size > Len - off)
+      size /= 2;
+
+    auto *val = size == 4 ? Word
+                          : builder.CreateTrunc(Word, builder.getIntNTy(size * 8));
+    builder.CreateAlignedStore(val, getAccessPtr(builder, Dest, off, size),
+                               commonAlignment(DestAlign, off));
+    off += size;
+  }
+}
+
+/// Returns the i32 value which contains the byte Val in all of its bytes.
+static Value *createSplatWord(IRBuilder<> &builder, Value *Val) {
+  if(auto* set_to_const = dyn_cast<ConstantInt>(Val)) {
+    auto set_to_val = set_to_const->getValue().getLimitedValue(std::numeric_limits<uint16_t>::max());
+    assert(set_to_val <= std::numeric_limits<uint8_t>::max() &&
+        "llvm.memset value to set to is out of range");
+
+    auto set_to_shl8 = set_to_val << 8;
+    auto set_to_half = set_to_shl8 + set_to_val;
+    auto set_to_upper = set_to_half << 16;
+    return builder.getInt32(set_to_upper + set_to_half);
+  }
+
+  auto* val_i32 = builder.CreateZExt(Val, builder.getInt32Ty());
+  auto* val_shl8 = builder.CreateShl(val_i32, builder.getInt32(8));
+  auto* val_halfword = builder.CreateAdd(val_shl8, val_i32);
+  auto* val_upper = builder.CreateShl(val_halfword, builder.getInt32(16));
+  return builder.CreateAdd(val_halfword, val_upper, "llvm.memset.set.to.word");
+}
+
+/// Returns true if the intrinsic of the given length should be expanded
+/// without a loop. Copies between stack objects use a larger limit, since the
+/// straight accesses can be selected as stack cache accesses.
+static bool shouldStraightLine(uint64_t len, Value *Dest, Value *Src) {
+  bool frame = isa<AllocaInst>(getUnderlyingObject(Dest)) &&
+               (!Src || isa<AllocaInst>(getUnderlyingObject(Src)));
+  return len <= (frame ? FrameInlineSize : InlineSize);
+}
+
+/// Returns true if a llvm.memcpy of the given length should read its source
+/// bypassing the data cache. The stores need not bypass it: the data cache
+/// is write-through without allocation on a write miss, and keeps the lines
+/// of the destination that it holds up to date.
+static bool shouldBypass(uint64_t len) {
+  return BypassSize && len >= BypassSize;
+}
+
 /// Checks that the given llvm.memset/memcpy is valid and should be eliminated.
 /// If so, calls the given lambda (which is assumed to then call 'eliminate').
 /// Returns true if the intrinsic was eliminated, false otherwise.
@@ -155,7 +297,9 @@ static bool eliminate_mem_intrinsic(Function &F, IntrinsicInst *II, StringRef na
   auto arg0 = II->getArgOperand(0);
   auto arg2 = II->getArgOperand(2);
 
-  assert(cast<PointerType>(arg0->getType())->getAddressSpace() == 0);
+  assert(cast<PointerType>(arg0->getType())->getAddressSpace() == 0 ||
+         cast<PointerType>(arg0->getType())->getAddressSpace() ==
+           UncachedAddrSpace);
   assert(arg0->getType()->getContainedType(0)->isIntegerTy(8));
   assert(arg2->getType()->isIntegerTy(32) || arg2->getType()->isIntegerTy(64));
 
@@ -188,47 +332,81 @@ static bool eliminateIntrinsic(Function &F, BasicBlock &BB) {
         case Intrinsic::memcpy: {
           auto arg1 = II->getArgOperand(1);
 
-          assert(cast<PointerType>(arg1->getType())->getAddressSpace() == 0);
+          // buffers in the uncached address space are copied with accesses
+          // that bypass the data cache
+          assert(cast<PointerType>(arg1->getType())->getAddressSpace() == 0 ||
+                 cast<PointerType>(arg1->getType())->getAddressSpace() ==
+                   UncachedAddrSpace);
           assert(arg1->getType()->getContainedType(0)->isIntegerTy(8));
 
+          Align dest_align = cast<MemCpyInst>(II)->getDestAlign().valueOrOne();
+          Align src_align = cast<MemCpyInst>(II)->getSourceAlign().valueOrOne();
+
           if(eliminate_mem_intrinsic(F, II, "llvm.memcpy",
             [&](auto *arg0, auto *arg2, auto len){
+              bool bypass = shouldBypass(len);
+              if (bypass)
+                Bypassed++;
+
+              if (shouldStraightLine(len, arg0, arg1)) {
+                IRBuilder<> builder(II);
+                emitCopy(builder, arg0, arg1, len, dest_align, src_align,
+                         bypass);
+                II->eraseFromParent();
+                StraightLined++;
+                return;
+              }
+
+              // Copy the largest units the alignment of both pointers allows.
+              unsigned size = getAccessSize(std::min(dest_align, src_align));
+              auto *ty = IntegerType::get(F.getContext(), size * 8);
+              auto *dest_ty = PointerType::get(ty,
+                  cast<PointerType>(arg0->getType())->getAddressSpace());
+              auto *src_ty = PointerType::get(ty,
+                  cast<PointerType>(arg1->getType())->getAddressSpace());
+
               eliminate<
-                int,                          // Not used
+                std::pair<Value*,Value*>,     // Returned by entry lambda
                 std::pair<PHINode*,PHINode*>  // Returned by condition lambda
               >(
-                  F, BB, instr_iter, len, 1,
+                  F, BB, instr_iter, len, size,
                   [&](auto &builder, auto entry_block){
-                    return 0;
+                    auto *dest = builder.CreateBitCast(arg0, dest_ty, "llvm.memcpy.dest.cast");
+                    auto *src = builder.CreateBitCast(arg1, src_ty, "llvm.memcpy.src.cast");
+                    return std::make_pair(dest, src);
                   },
                   [&](auto &builder, auto entry_block, auto entry_ret, auto condition_block){
-                    auto *dest_phi = builder.CreatePHI(PointerType::get(builder.getInt8Ty(),0), 2, "llvm.memcpy.dest");
-                    auto *src_phi = builder.CreatePHI(PointerType::get(builder.getInt8Ty(),0), 2, "llvm.memcpy.src");
-                    dest_phi->addIncoming(arg0, entry_block);
-                    src_phi->addIncoming(arg1, entry_block);
+                    auto *dest_phi = builder.CreatePHI(dest_ty, 2, "llvm.memcpy.dest");
+                    auto *src_phi = builder.CreatePHI(src_ty, 2, "llvm.memcpy.src");
+                    dest_phi->addIncoming(std::get<0>(entry_ret), entry_block);
+                    src_phi->addIncoming(std::get<1>(entry_ret), entry_block);
                     return std::make_pair(dest_phi, src_phi);
                   },
                   [&](auto &builder, auto entry_block, auto entry_ret, auto condition_block, auto cond_ret, auto body_block){
                     auto *dest_phi = std::get<0>(cond_ret);
                     auto *src_phi = std::get<1>(cond_ret);
 
-                    auto *dest_inc = builder.CreateGEP(PointerType::get(builder.getInt32Ty(),0), dest_phi, builder.getInt32(1), "llvm.memcpy.dest.incremented");
-                    auto *src_inc = builder.CreateGEP(PointerType::get(builder.getInt32Ty(),0), src_phi, builder.getInt32(1), "llvm.memcpy.src.incremented");
+                    auto *dest_inc = builder.CreateGEP(ty, dest_phi, builder.getInt32(1), "llvm.memcpy.dest.incremented");
+                    auto *src_inc = builder.CreateGEP(ty, src_phi, builder.getInt32(1), "llvm.memcpy.src.incremented");
                     dest_phi->addIncoming(dest_inc, body_block);
                     src_phi->addIncoming(src_inc, body_block);
 
-                    auto *to_cpy = builder.CreateAlignedLoad(builder.getInt8Ty(), src_phi, MaybeAlign(1), "llvm.memcpy.tmp");
-                    builder.CreateAlignedStore(to_cpy, dest_phi, MaybeAlign(1));
+                    auto *to_cpy = builder.CreateAlignedLoad(ty, src_phi, MaybeAlign(size), "llvm.memcpy.tmp");
+                    setBypass(to_cpy, bypass);
+                    builder.CreateAlignedStore(to_cpy, dest_phi, MaybeAlign(size));
                   },
                   [&](auto &builder,
                       auto entry_block, auto entry_ret,
-                      auto condition_block, auto dest_phi,
+                      auto condition_block, auto cond_ret,
                       auto body_block, auto end_block, auto epilogue_len
                   ){
-
+                    // Copy the remaining bytes after the end of the loop
+                    emitCopy(builder, std::get<0>(cond_ret), std::get<1>(cond_ret),
+                             epilogue_len, Align(size), Align(size), bypass);
                   },
                   "llvm.memcpy"
               );
+              Looped++;
             }
           )) {
             return true;
@@ -240,8 +418,27 @@ static bool eliminateIntrinsic(Function &F, BasicBlock &BB) {
 
           assert(arg1->getType()->isIntegerTy(8));
 
+          auto align = II->paramHasAttr(0, Attribute::Alignment) ?
+             II->getParamAttr(0, Attribute::Alignment).getAlignment()
+             : MaybeAlign(1);
+          // Note: Technically, an 'align' attribute without 'noundef' is undefined behaviour.
+          // However, we instead just assume its there. (since undefined behaviour allows us
+          // to do anything, we choose to treat it as if 'noundef' is present)
+
           if(eliminate_mem_intrinsic(F, II, "llvm.memset",
             [&](auto *arg0, auto *arg2, auto len){
+              if (shouldStraightLine(len, arg0, nullptr)) {
+                IRBuilder<> builder(II);
+                emitSet(builder, arg0, createSplatWord(builder, arg1), len,
+                        align.valueOrOne());
+                II->eraseFromParent();
+                StraightLined++;
+                return;
+              }
+
+              auto *dest_ty = PointerType::get(Type::getInt32Ty(F.getContext()),
+                  cast<PointerType>(arg0->getType())->getAddressSpace());
+
               eliminate<
                 std::pair<Value*, Value*>,  // Returned by entry lambda
                 PHINode*                    // Returned by condition lambda
@@ -249,41 +446,18 @@ static bool eliminateIntrinsic(Function &F, BasicBlock &BB) {
                   F, BB, instr_iter, len, 4,
                   [&](auto &builder, auto entry_block){
                     // Prepare i32 version of value
-                    Value *val_i32_done;
-                    if(auto* set_to_const = dyn_cast<ConstantInt>(arg1)) {
-                      auto set_to_val = set_to_const->getValue().getLimitedValue(std::numeric_limits<uint16_t>::max());
-                      assert(set_to_val <= std::numeric_limits<uint8_t>::max() &&
-                          "llvm.memset value to set to is out of range");
-
-                      auto set_to_shl8 = set_to_val << 8;
-                      auto set_to_half = set_to_shl8 + set_to_val;
-                      auto set_to_upper = set_to_half << 16;
-                      val_i32_done = builder.getInt32(set_to_upper + set_to_half);
-                    } else {
-                      auto* val_i32 = builder.CreateZExt(arg1, Type::getInt32Ty(F.getContext()));
-                      auto* val_shl8 = builder.CreateShl(val_i32, builder.getInt32(8));
-                      auto* val_halfword = builder.CreateAdd(val_shl8, val_i32);
-                      auto* val_upper = builder.CreateShl(val_halfword, builder.getInt32(16));
-                      auto *val_i32_done_instr = builder.CreateAdd(val_halfword, val_upper, "llvm.memset.set.to.word");
-                      val_i32_done = val_i32_done_instr;
-                    }
-                    auto *dest_i32 = builder.CreateBitCast(arg0, PointerType::get(builder.getInt32Ty(),0), "llvm.memset.dest.i32");
+                    Value *val_i32_done = createSplatWord(builder, arg1);
+                    auto *dest_i32 = builder.CreateBitCast(arg0, dest_ty, "llvm.memset.dest.i32");
                     return std::make_pair(dest_i32, val_i32_done);
                   },
                   [&](auto &builder, auto entry_block, auto entry_ret, auto condition_block){
-                    auto *dest_phi = builder.CreatePHI(PointerType::get(builder.getInt32Ty(),0), 2, "llvm.memset.dest");
+                    auto *dest_phi = builder.CreatePHI(dest_ty, 2, "llvm.memset.dest");
                     dest_phi->addIncoming(std::get<0>(entry_ret), entry_block);
                     return dest_phi;
                   },
                   [&](auto &builder, auto entry_block, auto entry_ret, auto condition_block, auto *dest_phi, auto body_block){
                     auto *dest_inc = builder.CreateGEP(PointerType::get(builder.getInt32Ty(),0), dest_phi, builder.getInt32(1), "llvm.memset.dest.incremented");
                     dest_phi->addIncoming(dest_inc, body_block);
-                    auto align = II->paramHasAttr(0, Attribute::Alignment) ?
-                       II->getParamAttr(0, Attribute::Alignment).getAlignment()
-                       : MaybeAlign(1);
-                    // Note: Technically, an 'align' attribute without 'noundef' is undefined behaviour.
-                    // However, we instead just assume its there. (since undefined behaviour allows us
-                    // to do anything, we choose to treat it as if 'noundef' is present)
                     builder.CreateAlignedStore(std::get<1>(entry_ret), dest_phi, align);
                   },
                   [&](auto &builder,
@@ -291,15 +465,13 @@ static bool eliminateIntrinsic(Function &F, BasicBlock &BB) {
                       auto condition_block, auto *dest_phi,
                       auto body_block, auto end_block, auto epilogue_len
                   ){
-                    // Just call llvm.memset which would automatically be expanded by LLVM
-                    auto *dest_phi_i8 = builder.CreateBitCast(dest_phi, PointerType::get(builder.getInt8Ty(),0), "llvm.memset.dest.i32.i8");
-
-                    builder.CreateCall(II->getCalledFunction(),
-                        {dest_phi_i8, arg1, ConstantInt::get(arg2->getType(), epilogue_len), builder.getFalse()}) ;
-
+                    // Set the remaining bytes after the end of the loop
+                    emitSet(builder, dest_phi, std::get<1>(entry_ret), epilogue_len,
+                            commonAlignment(align.valueOrOne(), 4));
                   },
                   "llvm.memset"
               );
+              Looped++;
             })){
             return true;
           }
@@ -0,0 +1,259 @@
+//===-- PatmosLongImmSplit.cpp - Split long immediates into free slots ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A long immediate load (li with a 32 bit immediate) occupies both issue
+// slots of its bundle. If the constant is a shifted 12 bit value, i.e.,
+// (c << s) or -(c << s), it can also be loaded by a short li followed by a
+// shift. This late local pass does so if both instructions fit into the
+// free second slots of two earlier single-slot bundles of the same block,
+// which removes the bundle of the long immediate, i.e., one cycle, without
+// changing the code size.
+//
+// The pass runs after bundling and delay slot filling and does not move
+// instructions over control flow instructions, into or out of delay slots,
+// nor does it shorten the distance between a load or a multiplication and
+// the use of its result.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineInstrBundle.h"
+#include "llvm/CodeGen/TargetRegisterInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-long-imm-split"
+
+STATISTIC( SplitLongImms, "Number of long immediates split into free slots");
+
+static cl::opt<bool> EnableLongImmSplit("mpatmos-long-imm-split",
+  cl::init(false),
+  cl::desc("Load shifted short constants by a short li and a shift in free "
+           "second slots instead of a long immediate (default: false)."),
+  cl::Hidden);
+
+/// The number of bundles searched for free slots in front of a long
+/// immediate.
+static const unsigned MaxSearchDistance = 16;
+
+/// The number of bundles in front of a long immediate that must not contain
+/// a load or a multiplication, the longest latency of their results.
+static const unsigned MaxResultLatency = 3;
+
+namespace {
+
+  class PatmosLongImmSplit : public MachineFunctionPass {
+  private:
+    static char ID;
+
+    const PatmosInstrInfo *TII;
+    const TargetRegisterInfo *TRI;
+
+  public:
+    PatmosLongImmSplit(PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID),
+        TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())),
+        TRI(tm.getSubtargetImpl()->getRegisterInfo()) { }
+
+    StringRef getPassName() const override {
+      return "Patmos Long Immediate Split";
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      if (!EnableLongImmSplit)
+        return false;
+
+      LLVM_DEBUG( dbgs() << "\n[LongImmSplit] "
+                         << MF.getFunction().getName() << "\n" );
+
+      bool Changed = false;
+      for (MachineBasicBlock &MBB : MF)
+        Changed |= splitLongImms(MBB);
+      return Changed;
+    }
+
+  private:
+    /// splitLongImms - Split the long immediates of a basic block.
+    bool splitLongImms(MachineBasicBlock &MBB);
+
+    /// splitLongImm - Try to replace the long immediate LI by a short li and
+    /// a shift in free slots in front of it.
+    bool splitLongImm(MachineBasicBlock &MBB, MachineInstr &LI);
+
+    /// getShortImm - Return the opcode of the short li and set Imm and Shift
+    /// if Value is a shifted 12 bit constant, or return 0.
+    unsigned getShortImm(int64_t Value, int64_t &Imm, unsigned &Shift) const;
+
+    /// hasFreeSlot - Check if the instruction or bundle I issues in the first
+    /// slot alone, so that an ALU instruction can be bundled with it.
+    bool hasFreeSlot(MachineBasicBlock::iterator I) const;
+
+    /// hasLongLatency - Check if the result of I is available only after
+    /// some delay.
+    bool hasLongLatency(const MachineInstr &I) const;
+
+    /// bundleWith - Insert NewMI after the single instruction I and bundle
+    /// both.
+    void bundleWith(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                    MachineInstr *NewMI) const;
+  };
+
+  char PatmosLongImmSplit::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosLongImmSplitPass - Returns a pass that splits long immediates
+/// into free slots of earlier bundles.
+///
+FunctionPass *llvm::createPatmosLongImmSplitPass(PatmosTargetMachine &tm) {
+  return new PatmosLongImmSplit(tm);
+}
+
+
+bool PatmosLongImmSplit::splitLongImms(MachineBasicBlock &MBB) {
+  bool Changed = false;
+
+  for (MachineBasicBlock::iterator I = MBB.begin(); I != MBB.end(); ) {
+    MachineInstr &MI = *I++;
+    if (MI.getOpcode() == Patmos::LIl && !MI.isBundled())
+      Changed |= splitLongImm(MBB, MI);
+  }
+
+  return Changed;
+}
+
+unsigned PatmosLongImmSplit::getShortImm(int64_t Value, int64_t &Imm,
+                                         unsigned &Shift) const {
+  int32_t V = (int32_t)Value;
+  if (V == 0 || isUInt<12>(V) || isUInt<12>(-(int64_t)V))
+    return 0;
+
+  bool Negative = V < 0;
+  uint32_t Abs = Negative ? -(uint32_t)V : (uint32_t)V;
+  Shift = countTrailingZeros(Abs);
+  if (Shift == 0 || !isUInt<12>(Abs >> Shift))
+    return 0;
+
+  // -(c << s) == (-c) << s, also for the most negative value
+  Imm = Abs >> Shift;
+  return Negative ? Patmos::LIin : Patmos::LIi;
+}
+
+bool PatmosLongImmSplit::hasFreeSlot(MachineBasicBlock::iterator I) const {
+  return !I->isBundle() && !I->isInlineAsm() &&
+         TII->getIssueWidth(&*I) == 1 && TII->canIssueInSlot(&*I, 0);
+}
+
+bool PatmosLongImmSplit::hasLongLatency(const MachineInstr &I) const {
+  return I.mayLoad() || I.modifiesRegister(Patmos::SL, TRI) ||
+         I.modifiesRegister(Patmos::SH, TRI);
+}
+
+void PatmosLongImmSplit::bundleWith(MachineBasicBlock &MBB,
+                                    MachineBasicBlock::iterator I,
+                                    MachineInstr *NewMI) const {
+  MachineBasicBlock::instr_iterator First = I.getInstrIterator();
+  MBB.insertAfter(First, NewMI);
+  finalizeBundle(MBB, First,
+                 std::next(MachineBasicBlock::instr_iterator(NewMI)));
+}
+
+bool PatmosLongImmSplit::splitLongImm(MachineBasicBlock &MBB,
+                                      MachineInstr &LI) {
+  const MachineOperand &ImmMO = LI.getOperand(3);
+  if (!ImmMO.isImm() || TII->isPredicated(LI))
+    return false;
+
+  int64_t Imm;
+  unsigned Shift;
+  unsigned Opcode = getShortImm(ImmMO.getImm(), Imm, Shift);
+  if (!Opcode)
+    return false;
+
+  Register Rd = LI.getOperand(0).getReg();
+  if (Rd == Patmos::R0)
+    return false;
+
+  if (!TII->canIssueInSlot(TII->get(Opcode), 1) ||
+      !TII->canIssueInSlot(TII->get(Patmos::SLi), 1))
+    return false;
+
+  // Collect the candidates from bottom to top. The cycle of the long
+  // immediate must not be needed to wait for a result, the short li and
+  // the shift must not write Rd while something else reads or writes it.
+  SmallVector<MachineBasicBlock::iterator, 2> Slots;
+  MachineBasicBlock::iterator I(LI);
+  unsigned Distance = 0;
+  while (Slots.size() < 2 && I != MBB.begin() &&
+         Distance < MaxSearchDistance) {
+    --I;
+    if (TII->isPseudo(&*I))
+      continue;
+
+    if (I->isInlineAsm())
+      return false;
+
+    // do not move over control flow, the long immediate might also be in
+    // the delay slot of I
+    if (I->isBranch() || I->isCall() || I->isReturn())
+      return false;
+
+    if (Distance < MaxResultLatency && hasLongLatency(*I))
+      return false;
+
+    if (I->readsRegister(Rd, TRI) || I->modifiesRegister(Rd, TRI))
+      return false;
+
+    if (hasFreeSlot(I))
+      Slots.push_back(I);
+
+    Distance++;
+  }
+
+  if (Slots.size() < 2)
+    return false;
+
+  // a delayed result written to Rd just in front of the short li could
+  // overwrite it
+  if (Slots[1] != MBB.begin()) {
+    MachineBasicBlock::iterator Prev = TII->prevNonPseudo(MBB, Slots[1]);
+    if (!TII->isPseudo(&*Prev) && hasLongLatency(*Prev) &&
+        Prev->modifiesRegister(Rd, TRI))
+      return false;
+  }
+
+  LLVM_DEBUG( dbgs() << "Split in BB#" << MBB.getNumber() << ": " << LI );
+
+  MachineFunction &MF = *MBB.getParent();
+  const DebugLoc &DL = LI.getDebugLoc();
+  MachineInstr *Load = AddDefaultPred(BuildMI(MF, DL, TII->get(Opcode), Rd))
+                         .addImm(Imm);
+  MachineInstr *Shl = AddDefaultPred(BuildMI(MF, DL, TII->get(Patmos::SLi),
+                                             Rd))
+                        .addReg(Rd, RegState::Kill).addImm(Shift);
+  if (LI.getOperand(0).isDead())
+    Shl->getOperand(0).setIsDead();
+
+  bundleWith(MBB, Slots[1], Load);
+  bundleWith(MBB, Slots[0], Shl);
+  LI.eraseFromParent();
+
+  SplitLongImms++;
+  return true;
+}
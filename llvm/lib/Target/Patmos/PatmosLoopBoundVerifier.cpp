@@ -0,0 +1,173 @@
+//===-- PatmosLoopBoundVerifier.cpp - Check loop bounds against SCEV. -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Check the loop bounds given by "#pragma loopbound" against the iteration
+// counts ScalarEvolution can prove, after the loop passes of the optimizer
+// have rotated, peeled and unrolled the loops and adjusted their bounds.
+//
+// A maximum below the exact iteration count makes the WCET analysis unsound,
+// a minimum above it the BCET. Both are reported as warnings, since the
+// same code is correct for other inputs, e.g., when the bound was written
+// for a different configuration of the application.
+//
+// The bounds are read like getLoopBounds() reads them: from the terminator
+// of the header and from the loop ID on the latches, the tighter one counts.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugLoc.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-loopbound-verifier"
+
+STATISTIC(NumBoundsVerified, "Number of loop bounds checked against SCEV");
+STATISTIC(NumBoundsViolated, "Number of loop bounds contradicted by SCEV");
+
+static cl::opt<bool> EnableLoopBoundVerifier("mpatmos-verify-loop-bounds",
+  cl::init(true),
+  cl::desc("Warn about loop bounds contradicted by the iteration counts of "
+           "scalar evolution."),
+  cl::Hidden);
+
+namespace {
+
+class PatmosLoopBoundVerifier : public FunctionPass {
+private:
+
+  /// readBound - Read the "llvm.loop.bound" of a loop ID into Min and Max,
+  /// tightening their previous values.
+  static bool readBound(MDNode *LoopID, uint64_t &Min, uint64_t &Max);
+
+  /// warn - Report a loop bound contradicted by scalar evolution.
+  static void warn(const Function &F, const Loop *L, const Twine &Msg);
+
+  /// verifyLoop - Check the bound of L, if any, against scalar evolution.
+  void verifyLoop(const Function &F, Loop *L, ScalarEvolution &SE);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+
+  PatmosLoopBoundVerifier() : FunctionPass(ID) {}
+
+  /// getPassName - Return the pass' name.
+  StringRef getPassName() const override {
+    return "Patmos Loop Bound Verifier";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.setPreservesAll();
+  }
+
+  bool runOnFunction(Function &F) override;
+};
+
+} // end anonymous namespace
+
+char PatmosLoopBoundVerifier::ID = 0;
+
+FunctionPass *llvm::createPatmosLoopBoundVerifierPass() {
+  return new PatmosLoopBoundVerifier();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosLoopBoundVerifier::runOnFunction(Function &F) {
+  if (!EnableLoopBoundVerifier || skipFunction(F))
+    return false;
+
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+  for (Loop *L : LI.getLoopsInPreorder())
+    verifyLoop(F, L, SE);
+  return false;
+}
+
+bool PatmosLoopBoundVerifier::readBound(MDNode *LoopID, uint64_t &Min,
+                                        uint64_t &Max) {
+  if (!LoopID)
+    return false;
+  // The first operand is always a self-reference
+  for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; i++) {
+    auto Op = dyn_cast<MDNode>(LoopID->getOperand(i).get());
+    if (!Op || Op->getNumOperands() != 3)
+      continue;
+    auto Name = dyn_cast<MDString>(Op->getOperand(0));
+    if (!Name || Name->getString() != "llvm.loop.bound")
+      continue;
+    auto BoundMin = mdconst::dyn_extract<ConstantInt>(Op->getOperand(1));
+    auto BoundMax = mdconst::dyn_extract<ConstantInt>(Op->getOperand(2));
+    if (!BoundMin || !BoundMax)
+      return false;
+    Min = std::min(Min, BoundMin->getZExtValue());
+    Max = std::min(Max, BoundMax->getZExtValue());
+    return true;
+  }
+  return false;
+}
+
+void PatmosLoopBoundVerifier::warn(const Function &F, const Loop *L,
+                                   const Twine &Msg) {
+  errs() << "Warning: ";
+  if (DebugLoc DL = L->getStartLoc()) {
+    DL.print(errs());
+    errs() << ": ";
+  }
+  errs() << "The loop bound of '" << L->getHeader()->getName() << "' in '"
+         << F.getName() << "' " << Msg << ".\n";
+  NumBoundsViolated++; // STATISTIC
+}
+
+void PatmosLoopBoundVerifier::verifyLoop(const Function &F, Loop *L,
+                                         ScalarEvolution &SE) {
+  uint64_t Min = UINT64_MAX, Max = UINT64_MAX;
+  bool OnHeader = readBound(L->getHeader()->getTerminator()->getMetadata(
+                              LLVMContext::MD_loop), Min, Max);
+  bool OnLatch = readBound(L->getLoopID(), Min, Max);
+  if (!OnHeader && !OnLatch)
+    return;
+  NumBoundsVerified++; // STATISTIC
+
+  LLVM_DEBUG(dbgs() << "Verify loop bound of '" << L->getHeader()->getName()
+                    << "': min " << Min << ", max " << Max << "\n");
+
+  if (auto Exact = dyn_cast<SCEVConstant>(SE.getBackedgeTakenCount(L))) {
+    uint64_t Count = Exact->getAPInt().getLimitedValue();
+    if (Count > Max)
+      warn(F, L, "max " + Twine(Max) + " is below the iteration count " +
+                 Twine(Count));
+    else if (Count < Min)
+      warn(F, L, "min " + Twine(Min) + " is above the iteration count " +
+                 Twine(Count));
+    return;
+  }
+
+  auto MaxBTC = dyn_cast<SCEVConstant>(SE.getConstantMaxBackedgeTakenCount(L));
+  if (MaxBTC) {
+    uint64_t Count = MaxBTC->getAPInt().getLimitedValue();
+    if (Count < Min)
+      warn(F, L, "min " + Twine(Min) + " is above the maximum iteration " +
+                 "count " + Twine(Count));
+  }
+}
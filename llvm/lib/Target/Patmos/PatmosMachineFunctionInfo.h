@@ -82,6 +82,28 @@ class PatmosMachineFunctionInfo : public MachineFunctionInfo {
   /// StackCacheFIs - Set of FIs assigned to the stack cache.
   BitVector StackCacheFIs;
 
+  /// StackCacheFrameBase - Offset in bytes of the stack cache frame relative
+  /// to the stack top, non-zero if the frame is coalesced into the frame of a
+  /// single-path root.
+  unsigned StackCacheFrameBase;
+
+  /// StackCacheRegionBytes - Size in bytes reserved on the stack cache on top
+  /// of the frame within the stack cache region, 0 if the frame is not split.
+  unsigned StackCacheRegionBytes;
+
+  /// StackCacheRegionFIs - Set of FIs assigned to the stack cache region,
+  /// which are only reserved within its blocks.
+  BitVector StackCacheRegionFIs;
+
+  /// StackCacheRegion - The blocks of the stack cache region, a single-entry
+  /// single-exit region without calls.
+  std::set<const MachineBasicBlock*> StackCacheRegion;
+
+  /// StackCacheRegionEntry/Exit - The blocks reserving and freeing the
+  /// objects of the stack cache region.
+  MachineBasicBlock *StackCacheRegionEntry;
+  MachineBasicBlock *StackCacheRegionExit;
+
   /// VarArgsFI - FrameIndex to access parameters of variadic functions.
   int VarArgsFI;
 
@@ -91,6 +113,10 @@ class PatmosMachineFunctionInfo : public MachineFunctionInfo {
   /// Register used to spill s0 to instead of the stack cache.
   unsigned S0SpillReg;
 
+  /// InterruptSSFI - FrameIndex holding the stack spill pointer at the entry
+  /// of an interrupt handler with calls, or -1.
+  int InterruptSSFI;
+
   /// True if this function is to be single-path converted
   bool SinglePathConvert;
 
@@ -107,6 +133,21 @@ class PatmosMachineFunctionInfo : public MachineFunctionInfo {
   // Index to the SinglePathFIs where the call spill slots start (R9)
   unsigned SPCallSpillOffset;
 
+  /// Execution time of the single-path function in cycles, including its
+  /// callees, or -1 if it was not computed.
+  int64_t SinglePathCycles;
+
+  /// False if SinglePathCycles is only a lower bound, e.g., because of
+  /// calls to functions with unknown timing.
+  bool SinglePathCyclesExact;
+
+  /// Estimate of the worst-case execution time of the function in cycles,
+  /// including its callees, or -1 if it is unbounded.
+  int64_t WCETEstimate;
+
+  /// True if WCETEstimate was computed.
+  bool HasWCETEstimate;
+
   /// Set of entry blocks to code regions that are potentially cached by the
   /// method cache.
   std::set<const MachineBasicBlock*> MethodCacheRegionEntries;
@@ -118,10 +159,14 @@ class PatmosMachineFunctionInfo : public MachineFunctionInfo {
   PatmosMachineFunctionInfo();
 public:
   explicit PatmosMachineFunctionInfo(MachineFunction &MF) :
-    StackCacheReservedBytes(0), StackReservedBytes(0), VarArgsFI(0),
-    RegScavengingFI(0), S0SpillReg(0),
+    StackCacheReservedBytes(0), StackReservedBytes(0), StackCacheFrameBase(0),
+    StackCacheRegionBytes(0), StackCacheRegionEntry(NULL),
+    StackCacheRegionExit(NULL),
+    VarArgsFI(0),
+    RegScavengingFI(0), S0SpillReg(0), InterruptSSFI(-1),
     SinglePathConvert(false), SPS0SpillOffset(0), SPExcessSpillOffset(0),
-    SPCallSpillOffset(0)
+    SPCallSpillOffset(0), SinglePathCycles(-1), SinglePathCyclesExact(false),
+    WCETEstimate(-1), HasWCETEstimate(false)
     {}
 
   /// getStackCacheReservedBytes - Get the number of bytes reserved on the
@@ -158,6 +203,61 @@ public:
     StackCacheFIs = fis;
   }
 
+  /// getStackCacheFrameBase - Get the offset in bytes of the stack cache
+  /// frame relative to the stack top.
+  unsigned getStackCacheFrameBase() const {
+    return StackCacheFrameBase;
+  }
+
+  /// setStackCacheFrameBase - Set the offset in bytes of the stack cache
+  /// frame relative to the stack top.
+  void setStackCacheFrameBase(unsigned Base) {
+    StackCacheFrameBase = Base;
+  }
+
+  /// getStackCacheRegionBytes - Get the number of bytes reserved on top of
+  /// the frame within the stack cache region.
+  unsigned getStackCacheRegionBytes() const {
+    return StackCacheRegionBytes;
+  }
+
+  /// setStackCacheRegion - Split the stack cache frame, the FIs are only
+  /// reserved between the entry and the exit of the region.
+  void setStackCacheRegion(MachineBasicBlock *Entry, MachineBasicBlock *Exit,
+                           const std::set<const MachineBasicBlock*> &Blocks,
+                           const BitVector &FIs, unsigned Bytes) {
+    StackCacheRegionEntry = Entry;
+    StackCacheRegionExit = Exit;
+    StackCacheRegion = Blocks;
+    StackCacheRegionFIs = FIs;
+    StackCacheRegionBytes = Bytes;
+  }
+
+  /// getStackCacheRegionEntry - Get the block reserving the objects of the
+  /// stack cache region, or NULL.
+  MachineBasicBlock *getStackCacheRegionEntry() const {
+    return StackCacheRegionEntry;
+  }
+
+  /// getStackCacheRegionExit - Get the block freeing the objects of the
+  /// stack cache region, or NULL.
+  MachineBasicBlock *getStackCacheRegionExit() const {
+    return StackCacheRegionExit;
+  }
+
+  /// isInStackCacheRegion - Return whether the block belongs to the stack
+  /// cache region.
+  bool isInStackCacheRegion(const MachineBasicBlock *MBB) const {
+    return StackCacheRegion.count(MBB);
+  }
+
+  /// isStackCacheRegionFI - Return whether the FI is assigned to the stack
+  /// cache region.
+  bool isStackCacheRegionFI(int FI) const {
+    return FI >= 0 && (unsigned)FI < StackCacheRegionFIs.size() &&
+           StackCacheRegionFIs[FI];
+  }
+
   /// getVarArgsFI - Get the FI used to access parameters of variadic functions.
   unsigned getVarArgsFI() const {
     return VarArgsFI;
@@ -186,6 +286,18 @@ public:
     S0SpillReg = Reg;
   }
 
+  /// getInterruptSSFI - Get the FI holding the stack spill pointer at the
+  /// entry of an interrupt handler, or -1 if it is not saved.
+  int getInterruptSSFI() const {
+    return InterruptSSFI;
+  }
+
+  /// setInterruptSSFI - Set the FI holding the stack spill pointer at the
+  /// entry of an interrupt handler.
+  void setInterruptSSFI(int newFI) {
+    InterruptSSFI = newFI;
+  }
+
   /// addMethodCacheRegionEntry - Add the block to the set of method cache
   /// region entry blocks.
   /// \see MethodCacheRegionEntries
@@ -248,6 +360,32 @@ public:
     return SinglePathFIs.size();
   }
 
+  void setSinglePathCycles(int64_t Cycles, bool Exact) {
+    SinglePathCycles = Cycles;
+    SinglePathCyclesExact = Exact;
+  }
+
+  int64_t getSinglePathCycles(void) const {
+    return SinglePathCycles;
+  }
+
+  bool isSinglePathCyclesExact(void) const {
+    return SinglePathCyclesExact;
+  }
+
+  void setWCETEstimate(int64_t Cycles) {
+    WCETEstimate = Cycles;
+    HasWCETEstimate = true;
+  }
+
+  int64_t getWCETEstimate(void) const {
+    return WCETEstimate;
+  }
+
+  bool hasWCETEstimate(void) const {
+    return HasWCETEstimate;
+  }
+
   PatmosAnalysisInfo &getAnalysisInfo() { return AnalysisInfo; }
 
   const PatmosAnalysisInfo &getAnalysisInfo() const { return AnalysisInfo; }
@@ -0,0 +1,336 @@
+//===-- PatmosPMLExport.cpp - Export machine code flow facts as PML. ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Write the final machine code of a module as PML for WCET analysis tools,
+// e.g., platin, given by -mpatmos-serialize=FILE.
+//
+// For every machine function the export contains
+//  - its blocks with predecessors, successors and the loops they belong to,
+//  - its subfunctions, i.e., the method cache regions,
+//  - the instructions with their size, bundling, branch type, delay slots,
+//    branch targets and the callees of calls from the machine-level call
+//    graph, the stack cache arguments and spill/fill sizes of the stack
+//    cache analysis, if it ran, and the always-hit and first-miss loads of
+//    the data cache analysis.
+// Machine functions and blocks are related to bitcode functions and blocks
+// by their 'mapsto' names. The loop bounds of getLoopBounds are exported as
+// flow facts on the loop headers.
+//
+// The document is written in YAML, or in the compact binary encoding of
+// PatmosPML.h if -mpatmos-serialize-format=binary is given. Functions are
+// written to the stream one at a time, the flow facts follow at the end of
+// the document.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosCallGraphBuilder.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosMachineFunctionInfo.h"
+#include "PatmosStackCacheAnalysis.h"
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "PML/PatmosPML.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-pml-export"
+
+STATISTIC(ExportedFunctions, "Number of machine functions exported to PML");
+STATISTIC(ExportedLoopBounds, "Number of loop bounds exported to PML");
+
+enum PMLFormat { PML_YAML, PML_Binary };
+
+static cl::opt<PMLFormat> SerializeFormat(
+  "mpatmos-serialize-format",
+  cl::init(PML_YAML),
+  cl::desc("Encoding of the PML export of -mpatmos-serialize."),
+  cl::values(clEnumValN(PML_YAML, "yaml", "YAML, as read by platin (default)"),
+             clEnumValN(PML_Binary, "binary",
+                        "Compact binary encoding, see patmos-pml-convert")),
+  cl::Hidden);
+
+namespace {
+  class PatmosPMLExport : public MachineModulePass {
+  private:
+    const PatmosInstrInfo &TII;
+    const PatmosSubtarget &STI;
+
+    /// The file to write the PML document to.
+    std::string PMLFile;
+
+    /// The loop bounds of all functions, written at the end.
+    std::vector<pml::LoopBound> LoopBounds;
+
+    /// getBlockNames - Return the block numbers.
+    template<typename T>
+    static std::vector<unsigned> getBlockNames(const T &Blocks) {
+      std::vector<unsigned> Names;
+      for (const MachineBasicBlock *MBB : Blocks)
+        Names.push_back(MBB->getNumber());
+      return Names;
+    }
+
+    /// getBranchType - Return the PML branch type of the instruction, or an
+    /// empty string.
+    static StringRef getBranchType(const MachineInstr &MI) {
+      if (MI.isCall())
+        return "call";
+      if (MI.isReturn())
+        return "return";
+      if (MI.isIndirectBranch())
+        return "indirect";
+      if (MI.isConditionalBranch())
+        return "conditional";
+      if (MI.isUnconditionalBranch())
+        return "unconditional";
+      return "";
+    }
+
+    /// getCallees - Return the possible callees of a call instruction. The
+    /// callees of an UNKNOWN node are the address taken functions that match
+    /// the type of the call.
+    static std::vector<std::string> getCallees(PatmosCallGraphBuilder &PCGB,
+                                               const MachineInstr &MI) {
+      std::vector<std::string> callees;
+      MCGSites sites(PCGB.getSites(&MI));
+      for (MCGSite *site : sites) {
+        MCGNode *callee = site->getCallee();
+        if (!callee->isUnknown()) {
+          callees.push_back(callee->getMF()->getName().str());
+          continue;
+        }
+        for (MCGSite *target : callee->getSites()) {
+          if (!target->getCallee()->isUnknown())
+            callees.push_back(target->getCallee()->getMF()->getName().str());
+        }
+      }
+
+      if (callees.empty())
+        callees.push_back("__any");
+      return callees;
+    }
+
+    /// isExported - Return true if MI is a single instruction that is emitted
+    /// to the code, i.e., not a bundle nor a pseudo instruction.
+    static bool isExported(const MachineInstr &MI) {
+      return !MI.isBundle() && !MI.isDebugInstr() && !MI.isCFIInstruction() &&
+             !MI.isLabel() && !MI.isImplicitDef() && !MI.isKill();
+    }
+
+    /// exportInstruction - Export a single instruction, i.e., not a bundle.
+    pml::Instruction exportInstruction(PatmosCallGraphBuilder &PCGB,
+                                   const PatmosStackCacheAnalysisInfo &SCAI,
+                                   const MachineInstr &MI, unsigned Index) {
+      pml::Instruction I;
+      I.Index = Index;
+      I.Opcode = TII.getName(MI.getOpcode()).str();
+      I.Size = TII.getInstrSize(&MI);
+      // the second slot of a bundle
+      I.Bundled = MI.isBundledWithPred() && !MI.getPrevNode()->isBundle();
+
+      I.BranchType = getBranchType(MI).str();
+      if (!I.BranchType.empty()) {
+        I.DelaySlots = STI.getDelaySlotCycles(MI);
+
+        if (MI.isCall())
+          I.Callees = getCallees(PCGB, MI);
+
+        for (const MachineOperand &MO : MI.operands()) {
+          if (MO.isMBB())
+            I.Targets.push_back(MO.getMBB()->getNumber());
+        }
+      }
+
+      switch (MI.getOpcode()) {
+      case Patmos::SRESi:
+      case Patmos::SENSi:
+      case Patmos::SFREEi:
+        // the argument of stack control instructions is in words
+        I.StackCacheArgument = MI.getOperand(2).getImm() * 4;
+        break;
+      }
+
+      if (SCAI.isValid()) {
+        auto R = SCAI.Reserves.find(&MI);
+        if (R != SCAI.Reserves.end())
+          I.StackCacheSpill = R->second;
+        auto E = SCAI.Ensures.find(&MI);
+        if (E != SCAI.Ensures.end())
+          I.StackCacheFill = E->second;
+      }
+
+      if (TII.isAlwaysHit(MI))
+        I.DataCacheClass = "always-hit";
+      else if (TII.isFirstMiss(MI))
+        I.DataCacheClass = "first-miss";
+      return I;
+    }
+
+    /// exportFunction - Export a machine function and collect its loop
+    /// bounds.
+    void exportFunction(pml::Writer &W, PatmosCallGraphBuilder &PCGB,
+                        const PatmosStackCacheAnalysisInfo &SCAI,
+                        MachineFunction &MF) {
+      // the analyses of the pass pipeline are gone in a module pass
+      MachineDomTree MDT;
+      MDT.recalculate(MF);
+      LoopInfoBase<MachineBasicBlock, MachineLoop> MLI;
+      MLI.analyze(MDT);
+
+      const PatmosMachineFunctionInfo &PMFI =
+                                     *MF.getInfo<PatmosMachineFunctionInfo>();
+
+      pml::Function F;
+      F.Name = MF.getFunctionNumber();
+      F.MapsTo = MF.getName().str();
+
+      std::vector<const MachineBasicBlock*> regions;
+      for (const MachineBasicBlock &MBB : MF) {
+        F.Blocks.emplace_back();
+        pml::Block &B = F.Blocks.back();
+        B.Name = MBB.getNumber();
+        if (const BasicBlock *BB = MBB.getBasicBlock()) {
+          if (BB->hasName())
+            B.MapsTo = BB->getName().str();
+        }
+
+        B.Predecessors = getBlockNames(MBB.predecessors());
+        B.Successors = getBlockNames(MBB.successors());
+
+        // the headers of the enclosing loops, from the innermost one
+        for (MachineLoop *L = MLI.getLoopFor(&MBB); L; L = L->getParentLoop())
+          B.Loops.push_back(L->getHeader()->getNumber());
+
+        MachineLoop *L = MLI.getLoopFor(&MBB);
+        if (L && L->getHeader() == &MBB) {
+          // the bound is on the back edges, the header runs once more
+          int Max = getLoopBounds(&MBB).second;
+          if (Max >= 0) {
+            pml::LoopBound LB;
+            LB.Function = F.Name;
+            LB.Header = MBB.getNumber();
+            LB.Bound = (unsigned)Max + 1;
+            LoopBounds.push_back(LB);
+            ExportedLoopBounds++;
+          }
+        }
+
+        if (PMFI.isMethodCacheRegionEntry(&MBB) || &MBB == &MF.front())
+          regions.push_back(&MBB);
+
+        unsigned Index = 0;
+        for (const MachineInstr &MI : MBB.instrs()) {
+          if (isExported(MI))
+            B.Instructions.push_back(exportInstruction(PCGB, SCAI, MI,
+                                                       Index++));
+        }
+      }
+
+      // every subfunction spans the blocks up to the next region entry, in
+      // layout order
+      for (const MachineBasicBlock *Region : regions) {
+        std::vector<const MachineBasicBlock*> blocks;
+        for (MachineFunction::const_iterator I = Region->getIterator(),
+             E = MF.end(); I != E; ++I) {
+          if (&*I != Region && PMFI.isMethodCacheRegionEntry(&*I))
+            break;
+          blocks.push_back(&*I);
+        }
+
+        pml::Subfunction S;
+        S.Name = Region->getNumber();
+        S.Blocks = getBlockNames(blocks);
+        F.Subfunctions.push_back(S);
+      }
+
+      W.writeFunction(F);
+      ExportedFunctions++;
+    }
+
+  public:
+    /// Pass ID
+    static char ID;
+
+    PatmosPMLExport(const PatmosTargetMachine &tm, const std::string &pmlFile)
+      : MachineModulePass(ID), TII(*tm.getInstrInfo()),
+        STI(*tm.getSubtargetImpl()), PMLFile(pmlFile)
+    {
+    }
+
+    /// getAnalysisUsage - Inform the pass manager that nothing is modified.
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+      AU.setPreservesAll();
+      AU.addRequired<MachineModuleInfoWrapperPass>();
+      AU.addRequired<PatmosCallGraphBuilder>();
+      AU.addRequired<PatmosStackCacheAnalysisInfo>();
+      ModulePass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineModule(const Module &M) override
+    {
+      bool Binary = SerializeFormat == PML_Binary;
+      std::error_code err;
+      raw_fd_ostream OS(PMLFile, err, Binary ? sys::fs::OF_None
+                                             : sys::fs::OF_Text);
+      if (err) {
+        errs() << "Error: Failed to open PML export '" << PMLFile << "': "
+               << err.message() << "\n";
+        return false;
+      }
+
+      auto &MMI = getAnalysis<MachineModuleInfoWrapperPass>().getMMI();
+      PatmosCallGraphBuilder &PCGB(getAnalysis<PatmosCallGraphBuilder>());
+      const PatmosStackCacheAnalysisInfo &SCAI =
+                                   getAnalysis<PatmosStackCacheAnalysisInfo>();
+
+      std::unique_ptr<pml::Writer> W;
+      if (Binary)
+        W.reset(new pml::BinaryWriter(OS));
+      else
+        W.reset(new pml::YAMLWriter(OS));
+
+      W->writeHeader(M.getTargetTriple());
+
+      LoopBounds.clear();
+      for (const Function &F : M) {
+        if (MachineFunction *MF = MMI.getMachineFunction(F))
+          exportFunction(*W, PCGB, SCAI, *MF);
+      }
+
+      if (Error E = W->finish(LoopBounds))
+        report_fatal_error(std::move(E));
+      return false;
+    }
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override {
+      return "Patmos PML Export";
+    }
+  };
+
+  char PatmosPMLExport::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosPMLExportPass - Returns a new PatmosPMLExport writing the
+/// machine code of the module to PMLFile.
+ModulePass *llvm::createPatmosPMLExportPass(const PatmosTargetMachine &tm,
+                                            const std::string &PMLFile) {
+  return new PatmosPMLExport(tm, PMLFile);
+}
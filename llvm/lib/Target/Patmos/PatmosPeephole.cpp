@@ -0,0 +1,444 @@
+//===-- PatmosPeephole.cpp - Patmos late peephole optimizations -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A late local peephole optimizer for the patterns the instruction selection,
+// the if-converter and the register allocator leave behind, after the
+// prologue and epilogue are inserted and before the post-RA scheduler bundles
+// the code. Every instruction removed frees a slot of a bundle:
+//  - A constant loaded by li and used once by an ALU instruction of the
+//    register form is folded into the short or long immediate form of the
+//    instruction. The forms are related by TableGen, see getALUiOpcode and
+//    getALUlOpcode.
+//  - A predicate defined by a compare and only copied by a pmov is defined
+//    by the compare directly.
+//  - A predicate moved into a register by mov and tested by mov, btest,
+//    isodd or by a comparison with zero is copied by pmov instead, the mov
+//    is removed if the register is not used otherwise.
+//  - A predicate copied by a pmov and only used as guard, e.g., of a branch,
+//    is replaced by the source of the copy.
+//
+// The pass does not touch bundled instructions nor single-path code, the
+// schedule of which is final already.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/TargetRegisterInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-peephole"
+
+STATISTIC( FoldedImms, "Number of constants folded into ALU instructions");
+STATISTIC( RetargetedDefs, "Number of pmovs removed by retargeting a def");
+STATISTIC( RewrittenTests, "Number of predicate tests rewritten to pmovs");
+STATISTIC( RemovedMoves, "Number of predicate to register moves removed");
+STATISTIC( PropagatedGuards, "Number of guards propagated from pmovs");
+
+static cl::opt<bool> EnablePeephole("mpatmos-peephole",
+  cl::init(false),
+  cl::desc("Fold constants into ALU instructions and remove predicate copies "
+           "and round trips through registers after register allocation "
+           "(default: false)."),
+  cl::Hidden);
+
+/// The number of instructions searched for the use of a definition.
+static const unsigned MaxSearchDistance = 16;
+
+namespace {
+
+  class PatmosPeephole : public MachineFunctionPass {
+  private:
+    static char ID;
+
+    const PatmosInstrInfo *TII;
+    const TargetRegisterInfo *TRI;
+
+  public:
+    PatmosPeephole(PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID),
+        TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())),
+        TRI(tm.getSubtargetImpl()->getRegisterInfo()) { }
+
+    StringRef getPassName() const override {
+      return "Patmos Peephole Optimizer";
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      if (!EnablePeephole || skipFunction(MF.getFunction()) ||
+          !MF.getRegInfo().tracksLiveness() || TII->isSinglePath(MF.front()))
+        return false;
+
+      LLVM_DEBUG( dbgs() << "\n[Peephole] "
+                         << MF.getFunction().getName() << "\n" );
+
+      bool Changed = false;
+      for (MachineBasicBlock &MBB : MF) {
+        // a rewrite may enable another one on the same instructions
+        while (optimizeBlock(MBB))
+          Changed = true;
+      }
+      return Changed;
+    }
+
+  private:
+    /// optimizeBlock - Apply the first applicable rewrite to the block.
+    /// Return true if anything changed.
+    bool optimizeBlock(MachineBasicBlock &MBB);
+
+    /// foldImmediate - Fold the constant loaded by LI into its single user.
+    bool foldImmediate(MachineBasicBlock &MBB, MachineInstr &LI);
+
+    /// retargetDef - Let the predicate definition Def define the destination
+    /// of a pmov copying its result.
+    bool retargetDef(MachineBasicBlock &MBB, MachineInstr &Def);
+
+    /// rewriteTest - Rewrite the tests of the register set by the predicate
+    /// move Mov to pmovs of the predicate.
+    bool rewriteTest(MachineBasicBlock &MBB, MachineInstr &Mov);
+
+    /// propagateGuard - Replace the guards using the destination of the
+    /// pmov Copy by its source.
+    bool propagateGuard(MachineBasicBlock &MBB, MachineInstr &Copy);
+
+    /// isDeadAfter - Check if Reg is not read after I before it is written
+    /// again, also not by the successors of the block.
+    bool isDeadAfter(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                     Register Reg) const;
+
+    /// isCandidate - Check if MI may be rewritten or removed.
+    bool isCandidate(const MachineInstr &MI) const;
+  };
+
+  char PatmosPeephole::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosPeepholePass - Returns a pass that removes redundant
+/// constant loads and predicate copies and moves.
+///
+FunctionPass *llvm::createPatmosPeepholePass(PatmosTargetMachine &tm) {
+  return new PatmosPeephole(tm);
+}
+
+bool PatmosPeephole::isCandidate(const MachineInstr &MI) const {
+  return !MI.isBundle() && !MI.isBundled() && !MI.isInlineAsm() &&
+         !MI.isDebugInstr();
+}
+
+bool PatmosPeephole::isDeadAfter(MachineBasicBlock &MBB,
+                                 MachineBasicBlock::iterator I,
+                                 Register Reg) const {
+  for (++I; I != MBB.end(); ++I) {
+    if (I->isDebugInstr())
+      continue;
+    if (I->readsRegister(Reg, TRI))
+      return false;
+    // a predicated definition might not be executed
+    if (I->modifiesRegister(Reg, TRI) && !TII->isPredicated(*I))
+      return true;
+  }
+
+  for (MachineBasicBlock *Succ : MBB.successors()) {
+    for (MCRegAliasIterator A(Reg, TRI, true); A.isValid(); ++A) {
+      if (Succ->isLiveIn(*A))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool PatmosPeephole::optimizeBlock(MachineBasicBlock &MBB) {
+  for (MachineInstr &MI : MBB) {
+    if (!isCandidate(MI) || TII->isPredicated(MI))
+      continue;
+
+    bool Rewritten = false;
+    switch (MI.getOpcode()) {
+    case Patmos::LIi:
+    case Patmos::LIl:
+      Rewritten = foldImmediate(MBB, MI);
+      break;
+    case Patmos::MOVpr:
+      Rewritten = rewriteTest(MBB, MI);
+      break;
+    case Patmos::PMOV:
+      Rewritten = propagateGuard(MBB, MI);
+      break;
+    }
+    if (!Rewritten && IsPredicateDef(MI.getOpcode()))
+      Rewritten = retargetDef(MBB, MI);
+
+    // MI and the instructions following it might have been removed
+    if (Rewritten)
+      return true;
+  }
+
+  return false;
+}
+
+bool PatmosPeephole::foldImmediate(MachineBasicBlock &MBB, MachineInstr &LI) {
+  Register Rd = LI.getOperand(0).getReg();
+  const MachineOperand &ImmMO = LI.getOperand(3);
+  if (Rd == Patmos::R0)
+    return false;
+
+  // find the single user within the search distance
+  MachineBasicBlock::iterator I(LI);
+  MachineInstr *User = nullptr;
+  for (unsigned Distance = 0; ++I != MBB.end() && Distance < MaxSearchDistance;
+       Distance++) {
+    if (I->isDebugInstr())
+      continue;
+    if (I->readsRegister(Rd, TRI)) {
+      User = &*I;
+      break;
+    }
+    if (I->modifiesRegister(Rd, TRI))
+      return false;
+  }
+  if (!User || !isCandidate(*User))
+    return false;
+
+  int Opcode = LI.getOpcode() == Patmos::LIl
+                 ? Patmos::getALUlOpcode(User->getOpcode())
+                 : Patmos::getALUiOpcode(User->getOpcode());
+  if (Opcode < 0)
+    return false;
+
+  // the shift amounts of the short forms are five bits only
+  if (Opcode == Patmos::SLi || Opcode == Patmos::SRi ||
+      Opcode == Patmos::SRAi) {
+    if (!ImmMO.isImm() || !isUInt<5>(ImmMO.getImm()))
+      return false;
+  }
+  if (Opcode == Patmos::SLl || Opcode == Patmos::SRl || Opcode == Patmos::SRAl)
+    return false;
+
+  // the register form is rd = rs1 op rs2, the constant replaces rs2
+  unsigned Src = 3;
+  if (User->getOperand(4).getReg() != Rd) {
+    if (!User->isCommutable())
+      return false;
+    Src = 4;
+  }
+  if (User->getOperand(Src).getReg() == Rd ||
+      !isDeadAfter(MBB, *User, Rd))
+    return false;
+
+  LLVM_DEBUG( dbgs() << "Fold in BB#" << MBB.getNumber() << ": " << LI
+                     << "  into: " << *User );
+
+  const MachineOperand &Dst = User->getOperand(0);
+  const MachineOperand &Base = User->getOperand(Src);
+  BuildMI(MBB, *User, User->getDebugLoc(), TII->get(Opcode))
+    .addReg(Dst.getReg(), RegState::Define | getDeadRegState(Dst.isDead()))
+    .add(User->getOperand(1)).add(User->getOperand(2))
+    .addReg(Base.getReg(), getKillRegState(Base.isKill()))
+    .add(ImmMO);
+
+  User->eraseFromParent();
+  LI.eraseFromParent();
+
+  FoldedImms++;
+  return true;
+}
+
+bool PatmosPeephole::retargetDef(MachineBasicBlock &MBB, MachineInstr &Def) {
+  Register Pd = Def.getOperand(0).getReg();
+  if (Pd == Patmos::P0)
+    return false;
+
+  // find the copy, nothing else may use the predicate in between
+  MachineBasicBlock::iterator I(Def);
+  MachineInstr *Copy = nullptr;
+  for (unsigned Distance = 0; ++I != MBB.end() && Distance < MaxSearchDistance;
+       Distance++) {
+    if (I->isDebugInstr())
+      continue;
+    if (I->readsRegister(Pd, TRI)) {
+      Copy = &*I;
+      break;
+    }
+    if (I->modifiesRegister(Pd, TRI))
+      return false;
+  }
+  if (!Copy || Copy->getOpcode() != Patmos::PMOV || !isCandidate(*Copy) ||
+      TII->isPredicated(*Copy) || Copy->getOperand(3).getReg() != Pd ||
+      Copy->getOperand(4).getImm() != 0)
+    return false;
+
+  // the destination of the copy must not be used between the two
+  Register Dst = Copy->getOperand(0).getReg();
+  if (Dst == Pd)
+    return false;
+  for (I = std::next(MachineBasicBlock::iterator(Def)); &*I != Copy; ++I) {
+    if (I->readsRegister(Dst, TRI) || I->modifiesRegister(Dst, TRI))
+      return false;
+  }
+  if (!isDeadAfter(MBB, *Copy, Pd))
+    return false;
+
+  LLVM_DEBUG( dbgs() << "Retarget in BB#" << MBB.getNumber() << ": " << Def
+                     << "  to: " << *Copy );
+
+  Def.getOperand(0).setReg(Dst);
+  Def.getOperand(0).setIsDead(Copy->getOperand(0).isDead());
+  Copy->eraseFromParent();
+
+  RetargetedDefs++;
+  return true;
+}
+
+bool PatmosPeephole::rewriteTest(MachineBasicBlock &MBB, MachineInstr &Mov) {
+  // rd = zext(ps), the tests compare rd against zero
+  Register Rd = Mov.getOperand(0).getReg();
+  Register Ps = Mov.getOperand(3).getReg();
+  int64_t PsFlag = Mov.getOperand(4).getImm();
+  if (Rd == Patmos::R0)
+    return false;
+
+  bool Changed = false;
+  MachineBasicBlock::iterator I(Mov);
+  for (unsigned Distance = 0; ++I != MBB.end() && Distance < MaxSearchDistance;
+       Distance++) {
+    MachineInstr &MI = *I;
+    if (MI.isDebugInstr())
+      continue;
+
+    bool Inverted = false;
+    bool IsTest = false;
+    if (isCandidate(MI) && MI.readsRegister(Rd, TRI)) {
+      switch (MI.getOpcode()) {
+      case Patmos::MOVrp:
+      case Patmos::ISODD:
+        IsTest = true;
+        break;
+      case Patmos::BTESTI:
+      case Patmos::CMPINEQ:
+        IsTest = MI.getOperand(4).getImm() == 0;
+        break;
+      case Patmos::CMPIEQ:
+        IsTest = MI.getOperand(4).getImm() == 0;
+        Inverted = true;
+        break;
+      }
+      IsTest &= MI.getOperand(3).getReg() == Rd;
+    }
+
+    if (IsTest) {
+      LLVM_DEBUG( dbgs() << "Rewrite in BB#" << MBB.getNumber() << ": "
+                         << MI );
+
+      const MachineOperand &Pd = MI.getOperand(0);
+      BuildMI(MBB, MI, MI.getDebugLoc(), TII->get(Patmos::PMOV))
+        .addReg(Pd.getReg(), RegState::Define | getDeadRegState(Pd.isDead()))
+        .add(MI.getOperand(1)).add(MI.getOperand(2))
+        .addReg(Ps).addImm(Inverted ? !PsFlag : PsFlag);
+      I = MBB.erase(I);
+      --I;
+
+      RewrittenTests++;
+      Changed = true;
+    }
+    else if (MI.readsRegister(Rd, TRI)) {
+      break;
+    }
+
+    // rd or ps changed, the remaining tests see other values
+    if (I->modifiesRegister(Rd, TRI) || I->modifiesRegister(Ps, TRI))
+      break;
+  }
+
+  // the move itself is not needed anymore if nothing else reads rd
+  if (Changed && isDeadAfter(MBB, Mov, Rd)) {
+    LLVM_DEBUG( dbgs() << "Remove in BB#" << MBB.getNumber() << ": " << Mov );
+    Mov.eraseFromParent();
+    RemovedMoves++;
+  }
+
+  return Changed;
+}
+
+bool PatmosPeephole::propagateGuard(MachineBasicBlock &MBB,
+                                    MachineInstr &Copy) {
+  Register Pd = Copy.getOperand(0).getReg();
+  Register Ps = Copy.getOperand(3).getReg();
+  int64_t PsFlag = Copy.getOperand(4).getImm();
+  if (Pd == Patmos::P0)
+    return false;
+
+  // collect the guards reading Pd until it is written again, the source
+  // must not change before the last of them
+  SmallVector<MachineInstr*, 4> Users;
+  bool SourceChanged = false;
+  MachineBasicBlock::iterator I(Copy);
+  bool Dead = false;
+  for (unsigned Distance = 0; ++I != MBB.end() && Distance < MaxSearchDistance;
+       Distance++) {
+    MachineInstr &MI = *I;
+    if (MI.isDebugInstr())
+      continue;
+
+    if (MI.readsRegister(Pd, TRI)) {
+      int Guard = MI.findFirstPredOperandIdx();
+      if (SourceChanged || !isCandidate(MI) || Guard < 0 ||
+          MI.getOperand(Guard).getReg() != Pd)
+        return false;
+      // Pd must not be read by any other operand
+      for (unsigned i = 0, e = MI.getNumOperands(); i != e; i++) {
+        const MachineOperand &MO = MI.getOperand(i);
+        if ((int)i != Guard && MO.isReg() && MO.readsReg() &&
+            TRI->regsOverlap(MO.getReg(), Pd))
+          return false;
+      }
+      Users.push_back(&MI);
+    }
+
+    if (MI.modifiesRegister(Pd, TRI)) {
+      // a predicated definition might keep the old value
+      if (TII->isPredicated(MI))
+        return false;
+      Dead = true;
+      break;
+    }
+
+    if (MI.modifiesRegister(Ps, TRI))
+      SourceChanged = true;
+  }
+
+  // Pd must not be needed after the search distance or in the successors
+  if (!Dead && (I != MBB.end() || !isDeadAfter(MBB, std::prev(I), Pd)))
+    return false;
+  if (Users.empty())
+    return false;
+
+  for (MachineInstr *MI : Users) {
+    int Guard = MI->findFirstPredOperandIdx();
+    MI->getOperand(Guard).setReg(Ps);
+    MI->getOperand(Guard + 1).setImm(MI->getOperand(Guard + 1).getImm() ^
+                                     PsFlag);
+    LLVM_DEBUG( dbgs() << "Propagate in BB#" << MBB.getNumber() << ": "
+                       << *MI );
+    PropagatedGuards++;
+  }
+  Copy.eraseFromParent();
+  return true;
+}
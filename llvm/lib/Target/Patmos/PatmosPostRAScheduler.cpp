@@ -11,6 +11,13 @@
 // ScheduleDAGInstr. This is similar to the PostRASchedulerList pass, but
 // uses the ScheduleDAGPostRA.
 //
+// With -mpatmos-superblock-sched, the scheduling regions at the end of a block
+// are extended along hot paths before scheduling: the leading instructions of
+// a hot successor that has no other predecessor are hoisted above the branch,
+// guarded by the branch condition. On the side exit the hoisted instructions
+// are disabled by their guard, so no compensation code is needed, and the
+// scheduler can use them to fill the issue slots at the end of the block.
+//
 // TODO This code is mostly similar to MachineScheduler and ScheduleDAGMI.
 // In fact, most of it is copied from there, merged with the
 // PostRASchedulerList code and adapted for VLIW scheduling. This should be
@@ -30,6 +37,7 @@
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/CodeGen/AntiDepBreaker.h"
 #include "llvm/CodeGen/LatencyPriorityQueue.h"
+#include "llvm/CodeGen/MachineBranchProbabilityInfo.h"
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
@@ -59,6 +67,10 @@ STATISTIC(NumFixedAnti, "Number of fixed anti-dependencies");
 STATISTIC(NumBundled, "Number of bundles with size > 1");
 STATISTIC(NumNotBundled, "Number of instructions not bundled");
 STATISTIC(NumRescheduled, "Number of rescheduled instructions");
+STATISTIC(NumSuperblockHoisted, "Number of instructions hoisted into the "
+                                "predecessor of a hot successor");
+STATISTIC(NumWindows, "Number of scheduling regions cut into windows");
+STATISTIC(NumOverBudget, "Number of functions exceeding the scheduling budget");
 
 static cl::opt<bool> ViewPostRASchedDAGs("view-postra-sched-dags", cl::Hidden,
   cl::desc("Pop up a window to show PostRASched dags after they are processed"));
@@ -70,10 +82,49 @@ EnableAntiDepBreaking("mpatmos-break-anti-dependencies",
                                "\"critical\", \"all\", or \"none\""),
                       cl::Hidden);
 
+static cl::opt<bool> EnableSuperblocks("mpatmos-superblock-sched",
+  cl::init(false),
+  cl::desc("Hoist instructions of hot successors into their predecessor, "
+           "guarded by the branch condition, before post-RA scheduling "
+           "(default: only for functions with profile data)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SuperblockProbability(
+  "mpatmos-superblock-probability",
+  cl::init(80),
+  cl::desc("Minimum probability in percent of an edge to extend the "
+           "scheduling region of a block to its successor (default: 80)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SuperblockHoistLimit(
+  "mpatmos-superblock-hoist-limit",
+  cl::init(2),
+  cl::desc("Maximum number of instructions hoisted from a hot successor "
+           "into its predecessor (default: 2)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SchedWindowSize(
+  "mpatmos-postra-sched-window",
+  cl::init(1000),
+  cl::desc("Maximum number of instructions in a post-RA scheduling region, "
+           "larger regions are scheduled in windows (default: 1000, "
+           "0: unlimited)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SchedBudget(
+  "mpatmos-postra-sched-budget",
+  cl::init(50000),
+  cl::desc("Number of instructions per function scheduled with the full "
+           "window size, the remaining regions are scheduled in small windows "
+           "(default: 50000, 0: unlimited)."),
+  cl::Hidden);
 
 // DAG subtrees must have at least this many nodes.
 static const unsigned MinSubtreeSize = 8;
 
+// Window size used once the scheduling budget of a function is exhausted.
+static const unsigned DegradedWindowSize = 32;
+
 
 namespace {
 
@@ -86,19 +137,34 @@ namespace {
       initializePatmosPostRASchedulerPass(*PassRegistry::getPassRegistry());
     }
 
+    // The scheduler does not use the loops or dominators, they need not be
+    // computed for it, in particular not for single-path functions, which
+    // are only bundled. Machine passes preserve the alias analysis, it is
+    // computed once per function before register allocation anyway.
     void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.setPreservesCFG();
       AU.addRequired<AAResultsWrapperPass>();
       AU.addRequired<TargetPassConfig>();
-      AU.addRequired<MachineDominatorTree>();
       AU.addPreserved<MachineDominatorTree>();
-      AU.addRequired<MachineLoopInfo>();
       AU.addPreserved<MachineLoopInfo>();
+      AU.addRequired<MachineBranchProbabilityInfo>();
       MachineFunctionPass::getAnalysisUsage(AU);
     }
 
     bool runOnMachineFunction(MachineFunction &Fn);
 
+  private:
+    /// formSuperblocks - Hoist the leading instructions of hot successors
+    /// into their unique predecessor, guarded by the branch condition.
+    void formSuperblocks();
+
+    /// isHoistable - Check if an instruction of a successor can be moved
+    /// above the terminators Terms of its predecessor and be guarded by the
+    /// predicate Cond.
+    bool isHoistable(const PatmosInstrInfo &PII, MachineInstr &MI,
+                     ArrayRef<MachineOperand> Cond,
+                     ArrayRef<MachineInstr*> Terms) const;
+
   };
   char PatmosPostRAScheduler::ID = 0;
 
@@ -134,16 +200,17 @@ nextIfDebug(MachineBasicBlock::iterator I, MachineBasicBlock::iterator End) {
 
 bool PatmosPostRAScheduler::runOnMachineFunction(MachineFunction &mf) {
 
-  if( mf.getInfo<PatmosMachineFunctionInfo>()->isSinglePath()){
-      LLVM_DEBUG( dbgs() << "********** Not running PatmosPostRAScheduler on '" << mf.getName() << "' as it is single-path **********\n");
-      finalizeBundles(mf); // Must be called, otherwise bundles wont be emitted correctly
-      return true;
+  // Single-path functions are scheduled and bundled by the SPScheduler and
+  // PatmosSPBundling already, their bundles only need their headers, which
+  // is a single walk over the instructions.
+  if (mf.getInfo<PatmosMachineFunctionInfo>()->isSinglePath()) {
+    LLVM_DEBUG(dbgs() << "********** Finalizing the bundles of single-path "
+                      << "function '" << mf.getName() << "' **********\n");
+    return finalizeBundles(mf);
   }
 
   // Initialize the context of the pass.
   MF = &mf;
-  MLI = &getAnalysis<MachineLoopInfo>();
-  MDT = &getAnalysis<MachineDominatorTree>();
   PassConfig = &getAnalysis<TargetPassConfig>();
   AA = &getAnalysis<AAResultsWrapperPass>().getAAResults();
 
@@ -180,6 +247,18 @@ bool PatmosPostRAScheduler::runOnMachineFunction(MachineFunction &mf) {
 
   std::unique_ptr<ScheduleDAGPostRA> Scheduler(new ScheduleDAGPostRA(this, S));
 
+  // the hot paths are only reliable if they are measured
+  if (EnableSuperblocks.getNumOccurrences() ? EnableSuperblocks
+                                            : mf.getFunction().hasProfileData())
+    formSuperblocks();
+
+  // Huge regions, e.g. in generated code, are cut into windows to bound the
+  // cost of building and scheduling the DAG. Windows do not overlap, but the
+  // exit edges of loads keep their latencies correct across the cut. Once the
+  // budget is exhausted, the remaining regions use small windows.
+  unsigned Window = SchedWindowSize;
+  unsigned NumScheduled = 0;
+
   // Visit all machine basic blocks.
   for (MachineFunction::iterator MBB = MF->begin(), MBBEnd = MF->end();
        MBB != MBBEnd; ++MBB) {
@@ -224,6 +303,10 @@ bool PatmosPostRAScheduler::runOnMachineFunction(MachineFunction &mf) {
         if (Scheduler->isSchedulingBoundary(&*std::prev(I), &*MBB, *MF))
           break;
         assert(!I->isBundled() && "Rescheduling bundled code is not supported.");
+        if (Window && EndIndex - StartIndex >= Window && !I->isDebugValue()) {
+          NumWindows++;
+          break;
+        }
       }
       assert(!I->isBundled() && "Rescheduling bundled code is not supported.");
 
@@ -254,6 +337,17 @@ bool PatmosPostRAScheduler::runOnMachineFunction(MachineFunction &mf) {
       // Close the current region.
       Scheduler->exitRegion();
 
+      NumScheduled += EndIndex - StartIndex;
+      if (SchedBudget && NumScheduled > SchedBudget &&
+          (!Window || Window > DegradedWindowSize))
+      {
+        LLVM_DEBUG(dbgs() << "Scheduling budget exhausted in "
+                          << MF->getName() << ", using windows of "
+                          << DegradedWindowSize << " instructions\n");
+        Window = DegradedWindowSize;
+        NumOverBudget++;
+      }
+
       // Scheduling has invalidated the current iterator 'I'. Ask the
       // scheduler for the top of it's scheduled region.
       RegionEnd = Scheduler->begin();
@@ -271,9 +365,112 @@ bool PatmosPostRAScheduler::runOnMachineFunction(MachineFunction &mf) {
   return true;
 }
 
+bool PatmosPostRAScheduler::isHoistable(const PatmosInstrInfo &PII,
+                                        MachineInstr &MI,
+                                        ArrayRef<MachineOperand> Cond,
+                                        ArrayRef<MachineInstr*> Terms) const {
+  if (MI.isBundled() || MI.isDebugInstr() || MI.isPseudo() ||
+      MI.isTerminator() || MI.isCall() || MI.isInlineAsm() ||
+      MI.hasUnmodeledSideEffects() || !MI.isPredicable() ||
+      PII.isPredicated(MI))
+    return false;
+
+  const TargetRegisterInfo *TRI = MF->getSubtarget().getRegisterInfo();
+  for (const MachineOperand &MO : MI.operands()) {
+    if (!MO.isReg() || !MO.getReg() || !MO.isDef())
+      continue;
+
+    // Implicit definitions (e.g., of the stack cache registers) are not
+    // disabled by the guard in all cases, keep them where they are.
+    if (MO.isImplicit())
+      return false;
+
+    // Do not change the guard of the hoisted instruction or the branch.
+    if (TRI->regsOverlap(MO.getReg(), Cond[0].getReg()))
+      return false;
+
+    for (ArrayRef<MachineInstr*>::iterator I = Terms.begin(), E = Terms.end();
+         I != E; ++I) {
+      if ((*I)->readsRegister(MO.getReg(), TRI))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void PatmosPostRAScheduler::formSuperblocks() {
+  const PatmosInstrInfo &PII =
+        *static_cast<const PatmosInstrInfo*>(MF->getSubtarget().getInstrInfo());
+  MachineBranchProbabilityInfo &MBPI =
+                                  getAnalysis<MachineBranchProbabilityInfo>();
+  BranchProbability Hot(SuperblockProbability, 100);
+
+  for (MachineFunction::iterator I = MF->begin(), E = MF->end(); I != E; ++I) {
+    MachineBasicBlock *MBB = &*I;
+
+    MachineBasicBlock *TBB = 0, *FBB = 0;
+    SmallVector<MachineOperand, 2> Cond;
+    if (PII.analyzeBranch(*MBB, TBB, FBB, Cond) || Cond.empty() || !TBB)
+      continue;
+
+    // Find the successor on the hot path and the guard for that path.
+    MachineBasicBlock *Succ = 0;
+    for (MachineBasicBlock::succ_iterator SI = MBB->succ_begin(),
+         SE = MBB->succ_end(); SI != SE; ++SI) {
+      if (*SI != MBB && MBPI.getEdgeProbability(MBB, *SI) >= Hot)
+        Succ = *SI;
+    }
+    if (!Succ || Succ->pred_size() != 1 || Succ->isEHPad() ||
+        Succ->hasAddressTaken())
+      continue;
+
+    if (Succ != TBB) {
+      if (TBB == FBB || PII.reverseBranchCondition(Cond))
+        continue;
+    }
+
+    SmallVector<MachineInstr*, 2> Terms;
+    for (MachineBasicBlock::iterator T = MBB->getFirstTerminator(),
+         TE = MBB->end(); T != TE; ++T) {
+      Terms.push_back(&*T);
+    }
+
+    unsigned Hoisted = 0;
+    while (Hoisted < SuperblockHoistLimit && !Succ->empty()) {
+      MachineInstr &MI = Succ->front();
+      if (!isHoistable(PII, MI, Cond, Terms))
+        break;
+
+      LLVM_DEBUG(dbgs() << "Superblock: hoist from BB#" << Succ->getNumber()
+                        << " to BB#" << MBB->getNumber() << ": " << MI);
+
+      MI.removeFromParent();
+      MBB->insert(MBB->getFirstTerminator(), &MI);
+      PII.PredicateInstruction(MI, Cond);
+
+      // The uses may still be live on the side exit.
+      MI.clearKillInfo();
+
+      // The defs are now live-in to the successor.
+      for (const MachineOperand &MO : MI.operands()) {
+        if (MO.isReg() && MO.isDef() && MO.getReg() &&
+            !Succ->isLiveIn(MO.getReg()))
+          Succ->addLiveIn(MO.getReg());
+      }
+
+      Hoisted++;
+      NumSuperblockHoisted++;
+    }
+
+    if (Hoisted)
+      Succ->sortUniqueLiveIns();
+  }
+}
+
 
 PostRASchedContext::PostRASchedContext():
-    MF(0), MLI(0), MDT(0), PassConfig(0), AA(0),
+    MF(0), PassConfig(0), AA(0),
     AntiDepMode(TargetSubtargetInfo::AntiDepBreakMode::ANTIDEP_NONE) {
   RegClassInfo = new RegisterClassInfo();
 }
@@ -286,7 +483,7 @@ PostRASchedContext::~PostRASchedContext() {
 
 ScheduleDAGPostRA::ScheduleDAGPostRA(PostRASchedContext *C,
                                      PostRASchedStrategy *S)
-  : ScheduleDAGInstrs(*C->MF, C->MLI),
+  : ScheduleDAGInstrs(*C->MF, nullptr),
     SchedImpl(S), DFSResult(0), Topo(SUnits, &ExitSU), EndIndex(0), AA(C->AA),
     LiveRegs(TRI->getNumRegs())
 {
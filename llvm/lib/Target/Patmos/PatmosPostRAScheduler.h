@@ -29,8 +29,6 @@
 
 namespace llvm {
 
-  class MachineLoopInfo;
-  class MachineDominatorTree;
   class RegisterClassInfo;
   class TargetRegisterClass;
   class SUnit;
@@ -41,8 +39,6 @@ namespace llvm {
   /// for the target to instantiate a scheduler.
   struct PostRASchedContext {
     MachineFunction *MF;
-    const MachineLoopInfo *MLI;
-    const MachineDominatorTree *MDT;
     const TargetPassConfig *PassConfig;
     AAResults *AA;
 
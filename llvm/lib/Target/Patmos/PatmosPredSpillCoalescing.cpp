@@ -0,0 +1,286 @@
+//===-- PatmosPredSpillCoalescing.cpp - Spill predicates together. --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Coalesce the spills of several predicates into a single spill of S0.
+//
+// The register allocator spills every predicate on its own, which costs two
+// predicated stores per predicate. If several predicates are spilled close to
+// each other, e.g., when they are live across a region of high register
+// pressure, this pass replaces their spills by a single copy of S0 into a
+// free register and a single store of it into a new spill slot. The reloads
+// of the predicates then test their bit in the stored word.
+//
+// A spill is only coalesced if it is the only store into its spill slot, and
+// the spilled predicate is not redefined nor reloaded before the combined
+// spill.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosRegisterInfo.h"
+#include "PatmosTargetMachine.h"
+#include "SinglePath/PatmosSinglePathInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/LivePhysRegs.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-pred-spill-coalescing"
+
+STATISTIC(CoalescedSpills, "Number of predicate spills coalesced");
+STATISTIC(CombinedSpills,  "Number of combined spills of S0 inserted");
+
+namespace {
+
+  class PatmosPredSpillCoalescing : public MachineFunctionPass {
+  private:
+    const PatmosInstrInfo &TII;
+    const PatmosRegisterInfo &TRI;
+
+    /// The spill slots that may be coalesced, i.e., that are written by a
+    /// single predicate spill and are otherwise only reloaded.
+    BitVector Candidates;
+
+    /// For coalesced spill slots, the new spill slot and the bit in it.
+    DenseMap<int, std::pair<int, unsigned> > Coalesced;
+
+    static char ID;
+
+    /// getSpillFI - Return the spill slot of a predicate spill or reload, or
+    /// -1 if MI is none.
+    static int getSpillFI(const MachineInstr &MI) {
+      switch (MI.getOpcode()) {
+      case Patmos::PSEUDO_PREG_SPILL:
+      case Patmos::PSEUDO_PREG_RELOAD:
+        if (MI.getOperand(0).isFI())
+          return MI.getOperand(0).getIndex();
+      }
+      return -1;
+    }
+
+    /// findCandidates - Collect the spill slots with a single predicate spill
+    /// and no other accesses than predicate reloads.
+    void findCandidates(MachineFunction &MF) {
+      const MachineFrameInfo &MFI = MF.getFrameInfo();
+      unsigned NumFIs = MFI.getObjectIndexEnd();
+      BitVector Stored(NumFIs), Rejected(NumFIs);
+
+      for (auto &MBB : MF) {
+        for (auto &MI : MBB) {
+          for (const MachineOperand &MO : MI.operands()) {
+            if (!MO.isFI() || MO.getIndex() < 0)
+              continue;
+            int FI = MO.getIndex();
+
+            if (getSpillFI(MI) != FI || !MFI.isSpillSlotObjectIndex(FI))
+              Rejected.set(FI);
+            else if (MI.getOpcode() == Patmos::PSEUDO_PREG_SPILL) {
+              if (Stored.test(FI))
+                Rejected.set(FI);
+              Stored.set(FI);
+            }
+          }
+        }
+      }
+
+      Candidates = Stored;
+      Candidates.reset(Rejected);
+    }
+
+    /// findScratchReg - Return a caller-saved register that is free after MI,
+    /// or 0 if there is none.
+    unsigned findScratchReg(MachineInstr *MI) {
+      MachineBasicBlock &MBB = *MI->getParent();
+      const MachineRegisterInfo &MRI = MBB.getParent()->getRegInfo();
+
+      LivePhysRegs LPR(TRI);
+      LPR.addLiveOuts(MBB);
+      for (auto I = MBB.rbegin(); &*I != MI; ++I)
+        LPR.stepBackward(*I);
+
+      // do not use callee-saved registers, they would need to be saved in
+      // the prologue
+      BitVector CSRs(TRI.getNumRegs());
+      for (const MCPhysReg *CSR = MRI.getCalleeSavedRegs(); *CSR; ++CSR)
+        CSRs.set(*CSR);
+
+      for (unsigned Reg : Patmos::RRegsRegClass) {
+        if (!CSRs.test(Reg) && !MRI.isReserved(Reg) &&
+            LPR.available(MRI, Reg))
+          return Reg;
+      }
+      return 0;
+    }
+
+    /// coalesce - Replace the spills in Group by a single spill of S0 after
+    /// the last of them.
+    bool coalesce(std::vector<MachineInstr*> &Group) {
+      if (Group.size() < 2)
+        return false;
+
+      MachineInstr *Last = Group.back();
+      MachineBasicBlock &MBB = *Last->getParent();
+      MachineFunction &MF = *MBB.getParent();
+
+      unsigned Scratch = findScratchReg(Last);
+      if (!Scratch)
+        return false;
+
+      int NewFI = MF.getFrameInfo().CreateSpillStackObject(4, Align(4));
+
+      MachineBasicBlock::iterator InsertPt = std::next(Last->getIterator());
+      AddDefaultPred(BuildMI(MBB, InsertPt, Last->getDebugLoc(),
+                             TII.get(Patmos::MFS), Scratch))
+        .addReg(Patmos::S0);
+      TII.storeRegToStackSlot(MBB, InsertPt, Scratch, true, NewFI,
+                              &Patmos::RRegsRegClass, &TRI);
+
+      for (MachineInstr *MI : Group) {
+        int FI = MI->getOperand(0).getIndex();
+        unsigned Bit = TRI.getS0Index(MI->getOperand(2).getReg());
+        Coalesced[FI] = std::make_pair(NewFI, Bit);
+
+        LLVM_DEBUG(dbgs() << "Coalesce spill into FI#" << NewFI << ", bit "
+                          << Bit << ": " << *MI);
+        MI->eraseFromParent();
+        CoalescedSpills++;
+      }
+      CombinedSpills++;
+      return true;
+    }
+
+    /// coalesceBlock - Coalesce the groups of predicate spills within MBB.
+    bool coalesceBlock(MachineBasicBlock &MBB) {
+      bool Changed = false;
+      std::vector<MachineInstr*> Group;
+      BitVector GroupPRegs(TRI.getNumRegs());
+      BitVector GroupFIs(Candidates.size());
+
+      for (auto &MI : MBB) {
+        int FI = getSpillFI(MI);
+        bool IsCandidate = MI.getOpcode() == Patmos::PSEUDO_PREG_SPILL &&
+                           FI >= 0 && Candidates.test(FI);
+
+        // the stored values of the group must still be in S0 at the combined
+        // spill, and the spill slots must not be read before
+        bool Clobbers = FI >= 0 && GroupFIs.test(FI);
+        for (unsigned PReg : Patmos::PRegsRegClass) {
+          if (GroupPRegs.test(PReg) && MI.modifiesRegister(PReg, &TRI))
+            Clobbers = true;
+        }
+        if (IsCandidate && GroupPRegs.test(MI.getOperand(2).getReg()))
+          Clobbers = true;
+
+        if (Clobbers) {
+          Changed |= coalesce(Group);
+          Group.clear();
+          GroupPRegs.reset();
+          GroupFIs.reset();
+        }
+
+        if (IsCandidate) {
+          Group.push_back(&MI);
+          GroupPRegs.set(MI.getOperand(2).getReg());
+          GroupFIs.set(FI);
+        }
+      }
+
+      Changed |= coalesce(Group);
+      return Changed;
+    }
+
+    /// rewriteReloads - Reload the predicates of coalesced spill slots from
+    /// their bit in the combined spill slot.
+    void rewriteReloads(MachineFunction &MF) {
+      MachineFrameInfo &MFI = MF.getFrameInfo();
+
+      for (auto &MBB : MF) {
+        for (auto I = MBB.begin(), E = MBB.end(); I != E; ) {
+          MachineInstr &MI = *I++;
+          if (MI.getOpcode() != Patmos::PSEUDO_PREG_RELOAD)
+            continue;
+
+          auto C = Coalesced.find(getSpillFI(MI));
+          if (C == Coalesced.end())
+            continue;
+
+          int NewFI = C->second.first;
+          MachineMemOperand *MMO = MF.getMachineMemOperand(
+              MachinePointerInfo::getFixedStack(MF, NewFI),
+              MachineMemOperand::MOLoad, MFI.getObjectSize(NewFI),
+              MFI.getObjectAlign(NewFI));
+
+          BuildMI(MBB, MI, MI.getDebugLoc(),
+                  TII.get(Patmos::PSEUDO_PREG_RELOAD_BIT),
+                  MI.getOperand(0).getReg())
+            .addFrameIndex(NewFI).addImm(0) // address
+            .addImm(C->second.second)       // bit
+            .addMemOperand(MMO);
+          MI.eraseFromParent();
+        }
+      }
+
+      for (auto &C : Coalesced)
+        MFI.RemoveStackObject(C.first);
+    }
+
+  public:
+    PatmosPredSpillCoalescing(const PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID), TII(*tm.getInstrInfo()),
+        TRI(tm.getInstrInfo()->getPatmosRegisterInfo())
+    {
+    }
+
+    StringRef getPassName() const override {
+      return "Patmos Predicate Spill Coalescing";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesCFG();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      // single-path code manages the predicates itself
+      if (PatmosSinglePathInfo::isEnabled(MF) ||
+          MF.getFunction().hasFnAttribute(Attribute::Naked))
+        return false;
+
+      findCandidates(MF);
+      if (Candidates.none())
+        return false;
+
+      bool Changed = false;
+      Coalesced.clear();
+      for (auto &MBB : MF)
+        Changed |= coalesceBlock(MBB);
+
+      if (Changed)
+        rewriteReloads(MF);
+
+      return Changed;
+    }
+  };
+
+  char PatmosPredSpillCoalescing::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosPredSpillCoalescingPass - Returns a new
+/// PatmosPredSpillCoalescing pass.
+FunctionPass *
+llvm::createPatmosPredSpillCoalescingPass(const PatmosTargetMachine &tm) {
+  return new PatmosPredSpillCoalescing(tm);
+}
@@ -0,0 +1,529 @@
+//===-- PatmosPredicateCSE.cpp - Reuse and hoist predicate definitions ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Remove redundant predicate definitions from predicated code, after the
+// if-converter and the single-path reduction, which leave compares and
+// predicate combinations behind that MachineCSE and MachineLICM do not see
+// anymore, or do not consider as they are as cheap as a move.
+//
+// The value numbering is local to the blocks, extended to blocks with a single
+// predecessor. A predicate is numbered by its canonical definition, which
+// also covers its complement: cmpneq a, b is !cmpeq a, b, cmple a, b is
+// !cmplt b, a, pnot p is !pmov p, por !a, !b is !pand a, b, and so on. A
+// definition of a predicate that is available in another register, plain or
+// negated, is removed if all its uses are guards or predicate operands, which
+// are then rewritten to the available register with the flag of the
+// negation.
+//
+// Unpredicated definitions of loop-invariant predicates are hoisted into the
+// preheader of their loop, if the predicate register is not written otherwise
+// in the loop and is not live into its header.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosTargetMachine.h"
+#include "SinglePath/PatmosSinglePathInfo.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/TargetRegisterInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-predicate-cse"
+
+STATISTIC( RemovedPreds, "Number of redundant predicate definitions removed");
+STATISTIC( NegatedPreds, "Number of predicates reused negated");
+STATISTIC( HoistedPreds, "Number of loop-invariant predicate definitions "
+                         "hoisted");
+
+static cl::opt<bool> EnablePredicateCSE("mpatmos-predicate-cse",
+  cl::init(false),
+  cl::desc("Reuse equal and complementary predicates and hoist loop-invariant "
+           "predicate definitions of predicated code (default: false)."),
+  cl::Hidden);
+
+namespace {
+
+  /// PredValue - The canonical definition of a predicate: the opcode and the
+  /// source operands, each a flag indicating a register and the register or
+  /// the immediate.
+  struct PredValue {
+    unsigned Opcode;
+    SmallVector<std::pair<bool, int64_t>, 4> Ops;
+
+    bool operator==(const PredValue &V) const {
+      return Opcode == V.Opcode && Ops == V.Ops;
+    }
+
+    /// reads - Check if the value depends on a register overlapping Reg.
+    bool reads(Register Reg, const TargetRegisterInfo *TRI) const {
+      for (const auto &Op : Ops) {
+        if (Op.first && TRI->regsOverlap(Register((unsigned)Op.second), Reg))
+          return true;
+      }
+      return false;
+    }
+
+    /// isClobberedBy - Check if MI writes a register the value depends on.
+    bool isClobberedBy(const MachineInstr &MI,
+                       const TargetRegisterInfo *TRI) const {
+      for (const auto &Op : Ops) {
+        if (Op.first &&
+            MI.modifiesRegister(Register((unsigned)Op.second), TRI))
+          return true;
+      }
+      return false;
+    }
+  };
+
+  /// AvailPred - A predicate value available in a register, possibly
+  /// negated.
+  struct AvailPred {
+    PredValue Value;
+    Register Reg;
+    bool Negated;
+  };
+
+  typedef std::vector<AvailPred> AvailPreds;
+
+  class PatmosPredicateCSE : public MachineFunctionPass {
+  private:
+    static char ID;
+
+    const PatmosInstrInfo *TII;
+    const TargetRegisterInfo *TRI;
+
+  public:
+    PatmosPredicateCSE(PatmosTargetMachine &tm)
+      : MachineFunctionPass(ID),
+        TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())),
+        TRI(tm.getSubtargetImpl()->getRegisterInfo()) { }
+
+    StringRef getPassName() const override {
+      return "Patmos Predicate CSE and LICM";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesCFG();
+      AU.addRequired<MachineLoopInfo>();
+      AU.addPreserved<MachineLoopInfo>();
+      AU.addPreserved<PatmosSinglePathInfo>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override;
+
+  private:
+    /// getValue - Get the canonical value of the predicate defined by MI and
+    /// whether MI defines its complement. Return false if MI is not a
+    /// predicate definition handled here.
+    bool getValue(const MachineInstr &MI, const AvailPreds &Avail,
+                  PredValue &V, bool &Negated) const;
+
+    /// numberBlock - Remove the redundant predicate definitions of the
+    /// block, given the predicates available at its entry. Leave the
+    /// predicates available at its exit in Avail.
+    bool numberBlock(MachineBasicBlock &MBB, AvailPreds &Avail);
+
+    /// replaceUses - Rewrite the uses of the predicate From defined by Def to
+    /// the predicate To, negated if Negate is set. Return false if some use
+    /// cannot be rewritten.
+    bool replaceUses(MachineBasicBlock &MBB, MachineInstr &Def,
+                     Register From, Register To, bool Negate);
+
+    /// hoistLoop - Hoist the loop-invariant predicate definitions of the loop
+    /// into its preheader.
+    bool hoistLoop(MachineLoop *L);
+
+    /// isCandidate - Check if MI is an unbundled predicate definition without
+    /// guard.
+    bool isCandidate(const MachineInstr &MI) const {
+      return IsPredicateDef(MI.getOpcode()) && !MI.isBundled() &&
+             !TII->isPredicated(MI);
+    }
+  };
+
+  char PatmosPredicateCSE::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosPredicateCSEPass - Returns a pass that removes redundant and
+/// hoists loop-invariant predicate definitions.
+///
+FunctionPass *llvm::createPatmosPredicateCSEPass(PatmosTargetMachine &tm) {
+  return new PatmosPredicateCSE(tm);
+}
+
+bool PatmosPredicateCSE::runOnMachineFunction(MachineFunction &MF) {
+  if (!EnablePredicateCSE || skipFunction(MF.getFunction()) ||
+      !MF.getRegInfo().tracksLiveness())
+    return false;
+
+  LLVM_DEBUG( dbgs() << "\n[PredicateCSE] "
+                     << MF.getFunction().getName() << "\n" );
+
+  bool Changed = false;
+
+  // hoist from the innermost loops first, their preheaders are blocks of the
+  // outer loops
+  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+  SmallVector<MachineLoop*, 8> Loops(MLI.getBase().getLoopsInPreorder());
+  for (auto I = Loops.rbegin(), E = Loops.rend(); I != E; ++I)
+    Changed |= hoistLoop(*I);
+
+  // the predicates available at the exits of the blocks
+  std::map<const MachineBasicBlock*, AvailPreds> ExitPreds;
+  ReversePostOrderTraversal<MachineFunction*> RPOT(&MF);
+  for (MachineBasicBlock *MBB : RPOT) {
+    // the block is only entered from its predecessor, the predicates still
+    // live are available
+    AvailPreds Avail;
+    if (MBB->pred_size() == 1) {
+      auto Pred = ExitPreds.find(*MBB->pred_begin());
+      if (Pred != ExitPreds.end()) {
+        for (const AvailPred &A : Pred->second) {
+          if (MBB->isLiveIn(A.Reg))
+            Avail.push_back(A);
+        }
+      }
+    }
+    Changed |= numberBlock(*MBB, Avail);
+    ExitPreds[MBB].swap(Avail);
+  }
+
+  return Changed;
+}
+
+bool PatmosPredicateCSE::getValue(const MachineInstr &MI,
+                                  const AvailPreds &Avail,
+                                  PredValue &V, bool &Negated) const {
+  // all sources must be registers or immediates
+  for (unsigned i = 3, e = MI.getNumExplicitOperands(); i != e; i++) {
+    const MachineOperand &MO = MI.getOperand(i);
+    if (MO.isReg())
+      V.Ops.push_back(std::make_pair(true, (int64_t)MO.getReg()));
+    else if (MO.isImm())
+      V.Ops.push_back(std::make_pair(false, MO.getImm()));
+    else
+      return false;
+  }
+
+  V.Opcode = MI.getOpcode();
+  Negated = false;
+
+  switch (V.Opcode) {
+  case Patmos::CMPNEQ:
+    V.Opcode = Patmos::CMPEQ;
+    Negated = true;
+    LLVM_FALLTHROUGH;
+  case Patmos::CMPEQ:
+    if (V.Ops[1] < V.Ops[0])
+      std::swap(V.Ops[0], V.Ops[1]);
+    break;
+  case Patmos::MOVrp:
+    // cmpneq rs, r0
+    V.Opcode = Patmos::CMPEQ;
+    V.Ops.push_back(std::make_pair(true, (int64_t)Patmos::R0));
+    if (V.Ops[1] < V.Ops[0])
+      std::swap(V.Ops[0], V.Ops[1]);
+    Negated = true;
+    break;
+  case Patmos::CMPLE:
+    V.Opcode = Patmos::CMPLT;
+    std::swap(V.Ops[0], V.Ops[1]);
+    Negated = true;
+    break;
+  case Patmos::CMPULE:
+    V.Opcode = Patmos::CMPULT;
+    std::swap(V.Ops[0], V.Ops[1]);
+    Negated = true;
+    break;
+  case Patmos::CMPINEQ:
+    V.Opcode = Patmos::CMPIEQ;
+    Negated = true;
+    break;
+  case Patmos::ISODD:
+    // btest rs, 0
+    V.Opcode = Patmos::BTESTI;
+    V.Ops.push_back(std::make_pair(false, (int64_t)0));
+    break;
+  case Patmos::PCLR:
+    V.Opcode = Patmos::PSET;
+    Negated = true;
+    break;
+  case Patmos::PXOR:
+    // a ^ !b == !(a ^ b)
+    Negated = V.Ops[1].second != V.Ops[3].second;
+    V.Ops[1].second = V.Ops[3].second = 0;
+    LLVM_FALLTHROUGH;
+  case Patmos::POR:
+  case Patmos::PAND:
+    // !a | !b == !(a & b), !a & !b == !(a | b)
+    if (V.Opcode != Patmos::PXOR && V.Ops[1].second && V.Ops[3].second) {
+      V.Opcode = V.Opcode == Patmos::POR ? Patmos::PAND : Patmos::POR;
+      V.Ops[1].second = V.Ops[3].second = 0;
+      Negated = true;
+    }
+    if (std::make_pair(V.Ops[2], V.Ops[3]) <
+        std::make_pair(V.Ops[0], V.Ops[1])) {
+      std::swap(V.Ops[0], V.Ops[2]);
+      std::swap(V.Ops[1], V.Ops[3]);
+    }
+    break;
+  case Patmos::PNOT:
+  case Patmos::PMOV: {
+    // a copy of a known predicate has its value
+    Negated = (V.Opcode == Patmos::PNOT) != (V.Ops[1].second != 0);
+    Register Src = (unsigned)V.Ops[0].second;
+    V.Opcode = Patmos::PMOV;
+    V.Ops.pop_back();
+    for (const AvailPred &A : Avail) {
+      if (A.Reg == Src) {
+        V = A.Value;
+        Negated ^= A.Negated;
+        break;
+      }
+    }
+    break;
+  }
+  }
+
+  return true;
+}
+
+bool PatmosPredicateCSE::numberBlock(MachineBasicBlock &MBB,
+                                     AvailPreds &Avail) {
+  bool Changed = false;
+
+  for (MachineBasicBlock::instr_iterator I = MBB.instr_begin(),
+       E = MBB.instr_end(); I != E; ) {
+    MachineInstr &MI = *I++;
+    if (MI.isDebugInstr() || MI.isBundle())
+      continue;
+
+    PredValue V;
+    bool Negated = false;
+    bool IsDef = isCandidate(MI) && getValue(MI, Avail, V, Negated);
+    if (IsDef) {
+      Register Pd = MI.getOperand(0).getReg();
+      for (const AvailPred &A : Avail) {
+        if (!(A.Value == V))
+          continue;
+
+        bool Negate = A.Negated != Negated;
+        if ((A.Reg == Pd && !Negate) ||
+            (A.Reg != Pd && replaceUses(MBB, MI, Pd, A.Reg, Negate))) {
+          LLVM_DEBUG( dbgs() << "Remove in BB#" << MBB.getNumber() << ": "
+                             << MI );
+          MI.eraseFromParent();
+          RemovedPreds++;
+          if (Negate)
+            NegatedPreds++;
+          Changed = true;
+          IsDef = false;
+        }
+        break;
+      }
+      if (!IsDef)
+        continue;
+    }
+
+    // forget the predicates MI overwrites or that depend on registers it
+    // writes
+    for (auto A = Avail.begin(); A != Avail.end(); ) {
+      if (MI.modifiesRegister(A->Reg, TRI) || A->Value.isClobberedBy(MI, TRI))
+        A = Avail.erase(A);
+      else
+        ++A;
+    }
+
+    if (IsDef) {
+      Register Pd = MI.getOperand(0).getReg();
+      if (!V.reads(Pd, TRI))
+        Avail.push_back(AvailPred{V, Pd, Negated});
+    }
+  }
+
+  return Changed;
+}
+
+bool PatmosPredicateCSE::replaceUses(MachineBasicBlock &MBB,
+                                     MachineInstr &Def, Register From,
+                                     Register To, bool Negate) {
+  // the operands to rewrite: guards and predicate operands reading From
+  // until it is written again, To must not change before the last of them
+  SmallVector<std::pair<MachineInstr*, unsigned>, 8> Uses;
+  bool ToChanged = false;
+  bool Dead = false;
+  MachineBasicBlock::instr_iterator I(Def);
+  for (++I; I != MBB.instr_end(); ++I) {
+    MachineInstr &MI = *I;
+    if (MI.isDebugInstr())
+      continue;
+
+    if (MI.readsRegister(From, TRI)) {
+      if (ToChanged || MI.isBundle())
+        return false;
+      const MCInstrDesc &Desc = MI.getDesc();
+      for (unsigned i = 0, e = MI.getNumOperands(); i != e; i++) {
+        const MachineOperand &MO = MI.getOperand(i);
+        if (!MO.isReg() || !MO.readsReg() ||
+            !TRI->regsOverlap(MO.getReg(), From))
+          continue;
+        if (MO.getReg() != From || MO.isImplicit() ||
+            i >= Desc.getNumOperands() || !Desc.OpInfo[i].isPredicate() ||
+            i + 1 >= MI.getNumOperands() || !MI.getOperand(i + 1).isImm())
+          return false;
+        Uses.push_back(std::make_pair(&MI, i));
+      }
+    }
+
+    if (MI.modifiesRegister(From, TRI)) {
+      // a predicated definition might keep the old value
+      if (TII->isPredicated(MI))
+        return false;
+      Dead = true;
+      break;
+    }
+
+    if (MI.modifiesRegister(To, TRI))
+      ToChanged = true;
+  }
+
+  if (!Dead) {
+    for (MachineBasicBlock *Succ : MBB.successors()) {
+      for (MCRegAliasIterator A(From, TRI, true); A.isValid(); ++A) {
+        if (Succ->isLiveIn(*A))
+          return false;
+      }
+    }
+  }
+
+  // To lives until the last rewritten use now
+  for (MachineBasicBlock::instr_iterator J(Def); ; --J) {
+    for (MachineOperand &MO : J->operands()) {
+      if (MO.isReg() && MO.getReg() == To) {
+        if (MO.isUse())
+          MO.setIsKill(false);
+        else
+          MO.setIsDead(false);
+      }
+    }
+    if (J->modifiesRegister(To, TRI) || J == MBB.instr_begin())
+      break;
+  }
+  for (auto &U : Uses) {
+    U.first->getOperand(U.second).setIsKill(false);
+  }
+
+  for (auto &U : Uses) {
+    MachineInstr &MI = *U.first;
+    MI.getOperand(U.second).setReg(To);
+    MachineOperand &Flag = MI.getOperand(U.second + 1);
+    Flag.setImm(Flag.getImm() ^ (int64_t)Negate);
+    LLVM_DEBUG( dbgs() << "  rewrite: " << MI );
+  }
+
+  return true;
+}
+
+bool PatmosPredicateCSE::hoistLoop(MachineLoop *L) {
+  MachineBasicBlock *Preheader = L->getLoopPreheader();
+  MachineBasicBlock *Header = L->getHeader();
+  if (!Preheader || Preheader->succ_size() != 1)
+    return false;
+
+  bool Changed = false;
+  for (MachineBasicBlock *MBB : L->blocks()) {
+    for (MachineBasicBlock::instr_iterator I = MBB->instr_begin(),
+         E = MBB->instr_end(); I != E; ) {
+      MachineInstr &MI = *I++;
+      if (!isCandidate(MI))
+        continue;
+
+      Register Pd = MI.getOperand(0).getReg();
+      bool LiveIn = false;
+      for (MCRegAliasIterator A(Pd, TRI, true); A.isValid(); ++A)
+        LiveIn |= Header->isLiveIn(*A);
+      if (LiveIn)
+        continue;
+
+      // the sources must be invariant, and MI the only definition of Pd
+      bool Invariant = true;
+      for (MachineBasicBlock *B : L->blocks()) {
+        for (MachineInstr &J : B->instrs()) {
+          if (&J == &MI || J.isBundle())
+            continue;
+          if (J.modifiesRegister(Pd, TRI))
+            Invariant = false;
+          for (const MachineOperand &MO : MI.uses()) {
+            if (MO.isReg() && MO.getReg() && J.modifiesRegister(MO.getReg(),
+                                                                TRI))
+              Invariant = false;
+          }
+          if (!Invariant)
+            break;
+        }
+        if (!Invariant)
+          break;
+      }
+      if (!Invariant)
+        continue;
+
+      // the terminators of the preheader must not use Pd
+      MachineBasicBlock::iterator Pos = Preheader->getFirstTerminator();
+      bool Used = false;
+      for (MachineBasicBlock::iterator T = Pos; T != Preheader->end(); ++T)
+        Used |= T->readsRegister(Pd, TRI) || T->modifiesRegister(Pd, TRI);
+      if (Used)
+        continue;
+
+      LLVM_DEBUG( dbgs() << "Hoist from BB#" << MBB->getNumber()
+                         << " to BB#" << Preheader->getNumber() << ": "
+                         << MI );
+
+      MI.removeFromParent();
+      Preheader->insert(Pos, &MI);
+      for (MachineOperand &MO : MI.operands()) {
+        if (MO.isReg() && MO.isUse())
+          MO.setIsKill(false);
+        else if (MO.isReg())
+          MO.setIsDead(false);
+      }
+
+      // Pd is live throughout the loop now
+      for (MachineBasicBlock *B : L->blocks()) {
+        if (!B->isLiveIn(Pd))
+          B->addLiveIn(Pd);
+        for (MachineInstr &J : B->instrs()) {
+          for (MachineOperand &MO : J.operands()) {
+            if (MO.isReg() && MO.isUse() && MO.getReg() == Pd)
+              MO.setIsKill(false);
+          }
+        }
+      }
+
+      HoistedPreds++;
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
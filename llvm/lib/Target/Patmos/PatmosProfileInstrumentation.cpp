@@ -0,0 +1,277 @@
+//===-- PatmosProfileInstrumentation.cpp - Count cycles of functions/loops ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Instrument functions and loops with reads of a hardware counter, given by
+// -mpatmos-profile.
+//
+// The counter is read by a single local load from the I/O device space,
+// which is the low word of the cycle counter of the timer by default. Any
+// other 32-bit counter device, e.g., cache miss counters where the hardware
+// provides them, can be given by -mpatmos-profile-counter. The difference of
+// the counter at the entry and at the exits of a function or loop is added to
+// a profile record:
+//
+//   struct __patmos_profile_record {
+//     unsigned long long Cycles; // the sum of the deltas of all executions
+//     unsigned Count;            // the number of executions
+//     unsigned Kind;             // 0: function, 1: loop, 2: call
+//     const char *Name;          // the function, the loop header or callee
+//     unsigned Line;             // the source line of a loop, or 0
+//   };
+//
+// The records are placed in the section patmos_profile, which the runtime
+// walks from __start_patmos_profile to __stop_patmos_profile, see
+// __patmos_profile_foreach in compiler-rt.
+//
+// Single-path code is not instrumented, such that its timing is unchanged.
+// Calls of single-path roots are measured around the call site instead.
+// Loops are measured around their preheader and exit blocks, only up to the
+// depth given by -mpatmos-profile-loop-depth to keep the counter reads out of
+// hot inner loops.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "SinglePath/PatmosSinglePathInfo.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-profile"
+
+STATISTIC(NumFunctions, "Number of functions instrumented for profiling");
+STATISTIC(NumLoops,     "Number of loops instrumented for profiling");
+STATISTIC(NumCalls,     "Number of single-path calls instrumented for "
+                        "profiling");
+STATISTIC(NumSkippedLoops, "Number of loops not instrumented for lack of a "
+                           "preheader or dedicated exits");
+
+static cl::opt<unsigned> ProfileCounter(
+  "mpatmos-profile-counter",
+  cl::init(0xF0020004),
+  cl::desc("The I/O address of the 32-bit counter read by -mpatmos-profile "
+           "(default: the low word of the cycle counter, 0xF0020004)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> ProfileLoopDepth(
+  "mpatmos-profile-loop-depth",
+  cl::init(1),
+  cl::desc("Instrument loops up to the given nesting depth with "
+           "-mpatmos-profile (default: 1, the outermost loops, 0 for none)."),
+  cl::Hidden);
+
+namespace {
+  /// The kinds of profile records, in sync with the runtime.
+  enum ProfileKind { PK_Function = 0, PK_Loop = 1, PK_Call = 2 };
+
+  class PatmosProfileInstrumentation : public ModulePass {
+  private:
+    /// The type of the profile records, see the file comment.
+    StructType *RecordTy;
+
+    /// The records created for the module, to be kept by llvm.used.
+    SmallVector<GlobalValue*, 32> Records;
+
+    /// createRecord - Create a zero-initialized profile record.
+    GlobalVariable *createRecord(Module &M, ProfileKind Kind, StringRef Name,
+                                 unsigned Line) {
+      LLVMContext &Ctx = M.getContext();
+      Constant *NameStr = ConstantDataArray::getString(Ctx, Name);
+      GlobalVariable *NameVar = new GlobalVariable(M, NameStr->getType(), true,
+                                                   GlobalValue::PrivateLinkage,
+                                                   NameStr, "__profile_name");
+      NameVar->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+      Constant *Fields[] = {
+        ConstantInt::get(Type::getInt64Ty(Ctx), 0),
+        ConstantInt::get(Type::getInt32Ty(Ctx), 0),
+        ConstantInt::get(Type::getInt32Ty(Ctx), Kind),
+        ConstantExpr::getPointerCast(NameVar, Type::getInt8PtrTy(Ctx)),
+        ConstantInt::get(Type::getInt32Ty(Ctx), Line)
+      };
+      GlobalVariable *Record = new GlobalVariable(M, RecordTy, false,
+                                       GlobalValue::PrivateLinkage,
+                                       ConstantStruct::get(RecordTy, Fields),
+                                       "__profile_record");
+      Record->setSection("patmos_profile");
+      Records.push_back(Record);
+      return Record;
+    }
+
+    /// readCounter - Read the counter in front of IP.
+    Value *readCounter(IRBuilder<> &B) {
+      // the I/O devices are accessed by local loads
+      PointerType *PtrTy = PointerType::get(B.getInt32Ty(), 1);
+      Value *Ptr = B.CreateIntToPtr(B.getInt32(ProfileCounter), PtrTy);
+      return B.CreateLoad(B.getInt32Ty(), Ptr, /*isVolatile=*/true,
+                          "profile.counter");
+    }
+
+    /// updateRecord - Read the counter in front of IP and add its difference
+    /// to Start to the record.
+    void updateRecord(Instruction *IP, GlobalVariable *Record, Value *Start) {
+      IRBuilder<> B(IP);
+      Value *Delta = B.CreateSub(readCounter(B), Start, "profile.delta");
+
+      // the counter wraps around, the difference does not
+      Value *CyclesPtr = B.CreateStructGEP(RecordTy, Record, 0);
+      Value *Cycles = B.CreateLoad(B.getInt64Ty(), CyclesPtr);
+      B.CreateStore(B.CreateAdd(Cycles, B.CreateZExt(Delta, B.getInt64Ty())),
+                    CyclesPtr);
+
+      Value *CountPtr = B.CreateStructGEP(RecordTy, Record, 1);
+      Value *Count = B.CreateLoad(B.getInt32Ty(), CountPtr);
+      B.CreateStore(B.CreateAdd(Count, B.getInt32(1)), CountPtr);
+    }
+
+    /// instrumentLoop - Measure L around its preheader and exit blocks and its
+    /// subloops up to the maximal depth.
+    void instrumentLoop(Module &M, Function &F, Loop *L) {
+      if (L->getLoopDepth() > ProfileLoopDepth)
+        return;
+
+      for (Loop *SubLoop : *L)
+        instrumentLoop(M, F, SubLoop);
+
+      BasicBlock *Preheader = L->getLoopPreheader();
+      if (!Preheader || !L->hasDedicatedExits()) {
+        NumSkippedLoops++;
+        return;
+      }
+
+      SmallVector<BasicBlock*, 4> Exits;
+      L->getUniqueExitBlocks(Exits);
+      if (Exits.empty()) {
+        NumSkippedLoops++;
+        return;
+      }
+
+      unsigned Line = 0;
+      if (DILocation *Loc = L->getStartLoc())
+        Line = Loc->getLine();
+
+      BasicBlock *Header = L->getHeader();
+      std::string Name = (F.getName() + ":" + Header->getName()).str();
+      GlobalVariable *Record = createRecord(M, PK_Loop, Name, Line);
+
+      IRBuilder<> B(Preheader->getTerminator());
+      Value *Start = readCounter(B);
+      for (BasicBlock *Exit : Exits)
+        updateRecord(&*Exit->getFirstInsertionPt(), Record, Start);
+
+      NumLoops++;
+    }
+
+    /// instrumentSinglePathCalls - Measure the calls of single-path roots
+    /// around their call sites.
+    void instrumentSinglePathCalls(Module &M, Function &F) {
+      SmallVector<CallInst*, 4> Calls;
+      for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+          CallInst *CI = dyn_cast<CallInst>(&I);
+          Function *Callee = CI ? CI->getCalledFunction() : nullptr;
+          if (Callee && PatmosSinglePathInfo::isRoot(*Callee))
+            Calls.push_back(CI);
+        }
+      }
+
+      for (CallInst *CI : Calls) {
+        GlobalVariable *Record = createRecord(M, PK_Call,
+                                     CI->getCalledFunction()->getName(), 0);
+        IRBuilder<> B(CI);
+        Value *Start = readCounter(B);
+        updateRecord(CI->getNextNode(), Record, Start);
+        NumCalls++;
+      }
+    }
+
+    /// instrumentFunction - Measure F from its entry to its returns, and its
+    /// loops and single-path calls.
+    void instrumentFunction(Module &M, Function &F) {
+      SmallVector<ReturnInst*, 4> Returns;
+      for (BasicBlock &BB : F) {
+        if (ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+          Returns.push_back(RI);
+      }
+
+      LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+      for (Loop *L : LI)
+        instrumentLoop(M, F, L);
+
+      instrumentSinglePathCalls(M, F);
+
+      if (Returns.empty())
+        return;
+
+      GlobalVariable *Record = createRecord(M, PK_Function, F.getName(), 0);
+      IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+      Value *Start = readCounter(B);
+      for (ReturnInst *RI : Returns)
+        updateRecord(RI, Record, Start);
+
+      NumFunctions++;
+    }
+
+  public:
+    static char ID;
+
+    PatmosProfileInstrumentation() : ModulePass(ID), RecordTy(nullptr) {}
+
+    StringRef getPassName() const override {
+      return "Patmos Profile Instrumentation";
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<LoopInfoWrapperPass>();
+    }
+
+    bool runOnModule(Module &M) override {
+      LLVMContext &Ctx = M.getContext();
+      RecordTy = StructType::get(Ctx, { Type::getInt64Ty(Ctx),
+                                        Type::getInt32Ty(Ctx),
+                                        Type::getInt32Ty(Ctx),
+                                        Type::getInt8PtrTy(Ctx),
+                                        Type::getInt32Ty(Ctx) });
+      Records.clear();
+
+      for (Function &F : M) {
+        if (F.isDeclaration() || PatmosSinglePathInfo::isEnabled(F))
+          continue;
+        LLVM_DEBUG(dbgs() << "Profile: instrument " << F.getName() << "\n");
+        instrumentFunction(M, F);
+      }
+
+      // the records are only accessed through their section
+      appendToUsed(M, Records);
+      return !Records.empty();
+    }
+  };
+
+  char PatmosProfileInstrumentation::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosProfileInstrumentationPass - Returns a new pass that
+/// instruments functions and loops with reads of a hardware counter.
+ModulePass *llvm::createPatmosProfileInstrumentationPass() {
+  return new PatmosProfileInstrumentation();
+}
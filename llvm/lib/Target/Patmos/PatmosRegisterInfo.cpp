@@ -26,6 +26,7 @@
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Support/ErrorHandling.h"
 
 #include "llvm/Support/Debug.h"
@@ -34,6 +35,13 @@
 #define GET_REGINFO_TARGET_DESC
 #include "PatmosGenRegisterInfo.inc"
 
+STATISTIC(LargeFIOffsets,      "Large frame offsets computed");
+STATISTIC(ReusedLargeFIOffsets, "Large frame offsets reusing a computed base");
+
+/// MaxLargeFIBaseDistance - Maximal number of instructions searched backwards
+/// for a base of large frame offsets to reuse.
+static const unsigned MaxLargeFIBaseDistance = 32;
+
 using namespace llvm;
 
 // FIXME: Provide proper call frame setup / destroy opcodes.
@@ -44,7 +52,7 @@ PatmosRegisterInfo::PatmosRegisterInfo(const PatmosTargetMachine &tm,
 const uint32_t *PatmosRegisterInfo::getCallPreservedMask(const MachineFunction &MF,
                                      CallingConv::ID) const
 {
-  llvm_unreachable("Unimplemented");
+  return CSR_Patmos_RegMask;
 }
 
 const MCPhysReg*
@@ -74,6 +82,48 @@ PatmosRegisterInfo::getCalleeSavedRegs(const MachineFunction *MF) const {
     Patmos::P5, Patmos::P6, Patmos::P7,
     0
   };
+  // Interrupt handlers must preserve every register of the interrupted code,
+  // but only save those clobbered by themselves or their callees, see
+  // PatmosFrameLowering::determineCalleeSaves. R9 is the temporary used to
+  // save the special registers and must be saved first and restored last.
+  static const uint16_t InterruptSavedRegs[] = {
+    // Special regs
+    Patmos::S0, Patmos::SRB, Patmos::SRO, Patmos::SL, Patmos::SH,
+    // GPR
+    Patmos::R1, Patmos::R2, Patmos::R3, Patmos::R4,
+    Patmos::R5, Patmos::R6, Patmos::R7, Patmos::R8,
+    Patmos::R10, Patmos::R11, Patmos::R12, Patmos::R13,
+    Patmos::R14, Patmos::R15, Patmos::R16, Patmos::R17,
+    Patmos::R18, Patmos::R19, Patmos::R20, Patmos::R21,
+    Patmos::R22, Patmos::R23, Patmos::R24, Patmos::R25,
+    Patmos::R26, Patmos::R27, Patmos::R28, Patmos::RTR,
+    // Predicate regs
+    Patmos::P1, Patmos::P2, Patmos::P3, Patmos::P4,
+    Patmos::P5, Patmos::P6, Patmos::P7,
+    Patmos::R9,
+    0
+  };
+  static const uint16_t InterruptSavedRegsFP[] = {
+    // Special regs
+    Patmos::S0, Patmos::SRB, Patmos::SRO, Patmos::SL, Patmos::SH,
+    // GPR
+    Patmos::R1, Patmos::R2, Patmos::R3, Patmos::R4,
+    Patmos::R5, Patmos::R6, Patmos::R7, Patmos::R8,
+    Patmos::R10, Patmos::R11, Patmos::R12, Patmos::R13,
+    Patmos::R14, Patmos::R15, Patmos::R16, Patmos::R17,
+    Patmos::R18, Patmos::R19, Patmos::R20, Patmos::R21,
+    Patmos::R22, Patmos::R23, Patmos::R24, Patmos::R25,
+    Patmos::R26, Patmos::R27, Patmos::R28, Patmos::RTR,
+    Patmos::RFP,
+    // Predicate regs
+    Patmos::P1, Patmos::P2, Patmos::P3, Patmos::P4,
+    Patmos::P5, Patmos::P6, Patmos::P7,
+    Patmos::R9,
+    0
+  };
+
+  if (PatmosFrameLowering::isInterruptHandler(*MF))
+    return (TFI->hasFP(*MF)) ? InterruptSavedRegsFP : InterruptSavedRegs;
 
   return (TFI->hasFP(*MF)) ? CalleeSavedRegsFP : CalleeSavedRegs;
 }
@@ -125,6 +175,51 @@ BitVector PatmosRegisterInfo::getReservedRegs(const MachineFunction &MF) const {
 }
 
 
+bool
+PatmosRegisterInfo::reuseLargeFIBase(int &offset, unsigned &basePtr,
+                                     MachineBasicBlock::iterator II,
+                                     int shl) const {
+  MachineBasicBlock &MBB = *II->getParent();
+
+  // find the last definition of the scratch register in the block
+  unsigned distance = 0;
+  MachineBasicBlock::iterator I = II;
+  while (I != MBB.begin() && distance++ < MaxLargeFIBaseDistance) {
+    --I;
+
+    // the callee, inline assembly, or a modified base pointer invalidate the
+    // computed base
+    if (I->isCall() || I->isInlineAsm() || I->modifiesRegister(basePtr, this))
+      return false;
+
+    if (!I->modifiesRegister(Patmos::RTR, this))
+      continue;
+
+    // only reuse bases computed by computeLargeFIOffset, unconditionally
+    if ((I->getOpcode() != Patmos::ADDi && I->getOpcode() != Patmos::ADDl) ||
+        TII.isPredicated(*I) || I->getOperand(0).getReg() != Patmos::RTR ||
+        I->getOperand(3).getReg() != basePtr || !I->getOperand(4).isImm() ||
+        I->getFlag(MachineInstr::FrameSetup) !=
+                                        II->getFlag(MachineInstr::FrameSetup))
+      return false;
+
+    // the access must be in range of the base, in units of the access size
+    int delta = (offset << shl) - I->getOperand(4).getImm();
+    if (delta & ((1 << shl) - 1) || !isInt<7>(delta >> shl))
+      return false;
+
+    // the base now lives up to the new access
+    for (MachineBasicBlock::iterator J = std::next(I); J != II; ++J)
+      J->clearRegisterKills(Patmos::RTR, this);
+
+    basePtr = Patmos::RTR;
+    offset = delta >> shl;
+    ReusedLargeFIOffsets++;
+    return true;
+  }
+  return false;
+}
+
 void
 PatmosRegisterInfo::computeLargeFIOffset(MachineRegisterInfo &MRI,
                                          int &offset, unsigned &basePtr,
@@ -135,6 +230,12 @@ PatmosRegisterInfo::computeLargeFIOffset(MachineRegisterInfo &MRI,
 
   assert(offset >= 0);
 
+  // accesses to neighbouring frame objects share the computed base
+  if (reuseLargeFIBase(offset, basePtr, II, shl))
+    return;
+
+  LargeFIOffsets++;
+
   // get offset
   unsigned offsetLeft = 63; // -64 for offsets < 0
   unsigned offsetLarge = offset - offsetLeft;
@@ -204,6 +305,19 @@ PatmosRegisterInfo::expandPseudoPregInstr(MachineBasicBlock::iterator II,
       }
       break;
 
+    case Patmos::PSEUDO_PREG_RELOAD_BIT:
+      {
+        unsigned ld_opc = (isOnStackCache) ? Patmos::LWS : Patmos::LWC;
+        unsigned DestReg = PseudoMI.getOperand(0).getReg();
+        unsigned Bit = PseudoMI.getOperand(3).getImm();
+
+        AddDefaultPred(BuildMI(MBB, II, DL, TII.get(ld_opc), Patmos::RTR))
+          .addReg(basePtr, false).addImm(offset); // address
+        AddDefaultPred(BuildMI(MBB, II, DL, TII.get(Patmos::BTESTI), DestReg))
+          .addReg(Patmos::RTR, RegState::Kill).addImm(Bit); // p <- r[bit]
+      }
+      break;
+
     default:
       llvm_unreachable("Unexpected MI in expandPseudoPregInstr()!");
 
@@ -257,6 +371,15 @@ PatmosRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator II,
   // get offset
   int Offset = SCFIs.empty() ? MFI.getStackSize() + FrameOffset : FrameOffset;
 
+  // stack cache frames may be coalesced into the frame of a caller
+  if (isOnStackCache)
+    Offset += PMFI.getStackCacheFrameBase();
+
+  // the stack cache region reserves its objects on top of the frame
+  if (isOnStackCache && PMFI.isInStackCacheRegion(MI.getParent()) &&
+      !PMFI.isStackCacheRegionFI(FrameIndex))
+    Offset += PMFI.getStackCacheRegionBytes();
+
   //----------------------------------------------------------------------------
   // Base register
 
@@ -280,6 +403,7 @@ PatmosRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator II,
     case Patmos::SWC: case Patmos::SWM:
     case Patmos::PSEUDO_PREG_SPILL:
     case Patmos::PSEUDO_PREG_RELOAD:
+    case Patmos::PSEUDO_PREG_RELOAD_BIT:
       // 9 bit
       assert((Offset & 0x3) == 0);
       Offset = (Offset >> 2) + FrameDisplacement;
@@ -336,7 +460,8 @@ PatmosRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator II,
 
   // special handling of pseudo instructions: expand
   if ( opcode==Patmos::PSEUDO_PREG_SPILL ||
-       opcode==Patmos::PSEUDO_PREG_RELOAD ) {
+       opcode==Patmos::PSEUDO_PREG_RELOAD ||
+       opcode==Patmos::PSEUDO_PREG_RELOAD_BIT ) {
       expandPseudoPregInstr(II, Offset, BasePtr, isOnStackCache);
       return;
   }
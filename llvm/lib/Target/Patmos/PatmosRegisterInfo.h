@@ -27,16 +27,22 @@ private:
   const PatmosTargetMachine &TM;
   const TargetInstrInfo &TII;
 
+  /// reuseLargeFIBase - Address a large FI offset relative to a base computed
+  /// by computeLargeFIOffset before in the same block, if it is in range.
+  /// \note The offset and basePtr arguments are updated on success!
+  bool reuseLargeFIBase(int &offset, unsigned &basePtr,
+                        MachineBasicBlock::iterator II, int shl) const;
+
   /// computeLargeFIOffset - Emit an ADDi or ADDl instruction to compute a large
-  /// FI offset.
+  /// FI offset, or reuse a base computed before.
   /// \note The offset and basePtr arguments are possibly updated!
   void computeLargeFIOffset(MachineRegisterInfo &MRI,
                             int &offset, unsigned &basePtr,
                             MachineBasicBlock::iterator II,
                             int shl) const;
 
-  /// expandPseudoPregInstr - expand PSEUDO_PREG_SPILL or PSEUDO_PREG_RELOAD
-  /// to a sequence of real machine instructions.
+  /// expandPseudoPregInstr - expand PSEUDO_PREG_SPILL, PSEUDO_PREG_RELOAD
+  /// or PSEUDO_PREG_RELOAD_BIT to a sequence of real machine instructions.
   void expandPseudoPregInstr(MachineBasicBlock::iterator II,
                              int offset, unsigned basePtr,
                              bool isOnStackCache) const;
@@ -0,0 +1,381 @@
+//===-- PatmosSPMTiling.cpp - Stage streamed arrays in the scratchpad -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Loops streaming over large arrays evict the data cache and make the number
+// of misses hard to bound. This pass copies the streamed words tile by tile
+// into a staging area of the local scratchpad and lets the loop read the
+// copies.
+//
+// A stream is a simple word load of an innermost loop whose address advances
+// by one word per iteration and that is executed in every iteration. The
+// loop must have a computable trip count, must only exit at its latch, and
+// must have no calls and no stores that may alias a stream. At the start of
+// every tile a copy loop moves the next words of all streams into the
+// staging area with cache-bypassing loads (LWM) and local stores (SWL). The
+// loads of the loop then become local loads (LWL) of the copies, which
+// always hit in a single cycle.
+//
+// The staging area is given by -mpatmos-spm-tile-base and
+// -mpatmos-spm-tile-size. The application must not use it otherwise. It is
+// split evenly among the streams of a loop.
+//
+// The copy loop carries a loop bound of the tile size. The WCET analysis
+// accounts it in every iteration of the tiled loop unless it is given the
+// frequency of the tiles.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-spm-tiling"
+
+STATISTIC(NumTiledLoops,   "Number of loops staging streams in the scratchpad");
+STATISTIC(NumTiledStreams, "Number of streams staged in the scratchpad");
+
+static cl::opt<unsigned> SPMTileBase("mpatmos-spm-tile-base",
+  cl::init(0),
+  cl::desc("Local address of the scratchpad area for staging streamed "
+           "arrays (default: 0)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SPMTileSize("mpatmos-spm-tile-size",
+  cl::init(0),
+  cl::desc("Size in bytes of the scratchpad area for staging streamed "
+           "arrays (default: 0, disabled)."),
+  cl::Hidden);
+
+/// The largest number of streams staged for one loop.
+static const unsigned MaxStreams = 4;
+
+/// The smallest tile in words worth the copy loop.
+static const unsigned MinTileWords = 8;
+
+/// The address space of the local scratchpad and of cache-bypassing
+/// accesses, see PatmosInstrPatterns.td.
+static const unsigned SPMAddrSpace = 1;
+static const unsigned UncachedAddrSpace = 3;
+
+namespace {
+
+class PatmosSPMTiling : public FunctionPass {
+private:
+  /// A load streaming over an array, one word per iteration.
+  struct Stream {
+    LoadInst *Load;
+    const SCEVAddRecExpr *Addr;
+  };
+
+  LoopInfo *LI;
+  ScalarEvolution *SE;
+  DominatorTree *DT;
+  AAResults *AA;
+
+  /// findStreams - Collect the streams of L, return false if L cannot be
+  /// tiled.
+  bool findStreams(Loop *L, SmallVectorImpl<Stream> &Streams) const;
+
+  /// tileLoop - Copy the streams of L tile-wise into the scratchpad.
+  void tileLoop(Loop *L, ArrayRef<Stream> Streams, unsigned TileWords);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+
+  PatmosSPMTiling() : FunctionPass(ID) {
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeLoopInfoWrapperPassPass(Registry);
+    initializeScalarEvolutionWrapperPassPass(Registry);
+    initializeDominatorTreeWrapperPassPass(Registry);
+    initializeAAResultsWrapperPassPass(Registry);
+  }
+
+  /// getPassName - Return the pass' name.
+  StringRef getPassName() const override {
+    return "Patmos Scratchpad Tiling";
+  }
+
+  /// getAnalysisUsage - The analyses are only needed if the pass is enabled,
+  /// they are not computed otherwise.
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    if (SPMTileSize == 0) {
+      AU.setPreservesAll();
+      return;
+    }
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addPreserved<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addPreserved<DominatorTreeWrapperPass>();
+    AU.addRequired<AAResultsWrapperPass>();
+  }
+
+  bool runOnFunction(Function &F) override;
+};
+
+} // end anonymous namespace
+
+char PatmosSPMTiling::ID = 0;
+
+FunctionPass *llvm::createPatmosSPMTilingPass() {
+  return new PatmosSPMTiling();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosSPMTiling::runOnFunction(Function &F) {
+  if (SPMTileSize == 0 || skipFunction(F)) return false;
+
+  LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  AA = &getAnalysis<AAResultsWrapperPass>().getAAResults();
+
+  // tiling adds a child loop, collect the innermost loops first
+  SmallVector<Loop*, 8> Innermost;
+  for (Loop *L : LI->getLoopsInPreorder())
+    if (L->isInnermost())
+      Innermost.push_back(L);
+
+  bool changed = false;
+  for (Loop *L : Innermost) {
+    SmallVector<Stream, MaxStreams> Streams;
+    if (!findStreams(L, Streams))
+      continue;
+
+    unsigned TileWords = PowerOf2Floor(SPMTileSize / 4 / Streams.size());
+    if (TileWords < MinTileWords)
+      continue;
+
+    tileLoop(L, Streams, TileWords);
+    changed = true;
+  }
+  return changed;
+}
+
+bool PatmosSPMTiling::findStreams(Loop *L,
+                                  SmallVectorImpl<Stream> &Streams) const {
+  // the loop must only be left at the latch, such that the streams are
+  // read in every iteration, including the last
+  BasicBlock *Latch = L->getLoopLatch();
+  if (!L->isLoopSimplifyForm() || !L->getExitBlock() ||
+      L->getExitingBlock() != Latch)
+    return false;
+
+  // the copies are limited by the remaining iterations, which must not wrap
+  const SCEV *BTC = SE->getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC) ||
+      SE->getTypeSizeInBits(BTC->getType()) > 32 ||
+      SE->getUnsignedRangeMax(BTC).isMaxValue())
+    return false;
+
+  const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+  SmallVector<Instruction*, 8> Stores;
+  for (BasicBlock *BB : L->blocks()) {
+    for (Instruction &I : *BB) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (isa<CallBase>(I) && I.mayHaveSideEffects())
+        return false;
+      if (isa<StoreInst>(I) || (I.mayWriteToMemory() && !isa<CallBase>(I))) {
+        Stores.push_back(&I);
+        continue;
+      }
+
+      LoadInst *Load = dyn_cast<LoadInst>(&I);
+      if (!Load || !Load->isSimple() ||
+          Load->getPointerAddressSpace() != 0 || Load->getAlign() < 4 ||
+          DL.getTypeStoreSize(Load->getType()) != 4 ||
+          !DT->dominates(BB, Latch))
+        continue;
+
+      auto *Addr = dyn_cast<SCEVAddRecExpr>(
+                     SE->getSCEV(Load->getPointerOperand()));
+      if (!Addr || Addr->getLoop() != L || !Addr->isAffine())
+        continue;
+      auto *Step = dyn_cast<SCEVConstant>(Addr->getStepRecurrence(*SE));
+      if (!Step || Step->getAPInt() != 4 ||
+          !SE->isLoopInvariant(Addr->getStart(), L))
+        continue;
+
+      if (Streams.size() == MaxStreams)
+        return false;
+      Streams.push_back({Load, Addr});
+    }
+  }
+  if (Streams.empty())
+    return false;
+
+  // the copies must stay valid for the whole tile
+  for (Instruction *I : Stores) {
+    for (const Stream &S : Streams) {
+      if (!isa<StoreInst>(I) ||
+          !AA->isNoAlias(MemoryLocation::getBeforeOrAfter(
+                           S.Load->getPointerOperand()),
+                         MemoryLocation::getBeforeOrAfter(
+                           cast<StoreInst>(I)->getPointerOperand())))
+        return false;
+    }
+  }
+  return true;
+}
+
+void PatmosSPMTiling::tileLoop(Loop *L, ArrayRef<Stream> Streams,
+                               unsigned TileWords) {
+  Function &F = *L->getHeader()->getParent();
+  LLVMContext &Ctx = F.getContext();
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  PointerType *SPMPtrTy = Int32Ty->getPointerTo(SPMAddrSpace);
+  PointerType *UncachedPtrTy = Int32Ty->getPointerTo(UncachedAddrSpace);
+
+  LLVM_DEBUG(dbgs() << "Tile loop '" << L->getHeader()->getName() << "' in "
+                    << F.getName() << ", " << Streams.size()
+                    << " streams of " << TileWords << " words\n");
+
+  // the trip count and the iteration, before the header is split. The last
+  // tile only copies the remaining words of the streams, which all are read
+  // in every iteration.
+  const SCEV *BTC = SE->getTruncateOrZeroExtend(SE->getBackedgeTakenCount(L),
+                                                Int32Ty);
+  const SCEV *Iteration = SE->getAddRecExpr(SE->getZero(Int32Ty),
+                                            SE->getOne(Int32Ty), L,
+                                            SCEV::FlagNUW);
+  const SCEV *Remaining = SE->getMinusSCEV(
+                            SE->getAddExpr(BTC, SE->getOne(Int32Ty)),
+                            Iteration);
+  const SCEV *Count = SE->getUMinExpr(Remaining,
+                                      SE->getConstant(Int32Ty, TileWords));
+
+  // Header: the position in the tile, refill at its start
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  PHINode *Pos = PHINode::Create(Int32Ty, 2, "spm.pos", &Header->front());
+
+  BasicBlock *Body = SplitBlock(Header, Header->getFirstNonPHI(), DT, LI);
+  if (Latch == Header)
+    Latch = Body;
+
+  // The Patmos loop bounds are read from the terminator of the header
+  Instruction *OldTerm = Body->getTerminator();
+  MDNode *LoopID = OldTerm->getMetadata(LLVMContext::MD_loop);
+  OldTerm->setMetadata(LLVMContext::MD_loop, nullptr);
+
+  BasicBlock *Refill = BasicBlock::Create(Ctx, "spm.refill", &F, Body);
+  BasicBlock *Copy = BasicBlock::Create(Ctx, "spm.copy", &F, Body);
+  Header->getTerminator()->eraseFromParent();
+  IRBuilder<> Builder(Header);
+  BranchInst *Term = Builder.CreateCondBr(
+                       Builder.CreateICmpEQ(Pos, Builder.getInt32(0)),
+                       Refill, Body);
+  if (LoopID)
+    Term->setMetadata(LLVMContext::MD_loop, LoopID);
+
+  L->addBasicBlockToLoop(Refill, *LI);
+  Loop *CopyLoop = LI->AllocateLoop();
+  L->addChildLoop(CopyLoop);
+  CopyLoop->addBasicBlockToLoop(Copy, *LI);
+  DT->addNewBlock(Refill, Header);
+  DT->addNewBlock(Copy, Refill);
+
+  // Refill: the number of words and the current addresses of the streams
+  Builder.SetInsertPoint(Refill);
+  BranchInst *ToCopy = Builder.CreateBr(Copy);
+  SCEVExpander Expander(*SE, DL, "spm.tile");
+  Value *N = Expander.expandCodeFor(Count, Int32Ty, ToCopy);
+  SmallVector<Value*, MaxStreams> Sources, Buffers;
+  for (unsigned i = 0, e = Streams.size(); i < e; i++) {
+    Value *Src = Expander.expandCodeFor(Streams[i].Addr, nullptr, ToCopy);
+    Builder.SetInsertPoint(ToCopy);
+    Sources.push_back(Builder.CreatePointerBitCastOrAddrSpaceCast(
+                        Src, UncachedPtrTy, "spm.src"));
+    Buffers.push_back(Builder.CreateIntToPtr(
+                        Builder.getInt32(SPMTileBase + i * TileWords * 4),
+                        SPMPtrTy, "spm.buf"));
+  }
+
+  // Copy: move N words of every stream, bypassing the data cache
+  Builder.SetInsertPoint(Copy);
+  PHINode *Idx = Builder.CreatePHI(Int32Ty, 2, "spm.idx");
+  for (unsigned i = 0, e = Streams.size(); i < e; i++) {
+    Value *Word = Builder.CreateAlignedLoad(
+                    Int32Ty, Builder.CreateInBoundsGEP(Int32Ty, Sources[i],
+                                                       Idx),
+                    Align(4));
+    Builder.CreateAlignedStore(Word,
+                               Builder.CreateInBoundsGEP(Int32Ty, Buffers[i],
+                                                         Idx),
+                               Align(4));
+  }
+  Value *Next = Builder.CreateNUWAdd(Idx, Builder.getInt32(1));
+  BranchInst *CopyTerm = Builder.CreateCondBr(Builder.CreateICmpULT(Next, N),
+                                              Copy, Body);
+  Idx->addIncoming(Builder.getInt32(0), Refill);
+  Idx->addIncoming(Next, Copy);
+
+  Metadata *BoundOps[] = {
+    MDString::get(Ctx, "llvm.loop.bound"),
+    ValueAsMetadata::get(Builder.getInt32(0)),
+    ValueAsMetadata::get(Builder.getInt32(TileWords - 1))
+  };
+  SmallVector<Metadata *, 2> Ops(1);
+  Ops.push_back(MDNode::get(Ctx, BoundOps));
+  MDNode *CopyLoopID = MDNode::get(Ctx, Ops);
+  CopyLoopID->replaceOperandWith(0, CopyLoopID); // First op points to itself.
+  CopyTerm->setMetadata(LLVMContext::MD_loop, CopyLoopID);
+
+  // Latch: advance the position, wrap at the end of the tile
+  Builder.SetInsertPoint(Latch->getTerminator());
+  Value *Inc = Builder.CreateNUWAdd(Pos, Builder.getInt32(1));
+  Value *PosNext = Builder.CreateSelect(
+                     Builder.CreateICmpEQ(Inc, Builder.getInt32(TileWords)),
+                     Builder.getInt32(0), Inc, "spm.pos.next");
+  Pos->addIncoming(Builder.getInt32(0), Preheader);
+  Pos->addIncoming(PosNext, Latch);
+
+  // read the copies instead of the arrays
+  for (unsigned i = 0, e = Streams.size(); i < e; i++) {
+    LoadInst *Load = Streams[i].Load;
+    Builder.SetInsertPoint(Load);
+    Value *Ptr = Builder.CreatePointerCast(
+                   Builder.CreateInBoundsGEP(Int32Ty, Buffers[i], Pos),
+                   Load->getType()->getPointerTo(SPMAddrSpace));
+    LoadInst *Local = Builder.CreateAlignedLoad(Load->getType(), Ptr,
+                                                Align(4));
+    Local->takeName(Load);
+    Local->setDebugLoc(Load->getDebugLoc());
+    Load->replaceAllUsesWith(Local);
+    Load->eraseFromParent();
+  }
+
+  SE->forgetLoop(L);
+  NumTiledLoops++;
+  NumTiledStreams += Streams.size();
+}
@@ -8,7 +8,8 @@
 //===----------------------------------------------------------------------===//
 //
 // PatmosPostRASchedStrategy implements the scheduling strategy for the post-RA
-// scheduler. 
+// scheduler, PatmosVLIWSchedStrategy the strategy for the pre-RA
+// MachineScheduler.
 //
 // TODO merge this somehow with the pre-RA MachineSchedStrategy?
 //
@@ -19,6 +20,7 @@
 #include "PatmosRegisterInfo.h"
 #include "PatmosTargetMachine.h"
 #include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/CodeGen/LatencyPriorityQueue.h"
@@ -35,6 +37,82 @@ using namespace llvm;
 
 #define DEBUG_TYPE "post-RA-sched"
 
+STATISTIC(NumTypedMemDeps, "Number of memory deps removed between memory types");
+
+static cl::opt<bool> DisableTypedMemDeps(
+  "mpatmos-disable-typed-mem-deps",
+  cl::init(false),
+  cl::desc("Keep the memory dependencies between accesses to different "
+           "memory types in the post-RA scheduler."),
+  cl::Hidden);
+
+static cl::opt<unsigned> DCacheStall(
+  "mpatmos-sched-dcache-stall",
+  cl::init(1),
+  cl::desc("Expected stall cycles of a load through the data cache, used to "
+           "place independent instructions before its uses (default: 1)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> BypassStall(
+  "mpatmos-sched-bypass-stall",
+  cl::init(4),
+  cl::desc("Expected stall cycles of a load bypassing the data cache, used to "
+           "place independent instructions before its uses (default: 4)."),
+  cl::Hidden);
+
+/// accessesMainMemory - Return true if MI may transfer data from or to the
+/// main memory: accesses of the data cache that may miss, stores written
+/// through it, bypassing accesses, stack cache spills and fills, and calls,
+/// returns and branches that load the method cache.
+static bool accessesMainMemory(const PatmosInstrInfo &PII,
+                               const MachineInstr *MI)
+{
+  switch (MI->getOpcode()) {
+  case Patmos::SRESi:
+  case Patmos::SENSi:
+  case Patmos::SENSr:
+  case Patmos::SSPILLi:
+  case Patmos::SSPILLr:
+    return true;
+  }
+  return !MI->isInlineAsm() && PII.mayStall(MI);
+}
+
+/// getMemStallCycles - Get the expected stall cycles of a load of the given
+/// memory type beyond the latency of the itinerary.
+static unsigned getMemStallCycles(PatmosII::MemType MT)
+{
+  switch (MT) {
+  // The stack cache always hits, the scratchpad has a fixed latency. The
+  // itineraries already cover both.
+  case PatmosII::MEM_S:
+  case PatmosII::MEM_L:
+    return 0;
+  // The data cache might miss.
+  case PatmosII::MEM_C:
+    return DCacheStall;
+  // The bypass always goes to the global memory.
+  case PatmosII::MEM_M:
+    return BypassStall;
+  }
+  llvm_unreachable("Unknown memory type");
+}
+
+/// getLoadStallCycles - Get the expected stall cycles of MI if it is a typed
+/// load, zero otherwise.
+static unsigned getLoadStallCycles(const PatmosInstrInfo &PII,
+                                   const MachineInstr *MI)
+{
+  if (!MI || !MI->mayLoad() || MI->hasOrderedMemoryRef() ||
+      getPatmosFormat(MI->getDesc().TSFlags) != PatmosII::FrmLDT)
+    return 0;
+
+  // the data cache analysis proved the load to hit
+  if (PII.isAlwaysHit(*MI))
+    return 0;
+  return getMemStallCycles(PII.getMemType(*MI));
+}
+
 bool ILPOrder::operator()(const SUnit *A, const SUnit *B) const {
   // Always prefer instructions with ScheduleLow flag.
   if (A->isScheduleLow != B->isScheduleLow) {
@@ -59,6 +137,15 @@ bool ILPOrder::operator()(const SUnit *A, const SUnit *B) const {
       return ScheduledTrees->test(SchedTreeA);
 
   }
+
+  // Prefer the users of loads that might miss, such that the loads become
+  // available early and end up further away from their uses.
+  if (MemStalls && A->NodeNum < MemStalls->size() &&
+      B->NodeNum < MemStalls->size() &&
+      (*MemStalls)[A->NodeNum] != (*MemStalls)[B->NodeNum]) {
+    return (*MemStalls)[A->NodeNum] > (*MemStalls)[B->NodeNum];
+  }
+
   if (MaximizeILP)
     return DFSResult->getILP(A) > DFSResult->getILP(B);
   else
@@ -74,7 +161,7 @@ void PatmosLatencyQueue::setDFSResult(ScheduleDAGPostRA *DAG)
 
 void PatmosLatencyQueue::initialize()
 {
-  std::sort(AvailableQueue.begin(), AvailableQueue.end(), Cmp);
+  AvailableQueue.rebuild();
 }
 
 void PatmosLatencyQueue::clear()
@@ -109,13 +196,24 @@ bool PatmosLatencyQueue::selectBundle(std::vector<SUnit*> &Bundle)
   // If the bundle is not empty, we should calculate the initial width
   assert(Bundle.empty());
 
+  // Take the best few candidates from the heap in priority order. They are
+  // put back afterwards, the selected ones are removed when they are
+  // scheduled.
+  SmallVector<SUnit*, LookAhead> Candidates;
+  while (!AvailableQueue.empty() && Candidates.size() < LookAhead) {
+    Candidates.push_back(AvailableQueue.pop());
+  }
+  for (unsigned i = 0; i < Candidates.size(); i++) {
+    AvailableQueue.push(Candidates[i]);
+  }
+
   std::vector<bool> Selected;
-  Selected.resize(AvailableQueue.size());
+  Selected.resize(Candidates.size());
 
   // Make sure that all instructions with ScheduleLow flag go into the bundle.
-  for (unsigned i = 0; i < AvailableQueue.size() && CurrWidth < IssueWidth; i++)
+  for (unsigned i = 0; i < Candidates.size() && CurrWidth < IssueWidth; i++)
   {
-    SUnit *SU = AvailableQueue[i];
+    SUnit *SU = Candidates[i];
     if (!SU->isScheduleLow) break;
 
     if (addToBundle(Bundle, SU, CurrWidth)) {
@@ -123,6 +221,22 @@ bool PatmosLatencyQueue::selectBundle(std::vector<SUnit*> &Bundle)
     }
   }
 
+  // Behind a TDM arbiter, an access right after the previous one waits for
+  // the next slot of the core, while accesses spread through the code wait
+  // for a slot at an arbitrary phase of the period. Pull the best available
+  // main memory access next to the one scheduled below.
+  if (groupMainMemAccesses()) {
+    for (unsigned i = 0; i < Candidates.size() && CurrWidth < IssueWidth; i++)
+    {
+      if (Selected[i] || !isMainMemAccess(Candidates[i])) continue;
+
+      if (addToBundle(Bundle, Candidates[i], CurrWidth)) {
+        Selected[i] = true;
+        break;
+      }
+    }
+  }
+
   // Check if any of the highest <IssueWidth> instructions can be
   // scheduled only with a single other instruction in this queue, or if there
   // is any instruction in the queue that can only be scheduled with the highest
@@ -135,10 +249,10 @@ bool PatmosLatencyQueue::selectBundle(std::vector<SUnit*> &Bundle)
 
 
   // Try to fill up the bundle with instructions from the queue by best effort
-  for (unsigned i = 0; i < AvailableQueue.size() && CurrWidth < IssueWidth; i++)
+  for (unsigned i = 0; i < Candidates.size() && CurrWidth < IssueWidth; i++)
   {
     if (Selected[i]) continue;
-    SUnit *SU = AvailableQueue[i];
+    SUnit *SU = Candidates[i];
 
     // check the width. ignore the width for the first instruction to allow
     // ALUl even when bundling is disabled.
@@ -154,25 +268,14 @@ bool PatmosLatencyQueue::selectBundle(std::vector<SUnit*> &Bundle)
 /// Go back one cycle and update availability queue.
 void PatmosLatencyQueue::recedeCycle(unsigned CurrCycle)
 {
-  unsigned avail = 0;
-  for (unsigned i = 0; i < PendingQueue.size() - avail; i++) {
-    SUnit *SU = PendingQueue[i];
+  this->CurrCycle = CurrCycle;
 
-    if (SU->getHeight() <= CurrCycle) {
-      // remove the instruction from pending
-      avail++;
-      PendingQueue[i] = *(PendingQueue.end() - avail);
-      // revisit the moved instruction
-      i--;
-
-      // Make the instruction available
-      AvailableQueue.push_back(SU);
-      std::inplace_merge(AvailableQueue.begin(), AvailableQueue.end() - 1,
-                         AvailableQueue.end(), Cmp);
-    }
+  // The heights of pending instructions do not change anymore, all their
+  // successors have been scheduled.
+  while (!PendingQueue.empty() && PendingQueue.top()->getHeight() <= CurrCycle)
+  {
+    AvailableQueue.push(PendingQueue.pop());
   }
-
-  PendingQueue.resize(PendingQueue.size() - avail);
 }
 
 /// Notify the queue that this instruction has now been scheduled.
@@ -180,20 +283,23 @@ void PatmosLatencyQueue::scheduled(SUnit *SU, unsigned CurrCycle)
 {
   SU->setHeightToAtLeast(CurrCycle);
 
-  AvailableQueue.erase(std::remove(AvailableQueue.begin(), AvailableQueue.end(),
-                                   SU), AvailableQueue.end());
+  if (isMainMemAccess(SU))
+    LastMainMemCycle = CurrCycle;
+
+  AvailableQueue.erase(SU);
 }
 
 void PatmosLatencyQueue::scheduledTree(unsigned SubtreeID)
 {
-  std::sort(AvailableQueue.begin(), AvailableQueue.end(), Cmp);
+  // The priority of the nodes in the scheduled tree changed.
+  AvailableQueue.rebuild();
 }
 
 /// put an instruction into the pending queue when all its successors have
 /// been scheduled.
 void PatmosLatencyQueue::makePending(SUnit *SU)
 {
-  PendingQueue.push_back(SU);
+  PendingQueue.push(SU);
 }
 
 bool PatmosLatencyQueue::canIssueInSlot(SUnit *SU, unsigned Slot)
@@ -279,10 +385,99 @@ void PatmosLatencyQueue::dump()
 #endif
 
 
+void PatmosVLIWSchedStrategy::initialize(ScheduleDAGMI *dag)
+{
+  GenericScheduler::initialize(dag);
+
+  PII = static_cast<const PatmosInstrInfo*>(dag->TII);
+}
+
+bool PatmosVLIWSchedStrategy::isFirstSlotOnly(const SUnit *SU) const
+{
+  MachineInstr *MI = SU->getInstr();
+  if (!MI || MI->isPseudo() || MI->isInlineAsm())
+    return false;
+
+  // ALUl instructions occupy both slots and cannot be paired anyway
+  return PII->getIssueWidth(MI) == 1 && !PII->canIssueInSlot(MI, 1);
+}
+
+unsigned PatmosVLIWSchedStrategy::getExposedLatency(const SUnit *SU,
+                                                    bool IsTop) const
+{
+  unsigned Exposed = 0;
+  const SmallVectorImpl<SDep> &Deps = IsTop ? SU->Succs : SU->Preds;
+  for (SmallVectorImpl<SDep>::const_iterator I = Deps.begin(), E = Deps.end();
+       I != E; ++I) {
+    if (I->getKind() != SDep::Data || I->getSUnit()->isScheduled)
+      continue;
+
+    // Loads that might miss are issued as early as possible and their
+    // results are read as late as possible.
+    const MachineInstr *Load = IsTop ? SU->getInstr()
+                                     : I->getSUnit()->getInstr();
+    unsigned Latency = I->getLatency() + getLoadStallCycles(*PII, Load);
+    if (Latency > 1)
+      Exposed = std::max(Exposed, Latency - 1);
+  }
+  return Exposed;
+}
+
+bool PatmosVLIWSchedStrategy::tryCandidate(SchedCandidate &Cand,
+                                           SchedCandidate &TryCand,
+                                           SchedBoundary *Zone) const
+{
+  // Initialize the candidate if needed.
+  if (!Cand.isValid()) {
+    TryCand.Reason = NodeOrder;
+    return true;
+  }
+
+  // Register pressure first, as in the GenericScheduler.
+  if (tryGreater(biasPhysReg(TryCand.SU, TryCand.AtTop),
+                 biasPhysReg(Cand.SU, Cand.AtTop), TryCand, Cand, PhysReg))
+    return TryCand.Reason != NoCand;
+
+  if (DAG->isTrackingPressure() && tryPressure(TryCand.RPDelta.Excess,
+                                               Cand.RPDelta.Excess,
+                                               TryCand, Cand, RegExcess, TRI,
+                                               DAG->MF))
+    return TryCand.Reason != NoCand;
+
+  if (DAG->isTrackingPressure() && tryPressure(TryCand.RPDelta.CriticalMax,
+                                               Cand.RPDelta.CriticalMax,
+                                               TryCand, Cand, RegCritical, TRI,
+                                               DAG->MF))
+    return TryCand.Reason != NoCand;
+
+  // Nodes of the top and bottom zone are only compared by the generic
+  // heuristics.
+  if (Zone) {
+    // Schedule loads and multiplications as early as possible (or their
+    // users as late as possible), so that the latency can be filled with
+    // independent instructions instead of NOPs.
+    if (tryGreater(getExposedLatency(TryCand.SU, Zone->isTop()),
+                   getExposedLatency(Cand.SU, Zone->isTop()),
+                   TryCand, Cand, Stall))
+      return TryCand.Reason != NoCand;
+
+    // Start a new cycle with an instruction that can only use the first
+    // slot, the hazard recognizer then only admits instructions for the
+    // second slot into the rest of the cycle.
+    if (Zone->getCurrMOps() == 0 &&
+        tryGreater(isFirstSlotOnly(TryCand.SU), isFirstSlotOnly(Cand.SU),
+                   TryCand, Cand, ResourceReduce))
+      return TryCand.Reason != NoCand;
+  }
+
+  return GenericScheduler::tryCandidate(Cand, TryCand, Zone);
+}
+
+
 PatmosPostRASchedStrategy::PatmosPostRASchedStrategy(
                                             const PatmosTargetMachine &PTM)
 : PTM(PTM), PII(*PTM.getInstrInfo()), PRI(PII.getPatmosRegisterInfo()),
-  DAG(0), ReadyQ(PTM), CurrCycle(0)
+  DAG(0), ReadyQ(PTM), CurrCycle(0), CFLAccessesMainMem(false)
 {
 }
 
@@ -297,6 +492,10 @@ bool PatmosPostRASchedStrategy::isSchedulingBoundary(const MachineInstr *MI,
   if (MI->getDesc().isTerminator() || MI->isLabel())
     return true;
 
+  // Timing instrumentation must measure exactly the code in between.
+  if (PII.isTimingRead(*MI))
+    return true;
+
   // Do not schedule over inline asm
   // TODO This is not actually really required, but it makes things a bit less
   // error-prone. Check if we want to remove that restriction or not.
@@ -436,6 +635,8 @@ void PatmosPostRASchedStrategy::postprocessDAG(ScheduleDAGPostRA *dag)
   // remove barriers between loads/stores with different memory type
   removeTypedMemBarriers();
 
+  markMainMemAccesses(CFL);
+
   // remove any dependency between instructions with mutually exclusive
   // predicates
   removeExclusivePredDeps();
@@ -457,6 +658,10 @@ void PatmosPostRASchedStrategy::initialize(ScheduleDAGPostRA *dag)
 
   DAG->computeDFSResult();
   ReadyQ.setDFSResult(DAG);
+
+  computeMemStalls();
+  ReadyQ.setMemStalls(&MemStalls);
+  ReadyQ.setMainMemAccesses(&MainMemAccesses, CFLAccessesMainMem);
 }
 
 void PatmosPostRASchedStrategy::registerRoots()
@@ -658,14 +863,146 @@ void PatmosPostRASchedStrategy::removeImplicitCFLDeps(SUnit &SU)
 /// different memory types and cannot alias.
 void PatmosPostRASchedStrategy::removeTypedMemBarriers()
 {
-  // TODO remove dependencies between SPM, stack and global memory load/stores
+  if (DisableTypedMemDeps) return;
+
+  // Note: Stack cache accesses do not alias with global/local memory, only
+  // objects whose address is not taken are placed in the stack cache, all other
+  // objects go to the shadow stack in global memory.
+
+  // Note: loads to global memory might in fact alias with STC instructions.
+  // Those are not typed loads or stores, their edges are kept.
+
+  // The memory chain only contains edges to the closest accesses, the order
+  // to the accesses further up is kept by transitivity. Collect all edges to
+  // remove on the unmodified DAG first, and replace them by edges to the
+  // closest accesses behind them that might alias.
+  std::vector<std::pair<SUnit*, SDep> > RemoveDeps, AddDeps;
+
+  for (std::vector<SUnit>::iterator it = DAG->SUnits.begin(),
+       ie = DAG->SUnits.end(); it != ie; it++)
+  {
+    PatmosII::MemType MT;
+    if (!getTypedMemAccess(it->getInstr(), MT)) continue;
+
+    SmallPtrSet<SUnit*, 16> Visited;
+    SmallVector<SUnit*, 8> Worklist;
+
+    for (SUnit::pred_iterator pit = it->Preds.begin(),
+           pie = it->Preds.end(); pit != pie; pit++)
+    {
+      if (!isTypedMemDep(*pit, MT)) continue;
+
+      RemoveDeps.push_back(std::make_pair(&*it, *pit));
+      if (Visited.insert(pit->getSUnit()).second)
+        Worklist.push_back(pit->getSUnit());
+    }
+
+    while (!Worklist.empty()) {
+      SUnit *PredSU = Worklist.pop_back_val();
+
+      for (SUnit::pred_iterator pit = PredSU->Preds.begin(),
+             pie = PredSU->Preds.end(); pit != pie; pit++)
+      {
+        if (!pit->getSUnit() || pit->getKind() != SDep::Order) continue;
+
+        if (isTypedMemDep(*pit, MT)) {
+          if (Visited.insert(pit->getSUnit()).second)
+            Worklist.push_back(pit->getSUnit());
+        } else {
+          AddDeps.push_back(std::make_pair(&*it, *pit));
+        }
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < AddDeps.size(); i++) {
+    AddDeps[i].first->addPred(AddDeps[i].second);
+  }
+
+  for (unsigned i = 0; i < RemoveDeps.size(); i++) {
+    LLVM_DEBUG(dbgs() << "Remove typed memory dep SU("
+                      << RemoveDeps[i].second.getSUnit()->NodeNum << ") -> SU("
+                      << RemoveDeps[i].first->NodeNum << ")\n");
+    RemoveDeps[i].first->removePred(RemoveDeps[i].second);
+    NumTypedMemDeps++;
+  }
+}
+
+bool PatmosPostRASchedStrategy::isTypedMemDep(const SDep &Dep,
+                                              PatmosII::MemType MT) const
+{
+  if (!Dep.getSUnit() || Dep.getKind() != SDep::Order) return false;
+  if (Dep.isArtificial() || Dep.isBarrier()) return false;
+
+  PatmosII::MemType PredMT;
+  if (!getTypedMemAccess(Dep.getSUnit()->getInstr(), PredMT)) return false;
+
+  return !mayAliasMemTypes(MT, PredMT);
+}
+
+bool PatmosPostRASchedStrategy::getTypedMemAccess(const MachineInstr *MI,
+                                                  PatmosII::MemType &MT) const
+{
+  if (!MI || MI->isCall() || MI->isInlineAsm() || MI->hasOrderedMemoryRef())
+    return false;
+
+  // Only the typed load and store formats have a memory type, stack control
+  // instructions, calls and pseudos are barriers for all memory types.
+  unsigned Format = getPatmosFormat(MI->getDesc().TSFlags);
+  if (Format != PatmosII::FrmLDT && Format != PatmosII::FrmSTT)
+    return false;
+
+  MT = PII.getMemType(*MI);
+  return true;
+}
+
+bool PatmosPostRASchedStrategy::mayAliasMemTypes(PatmosII::MemType A,
+                                                 PatmosII::MemType B) const
+{
+  if (A == B) return true;
+
+  // The data cache and the bypass both access the global memory. The stack
+  // cache and the scratchpad are disjoint from everything else.
+  return (A == PatmosII::MEM_C || A == PatmosII::MEM_M) &&
+         (B == PatmosII::MEM_C || B == PatmosII::MEM_M);
+}
+
+void PatmosPostRASchedStrategy::computeMemStalls()
+{
+  MemStalls.assign(DAG->SUnits.size(), 0);
+
+  for (std::vector<SUnit>::iterator it = DAG->SUnits.begin(),
+       ie = DAG->SUnits.end(); it != ie; it++)
+  {
+    for (SUnit::const_pred_iterator pit = it->Preds.begin(),
+           pie = it->Preds.end(); pit != pie; pit++)
+    {
+      if (!pit->getSUnit() || pit->getKind() != SDep::Data) continue;
 
-  // Note: Stack accesses usually do not alias with global/local memory since
-  // accesses to stack frame are accesses to known objects (but unknown stores
-  // might still alias with stack frame accesses!)
+      MemStalls[it->NodeNum] = std::max(MemStalls[it->NodeNum],
+                      getLoadStallCycles(PII, pit->getSUnit()->getInstr()));
+    }
+  }
+}
 
-  // Note: loads to global memory might in fact alias with STC instructions
+void PatmosPostRASchedStrategy::markMainMemAccesses(SUnit *CFL)
+{
+  MainMemAccesses.assign(DAG->SUnits.size(), false);
+  CFLAccessesMainMem = false;
+  if (!PTM.getSubtargetImpl()->getTDMPeriod())
+    return;
+
+  for (std::vector<SUnit>::iterator it = DAG->SUnits.begin(),
+       ie = DAG->SUnits.end(); it != ie; it++)
+  {
+    MachineInstr *MI = it->getInstr();
+    if (MI && accessesMainMemory(PII, MI))
+      MainMemAccesses[it->NodeNum] = true;
+  }
 
+  // the accesses before a call, return or cache-fill branch join the load
+  // of the method cache
+  CFLAccessesMainMem = CFL && MainMemAccesses[CFL->NodeNum];
 }
 
 /// Remove all dependencies between instructions with mutually exclusive
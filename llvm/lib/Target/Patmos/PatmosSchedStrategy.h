@@ -27,9 +27,11 @@
 //     Uses a MaschineSchedStrategy to pick nodes and set scheduling direction.
 //
 //     - PatmosVLIWSchedStrategy: Implements the MachineSchedStrategy for the
-//       generic ScheduleDAGMI pre-RA scheduler. TBD. Should order code so that
-//       the RegAlloc does not introduce pseudo dependencies, i.e. be bundling
-//       aware. Do bottom-up scheduling
+//       ScheduleDAGMILive pre-RA scheduler. Extends the GenericScheduler,
+//       which tracks register pressure and models the two ALU slots and the
+//       MUL unit using the itineraries and the hazard recognizer, by
+//       heuristics to hide load and multiply latencies and to pair
+//       first-slot-only instructions with instructions for the second slot.
 //
 //     - ConvergingSchedStrategy, ..: generic LLVM scheduling strategies.
 //
@@ -79,6 +81,7 @@
 #define PATMOSSCHEDSTRATEGY_H
 
 #include "PatmosPostRAScheduler.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/CodeGen/MachineScheduler.h"
 #include "llvm/CodeGen/LatencyPriorityQueue.h"
 
@@ -88,9 +91,12 @@ namespace llvm {
   struct ILPOrder {
     const SchedDFSResult *DFSResult;
     const BitVector *ScheduledTrees;
+    /// Expected stall cycles of the loads an instruction uses, by NodeNum.
+    const std::vector<unsigned> *MemStalls;
     bool MaximizeILP;
 
-    ILPOrder(bool MaxILP): DFSResult(0), ScheduledTrees(0), MaximizeILP(MaxILP) {}
+    ILPOrder(bool MaxILP)
+    : DFSResult(0), ScheduledTrees(0), MemStalls(0), MaximizeILP(MaxILP) {}
 
     /// \brief Apply a greater-than relation on node priority.
     ///
@@ -98,6 +104,116 @@ namespace llvm {
     bool operator()(const SUnit *A, const SUnit *B) const;
   };
 
+  /// Order nodes by increasing height, i.e., by the cycle in which they
+  /// become available in a bottom-up schedule.
+  struct HeightOrder {
+    /// Return true if A becomes available before B.
+    bool operator()(const SUnit *A, const SUnit *B) const {
+      if (A->getHeight() != B->getHeight())
+        return A->getHeight() < B->getHeight();
+      return A->NodeNum < B->NodeNum;
+    }
+  };
+
+  /// A binary heap of SUnits that keeps the position of every node, so that
+  /// arbitrary nodes can be removed in O(log n). The node with the highest
+  /// priority according to Compare is at the top.
+  template<class Compare>
+  class SUnitHeap {
+  private:
+    Compare &Cmp;
+
+    std::vector<SUnit*> Heap;
+
+    /// The position of a node in the heap, indexed by NodeNum.
+    std::vector<int> Pos;
+
+    void place(SUnit *SU, unsigned i) {
+      Heap[i] = SU;
+      if (SU->NodeNum >= Pos.size())
+        Pos.resize(SU->NodeNum + 1, -1);
+      Pos[SU->NodeNum] = i;
+    }
+
+    void siftUp(unsigned i) {
+      SUnit *SU = Heap[i];
+      while (i > 0) {
+        unsigned Parent = (i - 1) / 2;
+        if (!Cmp(SU, Heap[Parent])) break;
+        place(Heap[Parent], i);
+        i = Parent;
+      }
+      place(SU, i);
+    }
+
+    void siftDown(unsigned i) {
+      SUnit *SU = Heap[i];
+      while (true) {
+        unsigned Child = 2 * i + 1;
+        if (Child >= Heap.size()) break;
+        if (Child + 1 < Heap.size() && Cmp(Heap[Child + 1], Heap[Child]))
+          Child++;
+        if (!Cmp(Heap[Child], SU)) break;
+        place(Heap[Child], i);
+        i = Child;
+      }
+      place(SU, i);
+    }
+
+  public:
+    SUnitHeap(Compare &cmp) : Cmp(cmp) {}
+
+    bool empty() const { return Heap.empty(); }
+
+    unsigned size() const { return Heap.size(); }
+
+    /// Access the nodes in heap order, not in priority order.
+    SUnit *operator[](unsigned i) const { return Heap[i]; }
+
+    SUnit *top() const { return Heap.front(); }
+
+    bool contains(const SUnit *SU) const {
+      return SU->NodeNum < Pos.size() && Pos[SU->NodeNum] >= 0;
+    }
+
+    void clear() {
+      Heap.clear();
+      Pos.clear();
+    }
+
+    void push(SUnit *SU) {
+      assert(!contains(SU) && "Node is already in the heap");
+      Heap.push_back(SU);
+      siftUp(Heap.size() - 1);
+    }
+
+    SUnit *pop() {
+      SUnit *SU = top();
+      erase(SU);
+      return SU;
+    }
+
+    void erase(const SUnit *SU) {
+      if (!contains(SU)) return;
+      unsigned i = Pos[SU->NodeNum];
+      Pos[SU->NodeNum] = -1;
+
+      SUnit *Last = Heap.back();
+      Heap.pop_back();
+      if (i == Heap.size()) return;
+
+      place(Last, i);
+      siftUp(i);
+      siftDown(Pos[Last->NodeNum]);
+    }
+
+    /// Restore the heap property after the order of the nodes changed.
+    void rebuild() {
+      for (unsigned i = Heap.size() / 2; i > 0; i--)
+        siftDown(i - 1);
+    }
+  };
+
   /// This class manages a list of pending and available instructions and
   /// allows to pick the best instruction or bundle currently available.
   class PatmosLatencyQueue {
@@ -107,25 +223,44 @@ namespace llvm {
     /// Max number of slots to fill when selecting a bundle.
     unsigned IssueWidth;
 
+    /// Number of available instructions considered when selecting a bundle.
+    static const unsigned LookAhead = 8;
+
     ILPOrder Cmp;
 
+    HeightOrder PendingCmp;
+
     /// PendingQueue - This contains all of the instructions whose operands have
     /// been issued, but their results are not ready yet (due to the latency of
     /// the operation).  Once the operands becomes available, the instruction is
     /// added to the AvailableQueue.
-    std::vector<SUnit*> PendingQueue;
+    SUnitHeap<HeightOrder> PendingQueue;
 
     /// AvailableQueue - The priority queue to use for the available SUnits.
-    std::vector<SUnit*> AvailableQueue;
+    SUnitHeap<ILPOrder> AvailableQueue;
+
+    /// The period of the TDM arbiter of the main memory, zero if there is
+    /// none.
+    unsigned TDMPeriod;
+
+    /// The nodes accessing the main memory, by NodeNum.
+    const std::vector<bool> *MainMemAccesses;
+
+    /// The current cycle and the cycle of the last main memory access
+    /// scheduled, from the end of the region, if there is one.
+    unsigned CurrCycle;
+    Optional<unsigned> LastMainMemCycle;
 
   public:
     PatmosLatencyQueue(const PatmosTargetMachine &PTM)
-    : PII(*PTM.getInstrInfo()), Cmp(false)
+    : PII(*PTM.getInstrInfo()), Cmp(false), PendingQueue(PendingCmp),
+      AvailableQueue(Cmp), MainMemAccesses(0), CurrCycle(0)
     {
       const PatmosSubtarget &PST = *PTM.getSubtargetImpl();
 
       IssueWidth = PST.enableBundling(PTM.getOptLevel()) ?
                    PST.getSchedModel().IssueWidth : 1;
+      TDMPeriod = PST.getTDMPeriod();
     }
 
     unsigned getIssueWidth() const { return IssueWidth; }
@@ -134,6 +269,18 @@ namespace llvm {
 
     void setDFSResult(ScheduleDAGPostRA *DAG);
 
+    void setMemStalls(const std::vector<unsigned> *Stalls) {
+      Cmp.MemStalls = Stalls;
+    }
+
+    /// setMainMemAccesses - Set the nodes accessing the main memory, and
+    /// whether the control-flow instruction ending the region does, i.e.,
+    /// loads the method cache.
+    void setMainMemAccesses(const std::vector<bool> *Accesses, bool AtExit) {
+      MainMemAccesses = Accesses;
+      LastMainMemCycle = AtExit ? Optional<unsigned>(0) : None;
+    }
+
     void clear();
 
     bool empty();
@@ -165,6 +312,20 @@ namespace llvm {
   protected:
     bool canIssueInSlot(SUnit *SU, unsigned Slot);
 
+    /// isMainMemAccess - Return true if SU accesses the main memory.
+    bool isMainMemAccess(const SUnit *SU) const {
+      return MainMemAccesses && SU->NodeNum < MainMemAccesses->size() &&
+             (*MainMemAccesses)[SU->NodeNum];
+    }
+
+    /// groupMainMemAccesses - Return true if a main memory access should go
+    /// into the current bundle, to wait for the TDM slot right after the one
+    /// of the access scheduled less than a period later.
+    bool groupMainMemAccesses() const {
+      return TDMPeriod && LastMainMemCycle &&
+             CurrCycle - *LastMainMemCycle < TDMPeriod;
+    }
+
     /// Try to add an instruction to the bundle, return true if succeeded.
     /// \param Width the current width of the bundle, will be updated.
     bool addToBundle(std::vector<SUnit *> &Bundle, SUnit *SU, unsigned &Width);
@@ -174,26 +335,41 @@ namespace llvm {
   struct PatmosRegisterInfo;
 
 
-  // TODO implement, share code with PostRASchedStrategy if possible.
-  class PatmosVLIWSchedStrategy : public MachineSchedStrategy {
-
-    //const TargetSchedModel *SchedModel;
-    //const TargetRegisterInfo *TRI;
+  /// PatmosVLIWSchedStrategy - Pre-RA scheduling strategy for Patmos.
+  ///
+  /// Register pressure takes precedence over all Patmos specific heuristics,
+  /// so that the scheduler does not introduce spill code. Among candidates
+  /// with the same pressure, instructions are picked such that consumers of
+  /// loads and multiplications are placed away from their producers, and such
+  /// that first-slot-only instructions start a cycle, leaving the second
+  /// slot to the other ALU instructions. The remaining ties are broken by the
+  /// GenericScheduler.
+  /// TODO share code with PostRASchedStrategy if possible.
+  class PatmosVLIWSchedStrategy : public GenericScheduler {
+  private:
+    const PatmosInstrInfo *PII;
 
   public:
+    PatmosVLIWSchedStrategy(const MachineSchedContext *C)
+    : GenericScheduler(C), PII(0) {}
 
-    PatmosVLIWSchedStrategy() {}
-
-    virtual void initialize(ScheduleDAGMI *dag) {}
-
-    virtual SUnit *pickNode(bool &IsTopNode) { return 0; }
+    virtual void initialize(ScheduleDAGMI *dag) override;
 
-    virtual void schedNode(SUnit *SU, bool IsTopNode) {}
-
-    virtual void releaseTopNode(SUnit *SU) {}
-
-    virtual void releaseBottomNode(SUnit *SU) {}
+  protected:
+    virtual bool tryCandidate(SchedCandidate &Cand, SchedCandidate &TryCand,
+                              SchedBoundary *Zone) const override;
 
+  private:
+    /// isFirstSlotOnly - Check if the instruction can only be issued in the
+    /// first slot, i.e., uses the memory, multiply or control-flow units.
+    bool isFirstSlotOnly(const SUnit *SU) const;
+
+    /// getExposedLatency - Get the number of cycles the nodes depending on SU
+    /// on the side of the not yet scheduled zone have to wait for SU beyond
+    /// the next cycle, e.g., for the result of a load or a multiplication.
+    /// Includes the expected stall cycles of loads through the data cache or
+    /// the bypass.
+    unsigned getExposedLatency(const SUnit *SU, bool IsTop) const;
   };
 
 
@@ -221,6 +397,14 @@ namespace llvm {
     /// The current bundle that we are emitting
     std::vector<SUnit*> CurrBundle;
 
+    /// The expected stall cycles of the loads used by a node, by NodeNum.
+    std::vector<unsigned> MemStalls;
+
+    /// The nodes accessing the main memory, by NodeNum, and whether the
+    /// control-flow instruction of the region does.
+    std::vector<bool> MainMemAccesses;
+    bool CFLAccessesMainMem;
+
   public:
     PatmosPostRASchedStrategy(const PatmosTargetMachine &PTM);
     virtual ~PatmosPostRASchedStrategy() {}
@@ -282,6 +466,24 @@ namespace llvm {
     /// different memory types and cannot alias.
     void removeTypedMemBarriers();
 
+    /// Get the memory type of a typed load or store. Returns false for all
+    /// other instructions, including stack control and calls.
+    bool getTypedMemAccess(const MachineInstr *MI, PatmosII::MemType &MT) const;
+
+    /// Check if Dep is a memory dependency from an access to a memory type
+    /// that cannot alias with MT.
+    bool isTypedMemDep(const SDep &Dep, PatmosII::MemType MT) const;
+
+    /// Check if accesses to the two memory types might access the same memory.
+    bool mayAliasMemTypes(PatmosII::MemType A, PatmosII::MemType B) const;
+
+    /// Compute the expected stall cycles of the loads used by each node.
+    void computeMemStalls();
+
+    /// Mark the nodes accessing the main memory, to group them on processors
+    /// with a TDM arbiter.
+    void markMainMemAccesses(SUnit *CFL);
+
     /// Remove all dependencies between instructions with mutually exclusive
     /// predicates.
     void removeExclusivePredDeps();
@@ -12,9 +12,223 @@
 //===----------------------------------------------------------------------===//
 
 #include "PatmosTargetMachine.h"
+#include "llvm/CodeGen/SelectionDAG.h"
+#include "llvm/Support/CommandLine.h"
 using namespace llvm;
 #define DEBUG_TYPE "patmos-selectiondag-info"
 
+static cl::opt<unsigned> InlineMemSize("mpatmos-inline-mem-size",
+  cl::init(256),
+  cl::desc("Maximum size in bytes of a word-aligned memcpy or memset that is "
+           "expanded inline, larger ones call the runtime helpers "
+           "(default: 256)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> InlineMemmoveSize("mpatmos-inline-memmove-size",
+  cl::init(64),
+  cl::desc("Maximum size in bytes of a memmove that is expanded inline "
+           "(default: 64)."),
+  cl::Hidden);
+
+/// Number of words that are loaded before they are stored in an inline copy.
+/// Loading a group first hides the load latency and lets the scheduler pair
+/// the address computations with the memory accesses.
+static const unsigned CopyGroupSize = 4;
+
+/// Maximum number of words processed by __patmos_memcpy_w/__patmos_memset_w.
+/// This is the loop bound the helpers report to the WCET analysis, it must
+/// match PATMOS_MEM_HELPER_MAX_WORDS in compiler-rt.
+static const uint64_t HelperMaxWords = 16384;
+
 PatmosSelectionDAGInfo::PatmosSelectionDAGInfo(){}
 
 PatmosSelectionDAGInfo::~PatmosSelectionDAGInfo() {}
+
+/// Copy Size bytes starting at Offset in groups of GroupSize accesses, each
+/// of the widest size the alignment allows.
+static SDValue emitInlineCopy(SelectionDAG &DAG, const SDLoc &dl,
+                              SDValue Chain, SDValue Dst, SDValue Src,
+                              uint64_t Offset, uint64_t Size, Align Alignment,
+                              unsigned GroupSize,
+                              MachinePointerInfo DstPtrInfo,
+                              MachinePointerInfo SrcPtrInfo)
+{
+  uint64_t End = Offset + Size;
+
+  while (Offset < End) {
+    SmallVector<SDValue, 8> Values, LoadChains, StoreChains;
+    SmallVector<std::pair<uint64_t, EVT>, 8> Accesses;
+
+    for (unsigned i = 0; i < GroupSize && Offset < End; i++) {
+      unsigned Bytes = std::min<uint64_t>(
+                           commonAlignment(Alignment, Offset).value(), 4);
+      while (Bytes > End - Offset)
+        Bytes /= 2;
+      EVT VT = EVT::getIntegerVT(*DAG.getContext(), Bytes * 8);
+
+      SDValue Ptr = DAG.getMemBasePlusOffset(Src, TypeSize::Fixed(Offset), dl);
+      SDValue Load = DAG.getExtLoad(ISD::ZEXTLOAD, dl, MVT::i32, Chain, Ptr,
+                                    SrcPtrInfo.getWithOffset(Offset), VT,
+                                    commonAlignment(Alignment, Offset));
+      Values.push_back(Load);
+      LoadChains.push_back(Load.getValue(1));
+      Accesses.push_back(std::make_pair(Offset, VT));
+      Offset += Bytes;
+    }
+
+    SDValue LoadChain = DAG.getNode(ISD::TokenFactor, dl, MVT::Other,
+                                    LoadChains);
+
+    for (unsigned i = 0; i < Values.size(); i++) {
+      uint64_t Off = Accesses[i].first;
+      SDValue Ptr = DAG.getMemBasePlusOffset(Dst, TypeSize::Fixed(Off), dl);
+      StoreChains.push_back(DAG.getTruncStore(LoadChain, dl, Values[i], Ptr,
+                                      DstPtrInfo.getWithOffset(Off),
+                                      Accesses[i].second,
+                                      commonAlignment(Alignment, Off)));
+    }
+
+    Chain = DAG.getNode(ISD::TokenFactor, dl, MVT::Other, StoreChains);
+  }
+  return Chain;
+}
+
+/// Call a runtime helper with the destination, a second argument and the
+/// number of words to process.
+static SDValue emitHelperCall(SelectionDAG &DAG, const SDLoc &dl,
+                              SDValue Chain, const char *Helper, SDValue Dst,
+                              SDValue Arg, uint64_t Words)
+{
+  const TargetLowering &TLI = DAG.getTargetLoweringInfo();
+  Type *IntPtrTy = DAG.getDataLayout().getIntPtrType(*DAG.getContext());
+
+  TargetLowering::ArgListTy Args;
+  TargetLowering::ArgListEntry Entry;
+  Entry.Ty = IntPtrTy;
+  Entry.Node = Dst;
+  Args.push_back(Entry);
+  Entry.Node = Arg;
+  Args.push_back(Entry);
+  Entry.Node = DAG.getConstant(Words, dl, MVT::i32);
+  Args.push_back(Entry);
+
+  TargetLowering::CallLoweringInfo CLI(DAG);
+  CLI.setDebugLoc(dl)
+     .setChain(Chain)
+     .setLibCallee(CallingConv::C, Type::getVoidTy(*DAG.getContext()),
+                   DAG.getExternalSymbol(Helper,
+                                         TLI.getPointerTy(DAG.getDataLayout())),
+                   std::move(Args))
+     .setDiscardResult();
+
+  return TLI.LowerCallTo(CLI).second;
+}
+
+SDValue PatmosSelectionDAGInfo::EmitTargetCodeForMemcpy(SelectionDAG &DAG,
+                                  const SDLoc &dl, SDValue Chain,
+                                  SDValue Dst, SDValue Src, SDValue Size,
+                                  Align Alignment, bool isVolatile,
+                                  bool AlwaysInline,
+                                  MachinePointerInfo DstPtrInfo,
+                                  MachinePointerInfo SrcPtrInfo) const
+{
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || isVolatile)
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+
+  // Unaligned copies are left to the generic expansion or to memcpy.
+  if (Alignment < Align(4) && !AlwaysInline)
+    return SDValue();
+
+  if (Bytes <= InlineMemSize || AlwaysInline)
+    return emitInlineCopy(DAG, dl, Chain, Dst, Src, 0, Bytes, Alignment,
+                          CopyGroupSize, DstPtrInfo, SrcPtrInfo);
+
+  // Copy the words with the helper, and the remaining bytes inline.
+  uint64_t Words = Bytes / 4;
+  if (Words > HelperMaxWords)
+    return SDValue();
+  Chain = emitHelperCall(DAG, dl, Chain, "__patmos_memcpy_w", Dst, Src, Words);
+  return emitInlineCopy(DAG, dl, Chain, Dst, Src, Words * 4, Bytes % 4,
+                        Alignment, CopyGroupSize, DstPtrInfo, SrcPtrInfo);
+}
+
+SDValue PatmosSelectionDAGInfo::EmitTargetCodeForMemmove(SelectionDAG &DAG,
+                                  const SDLoc &dl, SDValue Chain,
+                                  SDValue Dst, SDValue Src, SDValue Size,
+                                  Align Alignment, bool isVolatile,
+                                  MachinePointerInfo DstPtrInfo,
+                                  MachinePointerInfo SrcPtrInfo) const
+{
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || isVolatile || Alignment < Align(4))
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+  if (Bytes > InlineMemmoveSize)
+    return SDValue();
+
+  // The regions might overlap, load everything before the first store.
+  return emitInlineCopy(DAG, dl, Chain, Dst, Src, 0, Bytes, Alignment,
+                        Bytes, DstPtrInfo, SrcPtrInfo);
+}
+
+SDValue PatmosSelectionDAGInfo::EmitTargetCodeForMemset(SelectionDAG &DAG,
+                                  const SDLoc &dl, SDValue Chain,
+                                  SDValue Dst, SDValue Val, SDValue Size,
+                                  Align Alignment, bool isVolatile,
+                                  MachinePointerInfo DstPtrInfo) const
+{
+  ConstantSDNode *ConstSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstSize || isVolatile || Alignment < Align(4))
+    return SDValue();
+
+  uint64_t Bytes = ConstSize->getZExtValue();
+
+  // Replicate the byte into all bytes of a word.
+  SDValue Word;
+  if (ConstantSDNode *ConstVal = dyn_cast<ConstantSDNode>(Val)) {
+    APInt Byte = ConstVal->getAPIntValue().zextOrTrunc(8);
+    Word = DAG.getConstant(APInt::getSplat(32, Byte), dl, MVT::i32);
+  } else {
+    Word = DAG.getZExtOrTrunc(Val, dl, MVT::i8);
+    Word = DAG.getNode(ISD::ZERO_EXTEND, dl, MVT::i32, Word);
+    Word = DAG.getNode(ISD::OR, dl, MVT::i32, Word,
+                       DAG.getNode(ISD::SHL, dl, MVT::i32, Word,
+                                   DAG.getConstant(8, dl, MVT::i32)));
+    Word = DAG.getNode(ISD::OR, dl, MVT::i32, Word,
+                       DAG.getNode(ISD::SHL, dl, MVT::i32, Word,
+                                   DAG.getConstant(16, dl, MVT::i32)));
+  }
+
+  uint64_t Offset = 0;
+  if (Bytes > InlineMemSize) {
+    uint64_t Words = Bytes / 4;
+    if (Words > HelperMaxWords)
+      return SDValue();
+    Chain = emitHelperCall(DAG, dl, Chain, "__patmos_memset_w", Dst, Word,
+                           Words);
+    Offset = Words * 4;
+  }
+
+  // Stores do not depend on each other, join them in a single token factor.
+  SmallVector<SDValue, 16> Stores;
+  while (Offset < Bytes) {
+    unsigned StoreBytes = 4;
+    while (StoreBytes > Bytes - Offset)
+      StoreBytes /= 2;
+    EVT VT = EVT::getIntegerVT(*DAG.getContext(), StoreBytes * 8);
+
+    SDValue Ptr = DAG.getMemBasePlusOffset(Dst, TypeSize::Fixed(Offset), dl);
+    Stores.push_back(DAG.getTruncStore(Chain, dl, Word, Ptr,
+                                       DstPtrInfo.getWithOffset(Offset), VT,
+                                       commonAlignment(Alignment, Offset)));
+    Offset += StoreBytes;
+  }
+
+  if (Stores.empty())
+    return Chain;
+  return DAG.getNode(ISD::TokenFactor, dl, MVT::Other, Stores);
+}
@@ -28,6 +28,33 @@ public:
   bool disableGenericCombines(CodeGenOpt::Level OptLevel) const override {
     return false;
   }
+
+  /// EmitTargetCodeForMemcpy - Emit word-aligned copies of constant size as
+  /// a sequence of grouped loads and stores, or call __patmos_memcpy_w for
+  /// large sizes.
+  SDValue EmitTargetCodeForMemcpy(SelectionDAG &DAG, const SDLoc &dl,
+                                  SDValue Chain, SDValue Dst, SDValue Src,
+                                  SDValue Size, Align Alignment,
+                                  bool isVolatile, bool AlwaysInline,
+                                  MachinePointerInfo DstPtrInfo,
+                                  MachinePointerInfo SrcPtrInfo) const override;
+
+  /// EmitTargetCodeForMemmove - Emit small moves of constant size by loading
+  /// all values before storing any of them.
+  SDValue EmitTargetCodeForMemmove(SelectionDAG &DAG, const SDLoc &dl,
+                                   SDValue Chain, SDValue Dst, SDValue Src,
+                                   SDValue Size, Align Alignment,
+                                   bool isVolatile,
+                                   MachinePointerInfo DstPtrInfo,
+                                   MachinePointerInfo SrcPtrInfo) const override;
+
+  /// EmitTargetCodeForMemset - Emit word-aligned memsets of constant size as
+  /// a sequence of stores, or call __patmos_memset_w for large sizes.
+  SDValue EmitTargetCodeForMemset(SelectionDAG &DAG, const SDLoc &dl,
+                                  SDValue Chain, SDValue Dst, SDValue Val,
+                                  SDValue Size, Align Alignment,
+                                  bool isVolatile,
+                                  MachinePointerInfo DstPtrInfo) const override;
 };
 
 }
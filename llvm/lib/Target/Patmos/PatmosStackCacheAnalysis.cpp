@@ -27,19 +27,29 @@
 #undef PATMOS_TRACE_DETAILED_RESULTS
 
 #include "PatmosCallGraphBuilder.h"
+#include "PatmosFrameLowering.h"
+#include "PatmosILPSolver.h"
 #include "PatmosMachineFunctionInfo.h"
 #include "PatmosStackCacheAnalysis.h"
 #include "PatmosSubtarget.h"
 #include "PatmosTargetMachine.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Debug.h"
-#include "llvm/Support/Program.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/YAMLParser.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/Path.h"
 
+#include <cmath>
 #include <map>
 #include <set>
 #include <fstream>
@@ -78,8 +88,37 @@ static cl::opt<std::string> Solve_ilp(
   cl::desc("Path to an ILP solver."),
   cl::Hidden);
 
+/// Option to solve the ILPs with the external solver instead of the built-in
+/// one.
+static cl::opt<bool> ExternalILPSolver(
+  "mpatmos-ilp-solver-external",
+  cl::init(true),
+  cl::desc("Solve ILPs with the external solver given by -mpatmos-ilp-solver "
+           "instead of the built-in solver, which passes the ILPs exceeding "
+           "its limits on to the external one (default: true)."),
+  cl::Hidden);
+
+/// Option to specify the number of threads solving ILPs concurrently.
+static cl::opt<unsigned> ILPThreads(
+  "mpatmos-ilp-solver-threads",
+  cl::init(1),
+  cl::desc("Number of threads solving independent ILPs of the stack cache "
+           "analysis concurrently (0 = number of hardware threads, "
+           "default: 1)."),
+  cl::Hidden);
+
+/// Option to keep the solutions of ILPs on disk, such that unchanged SCCs of
+/// the call graph need not be solved again in later compiler runs.
+static cl::opt<std::string> ILPCacheDir(
+  "mpatmos-ilp-cache-dir",
+  cl::init(""),
+  cl::desc("Directory caching the ILP solutions of the stack cache analysis "
+           "across compiler runs."),
+  cl::Hidden);
+
 /// Option to specify a file containing user-supplied bounds when solving ILP
-/// problems (for regions of the call graph with recursion).
+/// problems (for regions of the call graph with recursion), in addition to
+/// the recursion depths annotated in the source code.
 static cl::opt<std::string> BoundsFile(
   "mpatmos-stack-cache-analysis-bounds",
   cl::desc("File containing bounds for the stack cache analysis."),
@@ -104,15 +143,17 @@ static cl::opt<bool> EnablePreemptionSCA(
 /// EnableEnsureDwn - Option to enable ensure down-sizing during analysis
 static cl::opt<bool> EnableEnsureDwn(
   "mpatmos-sca-downsize-ensures",
-  cl::init(false),
-  cl::desc("Down-size ensure instructions during Stack Cache Analysis."),
+  cl::init(true),
+  cl::desc("Down-size ensure instructions to the live stack area during Stack "
+           "Cache Analysis (default: true)."),
   cl::Hidden);
 
 /// EnableEnsureOpt - Option to enable ensure optimization during analysis
 static cl::opt<bool> EnableEnsureOpt(
   "mpatmos-sca-remove-ensures",
-  cl::init(false),
-  cl::desc("Remove unnecessary ensure instructions during Stack Cache Analysis."),
+  cl::init(true),
+  cl::desc("Remove ensure instructions that provably never fill during Stack "
+           "Cache Analysis (default: true)."),
   cl::Hidden);
 
 /// EnableLazyPointer - Option to enable lazy pointer analysis
@@ -122,6 +163,23 @@ static cl::opt<bool> EnableLazyPointer(
   cl::desc("Enable lazy pointer (spill-cost-saving) analysis."),
   cl::Hidden);
 
+/// EnableEarlyFree - Option to free dead stack cache data before calls
+static cl::opt<bool> EnableEarlyFree(
+  "mpatmos-sca-early-free",
+  cl::init(false),
+  cl::desc("Free dead data at the top of the stack cache frame before calls "
+           "and reserve it again after the call returns."),
+  cl::Hidden);
+
+/// MaxSCAGraphMemory - Option to limit the memory of the context-sensitive
+/// spill cost analysis.
+static cl::opt<unsigned> MaxSCAGraphMemory(
+  "mpatmos-sca-max-graph-memory",
+  cl::init(0),
+  cl::desc("Fall back to context-insensitive spill costs when the SCA graph "
+           "grows beyond the given size in MB (default: 0, unlimited)."),
+  cl::Hidden);
+
 /// EnableContextSwitchAnalysis - Option to enable context switch analysis
 static cl::opt<bool> EnableContextSwitchAnalysis(
   "mpatmos-sca-cs",
@@ -137,7 +195,8 @@ static cl::opt<bool> RootOccupied(
   cl::ReallyHidden);
 
 static cl::opt<std::string> SCAPMLExport("mpatmos-sca-serialize",
-   cl::desc("Export PML specification of generated machine code to FILE"),
+   cl::desc("Export the results of the Stack Cache Analysis, including the "
+            "preemption costs (-mpatmos-sca-preemption), as PML to FILE"),
    cl::init(""));
 
 namespace llvm {
@@ -170,6 +229,9 @@ namespace llvm {
   /// Count the total number of nodes in the pruned SCA graph.
   STATISTIC(PrunedSCAGraphSize, "Pruned SCA graph size.");
 
+  /// Count the number of SCA graph nodes sharing the children of another node.
+  STATISTIC(SharedSCAContexts, "SCA graph nodes sharing children.");
+
   /// Count the total number of ILPs solved.
   STATISTIC(ILPs, "Number of ILPs solved.");
 
@@ -182,6 +244,12 @@ namespace llvm {
   /// Count the number of stores ignored during lazy pointer analysis.
   STATISTIC(StoresIgnored, "Number of stores ignored (LP analysis).");
 
+  /// Count the number of call sites with an early free of dead data.
+  STATISTIC(EarlyFreeSites, "Call sites freeing dead stack data early.");
+
+  /// Count the number of bytes freed early at call sites.
+  STATISTIC(EarlyFreedBytes, "Bytes of dead stack data freed before calls.");
+
   /// Count the number of analyzed basic blocks.
   STATISTIC(TotalBlocks, "Number of basic blocks.");
 
@@ -208,6 +276,10 @@ namespace llvm {
   STATISTIC(GlobalEnsureFillingFree,
    "Number of omitted SENS instructions - global restore analysis.");
 
+  /// Count the functions with context-insensitive spill costs.
+  STATISTIC(ContextInsensitiveFunctions,
+   "Functions with context-insensitive spill costs (SCA graph too large).");
+
   /// Prefixes for ILP variable names
   enum ilp_prefix {
     T,
@@ -464,24 +536,33 @@ namespace llvm {
     /// The root node of the spill cost graph.
     SCANode *Root;
 
-    /// Subtarget information (stack cache sizes)
-    const PatmosSubtarget &STC;
+    /// Arena of the SCA nodes, which are freed all at once with the graph.
+    SpecificBumpPtrAllocator<SCANode> NodeAllocator;
+
+    /// Number of edges linked by link.
+    uint64_t NumEdges;
+
+    /// Frame lowering information (effective stack cache sizes)
+    const PatmosFrameLowering &PFL;
 
   public:
-    SpillCostAnalysisGraph(const PatmosSubtarget &s) : STC(s) {}
+    SpillCostAnalysisGraph(const PatmosFrameLowering &pfl) : Root(NULL),
+      PFL(pfl), NumEdges(0) {}
 
     /// makeRoot - Construct the root node of the SCA graph.
     SCANode *makeRoot(MCGNode *node, unsigned int maxdisplacment,
                       bool hascallfreepath)
     {
       assert(Nodes.empty());
-      unsigned rootoccupancy = RootOccupied ? STC.getStackCacheSize() : 0;
+      unsigned rootoccupancy = RootOccupied ?
+                                         PFL.getEffectiveStackCacheSize() : 0;
       CostPair occupancyCosts(rootoccupancy, rootoccupancy);
       CostPair spillCosts(0, 0);
 
       // create the root node.
-      Root = new SCANode(node, occupancyCosts, maxdisplacment, spillCosts,
-                         hascallfreepath);
+      Root = new (NodeAllocator.Allocate()) SCANode(node, occupancyCosts,
+                                                    maxdisplacment, spillCosts,
+                                                    hascallfreepath);
 
       // store the root node.
       Nodes[std::make_pair(node, occupancyCosts)] = Root;
@@ -510,8 +591,10 @@ namespace llvm {
 #endif // PATMOS_TRACE_DETAILED_RESULTS
 
         // create a new node
-        result = new SCANode(node, occupancy, maxdisplacment, spillcost,
-                             hascallfreepath);
+        result = new (NodeAllocator.Allocate()) SCANode(node, occupancy,
+                                                        maxdisplacment,
+                                                        spillcost,
+                                                        hascallfreepath);
 
         // store the newly created node
         Nodes[std::make_pair(node, occupancy)] = result;
@@ -526,8 +609,9 @@ namespace llvm {
       }
     }
 
-    /// deleteNode - Free the node and remove it from the node list as well as
-    /// parent/children lists.
+    /// deleteNode - Remove the node from the node list as well as
+    /// parent/children lists. The node itself stays in the arena until the
+    /// graph is freed, only its edges are freed here.
     void deleteNode(SCANode *N)
     {
       // remove the node from the node list
@@ -546,7 +630,34 @@ namespace llvm {
         i->getCallee()->getParents().erase(*i);
       }
 
-      delete N;
+      N->getParents().clear();
+      N->getChildren().clear();
+    }
+
+    /// link - Create a link between a node and its parent.
+    void link(SCANode *node, SCANode *parent, MCGSite *site)
+    {
+      node->addParent(parent, site);
+      NumEdges++;
+    }
+
+    /// getMemoryEstimate - Return an estimate of the memory used by the graph
+    /// in bytes, including the tree nodes of the node map and the edge sets.
+    uint64_t getMemoryEstimate() const
+    {
+      const uint64_t TreeNode = 4 * sizeof(void*);
+      return Nodes.size() * (sizeof(SCANode) +
+                             sizeof(MCGSCANodeMap::value_type) + TreeNode) +
+             NumEdges * 2 * (sizeof(SCAEdge) + TreeNode);
+    }
+
+    /// clear - Free all nodes and edges of the graph.
+    void clear()
+    {
+      Nodes.clear();
+      NodeAllocator.DestroyAll();
+      Root = NULL;
+      NumEdges = 0;
     }
 
     /// Return the graph's root node.
@@ -561,15 +672,6 @@ namespace llvm {
     {
       return Nodes;
     }
-
-    /// Free all SCA nodes associated with this graph.
-    ~SpillCostAnalysisGraph()
-    {
-      for(MCGSCANodeMap::iterator i(Nodes.begin()), ie(Nodes.end()); i != ie;
-          i++) {
-        delete i->second;
-      }
-    }
   };
 
   /// Information concerning a specific SCC.
@@ -690,29 +792,69 @@ namespace llvm {
       appendDefaultConstraitns();
     }
 
-    /// getInfo - Retrieve information for a specific SCC.
-    const SCCInfo &getInfo(const MCGNodes &SCC) const {
+    /// getRecursionDepth - Return the bound on the activations of a function
+    /// on a chain of calls through its SCC, annotated in the source code by
+    /// the recursiondepth attribute, or 0 if there is none.
+    static unsigned getRecursionDepth(const MCGNode *N) {
+      if (N->isUnknown())
+        return 0;
+      Attribute A(N->getMF()->getFunction().getFnAttribute(
+                                                    "patmos-recursion-depth"));
+      unsigned Depth;
+      if (!A.isStringAttribute() ||
+          A.getValueAsString().getAsInteger(10, Depth))
+        return 0;
+      return Depth;
+    }
+
+    /// getInfo - Retrieve information for a specific SCC, the bounds from the
+    /// bounds file and the constraints generated for the functions with an
+    /// annotated recursion depth.
+    SCCInfo getInfo(const MCGNodes &SCC) const {
+      SCCInfo Info;
+      bool Found = false;
       for(MCGNodes::const_iterator i(SCC.begin()), ie(SCC.end()); i != ie;
           i++) {
         // TODO: maybe add support for unknown functions.
         if (!(*i)->isUnknown() &&
-            hasInfo((*i)->getMF()->getFunction().getName().str()))
-          return getInfo((*i)->getMF()->getFunction().getName().str());
+            hasInfo((*i)->getMF()->getFunction().getName().str())) {
+          Info = getInfo((*i)->getMF()->getFunction().getName().str());
+          Found = true;
+          break;
+        }
       }
 
-      dbgs() << "Error: Missing bounds for SCC: (";
+      // the number of activations of a function on the path through the SCC
+      // is its X variable, see ilp_name.
+      unsigned cnt = 0;
+      for(MCGNodes::const_iterator i(SCC.begin()), ie(SCC.end()); i != ie;
+          i++) {
+        if (unsigned Depth = getRecursionDepth(*i)) {
+          raw_string_ostream OS(Info.Constraints);
+          OS << "rd" << cnt++ << ":\t + X"
+             << (*i)->getMF()->getFunction().getName() << " <= " << Depth
+             << "\n";
+          Found = true;
+        }
+      }
+
+      if (Found)
+        return Info;
+
+      errs() << "Error: Missing bounds for SCC: (";
       for (MCGNodes::const_iterator i(SCC.begin()), ie(SCC.end()); i != ie;
            i++) {
-        dbgs() << "'" << **i << "' ";
+        errs() << "'" << **i << "' ";
       }
-      dbgs() << ")\nbounds available: ";
+      errs() << ")\nbounds available: ";
       for (SCCInfos::const_iterator i(Infos.begin()), ie(Infos.end()); i != ie;
            i++) {
-        dbgs() << "'" << i->first << "' ";
+        errs() << "'" << i->first << "' ";
       }
-      dbgs() << "\n";
-      assert(false && "Missing bounds for SCC during stack cache analysis.");
-      abort();
+      errs() << "\n";
+      report_fatal_error("Missing bounds for SCC during stack cache analysis, "
+                         "annotate a function of the SCC with "
+                         "__attribute__((recursiondepth(N))).");
     }
 
     /// getInfo - Retrieve information for a specific SCC represented by a
@@ -734,8 +876,70 @@ namespace llvm {
   /// Pass to analyze the occupancy and displacement of Patmos' stack cache.
   class PatmosStackCacheAnalysis : public MachineModulePass {
   private:
-    /// Work list of basic blocks.
-    typedef std::set<MachineBasicBlock*> MBBs;
+    /// Work list of the basic blocks of a function. The blocks are visited in
+    /// reverse post order, or in post order for backward problems, and each
+    /// block is on the work list at most once.
+    class MBBs {
+      /// The basic blocks in the order they are visited.
+      std::vector<MachineBasicBlock*> Order;
+
+      /// The position of each basic block in Order, by block number.
+      std::vector<unsigned int> Position;
+
+      /// The positions of the basic blocks on the work list.
+      BitVector Pending;
+
+    public:
+      MBBs(MachineFunction &MF, bool Backward)
+      {
+        ReversePostOrderTraversal<MachineFunction*> RPOT(&MF);
+        Order.assign(RPOT.begin(), RPOT.end());
+
+        // blocks unreachable from the entry are visited last
+        if (Order.size() != MF.size()) {
+          BitVector Visited(MF.getNumBlockIDs());
+          for(unsigned int i = 0, ie = Order.size(); i != ie; i++)
+            Visited.set(Order[i]->getNumber());
+          for(MachineFunction::iterator i(MF.begin()), ie(MF.end()); i != ie;
+              i++) {
+            if (!Visited.test(i->getNumber()))
+              Order.push_back(&*i);
+          }
+        }
+
+        if (Backward)
+          std::reverse(Order.begin(), Order.end());
+
+        Position.resize(MF.getNumBlockIDs());
+        for(unsigned int i = 0, ie = Order.size(); i != ie; i++)
+          Position[Order[i]->getNumber()] = i;
+
+        Pending.resize(Order.size());
+      }
+
+      bool empty() const { return Pending.none(); }
+
+      void insert(MachineBasicBlock *MBB)
+      {
+        Pending.set(Position[MBB->getNumber()]);
+      }
+
+      template<typename IteratorT>
+      void insert(IteratorT I, IteratorT E)
+      {
+        for(; I != E; I++)
+          insert(*I);
+      }
+
+      /// pop - Remove the first basic block from the work list.
+      MachineBasicBlock *pop()
+      {
+        int i = Pending.find_first();
+        assert(i >= 0 && "Work list is empty.");
+        Pending.reset(i);
+        return Order[i];
+      }
+    };
 
     /// Set of call graph nodes.
     typedef std::set<MCGNode*> MCGNodeSet;
@@ -748,19 +952,22 @@ namespace llvm {
     typedef std::vector<std::pair<MCGNodes, bool> > MCGNSCCs;
 
     /// Map basic blocks to an unsigned integer.
-    typedef std::map<MachineBasicBlock*, unsigned int> MBBUInt;
+    typedef DenseMap<MachineBasicBlock*, unsigned int> MBBUInt;
 
     /// Map basic blocks to a boolean.
-    typedef std::map<MachineBasicBlock*, bool> MBBBool;
+    typedef DenseMap<MachineBasicBlock*, bool> MBBBool;
 
     /// Map call graph nodes to booleans.
-    typedef std::map<MCGNode*, bool> MCGNodeBool;
+    typedef DenseMap<MCGNode*, bool> MCGNodeBool;
 
     /// Map call graph nodes to their (potentially trivial SCC).
     typedef std::map<MCGNode*, std::pair<MCGNodes, bool>*> MCGNodeSCC;
 
     /// Map call graph nodes to an unsigned integer.
-    typedef std::map<MCGNode*, unsigned int> MCGNodeUInt;
+    typedef DenseMap<MCGNode*, unsigned int> MCGNodeUInt;
+
+    /// List of call graph nodes and the ILPs to solve for them.
+    typedef std::vector<std::pair<MCGNode*, std::string> > MCGNodeILPs;
 
     struct MCGSiteCompare {
       bool operator()(const MCGSite *lhs, const MCGSite *rhs) const {
@@ -780,13 +987,13 @@ namespace llvm {
     };
 
     /// Map call sites to an unsigned integer.
-    typedef std::map<MCGSite*, unsigned int> MCGSiteUInt;
+    typedef DenseMap<MCGSite*, unsigned int> MCGSiteUInt;
     typedef std::map<MCGSite*, unsigned int, MCGSiteCompare> MCGSiteUIntSort;
 
     /// List of ensures and their effective sizes.
-    typedef std::map<MachineInstr*, unsigned int> SIZEs;
+    typedef DenseMap<MachineInstr*, unsigned int> SIZEs;
 
-    typedef std::map<const MachineInstr*, std::pair<MachineBasicBlock*,
+    typedef DenseMap<const MachineInstr*, std::pair<MachineBasicBlock*,
                                                     unsigned> > MInstrIndex;
 
     /// Track for each call graph node the maximum stack displacement.
@@ -863,11 +1070,12 @@ namespace llvm {
 
     ////////////////////////////////////////////////////////////////////////////
 
-    /// Subtarget information (stack cache block size)
-    const PatmosSubtarget &STC;
+    /// Frame lowering information (effective stack cache sizes, accounting
+    /// for the block-aligned stack cache)
+    const PatmosFrameLowering &PFL;
 
     /// Instruction information
-    const TargetInstrInfo &TII;
+    const PatmosInstrInfo &TII;
 
     /// Summarize the stack cache analysis results for reserve instructions as
     /// a spill cost graph.
@@ -876,18 +1084,44 @@ namespace llvm {
     /// Bounds to solve ILPs during stack cache analysis.
     const BoundsInformation BI;
 
+    /// Solver for the ILPs.
+    std::unique_ptr<PatmosILPSolver> Solver;
+
+    /// Threads to solve independent ILPs concurrently, or NULL.
+    std::unique_ptr<ThreadPool> Pool;
+
+    /// Flag indicating whether the SCA graph exceeded its memory limit, and
+    /// the spill costs are context-insensitive.
+    /// \see MaxSCAGraphMemory
+    bool ContextInsensitive;
+
     MInstrIndex MiMap;
   public:
     /// Pass ID
     static char ID;
 
     PatmosStackCacheAnalysis(const PatmosTargetMachine &tm) :
-        MachineModulePass(ID), STC(*tm.getSubtargetImpl()),
-        TII(*tm.getInstrInfo()), SCAGraph(STC), BI(BoundsFile)
+        MachineModulePass(ID),
+        PFL(*static_cast<const PatmosFrameLowering*>(
+                                   tm.getSubtargetImpl()->getFrameLowering())),
+        TII(*tm.getInstrInfo()), SCAGraph(PFL), BI(BoundsFile),
+        Solver(createSolver()), ContextInsensitive(false)
     {
       initializePatmosCallGraphBuilderPass(*PassRegistry::getPassRegistry());
     }
 
+    /// createSolver - Create the ILP solver selected on the command line.
+    static std::unique_ptr<PatmosILPSolver> createSolver()
+    {
+      std::unique_ptr<PatmosILPSolver> solver(
+                                      createPatmosExternalILPSolver(Solve_ilp));
+      if (!ExternalILPSolver)
+        solver = createPatmosBuiltinILPSolver(std::move(solver));
+      if (!ILPCacheDir.empty())
+        solver = createPatmosCachingILPSolver(std::move(solver), ILPCacheDir);
+      return solver;
+    }
+
     /// getAnalysisUsage - Inform the pass manager that nothing is modified.
     virtual void getAnalysisUsage(AnalysisUsage &AU) const
     {
@@ -976,11 +1210,32 @@ namespace llvm {
         return nodeDisplacement->second;
     }
 
+    /// getStackCacheSize - Return the size of the stack cache available to
+    /// the frames. With the block-aligned stack cache, frames are not rounded
+    /// to blocks, but one block of the stack cache remains unused.
+    unsigned int getStackCacheSize() const
+    {
+      return PFL.getEffectiveStackCacheSize();
+    }
+
+    /// getStackCacheBlockSize - Return the granularity of the frames.
+    unsigned int getStackCacheBlockSize() const
+    {
+      return PFL.getEffectiveStackCacheBlockSize();
+    }
+
+    /// getAlignedStackFrameSize - Return the size of a frame, rounded to the
+    /// granularity of the frames.
+    unsigned int getAlignedStackFrameSize(unsigned int frameSize) const
+    {
+      return PFL.getAlignedStackCacheFrameSize(frameSize);
+    }
+
     /// getMinDisplacement - Find the computed minimum stack displacement for a
     /// call graph node, including all its children in the call graph.
     unsigned int getMinDisplacement(MCGNode *Node) const
     {
-      return std::min(STC.getStackCacheSize(),
+      return std::min(getStackCacheSize(),
                       getMinMaxDisplacement(Node, false));
     }
 
@@ -988,7 +1243,7 @@ namespace llvm {
     /// call graph node, including all its children in the call graph.
     unsigned int getMaxDisplacement(MCGNode *Node) const
     {
-      return std::min(STC.getStackCacheSize(),
+      return std::min(getStackCacheSize(),
                       getMinMaxDisplacement(Node, true));
     }
 
@@ -1006,10 +1261,23 @@ namespace llvm {
         // TODO a function might contain inline asm code that might use
         // SRES/SFREE, we should check for that.
 
-        return STC.getAlignedStackFrameSize(PMFI->getStackCacheReservedBytes());
+        return getAlignedStackFrameSize(PMFI->getStackCacheReservedBytes());
       }
     }
 
+    /// getRegionBytesReserved - Get the number of bytes reserved on top of the
+    /// frame by the stack cache region of a call graph node, which contains
+    /// no calls. Returns 0 for UNKNOWN nodes and frames that are not split.
+    /// \see PatmosFrameLowering::splitStackCacheFrame
+    unsigned int getRegionBytesReserved(const MCGNode *Node) const
+    {
+      if (Node->isUnknown())
+        return 0;
+
+      return Node->getMF()->getInfo<PatmosMachineFunctionInfo>()->
+                                                    getStackCacheRegionBytes();
+    }
+
     /// getGlobalEnsureFilling - Worst-case number of blocks that need to be
     /// loaded by ensures of the node and its callers in the case of a
     /// preemption.
@@ -1049,7 +1317,7 @@ namespace llvm {
     /// graph.
     void computeMinMaxDisplacement(MCGNodeSCC &SCCMap, MCGNode *Node,
                                    MCGNodeUInt &succCount, MCGNodes &WL,
-                                   bool Maximize)
+                                   const MCGNodeUInt &Solutions, bool Maximize)
     {
       // keep track of the total displacement of the node and its children
       unsigned int totalDisplacment;
@@ -1064,12 +1332,27 @@ namespace llvm {
         return;
       }
       else if (SCCMap[Node]->second) {
-        // the node is in an SCC! -> make an ILP
+        // the node is in an SCC! -> the ILP has been solved already
         // note: we know here that all successors of the entire SCC have been
         // handled
-        totalDisplacment = computeMinMaxDisplacementILP(SCCMap[Node]->first,
-                                                        Node, Maximize);
+        assert(Solutions.count(Node));
+        totalDisplacment = Solutions.find(Node)->second;
+
+#ifdef PATMOS_TRACE_CG_DISPLACMENT_ILP
+        dbgs() << "ILP: " << *Node << ": " << totalDisplacment << "\n";
+#endif // PATMOS_TRACE_CG_DISPLACMENT_ILP
+
         assert(totalDisplacment >= nodeDisplacement);
+
+        // the ILP does not know about the stack cache regions, which are on
+        // top of the frame of one function of the SCC at a time
+        if (Maximize) {
+          unsigned int regionDisplacement = 0;
+          for (MCGNode *N : SCCMap[Node]->first)
+            regionDisplacement = std::max(regionDisplacement,
+                                          getRegionBytesReserved(N));
+          totalDisplacment += regionDisplacement;
+        }
       }
       else {
         const MCGSites &callSites(Node->getSites());
@@ -1096,6 +1379,12 @@ namespace llvm {
           }
         }
 
+        // the stack cache region is reserved on top of the frame, where no
+        // call displaces the stack cache
+        if (Maximize)
+          childDisplacement = std::max(childDisplacement,
+                                       getRegionBytesReserved(Node));
+
         // include the current function's displacement
         assert(childDisplacement != std::numeric_limits<unsigned int>::max());
         totalDisplacment = childDisplacement + nodeDisplacement;
@@ -1146,6 +1435,10 @@ namespace llvm {
     /// \see computeMinMaxDisplacementILP
     void computeMinMaxDisplacement(const MCallGraph &G, bool Maximize)
     {
+      PatmosPhaseScope T(Maximize ? "sca-max-displacement"
+                                  : "sca-min-displacement",
+                         Maximize ? "SCA Maximum Displacement"
+                                  : "SCA Minimum Displacement");
       // list of SCCs in the call graph and mapping to/from call graph nodes
       MCGNSCCs SCCs;
       MCGNodeSCC SCCMap;
@@ -1204,14 +1497,31 @@ namespace llvm {
         }
       }
 
-      // process nodes in topological order
+      // process nodes in topological order, all nodes on the work list are
+      // independent of each other.
       while(!WL.empty()) {
-        // pop some node from the work list
-        MCGNode *tmp = WL.back();
-        WL.pop_back();
+        MCGNodes Ready;
+        Ready.swap(WL);
+
+        // solve the ILPs of all ready nodes in SCCs
+        MCGNodeILPs Problems;
+        for(MCGNodes::const_iterator i(Ready.begin()), ie(Ready.end());
+            i != ie; i++) {
+          if (!(*i)->isDead() && SCCMap[*i]->second) {
+            Problems.push_back(std::make_pair(*i,
+                 makeMinMaxDisplacementILP(SCCMap[*i]->first, *i, Maximize)));
+          }
+        }
 
-        // compute its displacement
-        computeMinMaxDisplacement(SCCMap, tmp, succCount, WL, Maximize);
+        MCGNodeUInt Solutions;
+        solveILPs(Problems, Solutions);
+
+        // compute their displacement
+        for(MCGNodes::const_reverse_iterator i(Ready.rbegin()),
+            ie(Ready.rend()); i != ie; i++) {
+          computeMinMaxDisplacement(SCCMap, *i, succCount, WL, Solutions,
+                                    Maximize);
+        }
       }
 
 #ifdef PATMOS_TRACE_CG_DISPLACMENT
@@ -1247,7 +1557,7 @@ namespace llvm {
           if (MI->getOperand(3).isImm() && B == Patmos::R0) {
             return scale * (MI->getOperand(3).getImm() + 1);
           }
-          else return STC.getStackCacheSize();
+          else return getStackCacheSize();
         }
         case Patmos::LWS:
           scale = 2;
@@ -1261,7 +1571,7 @@ namespace llvm {
           if (MI->getOperand(4).isImm() && B == Patmos::R0) {
             return scale * (MI->getOperand(4).getImm() + 1);
           }
-          else return STC.getStackCacheSize();
+          else return getStackCacheSize();
         }
         default:
           return 0;
@@ -1288,15 +1598,17 @@ namespace llvm {
           assert(i->getOperand(2).isImm());
 
           // compute actual space to ensure here (in words)
-          unsigned int ensure = STC.getAlignedStackFrameSize(liveAreaSize) / 4;
+          unsigned int ensure = getAlignedStackFrameSize(liveAreaSize) / 4;
 
           // update the ensure to reserve only the space actually used.
           ENSs[&*i] = std::min(ensure, (unsigned int)i->getOperand(2).getImm());
 
           // If we encounter an ensure, we can reset the liveAreaSize to 0
           // since all following accesses will be served by this ensure. This
-          // also applies when this ensure is eliminated.
-          liveAreaSize = 0;
+          // also applies when this ensure is eliminated. A predicated ensure,
+          // e.g., after a conditional call, serves them only if it executes.
+          if (!TII.isPredicated(*i))
+            liveAreaSize = 0;
         }
         else {
           // compute the size of the live area before the current instruction
@@ -1330,21 +1642,21 @@ namespace llvm {
     /// remove ensures.
     void propagateLiveArea(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-live-area", "SCA Live Area");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
       for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
           i++) {
         if (!(*i)->isUnknown() && !(*i)->isDead()) {
-          MBBs WL;
           SIZEs ENSs;
           MBBUInt INs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, true);
 
           MCGNodes::const_iterator j = i;
 
-          // initialize work list (yeah, reverse-reverse post order would be
-          // optimal, but this works too).
+          // initialize work list, blocks are visited in post order.
           for(MachineFunction::iterator i(MF->begin()), ie(MF->end()); i != ie;
               i++) {
             WL.insert(&*i);
@@ -1353,8 +1665,7 @@ namespace llvm {
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its predecessors on the work list.
@@ -1408,10 +1719,10 @@ namespace llvm {
                                                getMinOccupancy(Node));
 
           unsigned int minSpill = safeUIntDiff(minOccupancy + minDisp,
-                                               STC.getStackCacheSize());
+                                               getStackCacheSize());
 
           unsigned int minSpillPr = safeUIntDiff(k + minDisp,
-                                                 STC.getStackCacheSize());
+                                                 getStackCacheSize());
 
           siteGain = std::max(siteGain, safeUIntDiff(minSpill, minSpillPr));
         }
@@ -1442,18 +1753,18 @@ namespace llvm {
     /// CFG.
     void propagateReserveGain(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-reserve-gain", "SCA Reserve Gain");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
       for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
           i++) {
         if (!(*i)->isUnknown() && !(*i)->isDead()) {
-          MBBs WL;
           MBBUInt INs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, true);
 
-          // initialize work list (yeah, reverse-reverse post order would be
-          // optimal, but this works too).
+          // initialize work list, blocks are visited in post order.
           for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
               j++) {
             WL.insert(&*j);
@@ -1462,8 +1773,7 @@ namespace llvm {
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its predecessors on the work list.
@@ -1526,18 +1836,19 @@ namespace llvm {
     /// filling.
     void propagateLocalEnsureFilling(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-local-ensure-filling",
+                         "SCA Local Ensure Filling");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
       for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
           i++) {
         if (!(*i)->isUnknown() && !(*i)->isDead()) {
-          MBBs WL;
           MBBUInt INs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, true);
 
-          // initialize work list (yeah, reverse-reverse post order would be
-          // optimal, but this works too).
+          // initialize work list, blocks are visited in post order.
           for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
               j++) {
             WL.insert(&*j);
@@ -1547,8 +1858,7 @@ namespace llvm {
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its predecessors on the work list.
@@ -1562,7 +1872,8 @@ namespace llvm {
     /// at the ensure instruction of all the callers of a call graph node
     /// downwards through the call graph.
     void propagateGlobalEnsureFilling(MCGNodeSCC &SCCMap, MCGNode *Node,
-                                      MCGNodeUInt &succCount, MCGNodes &WL)
+                                      MCGNodeUInt &succCount, MCGNodes &WL,
+                                      const MCGNodeUInt &Solutions)
     {
       // keep track of the total ensure cost of the node and its parent
       unsigned int totalCost = 0;
@@ -1575,19 +1886,23 @@ namespace llvm {
       GlobalEnsureFillingTotal++;
 
       if (SCCMap[Node]->second) {
-        if (getMinDisplacement(Node) >= STC.getStackCacheSize()) {
+        if (getMinDisplacement(Node) >= getStackCacheSize()) {
           GlobalEnsureFillingILPFree++;
         }
         else {
-          // the node is in an SCC! -> make an ILP
+          // the node is in an SCC! -> the ILP has been solved already
           // note: we know here that all predecessors of the entire SCC have been
           // handled
-          totalCost = propagateGlobalEnsureFillingILP(SCCMap[Node]->first,
-                                                      Node);
+          assert(Solutions.count(Node));
+          totalCost = Solutions.find(Node)->second;
           GlobalEnsureFillingILP++;
+
+#ifdef PATMOS_TRACE_CG_ENS_COST_ILP
+          dbgs() << "ILP: " << *Node << ": " << totalCost << "\n";
+#endif // PATMOS_TRACE_CG_ENS_COST_ILP
         }
       }
-      else if (getMaxDisplacement(Node) >= STC.getStackCacheSize()) {
+      else if (getMaxDisplacement(Node) >= getStackCacheSize()) {
         GlobalEnsureFillingFree++;
       }
       else {
@@ -1608,7 +1923,7 @@ namespace llvm {
         totalCost = parentCost;
       }
 
-      assert(totalCost <= STC.getStackCacheSize());
+      assert(totalCost <= getStackCacheSize());
 
       /// keep track of the additional blocks that have to be filled by ensures
       /// of other functions assuming a preemption in a preceding basic block.
@@ -1641,37 +1956,23 @@ namespace llvm {
       }
     }
 
-    /// propagateGlobalEnsureFillingILP - Propagate the worst-case filling
-    /// caused at the ensure instruction of all the callers of a call graph node
-    /// downwards through the call graph.
-    unsigned int propagateGlobalEnsureFillingILP(const MCGNodes &SCC,
-                                                 MCGNode *N)
+    /// makeGlobalEnsureFillingILP - Construct an ILP propagating the
+    /// worst-case filling caused at the ensure instruction of all the callers
+    /// of a call graph node downwards through the call graph.
+    /// \see solveILPs
+    std::string makeGlobalEnsureFillingILP(const MCGNodes &SCC, MCGNode *N)
     {
       assert(std::find(SCC.begin(), SCC.end(), N) != SCC.end());
 
       // get user-supplied bounds to solve the ILP.
-      const SCCInfo &BInfo(BI.getInfo(SCC));
-
-      // open LP file.
-      SmallString<1024> LPname;
-      std::error_code err = sys::fs::createUniqueDirectory("stack", LPname);
-      if (err) {
-        errs() << "Error creating temp .lp file: " << err.message() << "\n";
-        return std::numeric_limits<unsigned int>::max();
-      }
+      const SCCInfo BInfo(BI.getInfo(SCC));
 
-      sys::path::append(LPname, "scc.lp");
-
-      std::error_code ErrMsg;
-      raw_fd_ostream OS(LPname.c_str(), ErrMsg);
-      if (!ErrMsg) {
-        errs() << "Error: Failed to open file '" << LPname.str()
-               << "' for writing!\n";
-        return std::numeric_limits<unsigned int>::max();
-      }
+      // construct the LP in memory.
+      std::string LP;
+      raw_string_ostream OS(LP);
 
       // find entry and exit call sites
-      typedef std::set<MCGSite*> MCGSiteSet;
+      typedef std::set<MCGSite*, ilp_order> MCGSiteSet;
       MCGSiteSet entries, exits;
       for(MCGNodes::const_iterator n(SCC.begin()), ne(SCC.end()); n != ne;
           n++) {
@@ -1908,20 +2209,9 @@ namespace llvm {
 
       OS << "End\n";
 
-      OS.close();
-
-      // solve the ILP
-      unsigned int result = solve_ilp(LPname.c_str(), true);
-
-#ifdef PATMOS_TRACE_CG_ENS_COST_ILP
-      dbgs() << "ILP: " << *N << ": " << result << "\n";
-#endif // PATMOS_TRACE_CG_ENS_COST_ILP
-
-      // remove LP file
-      // TODO do we need to remove the temp dir??
-      sys::fs::remove(LPname.str());
+      OS.flush();
 
-      return result;
+      return LP;
     }
 
     /// propagateGlobalEnsureFilling - Propagate the worst-case filling caused
@@ -1929,6 +2219,8 @@ namespace llvm {
     /// downwards through the call graph.
     void propagateGlobalEnsureFilling(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-global-ensure-filling",
+                         "SCA Global Ensure Filling");
       // list of SCCs in the call graph and mapping to/from call graph nodes
       MCGNSCCs SCCs;
       MCGNodeSCC SCCMap;
@@ -1981,11 +2273,29 @@ namespace llvm {
         }
       }
 
+      // all nodes on the work list are independent of each other.
       while(!WL.empty()) {
-          MCGNode *tmp = WL.back();
-          WL.pop_back();
+        MCGNodes Ready;
+        Ready.swap(WL);
+
+        // solve the ILPs of all ready nodes in SCCs
+        MCGNodeILPs Problems;
+        for(MCGNodes::const_iterator i(Ready.begin()), ie(Ready.end());
+            i != ie; i++) {
+          if (!(*i)->isDead() && SCCMap[*i]->second &&
+              getMinDisplacement(*i) < getStackCacheSize()) {
+            Problems.push_back(std::make_pair(*i,
+                             makeGlobalEnsureFillingILP(SCCMap[*i]->first, *i)));
+          }
+        }
 
-          propagateGlobalEnsureFilling(SCCMap, tmp, predCount, WL);
+        MCGNodeUInt Solutions;
+        solveILPs(Problems, Solutions);
+
+        for(MCGNodes::const_reverse_iterator i(Ready.rbegin()),
+            ie(Ready.rend()); i != ie; i++) {
+          propagateGlobalEnsureFilling(SCCMap, *i, predCount, WL, Solutions);
+        }
       }
     }
 
@@ -2042,8 +2352,9 @@ namespace llvm {
             assert(i->getOperand(2).isImm());
 
             // If we encounter a free, then we are sure that all cache-blocks
-            // are actually dead.
-            deadAreaSize = (unsigned int)i->getOperand(2).getImm();
+            // are actually dead, unless it is predicated.
+            if (!TII.isPredicated(*i))
+              deadAreaSize = (unsigned int)i->getOperand(2).getImm();
             break;
 
           default:
@@ -2076,18 +2387,18 @@ namespace llvm {
     /// stack cache, e.g., accessed by loads and stores, upwards trough the CFG.
     void propagateDeadArea(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-dead-area", "SCA Dead Area");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
       for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
           i++) {
         if (!(*i)->isUnknown() && !(*i)->isDead()) {
-          MBBs WL;
           MBBUInt INs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, true);
 
-          // initialize work list (yeah, reverse-reverse post order would be
-          // optimal, but this works too).
+          // initialize work list, blocks are visited in post order.
           for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
               j++) {
             WL.insert(&*j);
@@ -2097,8 +2408,7 @@ namespace llvm {
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its predecessors on the work list.
@@ -2130,6 +2440,155 @@ namespace llvm {
       }
     }
 
+    /// propagateDeadFrame - Propagate the number of words at the top of the
+    /// stack cache frame that are certainly overwritten before they are read,
+    /// upwards through the CFG. The result is recorded for each call site.
+    void propagateDeadFrame(MBBs &WL, MBBUInt &INs, MachineBasicBlock *MBB,
+                            SIZEs &Dead)
+    {
+      // get the size of the dead frame area from the CFG successors (words)
+      unsigned int dead = INs[MBB];
+
+      // propagate within the basic block
+      for(MachineBasicBlock::reverse_instr_iterator i(MBB->instr_rbegin()),
+          ie(MBB->instr_rend()); i != ie; i++) {
+        unsigned int scale = 1;
+        switch(i->getOpcode()) {
+          case Patmos::SWS:
+            // a store to the word right below the dead area kills it as well
+            if (!TII.isPredicated(*i) && i->getOperand(2).getReg() == Patmos::R0
+                && i->getOperand(3).isImm() &&
+                i->getOperand(3).getImm() == (int64_t)dead) {
+              dead++;
+            }
+            break;
+
+          case Patmos::SHS:
+          case Patmos::SBS:
+            // partial stores do not kill any words
+            break;
+
+          case Patmos::LWS:
+            scale = 2;
+          case Patmos::LHS:
+          case Patmos::LHUS:
+            scale <<= 1;
+          case Patmos::LBS:
+          case Patmos::LBUS:
+            if (i->getOperand(3).getReg() == Patmos::R0 &&
+                i->getOperand(4).isImm()) {
+              dead = std::min(dead,
+                     (unsigned int)(i->getOperand(4).getImm() * scale / 4));
+            }
+            else dead = 0;
+            break;
+
+          case Patmos::SENSi:
+            // ensures do not read the frame
+            break;
+
+          case Patmos::SFREEi:
+            // everything is dead once the frame is freed, unless the free is
+            // predicated, e.g., by an early return
+            if (!TII.isPredicated(*i))
+              dead = i->getOperand(2).getImm();
+            break;
+
+          default:
+            if (i->isCall()) {
+              Dead[&*i] = dead;
+            }
+            else if (TII.isStackControl(&*i) || i->isInlineAsm() ||
+                     ((i->mayLoad() || i->mayStore()) &&
+                      TII.getMemType(*i) == PatmosII::MEM_S)) {
+              dead = 0;
+            }
+            break;
+        }
+      }
+
+      // propagate to CFG predecessors
+      for(MachineBasicBlock::pred_iterator i(MBB->pred_begin()),
+          ie(MBB->pred_end()); i != ie; i++) {
+        if (INs[*i] > dead) {
+          INs[*i] = dead;
+          WL.insert(*i);
+        }
+      }
+    }
+
+    /// insertEarlyFrees - Free the dead data at the top of the stack cache
+    /// frame before calls and reserve the space again before the ensure
+    /// following the call. The callee then finds more free space in the stack
+    /// cache and spills less of the caller's data, dead data is never spilled
+    /// or filled.
+    void insertEarlyFrees(const MCallGraph &G)
+    {
+      PatmosPhaseScope T("sca-early-frees", "SCA Early Frees");
+      const MCGNodes &nodes(G.getNodes());
+      unsigned int blockWords = getStackCacheBlockSize() / 4;
+
+      // visit all functions
+      for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
+          i++) {
+        if ((*i)->isUnknown() || (*i)->isDead() || (*i)->getSites().empty())
+          continue;
+
+        unsigned int frame = getBytesReserved(*i) / 4;
+        if (frame == 0)
+          continue;
+
+        MachineFunction *MF = (*i)->getMF();
+        MBBUInt INs;
+        MBBs WL(*MF, true);
+
+        // initialize work list, assuming the entire frame to be dead.
+        for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
+            j++) {
+          WL.insert(&*j);
+          INs[&*j] = frame;
+        }
+
+        // process until the work list becomes empty
+        SIZEs Dead;
+        while (!WL.empty()) {
+          MachineBasicBlock *MBB = WL.pop();
+          propagateDeadFrame(WL, INs, MBB, Dead);
+        }
+
+        // rewrite the call sites
+        for(SIZEs::const_iterator j(Dead.begin()), je(Dead.end());
+            j != je; j++) {
+          MachineInstr *MI = j->first;
+          MachineBasicBlock *MBB = MI->getParent();
+          MachineBasicBlock::instr_iterator next(std::next(MI->getIterator()));
+
+          // free whole blocks only
+          unsigned int words = std::min(j->second, frame);
+          words -= words % blockWords;
+
+          // the ensure has to follow the call immediately, otherwise the code
+          // in between might access the frame.
+          if (words == 0 || MI->isBundled() || TII.isPredicated(*MI) ||
+              next == MBB->instr_end() || next->getOpcode() != Patmos::SENSi ||
+              next->isBundled() || TII.isPredicated(*next))
+            continue;
+
+          DebugLoc DL = MI->getDebugLoc();
+          AddDefaultPred(BuildMI(*MBB, MI, DL, TII.get(Patmos::SFREEi)))
+            .addImm(words);
+          AddDefaultPred(BuildMI(*MBB, next, DL, TII.get(Patmos::SRESi)))
+            .addImm(words);
+
+          LLVM_DEBUG(dbgs() << "SCA: free " << words << " dead words before "
+                            << *MI);
+
+          EarlyFreeSites++;
+          EarlyFreedBytes += words * 4;
+        }
+      }
+    }
+
     /// analyzeEnsures - Does what it says. SENS instructions can be removed if
     /// the preceding calls plus the current frame on the stack cache fit into
     /// the stack cache.
@@ -2159,13 +2618,13 @@ namespace llvm {
 
           // does the content of the ensure and all the children in the call
           // graph fit into the stack cache?
-          bool remove = (ensure + childDisplacement) <= STC.getStackCacheSize();
+          bool remove = (ensure + childDisplacement) <= getStackCacheSize();
 
           if (ensure == 0) assert(remove);
 
           // if all fits, the SENS can be removed.
           unsigned int filling = remove ? 0u : ensure + childDisplacement -
-                                               STC.getStackCacheSize();
+                                               getStackCacheSize();
           ENSs[&*i] = filling;
 
           // store worst-case filling at call sites and basic block entry
@@ -2175,7 +2634,7 @@ namespace llvm {
 
           if (!remove && !TII.isPredicated(*i)) {
             childDisplacement = std::min(childDisplacement,
-                                         STC.getStackCacheSize() - ensure);
+                                         getStackCacheSize() - ensure);
           }
         }
       }
@@ -2199,6 +2658,7 @@ namespace llvm {
     /// the stack cache.
     void analyzeEnsures(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-ensures", "SCA Ensure Analysis");
       const MCGNodes &nodes(G.getNodes());
 
       // we store analysis results in a pseudo pass
@@ -2210,13 +2670,12 @@ namespace llvm {
       for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
           i++) {
         if (!(*i)->isUnknown() && !(*i)->isDead()) {
-          MBBs WL;
           SIZEs ENSs;
           MBBUInt INs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, false);
 
-          // initialize work list (yeah, reverse post order would be optimal,
-          // but this works too).
+          // initialize work list, blocks are visited in reverse post order.
           for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
               j++) {
             WL.insert(&*j);
@@ -2225,15 +2684,15 @@ namespace llvm {
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its successors on the work list.
             analyzeEnsures(WL, INs, ENSs, *i, MBB);
           }
 
-          // actually remove ensure instructions (if requested)
+          // export the results and collect non-filling ensure instructions
+          std::vector<MachineInstr*> removed;
           for(SIZEs::const_iterator i(ENSs.begin()), ie(ENSs.end()); i != ie;
               i++) {
             unsigned int ensure = i->first->getOperand(2).getImm() * 4;
@@ -2250,8 +2709,9 @@ namespace llvm {
 
             if (i->second == 0) {
               if (EnableEnsureOpt) {
-                i->first->getParent()->erase(i->first);
+                removed.push_back(i->first);
                 RemovedSENS++;
+                continue;
               } else {
                 NonFillingSENS++;
               }
@@ -2263,10 +2723,17 @@ namespace llvm {
             }
 
             // update the analysis info pseudo pass (convert bytes to blocks)
-            assert(i->second % STC.getStackCacheBlockSize() == 0);
+            assert(i->second % getStackCacheBlockSize() == 0);
             info->Ensures[i->first] = i->second; // export in bytes
           }
 
+          // actually remove ensure instructions (if requested), the code may
+          // be bundled already -- keep the rest of the bundle
+          for(std::vector<MachineInstr*>::iterator j(removed.begin()),
+              je(removed.end()); j != je; j++) {
+            (*j)->eraseFromBundle();
+          }
+
 #ifdef PATMOS_TRACE_SENS_REMOVAL
           LLVM_DEBUG(
             dbgs() << "########################### "
@@ -2298,98 +2765,94 @@ namespace llvm {
     }
 
     /// ilp_name - make a name for a call site suitable for the LP file.
+    /// The name is derived from the caller and the position of the site in
+    /// it, such that unchanged code yields the same ILP in every compiler run.
     static std::string ilp_name(ilp_prefix Prefix, const MCGSite *S)
     {
       std::string tmps;
       raw_string_ostream tmp(tmps);
-      tmp << Prefix << "S" << (void*)S;
+      tmp << Prefix << "S";
+
+      const MCGNode *Caller = S->getCaller();
+      const MCGSites &Sites(Caller->getSites());
+      MCGSites::const_iterator pos(std::find(Sites.begin(), Sites.end(), S));
+      if (Caller->isUnknown() || pos == Sites.end()) {
+        tmp << (void*)S;
+      }
+      else {
+        tmp << Caller->getMF()->getFunction().getName() << "."
+            << (pos - Sites.begin());
+      }
       return tmp.str();
     }
 
-    /// solve_ilp - solve the ILP problem.
-    static unsigned int solve_ilp(const char *LPname, bool Maximize)
-    {
-      unsigned int result = Maximize ? std::numeric_limits<unsigned int>::max():
-                                       std::numeric_limits<unsigned int>::min();
-
-      std::vector<StringRef> args;
-      args.push_back(Solve_ilp);
-      args.push_back(LPname);
-      args.push_back("\0");
-
-      std::string ErrMsg;
-      auto progName = sys::findProgramByName(Solve_ilp);
-    if (progName && sys::ExecuteAndWait(StringRef(*progName),
-                              llvm::ArrayRef<StringRef>(args),
-                              llvm::None,
-                              llvm::ArrayRef<Optional<StringRef>>(),
-                              0,0,&ErrMsg)) {
-        StringRef reason = "calling ILP solver (" + Solve_ilp + "): " + ErrMsg;
-        report_fatal_error(reason);
+    /// ilp_order - order call sites by their names in the LP file, such that
+    /// the LP is constructed deterministically.
+    struct ilp_order
+    {
+      bool operator()(const MCGSite *A, const MCGSite *B) const
+      {
+        return ilp_name(T, A) < ilp_name(T, B);
       }
-      else {
-        // read solution
-        // construct name of solution
-        std::string SOLname(LPname);
-        SOLname += ".sol";
+    };
 
-        //SmallString<1024> SOLname(LPname);
-        //sys::path::replace_extension(SOLname, ".sol");
+    /// solve_ilp - solve the ILP problem.
+    unsigned int solve_ilp(const std::string &LP) const
+    {
+      double result;
 
-        if (!sys::fs::exists(SOLname))
-          report_fatal_error("Failed to read ILP solution");
+      // don't go ahead when solving has failed
+      if (!Solver->solve(LP, result))
+        report_fatal_error("unbounded/infeasible ILP");
 
-        std::ifstream IS(SOLname.c_str());
-        assert(IS.good());
+      ILPs++;
 
-        // read the result value
-        double tmp;
-        IS >> tmp;
-        result = tmp;
+      return std::max(0.0, std::round(result));
+    }
 
-        // don't go ahead when solving has failed
-        if (tmp == -1.)
-          assert(0 && "unbounded/infeasible ILP");
+    /// solveILPs - Solve the ILPs of several call graph nodes and store their
+    /// results in Solutions. The ILPs are independent of each other and are
+    /// solved concurrently on the thread pool, if available.
+    void solveILPs(const MCGNodeILPs &Problems, MCGNodeUInt &Solutions)
+    {
+      std::vector<unsigned int> Results(Problems.size());
 
-        sys::fs::remove(SOLname);
+      if (Pool && Problems.size() > 1) {
+        for(unsigned i = 0, e = Problems.size(); i != e; i++) {
+          Pool->async([this, &Problems, &Results, i]() {
+            Results[i] = solve_ilp(Problems[i].second);
+          });
+        }
+        Pool->wait();
+      }
+      else {
+        for(unsigned i = 0, e = Problems.size(); i != e; i++) {
+          Results[i] = solve_ilp(Problems[i].second);
+        }
       }
 
-      ILPs++;
-
-      return result;
+      for(unsigned i = 0, e = Problems.size(); i != e; i++) {
+        Solutions[Problems[i].first] = Results[i];
+      }
     }
 
-    /// computeMinMaxDisplacementILP - Construct an ILP modeling the
-    /// displacement of an SCC within the call graph, write it to an LP file,
-    /// and solve it.
-    unsigned int computeMinMaxDisplacementILP(const MCGNodes &SCC,
-                                              const MCGNode *N, bool Maximize)
+    /// makeMinMaxDisplacementILP - Construct an ILP modeling the
+    /// displacement of an SCC within the call graph.
+    /// \see solveILPs
+    std::string makeMinMaxDisplacementILP(const MCGNodes &SCC,
+                                          const MCGNode *N, bool Maximize)
     {
       assert(std::find(SCC.begin(), SCC.end(), N) != SCC.end());
 
       // get user-supplied bounds to solve the ILP.
-      const SCCInfo &BInfo(BI.getInfo(SCC));
-
-      // open LP file.
-      SmallString<1024> LPname;
-      std::error_code err = sys::fs::createUniqueDirectory("stack", LPname);
-      if (err) {
-        errs() << "Error creating temp .lp file: " << err.message() << "\n";
-        return std::numeric_limits<unsigned int>::max();
-      }
+      const SCCInfo BInfo(BI.getInfo(SCC));
 
-      sys::path::append(LPname, "scc.lp");
-
-      std::error_code ErrCode;
-      raw_fd_ostream OS(LPname.c_str(), ErrCode);
-      if (!ErrCode) {
-        errs() << "Error: Failed to open file '" << LPname.str()
-               << "' for writing!\n";
-        return std::numeric_limits<unsigned int>::max();
-      }
+      // construct the LP in memory.
+      std::string LP;
+      raw_string_ostream OS(LP);
 
       // find entry and exit call sites
-      typedef std::set<MCGSite*> MCGSiteSet;
+      typedef std::set<MCGSite*, ilp_order> MCGSiteSet;
       MCGSiteSet entries, exits;
       for(MCGNodes::const_iterator n(SCC.begin()), ne(SCC.end()); n != ne;
           n++) {
@@ -2605,20 +3068,9 @@ namespace llvm {
 
       OS << "End\n";
 
-      OS.close();
-
-      // solve the ILP
-      unsigned int result = solve_ilp(LPname.c_str(), Maximize);
-
-#ifdef PATMOS_TRACE_CG_DISPLACMENT_ILP
-      dbgs() << "ILP: " << *N << ": " << result << "\n";
-#endif // PATMOS_TRACE_CG_DISPLACMENT_ILP
-
-      // remove LP file
-      // TODO do we need to remove the temp dir??
-      sys::fs::remove(LPname.str());
+      OS.flush();
 
-      return result;
+      return LP;
     }
 
     /// checkCallFreePaths - Check whether functions have call free paths.
@@ -2654,6 +3106,7 @@ namespace llvm {
     /// from it to a sink do not contain a call instruction.
     void checkCallFreePaths(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-call-free-paths", "SCA Call-Free Paths");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
@@ -2664,9 +3117,9 @@ namespace llvm {
 
         // ignore unknown functions here
         if (!(*i)->isUnknown() && !(*i)->isDead()) {
-          MBBs WL;
           MBBBool OUTs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, true);
 
           // initialize work list -- initially we assume
           for(MachineFunction::iterator i(MF->begin()), ie(MF->end()); i != ie;
@@ -2681,8 +3134,7 @@ namespace llvm {
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its predecessors on the work list.
@@ -2731,7 +3183,7 @@ namespace llvm {
           if (!TII.isPredicated(*i)) {
             // get the worst-case occupancy after the call
             unsigned int worstCallOccupancy =
-                STC.getStackCacheSize() - getMinDisplacement(site->getCallee());
+                getStackCacheSize() - getMinDisplacement(site->getCallee());
 
             // update the worst-case occupancy
             worstOccupancy = std::min(worstOccupancy, worstCallOccupancy);
@@ -2760,7 +3212,7 @@ namespace llvm {
                            MachineBasicBlock *MBB)
     {
       unsigned int worstSpillDirty = INs[MBB];
-      unsigned int SCSize = STC.getStackCacheSize();
+      unsigned int SCSize = getStackCacheSize();
       unsigned int Reserved = getBytesReserved(Node);
 
       /// keep track of coherent data for the current basic block assuming a
@@ -2887,6 +3339,7 @@ namespace llvm {
     /// beginning of each basic block.
     void computeWorstCaseSavingOccupancy(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-saving-occupancy", "SCA Worst-Case Saving");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
@@ -2961,6 +3414,7 @@ namespace llvm {
     /// at the beginning of each basic block.
     void computeWorstCaseRestoringOccupancy(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-restoring-occupancy", "SCA Worst-Case Restoring");
 
       const MCGNodes &nodes(G.getNodes());
 
@@ -2998,6 +3452,8 @@ namespace llvm {
     /// a path to get the worst-case occupancy.
     void propagateWorstCaseOccupancyAtSite(const MCallGraph &G)
     {
+      PatmosPhaseScope T("sca-occupancy-at-site",
+                         "SCA Occupancy at Call Sites");
       const MCGNodes &nodes(G.getNodes());
 
       // visit all functions
@@ -3008,24 +3464,23 @@ namespace llvm {
           // globally, are simply propagated onward through UNKNOWN nodes
           for(MCGSites::const_iterator j((*i)->getSites().begin()),
               je((*i)->getSites().end()); j != je; j++) {
-            WorstCaseSiteOccupancy[*j] = STC.getStackCacheSize();
-            WorstCaseSpillDirty[*j] = STC.getStackCacheSize();
+            WorstCaseSiteOccupancy[*j] = getStackCacheSize();
+            WorstCaseSpillDirty[*j] = getStackCacheSize();
           }
         }
         else if (!(*i)->isDead()) {
-          MBBs WL;
           MBBUInt INs;
           MachineFunction *MF = (*i)->getMF();
+          MBBs WL(*MF, false);
 
           // initialize work list.
-          INs[&*MF->begin()] = STC.getStackCacheSize();
+          INs[&*MF->begin()] = getStackCacheSize();
           WL.insert(&*MF->begin());
 
           // process until the work list becomes empty
           while (!WL.empty()) {
             // get some basic block
-            MachineBasicBlock *MBB = *WL.begin();
-            WL.erase(WL.begin());
+            MachineBasicBlock *MBB = WL.pop();
 
             // update the basic block's information, potentially putting any of
             // its successors on the work list.
@@ -3053,12 +3508,12 @@ namespace llvm {
         if ((*i)->isDead() || (*i)->isUnknown())
           continue;
 
-        MBBs WL;
         MBBUInt INs;
         MachineFunction *MF = (*i)->getMF();
+        MBBs WL(*MF, false);
 
         // initialize work list.
-        INs[&*MF->begin()] = STC.getStackCacheSize();
+        INs[&*MF->begin()] = getStackCacheSize();
         WL.insert(&*MF->begin());
 
 #ifdef PATMOS_TRACE_WORST_SITE_OCCUPANCY
@@ -3071,8 +3526,7 @@ namespace llvm {
         // process until the work list becomes empty
         while (!WL.empty()) {
           // get some basic block
-          MachineBasicBlock *MBB = *WL.begin();
-          WL.erase(WL.begin());
+          MachineBasicBlock *MBB = WL.pop();
 
           // update the basic block's information, potentially putting any of
           // its successors on the work list.
@@ -3091,7 +3545,7 @@ namespace llvm {
 
     void dumpOccupancy() const {
       MCGSiteUIntSort Sorted(WorstCaseSiteOccupancy.begin(), WorstCaseSiteOccupancy.end());
-      for(MCGSiteUInt::const_iterator j(Sorted.begin()),
+      for(MCGSiteUIntSort::const_iterator j(Sorted.begin()),
           je(Sorted.end()); j != je; j++) {
         unsigned int Displacement = getMinDisplacement(j->first->getCallee());
         std::stringstream SpillDirty; // worst-case lazy-pointer saving
@@ -3225,33 +3679,52 @@ namespace llvm {
     ///
     /// We only need to propagate the minimum of the two.
     ///
+    /// Contexts of a call graph node with the same occupancy after the
+    /// function's reserve have the same children. Only the first of them is
+    /// expanded, the others share its children, which are found in Expanded.
+    ///
     /// \see propagateWorstCaseOccupancyAtSite
-    void propagateMaxOccupancy(SCANode *Node, SCANodeSet &WL)
+    void propagateMaxOccupancy(SCANode *Node, SCANodeSet &WL,
+                               MCGSCANodeMap &Expanded)
     {
       // get the call graph node and occupancy
       MCGNode *mcgNode = Node->getMCGNode();
 
       // get the stack occupancy of the current calling context and add the
       // space allocated by the current function to it.
-      unsigned int nodeOccupancy = std::min(STC.getStackCacheSize(),
+      unsigned int nodeOccupancy = std::min(getStackCacheSize(),
                               Node->getOccupancy() + getBytesReserved(mcgNode));
 
-      unsigned int lpNodeOccupancy = std::min(STC.getStackCacheSize(),
+      unsigned int lpNodeOccupancy = std::min(getStackCacheSize(),
                      Node->getEffectiveOccupancy() + getBytesReserved(mcgNode));
 
       // keep track of the node's minimum/maximum occupancy after the
       // function's sres
       updateMinMaxOccupancy(Node->getMCGNode(), nodeOccupancy, lpNodeOccupancy);
 
+      // share the children of an equivalent context expanded before
+      CostPair expandedOccupancy(nodeOccupancy, lpNodeOccupancy);
+      std::pair<MCGSCANodeMap::iterator, bool> expanded(Expanded.insert(
+          std::make_pair(std::make_pair(mcgNode, expandedOccupancy), Node)));
+      if (!expanded.second) {
+        const SCAEdgeSet &children(expanded.first->second->getChildren());
+        for(SCAEdgeSet::const_iterator i(children.begin()), ie(children.end());
+            i != ie; i++) {
+          SCAGraph.link(i->getCallee(), Node, i->getSite());
+        }
+        SharedSCAContexts++;
+        return;
+      }
+
       // propagate to call sites
       for(MCGSites::const_iterator j(mcgNode->getSites().begin()),
           je(mcgNode->getSites().end()); j != je; j++) {
         // get the site's stack worst-case occupancy
         MCGSite *site = *j;
         MCGNode *callee = site->getCallee();
-        unsigned int worstSiteOccupancy = STC.getStackCacheSize();
+        unsigned int worstSiteOccupancy = getStackCacheSize();
         if (WorstCaseSiteOccupancy.count(site))
-          WorstCaseSiteOccupancy[site];
+          worstSiteOccupancy = WorstCaseSiteOccupancy[site];
 
         // compute the occupancy and the call site
         unsigned int siteOccupancy = std::min(nodeOccupancy,
@@ -3263,12 +3736,12 @@ namespace llvm {
 
         // compute the spill caused by the child's reserve
         unsigned int spillCost =
-            childOccupancy <= STC.getStackCacheSize() ? 0 :
-                                  childOccupancy - STC.getStackCacheSize();
+            childOccupancy <= getStackCacheSize() ? 0 :
+                                  childOccupancy - getStackCacheSize();
 
         // compute again only considering dirty spill region below lazy pointer
         //assert(WorstCaseSpillDirty.count(site));
-        unsigned int lpWorstSiteOccupancy = STC.getStackCacheSize();
+        unsigned int lpWorstSiteOccupancy = getStackCacheSize();
         if (WorstCaseSpillDirty.count(site))
           lpWorstSiteOccupancy = WorstCaseSpillDirty[site];
 
@@ -3281,8 +3754,8 @@ namespace llvm {
                                               lpSiteOccupancy;
 
         unsigned int lpSpillCost =
-            lpChildOccupancy <= STC.getStackCacheSize() ? 0 :
-                                    lpChildOccupancy - STC.getStackCacheSize();
+            lpChildOccupancy <= getStackCacheSize() ? 0 :
+                                    lpChildOccupancy - getStackCacheSize();
 
         // occupancy and cost pair
         CostPair OccP(siteOccupancy, lpSiteOccupancy);
@@ -3298,7 +3771,7 @@ namespace llvm {
                                            IsCallFree[callee], calleeSCANode);
 
         // make a link to the parent context
-        calleeSCANode->addParent(Node, site);
+        SCAGraph.link(calleeSCANode, Node, site);
 
         // if the node did not exist before, append it to the work list
         if (isNewNode) {
@@ -3307,41 +3780,10 @@ namespace llvm {
       }
     }
 
-    /// propagateMaxOccupancy - propagate the maximum stack occupancy on the
-    /// call graph and analyze the worst-case spilling of reserves.
-    ///
-    /// The main idea is to associate each call graph node with a set of calling
-    /// contexts, which are in turn associated with a maximum stack occupancy.
-    /// The occupancy is then propagated onwards to children in the call graph
-    /// through calls sites, considering the worst-case occupancy computed
-    /// before.
-    ///
-    /// We know that there are only two options:
-    /// (1) either we propagate the stack occupancy of the current context,
-    ///     adding the stack space reserved by the current function or
-    /// (2) we propagate the worst-case occupancy of the site onward.
-    ///
-    /// We only need to propagate the minimum of the two.
-    ///
-    /// \see propagateWorstCaseOccupancyAtSite
-    void propagateMaxOccupancy(const MCallGraph &G, MCGNode *main)
+    /// summarizeSCAGraph - Prune the SCA graph and find the maximum spill
+    /// costs of the functions over their calling contexts.
+    void summarizeSCAGraph(MCGNodeUInt &Spilling)
     {
-      // initialize the work list and calling context information
-      SCANodeSet WL;
-      WL.insert(SCAGraph.makeRoot(main, getMaxDisplacement(main),
-                                  IsCallFree[main]));
-
-      while (!WL.empty()) {
-        // pop current call graph node
-        SCANode *Node =  *WL.begin();
-        WL.erase(Node);
-
-        // propagate to callees through call sites
-        if (!Node->getMCGNode()->isDead()) {
-          propagateMaxOccupancy(Node, WL);
-        }
-      }
-
       // mark cost-relevant nodes; nodes not relevant for analysis remain hidden
       markSCAGraphVisible();
 
@@ -3371,7 +3813,6 @@ namespace llvm {
 #endif // PATMOS_TRACE_DETAILED_RESULTS
 
       // keep statistics of the pruned SCA graph size.
-      MCGNodeUInt Spilling;
       for(MCGSCANodeMap::const_iterator i(nodes.begin()), ie(nodes.end());
           i != ie; i++) {
         if (i->second->isVisible()) {
@@ -3381,6 +3822,139 @@ namespace llvm {
         }
       }
 
+    }
+
+    /// getWorstSiteOccupancy - The worst-case occupancy at a call site, or
+    /// a full stack cache if it is not known.
+    unsigned int getWorstSiteOccupancy(MCGSite *site) const
+    {
+      MCGSiteUInt::const_iterator i(WorstCaseSiteOccupancy.find(site));
+      return i != WorstCaseSiteOccupancy.end() ? i->second :
+                                                 getStackCacheSize();
+    }
+
+    /// propagateContextInsensitiveOccupancy - Bound the occupancy and the
+    /// spill costs of the functions without calling contexts, when the SCA
+    /// graph is too large.
+    ///
+    /// Every context of a function is entered through one of its call sites,
+    /// with at most the worst-case occupancy of the site. The maximum over
+    /// the sites is what the SCA graph would propagate for the context with
+    /// a full stack cache, so it bounds all contexts. Call sites of UNKNOWN
+    /// nodes stand for the indirect calls reaching them.
+    void propagateContextInsensitiveOccupancy(const MCallGraph &G,
+                                              MCGNode *main,
+                                              MCGNodeUInt &Spilling)
+    {
+      unsigned int S = getStackCacheSize();
+      const MCGNodes &nodes(G.getNodes());
+      for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
+          i++) {
+        MCGNode *N = *i;
+        if (N->isUnknown() || N->isDead())
+          continue;
+
+        // the occupancy after the function's reserve is at least its own
+        unsigned int k = getBytesReserved(N);
+        updateMinMaxOccupancy(N, std::min(S, k), std::min(S, k));
+
+        // the root does not spill, see makeRoot
+        if (N == main) {
+          unsigned int rootOccupancy = RootOccupied ?
+                                         PFL.getEffectiveStackCacheSize() : 0;
+          unsigned int occupancy = std::min(S, rootOccupancy + k);
+          updateMinMaxOccupancy(N, occupancy, occupancy);
+        }
+
+        std::vector<MCGSite*> sites;
+        for(MCGSites::const_iterator j(N->getCallingSites().begin()),
+            je(N->getCallingSites().end()); j != je; j++) {
+          MCGNode *caller = (*j)->getCaller();
+          if (!caller->isUnknown()) {
+            if (!caller->isDead())
+              sites.push_back(*j);
+            continue;
+          }
+
+          for(MCGSites::const_iterator l(caller->getCallingSites().begin()),
+              le(caller->getCallingSites().end()); l != le; l++) {
+            if (!(*l)->getCaller()->isDead())
+              sites.push_back(*l);
+          }
+        }
+
+        unsigned int spill = 0;
+        for(std::vector<MCGSite*>::const_iterator j(sites.begin()),
+            je(sites.end()); j != je; j++) {
+          unsigned int siteOccupancy = std::min(S, getWorstSiteOccupancy(*j));
+          unsigned int occupancy = std::min(S, siteOccupancy + k);
+          updateMinMaxOccupancy(N, occupancy, occupancy);
+          spill = std::max(spill, safeUIntDiff(siteOccupancy + k, S));
+        }
+
+        Spilling[N] = spill;
+        ContextInsensitiveFunctions++;
+        LLVM_DEBUG(dbgs() << "SCA: context-insensitive spill costs of "
+                          << N->getMF()->getName() << ": " << spill << "\n");
+      }
+    }
+
+    /// propagateMaxOccupancy - propagate the maximum stack occupancy on the
+    /// call graph and analyze the worst-case spilling of reserves.
+    ///
+    /// The main idea is to associate each call graph node with a set of calling
+    /// contexts, which are in turn associated with a maximum stack occupancy.
+    /// The occupancy is then propagated onwards to children in the call graph
+    /// through calls sites, considering the worst-case occupancy computed
+    /// before.
+    ///
+    /// We know that there are only two options:
+    /// (1) either we propagate the stack occupancy of the current context,
+    ///     adding the stack space reserved by the current function or
+    /// (2) we propagate the worst-case occupancy of the site onward.
+    ///
+    /// We only need to propagate the minimum of the two.
+    ///
+    /// \see propagateWorstCaseOccupancyAtSite
+    void propagateMaxOccupancy(const MCallGraph &G, MCGNode *main)
+    {
+      PatmosPhaseScope T("sca-max-occupancy", "SCA Maximum Occupancy");
+      // initialize the work list and calling context information
+      SCANodeSet WL;
+      MCGSCANodeMap Expanded;
+      WL.insert(SCAGraph.makeRoot(main, getMaxDisplacement(main),
+                                  IsCallFree[main]));
+
+      uint64_t MaxMemory = (uint64_t)MaxSCAGraphMemory << 20;
+      while (!WL.empty()) {
+        // pop current call graph node
+        SCANode *Node =  *WL.begin();
+        WL.erase(Node);
+
+        // propagate to callees through call sites
+        if (!Node->getMCGNode()->isDead()) {
+          propagateMaxOccupancy(Node, WL, Expanded);
+        }
+
+        // give up the calling contexts when the graph gets too large
+        if (MaxMemory && SCAGraph.getMemoryEstimate() > MaxMemory) {
+          errs() << "Warning: The SCA graph exceeds " << MaxSCAGraphMemory
+                 << " MB, using context-insensitive spill costs.\n";
+          ContextInsensitive = true;
+          break;
+        }
+      }
+
+      MCGNodeUInt Spilling;
+      if (ContextInsensitive) {
+        WL.clear();
+        Expanded.clear();
+        SCAGraph.clear();
+        propagateContextInsensitiveOccupancy(G, main, Spilling);
+      }
+      else
+        summarizeSCAGraph(Spilling);
+
       PatmosStackCacheAnalysisInfo *info =
        &getAnalysis<PatmosStackCacheAnalysisInfo>();
 
@@ -3408,18 +3982,109 @@ namespace llvm {
               if (I->getOpcode() == Patmos::SRESi)
                 break;
             assert(I != MBB.instr_end());
-            assert(tmp % STC.getStackCacheBlockSize() == 0);
+            assert(tmp % getStackCacheBlockSize() == 0);
 
             // convert bytes back to blocks
             info->Reserves[&*I] = tmp; // export in bytes
           }
+
+          // the reserve of the stack cache region spills what does not fit
+          // on top of the frame, in any context
+          unsigned int region = getRegionBytesReserved(*i);
+          if (region != 0 && MaxOccupancy.count(*i)) {
+            unsigned int occupancy = std::min(getStackCacheSize(),
+                                              MaxOccupancy[*i]) + region;
+            unsigned int spill = occupancy <= getStackCacheSize() ? 0 :
+                                          occupancy - getStackCacheSize();
+            for (MachineBasicBlock &MBB : *(*i)->getMF())
+              for (MachineInstr &MI : MBB.instrs())
+                if (MI.getOpcode() == Patmos::SRESi &&
+                    !MI.getFlag(MachineInstr::FrameSetup))
+                  info->Reserves[&MI] = spill; // export in bytes
+          }
         }
       }
 
-      if (EnableViewSCAGraph)
+      if (EnableViewSCAGraph && !ContextInsensitive)
         ViewGraph(SCAGraph, "sca");
     }
 
+    /// getWorstCaseRestoring - The worst-case amount of data to restore when a
+    /// task preempted at the beginning of a basic block is reactivated,
+    /// including the fills of the function's and its callers' ensures.
+    unsigned int getWorstCaseRestoring(MCGNode *Node, MachineBasicBlock *MBB)
+    {
+      unsigned int localEnsure = safeUIntDiff(WorstCaseLocalEnsureFilling[MBB],
+                                              WorstCaseBlockRP[MBB]);
+      unsigned int costs = WorstCaseBlockRestoring[MBB] + localEnsure +
+                           WorstCaseGlobalEnsureFilling[Node];
+
+      // reserves that spill less after a preemption compensate the costs
+      return safeUIntDiff(costs, ReserveGain[MBB]);
+    }
+
+    /// exportPML - Write the analysis results to the file given by
+    /// -mpatmos-sca-serialize, i.e., the stack frame size of every function
+    /// and, if the preemption analysis ran, the worst-case costs of saving and
+    /// restoring the stack cache in a context switch at each basic block.
+    /// All sizes are in bytes.
+    void exportPML(const Module &M, const MCallGraph &G)
+    {
+      std::error_code err;
+      raw_fd_ostream OS(SCAPMLExport, err, sys::fs::OF_Text);
+      if (err) {
+        errs() << "Error: Failed to open stack cache analysis export '"
+               << SCAPMLExport << "': " << err.message() << "\n";
+        return;
+      }
+
+      OS << "---\n"
+         << "format: pml-0.1\n"
+         << "triple: " << M.getTargetTriple() << "\n"
+         << "stack-cache:\n";
+
+      const MCGNodes &nodes(G.getNodes());
+      for(MCGNodes::const_iterator i(nodes.begin()), ie(nodes.end()); i != ie;
+          i++) {
+        if ((*i)->isUnknown() || (*i)->isDead())
+          continue;
+
+        MachineFunction *MF = (*i)->getMF();
+        OS << "  - function: \"" << yaml::escape(MF->getName()) << "\"\n"
+           << "    reserved: " << getBytesReserved(*i) << "\n";
+        if (ContextInsensitive)
+          OS << "    context-sensitive: false\n";
+
+        if (!EnablePreemptionSCA)
+          continue;
+
+        // the cheapest and the most expensive point of the function
+        unsigned int maxSaving = 0, maxRestoring = 0;
+        unsigned int minCosts = std::numeric_limits<unsigned int>::max();
+        for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
+            j++) {
+          unsigned int saving = WorstCaseBlockSaving[&*j];
+          unsigned int restoring = getWorstCaseRestoring(*i, &*j);
+          maxSaving = std::max(maxSaving, saving);
+          maxRestoring = std::max(maxRestoring, restoring);
+          minCosts = std::min(minCosts, saving + restoring);
+        }
+
+        OS << "    max-saving: " << maxSaving << "\n"
+           << "    max-restoring: " << maxRestoring << "\n"
+           << "    min-context-switch: " << minCosts << "\n"
+           << "    blocks:\n";
+
+        for(MachineFunction::iterator j(MF->begin()), je(MF->end()); j != je;
+            j++) {
+          OS << "      - block: " << j->getNumber() << "\n"
+             << "        saving: " << WorstCaseBlockSaving[&*j] << "\n"
+             << "        restoring: " << getWorstCaseRestoring(*i, &*j) << "\n";
+        }
+      }
+      OS << "...\n";
+    }
+
     /// runOnModule - determine the state of the stack cache for each call site.
     bool runOnMachineModule(const Module &M) override
     {
@@ -3427,6 +4092,13 @@ namespace llvm {
       const MCallGraph &G(*PCGB.getCallGraph());
       MCGNode *main = G.getEntryNode();
 
+      // solve independent ILPs concurrently
+      ThreadPoolStrategy Threads = hardware_concurrency(ILPThreads);
+      if (Threads.compute_thread_count() > 1)
+        Pool.reset(new ThreadPool(Threads));
+
+      PatmosPhaseScope T("sca-dataflow", "Stack Cache Analysis Dataflow");
+
       // find out whether a call free path exists in each function
       checkCallFreePaths(G);
 
@@ -3469,6 +4141,16 @@ namespace llvm {
         computeWorstCaseRestoringOccupancy(G);
       }
 
+      if (!SCAPMLExport.empty())
+        exportPML(M, G);
+
+      // free dead data early before calls, this changes the code and thus
+      // has to run last.
+      if (EnableEarlyFree)
+        insertEarlyFrees(G);
+
+      Pool.reset();
+
       return false;
     }
 
@@ -3647,7 +4329,7 @@ namespace llvm {
       return "scagraph";
     }
 
-    static bool isNodeHidden(const SCANode *N, const SpillCostAnalysisGraph G)
+    static bool isNodeHidden(const SCANode *N, const SpillCostAnalysisGraph &G)
     {
       return !N->isVisible();
     }
@@ -18,6 +18,7 @@
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/ADT/StringExtras.h"
+#include <algorithm>
 #include <math.h>
 
 using namespace llvm;
@@ -38,13 +39,63 @@ static cl::opt<unsigned> StackCacheBlockSize("mpatmos-stack-cache-block-size",
 /// i.e., 1K words).
 static cl::opt<unsigned> StackCacheSize("mpatmos-stack-cache-size",
                            cl::init(2048),
-                           cl::desc("Total size of the stack cache in bytes."));
+                           cl::desc("Total size of the stack cache in bytes "
+                                    "(default: from the processor)."));
+
+/// DataCacheSize - Total size of the data cache in bytes.
+static cl::opt<unsigned> DataCacheSize("mpatmos-data-cache-size",
+                     cl::init(2048),
+                     cl::desc("Total size of the data cache in bytes "
+                              "(default: 2048)."));
+
+/// DataCacheWays - Associativity of the data cache.
+static cl::opt<unsigned> DataCacheWays("mpatmos-data-cache-ways",
+                     cl::init(1),
+                     cl::desc("Number of ways of the data cache, with LRU "
+                              "replacement (default: 1, direct-mapped)."));
+
+/// TDMPeriod - Period of the TDM arbiter of the main memory in cycles.
+static cl::opt<unsigned> TDMPeriod("mpatmos-tdm-period",
+                     cl::init(0),
+                     cl::desc("Period of the TDM arbiter of the main memory "
+                              "in cycles, 0 for a single core (default: from "
+                              "the processor)."));
 
 /// MethodCacheSize - Total size of the method cache in bytes.
 static cl::opt<unsigned> MethodCacheSize("mpatmos-method-cache-size",
                      cl::init(4096),
                      cl::desc("Total size of the instruction cache in bytes "
-                              "(default 4096)"));
+                              "(default: from the processor, 4096 for "
+                              "generic)"));
+
+/// MaxSubfunctionSize - Maximum size of a method cache region.
+static cl::opt<int> MaxSubfunctionSize(
+    "mpatmos-max-subfunction-size",
+    cl::init(1024),
+    cl::desc("Maximum size of subfunctions after function splitting, defaults "
+             "to the method cache size if set to 0. (default: 1024)"));
+
+/// MethodCacheEntries - Number of blocks of the method cache.
+static cl::opt<unsigned> MethodCacheEntries("mpatmos-method-cache-entries",
+                     cl::init(16),
+                     cl::desc("Number of blocks of the method cache, i.e., "
+                              "the maximum number of cached regions "
+                              "(default: from the processor, 16 for "
+                              "generic)"));
+
+/// MethodCachePolicy - Replacement policy of the method cache.
+static cl::opt<PatmosSubtarget::MethodCacheReplacement> MethodCachePolicy(
+                     "mpatmos-method-cache-replacement",
+                     cl::init(PatmosSubtarget::MCR_FIFO),
+                     cl::desc("Replacement policy of the method cache "
+                              "(default: from the processor, fifo for "
+                              "generic)"),
+                     cl::values(
+                         clEnumValN(PatmosSubtarget::MCR_FIFO, "fifo",
+                                    "Replace the oldest region"),
+                         clEnumValN(PatmosSubtarget::MCR_LRU, "lru",
+                                    "Replace the least recently used region")
+                         ));
 
 static cl::opt<unsigned> MinSubfunctionAlign("mpatmos-subfunction-align",
                    cl::init(16),
@@ -60,7 +111,8 @@ static cl::opt<bool> BranchInsideCFLDelaySlots("mpatmos-nested-branches",
 
 static cl::opt<bool> DisableVLIW("mpatmos-disable-vliw",
 	             cl::init(true),
-		     cl::desc("Schedule instructions only in first slot."));
+		     cl::desc("Schedule instructions only in first slot "
+                              "(default: unless the processor is dual-issue)."));
 
 static cl::opt<bool> DisableMIPreRA("mpatmos-disable-pre-ra-misched",
                      cl::init(true),
@@ -103,9 +155,29 @@ PatmosSubtarget::PatmosSubtarget(const Triple &TT,
   auto CPUName = CPU;
   if (CPUName.empty()) CPUName = "generic";
 
+  // The parsed features only raise the values, start from zero such that the
+  // values of the processor apply
+  HasFPU = false;
+  HasMethodCache = false;
+  HasDualIssue = false;
+  HasMethodCacheLRU = false;
+  StackCacheSizeDef = 0;
+  MethodCacheSizeDef = 0;
+  MethodCacheEntriesDef = 0;
+  MemoryBurstSizeDef = 0;
+  MemoryBurstCyclesDef = 0;
+  TDMPeriodDef = 0;
+
   // Parse features string.
   ParseSubtargetFeatures(CPUName, CPUName, FS);
 
+  // the generic values, for unknown processors
+  if (!StackCacheSizeDef) StackCacheSizeDef = 2048;
+  if (!MethodCacheSizeDef) MethodCacheSizeDef = 4096;
+  if (!MethodCacheEntriesDef) MethodCacheEntriesDef = 16;
+  if (!MemoryBurstSizeDef) MemoryBurstSizeDef = 16;
+  if (!MemoryBurstCyclesDef) MemoryBurstCyclesDef = 21;
+
   InstrItins = getInstrItineraryForCPU(CPUName);
 }
 
@@ -114,7 +186,9 @@ bool PatmosSubtarget::enablePostRAScheduler() const {
 }
 
 bool PatmosSubtarget::enableBundling(CodeGenOpt::Level OptLevel) const {
-  return !DisableVLIW;
+  if (DisableVLIW.getNumOccurrences())
+    return !DisableVLIW;
+  return HasDualIssue;
 }
 
 bool PatmosSubtarget::hasPostRAScheduler(CodeGenOpt::Level OptLevel) const {
@@ -160,7 +234,9 @@ unsigned PatmosSubtarget::getDelaySlotCycles(const MachineInstr &MI) const {
            MI.getOpcode() == Patmos::BRCFRu ||
            MI.getOpcode() == Patmos::BRCFR ||
            MI.getOpcode() == Patmos::BRCFTu ||
-           MI.getOpcode() == Patmos::BRCFT)
+           MI.getOpcode() == Patmos::BRCFT ||
+           MI.getOpcode() == Patmos::BRCFTOu ||
+           MI.getOpcode() == Patmos::BRCFTO)
   {
     return getCFLDelaySlotCycles(false);
   }
@@ -193,15 +269,61 @@ Align PatmosSubtarget::getMinSubfunctionAlignment() const {
 }
 
 unsigned PatmosSubtarget::getStackCacheSize() const {
-  return StackCacheSize;
+  return StackCacheSize.getNumOccurrences() ? StackCacheSize
+                                            : StackCacheSizeDef;
 }
 
 unsigned PatmosSubtarget::getStackCacheBlockSize() const {
   return StackCacheBlockSize;
 }
 
+unsigned PatmosSubtarget::getTDMPeriod() const {
+  return TDMPeriod.getNumOccurrences() ? TDMPeriod : TDMPeriodDef;
+}
+
+unsigned PatmosSubtarget::getDataCacheSize() const {
+  return std::max(DataCacheSize.getValue(), getDataCacheLineSize());
+}
+
+unsigned PatmosSubtarget::getDataCacheWays() const {
+  unsigned Lines = getDataCacheSize() / getDataCacheLineSize();
+  return std::max(1u, std::min(DataCacheWays.getValue(), Lines));
+}
+
+unsigned PatmosSubtarget::getDataCacheSets() const {
+  return getDataCacheSize() / getDataCacheLineSize() / getDataCacheWays();
+}
+
 unsigned PatmosSubtarget::getMethodCacheSize() const {
-  return MethodCacheSize;
+  return MethodCacheSize.getNumOccurrences() ? MethodCacheSize
+                                             : MethodCacheSizeDef;
+}
+
+unsigned PatmosSubtarget::getMaxSubfunctionSize() const {
+  if (MaxSubfunctionSize <= 0)
+    return getMethodCacheSize();
+  return std::min((unsigned)MaxSubfunctionSize, getMethodCacheSize());
+}
+
+unsigned PatmosSubtarget::getMethodCacheEntries() const {
+  unsigned Entries = MethodCacheEntries.getNumOccurrences()
+                       ? MethodCacheEntries : MethodCacheEntriesDef;
+  return std::max(1u, std::min(Entries, getMethodCacheSize()));
+}
+
+unsigned PatmosSubtarget::getMethodCacheBlockSize() const {
+  return getMethodCacheSize() / getMethodCacheEntries();
+}
+
+unsigned PatmosSubtarget::getMethodCacheBlocks(unsigned Size) const {
+  return (Size + getMethodCacheBlockSize() - 1) / getMethodCacheBlockSize();
+}
+
+PatmosSubtarget::MethodCacheReplacement
+PatmosSubtarget::getMethodCacheReplacement() const {
+  if (MethodCachePolicy.getNumOccurrences())
+    return MethodCachePolicy;
+  return HasMethodCacheLRU ? MCR_LRU : MCR_FIFO;
 }
 
 unsigned PatmosSubtarget::getAlignedStackFrameSize(unsigned frameSize) const {
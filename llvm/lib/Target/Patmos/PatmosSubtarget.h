@@ -33,6 +33,17 @@ class StringRef;
 class PatmosSubtarget final : public PatmosGenSubtargetInfo {
   bool HasFPU;
   bool HasMethodCache;
+  bool HasDualIssue;
+  bool HasMethodCacheLRU;
+
+  /// The cache geometry and memory timing of the processor, unless they are
+  /// given by options.
+  unsigned StackCacheSizeDef;
+  unsigned MethodCacheSizeDef;
+  unsigned MethodCacheEntriesDef;
+  unsigned MemoryBurstSizeDef;
+  unsigned MemoryBurstCyclesDef;
+  unsigned TDMPeriodDef;
 
   InstrItineraryData InstrItins;
   CodeGenOpt::Level OptLevel;
@@ -88,6 +99,8 @@ public:
 
   typedef enum { CFL_DELAYED, CFL_MIXED, CFL_NON_DELAYED } CFLType;
 
+  typedef enum { MCR_FIFO, MCR_LRU } MethodCacheReplacement;
+
   // Return the type of control-flow instructions to be generated
   CFLType getCFLType() const;
 
@@ -133,6 +146,47 @@ public:
 
   unsigned getMethodCacheSize() const;
 
+  /// Return the maximum size of a method cache region in bytes. It is the
+  /// size budget of the function splitter, the unroller and the inliner.
+  unsigned getMaxSubfunctionSize() const;
+
+  /// Return the number of blocks of the method cache, i.e., the maximum
+  /// number of regions it holds at once.
+  unsigned getMethodCacheEntries() const;
+
+  /// Return the size of a method cache block in bytes.
+  unsigned getMethodCacheBlockSize() const;
+
+  /// Return the number of method cache blocks a region of Size bytes
+  /// occupies.
+  unsigned getMethodCacheBlocks(unsigned Size) const;
+
+  /// Return the replacement policy of the method cache.
+  MethodCacheReplacement getMethodCacheReplacement() const;
+
+  /// Return the bytes transferred by a burst from or to the main memory.
+  unsigned getMemoryBurstSize() const { return MemoryBurstSizeDef; }
+
+  /// Return the worst-case cycles of a burst from or to the main memory.
+  unsigned getMemoryBurstCycles() const { return MemoryBurstCyclesDef; }
+
+  /// Return the period of the TDM arbiter of the main memory in cycles, in
+  /// which every core gets one slot, or zero for a single core.
+  unsigned getTDMPeriod() const;
+
+  /// Return the total size of the data cache in bytes.
+  unsigned getDataCacheSize() const;
+
+  /// Return the size of a data cache line in bytes, the cache fills a line
+  /// by a burst.
+  unsigned getDataCacheLineSize() const { return getMemoryBurstSize(); }
+
+  /// Return the number of ways of the data cache.
+  unsigned getDataCacheWays() const;
+
+  /// Return the number of sets of the data cache.
+  unsigned getDataCacheSets() const;
+
   /// Return the actual size of a stack cache frame in bytes.
   /// @param frameSize the required frame size in bytes.
   unsigned getAlignedStackFrameSize(unsigned frameSize) const;
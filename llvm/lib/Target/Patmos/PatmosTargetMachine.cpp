@@ -16,6 +16,7 @@
 #include "SinglePath/PatmosSinglePathInfo.h"
 #include "PatmosSchedStrategy.h"
 #include "PatmosStackCacheAnalysis.h"
+#include "PatmosTargetTransformInfo.h"
 #include "TargetInfo/PatmosTargetInfo.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/CodeGen/Passes.h"
@@ -37,11 +38,11 @@ extern "C" LLVM_EXTERNAL_VISIBILITY void LLVMInitializePatmosTarget() {
 }
 
 static ScheduleDAGInstrs *createPatmosVLIWMachineSched(MachineSchedContext *C) {
-  // TODO instead of the generic ScheduleDAGMI, we might want to use a different
-  // scheduler that allows for VLIW bundling or something, similar to the
-  // PatmosPostRAScheduler. Should still be split into a generic ScheduleDAG
-  // scheduler and a specialised PatmosSchedStrategy.
-  ScheduleDAGMI *PS = new ScheduleDAGMI(C, std::make_unique<PatmosVLIWSchedStrategy>(), false);
+  // The ScheduleDAGMILive tracks the register pressure for the strategy.
+  // Bundles are only formed by the PatmosPostRAScheduler.
+  ScheduleDAGMILive *PS =
+      new ScheduleDAGMILive(C, std::make_unique<PatmosVLIWSchedStrategy>(C));
+  PS->addMutation(createCopyConstrainDAGMutation(PS->TII, PS->TRI));
   return PS;
 }
 
@@ -58,11 +59,119 @@ namespace {
     cl::init(false),
     cl::desc("Enable the Patmos stack cache analysis."),
     cl::Hidden);
+  /// EnableFrequencyStackCacheLayout - Option to lay out the stack cache
+  /// frame by the block-frequency-weighted accesses of the frame objects.
+  static cl::opt<bool> EnableFrequencyStackCacheLayout(
+    "mpatmos-stack-cache-frequency-layout",
+    cl::init(false),
+    cl::desc("Assign the most frequently accessed frame objects to the stack "
+             "cache first and pack them densely."),
+    cl::Hidden);
+  /// EnableIPRA - Option to enable interprocedural register allocation.
+  static cl::opt<bool> EnableIPRA(
+    "mpatmos-ipra",
+    cl::init(false),
+    cl::desc("Use the registers clobbered by the callees of a module instead "
+             "of the calling convention at calls (interprocedural register "
+             "allocation)."),
+    cl::Hidden);
+  /// EnablePredSpillCoalescing - Option to spill several predicates with a
+  /// single store of S0.
+  static cl::opt<bool> EnablePredSpillCoalescing(
+    "mpatmos-coalesce-pred-spills",
+    cl::init(false),
+    cl::desc("Coalesce the spills of predicates that are spilled together "
+             "into a single spill of S0."),
+    cl::Hidden);
+  static cl::opt<std::string> FunctionOrderFile(
+    "mpatmos-function-order",
+    cl::init(""),
+    cl::desc("Write an order of the functions by call affinity to the given "
+             "file, to be passed to lld's --symbol-ordering-file."),
+    cl::Hidden);
+  static cl::opt<std::string> SerializeMachineCode(
+    "mpatmos-serialize",
+    cl::init(""),
+    cl::desc("Export the final machine code with its loop bounds, call "
+             "targets and stack cache results as PML to the given file."),
+    cl::value_desc("FILE"));
+  /// EnableWCETEstimate - Option to estimate the WCET of all functions.
+  static cl::opt<bool> EnableWCETEstimate(
+    "mpatmos-wcet-estimate",
+    cl::init(false),
+    cl::desc("Compute a quick, conservative WCET estimate of every function "
+             "and print it as comment."),
+    cl::Hidden);
+  static cl::opt<std::string> WCETEstimateReport(
+    "mpatmos-wcet-report",
+    cl::init(""),
+    cl::desc("Append the WCET estimates and code sizes of all functions to "
+             "the given file (implies -mpatmos-wcet-estimate)."),
+    cl::value_desc("FILE"),
+    cl::Hidden);
+  /// EnableOutliner - Option to outline repeated instruction sequences into
+  /// functions of their own.
+  static cl::opt<bool> EnableOutliner(
+    "mpatmos-outline",
+    cl::init(false),
+    cl::desc("Outline repeated instruction sequences outside of loops into "
+             "functions, if that makes the code smaller including the calls, "
+             "their delay slots and the method cache alignment."),
+    cl::Hidden);
+  /// EnablePipeliner - Option to software pipeline innermost loops.
+  static cl::opt<bool> EnablePipeliner(
+    "mpatmos-enable-pipeliner",
+    cl::init(false),
+    cl::desc("Enable the MachinePipeliner for single-block loops controlled "
+             "by an induction variable."),
+    cl::Hidden);
+  /// DisableEnsurePlacement - Option to keep the ensures of the full frame
+  /// after calls.
+  static cl::opt<bool> DisableEnsurePlacement(
+    "mpatmos-disable-ensure-placement",
+    cl::init(false),
+    cl::desc("Do not shrink, sink and merge the stack cache ensures after "
+             "calls if the stack cache analysis is disabled."),
+    cl::Hidden);
+  /// EnableProfile - Option to instrument functions and loops with counter
+  /// reads.
+  static cl::opt<bool> EnableProfile(
+    "mpatmos-profile",
+    cl::init(false),
+    cl::desc("Instrument functions and loops outside single-path code with "
+             "reads of the cycle counter into profile records."),
+    cl::Hidden);
   static cl::opt<bool> DisableIfConverter(
       "mpatmos-disable-ifcvt",
       cl::init(false),
       cl::desc("Disable if-converter for Patmos."),
       cl::Hidden);
+  /// EnableGlobalMerge - Option to merge small globals, such that they are
+  /// addressed by an offset to a shared base address.
+  static cl::opt<bool> EnableGlobalMerge(
+    "mpatmos-global-merge",
+    cl::init(true),
+    cl::desc("Merge the small globals of a module, such that loads and stores "
+             "use a base address loaded once per function and a short "
+             "offset, instead of a long immediate per global (default: "
+             "true)."),
+    cl::Hidden);
+
+  /// The largest offset of a load or store, i.e., 127 words.
+  static const unsigned GlobalMergeMaxOffset = 127 * 4;
+
+  /// CompressDebugSections - Option to compress the debug sections of the
+  /// generated object files, for llc and patmos-link, which have no
+  /// --compress-debug-sections of their own.
+  static cl::opt<DebugCompressionType> CompressDebugSections(
+    "mpatmos-compress-debug-sections",
+    cl::init(DebugCompressionType::None),
+    cl::desc("Compress the DWARF debug sections of Patmos object files."),
+    cl::values(clEnumValN(DebugCompressionType::None, "none",
+                          "No compression"),
+               clEnumValN(DebugCompressionType::Z, "zlib",
+                          "zlib style compression")),
+    cl::Hidden);
 
   /// Patmos Code Generator Pass Configuration Options.
   class PatmosPassConfig : public TargetPassConfig {
@@ -101,6 +210,20 @@ namespace {
       llvm_unreachable("unimplemented");
     }
 
+    void addIRPasses() override {
+      // expand atomics the backend does not select, and insert the fences
+      // for the ordering of atomic loads and stores
+      addPass(createAtomicExpandPass());
+
+      // Stage streamed arrays in the scratchpad, before loop strength
+      // reduction rewrites the addresses of the streams
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosSPMTilingPass());
+      }
+
+      TargetPassConfig::addIRPasses();
+    }
+
     bool addInstSelector() override {
       addPass(createPatmosISelDag(getPatmosTargetMachine(), getOptLevel()));
       return false;
@@ -110,13 +233,46 @@ namespace {
     /// addPreISelPasses - This method should add any "last minute" LLVM->LLVM
     /// passes (which are run just before instruction selector).
     bool addPreISel() override {
+      // Give small, bounded dynamic allocas a static frame object
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosBoundedAllocasPass());
+      }
+
+      // Globals of external linkage are only merged with
+      // -global-merge-on-external, as this changes their symbols to aliases
+      if (getOptLevel() != CodeGenOpt::None && EnableGlobalMerge) {
+        addPass(createGlobalMergePass(TM, GlobalMergeMaxOffset,
+                                      /*OnlyOptimizeForSize=*/false,
+                                      /*MergeExternalByDefault=*/false));
+      }
+
+      // Check the loop bounds of the user after the loop passes, before
+      // single-path code tightens them
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosLoopBoundVerifierPass());
+      }
+
       if (PatmosSinglePathInfo::isEnabled()) {
+        // Clone the single-path functions first, such that only they are
+        // prepared below and other functions keep their exits and switches
+        addPass(createPatmosSPClonePass(getPatmosTargetMachine()));
+        auto IsSinglePath = [](const Function &F) {
+          return PatmosSinglePathInfo::isEnabled(F);
+        };
         // Single-path transformation requires a single exit node
-        addPass(createUnifyFunctionExitNodesPass());
+        addPass(createUnifyFunctionExitNodesPass(IsSinglePath));
+        // Switches that only select values become table lookups or selects,
+        // which take the same time for every case
+        addPass(createPatmosSPSwitchLookupPass());
         // Single-path transformation currently cannot deal with
         // switch/jumptables -> lower them to ITEs
-        addPass(createLowerSwitchPass());
-        addPass(createPatmosSPClonePass());
+        addPass(createLowerSwitchPass(IsSinglePath));
+        // Derive loop bounds from SCEV where no (tight) pragma is given
+        addPass(createPatmosSPLoopBoundPass());
+      }
+      // After SPClone, which marks the single-path code to leave alone
+      if (EnableProfile) {
+        addPass(createPatmosProfileInstrumentationPass());
       }
       // This pass must be after SPClone to ensure we know which functions are
       // singlepath, so that we can report errors when needed
@@ -135,6 +291,9 @@ namespace {
       if (getOptLevel() == CodeGenOpt::None) {
         addPass(&DeadMachineInstructionElimID);
       }
+      else if (EnablePipeliner) {
+        addPass(&MachinePipelinerID);
+      }
     }
 
     /// addPostRegAlloc - This method may be implemented by targets that want to
@@ -142,11 +301,37 @@ namespace {
     /// prolog-epilog insertion.  This should return true if -print-machineinstrs
     /// should print after these passes.
     void addPostRegAlloc() override {
+      if (EnablePredSpillCoalescing && getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosPredSpillCoalescingPass(getPatmosTargetMachine()));
+      }
+
       if (PatmosSinglePathInfo::isEnabled()) {
         addPass(createPatmosSPMarkPass(getPatmosTargetMachine()));
+        // Drop the clones and originals the marking left uncalled, before
+        // the later passes spend time on them
+        addPass(createPatmosDeadFunctionEliminationPass());
+        if (getOptLevel() != CodeGenOpt::None && !DisableIfConverter) {
+          // Fold small triangles and diamonds of single-path functions into
+          // predicated code, reducing the predicates the reduction needs
+          addPass(createIfConverter([](const MachineFunction &MF) {
+            return PatmosSinglePathInfo::isConverting(MF);
+          }));
+          addPass(&UnreachableMachineBlockElimID);
+        }
         addPass(createPatmosSinglePathInfoPass(getPatmosTargetMachine()));
+        if (getOptLevel() != CodeGenOpt::None) {
+          // Unrolling changes the scopes the slots are prepared for, so it
+          // runs before SPPrepare, on a freshly built scope tree
+          addPass(createPatmosSPUnrollPass(getPatmosTargetMachine()));
+          addPass(createPatmosSinglePathInfoPass(getPatmosTargetMachine()));
+        }
         addPass(createPatmosSPPreparePass(getPatmosTargetMachine()));
       }
+
+      // the frame lowering cannot request the block frequencies itself
+      if (EnableFrequencyStackCacheLayout) {
+        addPass(createPatmosBlockFrequenciesPass());
+      }
     }
 
 
@@ -157,17 +342,58 @@ namespace {
     void addPreSched2() override {
 
       if (PatmosSinglePathInfo::isEnabled()) {
+        // needs the final frames of all functions, before the reduction
+        addPass(createPatmosSPFrameCoalescingPass(getPatmosTargetMachine()));
         addPass(createPatmosSinglePathInfoPass(getPatmosTargetMachine()));
         addPass(createPatmosSPBundlingPass(getPatmosTargetMachine()));
         addPass(createPatmosSPReducePass(getPatmosTargetMachine()));
-        addPass(createSPSchedulerPass(getPatmosTargetMachine()));
-      } else {
-        if (getOptLevel() != CodeGenOpt::None && !DisableIfConverter) {
-          addPass(&IfConverterID);
-          // If-converter might create unreachable blocks (bug?), need to be
-          // removed before function splitter
-          addPass(&UnreachableMachineBlockElimID);
+        // the predicate logic of the reduction, before it is bundled
+        if (getOptLevel() != CodeGenOpt::None) {
+          addPass(createPatmosPredicateCSEPass(getPatmosTargetMachine()));
         }
+        addPass(createSPSchedulerPass(getPatmosTargetMachine()));
+      }
+
+      // the loads that always hit do not stall the if-converted code and
+      // the post-RA scheduler
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosDataCacheAnalysisPass(getPatmosTargetMachine()));
+      }
+
+      // Single-path functions are converted already, the others are
+      // if-converted and get their ensures placed as usual
+      if (getOptLevel() != CodeGenOpt::None && !DisableIfConverter) {
+        addPass(createIfConverter([](const MachineFunction &MF) {
+          return !PatmosSinglePathInfo::isConverting(MF);
+        }));
+        // If-converter might create unreachable blocks (bug?), need to be
+        // removed before function splitter
+        addPass(&UnreachableMachineBlockElimID);
+        // the if-converted code computes the same predicates repeatedly
+        addPass(createPatmosPredicateCSEPass(getPatmosTargetMachine()));
+      }
+      // warn about the branches the if-converter left in constant-time code
+      addPass(createPatmosConstantTimeCheckPass(getPatmosTargetMachine()));
+
+      // Outline after the if-converter, whose predicated calls are not
+      // outlined, and before the ensures are placed, the outlined functions
+      // have no frame. The function splitter, the delay slot filler and the
+      // analyses of the final code then handle the outlined functions like
+      // any other.
+      if (getOptLevel() != CodeGenOpt::None && EnableOutliner) {
+        addPass(createMachineOutlinerPass(true));
+      }
+
+      // fold the constants and predicate copies left by the register
+      // allocator and the if-converter before the post-RA scheduler
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosPeepholePass(getPatmosTargetMachine()));
+      }
+
+      // the stack cache analysis places the ensures itself
+      if (getOptLevel() != CodeGenOpt::None && !EnableStackCacheAnalysis &&
+          !DisableEnsurePlacement) {
+        addPass(createPatmosEnsurePlacementPass(getPatmosTargetMachine()));
       }
 
       // this is pseudo pass that may hold results from SC analysis
@@ -202,13 +428,44 @@ namespace {
       // All passes below this line must handle delay slots and bundles
       // correctly.
 
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosLongImmSplitPass(getPatmosTargetMachine()));
+      }
+
       if (getPatmosSubtarget().hasMethodCache()) {
         addPass(createPatmosFunctionSplitterPass(getPatmosTargetMachine()));
       }
 
+      // place hot callers and callees next to each other in the method cache
+      if (!FunctionOrderFile.empty()) {
+        addPass(createPatmosFunctionOrderingPass(FunctionOrderFile));
+      }
+
       addPass(createPatmosDelaySlotKillerPass(getPatmosTargetMachine()));
 
+      // classify the loads of the final code again for its timing
+      if (getOptLevel() != CodeGenOpt::None) {
+        addPass(createPatmosDataCacheAnalysisPass(getPatmosTargetMachine()));
+      }
+
+      if (PatmosSinglePathInfo::isEnabled()) {
+        // The code is final, compute the execution time of single-path code
+        addPass(createPatmosSPTimingPass(getPatmosTargetMachine()));
+      }
+
       addPass(createPatmosEnsureAlignmentPass(getPatmosTargetMachine()));
+
+      // the code is final, estimate its WCET for quick feedback
+      if (EnableWCETEstimate || !WCETEstimateReport.empty()) {
+        addPass(createPatmosWCETEstimatePass(getPatmosTargetMachine(),
+                                             WCETEstimateReport));
+      }
+
+      // the code is final, export it for WCET analysis
+      if (!SerializeMachineCode.empty()) {
+        addPass(createPatmosPMLExportPass(getPatmosTargetMachine(),
+                                          SerializeMachineCode));
+      }
     }
   };
 } // namespace
@@ -238,9 +495,21 @@ PatmosTargetMachine::PatmosTargetMachine(const Target &T,
       TT, CPU, FS, Options, getEffectiveRelocModel(JIT, RM), getEffectiveCodeModel(CM, CodeModel::Small), L),
     Subtarget(TT, CPU, FS, *this, L), TLOF(std::make_unique<PatmosTargetObjectFile>())
 {
+  // the asm info takes the compression of the debug sections from the options
+  if (CompressDebugSections.getNumOccurrences())
+    this->Options.CompressDebugSections = CompressDebugSections;
   initAsmInfo();
 }
 
+TargetTransformInfo
+PatmosTargetMachine::getTargetTransformInfo(const Function &F) {
+  return TargetTransformInfo(PatmosTTIImpl(this, F));
+}
+
+bool PatmosTargetMachine::useIPRA() const {
+  return EnableIPRA;
+}
+
 TargetPassConfig *PatmosTargetMachine::createPassConfig(PassManagerBase &PM) {
   return new PatmosPassConfig(*this, PM);
 }
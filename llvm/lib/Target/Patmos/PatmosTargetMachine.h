@@ -21,6 +21,7 @@
 #include "PatmosSelectionDAGInfo.h"
 #include "PatmosRegisterInfo.h"
 #include "PatmosSubtarget.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Target/TargetMachine.h"
 
@@ -64,6 +65,15 @@ public:
     return true;
   }
 
+  /// useIPRA - Enable interprocedural register allocation, which replaces
+  /// the call preserved masks of calls to functions of the module by the
+  /// registers they actually clobber.
+  bool useIPRA() const override;
+
+  /// getTargetTransformInfo - Return the cost model of Patmos for the IR
+  /// passes, see PatmosTargetTransformInfo.
+  TargetTransformInfo getTargetTransformInfo(const Function &F) override;
+
   /// createPassConfig - Create a pass configuration object to be used by
   /// addPassToEmitX methods for generating a pipeline of CodeGen passes.
   TargetPassConfig *createPassConfig(PassManagerBase &PM) override;
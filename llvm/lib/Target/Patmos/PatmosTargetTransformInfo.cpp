@@ -0,0 +1,260 @@
+//===-- PatmosTargetTransformInfo.cpp - Patmos specific TTI ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The cost model of Patmos for the IR optimizer:
+//  - Constants up to 12 bits are immediates of the ALU instructions, larger
+//    ones need a long immediate, which occupies both slots of a bundle.
+//  - Division and remainder are calls to compiler-rt or expanded inline,
+//    floating point operations are calls to the soft-float routines.
+//  - Selects are predicated moves, branches stall for their delay slots.
+//  - Uncached accesses always go to the main memory.
+//  - Calls fill the stack cache and load the method cache regions of callee
+//    and caller, inlining small callees pays off earlier.
+//  - Partial unrolling only pays off by filling the second slot of
+//    dual-issue processors, runtime unrolling duplicates the body into the
+//    remainder loop. The loop passes adjust the loop bounds of the WCET
+//    analysis to the peeled and unrolled loops.
+//
+// The unroller and the inliner share the size budget of the function
+// splitter, the maximum size of a method cache region: code beyond it is
+// split into regions connected by costly transfers, which eats up the gain.
+// A loop is unrolled only as far as it fits into a region and leaves room
+// for its callees in the method cache. A function larger than a region is
+// not inlined, and the bonus for small callees is only given as long as the
+// caller still fits into a region.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PatmosTargetTransformInfo.h"
+#include "llvm/Analysis/InlineCost.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
+
+#include <set>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmostti"
+
+/// The cost of a call to a soft-float routine of compiler-rt.
+static cl::opt<unsigned> SoftFloatCost("mpatmos-tti-soft-float-cost",
+  cl::init(40),
+  cl::desc("Cost of a soft-float operation for the IR optimizer "
+           "(default: 40)."),
+  cl::Hidden);
+
+/// The cost of a 32 bit division or remainder by a non-constant divisor.
+static cl::opt<unsigned> DivisionCost("mpatmos-tti-division-cost",
+  cl::init(32),
+  cl::desc("Cost of a 32 bit division by a non-constant divisor for the IR "
+           "optimizer (default: 32)."),
+  cl::Hidden);
+
+/// The uncached address space, see PatmosISelLowering.
+static const unsigned UncachedAddrSpace = 3;
+
+/// getCodeSize - Estimate the size of the code of a function in bytes, for
+/// an instruction of four bytes per IR instruction.
+static unsigned getCodeSize(const Function &F) {
+  return F.getInstructionCount() * 4;
+}
+
+InstructionCost PatmosTTIImpl::getIntImmCost(const APInt &Imm, Type *Ty,
+                                             TTI::TargetCostKind CostKind) {
+  assert(Ty->isIntegerTy());
+  unsigned BitSize = Ty->getPrimitiveSizeInBits();
+  if (BitSize == 0 || BitSize > 64)
+    return TTI::TCC_Free;
+
+  // every half of a 64 bit constant is a constant of its own
+  InstructionCost Cost = 0;
+  for (unsigned Part = 0; Part * 32 < BitSize; Part++) {
+    uint64_t V = Imm.extractBitsAsZExtValue(std::min(32u, BitSize - Part * 32),
+                                            Part * 32);
+    if (V == 0)
+      continue;
+    // li and li with negation take 12 bit constants, all others take a long
+    // immediate
+    Cost += isUInt<12>(V) || isUInt<12>(-(uint32_t)V) ? TTI::TCC_Basic
+                                                      : 2 * TTI::TCC_Basic;
+  }
+  return Cost;
+}
+
+InstructionCost PatmosTTIImpl::getIntImmCostInst(unsigned Opc, unsigned Idx,
+                                                 const APInt &Imm, Type *Ty,
+                                                 TTI::TargetCostKind CostKind,
+                                                 Instruction *Inst) {
+  assert(Ty->isIntegerTy());
+  if (Ty->getPrimitiveSizeInBits() > 32)
+    return getIntImmCost(Imm, Ty, CostKind);
+
+  switch (Opc) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+  case Instruction::ICmp:
+    // the second operand is an immediate of the instruction, short ones are
+    // free, long ones need the long form of the instruction
+    if (Idx == 1)
+      return isUInt<12>(Imm.getZExtValue()) ? TTI::TCC_Free : TTI::TCC_Basic;
+    break;
+  case Instruction::GetElementPtr:
+    // the offset of a load or store
+    if (Idx > 0)
+      return TTI::TCC_Free;
+    break;
+  }
+  return getIntImmCost(Imm, Ty, CostKind);
+}
+
+InstructionCost PatmosTTIImpl::getArithmeticInstrCost(
+    unsigned Opcode, Type *Ty, TTI::TargetCostKind CostKind,
+    TTI::OperandValueKind Opd1Info, TTI::OperandValueKind Opd2Info,
+    TTI::OperandValueProperties Opd1PropInfo,
+    TTI::OperandValueProperties Opd2PropInfo, ArrayRef<const Value *> Args,
+    const Instruction *CxtI) {
+  if (Ty->isVectorTy() || CostKind == TTI::TCK_CodeSize)
+    return BaseT::getArithmeticInstrCost(Opcode, Ty, CostKind, Opd1Info,
+                                         Opd2Info, Opd1PropInfo, Opd2PropInfo,
+                                         Args, CxtI);
+
+  // a call to a soft-float routine
+  if (Ty->isFloatingPointTy()) {
+    unsigned Cost = SoftFloatCost;
+    if (Opcode == Instruction::FDiv || Opcode == Instruction::FRem)
+      Cost *= 2;
+    if (Ty->isDoubleTy())
+      Cost *= 2;
+    return Cost;
+  }
+
+  unsigned Parts = (Ty->getPrimitiveSizeInBits() + 31) / 32;
+  switch (Opcode) {
+  case Instruction::SDiv:
+  case Instruction::UDiv:
+  case Instruction::SRem:
+  case Instruction::URem:
+    // divisions by constants are expanded to multiplications
+    if (Opd2Info == TTI::OK_UniformConstantValue && Parts == 1)
+      return 4 * TTI::TCC_Basic;
+    return DivisionCost * Parts * Parts;
+  }
+
+  return BaseT::getArithmeticInstrCost(Opcode, Ty, CostKind, Opd1Info,
+                                       Opd2Info, Opd1PropInfo, Opd2PropInfo,
+                                       Args, CxtI);
+}
+
+InstructionCost PatmosTTIImpl::getCFInstrCost(unsigned Opcode,
+                                              TTI::TargetCostKind CostKind,
+                                              const Instruction *I) {
+  // a branch stalls for the delay slots that are not filled
+  if (Opcode == Instruction::Br && CostKind == TTI::TCK_Latency)
+    return 1 + ST->getCFLDelaySlotCycles(true);
+  return BaseT::getCFInstrCost(Opcode, CostKind, I);
+}
+
+InstructionCost PatmosTTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy,
+                                                  Type *CondTy,
+                                                  CmpInst::Predicate VecPred,
+                                                  TTI::TargetCostKind CostKind,
+                                                  const Instruction *I) {
+  // a select is a predicated move of each word, also of soft floats
+  if (Opcode == Instruction::Select && !ValTy->isVectorTy() &&
+      ValTy->isSized())
+    return (DL.getTypeSizeInBits(ValTy).getFixedSize() + 31) / 32 *
+           TTI::TCC_Basic;
+  return BaseT::getCmpSelInstrCost(Opcode, ValTy, CondTy, VecPred, CostKind,
+                                   I);
+}
+
+InstructionCost PatmosTTIImpl::getMemoryOpCost(unsigned Opcode, Type *Src,
+                                               MaybeAlign Alignment,
+                                               unsigned AddressSpace,
+                                               TTI::TargetCostKind CostKind,
+                                               const Instruction *I) {
+  InstructionCost Cost = BaseT::getMemoryOpCost(Opcode, Src, Alignment,
+                                                AddressSpace, CostKind, I);
+  if (CostKind == TTI::TCK_CodeSize)
+    return Cost;
+
+  // every access of an uncached word waits for the main memory
+  if (AddressSpace == UncachedAddrSpace)
+    return Cost * ST->getMemoryBurstCycles();
+  return Cost;
+}
+
+bool PatmosTTIImpl::areInlineCompatible(const Function *Caller,
+                                        const Function *Callee) const {
+  if (!BaseT::areInlineCompatible(Caller, Callee))
+    return false;
+
+  // a callee larger than a region is split anyway, inlined, it would also
+  // split the code around the call
+  return Callee->hasFnAttribute(Attribute::AlwaysInline) ||
+         getCodeSize(*Callee) <= ST->getMaxSubfunctionSize();
+}
+
+unsigned PatmosTTIImpl::adjustInliningThreshold(const CallBase *CB) {
+  // A call reserves and ensures the stack frame of the callee and loads the
+  // method cache region of the callee and of the caller on return. A callee
+  // that fits into a single method cache block is worth inlining for that,
+  // unless the caller then no longer fits into a region.
+  const Function *Callee = CB->getCalledFunction();
+  if (!Callee || Callee->isDeclaration())
+    return 0;
+  if (getCodeSize(*Callee) > ST->getMethodCacheBlockSize() ||
+      getCodeSize(*CB->getCaller()) + getCodeSize(*Callee) >
+        ST->getMaxSubfunctionSize())
+    return 0;
+  return 5 * InlineConstants::InstrCost;
+}
+
+void PatmosTTIImpl::getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
+                                            TTI::UnrollingPreferences &UP,
+                                            OptimizationRemarkEmitter *ORE) {
+  BaseT::getUnrollingPreferences(L, SE, UP, ORE);
+
+  // the unrolled loop must fit into a region, and into the method cache
+  // together with the functions it calls
+  std::set<const Function*> Callees;
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      if (const CallBase *CB = dyn_cast<CallBase>(&I))
+        if (const Function *F = CB->getCalledFunction())
+          if (!F->isDeclaration())
+            Callees.insert(F);
+  unsigned CalleeSize = 0;
+  for (const Function *F : Callees)
+    CalleeSize += std::min(getCodeSize(*F), ST->getMaxSubfunctionSize());
+  unsigned MaxSize = ST->getMaxSubfunctionSize();
+  if (CalleeSize >= ST->getMethodCacheSize())
+    MaxSize = 0;
+  else
+    MaxSize = std::min(MaxSize, ST->getMethodCacheSize() - CalleeSize);
+
+  // in instructions of four bytes
+  unsigned MaxInstrs = MaxSize / 4;
+  UP.Threshold = std::min(UP.Threshold, MaxInstrs);
+  UP.PartialThreshold = std::min(UP.PartialThreshold, MaxInstrs);
+
+  // the remainder loop of runtime unrolling only adds code
+  UP.Runtime = false;
+
+  UP.Partial = ST->enableBundling(CodeGenOpt::Default);
+  if (UP.Partial && !UP.PartialThreshold)
+    UP.PartialThreshold = MaxInstrs;
+}
@@ -0,0 +1,103 @@
+//===-- PatmosTargetTransformInfo.h - Patmos specific TTI -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the cost model of Patmos for the IR optimizer, i.e., the
+// TargetTransformInfo, see PatmosTargetTransformInfo.cpp.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _LLVM_TARGET_PATMOS_TARGETTRANSFORMINFO_H_
+#define _LLVM_TARGET_PATMOS_TARGETTRANSFORMINFO_H_
+
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/CodeGen/BasicTTIImpl.h"
+
+namespace llvm {
+
+class PatmosTTIImpl : public BasicTTIImplBase<PatmosTTIImpl> {
+  typedef BasicTTIImplBase<PatmosTTIImpl> BaseT;
+  typedef TargetTransformInfo TTI;
+  friend BaseT;
+
+  const PatmosSubtarget *ST;
+  const PatmosTargetLowering *TLI;
+
+  const PatmosSubtarget *getST() const { return ST; }
+  const PatmosTargetLowering *getTLI() const { return TLI; }
+
+public:
+  explicit PatmosTTIImpl(const PatmosTargetMachine *TM, const Function &F)
+      : BaseT(TM, F.getParent()->getDataLayout()), ST(TM->getSubtargetImpl(F)),
+        TLI(ST->getTargetLowering()) {}
+
+  /// getNumberOfRegisters - The general purpose registers, without r0 and
+  /// the reserved registers, there are no vector registers.
+  unsigned getNumberOfRegisters(unsigned ClassID) const {
+    return ClassID == 0 ? 28 : 0;
+  }
+
+  TypeSize getRegisterBitWidth(TargetTransformInfo::RegisterKind K) const {
+    return TypeSize::getFixed(K == TTI::RGK_Scalar ? 32 : 0);
+  }
+
+  TTI::PopcntSupportKind getPopcntSupport(unsigned TyWidth) const {
+    return TTI::PSK_Software;
+  }
+
+  InstructionCost getIntImmCost(const APInt &Imm, Type *Ty,
+                                TTI::TargetCostKind CostKind);
+
+  InstructionCost getIntImmCostInst(unsigned Opc, unsigned Idx,
+                                    const APInt &Imm, Type *Ty,
+                                    TTI::TargetCostKind CostKind,
+                                    Instruction *Inst = nullptr);
+
+  InstructionCost getIntImmCostIntrin(Intrinsic::ID IID, unsigned Idx,
+                                      const APInt &Imm, Type *Ty,
+                                      TTI::TargetCostKind CostKind) {
+    return getIntImmCost(Imm, Ty, CostKind);
+  }
+
+  InstructionCost getArithmeticInstrCost(
+      unsigned Opcode, Type *Ty, TTI::TargetCostKind CostKind,
+      TTI::OperandValueKind Opd1Info = TTI::OK_AnyValue,
+      TTI::OperandValueKind Opd2Info = TTI::OK_AnyValue,
+      TTI::OperandValueProperties Opd1PropInfo = TTI::OP_None,
+      TTI::OperandValueProperties Opd2PropInfo = TTI::OP_None,
+      ArrayRef<const Value *> Args = ArrayRef<const Value *>(),
+      const Instruction *CxtI = nullptr);
+
+  InstructionCost getCFInstrCost(unsigned Opcode, TTI::TargetCostKind CostKind,
+                                 const Instruction *I = nullptr);
+
+  InstructionCost getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
+                                     CmpInst::Predicate VecPred,
+                                     TTI::TargetCostKind CostKind,
+                                     const Instruction *I = nullptr);
+
+  InstructionCost getMemoryOpCost(unsigned Opcode, Type *Src,
+                                  MaybeAlign Alignment, unsigned AddressSpace,
+                                  TTI::TargetCostKind CostKind,
+                                  const Instruction *I = nullptr);
+
+  bool areInlineCompatible(const Function *Caller,
+                           const Function *Callee) const;
+
+  unsigned adjustInliningThreshold(const CallBase *CB);
+
+  void getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
+                               TTI::UnrollingPreferences &UP,
+                               OptimizationRemarkEmitter *ORE);
+};
+
+} // end namespace llvm
+
+#endif // _LLVM_TARGET_PATMOS_TARGETTRANSFORMINFO_H_
@@ -0,0 +1,548 @@
+//===-- PatmosWCETEstimate.cpp - Quick WCET estimate of machine functions. ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Compute a quick, conservative estimate of the worst-case execution time of
+// every function of the module once the final code is known, given by
+// -mpatmos-wcet-estimate.
+//
+// The cost of a block is the number of its bundles plus
+//  - the stall cycles of non-delayed control-flow instructions,
+//  - a memory burst for every access to the data cache or main memory, which
+//    are all assumed to miss, while stack cache and scratchpad accesses hit,
+//    except for the loads the data cache analysis classified: always-hit
+//    loads cost nothing, first-miss loads a burst on each entry edge of
+//    their loop,
+//  - the bursts to spill and fill the stack cache at reserves and ensures,
+//    taken from the stack cache analysis if it ran, or the full argument,
+//  - the estimate of the most expensive callee of its calls, and the bursts
+//    to load its method cache region again after each call returns.
+// Edges entering another method cache region, as laid out by the function
+// splitter, cost the bursts to load the region. The estimate of a function
+// is then the maximum of the block and edge costs over all paths, bounded by
+// the loop bounds, computed as implicit path enumeration (IPET) by the
+// built-in ILP solver.
+//
+// Functions with loops without bound, irreducible loops, recursion or calls
+// to unknown functions are reported as unbounded.
+//
+// The functions are estimated bottom-up in the call graph, in rounds of the
+// functions whose callees all have their estimate. The functions of a round
+// are independent of each other and can be estimated concurrently, see
+// -mpatmos-wcet-estimate-threads. The code sizes are computed up front on a
+// single thread.
+//
+// The estimate is printed as comment at the function label and, if
+// requested, written to a report with one line per function, together with
+// the code size of the function, e.g., to tune the function splitter.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosCallGraphBuilder.h"
+#include "PatmosILPSolver.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosMachineFunctionInfo.h"
+#include "PatmosStackCacheAnalysis.h"
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-wcet-estimate"
+
+STATISTIC(NumEstimated, "Number of functions with a WCET estimate");
+STATISTIC(NumUnbounded, "Number of functions without bounded WCET estimate");
+
+static cl::opt<unsigned> BurstSize(
+  "mpatmos-wcet-burst-size",
+  cl::init(16),
+  cl::desc("Bytes transferred by a memory burst for the WCET estimate "
+           "(default: from the processor, 16 for generic)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> BurstCycles(
+  "mpatmos-wcet-burst-cycles",
+  cl::init(21),
+  cl::desc("Cycles of a memory burst for the WCET estimate (default: from "
+           "the processor, 21 for generic)."),
+  cl::Hidden);
+
+/// Option to specify the number of threads estimating functions concurrently.
+static cl::opt<unsigned> EstimateThreads(
+  "mpatmos-wcet-estimate-threads",
+  cl::init(1),
+  cl::desc("Number of threads estimating independent functions concurrently "
+           "(0 = number of hardware threads, default: 1)."),
+  cl::Hidden);
+
+namespace {
+  class PatmosWCETEstimate : public MachineModulePass {
+  private:
+    const PatmosInstrInfo &TII;
+    const PatmosSubtarget &STI;
+
+    /// The file to append the report to, or an empty string.
+    std::string ReportFile;
+
+    /// The estimates of the functions, or -1 if they are unbounded. Only
+    /// written between the rounds of concurrent estimates.
+    std::map<const MachineFunction*, int64_t> Estimates;
+
+    /// The sizes of the basic blocks in bytes. Computed before the concurrent
+    /// estimates, since the size of inline assembly is cached in the
+    /// instruction info without any locking.
+    DenseMap<const MachineBasicBlock*, uint64_t> BlockSizes;
+
+    /// getBurstCycles - Return the cycles of a single memory burst.
+    uint64_t getBurstCycles() const {
+      return BurstCycles.getNumOccurrences() ? BurstCycles
+                                             : STI.getMemoryBurstCycles();
+    }
+
+    /// getBurstCycles - Return the cycles to transfer Bytes from or to main
+    /// memory.
+    uint64_t getBurstCycles(uint64_t Bytes) const {
+      uint64_t Size = BurstSize.getNumOccurrences() ? BurstSize
+                                                    : STI.getMemoryBurstSize();
+      return (Bytes + Size - 1) / Size * getBurstCycles();
+    }
+
+    /// getCodeSize - Return the size of the code of MF in bytes.
+    uint64_t getCodeSize(const MachineFunction &MF) const {
+      uint64_t Size = 0;
+      for (const MachineBasicBlock &MBB : MF)
+        for (const MachineInstr &MI : MBB)
+          Size += TII.getInstrSize(&MI);
+      return Size;
+    }
+
+    /// getStallCycles - Return the cycles the pipeline stalls after the
+    /// given instruction, i.e., for non-delayed control-flow instructions.
+    uint64_t getStallCycles(const MachineInstr &MI) const {
+      if (!(MI.isBranch() || MI.isCall() || MI.isReturn()) ||
+          MI.hasDelaySlot())
+        return 0;
+      return STI.getDelaySlotCycles(MI);
+    }
+
+    /// getMemoryCycles - Return the cycles of the memory transfers of MI,
+    /// besides the bundle itself.
+    uint64_t getMemoryCycles(const MachineInstr &MI,
+                             const PatmosStackCacheAnalysisInfo &SCAI) const {
+      switch (MI.getOpcode()) {
+      case Patmos::SRESi: {
+        auto R = SCAI.Reserves.find(&MI);
+        if (SCAI.isValid() && R != SCAI.Reserves.end())
+          return getBurstCycles(R->second);
+        return getBurstCycles(MI.getOperand(2).getImm() * 4);
+      }
+      case Patmos::SENSi: {
+        auto E = SCAI.Ensures.find(&MI);
+        if (SCAI.isValid() && E != SCAI.Ensures.end())
+          return getBurstCycles(E->second);
+        return getBurstCycles(MI.getOperand(2).getImm() * 4);
+      }
+      case Patmos::SSPILLi:
+        return getBurstCycles(MI.getOperand(2).getImm() * 4);
+      case Patmos::SENSr:
+      case Patmos::SSPILLr:
+        return getBurstCycles(STI.getStackCacheSize());
+      case Patmos::SFREEi:
+        return 0;
+      }
+
+      if ((!MI.mayLoad() && !MI.mayStore()) || MI.isCall() || MI.isReturn() ||
+          MI.isBranch() || TII.isPseudo(&MI))
+        return 0;
+
+      // stores are written through, all other accesses may miss, unless the
+      // data cache analysis proved them to hit
+      switch (TII.getMemType(MI)) {
+      case PatmosII::MEM_C:
+        // first-miss loads are charged on the entries of their loop
+        if (TII.isAlwaysHit(MI) || TII.isFirstMiss(MI))
+          return 0;
+        return getBurstCycles();
+      case PatmosII::MEM_M:
+        return getBurstCycles();
+      default:
+        return 0;
+      }
+    }
+
+    /// getCallees - Return the possible callees of a call, or false if some
+    /// are unknown.
+    static bool getCallees(PatmosCallGraphBuilder &PCGB,
+                           const MachineInstr &MI,
+                           std::vector<const MachineFunction*> &Callees) {
+      MCGSites sites(PCGB.getSites(&MI));
+      for (MCGSite *site : sites) {
+        MCGNode *callee = site->getCallee();
+        if (!callee->isUnknown()) {
+          Callees.push_back(callee->getMF());
+          continue;
+        }
+        for (MCGSite *target : callee->getSites()) {
+          if (!target->getCallee()->isUnknown())
+            Callees.push_back(target->getCallee()->getMF());
+        }
+      }
+      return !Callees.empty();
+    }
+
+    /// getEdgeName - Return the ILP variable of the edge from Src to Dst.
+    static std::string getEdgeName(const MachineBasicBlock *Src,
+                                   const MachineBasicBlock *Dst) {
+      return "e" + utostr(Src->getNumber()) + "_" + utostr(Dst->getNumber());
+    }
+
+    /// isReady - Check whether all known callees of MF have their estimate.
+    bool isReady(PatmosCallGraphBuilder &PCGB, const MachineFunction &MF) const;
+
+    /// estimateFunction - Compute the estimate of MF, given the estimates of
+    /// its callees. This may run concurrently for several functions.
+    int64_t estimateFunction(PatmosCallGraphBuilder &PCGB,
+                             const PatmosStackCacheAnalysisInfo &SCAI,
+                             PatmosILPSolver &Solver,
+                             const MachineFunction &MF);
+
+  public:
+    /// Pass ID
+    static char ID;
+
+    PatmosWCETEstimate(const PatmosTargetMachine &tm,
+                       const std::string &reportFile)
+      : MachineModulePass(ID), TII(*tm.getInstrInfo()),
+        STI(*tm.getSubtargetImpl()), ReportFile(reportFile)
+    {
+    }
+
+    /// getAnalysisUsage - Inform the pass manager that nothing is modified.
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+      AU.setPreservesAll();
+      AU.addRequired<MachineModuleInfoWrapperPass>();
+      AU.addRequired<PatmosCallGraphBuilder>();
+      AU.addRequired<PatmosStackCacheAnalysisInfo>();
+      ModulePass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineModule(const Module &M) override;
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override {
+      return "Patmos WCET Estimate";
+    }
+  };
+
+  char PatmosWCETEstimate::ID = 0;
+} // end of anonymous namespace
+
+/// createPatmosWCETEstimatePass - Returns a new PatmosWCETEstimate appending
+/// its report to ReportFile, if it is not empty.
+ModulePass *llvm::createPatmosWCETEstimatePass(const PatmosTargetMachine &tm,
+                                               const std::string &ReportFile) {
+  return new PatmosWCETEstimate(tm, ReportFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosWCETEstimate::isReady(PatmosCallGraphBuilder &PCGB,
+                                 const MachineFunction &MF) const {
+  for (const MachineBasicBlock &MBB : MF) {
+    for (const MachineInstr &MI : MBB.instrs()) {
+      if (!MI.isCall())
+        continue;
+
+      // unknown callees make the estimate unbounded right away
+      std::vector<const MachineFunction*> Callees;
+      getCallees(PCGB, MI, Callees);
+      for (const MachineFunction *Callee : Callees)
+        if (!Estimates.count(Callee))
+          return false;
+    }
+  }
+  return true;
+}
+
+int64_t PatmosWCETEstimate::estimateFunction(PatmosCallGraphBuilder &PCGB,
+                                    const PatmosStackCacheAnalysisInfo &SCAI,
+                                    PatmosILPSolver &Solver,
+                                    const MachineFunction &MF) {
+  LLVM_DEBUG(dbgs() << "WCET estimate of " << MF.getName() << "\n");
+
+  // the analyses of the pass pipeline are gone in a module pass
+  MachineDomTree MDT;
+  MDT.recalculate(const_cast<MachineFunction&>(MF));
+  LoopInfoBase<MachineBasicBlock, MachineLoop> MLI;
+  MLI.analyze(MDT);
+
+  const PatmosMachineFunctionInfo &PMFI =
+                                     *MF.getInfo<PatmosMachineFunctionInfo>();
+
+  // the method cache regions of the function splitter and their sizes,
+  // including the size word
+  DenseMap<const MachineBasicBlock*, const MachineBasicBlock*> Regions;
+  DenseMap<const MachineBasicBlock*, uint64_t> RegionSizes;
+  const MachineBasicBlock *Region = &MF.front();
+  for (const MachineBasicBlock &MBB : MF) {
+    if (PMFI.isMethodCacheRegionEntry(&MBB))
+      Region = &MBB;
+    Regions[&MBB] = Region;
+
+    uint64_t &Size = RegionSizes[Region];
+    if (Size == 0)
+      Size = 4;
+    Size += BlockSizes.lookup(&MBB);
+  }
+
+  // first-miss loads miss once per entry of their innermost loop
+  DenseMap<const MachineBasicBlock*, uint64_t> EntryMisses;
+  for (const MachineBasicBlock &MBB : MF) {
+    for (const MachineInstr &MI : MBB.instrs()) {
+      if (TII.isFirstMiss(MI)) {
+        MachineLoop *L = MLI.getLoopFor(&MBB);
+        assert(L && "First-miss load outside of a loop");
+        EntryMisses[L->getHeader()] += getBurstCycles();
+      }
+    }
+  }
+
+  std::string LP;
+  raw_string_ostream OS(LP);
+  std::string Constraints;
+  raw_string_ostream CS(Constraints);
+  std::vector<std::string> Variables;
+
+  OS << "Maximize";
+  for (const MachineBasicBlock &MBB : MF) {
+    std::string Block = "b" + utostr(MBB.getNumber());
+    Variables.push_back(Block);
+
+    uint64_t Cycles = 0;
+    for (const MachineInstr &MI : MBB) {
+      if (TII.isPseudo(&MI))
+        continue;
+
+      // every bundle issues in a single cycle
+      Cycles++;
+
+      MachineBasicBlock::const_instr_iterator II = MI.getIterator();
+      do {
+        if (II->isInlineAsm()) {
+          LLVM_DEBUG(dbgs() << "  Inline assembly in MBB#" << MBB.getNumber()
+                            << "\n");
+          return -1;
+        }
+
+        Cycles += getStallCycles(*II) + getMemoryCycles(*II, SCAI);
+
+        if (II->isCall()) {
+          std::vector<const MachineFunction*> Callees;
+          if (!getCallees(PCGB, *II, Callees)) {
+            LLVM_DEBUG(dbgs() << "  Unknown callee in MBB#"
+                              << MBB.getNumber() << "\n");
+            return -1;
+          }
+
+          int64_t Max = 0;
+          for (const MachineFunction *Callee : Callees) {
+            int64_t Estimate = Estimates.find(Callee)->second;
+            if (Estimate < 0)
+              return -1;
+            Max = std::max(Max, Estimate);
+          }
+
+          // the callee may evict the region of the call
+          Cycles += Max + getBurstCycles(RegionSizes[Regions[&MBB]]);
+        }
+        ++II;
+      } while (II != MBB.instr_end() && II->isBundledWithPred());
+    }
+    OS << "\n + " << Cycles << " " << Block;
+
+    // flow into and out of the block, the entry block is entered once
+    CS << "in" << MBB.getNumber() << ": " << Block;
+    for (const MachineBasicBlock *Pred : MBB.predecessors())
+      CS << " - " << getEdgeName(Pred, &MBB);
+    CS << " = " << (&MBB == &MF.front() ? 1 : 0) << "\n";
+
+    if (!MBB.succ_empty()) {
+      CS << "out" << MBB.getNumber() << ": " << Block;
+      for (const MachineBasicBlock *Succ : MBB.successors()) {
+        std::string Edge = getEdgeName(&MBB, Succ);
+        CS << " - " << Edge;
+        Variables.push_back(Edge);
+
+        // entering another region loads it into the method cache
+        uint64_t EdgeCycles = 0;
+        if (Regions[Succ] == Succ && Regions[&MBB] != Succ)
+          EdgeCycles += getBurstCycles(RegionSizes[Succ]);
+        // entering a loop loads the lines of its first-miss loads
+        auto EM = EntryMisses.find(Succ);
+        if (EM != EntryMisses.end() && !MLI.getLoopFor(Succ)->contains(&MBB))
+          EdgeCycles += EM->second;
+        if (EdgeCycles)
+          OS << "\n + " << EdgeCycles << " " << Edge;
+      }
+      CS << " = 0\n";
+    }
+
+    // the bound is on the back edges, relative to the entries of the loop
+    MachineLoop *L = MLI.getLoopFor(&MBB);
+    if (L && L->getHeader() == &MBB) {
+      int Max = getLoopBounds(&MBB).second;
+      if (Max < 0) {
+        LLVM_DEBUG(dbgs() << "  Loop header MBB#" << MBB.getNumber()
+                          << " has no bound\n");
+        return -1;
+      }
+
+      CS << "loop" << MBB.getNumber() << ":";
+      for (const MachineBasicBlock *Pred : MBB.predecessors()) {
+        if (L->contains(Pred))
+          CS << " + " << getEdgeName(Pred, &MBB);
+        else
+          CS << " - " << Max << " " << getEdgeName(Pred, &MBB);
+      }
+      CS << " <= " << (&MBB == &MF.front() ? Max : 0) << "\n";
+    }
+  }
+
+  OS << "\nSubject To\n" << CS.str() << "Generals\n";
+  for (const std::string &Variable : Variables)
+    OS << Variable << "\n";
+  OS << "End\n";
+  OS.flush();
+
+  // cycles not covered by a loop leave the ILP unbounded
+  double Objective;
+  if (!Solver.solve(LP, Objective)) {
+    LLVM_DEBUG(dbgs() << "  Unbounded or infeasible ILP:\n" << LP);
+    return -1;
+  }
+
+  // the function is entered by loading its first region
+  int64_t Estimate = (int64_t)Objective +
+                     getBurstCycles(RegionSizes[&MF.front()]) +
+                     EntryMisses.lookup(&MF.front());
+  LLVM_DEBUG(dbgs() << "  " << Estimate << " cycles\n");
+  return Estimate;
+}
+
+bool PatmosWCETEstimate::runOnMachineModule(const Module &M) {
+  auto &MMI = getAnalysis<MachineModuleInfoWrapperPass>().getMMI();
+  PatmosCallGraphBuilder &PCGB(getAnalysis<PatmosCallGraphBuilder>());
+  const PatmosStackCacheAnalysisInfo &SCAI =
+                                   getAnalysis<PatmosStackCacheAnalysisInfo>();
+  std::unique_ptr<PatmosILPSolver> Solver(createPatmosBuiltinILPSolver());
+
+  std::error_code err;
+  std::unique_ptr<raw_fd_ostream> Report;
+  if (!ReportFile.empty()) {
+    Report.reset(new raw_fd_ostream(ReportFile, err, sys::fs::OF_Append));
+    if (err) {
+      errs() << "Error: Failed to open WCET estimate report '" << ReportFile
+             << "': " << err.message() << "\n";
+      Report.reset();
+    }
+  }
+
+  // estimate independent functions concurrently
+  std::unique_ptr<ThreadPool> Pool;
+  ThreadPoolStrategy Threads = hardware_concurrency(EstimateThreads);
+  if (Threads.compute_thread_count() > 1)
+    Pool.reset(new ThreadPool(Threads));
+
+  Estimates.clear();
+  BlockSizes.clear();
+  std::vector<const MachineFunction*> Pending;
+  for (const Function &F : M) {
+    MachineFunction *MF = MMI.getMachineFunction(F);
+    if (!MF)
+      continue;
+    Pending.push_back(MF);
+
+    for (const MachineBasicBlock &MBB : *MF) {
+      uint64_t &Size = BlockSizes[&MBB];
+      for (const MachineInstr &MI : MBB.instrs()) {
+        if (!MI.isBundle())
+          Size += TII.getInstrSize(&MI);
+      }
+    }
+  }
+
+  while (!Pending.empty()) {
+    std::vector<const MachineFunction*> Ready, Waiting;
+    for (const MachineFunction *MF : Pending)
+      (isReady(PCGB, *MF) ? Ready : Waiting).push_back(MF);
+
+    // the remaining functions are recursive or call recursive functions,
+    // recursion is not bounded
+    if (Ready.empty()) {
+      for (const MachineFunction *MF : Waiting) {
+        LLVM_DEBUG(dbgs() << "WCET estimate of " << MF->getName()
+                          << "\n  Recursion\n");
+        Estimates[MF] = -1;
+      }
+      break;
+    }
+
+    std::vector<int64_t> Results(Ready.size());
+    if (Pool && Ready.size() > 1) {
+      for (unsigned i = 0, e = Ready.size(); i != e; i++) {
+        Pool->async([this, &PCGB, &SCAI, &Solver, &Ready, &Results, i]() {
+          Results[i] = estimateFunction(PCGB, SCAI, *Solver, *Ready[i]);
+        });
+      }
+      Pool->wait();
+    }
+    else {
+      for (unsigned i = 0, e = Ready.size(); i != e; i++)
+        Results[i] = estimateFunction(PCGB, SCAI, *Solver, *Ready[i]);
+    }
+
+    for (unsigned i = 0, e = Ready.size(); i != e; i++)
+      Estimates[Ready[i]] = Results[i];
+    Pending.swap(Waiting);
+  }
+
+  for (const Function &F : M) {
+    MachineFunction *MF = MMI.getMachineFunction(F);
+    if (!MF)
+      continue;
+
+    int64_t Estimate = Estimates[MF];
+    MF->getInfo<PatmosMachineFunctionInfo>()->setWCETEstimate(Estimate);
+    if (Estimate < 0)
+      NumUnbounded++;
+    else
+      NumEstimated++;
+
+    // <module>, <function>, <cycles or -1 if unbounded>, <bytes>
+    if (Report) {
+      *Report << "\"" << M.getModuleIdentifier() << "\", ";
+      *Report << "\"" << MF->getName() << "\", ";
+      *Report << Estimate << ", " << getCodeSize(*MF) << "\n";
+    }
+  }
+  return false;
+}
@@ -13,7 +13,11 @@
 //===----------------------------------------------------------------------===//
 
 #include "PatmosSPBundling.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Timer.h"
 
 using namespace llvm;
 
@@ -24,6 +28,28 @@ STATISTIC(InstPairsSwitched,     "Number of instructions tried to bundle and but
 STATISTIC(InstPairsSuccess,     "Number of instructions tried to bundle and succeeded");
 STATISTIC(SPBlocks,     "Number of basic blocks in single-path code (before bundle)");
 
+namespace {
+  enum PairingMode {
+    PAIR_POSITIONAL,
+    PAIR_DEPENDENCE
+  };
+}
+
+static cl::opt<PairingMode> SPBundlingPairing("mpatmos-sp-bundling-pairing",
+    cl::init(PAIR_DEPENDENCE),
+    cl::desc("How instructions of merged single-path blocks are paired"),
+    cl::values(
+        clEnumValN(PAIR_POSITIONAL, "positional",
+                   "Pair instructions in the order of the blocks"),
+        clEnumValN(PAIR_DEPENDENCE, "dependence",
+                   "Reorder instructions within the blocks along their "
+                   "dependencies to find more pairs")),
+    cl::Hidden);
+
+/// Number of unscheduled instructions of each block that are considered
+/// when looking for a pair.
+static const unsigned PairingWindow = 8;
+
 char PatmosSPBundling::ID = 0;
 
 /// createPatmosSPBundlingPass - Returns a new PatmosSPBundling
@@ -34,7 +60,7 @@ FunctionPass *llvm::createPatmosSPBundlingPass(const PatmosTargetMachine &tm) {
 
 bool PatmosSPBundling::runOnMachineFunction(MachineFunction &MF) {
   PSPI = &getAnalysis<PatmosSinglePathInfo>();
-  PostDom = &getAnalysis<MachinePostDominatorTree>();
+  ORE = &getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
     
   // only convert function if marked
   if ( PSPI->isConverting(MF) && STC.enableBundling(TM.getOptLevel())
@@ -45,83 +71,334 @@ bool PatmosSPBundling::runOnMachineFunction(MachineFunction &MF) {
   return true;
 }
 
-std::pair<PredicatedBlock*, PredicatedBlock*> findBranch(SPScope* root){
-  auto blocks = root->getScopeBlocks();
+bool PatmosSPBundling::canBundle(const MachineInstr *mi) const {
+  return !mi->isBundled() && !TII->isPseudo(mi) &&
+         !mi->isCall() && !mi->isBranch() && !mi->isReturn() &&
+         TII->getIssueWidth(mi) == 1;
+}
 
-  for(auto block: blocks){
-    if(root->isHeader(block) || root->isSubheader(block)) continue;
-    auto mbb = block->getMBB();
-    if(mbb->succ_size() == 2 && block->getDefinitions().size() == 2){
-      auto defs = block->getDefinitions();
-      return std::make_pair((PredicatedBlock*)(*defs.begin()).useBlock, (PredicatedBlock*)(*(++defs.begin())).useBlock);
-    }
+int PatmosSPBundling::getBundleSlot(const MachineInstr *mi1,
+                                    const MachineInstr *mi2) const {
+  if (!canBundle(mi1) || !canBundle(mi2)) return -1;
+  if (TII->canIssueInSlot(mi1, 0) && TII->canIssueInSlot(mi2, 1)) return 1;
+  if (TII->canIssueInSlot(mi2, 0) && TII->canIssueInSlot(mi1, 1)) return 0;
+  return -1;
+}
+
+/// Counts the pairs and the single instructions among the non-terminators
+/// of the block.
+static std::pair<unsigned, unsigned> countPairs(MachineBasicBlock *mbb) {
+  unsigned pairs = 0, singles = 0;
+  for(auto iter = mbb->begin(), end = mbb->getFirstTerminator();
+      iter != end; iter++){
+    if (iter->isBundledWithSucc()) pairs++;
+    else singles++;
   }
-  return std::make_pair((PredicatedBlock*)NULL, (PredicatedBlock*)NULL);
+  return std::make_pair(pairs, singles);
 }
 
-int numberOfInstructions(MachineBasicBlock* mbb){
-  auto count = 0;
-  for(auto begin = mbb->begin(), end = mbb->getFirstTerminator();
-      begin != end ; begin++){
-    count++;
+void PatmosSPBundling::emitPairingRemark(MachineBasicBlock *mbb1, int mbb2,
+                                         unsigned pairsBefore) {
+  auto counts = countPairs(mbb1);
+  unsigned formed = counts.first - pairsBefore;
+  if (counts.second == 0) {
+    ORE->emit([&]() {
+      return MachineOptimizationRemark(DEBUG_TYPE, "BundlePairing",
+                                       mbb1->findDebugLoc(mbb1->begin()), mbb1)
+             << "merged block #" << ore::NV("Block", mbb2)
+             << " into #" << ore::NV("Into", mbb1->getNumber())
+             << ": " << ore::NV("Pairs", formed) << " pairs formed";
+    });
+  } else {
+    ORE->emit([&]() {
+      return MachineOptimizationRemarkMissed(DEBUG_TYPE, "BundlePairingFailed",
+                                       mbb1->findDebugLoc(mbb1->begin()), mbb1)
+             << "merged block #" << ore::NV("Block", mbb2)
+             << " into #" << ore::NV("Into", mbb1->getNumber())
+             << ": " << ore::NV("Pairs", formed) << " pairs formed, "
+             << ore::NV("Unpaired", counts.second)
+             << " instructions could not be paired";
+    });
   }
-  return count;
 }
 
 void PatmosSPBundling::mergeMBBs(MachineBasicBlock *mbb1, MachineBasicBlock *mbb2){
+  if (SPBundlingPairing == PAIR_DEPENDENCE) {
+    mergeMBBsByDependence(mbb1, mbb2);
+    return;
+  }
+
+  // Both blocks are walked once. The cursor points at the next instruction
+  // of mbb1 that has not been paired yet, everything before it is done.
+  // Blocks may already contain bundles from earlier merges, these are
+  // moved as a whole.
+  auto mbb1End = mbb1->getFirstTerminator();
+  auto mbb2End = mbb2->getFirstTerminator();
+  MachineBasicBlock::iterator cursor = mbb1->begin();
 
-  auto moveInstruction = [&](auto bundleWith){
+  while(cursor != mbb1End && mbb2->begin() != mbb2End){
+    auto inst = &(*mbb2->begin());
     InstPairsTried++;
-    auto inst = &(*mbb2->instr_begin());
-    mbb2->remove(inst);
-#define DO_BUNDLE // for easily turning off bundling of instructions
-#ifdef DO_BUNDLE
-    if(TII->canIssueInSlot(inst, 1)){
+
+    int slot = getBundleSlot(&(*cursor), inst);
+    if(slot == 1){
       InstPairsSuccess++;
-      mbb1->insertAfter(bundleWith, inst);
+      mbb2->remove(inst);
+      mbb1->insertAfter(cursor, inst);
       inst->bundleWithPred();
-    }else if (TII->canIssueInSlot(&(*bundleWith), 1)){
+      cursor++;
+    }else if(slot == 0){
       InstPairsSwitched++;
-      mbb1->insert(bundleWith, inst);
+      mbb2->remove(inst);
+      mbb1->insert(cursor, inst);
       inst->bundleWithSucc();
+      cursor = std::next(MachineBasicBlock::iterator(inst));
     }else{
-#endif
-      mbb1->insertAfter(bundleWith, inst);
-#ifdef DO_BUNDLE
+      // One of the two is issued alone. Pick the one whose successor can
+      // be paired with the other, if any.
+      auto next1 = std::next(cursor);
+      auto next2 = std::next(mbb2->begin());
+      if( (next1 == mbb1End || getBundleSlot(&(*next1), inst) < 0) &&
+          next2 != mbb2End && getBundleSlot(&(*cursor), &(*next2)) >= 0
+      ){
+        mbb1->splice(cursor, mbb2, mbb2->begin());
+      }else{
+        cursor = next1;
+      }
     }
-#endif
+  }
+
+  // Whatever is left of mbb2 is issued alone
+  while(mbb2->begin() != mbb2End){
+    mbb1->splice(mbb1End, mbb2, mbb2->begin());
+  }
+
+  // Only terminators left
+  while(mbb2->instr_begin() != mbb2->instr_end()){
+    auto inst = &(*mbb2->instr_begin());
+    mbb2->remove(inst);
+    mbb1->insert(mbb1->instr_end(), inst);
+  }
+}
+
+namespace {
+  /// Node of the dependence graph of a block to be merged.
+  struct PairingNode {
+    /// A single instruction, or a bundle formed by an earlier merge.
+    SmallVector<MachineInstr*, 2> Instrs;
+    SmallVector<std::pair<unsigned, unsigned>, 4> Succs;
+    unsigned NumPreds = 0;
+    unsigned Height = 0;
+    bool Done = false;
   };
+}
 
-  auto moveNextInstruction = [&](unsigned movedInstructions){
-    auto mbb1next = mbb1->instr_begin();
-    for(int i = 0; i<movedInstructions; i++){
-      // We advance by 2, because we have already inserted some instructions from mbb2
-      mbb1next++;
-      mbb1next++;
+/// Builds the dependence graph of the non-terminators of the block.
+/// Instructions that cannot be moved are ordered with all others.
+static std::vector<PairingNode> buildPairingDAG(MachineBasicBlock *mbb,
+                                                const PatmosInstrInfo *TII,
+                                                const TargetRegisterInfo *TRI,
+                                                const InstrItineraryData *Itins)
+{
+  std::vector<PairingNode> nodes;
+  for(auto iter = mbb->begin(), end = mbb->getFirstTerminator();
+      iter != end; iter++){
+    PairingNode node;
+    auto mi = iter.getInstrIterator();
+    do {
+      node.Instrs.push_back(&(*mi));
+    } while ((mi++)->isBundledWithSucc());
+    nodes.push_back(node);
+  }
+
+  auto addEdge = [&](unsigned from, unsigned to, unsigned latency){
+    if (from == to) return;
+    nodes[from].Succs.push_back(std::make_pair(to, latency));
+    nodes[to].NumPreds++;
+  };
+
+  struct RegDef { unsigned node; const MachineInstr *mi; unsigned opIdx; };
+  DenseMap<unsigned, RegDef> defs;
+  DenseMap<unsigned, SmallVector<unsigned, 4>> uses;
+  SmallVector<unsigned, 8> loads, sinceBarrier;
+  int lastStore = -1, lastBarrier = -1;
+
+  for(unsigned n = 0; n < nodes.size(); n++){
+    bool isBarrier = false, isStore = false, isLoad = false;
+    for (auto mi : nodes[n].Instrs) {
+      isBarrier |= mi->isInlineAsm() || mi->isCall() || mi->isLabel() ||
+                   mi->isCFIInstruction() || TII->isStackControl(mi) ||
+                   mi->hasUnmodeledSideEffects();
+      isStore |= mi->mayStore() || (mi->mayLoad() && mi->hasOrderedMemoryRef());
+      isLoad |= mi->mayLoad();
+    }
+
+    if (isBarrier) {
+      for (auto pred : sinceBarrier) addEdge(pred, n, 0);
+      if (lastBarrier >= 0) addEdge(lastBarrier, n, 0);
+      sinceBarrier.clear();
+      lastBarrier = n;
+    } else {
+      if (lastBarrier >= 0) addEdge(lastBarrier, n, 0);
+      sinceBarrier.push_back(n);
+    }
+
+    if (isStore) {
+      if (lastStore >= 0) addEdge(lastStore, n, 1);
+      for (auto load : loads) addEdge(load, n, 0);
+      loads.clear();
+      lastStore = n;
+    } else if (isLoad) {
+      if (lastStore >= 0) addEdge(lastStore, n, 1);
+      loads.push_back(n);
+    }
+
+    for (auto mi : nodes[n].Instrs) {
+      for(unsigned i = 0; i < mi->getNumOperands(); i++){
+        const MachineOperand &mo = mi->getOperand(i);
+        if (!mo.isReg() || !mo.getReg() || !mo.isUse()) continue;
+        for (MCRegUnitIterator ru(mo.getReg(), TRI); ru.isValid(); ++ru) {
+          auto def = defs.find(*ru);
+          if (def != defs.end()) {
+            int latency = TII->getOperandLatency(Itins, *def->second.mi,
+                                                 def->second.opIdx, *mi, i);
+            addEdge(def->second.node, n, std::max(latency, 1));
+          }
+          // Keep the kill flags valid, all other uses stay in front of a kill
+          if (mo.isKill()) {
+            for (auto use : uses[*ru]) addEdge(use, n, 0);
+          }
+          uses[*ru].push_back(n);
+        }
+      }
+    }
+
+    // Bundles may define a register in both slots under disjoint predicates
+    SmallVector<std::pair<unsigned, RegDef>, 4> newDefs;
+    for (auto mi : nodes[n].Instrs) {
+      for(unsigned i = 0; i < mi->getNumOperands(); i++){
+        const MachineOperand &mo = mi->getOperand(i);
+        if (!mo.isReg() || !mo.getReg() || !mo.isDef()) continue;
+        for (MCRegUnitIterator ru(mo.getReg(), TRI); ru.isValid(); ++ru) {
+          for (auto use : uses[*ru]) addEdge(use, n, 0);
+          uses[*ru].clear();
+          auto def = defs.find(*ru);
+          if (def != defs.end()) addEdge(def->second.node, n, 1);
+          newDefs.push_back(std::make_pair(*ru, RegDef{n, mi, i}));
+        }
+      }
     }
-    moveInstruction(mbb1next);
+    for (auto &def : newDefs) {
+      defs[def.first] = def.second;
+    }
+  }
+
+  for(unsigned n = nodes.size(); n-- > 0; ){
+    for (auto &succ : nodes[n].Succs) {
+      nodes[n].Height = std::max(nodes[n].Height,
+                                 succ.second + nodes[succ.first].Height);
+    }
+  }
+  return nodes;
+}
+
+void PatmosSPBundling::mergeMBBsByDependence(MachineBasicBlock *mbb1,
+                                             MachineBasicBlock *mbb2)
+{
+  const InstrItineraryData *itins = STC.getInstrItineraryData();
+  std::vector<PairingNode> nodes[2] = {
+    buildPairingDAG(mbb1, TII, TRI, itins),
+    buildPairingDAG(mbb2, TII, TRI, itins)
   };
-  int nrMbb1Instrs = numberOfInstructions(mbb1);
-  if (nrMbb1Instrs > numberOfInstructions(mbb2)) {
-    for(auto movedInstructions = 0;
-        mbb2->instr_begin() != mbb2->getFirstInstrTerminator();
-        movedInstructions++)
-    {
-      moveNextInstruction(movedInstructions);
+  unsigned first[2] = {0, 0};
+  unsigned remaining[2] = {(unsigned) nodes[0].size(),
+                           (unsigned) nodes[1].size()};
+
+  // Take the instructions out, they are reinserted in schedule order.
+  for (auto &block : nodes) {
+    for (auto &node : block) {
+      for (auto mi : node.Instrs)
+        mi->getParent()->remove_instr(mi);
     }
-  }else{
-    for(auto movedInstructions = 0;
-        movedInstructions < nrMbb1Instrs;
-        movedInstructions++)
-    {
-      moveNextInstruction(movedInstructions);
+  }
+
+  auto insertPoint = mbb1->getFirstInstrTerminator();
+  auto insertNode = [&](PairingNode &node, bool bundleWithPred){
+    for (auto mi : node.Instrs) {
+      mbb1->insert(insertPoint, mi);
+      if (bundleWithPred) mi->bundleWithPred();
+      bundleWithPred = true;
     }
+  };
 
-    while(mbb2->instr_begin() != mbb2->getFirstInstrTerminator()){
-      auto inst = &(*mbb2->instr_begin());
-      mbb2->remove(inst);
-      mbb1->insert(mbb1->getFirstInstrTerminator(), inst);
+  // The ready nodes among the next unscheduled nodes of a block.
+  auto getCandidates = [&](unsigned b, SmallVectorImpl<unsigned> &candidates){
+    auto &block = nodes[b];
+    while (first[b] < block.size() && block[first[b]].Done) first[b]++;
+    unsigned seen = 0;
+    for (unsigned n = first[b]; n < block.size() && seen < PairingWindow; n++) {
+      if (block[n].Done) continue;
+      seen++;
+      if (block[n].NumPreds == 0) candidates.push_back(n);
+    }
+  };
+
+  auto release = [&](unsigned b, unsigned n){
+    auto &node = nodes[b][n];
+    node.Done = true;
+    remaining[b]--;
+    for (auto &succ : node.Succs) nodes[b][succ.first].NumPreds--;
+  };
+
+  while (remaining[0] || remaining[1]) {
+    SmallVector<unsigned, PairingWindow> candidates[2];
+    getCandidates(0, candidates[0]);
+    getCandidates(1, candidates[1]);
+
+    // Find the pair with the longest paths below them
+    int best1 = -1, best2 = -1, bestSlot = -1;
+    unsigned bestHeight = 0;
+    if (!candidates[0].empty() && !candidates[1].empty()) {
+      InstPairsTried++;
+      for (auto n1 : candidates[0]) {
+        if (nodes[0][n1].Instrs.size() > 1) continue;
+        for (auto n2 : candidates[1]) {
+          if (nodes[1][n2].Instrs.size() > 1) continue;
+          int slot = getBundleSlot(nodes[0][n1].Instrs.front(),
+                                   nodes[1][n2].Instrs.front());
+          unsigned height = nodes[0][n1].Height + nodes[1][n2].Height;
+          if (slot >= 0 && (best1 < 0 || height > bestHeight)) {
+            best1 = n1; best2 = n2; bestSlot = slot; bestHeight = height;
+          }
+        }
+      }
     }
+
+    if (best1 >= 0) {
+      if (bestSlot == 1) {
+        InstPairsSuccess++;
+        insertNode(nodes[0][best1], false);
+        insertNode(nodes[1][best2], true);
+      } else {
+        InstPairsSwitched++;
+        insertNode(nodes[1][best2], false);
+        insertNode(nodes[0][best1], true);
+      }
+      release(0, best1);
+      release(1, best2);
+      continue;
+    }
+
+    // Nothing can be paired, issue the most critical instruction alone,
+    // preferring the block with more work left.
+    unsigned block = remaining[0] >= remaining[1] ? 0 : 1;
+    if (candidates[block].empty()) block = 1 - block;
+    unsigned single = candidates[block].front();
+    for (auto n : candidates[block]) {
+      if (nodes[block][n].Height > nodes[block][single].Height) single = n;
+    }
+    insertNode(nodes[block][single], false);
+    release(block, single);
   }
 
   // Only terminators left
@@ -132,54 +409,184 @@ void PatmosSPBundling::mergeMBBs(MachineBasicBlock *mbb1, MachineBasicBlock *mbb
   }
 }
 
-std::pair<bool, std::pair<PredicatedBlock*,PredicatedBlock*>> PatmosSPBundling::findMergePair(const SPScope* scope){
-  for(auto block: scope->getScopeBlocks()){
-    LLVM_DEBUG(dbgs() << "Looking for merge pair at: #" << block->getMBB()->getNumber() << "\n");
-    auto mbb = block->getMBB();
-    auto succs = block->getSuccessors();
-    auto exits = block->getExitTargets();
+/// Merge state of a scope, indexed by the position of the blocks in the
+/// topological order of the scope when the bundling of the scope started.
+struct PatmosSPBundling::MergeState {
+  std::vector<PredicatedBlock*> Blocks;
+  DenseMap<const PredicatedBlock*, unsigned> Index;
+  /// The blocks each block reaches, and the blocks reaching each block.
+  std::vector<BitVector> Reaches, ReachedBy;
+  /// The blocks of the scope itself with instructions to merge.
+  BitVector Candidates;
+  /// The number of non-terminator bundles or instructions of each block.
+  std::vector<unsigned> Sizes;
+};
+
+/// Returns the number of issue groups before the terminators of the block.
+static unsigned getMergeSize(const PredicatedBlock *block) {
+  auto mbb = block->getMBB();
+  return std::distance(mbb->begin(), mbb->getFirstTerminator());
+}
 
-    // Remove any exit targets
-    for (auto iter = succs.begin(), last = succs.end(); iter != last; ) {
-      auto succ = (*iter).first;
-      if (std::count(exits.begin(), exits.end(), succ)) {
-        iter = succs.erase(iter);
-      } else {
-        iter++;
+void PatmosSPBundling::initMergeState(const SPScope* scope, MergeState &state){
+  // Two blocks of the scope are never executed in the same iteration if
+  // neither reaches the other, their instructions can then share bundles.
+  // Subscopes are represented by their headers, with the exits of the
+  // subscope as successors.
+  auto &blocks = scope->getBlocksTopoOrd();
+  unsigned n = blocks.size();
+  state.Blocks.assign(blocks.begin(), blocks.end());
+  state.Index.clear();
+  for(unsigned i = 0; i < n; i++){
+    state.Index[blocks[i]] = i;
+  }
+
+  state.Reaches.assign(n, BitVector(n));
+  for(unsigned i = n; i-- > 0; ){
+    std::vector<const PredicatedBlock*> succs;
+    if(scope->isSubheader(blocks[i])){
+      auto &exits = scope->findScopeOf(blocks[i])->getSucceedingBlocks();
+      succs.insert(succs.end(), exits.begin(), exits.end());
+    }else{
+      for(auto succ: blocks[i]->getSuccessors()){
+        succs.push_back(succ.first);
       }
     }
 
-    for(auto iter1 = succs.begin(), end = succs.end(); iter1 != end; iter1++){
-      auto b1 = (PredicatedBlock*) (*iter1).first;
-      if(b1->bundled()) continue;
+    for(auto succ: succs){
+      auto found = state.Index.find(succ);
+      // Skip edges leaving the scope and the back edge to the header
+      if(found == state.Index.end() || found->second <= i) continue;
+      state.Reaches[i].set(found->second);
+      state.Reaches[i] |= state.Reaches[found->second];
+    }
+  }
 
-      for(auto iter2 = std::next(iter1); iter2 != end; iter2++){
-        PairsTried++;
-        auto b2 = (PredicatedBlock*) (*iter2).first;
+  state.ReachedBy.assign(n, BitVector(n));
+  for(unsigned i = 0; i < n; i++){
+    for(unsigned j : state.Reaches[i].set_bits()){
+      state.ReachedBy[j].set(i);
+    }
+  }
 
-        if( scope->isHeader(b1) || scope->isHeader(b2) ||
-            scope->isSubheader(b1) || scope->isSubheader(b2) ||
-            PostDom->dominates(b1->getMBB(), b2->getMBB()) ||
-            PostDom->dominates(b2->getMBB(), b1->getMBB())
-        ){
-          continue;
-        }
+  // Only the blocks of the scope itself are merged, not those of subscopes
+  state.Candidates = BitVector(n);
+  state.Sizes.assign(n, 0);
+  for(unsigned i = 0; i < n; i++){
+    auto block = blocks[i];
+    if(scope->isHeader(block) || scope->isSubheader(block) ||
+       block->getSuccessors().size() == 0)
+    {
+      continue;
+    }
+    state.Sizes[i] = getMergeSize(block);
+    if(state.Sizes[i] > 0){
+      state.Candidates.set(i);
+    }
+  }
+}
 
-        if(!( scope->isSubheader(b1) || scope->isSubheader(b2) || 
-              b1->getSuccessors().size() == 0 || b2->getSuccessors().size() == 0 ||
-              b1->bundledMBBs().size()>0 || b2->bundledMBBs().size()>0
-        )){
-          return std::make_pair(true, std::make_pair(b1, b2));
-        }
-      }
+void PatmosSPBundling::updateMergeState(MergeState &state, unsigned into,
+                                        unsigned from){
+  // The merged block is reached by the blocks reaching either block and
+  // reaches the blocks either block reaches. The two blocks did not reach
+  // each other, so the merge does not form a cycle.
+  state.Reaches[into] |= state.Reaches[from];
+  state.ReachedBy[into] |= state.ReachedBy[from];
+  for(unsigned k : state.ReachedBy[into].set_bits()){
+    state.Reaches[k] |= state.Reaches[into];
+    state.Reaches[k].set(into);
+    state.Reaches[k].reset(from);
+  }
+  for(unsigned k : state.Reaches[into].set_bits()){
+    state.ReachedBy[k] |= state.ReachedBy[into];
+    state.ReachedBy[k].set(into);
+    state.ReachedBy[k].reset(from);
+  }
+  state.Reaches[from].reset();
+  state.ReachedBy[from].reset();
+
+  state.Candidates.reset(from);
+  state.Sizes[from] = 0;
+  state.Sizes[into] = getMergeSize(state.Blocks[into]);
+}
+
+std::pair<bool, std::pair<PredicatedBlock*,PredicatedBlock*>>
+PatmosSPBundling::findMergePair(const SPScope* scope, MergeState &state){
+  // Merge the pair that can save the most cycles, i.e., whose smaller block
+  // is the largest. The candidates are visited by decreasing size, the
+  // first one with an independent candidate at least as large gives the
+  // size of the best pair.
+  std::vector<unsigned> bySize;
+  for(unsigned i : state.Candidates.set_bits()){
+    bySize.push_back(i);
+  }
+  std::stable_sort(bySize.begin(), bySize.end(), [&](unsigned a, unsigned b){
+    return state.Sizes[a] > state.Sizes[b];
+  });
+
+  unsigned n = state.Blocks.size();
+  BitVector larger(n), partners(n);
+  unsigned bestSize = 0;
+  for(unsigned c = 0; c < bySize.size() && !bestSize; ){
+    // add all candidates of the same size
+    unsigned size = state.Sizes[bySize[c]], group = c;
+    for(; c < bySize.size() && state.Sizes[bySize[c]] == size; c++){
+      larger.set(bySize[c]);
+    }
+    for(; group < c && !bestSize; group++){
+      unsigned i = bySize[group];
+      partners = larger;
+      partners.reset(state.Reaches[i]);
+      partners.reset(state.ReachedBy[i]);
+      partners.reset(i);
+      PairsTried++;
+      if(partners.any()) bestSize = size;
     }
   }
-  return std::make_pair(false, std::make_pair((PredicatedBlock*)NULL, (PredicatedBlock*)NULL));
+
+  if(!bestSize){
+    return std::make_pair(false, std::make_pair((PredicatedBlock*)NULL, (PredicatedBlock*)NULL));
+  }
+
+  // On ties, the pair deepest in the scope is merged first, so nested
+  // branches are merged bottom-up: the pair with the last first block,
+  // and among those the last second block.
+  int best1 = -1, best2 = -1;
+  for(int i = larger.find_last(); i >= 0 && best1 < 0;
+      i = larger.find_prev(i)){
+    partners = larger;
+    partners.reset(state.Reaches[i]);
+    partners.reset(state.ReachedBy[i]);
+    int last = partners.find_last();
+    // the smaller block of the pair must have the size of the best pair
+    while(last > i && state.Sizes[i] != bestSize &&
+          state.Sizes[last] != bestSize){
+      last = partners.find_prev(last);
+    }
+    if(last > i){
+      best1 = i; best2 = last;
+    }
+  }
+  assert(best1 >= 0 && "No pair of the best size");
+
+  auto &blocks = state.Blocks;
+  LLVM_DEBUG(dbgs() << "Found merge pair: (#" << blocks[best1]->getMBB()->getNumber()
+                    << ", #" << blocks[best2]->getMBB()->getNumber() << ")\n");
+  return std::make_pair(true, std::make_pair(blocks[best1], blocks[best2]));
 }
 
 void PatmosSPBundling::bundleScope(SPScope* root){
+  // Bundle inner loops first
+  std::for_each(root->child_begin(), root->child_end(), [&](auto subscope){
+    this->bundleScope(subscope);
+  });
+
+  MergeState state;
+  initMergeState(root, state);
+
   std::pair<bool, std::pair<PredicatedBlock*,PredicatedBlock*>> mergePair;
-  while( (mergePair = findMergePair(root)).first ){
+  while( (mergePair = findMergePair(root, state)).first ){
     PairsSuccess++;
 
     auto destination = mergePair.second.first;
@@ -187,9 +594,16 @@ void PatmosSPBundling::bundleScope(SPScope* root){
 
     LLVM_DEBUG(dbgs() << "Merge pair: (#" << destination->getMBB()->getNumber() << ", #" << source->getMBB()->getNumber() << ")\n");
 
-    mergeMBBs(destination->getMBB(), source->getMBB());
-
     auto mbb1 = destination->getMBB(), mbb2 = source->getMBB();
+    unsigned pairsBefore = countPairs(mbb1).first + countPairs(mbb2).first;
+
+    {
+      PatmosPhaseScope T("sp-bundling-merge", "Single-Path Block Pairing",
+                         mbb1->getParent()->getName());
+      mergeMBBs(mbb1, mbb2);
+    }
+    emitPairingRemark(mbb1, mbb2->getNumber(), pairsBefore);
+
     auto func = mbb2->getParent();
 
     // Replace the use of the discarded MBB with the other
@@ -206,11 +620,8 @@ void PatmosSPBundling::bundleScope(SPScope* root){
 
     // Merge the two PredicatedBlocks into one
     root->merge(destination, source);
+    updateMergeState(state, state.Index[destination], state.Index[source]);
   }
-
-  std::for_each(root->child_begin(), root->child_end(), [&](auto subscope){
-    this->bundleScope(subscope);
-  });
 }
 
 void PatmosSPBundling::doBundlingFunction(SPScope* root) {
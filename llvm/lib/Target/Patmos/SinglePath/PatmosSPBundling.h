@@ -6,8 +6,8 @@
 #include "PatmosSinglePathInfo.h"
 #include "PatmosTargetMachine.h"
 #include "PatmosSinglePathInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/IR/Metadata.h"
-#include "llvm/CodeGen/MachinePostDominators.h"
 
 #define DEBUG_TYPE "patmos-singlepath"
 
@@ -24,7 +24,7 @@ private:
 
   PatmosSinglePathInfo *PSPI;
 
-  MachinePostDominatorTree *PostDom;
+  MachineOptimizationRemarkEmitter *ORE;
 
   /// doBundlingFunction - Bundle a given MachineFunction
   void doBundlingFunction(SPScope* root);
@@ -35,7 +35,8 @@ public:
        MachineFunctionPass(ID), TM(tm),
        STC(*tm.getSubtargetImpl()),
        TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())),
-       TRI(static_cast<const PatmosRegisterInfo*>(tm.getRegisterInfo()))
+       TRI(static_cast<const PatmosRegisterInfo*>(tm.getRegisterInfo())),
+       PSPI(nullptr), ORE(nullptr)
   {}
 
   /// getPassName - Return the pass' name.
@@ -46,7 +47,9 @@ public:
   /// getAnalysisUsage - Specify which passes this pass depends on
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<PatmosSinglePathInfo>();
-    AU.addRequired<MachinePostDominatorTree>();
+    // Merged blocks are merged in the SPScope tree too
+    AU.addPreserved<PatmosSinglePathInfo>();
+    AU.addRequired<MachineOptimizationRemarkEmitterPass>();
     MachineFunctionPass::getAnalysisUsage(AU);
   }
 
@@ -60,19 +63,51 @@ public:
 
   bool runOnMachineFunction(MachineFunction &MF) override ;
 
-  SPScope* getRootScope(){
-    return PSPI->getRootScope();
-  }
+  /// The reachability among the blocks of a scope, built once per scope
+  /// and updated whenever two of its blocks are merged.
+  struct MergeState;
+
+  /// Builds the merge state of the blocks of the given scope.
+  void initMergeState(const SPScope*, MergeState &state);
+
+  /// Updates the merge state after the block at index 'from' was merged
+  /// into the block at index 'into'.
+  void updateMergeState(MergeState &state, unsigned into, unsigned from);
 
   /// Tries to find a pair of blocks to merge.
+  /// Any two blocks of the scope that are never executed in the same
+  /// iteration of the scope can be merged, not only siblings.
   ///
   /// If a pair is found, true is returned with the pair of blocks found.
   /// If no pair is found, false is returned with a pair of NULLs.
   std::pair<bool, std::pair<PredicatedBlock*,PredicatedBlock*>>
-  findMergePair(const SPScope*);
+  findMergePair(const SPScope*, MergeState &state);
 
+  /// Interleaves the instructions of mbb2 into mbb1, bundling instructions
+  /// of the two blocks where possible. mbb2 is left empty.
+  /// Both blocks are traversed only once.
   void mergeMBBs(MachineBasicBlock *mbb1, MachineBasicBlock *mbb2);
 
+  /// Merges mbb2 into mbb1 like mergeMBBs, but reorders the instructions
+  /// within each block along their dependencies to find more pairs.
+  void mergeMBBsByDependence(MachineBasicBlock *mbb1, MachineBasicBlock *mbb2);
+
+  /// Emits a remark on the pairs formed by merging block number mbb2 into
+  /// mbb1 and the instructions that remained unpaired.
+  /// pairsBefore is the number of pairs both blocks held before the merge.
+  void emitPairingRemark(MachineBasicBlock *mbb1, int mbb2,
+                         unsigned pairsBefore);
+
+  /// Returns true if the instruction may be bundled with an instruction of
+  /// the other block.
+  bool canBundle(const MachineInstr *mi) const;
+
+  /// Returns the slot mi2 can be issued in when bundled with mi1,
+  /// or -1 if the two cannot be bundled.
+  int getBundleSlot(const MachineInstr *mi1, const MachineInstr *mi2) const;
+
+  /// Merges blocks in the given scope and all its subscopes, innermost
+  /// scopes first.
   void bundleScope(SPScope* root);
 };
 
@@ -19,15 +19,28 @@
 // The calls inserted by lowering and unnecessarily cloned functions are
 // rewritten and removed, respectively, in the PatmosSPMark pass.
 //
+// Optionally, reachable functions that are already free of branches and
+// side effects are not cloned. They execute in constant time, and running
+// them unconditionally does not change the state of the caller, so they
+// are called as is from single-path code and marked with "sp-shared".
+//
+// Finally, small callees are inlined into their single-path callers. The
+// normal inliner has already run, but did not know that each single-path
+// call costs the full call/return and stack cache reserve/free overhead.
+// Inlining is refused where the caller would outgrow the method cache.
+//
 //===----------------------------------------------------------------------===//
 
 
 #include "PatmosSinglePathInfo.h"
+#include "PatmosTargetMachine.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/SmallSet.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Pass.h"
@@ -47,6 +60,26 @@ STATISTIC(NumSPReachable, "Number of functions marked as single-path "
                           "reachable from roots");
 STATISTIC(NumSPUsed,      "Number of functions marked as single-path "
                           "because of <used> attribute");
+STATISTIC(NumSPShared,    "Number of branch-free functions called from "
+                          "single-path code without cloning");
+STATISTIC(NumSPInlined,   "Number of calls inlined into single-path code");
+STATISTIC(NumSPInlineMC,  "Number of single-path inlinings refused due to "
+                          "the method cache size");
+
+static cl::opt<bool> EnableSPShare("mpatmos-sp-share-branchfree",
+  cl::init(false),
+  cl::desc("Call branch-free functions without side effects from "
+           "single-path code instead of cloning them."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SPInlineThreshold("mpatmos-sp-inline-threshold",
+  cl::init(16),
+  cl::desc("Inline loop-free single-path callees with at most this many "
+           "instructions (0 disables single-path inlining)."),
+  cl::Hidden);
+
+/// Estimated code size of a bitcode instruction, in bytes.
+static const unsigned InstrBytes = 4;
 
 namespace {
 
@@ -61,6 +94,8 @@ private:
   typedef std::deque<Function*> Worklist;
   typedef std::map<Function*, Function*> FunctionSPMap;
 
+  const PatmosTargetMachine &TM;
+
   /// Set of function names as roots
   std::set<StringRef> SPRoots;
 
@@ -71,6 +106,10 @@ private:
   /// Used to detect cycles in the call graph.
   std::set<Function*> ExploreFinished;
 
+  /// The explored functions, in the order they were finished.
+  /// Callees therefore precede their callers.
+  std::vector<Function*> ExploreOrder;
+
   void loadFromGlobalVariable(SmallSet<StringRef, 32> &Result,
                               const GlobalVariable *GV) const;
 
@@ -84,6 +123,32 @@ private:
    */
   Function *cloneAndMark(Function *F, bool onlyMaybe=false);
 
+  /**
+   * Check whether F can be called from single-path code without being
+   * converted, i.e., it has a single path through straight-line code,
+   * does not call other functions and does not write to memory.
+   * Operations that are lowered to library calls are rejected.
+   */
+  bool isBranchFree(const Function *F) const;
+
+  /**
+   * Marks F as "sp-shared", making it its own single-path version.
+   * @return F
+   */
+  Function *share(Function *F);
+
+  /**
+   * Check whether calls to F from single-path code may be inlined.
+   */
+  bool isInlineCandidate(const Function *F) const;
+
+  /**
+   * Inline small callees into the single-path functions, callees first.
+   * Clones that are no longer called afterwards are removed, unless they
+   * are in 'used', as calls to these may still be inserted in lowering.
+   */
+  void inlineSmallCallees(const SmallSet<StringRef, 32> &used);
+
   /**
    * Iterate through all instructions of F.
    * Explore callees of F and rewrite the calls.
@@ -100,7 +165,7 @@ private:
 public:
   static char ID; // Pass identification, replacement for typeid
 
-  PatmosSPClone() : ModulePass(ID) {}
+  PatmosSPClone(const PatmosTargetMachine &tm) : ModulePass(ID), TM(tm) {}
 
   /// getPassName - Return the pass' name.
   StringRef getPassName() const override{
@@ -117,8 +182,8 @@ public:
 char PatmosSPClone::ID = 0;
 
 
-ModulePass *llvm::createPatmosSPClonePass() {
-  return new PatmosSPClone();
+ModulePass *llvm::createPatmosSPClonePass(const PatmosTargetMachine &tm) {
+  return new PatmosSPClone(tm);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -183,6 +248,10 @@ bool PatmosSPClone::runOnModule(Module &M) {
       continue;
     }
   }
+
+  if (SPInlineThreshold > 0) {
+    inlineSmallCallees(used);
+  }
   return (NumSPRoots + NumSPReachable + NumSPUsed) > 0;
 }
 
@@ -249,6 +318,69 @@ Function *PatmosSPClone::cloneAndMark(Function *F, bool onlyMaybe) {
 }
 
 
+bool PatmosSPClone::isBranchFree(const Function *F) const {
+  if (F->isDeclaration() || F->isVarArg() ||
+      F->hasFnAttribute("sp-root")) {
+    return false;
+  }
+
+  // Division, floating point and wide integer arithmetic are
+  // implemented in the runtime library, with branches.
+  auto isLibType = [](const Type *T){
+    return T->isFloatingPointTy() || T->isVectorTy() ||
+           (T->isIntegerTy() && T->getIntegerBitWidth() > 32);
+  };
+
+  // Follow the unconditional control flow from the entry to the return
+  std::set<const BasicBlock*> visited;
+  for (const BasicBlock *BB = &F->getEntryBlock(); BB;
+       BB = BB->getSingleSuccessor()) {
+    if (!visited.insert(BB).second) return false; // loop
+
+    const Instruction *Term = BB->getTerminator();
+    if (!isa<ReturnInst>(Term) &&
+        !(isa<BranchInst>(Term) && cast<BranchInst>(Term)->isUnconditional())) {
+      return false;
+    }
+
+    for (const Instruction &I : *BB) {
+      if (isa<DbgInfoIntrinsic>(I) || I.isLifetimeStartOrEnd()) continue;
+
+      if (isa<CallBase>(I) || I.mayWriteToMemory() || I.isAtomic() ||
+          I.isVolatile()) {
+        return false;
+      }
+      if (auto AI = dyn_cast<AllocaInst>(&I)) {
+        if (!AI->isStaticAlloca()) return false;
+      }
+      switch (I.getOpcode()) {
+        case Instruction::UDiv: case Instruction::SDiv:
+        case Instruction::URem: case Instruction::SRem:
+          return false;
+      }
+      if (isLibType(I.getType()) ||
+          std::any_of(I.op_begin(), I.op_end(),
+                      [&](const Use &U){ return isLibType(U->getType()); })) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+Function *PatmosSPClone::share(Function *F) {
+  F->addFnAttr("sp-shared");
+  LLVM_DEBUG( dbgs() << "  Share function: " << F->getName() << "\n");
+  NumSPShared++; // STATISTIC
+
+  ClonedFunctions.insert(std::make_pair(F, F));
+  ExploreFinished.insert(F);
+
+  return F;
+}
+
+
 void PatmosSPClone::explore(Function *F, bool fromUsed) {
   for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
       CallInst *Call = dyn_cast<CallInst>(&*I);
@@ -266,10 +398,15 @@ void PatmosSPClone::explore(Function *F, bool fromUsed) {
 
         Function *SPCallee;
         if (!ClonedFunctions.count(Callee)) {
-          // clone function
-          SPCallee = cloneAndMark(Callee, fromUsed);
-          // recurse into callee
-          explore(SPCallee, fromUsed);
+          if (EnableSPShare && !fromUsed && isBranchFree(Callee)) {
+            // no callees to explore
+            SPCallee = share(Callee);
+          } else {
+            // clone function
+            SPCallee = cloneAndMark(Callee, fromUsed);
+            // recurse into callee
+            explore(SPCallee, fromUsed);
+          }
         } else {
           // lookup
           SPCallee = ClonedFunctions.at(Callee);
@@ -286,4 +423,94 @@ void PatmosSPClone::explore(Function *F, bool fromUsed) {
       }
   }
   ExploreFinished.insert(F);
+  ExploreOrder.push_back(F);
+}
+
+
+/// Returns the number of instructions of F, ignoring debug info.
+static unsigned getSizeEstimate(const Function *F) {
+  unsigned size = 0;
+  for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+    if (!isa<DbgInfoIntrinsic>(&*I)) size++;
+  }
+  return size;
+}
+
+bool PatmosSPClone::isInlineCandidate(const Function *F) const {
+  if (F->isDeclaration() || F->isVarArg() ||
+      F->hasFnAttribute(Attribute::NoInline) ||
+      F->hasFnAttribute("sp-root") ||
+      !(PatmosSinglePathInfo::isReachable(*F) ||
+        PatmosSinglePathInfo::isShared(*F))) {
+    return false;
+  }
+  if (getSizeEstimate(F) > SPInlineThreshold) return false;
+
+  // Loops in the callee would need their bounds in the caller
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 4> backedges;
+  FindFunctionBackedges(*F, backedges);
+  return backedges.empty();
+}
+
+void PatmosSPClone::inlineSmallCallees(const SmallSet<StringRef, 32> &used) {
+  unsigned cacheSize = TM.getSubtargetImpl()->getMethodCacheSize();
+
+  for (auto F : ExploreOrder) {
+    if (!PatmosSinglePathInfo::isRoot(*F) &&
+        !PatmosSinglePathInfo::isReachable(*F)) {
+      continue;
+    }
+
+    SmallVector<CallInst*, 8> calls;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+      CallInst *Call = dyn_cast<CallInst>(&*I);
+      if (Call && !Call->isInlineAsm() && Call->getCalledFunction() &&
+          Call->getCalledFunction() != F &&
+          isInlineCandidate(Call->getCalledFunction())) {
+        calls.push_back(Call);
+      }
+    }
+
+    unsigned size = getSizeEstimate(F);
+    for (auto Call : calls) {
+      Function *Callee = Call->getCalledFunction();
+      unsigned calleeSize = getSizeEstimate(Callee);
+      if ((size + calleeSize) * InstrBytes > cacheSize) {
+        LLVM_DEBUG( dbgs() << "  Not inlining " << Callee->getName()
+                      << " into " << F->getName()
+                      << ": exceeds method cache\n");
+        NumSPInlineMC++; // STATISTIC
+        continue;
+      }
+
+      InlineFunctionInfo IFI;
+      if (InlineFunction(*Call, IFI).isSuccess()) {
+        LLVM_DEBUG( dbgs() << "  Inline " << Callee->getName()
+                      << " into " << F->getName() << "\n");
+        size += calleeSize;
+        NumSPInlined++; // STATISTIC
+      }
+    }
+  }
+
+  // Remove clones that became unreachable. Removing a clone may leave
+  // the clones it calls unreachable too.
+  bool changed;
+  do {
+    changed = false;
+    for (auto I = ClonedFunctions.begin(); I != ClonedFunctions.end();) {
+      Function *SPF = I->second;
+      if (SPF != I->first && SPF->use_empty() &&
+          PatmosSinglePathInfo::isReachable(*SPF) &&
+          !used.count(I->first->getName())) {
+        LLVM_DEBUG( dbgs() << "  Remove inlined clone: " << SPF->getName()
+                      << "\n");
+        SPF->eraseFromParent();
+        I = ClonedFunctions.erase(I);
+        changed = true;
+      } else {
+        ++I;
+      }
+    }
+  } while (changed);
 }
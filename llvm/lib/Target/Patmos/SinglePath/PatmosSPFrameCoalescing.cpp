@@ -0,0 +1,525 @@
+//===-- PatmosSPFrameCoalescing.cpp - Coalesce single-path stack frames ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass merges the stack cache frames of single-path functions into the
+// frame of the single-path root they are called from.
+//
+// Every function reserves its stack cache frame in its prologue (SRES), frees
+// it in its epilogue (SFREE) and ensures it after each call (SENS). For
+// single-path code, which is never recursive, the frames of all callees can
+// instead be placed at fixed offsets within one frame reserved by the root:
+// the frame of a callee is placed above the frames of all its callers. The
+// root then reserves the whole frame at once, and the callees access their
+// objects at their offset relative to the stack top, without any stack
+// control instructions of their own. The stack cache costs of single-path
+// code thus no longer depend on the call depth.
+//
+// A function is coalesced only if all its callers are known and coalesced or
+// a root, it calls coalesced functions only, and its offsets still fit into
+// the immediates of its stack cache accesses. The module is expected to
+// contain all callers of single-path functions, as with whole-program
+// compilation.
+//
+// The pass runs after prologue/epilogue insertion, when the frame sizes are
+// known, and before the single-path reduction. Frame indices eliminated by
+// the reduction take the offset of the frame into account.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "MachineModulePass.h"
+#include "PatmosFrameLowering.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosMachineFunctionInfo.h"
+#include "PatmosSinglePathInfo.h"
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <set>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-singlepath"
+
+STATISTIC(NumSPFramesCoalesced, "Number of single-path frames coalesced");
+STATISTIC(NumSPSTCRemoved,      "Number of single-path stack control "
+                                "instructions removed");
+
+static cl::opt<bool> EnableSPFrameCoalescing("mpatmos-sp-coalesce-frames",
+  cl::init(false),
+  cl::desc("Coalesce the stack cache frames of single-path functions into "
+           "the frame of their root (assumes whole-program compilation)."),
+  cl::Hidden);
+
+// anonymous namespace
+namespace {
+
+  /// A single-path function in the call graph.
+  struct SPFrameNode {
+    MachineFunction *MF = NULL;
+    /// Aligned size of the stack cache frame in bytes
+    unsigned Size = 0;
+    /// Offset of the frame relative to the stack top of the root
+    unsigned Base = 0;
+    bool IsRoot = false;
+    /// True as long as the frame may be coalesced
+    bool Coalesce = false;
+    /// True if the function contains calls to unknown functions
+    bool CallsUnknown = false;
+    std::set<const Function*> Callees;
+  };
+
+  class PatmosSPFrameCoalescing : public MachineModulePass {
+  private:
+    /// Pass ID
+    static char ID;
+
+    const PatmosTargetMachine &TM;
+    const PatmosInstrInfo *TII;
+    const PatmosFrameLowering *PFL;
+
+    /// All single-path functions of the module
+    std::map<const Function*, SPFrameNode> Nodes;
+
+    /// getCallTarget - Return the function called by MI, or NULL.
+    const Function *getCallTarget(const Module &M,
+                                  const MachineInstr &MI) const;
+
+    /// getStackAccessShift - Return the scaling of the immediate of a stack
+    /// cache access, or -1 if MI does not access the stack cache.
+    static int getStackAccessShift(const MachineInstr &MI);
+
+    /// canRebase - Check whether all stack cache accesses of MF can be moved
+    /// by Base bytes.
+    bool canRebase(MachineFunction &MF, unsigned Base) const;
+
+    /// collectNodes - Build the call graph of the single-path functions.
+    void collectNodes(const Module &M, MachineModuleInfo &MMI);
+
+    /// assignBases - Assign the frame offsets of all coalesced functions.
+    /// @return False if some function had to be excluded.
+    bool assignBases();
+
+    /// orderNodes - Append F and its coalesced callees to PostOrder.
+    /// Coalesced callees on a cycle are excluded.
+    /// @return False if some function had to be excluded.
+    bool orderNodes(const Function *F, std::set<const Function*> &Visited,
+                    std::set<const Function*> &OnStack,
+                    std::vector<const Function*> &PostOrder);
+
+    /// getReachable - Collect the coalesced functions called by F,
+    /// transitively.
+    void getReachable(const Function *F, std::set<const Function*> &R) const;
+
+    /// getTotalSize - Return the size of the coalesced frame of Root.
+    unsigned getTotalSize(const Function *Root) const;
+
+    /// insertSTC - Insert a stack control instruction before MI.
+    void insertSTC(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
+                   unsigned Opcode, unsigned Size) const;
+
+    /// rewriteFunction - Rewrite the stack cache accesses and control
+    /// instructions of a coalesced function or a root.
+    void rewriteFunction(const Module &M, SPFrameNode &N, unsigned Total);
+
+  public:
+    /// PatmosSPFrameCoalescing - Initialize with PatmosTargetMachine
+    PatmosSPFrameCoalescing(const PatmosTargetMachine &tm) :
+      MachineModulePass(ID), TM(tm),
+      TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())),
+      PFL(static_cast<const PatmosFrameLowering*>(
+                            tm.getSubtargetImpl()->getFrameLowering())) {}
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override {
+      return "Patmos Single-Path Frame Coalescing";
+    }
+
+    /// getAnalysisUsage - Specify which passes this pass depends on
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<MachineModuleInfoWrapperPass>();
+      AU.addPreserved<MachineModuleInfoWrapperPass>();
+      MachineModulePass::getAnalysisUsage(AU);
+    }
+
+    /// runOnMachineModule - Coalesce the frames of the module.
+    bool runOnMachineModule(const Module &M) override;
+  };
+
+  char PatmosSPFrameCoalescing::ID = 0;
+} // end of anonymous namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// createPatmosSPFrameCoalescingPass - Returns a new PatmosSPFrameCoalescing
+/// \see PatmosSPFrameCoalescing
+ModulePass *
+llvm::createPatmosSPFrameCoalescingPass(const PatmosTargetMachine &tm) {
+  return new PatmosSPFrameCoalescing(tm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosSPFrameCoalescing::runOnMachineModule(const Module &M) {
+  if (!EnableSPFrameCoalescing) return false;
+
+  auto &MMI = getAnalysis<MachineModuleInfoWrapperPass>().getMMI();
+
+  collectNodes(M, MMI);
+
+  // Excluding a function may exclude its callers, and changes the bases
+  while (!assignBases())
+    ;
+
+  bool changed = false;
+  for (auto &Entry : Nodes) {
+    SPFrameNode &N = Entry.second;
+    if (!N.IsRoot) continue;
+
+    std::set<const Function*> Reachable;
+    getReachable(Entry.first, Reachable);
+    if (Reachable.empty()) continue;
+
+    unsigned Total = getTotalSize(Entry.first);
+
+    LLVM_DEBUG( dbgs() << "[Single-Path] Coalesced frame of "
+                  << Entry.first->getName() << ": " << Total << " bytes\n");
+
+    rewriteFunction(M, N, Total);
+    changed = true;
+  }
+
+  for (auto &Entry : Nodes) {
+    SPFrameNode &N = Entry.second;
+    if (!N.Coalesce) continue;
+
+    LLVM_DEBUG( dbgs() << "  " << Entry.first->getName() << " at offset "
+                  << N.Base << ", " << N.Size << " bytes\n");
+
+    rewriteFunction(M, N, 0);
+    NumSPFramesCoalesced++; // STATISTIC
+  }
+
+  Nodes.clear();
+  return changed;
+}
+
+
+const Function *
+PatmosSPFrameCoalescing::getCallTarget(const Module &M,
+                                       const MachineInstr &MI) const {
+  if (MI.getNumOperands() < 3) return NULL;
+
+  const MachineOperand &MO = MI.getOperand(2);
+  if (MO.isGlobal()) {
+    return dyn_cast<Function>(MO.getGlobal());
+  } else if (MO.isSymbol()) {
+    return M.getFunction(MO.getSymbolName());
+  }
+  return NULL;
+}
+
+
+int PatmosSPFrameCoalescing::getStackAccessShift(const MachineInstr &MI) {
+  switch (MI.getOpcode()) {
+  case Patmos::LWS: case Patmos::SWS:
+    return 2;
+  case Patmos::LHS: case Patmos::LHUS: case Patmos::SHS:
+    return 1;
+  case Patmos::LBS: case Patmos::LBUS: case Patmos::SBS:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+
+bool PatmosSPFrameCoalescing::canRebase(MachineFunction &MF,
+                                        unsigned Base) const {
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB.instrs()) {
+      if (MI.isInlineAsm()) return false;
+
+      int Shift = getStackAccessShift(MI);
+      if (Shift < 0) continue;
+
+      unsigned Idx = MI.mayStore() ? 2 : 3;
+      const MachineOperand &BaseMO = MI.getOperand(Idx);
+      // Remaining frame indices are eliminated later, with the base
+      if (BaseMO.isFI()) continue;
+
+      // Large offsets are computed into a register, do not bother
+      if (!BaseMO.isReg() || BaseMO.getReg() != Patmos::R0) return false;
+
+      int64_t Imm = MI.getOperand(Idx + 1).getImm() + (Base >> Shift);
+      if (!isInt<7>(Imm)) return false;
+    }
+  }
+  return true;
+}
+
+
+void PatmosSPFrameCoalescing::collectNodes(const Module &M,
+                                           MachineModuleInfo &MMI) {
+  for (auto &F : M) {
+    if (F.isDeclaration()) continue;
+
+    MachineFunction *MF = MMI.getMachineFunction(F);
+    if (!MF || !PatmosSinglePathInfo::isConverting(*MF)) continue;
+
+    SPFrameNode &N = Nodes[&F];
+    N.MF = MF;
+    N.Size = PFL->getAlignedStackCacheFrameSize(
+        MF->getInfo<PatmosMachineFunctionInfo>()->getStackCacheReservedBytes());
+    N.IsRoot = PatmosSinglePathInfo::isRoot(*MF);
+    N.Coalesce = !N.IsRoot && !F.hasAddressTaken();
+
+    for (auto &MBB : *MF) {
+      for (auto &MI : MBB.instrs()) {
+        if (!MI.isCall()) continue;
+        const Function *Target = getCallTarget(M, MI);
+        if (Target) {
+          N.Callees.insert(Target);
+        } else {
+          N.CallsUnknown = true;
+        }
+      }
+    }
+  }
+
+  // All callers of a coalesced function must be single-path functions
+  for (auto &Entry : Nodes) {
+    SPFrameNode &N = Entry.second;
+    for (auto U : Entry.first->users()) {
+      auto CB = dyn_cast<CallBase>(U);
+      if (!CB || CB->getCalledOperand() != Entry.first ||
+          !Nodes.count(CB->getFunction())) {
+        N.Coalesce = false;
+        break;
+      }
+    }
+  }
+}
+
+
+bool PatmosSPFrameCoalescing::assignBases() {
+  // Callers of excluded functions need their stack control instructions
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (auto &Entry : Nodes) {
+      SPFrameNode &N = Entry.second;
+      if (!N.Coalesce) continue;
+      bool Keep = !N.CallsUnknown;
+      for (auto F : N.Callees) {
+        auto C = Nodes.find(F);
+        Keep &= C != Nodes.end() && C->second.Coalesce;
+      }
+      if (!Keep) {
+        N.Coalesce = false;
+        changed = true;
+      }
+    }
+    for (auto &Entry : Nodes) {
+      SPFrameNode &N = Entry.second;
+      if (N.Coalesce) continue;
+      for (auto F : N.Callees) {
+        auto C = Nodes.find(F);
+        if (C != Nodes.end() && C->second.Coalesce && !N.IsRoot) {
+          // Callers that are not coalesced, but not roots either, would
+          // have to reserve the frames of their callees.
+          C->second.Coalesce = false;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // Order all functions topologically, starting from the roots
+  std::vector<const Function*> PostOrder;
+  std::set<const Function*> Visited, OnStack;
+  bool Excluded = false;
+  for (auto &Entry : Nodes) {
+    if (Entry.second.IsRoot) {
+      Excluded |= !orderNodes(Entry.first, Visited, OnStack, PostOrder);
+    }
+  }
+  if (Excluded) return false;
+
+  // Place the frame of each callee above the frames of its callers
+  for (auto &Entry : Nodes) Entry.second.Base = 0;
+  for (auto I = PostOrder.rbegin(), E = PostOrder.rend(); I != E; ++I) {
+    SPFrameNode &N = Nodes.at(*I);
+    for (auto Callee : N.Callees) {
+      auto C = Nodes.find(Callee);
+      if (C != Nodes.end() && C->second.Coalesce) {
+        C->second.Base = std::max(C->second.Base, N.Base + N.Size);
+      }
+    }
+  }
+
+  // Roots must be able to reserve the coalesced frame
+  for (auto &Entry : Nodes) {
+    if (!Entry.second.IsRoot) continue;
+
+    unsigned Total = getTotalSize(Entry.first);
+    if (Total > PFL->getEffectiveStackCacheSize()) {
+      std::set<const Function*> Reachable;
+      getReachable(Entry.first, Reachable);
+      LLVM_DEBUG( dbgs() << "[Single-Path] Coalesced frame of "
+                    << Entry.first->getName()
+                    << " exceeds the stack cache: " << Total << " bytes\n");
+      for (auto F : Reachable) Nodes.at(F).Coalesce = false;
+      Excluded = true;
+    }
+  }
+
+  for (auto &Entry : Nodes) {
+    SPFrameNode &N = Entry.second;
+    if (N.Coalesce && !canRebase(*N.MF, N.Base)) {
+      LLVM_DEBUG( dbgs() << "[Single-Path] Cannot move frame of "
+                    << Entry.first->getName() << " to offset " << N.Base
+                    << "\n");
+      N.Coalesce = false;
+      Excluded = true;
+    }
+  }
+  return !Excluded;
+}
+
+
+bool PatmosSPFrameCoalescing::orderNodes(const Function *F,
+                                      std::set<const Function*> &Visited,
+                                      std::set<const Function*> &OnStack,
+                                      std::vector<const Function*> &PostOrder) {
+  bool Ok = true;
+  Visited.insert(F);
+  OnStack.insert(F);
+  for (auto Callee : Nodes.at(F).Callees) {
+    auto C = Nodes.find(Callee);
+    if (C == Nodes.end() || !C->second.Coalesce) continue;
+    if (OnStack.count(Callee)) {
+      // Single-path code is not recursive, but be safe
+      C->second.Coalesce = false;
+      Ok = false;
+    } else if (!Visited.count(Callee)) {
+      Ok &= orderNodes(Callee, Visited, OnStack, PostOrder);
+    }
+  }
+  OnStack.erase(F);
+  PostOrder.push_back(F);
+  return Ok;
+}
+
+
+void PatmosSPFrameCoalescing::getReachable(const Function *F,
+                                  std::set<const Function*> &R) const {
+  for (auto Callee : Nodes.at(F).Callees) {
+    auto C = Nodes.find(Callee);
+    if (C != Nodes.end() && C->second.Coalesce && R.insert(Callee).second) {
+      getReachable(Callee, R);
+    }
+  }
+}
+
+
+unsigned PatmosSPFrameCoalescing::getTotalSize(const Function *Root) const {
+  std::set<const Function*> Reachable;
+  getReachable(Root, Reachable);
+
+  unsigned Total = Nodes.at(Root).Size;
+  for (auto F : Reachable) {
+    const SPFrameNode &C = Nodes.at(F);
+    Total = std::max(Total, C.Base + C.Size);
+  }
+  return Total;
+}
+
+
+void PatmosSPFrameCoalescing::insertSTC(MachineBasicBlock &MBB,
+                                        MachineBasicBlock::iterator MI,
+                                        unsigned Opcode, unsigned Size) const {
+  DebugLoc DL = (MI != MBB.end()) ? MI->getDebugLoc() : DebugLoc();
+  MachineInstr *Inst = AddDefaultPred(BuildMI(MBB, MI, DL, TII->get(Opcode)))
+    .addImm(Size / 4);
+  if (Opcode != Patmos::SENSi) Inst->setFlag(MachineInstr::FrameSetup);
+}
+
+
+void PatmosSPFrameCoalescing::rewriteFunction(const Module &M,
+                                              SPFrameNode &N, unsigned Total) {
+  MachineFunction &MF = *N.MF;
+
+  if (N.Coalesce) {
+    MF.getInfo<PatmosMachineFunctionInfo>()->setStackCacheFrameBase(N.Base);
+  }
+
+  // A root without a frame of its own has no stack control instructions yet
+  bool InsertSTC = !N.Coalesce && N.Size == 0 && Total != 0;
+  if (InsertSTC) {
+    insertSTC(MF.front(), MF.front().begin(), Patmos::SRESi, Total);
+  }
+
+  for (auto &MBB : MF) {
+    bool LastCallCoalesced = false;
+
+    for (auto MI = MBB.instr_begin(), ME = MBB.instr_end(); MI != ME; ) {
+      MachineInstr &I = *MI++;
+
+      if (I.isCall()) {
+        const Function *Target = getCallTarget(M, I);
+        auto C = Target ? Nodes.find(Target) : Nodes.end();
+        LastCallCoalesced = C != Nodes.end() && C->second.Coalesce;
+        if (InsertSTC && !LastCallCoalesced) {
+          insertSTC(MBB, MI, Patmos::SENSi, Total);
+        }
+        continue;
+      }
+
+      if (InsertSTC && I.isReturn()) {
+        insertSTC(MBB, I, Patmos::SFREEi, Total);
+        continue;
+      }
+
+      switch (I.getOpcode()) {
+      case Patmos::SRESi:
+      case Patmos::SFREEi:
+      case Patmos::SENSi:
+        if (N.Coalesce ||
+            (I.getOpcode() == Patmos::SENSi && LastCallCoalesced)) {
+          // The frame is reserved by the root
+          I.eraseFromParent();
+          NumSPSTCRemoved++; // STATISTIC
+        } else {
+          // The root reserves and ensures the whole coalesced frame
+          I.getOperand(2).setImm(Total / 4);
+        }
+        LastCallCoalesced = false;
+        break;
+      default:
+        if (N.Coalesce) {
+          int Shift = getStackAccessShift(I);
+          if (Shift < 0) break;
+          MachineOperand &BaseMO = I.getOperand(I.mayStore() ? 2 : 3);
+          if (BaseMO.isFI()) break;
+          MachineOperand &ImmMO = I.getOperand(I.mayStore() ? 3 : 4);
+          ImmMO.setImm(ImmMO.getImm() + (N.Base >> Shift));
+        }
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,190 @@
+//===-- PatmosSPLoopBound.cpp - Derive loop bounds for single-path code ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass derives loop bounds on bitcode level from ScalarEvolution and
+// attaches them as "llvm.loop.bound" metadata to the terminator of the loop
+// header, where getLoopBounds() expects them. Single-path conversion
+// requires a bound on every loop, so loops with a computable trip count no
+// longer need a "#pragma loopbound".
+//
+// Bounds given by the user are kept, but tightened if ScalarEvolution can
+// prove a smaller maximum. They are found on the header or, for loops the
+// optimizer rotated, peeled or unrolled, in the loop ID on the latches.
+//
+// As in the pragma, the bounds count the iterations of a loop, i.e., how
+// often its backedge is taken.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-singlepath"
+
+STATISTIC(NumBoundsAdded,     "Number of loop bounds derived from SCEV");
+STATISTIC(NumBoundsTightened, "Number of user loop bounds tightened by SCEV");
+
+static cl::opt<bool> EnableSPLoopBound("mpatmos-sp-scev-loopbounds",
+  cl::init(true),
+  cl::desc("Derive missing or tighter loop bounds for single-path code "
+           "from scalar evolution."),
+  cl::Hidden);
+
+namespace {
+
+class PatmosSPLoopBound : public FunctionPass {
+private:
+
+  /**
+   * Returns the "llvm.loop.bound" of the given loop metadata, or NULL.
+   */
+  static MDNode *findBound(MDNode *LoopID);
+
+  /**
+   * Derive the bound of L and attach it to the terminator of its header.
+   * @return Whether the metadata was changed.
+   */
+  bool boundLoop(Loop *L, ScalarEvolution &SE);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+
+  PatmosSPLoopBound() : FunctionPass(ID) {}
+
+  /// getPassName - Return the pass' name.
+  StringRef getPassName() const override {
+    return "Patmos Single-Path Loop Bounds (bitcode)";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.setPreservesAll();
+  }
+
+  bool runOnFunction(Function &F) override;
+};
+
+} // end anonymous namespace
+
+char PatmosSPLoopBound::ID = 0;
+
+
+FunctionPass *llvm::createPatmosSPLoopBoundPass() {
+  return new PatmosSPLoopBound();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosSPLoopBound::runOnFunction(Function &F) {
+  if (!EnableSPLoopBound || skipFunction(F)) return false;
+
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+  bool changed = false;
+  for (auto L : LI.getLoopsInPreorder()) {
+    changed |= boundLoop(L, SE);
+  }
+  return changed;
+}
+
+
+MDNode *PatmosSPLoopBound::findBound(MDNode *LoopID) {
+  if (!LoopID) return NULL;
+  // The first operand is always a self-reference
+  for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; i++) {
+    auto Op = dyn_cast<MDNode>(LoopID->getOperand(i).get());
+    if (Op && Op->getNumOperands() == 3) {
+      auto Name = dyn_cast<MDString>(Op->getOperand(0));
+      if (Name && Name->getString() == "llvm.loop.bound") {
+        return Op;
+      }
+    }
+  }
+  return NULL;
+}
+
+
+bool PatmosSPLoopBound::boundLoop(Loop *L, ScalarEvolution &SE) {
+  Instruction *Term = L->getHeader()->getTerminator();
+
+  const SCEV *MaxBTC = SE.getConstantMaxBackedgeTakenCount(L);
+  if (!isa<SCEVConstant>(MaxBTC)) return false;
+
+  // The bounds are read back as int
+  const uint64_t Limit = INT32_MAX - 1;
+  uint64_t max = cast<SCEVConstant>(MaxBTC)->getAPInt().getLimitedValue();
+  if (max > Limit) return false;
+
+  uint64_t min = 0;
+  if (auto ExactBTC = dyn_cast<SCEVConstant>(SE.getBackedgeTakenCount(L))) {
+    min = ExactBTC->getAPInt().getLimitedValue();
+  }
+
+  MDNode *LoopID = Term->getMetadata("llvm.loop");
+  MDNode *Bound = findBound(LoopID);
+  if (!Bound)
+    Bound = findBound(L->getLoopID());
+  if (Bound) {
+    auto UserMin = mdconst::dyn_extract<ConstantInt>(Bound->getOperand(1));
+    auto UserMax = mdconst::dyn_extract<ConstantInt>(Bound->getOperand(2));
+    if (!UserMin || !UserMax) return false;
+
+    if (UserMax->getZExtValue() <= max) {
+      // The user bound is at least as tight
+      return false;
+    }
+    min = std::min(std::max(min, UserMin->getZExtValue()), max);
+    LLVM_DEBUG( dbgs() << "Tighten loop bound of '"
+                  << L->getHeader()->getName() << "' from "
+                  << UserMax->getZExtValue() << " to " << max << "\n");
+    NumBoundsTightened++; // STATISTIC
+  } else {
+    LLVM_DEBUG( dbgs() << "Derived loop bound of '"
+                  << L->getHeader()->getName() << "': min " << min
+                  << ", max " << max << "\n");
+    NumBoundsAdded++; // STATISTIC
+  }
+
+  LLVMContext &Ctx = Term->getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Metadata *BoundOps[] = {
+    MDString::get(Ctx, "llvm.loop.bound"),
+    ValueAsMetadata::get(ConstantInt::get(Int32Ty, min)),
+    ValueAsMetadata::get(ConstantInt::get(Int32Ty, max))
+  };
+
+  // Keep any other loop properties
+  SmallVector<Metadata *, 4> Ops(1);
+  if (LoopID) {
+    for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; i++) {
+      if (LoopID->getOperand(i).get() != Bound) {
+        Ops.push_back(LoopID->getOperand(i).get());
+      }
+    }
+  }
+  Ops.push_back(MDNode::get(Ctx, BoundOps));
+  MDNode *NewLoopID = MDNode::get(Ctx, Ops);
+  NewLoopID->replaceOperandWith(0, NewLoopID); // First op points to itself.
+
+  Term->setMetadata("llvm.loop", NewLoopID);
+  return true;
+}
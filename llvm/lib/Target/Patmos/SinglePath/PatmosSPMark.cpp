@@ -18,6 +18,9 @@
 // (setSinglePath()). Any functions marked as 'sp-maybe' but not finally
 // in the PatmosMachineFunctionInfo are "removed" again.
 //
+// Calls to functions marked as 'sp-shared' are left alone. These functions
+// are free of branches and side effects, so PatmosSPClone did not clone them.
+//
 // The removal is done by erasing all basic blocks and inserting a single
 // basic block with a single return instruction, the least required to
 // make the compiler happy.
@@ -214,6 +217,11 @@ void PatmosSPMark::scanAndRewriteCalls(MachineFunction &MF) {
 
         const Function *Target = getCallTarget(&*MI);
 
+        if (PatmosSinglePathInfo::isShared(*Target)) {
+          LLVM_DEBUG( dbgs() << "  Shared call: " << Target->getName() << "\n" );
+          continue;
+        }
+
         PatmosMachineFunctionInfo *PMFI =
           MF->getInfo<PatmosMachineFunctionInfo>();
         if (!PMFI->isSinglePath()) {
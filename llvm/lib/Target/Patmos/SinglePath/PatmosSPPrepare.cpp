@@ -24,6 +24,7 @@
 #include "llvm/ADT/GraphTraits.h"
 #include "llvm/ADT/DepthFirstIterator.h"
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/MachineLoopInfo.h"
@@ -50,6 +51,18 @@ using namespace llvm;
 
 #define DEBUG_TYPE "patmos-singlepath"
 
+STATISTIC(CoalescedPredicates,
+          "Number of predicate locations saved by coalescing live ranges");
+
+/// Reserve the predicate locations by the predicates live at the same time,
+/// instead of by all predicates of a scope.
+static cl::opt<bool> EnableCoalescePreds(
+  "mpatmos-sp-coalesce-preds",
+  cl::init(true),
+  cl::desc("Share predicate locations between single-path predicates with "
+           "disjoint live ranges when reserving spill slots."),
+  cl::Hidden);
+
 // anonymous namespace
 namespace {
 
@@ -135,6 +148,14 @@ void PatmosSPPrepare::doPrepareFunction(MachineFunction &MF) {
     unsigned preds = scope->getNumPredicates();
     unsigned d = scope->getDepth();
 
+    // Predicates with disjoint live ranges share a location in RAInfo, the
+    // scope needs as many as are live at the same time.
+    if (EnableCoalescePreds) {
+      unsigned live = std::min(preds, scope->getMaxLivePredicates());
+      CoalescedPredicates += preds - live; // STATISTIC
+      preds = live;
+    }
+
     LLVM_DEBUG( dbgs() << "[MBB#" << scope->getHeader()->getMBB()->getNumber()
                   << "]: d=" << d << ", " << preds << "\n");
 
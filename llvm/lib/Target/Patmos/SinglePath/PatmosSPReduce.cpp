@@ -39,6 +39,7 @@
 #include "llvm/Support/GraphWriter.h"
 #include "llvm/Support/DOTGraphTraits.h"
 #include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include <map>
@@ -60,6 +61,40 @@ STATISTIC( RemovedBranchInstrs, "Number of branch instructions removed");
 STATISTIC( InsertedInstrs,      "Number of instructions inserted");
 STATISTIC( LoopCounters,        "Number of loop counters introduced");
 STATISTIC( ElimLdStCnt,         "Number of eliminated redundant loads/stores");
+STATISTIC( RegLoopCounters,     "Number of loop counters kept in registers");
+STATISTIC( StraightLineFuncs,   "Number of straight-line functions reduced "
+                                "without linearization");
+STATISTIC( NormalizedMemAccesses, "Number of predicated memory accesses "
+                                  "normalized");
+STATISTIC( HoistedCondInstrs,   "Number of loop-invariant conditions hoisted "
+                                "to the loop preheader");
+
+static cl::opt<bool> EnableRegLoopCounters("mpatmos-sp-reg-loop-counters",
+    cl::init(true),
+    cl::desc("Keep single-path loop counters in unused general-purpose "
+             "registers instead of stack slots"),
+    cl::Hidden);
+
+static cl::opt<bool> EnableNormalizeMemAccesses("mpatmos-sp-normalize-mem",
+    cl::init(false),
+    cl::desc("Execute predicated accesses of the data cache and the main "
+             "memory of single-path code unconditionally, for a data cache "
+             "behaviour independent of the predicates. Stores become a load "
+             "and a store of the old or new value, which is not safe for "
+             "memory shared with other cores or devices"),
+    cl::Hidden);
+
+static cl::opt<bool> EnableHoistConditions("mpatmos-sp-hoist-conditions",
+    cl::init(true),
+    cl::desc("Compute the loop-invariant branch conditions of single-path "
+             "loops once in the loop preheader instead of in every iteration"),
+    cl::Hidden);
+
+static cl::opt<bool> EnableStraightLine("mpatmos-sp-straight-line",
+    cl::init(true),
+    cl::desc("Reduce single-path functions without branches by guarding "
+             "them only, skipping predicate allocation and linearization"),
+    cl::Hidden);
 
 namespace llvm {
   /// LinearizeWalker - Class to linearize the CFG during a walk of the SPScope
@@ -122,19 +157,29 @@ namespace llvm {
   /// of redundant loads and stores (to a tracked register), which are
   /// inserted in the course of the transformation.
   /// This includes predicate spill code and loop counters.
+  ///
+  /// Two data-flow analyses are run over the linearized function, covering
+  /// all stack slots created for single-path code:
+  /// - A forward analysis computes the slots whose contents are known to be
+  ///   held by the tracked register. Loads from such a slot, and stores of
+  ///   the tracked register to it, are redundant.
+  /// - A backward analysis computes the slots that are live, i.e. may still
+  ///   be loaded from. Stores to a slot that is not live are dead.
+  /// The slots are local to the frame of the function, so none of them are
+  /// live at its exits. Each slot is always accessed with the same width.
   class RedundantLdStEliminator {
     public:
       explicit RedundantLdStEliminator(MachineFunction &mf,
           const PatmosRegisterInfo *tri, unsigned int tgtreg,
           const PatmosMachineFunctionInfo &PMFI)
         : MF(mf), TRI(tri), TgtReg(tgtreg), NumFIs(PMFI.getSinglePathFICnt()),
-          OffsetFIs(PMFI.getSinglePathLoopCntFI(0)) {}
-
-      void addRemovableInst(MachineInstr *MI) {
-        Removables.insert(MI);
+          FIs(PMFI.getSinglePathFIs())
+      {
+        for (unsigned i = 0; i < NumFIs; i++) {
+          FIIndex[FIs[i]] = i;
+        }
       }
 
-
       unsigned int process(void) {
         LLVM_DEBUG( dbgs() << "Eliminate redundant loads/stores to " <<
             TRI->getName(TgtReg) << "\n" );
@@ -154,8 +199,7 @@ namespace llvm {
         // Having redundant loads eliminated enables simpler removal
         // of redundant stores
         LLVM_DEBUG(dbgs() << "Removing redundant stores:\n");
-        // FIXME the analysis is erroneous.
-        //findRedundantStores();
+        findRedundantStores();
         count += remove();
 
         return count;
@@ -168,6 +212,15 @@ namespace llvm {
           LLVM_DEBUG(dbgs() << "  " << **I);
           (*I)->eraseFromParent();
         }
+        // The value of a removed load now lives on from an earlier
+        // definition, which might have killed it.
+        if (cnt > 0) {
+          for (auto &MBB : MF) {
+            for (auto &MI : MBB) {
+              MI.clearRegisterKills(TgtReg, TRI);
+            }
+          }
+        }
         Removables.clear();
         return cnt;
       }
@@ -177,34 +230,46 @@ namespace llvm {
       const PatmosRegisterInfo *TRI;
       const unsigned int TgtReg;
       const unsigned int NumFIs;
-      const unsigned int OffsetFIs;
+      const std::vector<int> &FIs;
+
+      /// Maps each single-path frame index to its position in the bitvectors.
+      std::map<int, unsigned> FIIndex;
 
       std::set<MachineInstr *> Removables;
 
       struct Blockinfo {
         // required for elimination of redundant loads
-        BitVector LiveFIExit, LiveFIEntry;
+        BitVector AvailFIExit, AvailFIEntry;
         // required for elimination of redundant stores
-        BitVector SubseqStoresEntry, SubseqStoresExit;
-        BitVector FutureLoadsEntry, FutureLoadsExit;
+        BitVector LiveFIEntry, LiveFIExit;
 
         Blockinfo(unsigned int size)
-          : LiveFIExit(size), LiveFIEntry(size),
-            SubseqStoresEntry(size), SubseqStoresExit(size),
-            FutureLoadsEntry(size), FutureLoadsExit(size) {}
+          : AvailFIExit(size), AvailFIEntry(size),
+            LiveFIEntry(size), LiveFIExit(size) {}
       };
 
       std::map<const MachineBasicBlock *, Blockinfo> BlockInfos;
 
-      inline unsigned int normalizeFI(int fi) const {
-        unsigned norm = fi - OffsetFIs;
-        assert((fi >= 0 && norm < NumFIs) && "FI out of bounds");
-        return norm;
-      }
+      /// The kind of access an instruction makes to a single-path slot.
+      enum AccessKind {
+        NoAccess,
+        /// Unconditional load of the slot to TgtReg
+        LoadTgt,
+        /// Unconditional store of TgtReg to the slot
+        StoreTgt,
+        /// Any other load of the slot
+        Load,
+        /// Any other unconditional store to the slot
+        Store,
+        /// Any other store to the slot
+        CondStore,
+        /// Any other instruction using the slot
+        Unknown
+      };
 
       inline int denormalizeFI(unsigned int fi) const {
         assert(fi < NumFIs && "FI out of bounds");
-        return fi + OffsetFIs;
+        return FIs[fi];
       }
 
       void printFISet(const BitVector &BV, raw_ostream &os) const {
@@ -213,38 +278,89 @@ namespace llvm {
         }
       }
 
-      bool isUncondLoad(const MachineInstr *MI, int &fi) const {
-        if ((MI->getOpcode() == Patmos::LBC || MI->getOpcode() == Patmos::LWC)
-            && MI->getOperand(0).getReg() == TgtReg
-            && (MI->getOperand(1).getReg() == Patmos::NoRegister ||
-              MI->getOperand(1).getReg() == Patmos::P0)
-            && MI->getOperand(2).getImm() == 0
-            && MI->getOperand(3).isFI()) {
-          fi = MI->getOperand(3).getIndex();
-          return true;
-        }
-        return false;
+      static bool isUnpredicated(const MachineOperand &pred,
+                                 const MachineOperand &flag) {
+        return (pred.getReg() == Patmos::NoRegister ||
+                pred.getReg() == Patmos::P0) && flag.getImm() == 0;
       }
 
-      bool isUncondStore(const MachineInstr *MI, int &fi) const {
-        if ((MI->getOpcode() == Patmos::SBC || MI->getOpcode() == Patmos::SWC)
-            && MI->getOperand(4).getReg() == TgtReg
-            && (MI->getOperand(0).getReg() == Patmos::NoRegister ||
-              MI->getOperand(0).getReg() == Patmos::P0)
-            && MI->getOperand(1).getImm() == 0
-            && MI->getOperand(2).isFI()) {
-          fi = MI->getOperand(2).getIndex();
-          return true;
+      /// Classifies the access of MI to a single-path slot. If it accesses
+      /// one, its position in the bitvectors is returned through nfi.
+      AccessKind getAccess(const MachineInstr *MI, unsigned &nfi) const {
+        switch (MI->getOpcode()) {
+          case Patmos::LBC:
+          case Patmos::LWC: {
+            if (!MI->getOperand(3).isFI()) return NoAccess;
+            auto found = FIIndex.find(MI->getOperand(3).getIndex());
+            if (found == FIIndex.end()) return NoAccess;
+            nfi = found->second;
+            return (MI->getOperand(0).getReg() == TgtReg &&
+                    isUnpredicated(MI->getOperand(1), MI->getOperand(2)))
+                   ? LoadTgt : Load;
+          }
+          case Patmos::SBC:
+          case Patmos::SWC: {
+            if (!MI->getOperand(2).isFI()) return NoAccess;
+            auto found = FIIndex.find(MI->getOperand(2).getIndex());
+            if (found == FIIndex.end()) return NoAccess;
+            nfi = found->second;
+            if (!isUnpredicated(MI->getOperand(0), MI->getOperand(1))) {
+              return CondStore;
+            }
+            return MI->getOperand(4).getReg() == TgtReg ? StoreTgt : Store;
+          }
+          default:
+            for (const MachineOperand &MO : MI->operands()) {
+              if (MO.isFI() && FIIndex.count(MO.getIndex())) {
+                nfi = FIIndex.at(MO.getIndex());
+                return Unknown;
+              }
+            }
+            return NoAccess;
         }
-        return false;
       }
 
+      /// Transfer function of the forward analysis.
+      /// Returns whether MI is redundant given the slots in avail.
+      bool transferAvail(const MachineInstr *MI, BitVector &avail) const {
+        unsigned nfi;
+        switch (getAccess(MI, nfi)) {
+          case LoadTgt:
+            if (avail.test(nfi)) return true;
+            avail.reset();
+            avail.set(nfi);
+            return false;
+          case StoreTgt:
+            if (avail.test(nfi)) return true;
+            avail.set(nfi);
+            return false;
+          case Store:
+            avail.reset(nfi);
+            return false;
+          case CondStore:
+            if (MI->getOperand(4).getReg() != TgtReg) avail.reset(nfi);
+            return false;
+          case Unknown:
+            avail.reset(nfi);
+            if (MI->modifiesRegister(TgtReg, TRI)) avail.reset();
+            return false;
+          case Load:
+          case NoAccess:
+            if (MI->modifiesRegister(TgtReg, TRI)) avail.reset();
+            return false;
+        }
+        llvm_unreachable("unknown access kind");
+      }
 
       void findRedundantLoads(void) {
-        // forward DF problem
-        std::map<MachineInstr *, BitVector> collected_loads;
+        // forward DF problem, optimistic initialization handles values that
+        // are available around loops
         // operate in reverse-postorder
         ReversePostOrderTraversal<MachineFunction *> RPOT(&MF);
+        // unreachable blocks keep nothing available
+        for (auto RI = RPOT.begin(), RE = RPOT.end(); RI != RE; ++RI) {
+          BlockInfos.at(*RI).AvailFIExit.set();
+        }
         bool changed;
         do {
           changed = false;
@@ -253,60 +369,76 @@ namespace llvm {
             MachineBasicBlock *MBB = *RI;
             Blockinfo &BI = this->BlockInfos.at(MBB);
 
-            BitVector livein = BitVector(NumFIs, true);
+            BitVector availin = BitVector(NumFIs, true);
             // join from predecessors
             if (MBB->pred_size() > 0) {
               for (MachineBasicBlock::pred_iterator PI = MBB->pred_begin();
                   PI != MBB->pred_end(); ++PI) {
-                 livein &= this->BlockInfos.at(*PI).LiveFIExit;
+                 availin &= this->BlockInfos.at(*PI).AvailFIExit;
               }
             } else {
-              livein.reset();
+              availin.reset();
             }
-            if (BI.LiveFIEntry != livein) {
-              BI.LiveFIEntry = livein;
+            if (BI.AvailFIEntry != availin) {
+              BI.AvailFIEntry = availin;
               changed = true;
             }
 
             // transfer
-            BitVector livefi(livein);
-            for (MachineBasicBlock::iterator MI = MBB->begin(),
-                MIe = MBB->end(); MI != MIe; ++MI) {
-              // check for unconditional load to TgtReg
-              int fi;
-              if (isUncondLoad(&*MI, fi)) {
-                // remember load with livefi at entry
-                collected_loads[&*MI] = livefi;
-                // update
-                livefi.reset();
-                livefi.set(normalizeFI(fi));
-              }
+            BitVector availfi(availin);
+            for (auto &MI : MBB->instrs()) {
+              transferAvail(&MI, availfi);
             }
             // was an update?
-            if (BI.LiveFIExit != livefi) {
-              BI.LiveFIExit = livefi;
+            if (BI.AvailFIExit != availfi) {
+              BI.AvailFIExit = availfi;
               changed = true;
             }
           }
         } while (changed);
 
-        // now inspect the livefi at entry of each load. if it is equal to
-        // the fi of the load, the load is redundant and we can remove it.
-        for (std::map<MachineInstr *, BitVector>::iterator
-            I = collected_loads.begin(), E = collected_loads.end();
-            I != E; ++I) {
-          int fi;
-          (void) isUncondLoad(I->first, fi);
-          if (I->second.test(normalizeFI(fi))) {
-            Removables.insert(I->first);
+        // now replay the transfer from the fixpoint, collecting the loads
+        // of available slots and the stores of values the slots already hold
+        for (auto &MBB : MF) {
+          BitVector availfi(BlockInfos.at(&MBB).AvailFIEntry);
+          DEBUG_TRACE({
+            dbgs() << "  MBB#" << MBB.getNumber() << " available: ";
+            printFISet(availfi, dbgs());
+            dbgs() << "\n";
+          });
+          for (auto &MI : MBB.instrs()) {
+            if (transferAvail(&MI, availfi)) {
+              Removables.insert(&MI);
+            }
           }
         }
       }
 
+      /// Transfer function of the backward analysis.
+      /// Returns whether MI is a dead store given the slots in live.
+      bool transferLive(const MachineInstr *MI, BitVector &live) const {
+        unsigned nfi;
+        switch (getAccess(MI, nfi)) {
+          case LoadTgt:
+          case Load:
+          case Unknown:
+            live.set(nfi);
+            return false;
+          case StoreTgt:
+          case Store:
+            if (!live.test(nfi)) return true;
+            live.reset(nfi);
+            return false;
+          case CondStore:
+            return !live.test(nfi);
+          case NoAccess:
+            return false;
+        }
+        llvm_unreachable("unknown access kind");
+      }
+
       void findRedundantStores(void) {
-        // backward DF problems
-        std::map<MachineInstr *,
-                 std::pair<BitVector, BitVector> > collected_stores;
+        // backward DF problem
         std::queue<MachineBasicBlock *> worklist;
 
         // fill worklist initially in dfs postorder
@@ -322,47 +454,22 @@ namespace llvm {
           worklist.pop();
           Blockinfo &BI = this->BlockInfos.at(MBB);
 
-          BitVector subseqstores(NumFIs, true);
-          BitVector futureloads(NumFIs);
-          if (MBB->succ_size() > 0) {
-            for (MachineBasicBlock::succ_iterator SI = MBB->succ_begin();
-                SI != MBB->succ_end(); ++SI) {
-              Blockinfo &BISucc = this->BlockInfos.at(*SI);
-              futureloads  |= BISucc.FutureLoadsEntry;
-              subseqstores &= BISucc.SubseqStoresEntry;
-            }
-          } else {
-            subseqstores.reset();
+          BitVector livefi(NumFIs);
+          for (MachineBasicBlock::succ_iterator SI = MBB->succ_begin();
+              SI != MBB->succ_end(); ++SI) {
+            livefi |= this->BlockInfos.at(*SI).LiveFIEntry;
           }
-          BI.FutureLoadsExit = futureloads;
-          BI.SubseqStoresExit = subseqstores;
+          BI.LiveFIExit = livefi;
 
           // transfer
-          for (MachineBasicBlock::reverse_iterator MI = MBB->rbegin(),
-              MIe = MBB->rend(); MI != MIe; ++MI) {
-            int fi;
-            if (isUncondLoad(&*MI, fi)) {
-              int nfi = normalizeFI(fi);
-              futureloads.set(nfi);
-              if (!subseqstores.test(nfi)) subseqstores.reset();
-              continue;
-            }
-            if (isUncondStore(&*MI, fi)) {
-              // remember store-inst with futureloads/subseq-st at exit
-              collected_stores[&*MI] = std::make_pair(futureloads,
-                                                      subseqstores);
-              // update
-              subseqstores.reset();
-              subseqstores.set(normalizeFI(fi));
-              continue;
-            }
+          for (auto MI = MBB->instr_rbegin(), MIe = MBB->instr_rend();
+              MI != MIe; ++MI) {
+            transferLive(&*MI, livefi);
           }
 
           // was an update?
-          if (BI.FutureLoadsEntry  != futureloads ||
-              BI.SubseqStoresEntry != subseqstores) {
-            BI.FutureLoadsEntry  = futureloads;
-            BI.SubseqStoresEntry = subseqstores;
+          if (BI.LiveFIEntry != livefi) {
+            BI.LiveFIEntry = livefi;
             // add predecessors to worklist
             for (MachineBasicBlock::pred_iterator PI=MBB->pred_begin();
                 PI!=MBB->pred_end(); ++PI) {
@@ -371,20 +478,20 @@ namespace llvm {
           }
         }
 
-        // Now iterate through the collected store instructions.
-        // If the fi of a store is covered by a subsequent store, or the
-        // fi is never loaded again in the future, the store can be removed.
-        for (std::map<MachineInstr *,
-                      std::pair<BitVector, BitVector> >::iterator
-             I = collected_stores.begin(), E = collected_stores.end();
-             I != E; ++I) {
-          int fi, nfi;
-          (void) isUncondStore(I->first, fi);
-          nfi = normalizeFI(fi);
-          BitVector futureloads  = I->second.first;
-          BitVector subseqstores = I->second.second;
-          if (subseqstores.test(nfi) || !futureloads.test(nfi)) {
-            Removables.insert(I->first);
+        // Now replay the transfer from the fixpoint.
+        // A store to a slot that is not live afterwards can be removed.
+        for (auto &MBB : MF) {
+          BitVector livefi(BlockInfos.at(&MBB).LiveFIExit);
+          DEBUG_TRACE({
+            dbgs() << "  MBB#" << MBB.getNumber() << " live-out: ";
+            printFISet(livefi, dbgs());
+            dbgs() << "\n";
+          });
+          for (auto MI = MBB.instr_rbegin(), MIe = MBB.instr_rend();
+              MI != MIe; ++MI) {
+            if (transferLive(&*MI, livefi)) {
+              Removables.insert(&*MI);
+            }
           }
         }
       }
@@ -406,6 +513,7 @@ FunctionPass *llvm::createPatmosSPReducePass(const PatmosTargetMachine &tm) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void PatmosSPReduce::doReduceFunction(MachineFunction &MF) {
+  PatmosPhaseScope T("sp-reduce", "Single-Path Reduction", MF.getName());
 
   LLVM_DEBUG( dbgs() << "BEFORE Single-Path Reduce\n"; MF.dump() );
 
@@ -431,9 +539,20 @@ void PatmosSPReduce::doReduceFunction(MachineFunction &MF) {
   PRTmp     = AvailPredRegs.back();
   AvailPredRegs.pop_back();
 
+  if (EnableStraightLine && isStraightLine(MF)) {
+    doReduceStraightLine(MF);
+    return;
+  }
+
+  collectLoopCounterRegs(MF);
+
   LLVM_DEBUG( dbgs() << "RegAlloc\n" );
   RAInfos.clear();
-  RAInfos = RAInfo::computeRegAlloc(RootScope, AvailPredRegs.size());
+  {
+    PatmosPhaseScope T("sp-reg-alloc", "Single-Path Predicate Allocation",
+                       MF.getName());
+    RAInfos = RAInfo::computeRegAlloc(RootScope, AvailPredRegs.size());
+  }
 
   // before inserting code, we need to obtain additional instructions that are
   // spared from predication (i.e. need to execute unconditionally)
@@ -441,17 +560,31 @@ void PatmosSPReduce::doReduceFunction(MachineFunction &MF) {
   // NB: we execute the whole frame setup unconditionally!
   //collectReturnInfoInsts(MF);
 
-  // Guard the instructions (no particular order necessary)
-  for (auto iter = df_begin(RootScope), end = df_end(RootScope);
-        iter != end; ++iter) {
-    applyPredicates(*iter, MF);
+  // Hoist the loop-invariant conditions before the instructions are guarded,
+  // the preheaders execute unconditionally
+  HoistedConds.clear();
+  if (EnableHoistConditions) {
+    for (auto iter = df_begin(RootScope), end = df_end(RootScope);
+          iter != end; ++iter) {
+      hoistInvariantConditions(*iter);
+    }
   }
-  // Insert predicate definitions (no particular order necessary)
-  for (auto iter = df_begin(RootScope), end = df_end(RootScope);
-        iter != end; ++iter) {
-    auto scope = *iter;
-    insertPredDefinitions(scope);
-    insertStackLocInitializations(scope);
+
+  {
+    PatmosPhaseScope T("sp-predicate", "Single-Path Predication",
+                       MF.getName());
+    // Guard the instructions (no particular order necessary)
+    for (auto iter = df_begin(RootScope), end = df_end(RootScope);
+          iter != end; ++iter) {
+      applyPredicates(*iter, MF);
+    }
+    // Insert predicate definitions (no particular order necessary)
+    for (auto iter = df_begin(RootScope), end = df_end(RootScope);
+          iter != end; ++iter) {
+      auto scope = *iter;
+      insertPredDefinitions(scope);
+      insertStackLocInitializations(scope);
+    }
   }
 
   // After all scopes are handled, perform some global fixups
@@ -459,29 +592,34 @@ void PatmosSPReduce::doReduceFunction(MachineFunction &MF) {
   // Fixup kill flag of condition predicate registers
   fixupKillFlagOfCondRegs();
 
-  // we create an instance of the eliminator here, such that we can
-  // insert dummy instructions for analysis and mark them as 'to be removed'
-  // with the eliminator
-  GuardsLdStElim = new RedundantLdStEliminator(MF, TRI, GuardsReg, *PMFI);
-
   // Following walk of the SPScope tree linearizes the CFG structure,
   // inserting MBBs as required (preheader, spill/restore, loop counts, ...)
   LLVM_DEBUG( dbgs() << "Linearize MBBs\n" );
-  LinearizeWalker LW(*this, MF);
-  RootScope->walk(LW);
-
-  // Following function merges MBBs in the linearized CFG in order to
-  // simplify it
-  mergeMBBs(MF);
+  {
+    PatmosPhaseScope T("sp-linearize", "Single-Path Linearization",
+                       MF.getName());
+    LinearizeWalker LW(*this, MF);
+    RootScope->walk(LW);
+
+    // Following function merges MBBs in the linearized CFG in order to
+    // simplify it
+    mergeMBBs(MF);
+  }
 
-  // Perform the elimination of LD/ST on the large basic blocks
-  ElimLdStCnt += GuardsLdStElim->process();
-  delete GuardsLdStElim;
+  // Perform the elimination of LD/ST over the whole linearized function
+  {
+    PatmosPhaseScope T("sp-ldst-elim", "Single-Path Load/Store Elimination",
+                       MF.getName());
+    RedundantLdStEliminator GuardsLdStElim(MF, TRI, GuardsReg, *PMFI);
+    ElimLdStCnt += GuardsLdStElim.process();
+  }
 
 
   // Remove frame index operands from inserted loads and stores to stack
   eliminateFrameIndices(MF);
 
+  normalizeMemAccesses(MF);
+
   // Finally, we assign numbers in ascending order to MBBs again.
   MF.RenumberBlocks();
 
@@ -492,6 +630,66 @@ void PatmosSPReduce::doReduceFunction(MachineFunction &MF) {
   });
 }
 
+bool PatmosSPReduce::isStraightLine(const MachineFunction &MF) const {
+  // no loops
+  if (RootScope->child_begin() != RootScope->child_end()) return false;
+
+  for (auto &MBB : MF) {
+    if (MBB.isEHPad() || MBB.hasAddressTaken()) return false;
+    // a single chain of blocks, starting at the entry
+    if (&MBB != &MF.front() && MBB.pred_size() != 1) return false;
+    if (MBB.succ_size() > 1) return false;
+    for (auto &MI : MBB.terminators()) {
+      if (MI.isConditionalBranch() || MI.isIndirectBranch()) return false;
+    }
+  }
+  return true;
+}
+
+void PatmosSPReduce::doReduceStraightLine(MachineFunction &MF) {
+  LLVM_DEBUG( dbgs() << "Straight-line function, guard only\n" );
+
+  // The top-level predicate is true in roots. Otherwise it is passed by the
+  // caller in PRTmp and copied to a register that is preserved over calls.
+  bool isRoot = RootScope->isRootTopLevel();
+  assert(!AvailPredRegs.empty());
+  unsigned predReg = isRoot ? Patmos::P0 : AvailPredRegs.front();
+
+  for (auto &MBB : MF) {
+    for (auto MI = MBB.instr_begin(), ME = MBB.getFirstInstrTerminator();
+         MI != ME; ++MI) {
+      if (isUnguarded(*MI)) continue;
+      applyPredicate(MBB, MI, predReg);
+    }
+    RemovedBranchInstrs += TII->removeBranch(MBB);
+  }
+
+  if (!isRoot) {
+    // skip unconditionally executed frame setup
+    MachineBasicBlock &Entry = MF.front();
+    MachineBasicBlock::iterator MI = Entry.begin();
+    while (MI->getFlag(MachineInstr::FrameSetup)) ++MI;
+
+    AddDefaultPred(BuildMI(Entry, MI, MI->getDebugLoc(),
+          TII->get(Patmos::PMOV), predReg))
+      .addReg(PRTmp).addImm(0);
+    InsertedInstrs++; // STATISTIC
+  }
+
+  // the chain of blocks collapses into one
+  mergeMBBs(MF);
+
+  // Remove frame index operands from the spill/restore code of calls
+  eliminateFrameIndices(MF);
+
+  normalizeMemAccesses(MF);
+
+  MF.RenumberBlocks();
+  StraightLineFuncs++; // STATISTIC
+
+  LLVM_DEBUG( dbgs() << "AFTER Single-Path Reduce\n"; MF.dump() );
+}
+
 SmallVector<MachineOperand, 2> PatmosSPReduce::getEdgeCondition(
     const PredicatedBlock* sourceBlock,
     PredicatedBlock::Definition def) {
@@ -576,7 +774,7 @@ void PatmosSPReduce::insertPredDefinitions(SPScope *S) {
   LLVM_DEBUG( dbgs() << " Insert Predicate Definitions in [MBB#"
                 << S->getHeader()->getMBB()->getNumber() << "]\n");
 
-  auto blocks = S->getScopeBlocks();
+  auto &blocks = S->getScopeBlocks();
   RAInfo &R = RAInfos.at(S);// local scope of definitions
   for(auto block: blocks){
 
@@ -585,7 +783,7 @@ void PatmosSPReduce::insertPredDefinitions(SPScope *S) {
                                        : R;
     // get the guard register from the source block
     auto useLocs = getPredicateRegisters(RI, block);
-    auto defs = block->getDefinitions();
+    auto &defs = block->getDefinitions();
 
     LLVM_DEBUG(
       dbgs() << " - MBB#" << block->getMBB()->getNumber() << ":\n";
@@ -690,10 +888,31 @@ void PatmosSPReduce::insertPredDefinitions(SPScope *S) {
         auto pred1 = definition.swap.predicate_1, pred2 = definition.swap.predicate_2;
         LLVM_DEBUG(dbgs() << "Insert Swap Definition Pred(" << pred1 << ") Pred2(" << pred2 << ")\n");
 
-        auto insertPXOR = [&](auto r1, auto r2){
-          MachineBasicBlock::iterator MI = block->getMBB()->getFirstTerminator();
-          DebugLoc DL(MI->getDebugLoc());
+        SmallVector<MachineOperand, 2> cond2;
+        cond2.push_back(definition.conditions[2]);
+        cond2.push_back(definition.conditions[3]);
+
+        MachineBasicBlock::iterator MI = block->getMBB()->getFirstTerminator();
+        DebugLoc DL(MI->getDebugLoc());
+
+        if (!S->isSubheader(block)) {
+          // Both predicates are defined by an unconditional PAND. Save the
+          // first guard to the temporary, so each PAND can read the other
+          // guard directly. The save and the first PAND do not depend on
+          // each other and can be issued in the same bundle.
+          AddDefaultPred(BuildMI(*block->getMBB(), MI, DL,
+                TII->get(Patmos::PMOV), PRTmp))
+            .addReg(pred1).addImm(0);
+          InsertedInstrs++; // STATISTIC
+
+          insertDefEdge(S, block, RAInfo::Register, pred1, pred2, cond1, true);
+          insertDefEdge(S, block, RAInfo::Register, pred2, PRTmp, cond2, true);
+          continue;
+        }
 
+        // The definitions are guarded PMOVs, or use the temporary themselves.
+        // We first swap the values of the two predicates
+        auto insertPXOR = [&](auto r1, auto r2){
           AddDefaultPred(BuildMI(*block->getMBB(), MI, DL,
             TII->get(Patmos::PXOR), r1)
           )
@@ -702,15 +921,9 @@ void PatmosSPReduce::insertPredDefinitions(SPScope *S) {
 
           InsertedInstrs++; // STATISTIC
         };
-
-        // We first swap the values of the two predicates
         insertPXOR(pred1, pred2);
         insertPXOR(pred2, pred1);
         insertPXOR(pred1, pred2);
-		
-		SmallVector<MachineOperand, 2> cond2;
-		cond2.push_back(definition.conditions[2]);
-		cond2.push_back(definition.conditions[3]);
 
         // Then define them using the swapped guards, 
         // i.e. each register becomes its own guard
@@ -899,6 +1112,10 @@ void PatmosSPReduce::fixupKillFlagOfCondRegs(void) {
     MachineBasicBlock *MBB = (*I).first;
     MachineOperand CondReg = (*I).second;
 
+    // the hoisted condition is live throughout the loop
+    if (HoistedCondMBBs.count(MBB))
+      continue;
+
     MachineBasicBlock::iterator firstTI = MBB->getFirstTerminator();
 
     // restore kill flag at the last use
@@ -915,6 +1132,115 @@ void PatmosSPReduce::fixupKillFlagOfCondRegs(void) {
 
   } // end for all elements in KilledCondRegs
   KilledCondRegs.clear();
+  HoistedCondMBBs.clear();
+}
+
+void PatmosSPReduce::hoistInvariantConditions(SPScope *S) {
+  if (S->isTopLevel())
+    return;
+
+  // the MBBs of the loop, including those of nested loops
+  std::set<MachineBasicBlock *> LoopMBBs;
+  for (auto iter = df_begin(S), end = df_end(S); iter != end; ++iter) {
+    for (auto block : (*iter)->getScopeBlocks())
+      LoopMBBs.insert(block->getMBB());
+  }
+
+  // Return true if Reg is written in the loop by an instruction other than
+  // Except, including clobbers of calls
+  auto isDefinedInLoop = [&](Register Reg, const MachineInstr *Except) {
+    for (auto MBB : LoopMBBs) {
+      for (const MachineInstr &MI : MBB->instrs()) {
+        if (&MI == Except)
+          continue;
+        for (const MachineOperand &MO : MI.operands()) {
+          if (MO.isRegMask() && MO.clobbersPhysReg(Reg))
+            return true;
+          if (MO.isReg() && MO.isDef() && MO.getReg() &&
+              TRI->regsOverlap(MO.getReg(), Reg))
+            return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  auto isLiveIn = [&](const MachineBasicBlock *MBB, Register Reg) {
+    for (const auto &LI : MBB->liveins()) {
+      if (TRI->regsOverlap(LI.PhysReg, Reg))
+        return true;
+    }
+    return false;
+  };
+
+  for (auto block : S->getScopeBlocks()) {
+    if (S->isSubheader(block))
+      continue;
+
+    // all definitions of a block use the condition of its branch
+    auto &defs = block->getDefinitions();
+    if (defs.empty())
+      continue;
+    Register Cond = defs.begin()->condPred.getReg();
+    if (std::any_of(defs.begin(), defs.end(), [&](const auto &def) {
+          return def.condPred.getReg() != Cond;
+        }))
+      continue;
+
+    // the last instruction writing the condition before the branch
+    MachineBasicBlock *MBB = block->getMBB();
+    MachineInstr *CondMI = nullptr;
+    for (auto MI = MBB->instr_begin(), ME = MBB->getFirstInstrTerminator();
+         MI != ME; ++MI) {
+      if (MI->modifiesRegister(Cond, TRI))
+        CondMI = &*MI;
+    }
+
+    // only unguarded computations without side effects are hoisted, their
+    // only result being the condition
+    if (!CondMI || CondMI->isBundled() || CondMI->isCall() ||
+        CondMI->mayLoadOrStore() || CondMI->hasUnmodeledSideEffects() ||
+        TII->isPredicated(*CondMI) || CondMI->getNumExplicitDefs() != 1 ||
+        CondMI->getOperand(0).getReg() != Cond)
+      continue;
+
+    bool Invariant = true;
+    for (const MachineOperand &MO : CondMI->operands()) {
+      if (MO.isImm() || (MO.isReg() && MO.getReg() == Patmos::P0 &&
+                         !MO.isDef()))
+        continue;
+      if (!MO.isReg() || (MO.isDef() && &MO != &CondMI->getOperand(0)) ||
+          (MO.isUse() && isDefinedInLoop(MO.getReg(), nullptr))) {
+        Invariant = false;
+        break;
+      }
+    }
+    if (!Invariant || isDefinedInLoop(Cond, CondMI) ||
+        isLiveIn(S->getHeader()->getMBB(), Cond))
+      continue;
+    if (std::any_of(S->getSucceedingBlocks().begin(),
+                    S->getSucceedingBlocks().end(), [&](const auto *succ) {
+          return isLiveIn(succ->getMBB(), Cond);
+        }))
+      continue;
+
+    LLVM_DEBUG(dbgs() << "  Hoist condition of MBB#" << MBB->getNumber()
+                      << ": " << *CondMI);
+    CondMI->removeFromParent();
+    HoistedConds[S].push_back(CondMI);
+    HoistedCondMBBs.insert(MBB);
+    HoistedCondInstrs++; // STATISTIC
+
+    // the condition is live across the iterations now
+    for (auto LoopMBB : LoopMBBs) {
+      for (MachineInstr &MI : LoopMBB->instrs()) {
+        for (MachineOperand &MO : MI.operands()) {
+          if (MO.isReg() && MO.isUse() && MO.getReg() == Cond)
+            MO.setIsKill(false);
+        }
+      }
+    }
+  }
 }
 
 
@@ -927,102 +1253,22 @@ void PatmosSPReduce::applyPredicates(SPScope *S, MachineFunction &MF) {
   // Predicate the instructions of blocks in S, also inserting spill/load
   // of predicates not in registers.
 
-  auto blocks = S->getScopeBlocks();
+  auto &blocks = S->getScopeBlocks();
   for(auto block: blocks){
     auto MBB = block->getMBB();
-    auto instrPreds = block->getInstructionPredicates();
     auto predRegs = getPredicateRegisters(R, block);
 
     // apply predicate to all instructions in block
     for( auto MI = MBB->instr_begin(), ME = MBB->getFirstInstrTerminator();
                                      MI != ME; ++MI) {
 
-      if (MI->isReturn()) {
-          DEBUG_TRACE( dbgs() << "    skip return: " << *MI );
-          continue;
-      }
-      if (TII->isStackControl(&*MI)) {
-          DEBUG_TRACE( dbgs() << "    skip stack control: " << *MI );
-          continue;
-      }
-      if (MI->getFlag(MachineInstr::FrameSetup)) {
-          continue;
-          DEBUG_TRACE(dbgs() << "    skip frame setup: " << *MI);
-      }
-      if (ReturnInfoInsts.count(&*MI)) {
-          DEBUG_TRACE(dbgs() << "    skip return info (re-)storing: " << *MI);
-          continue;
-      }
+      if (isUnguarded(*MI)) continue;
 
-      assert(instrPreds.count(&(*MI)));
-      auto instrPred = instrPreds[&(*MI)];
+      assert(block->getInstructionPredicate(&(*MI)).hasValue());
+      auto instrPred = *block->getInstructionPredicate(&(*MI));
       auto predReg = predRegs.count(instrPred) ? predRegs[instrPred] : Patmos::P0;
       DEBUG_TRACE( dbgs() << "Predicate (" << instrPred << ") set to register: (" << predReg << ")\n");
-      if (MI->isCall()) {
-          DEBUG_TRACE( dbgs() << "    call: " << *MI );
-          assert(!TII->isPredicated(*MI) && "call predicated");
-          DebugLoc DL = MI->getDebugLoc();
-          // copy actual preg to temporary preg
-          AddDefaultPred(BuildMI(*MBB, MI, DL,
-                TII->get(Patmos::PMOV), PRTmp))
-            .addReg(predReg).addImm(0);
-
-          // store/restore caller saved R9 (gets dirty during frame setup)
-          int fi = PMFI->getSinglePathCallSpillFI();
-          // store to stack slot
-          AddDefaultPred(BuildMI(*MBB, MI, DL, TII->get(Patmos::SWC)))
-            .addFrameIndex(fi).addImm(0) // address
-            .addReg(Patmos::R9, RegState::Kill);
-          // restore from stack slot (after the call MI)
-          AddDefaultPred(BuildMI(*MBB, std::next(MI), DL,
-                TII->get(Patmos::LWC), Patmos::R9))
-            .addFrameIndex(fi).addImm(0); // address
-          ++MI; // skip the load operation
-          InsertedInstrs += 3; // STATISTIC
-          continue;
-      }
-
-      if (MI->isPredicable(MachineInstr::QueryType::IgnoreBundle) && predReg != Patmos::P0) {
-        auto isPredicated = [&](auto instr){
-          int i = instr->findFirstPredOperandIdx();
-          if (i != -1) {
-            unsigned preg = instr->getOperand(i).getReg();
-            int      flag = instr->getOperand(++i).getImm();
-            return (preg!=Patmos::NoRegister && preg!=Patmos::P0) || flag;
-          }
-          // no predicates at all
-          return false;
-        };
-        if (!isPredicated(MI)) {
-          // find first predicate operand
-          int i = MI->findFirstPredOperandIdx();
-          assert(i != -1);
-          MachineOperand &PO1 = MI->getOperand(i);
-          MachineOperand &PO2 = MI->getOperand(i+1);
-          assert(PO1.isReg() && PO2.isImm() &&
-                 "Unexpected Patmos predicate operand");
-          PO1.setReg(predReg);
-          PO2.setImm(0);
-        } else {
-          DEBUG_TRACE( dbgs() << "    in MBB#" << MBB->getNumber()
-                        << ": instruction already predicated: " << *MI );
-          // read out the predicate
-          int i = MI->findFirstPredOperandIdx();
-          assert(i != -1);
-          MachineOperand &PO1 = MI->getOperand(i);
-          MachineOperand &PO2 = MI->getOperand(i+1);
-          if (!(PO1.getReg() == predReg && PO2.getImm() == 0)) {
-            // build a new predicate := use_preg & old pred
-            AddDefaultPred(BuildMI(*MBB, MI, MI->getDebugLoc(),
-                                TII->get(Patmos::PAND), PRTmp))
-                  .addReg(predReg).addImm(0)
-                  .add(PO1).add(PO2);
-            PO1.setReg(PRTmp);
-            PO2.setImm(0);
-            InsertedInstrs++; // STATISTIC
-          }
-        }
-      }
+      applyPredicate(*MBB, MI, predReg);
     } // for each instruction in MBB
 
     // insert spill and load instructions for the guard register
@@ -1037,7 +1283,7 @@ void PatmosSPReduce::applyPredicates(SPScope *S, MachineFunction &MF) {
       MachineBasicBlock::iterator MI = MBB->begin();
       while (MI->getFlag(MachineInstr::FrameSetup)) ++MI;
 
-      auto headerPreds = block->getBlockPredicates();
+      auto &headerPreds = block->getBlockPredicates();
       assert(headerPreds.size() == 1);
       // HT
       auto pred = *block->getBlockPredicates().begin();
@@ -1051,6 +1297,99 @@ void PatmosSPReduce::applyPredicates(SPScope *S, MachineFunction &MF) {
   }
 }
 
+bool PatmosSPReduce::isUnguarded(const MachineInstr &MI) const {
+  if (MI.isReturn()) {
+      DEBUG_TRACE( dbgs() << "    skip return: " << MI );
+      return true;
+  }
+  if (TII->isStackControl(&MI)) {
+      DEBUG_TRACE( dbgs() << "    skip stack control: " << MI );
+      return true;
+  }
+  if (MI.getFlag(MachineInstr::FrameSetup)) {
+      return true;
+      DEBUG_TRACE(dbgs() << "    skip frame setup: " << MI);
+  }
+  if (ReturnInfoInsts.count(&MI)) {
+      DEBUG_TRACE(dbgs() << "    skip return info (re-)storing: " << MI);
+      return true;
+  }
+
+  return false;
+}
+
+
+void PatmosSPReduce::applyPredicate(MachineBasicBlock &MBB,
+                                    MachineBasicBlock::instr_iterator &MI,
+                                    unsigned predReg) {
+  if (MI->isCall()) {
+      DEBUG_TRACE( dbgs() << "    call: " << *MI );
+      assert(!TII->isPredicated(*MI) && "call predicated");
+      DebugLoc DL = MI->getDebugLoc();
+      // copy actual preg to temporary preg
+      AddDefaultPred(BuildMI(MBB, MI, DL,
+            TII->get(Patmos::PMOV), PRTmp))
+        .addReg(predReg).addImm(0);
+
+      // store/restore caller saved R9 (gets dirty during frame setup)
+      int fi = PMFI->getSinglePathCallSpillFI();
+      // store to stack slot
+      AddDefaultPred(BuildMI(MBB, MI, DL, TII->get(Patmos::SWC)))
+        .addFrameIndex(fi).addImm(0) // address
+        .addReg(Patmos::R9, RegState::Kill);
+      // restore from stack slot (after the call MI)
+      AddDefaultPred(BuildMI(MBB, std::next(MI), DL,
+            TII->get(Patmos::LWC), Patmos::R9))
+        .addFrameIndex(fi).addImm(0); // address
+      ++MI; // skip the load operation
+      InsertedInstrs += 3; // STATISTIC
+      return;
+  }
+
+  if (MI->isPredicable(MachineInstr::QueryType::IgnoreBundle) && predReg != Patmos::P0) {
+    auto isPredicated = [&](auto instr){
+      int i = instr->findFirstPredOperandIdx();
+      if (i != -1) {
+        unsigned preg = instr->getOperand(i).getReg();
+        int      flag = instr->getOperand(++i).getImm();
+        return (preg!=Patmos::NoRegister && preg!=Patmos::P0) || flag;
+      }
+      // no predicates at all
+      return false;
+    };
+    if (!isPredicated(MI)) {
+      // find first predicate operand
+      int i = MI->findFirstPredOperandIdx();
+      assert(i != -1);
+      MachineOperand &PO1 = MI->getOperand(i);
+      MachineOperand &PO2 = MI->getOperand(i+1);
+      assert(PO1.isReg() && PO2.isImm() &&
+             "Unexpected Patmos predicate operand");
+      PO1.setReg(predReg);
+      PO2.setImm(0);
+    } else {
+      DEBUG_TRACE( dbgs() << "    in MBB#" << MBB.getNumber()
+                    << ": instruction already predicated: " << *MI );
+      // read out the predicate
+      int i = MI->findFirstPredOperandIdx();
+      assert(i != -1);
+      MachineOperand &PO1 = MI->getOperand(i);
+      MachineOperand &PO2 = MI->getOperand(i+1);
+      if (!(PO1.getReg() == predReg && PO2.getImm() == 0)) {
+        // build a new predicate := use_preg & old pred
+        AddDefaultPred(BuildMI(MBB, MI, MI->getDebugLoc(),
+                            TII->get(Patmos::PAND), PRTmp))
+              .addReg(predReg).addImm(0)
+              .add(PO1).add(PO2);
+        PO1.setReg(PRTmp);
+        PO2.setImm(0);
+        InsertedInstrs++; // STATISTIC
+      }
+    }
+  }
+}
+
+
 std::map<unsigned, unsigned> PatmosSPReduce::getPredicateRegisters(const RAInfo &R,
                                     const PredicatedBlock *block)
 {
@@ -1065,6 +1404,48 @@ std::map<unsigned, unsigned> PatmosSPReduce::getPredicateRegisters(const RAInfo
   return uls;
 }
 
+void PatmosSPReduce::collectLoopCounterRegs(MachineFunction &MF) {
+  LoopCntRegs.clear();
+
+  unsigned maxDepth = 0;
+  for (auto iter = df_begin(RootScope), end = df_end(RootScope);
+        iter != end; ++iter) {
+    maxDepth = std::max(maxDepth, (*iter)->getDepth());
+  }
+  LoopCntRegs.assign(maxDepth, Patmos::NoRegister);
+  if (!EnableRegLoopCounters) return;
+
+  // Only caller-saved registers that are not used at all in the function
+  // are free in every loop: Callee-saved registers would have to be saved by
+  // the (already inserted) prologue and calls clobber all caller-saved ones,
+  // which is covered by isPhysRegUsed().
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  BitVector Reserved = TRI->getReservedRegs(MF);
+  BitVector CalleeSaved(TRI->getNumRegs());
+  for (const MCPhysReg *CSR = TRI->getCalleeSavedRegs(&MF); *CSR; ++CSR) {
+    CalleeSaved.set(*CSR);
+  }
+
+  // Counters of deeper loops are updated more often, so they get the
+  // registers first.
+  unsigned depth = maxDepth;
+  for (auto Reg: Patmos::RRegsRegClass) {
+    if (depth == 0) break;
+    if (Reserved.test(Reg) || CalleeSaved.test(Reg) || MRI.isPhysRegUsed(Reg)) {
+      continue;
+    }
+    LLVM_DEBUG( dbgs() << "Loop counter of depth " << depth << " in "
+                       << TRI->getName(Reg) << "\n" );
+    LoopCntRegs[depth - 1] = Reg;
+    depth--;
+  }
+}
+
+unsigned PatmosSPReduce::getLoopCounterReg(const SPScope *S) const {
+  assert(!S->isTopLevel());
+  return LoopCntRegs[S->getDepth() - 1];
+}
+
 void PatmosSPReduce::getStackLocPair(int &fi, unsigned &bitpos,
                                      const unsigned stloc) const {
   fi = PMFI->getSinglePathExcessSpillFI(stloc / 32);
@@ -1203,7 +1584,7 @@ void PatmosSPReduce::mergeMBBs(MachineFunction &MF) {
         }
       }else{
         if(MBBBlock){
-          MBBBlock->replaceMbb(BaseMBB);
+          RootScope->replaceMbb(MBBBlock, BaseMBB);
         }
       }
 
@@ -1315,10 +1696,126 @@ void PatmosSPReduce::eliminateFrameIndices(MachineFunction &MF) {
 }
 
 
+/// getLoadForStore - Return the load of the same width and memory type as the
+/// store Opcode, zero-extending sub-word values.
+static unsigned getLoadForStore(unsigned Opcode) {
+  switch (Opcode) {
+  case Patmos::SWC: return Patmos::LWC;
+  case Patmos::SHC: return Patmos::LHUC;
+  case Patmos::SBC: return Patmos::LBUC;
+  case Patmos::SWM: return Patmos::LWM;
+  case Patmos::SHM: return Patmos::LHUM;
+  case Patmos::SBM: return Patmos::LBUM;
+  default: llvm_unreachable("Unexpected store of the data cache or memory");
+  }
+}
+
+unsigned PatmosSPReduce::getScratchReg(const MachineFunction &MF) const {
+  // The register is only used between an access and its predicated move,
+  // with no call in between, so any caller-saved register left untouched by
+  // the function will do, also across calls.
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  BitVector Reserved = TRI->getReservedRegs(MF);
+  BitVector CalleeSaved(TRI->getNumRegs());
+  for (const MCPhysReg *CSR = TRI->getCalleeSavedRegs(&MF); *CSR; ++CSR) {
+    CalleeSaved.set(*CSR);
+  }
+  for (auto Reg: Patmos::RRegsRegClass) {
+    if (!Reserved.test(Reg) && !CalleeSaved.test(Reg) &&
+        MRI.reg_nodbg_empty(Reg)) {
+      return Reg;
+    }
+  }
+  return Patmos::NoRegister;
+}
+
+void PatmosSPReduce::normalizeMemAccesses(MachineFunction &MF) {
+  if (!EnableNormalizeMemAccesses) return;
+
+  unsigned TmpReg = getScratchReg(MF);
+  LLVM_DEBUG( dbgs() << "Normalize memory accesses with "
+                     << (TmpReg ? TRI->getName(TmpReg) : "no register")
+                     << "\n" );
+
+  for (auto &MBB : MF) {
+    for (auto MI = MBB.instr_begin(), ME = MBB.instr_end(); MI != ME; ++MI) {
+      if (!(MI->mayLoad() || MI->mayStore()) || MI->isCall() ||
+          MI->isInlineAsm() || TII->isPseudo(&*MI) ||
+          !TII->isPredicated(*MI)) {
+        continue;
+      }
+      // The stack cache and the scratchpad always hit.
+      PatmosII::MemType MT = TII->getMemType(*MI);
+      if (MT != PatmosII::MEM_C && MT != PatmosII::MEM_M) continue;
+
+      // Volatile accesses must not be executed speculatively, and accesses
+      // without memory operands might be such.
+      const char *Reason = nullptr;
+      if (!TmpReg)
+        Reason = "no free scratch register";
+      else if (MI->isBundled())
+        Reason = "the access is bundled";
+      else if (MI->hasOrderedMemoryRef())
+        Reason = "the access may be volatile";
+      if (Reason) {
+        ORE->emit([&]() {
+          return MachineOptimizationRemarkMissed(DEBUG_TYPE,
+                                                 "MemAccessNotNormalized",
+                                                 MI->getDebugLoc(), &MBB)
+                 << "predicated memory access not normalized, "
+                 << ore::NV("Reason", Reason);
+        });
+        continue;
+      }
+
+      int PI = MI->findFirstPredOperandIdx();
+      assert(PI != -1);
+      MachineOperand Guard = MI->getOperand(PI);
+      MachineOperand GuardFlag = MI->getOperand(PI + 1);
+      MI->getOperand(PI).setReg(Patmos::P0);
+      MI->getOperand(PI).setIsKill(false);
+      MI->getOperand(PI + 1).setImm(0);
+      DebugLoc DL = MI->getDebugLoc();
+
+      // the address is not the one of the memory operands when the
+      // predicate does not hold
+      MI->dropMemRefs(MF);
+      NormalizedMemAccesses++; // STATISTIC
+
+      if (MI->mayLoad()) {
+        // (g) ld rd = [a]  ==>  ld tmp = [a]; (g) mov rd = tmp
+        Register DstReg = MI->getOperand(0).getReg();
+        MI->getOperand(0).setReg(TmpReg);
+        BuildMI(MBB, std::next(MI), DL, TII->get(Patmos::MOV), DstReg)
+          .add(Guard).add(GuardFlag)
+          .addReg(TmpReg, RegState::Kill);
+        ++MI; // skip the move
+        InsertedInstrs++; // STATISTIC
+      } else {
+        // (g) st [a] = rs  ==>  ld tmp = [a]; (g) mov tmp = rs; st [a] = tmp
+        MachineOperand &Addr = MI->getOperand(2);
+        MachineOperand &Offset = MI->getOperand(3);
+        MachineOperand &Value = MI->getOperand(4);
+        MachineOperand AddrUse = Addr;
+        AddrUse.setIsKill(false);
+        AddDefaultPred(BuildMI(MBB, MI, DL,
+              TII->get(getLoadForStore(MI->getOpcode())), TmpReg))
+          .add(AddrUse).add(Offset);
+        BuildMI(MBB, MI, DL, TII->get(Patmos::MOV), TmpReg)
+          .add(Guard).add(GuardFlag)
+          .add(Value);
+        Value.setReg(TmpReg);
+        Value.setIsKill(true);
+        InsertedInstrs += 2; // STATISTIC
+      }
+    }
+  }
+}
+
 void PatmosSPReduce::getLoopLiveOutPRegs(const SPScope *S,
                                          std::vector<unsigned> &pregs) const {
 
-  auto SuccMBBs = S->getSucceedingBlocks();
+  auto &SuccMBBs = S->getSucceedingBlocks();
 
   pregs.clear();
   for(auto succ: SuccMBBs) {
@@ -1378,11 +1875,6 @@ void LinearizeWalker::enterSubscope(SPScope *S) {
     int fi = Pass.PMFI->getSinglePathS0SpillFI(S->getDepth() - 1);
     Pass.TII->copyPhysReg(*PrehdrMBB, PrehdrMBB->end(), DL,
         Pass.GuardsReg, Patmos::S0, false);
-    // we insert a dummy load for the RedundantLdStEliminator
-    MachineInstr *Dummy = AddDefaultPred(BuildMI(*PrehdrMBB, PrehdrMBB->end(),
-          DL, Pass.TII->get(Patmos::LBC), Pass.GuardsReg))
-          .addFrameIndex(fi).addImm(0); // address
-    Pass.GuardsLdStElim->addRemovableInst(Dummy);
     AddDefaultPred(BuildMI(*PrehdrMBB, PrehdrMBB->end(), DL,
             Pass.TII->get(Patmos::SBC)))
       .addFrameIndex(fi).addImm(0) // address
@@ -1392,9 +1884,27 @@ void LinearizeWalker::enterSubscope(SPScope *S) {
 
   insertHeaderPredLoadOrCopy(S, PrehdrMBB, DL);
 
+  // compute the loop-invariant conditions once, before the loop
+  auto Hoisted = Pass.HoistedConds.find(S);
+  if (Hoisted != Pass.HoistedConds.end()) {
+    for (MachineInstr *MI : Hoisted->second)
+      PrehdrMBB->insert(PrehdrMBB->end(), MI);
+  }
+
 
   // Initialize the loop bound and store it to the stack slot
-  if (S->hasLoopBound()) {
+  unsigned cntReg = Pass.getLoopCounterReg(S);
+  if (S->hasLoopBound() && cntReg != Patmos::NoRegister) {
+    // The counter is kept in a register, just initialize it
+    uint32_t loop = S->getLoopBound();
+    AddDefaultPred(BuildMI(*PrehdrMBB, PrehdrMBB->end(), DL,
+          Pass.TII->get( (isUInt<12>(loop)) ? Patmos::LIi : Patmos::LIl),
+          cntReg))
+      .addImm(loop); // the loop bound
+    InsertedInstrs++; // STATISTIC
+    LoopCounters++; // STATISTIC
+    RegLoopCounters++; // STATISTIC
+  } else if (S->hasLoopBound()) {
     unsigned tmpReg = Pass.GuardsReg;
     uint32_t loop = S->getLoopBound();
     // Create an instruction to load the loop bound
@@ -1405,11 +1915,6 @@ void LinearizeWalker::enterSubscope(SPScope *S) {
       .addImm(loop); // the loop bound
 
     int fi = Pass.PMFI->getSinglePathLoopCntFI(S->getDepth()-1);
-    // we insert a dummy load for the RedundantLdStEliminator
-    MachineInstr *Dummy = AddDefaultPred(BuildMI(*PrehdrMBB, PrehdrMBB->end(),
-          DL, Pass.TII->get(Patmos::LWC), Pass.GuardsReg))
-          .addFrameIndex(fi).addImm(0); // address
-    Pass.GuardsLdStElim->addRemovableInst(Dummy);
     // store the initialized loop bound to its stack slot
     AddDefaultPred(BuildMI(*PrehdrMBB, PrehdrMBB->end(), DL,
             Pass.TII->get(Patmos::SWC)))
@@ -1457,28 +1962,46 @@ void LinearizeWalker::exitSubscope(SPScope *S) {
   // load the branch predicate:
   // load the loop counter, decrement it by one, and if it is not (yet)
   // zero, we enter the loop again.
-  // TODO is the loop counter in a register?!
-  int fi = Pass.PMFI->getSinglePathLoopCntFI(S->getDepth() - 1);
-  unsigned tmpReg = Pass.GuardsReg;
-  AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
-          Pass.TII->get(Patmos::LWC), tmpReg))
-    .addFrameIndex(fi).addImm(0); // address
-
-  // decrement
-  AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
-          Pass.TII->get(Patmos::SUBi), tmpReg))
-    .addReg(tmpReg).addImm(1);
-  // compare with 0, PRTmp as predicate register
   unsigned branch_preg = Pass.PRTmp;
-  AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
-          Pass.TII->get(Patmos::CMPLT), branch_preg))
-    .addReg(Patmos::R0).addReg(tmpReg);
-  // store back
-  AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
-          Pass.TII->get(Patmos::SWC)))
-    .addFrameIndex(fi).addImm(0) // address
-    .addReg(tmpReg, RegState::Kill);
-  InsertedInstrs += 4; // STATISTIC
+  // whether the branch is taken if branch_preg is false
+  unsigned branch_flag = 0;
+  unsigned cntReg = Pass.getLoopCounterReg(S);
+  if (cntReg != Patmos::NoRegister) {
+    // The counter is in a register: compare before decrementing, such that
+    // the compare and the decrement are independent and can be bundled.
+    // We enter the loop again if the counter is not <= 1, PRTmp as
+    // predicate register
+    AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
+            Pass.TII->get(Patmos::CMPILE), branch_preg))
+      .addReg(cntReg).addImm(1);
+    // decrement
+    AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
+            Pass.TII->get(Patmos::SUBi), cntReg))
+      .addReg(cntReg).addImm(1);
+    branch_flag = 1;
+    InsertedInstrs += 2; // STATISTIC
+  } else {
+    int fi = Pass.PMFI->getSinglePathLoopCntFI(S->getDepth() - 1);
+    unsigned tmpReg = Pass.GuardsReg;
+    AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
+            Pass.TII->get(Patmos::LWC), tmpReg))
+      .addFrameIndex(fi).addImm(0); // address
+
+    // decrement
+    AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
+            Pass.TII->get(Patmos::SUBi), tmpReg))
+      .addReg(tmpReg).addImm(1);
+    // compare with 0, PRTmp as predicate register
+    AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
+            Pass.TII->get(Patmos::CMPLT), branch_preg))
+      .addReg(Patmos::R0).addReg(tmpReg);
+    // store back
+    AddDefaultPred(BuildMI(*BranchMBB, BranchMBB->end(), DL,
+            Pass.TII->get(Patmos::SWC)))
+      .addFrameIndex(fi).addImm(0) // address
+      .addReg(tmpReg, RegState::Kill);
+    InsertedInstrs += 4; // STATISTIC
+  }
 
   // insert branch to header
   assert(branch_preg != Patmos::NoRegister);
@@ -1495,7 +2018,7 @@ void LinearizeWalker::exitSubscope(SPScope *S) {
 
   // branch condition: not(<= zero)
   BuildMI(*BranchMBB, BranchMBB->end(), DL, Pass.TII->get(Patmos::BR))
-    .addReg(branch_preg).addImm(0)
+    .addReg(branch_preg).addImm(branch_flag)
     .addMBB(HeaderMBB);
   BranchMBB->addSuccessor(HeaderMBB);
   InsertedInstrs++; // STATISTIC
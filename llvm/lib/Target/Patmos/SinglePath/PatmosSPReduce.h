@@ -20,6 +20,9 @@
 //     inserts MBBs around loops for predicate spilling/restoring,
 //     setting/loading loop bounds, etc.
 // (4) MBBs are merged and renumbered, as finalization step.
+// (5) Optionally, the predicated accesses of the data cache and the main
+//     memory are normalized to access the same address regardless of their
+//     predicate, see normalizeMemAccesses.
 //
 //===----------------------------------------------------------------------===//
 
@@ -32,7 +35,6 @@
 namespace llvm {
 
   class LinearizeWalker;
-  class RedundantLdStEliminator;
 
   class PatmosSPReduce : public MachineFunctionPass {
   private:
@@ -136,9 +138,36 @@ namespace llvm {
     /// appropriately.
     void fixupKillFlagOfCondRegs(void);
 
+    /// hoistInvariantConditions - Move the compares computing loop-invariant
+    /// branch conditions of the blocks of the loop S to HoistedConds, to be
+    /// placed in the preheader of S. The conditions stay in their registers
+    /// across the iterations: neither their operands nor the condition
+    /// register may be written in the loop, and the condition may not live
+    /// into the loop or out of it.
+    void hoistInvariantConditions(SPScope *S);
+
     /// applyPredicates - Predicate instructions of MBBs in the given SPScope.
     void applyPredicates(SPScope *S, MachineFunction &MF);
 
+    /// isUnguarded - Return true if MI is executed unconditionally, i.e.,
+    /// returns, stack control and frame setup.
+    bool isUnguarded(const MachineInstr &MI) const;
+
+    /// applyPredicate - Guard MI with the given predicate register.
+    /// Calls pass the predicate to the callee in PRTmp; MI is advanced past
+    /// the instructions inserted after the call.
+    void applyPredicate(MachineBasicBlock &MBB,
+                        MachineBasicBlock::instr_iterator &MI,
+                        unsigned predReg);
+
+    /// isStraightLine - Return true if MF is a chain of blocks without any
+    /// branching, which needs no predicate definitions nor linearization.
+    bool isStraightLine(const MachineFunction &MF) const;
+
+    /// doReduceStraightLine - Reduce a straight-line function: merge its
+    /// blocks and guard it with the predicate of the caller.
+    void doReduceStraightLine(MachineFunction &MF);
+
     /// insertUseSpillLoad - Insert Spill/Load code at the beginning of the
     /// given MBB, according to R.
     void insertUseSpillLoad(const RAInfo &R, PredicatedBlock *block);
@@ -168,6 +197,26 @@ namespace llvm {
     /// collected stack store and load indices
     void eliminateFrameIndices(MachineFunction &MF);
 
+    /// normalizeMemAccesses - Execute the predicated loads and stores of the
+    /// data cache and main memory unconditionally, selecting their effect by
+    /// a predicated move through a scratch register, so they touch the same
+    /// cache line whether their predicate holds or not.
+    void normalizeMemAccesses(MachineFunction &MF);
+
+    /// getScratchReg - Return a caller-saved general-purpose register not
+    /// referenced in MF, or Patmos::NoRegister if there is none.
+    unsigned getScratchReg(const MachineFunction &MF) const;
+
+    /// collectLoopCounterRegs - Collect the unused general-purpose registers
+    /// that can hold loop counters instead of their stack slots, one per
+    /// loop nesting depth, in LoopCntRegs.
+    void collectLoopCounterRegs(MachineFunction &MF);
+
+    /// getLoopCounterReg - Return the register holding the loop counter of
+    /// the given scope, or Patmos::NoRegister if the counter is kept in its
+    /// stack slot.
+    unsigned getLoopCounterReg(const SPScope *S) const;
+
     /// getLoopLiveOutPRegs - Collect unavailable PRegs that must be preserved
     /// in S0 during predicate allocation SPScope on exiting the SPScope
     /// because it lives in into a loop successor
@@ -185,20 +234,31 @@ namespace llvm {
     unsigned GuardsReg; // RReg to hold all predicates
     unsigned PRTmp;     // temporary PReg
 
-    // At each doReduce on a function, an instance of the
-    // RedundantLdStEliminator is created
-    RedundantLdStEliminator *GuardsLdStElim;
+    // The register holding the loop counters of each nesting depth
+    // (starting with depth 1), or Patmos::NoRegister if the counter is kept
+    // in its stack slot.
+    std::vector<unsigned> LoopCntRegs;
 
     // Branches that set the kill flag on condition operands are remembered,
     // as the branches themselves are removed. The last use of these
     // conditions before the branch will be set the kill flag
     std::map<MachineBasicBlock *, MachineOperand> KilledCondRegs;
 
+    // The compares of loop-invariant conditions removed from the blocks of
+    // each loop, which are inserted into its preheader at linearization.
+    std::map<const SPScope *, std::vector<MachineInstr *>> HoistedConds;
+
+    // The MBBs whose branch condition is hoisted. The condition lives through
+    // the whole loop, its kill flag must not be restored at the MBB.
+    std::set<const MachineBasicBlock *> HoistedCondMBBs;
+
     // To preserve the call hierarchy (calls are unconditional in single-path
     // code) instructions that store/restore return information (s7+s8)
     // need to be excluded from predication
     std::set<const MachineInstr *> ReturnInfoInsts;
 
+    MachineOptimizationRemarkEmitter *ORE;
+
   public:
     /// Pass ID
     static char ID;
@@ -220,14 +280,19 @@ namespace llvm {
 
     /// getAnalysisUsage - Specify which passes this pass depends on
     void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<PatmosSinglePathInfo>();
       AU.addRequired<PatmosSPBundling>();
+      AU.addRequired<MachineOptimizationRemarkEmitterPass>();
+      // The SPScope tree is updated as the MBBs are merged
+      AU.addPreserved<PatmosSinglePathInfo>();
       MachineFunctionPass::getAnalysisUsage(AU);
     }
 
     /// runOnMachineFunction - Run the SP converter on the given function.
     bool runOnMachineFunction(MachineFunction &MF) override {
-      RootScope = getAnalysis<PatmosSPBundling>().getRootScope();
+      RootScope = getAnalysis<PatmosSinglePathInfo>().getRootScope();
       PMFI = MF.getInfo<PatmosMachineFunctionInfo>();
+      ORE = &getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
       bool changed = false;
       // only convert function if marked
       if ( MF.getInfo<PatmosMachineFunctionInfo>()->isSinglePath()) {
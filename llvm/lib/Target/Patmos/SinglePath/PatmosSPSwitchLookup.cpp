@@ -0,0 +1,420 @@
+//===-- PatmosSPSwitchLookup.cpp - Switches to lookups in single-path code ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Replace switches of single-path functions that only select values by a
+// lookup of the value, before LowerSwitch turns them into a tree of branches.
+//
+// Single-path conversion executes every node of that tree, predicated, so the
+// cost of a lowered switch grows with the number of its cases in any case.
+// A switch whose cases only forward to a common successor, possibly through
+// a block of instructions that are safe to speculate, merely selects the
+// incoming values of the PHIs there. Such a switch is replaced by
+//  - a load from a constant table indexed by the condition, if all selected
+//    values are constants and the cases are dense enough, or
+//  - a chain of compares and selects, i.e., predicated moves, for small
+//    switches.
+// Both take the same time for every value of the condition. Switches with a
+// case that has side effects are left to LowerSwitch, the single-path
+// conversion predicates the case bodies.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosSinglePathInfo.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-singlepath"
+
+STATISTIC(NumSwitchTables,  "Number of single-path switches made table "
+                            "lookups");
+STATISTIC(NumSwitchSelects, "Number of single-path switches made selects");
+STATISTIC(NumSpeculated,    "Number of instructions of switch cases "
+                            "speculated");
+
+static cl::opt<bool> EnableSPSwitchLookup("mpatmos-sp-switch-lookup",
+  cl::init(true),
+  cl::desc("Replace switches in single-path code that only select values by "
+           "table lookups or selects."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SPSwitchMinTable("mpatmos-sp-switch-min-table",
+  cl::init(4),
+  cl::desc("Minimum number of cases of a single-path switch for a lookup "
+           "table (default: 4)."),
+  cl::Hidden);
+
+static cl::opt<unsigned> SPSwitchMaxSelects("mpatmos-sp-switch-max-selects",
+  cl::init(16),
+  cl::desc("Maximum number of compares of a single-path switch lowered to "
+           "selects (default: 16)."),
+  cl::Hidden);
+
+/// The largest lookup table, in entries.
+static const uint64_t MaxTableSize = 256;
+
+/// The minimum share of the table entries in percent that are cases.
+static const uint64_t MinTableDensity = 40;
+
+namespace {
+
+class PatmosSPSwitchLookup : public FunctionPass {
+private:
+  /// isForwarder - Return true if Dest only forwards the switch in BB to its
+  /// successor, after instructions that may be speculated into BB.
+  static bool isForwarder(const BasicBlock *Dest, const BasicBlock *BB);
+
+  /// isUnreachable - Return true if Dest is an unreachable default.
+  static bool isUnreachable(const BasicBlock *Dest) {
+    return isa<UnreachableInst>(Dest->getFirstNonPHIOrDbg());
+  }
+
+  /// isTableValue - Return true if V may be an entry of a lookup table.
+  static bool isTableValue(const Value *V) {
+    return isa<ConstantInt>(V) || isa<ConstantFP>(V) ||
+           isa<ConstantPointerNull>(V) || isa<GlobalValue>(V) ||
+           isa<UndefValue>(V);
+  }
+
+  /// lookupSwitch - Replace SI by lookups of the values it selects.
+  /// @return Whether SI was replaced.
+  bool lookupSwitch(SwitchInst *SI);
+
+  /// buildTable - Load the value of PN from a constant table indexed by
+  /// Index, i.e., the condition minus the smallest case.
+  Value *buildTable(IRBuilder<> &Builder, PHINode *PN, Value *Index,
+                    Value *InRange, const APInt &Min, uint64_t Size,
+                    const MapVector<ConstantInt*, Value*> &Cases,
+                    Value *Default);
+
+  /// buildSelects - Select the value of PN by compares of the condition,
+  /// starting from the value Base that needs no compare.
+  Value *buildSelects(IRBuilder<> &Builder, Value *Cond,
+                      const MapVector<Value*, SmallVector<ConstantInt*, 4>>
+                        &Groups, Value *Base);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+
+  PatmosSPSwitchLookup() : FunctionPass(ID) {}
+
+  /// getPassName - Return the pass' name.
+  StringRef getPassName() const override {
+    return "Patmos Single-Path Switch Lookup (bitcode)";
+  }
+
+  bool runOnFunction(Function &F) override;
+};
+
+} // end anonymous namespace
+
+char PatmosSPSwitchLookup::ID = 0;
+
+
+FunctionPass *llvm::createPatmosSPSwitchLookupPass() {
+  return new PatmosSPSwitchLookup();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosSPSwitchLookup::runOnFunction(Function &F) {
+  if (!EnableSPSwitchLookup || skipFunction(F)) return false;
+  if (!PatmosSinglePathInfo::isEnabled(F)) return false;
+
+  SmallVector<SwitchInst*, 8> Switches;
+  for (BasicBlock &BB : F) {
+    if (auto SI = dyn_cast<SwitchInst>(BB.getTerminator())) {
+      Switches.push_back(SI);
+    }
+  }
+
+  bool changed = false;
+  for (auto SI : Switches) {
+    changed |= lookupSwitch(SI);
+  }
+  return changed;
+}
+
+
+bool PatmosSPSwitchLookup::isForwarder(const BasicBlock *Dest,
+                                       const BasicBlock *BB) {
+  if (Dest->getUniquePredecessor() != BB || isa<PHINode>(Dest->front()))
+    return false;
+
+  auto Br = dyn_cast<BranchInst>(Dest->getTerminator());
+  if (!Br || Br->isConditional() || Br->getSuccessor(0) == Dest)
+    return false;
+  const BasicBlock *Succ = Br->getSuccessor(0);
+
+  for (const Instruction &I : *Dest) {
+    if (&I == Br || isa<DbgInfoIntrinsic>(I)) continue;
+    if (!isSafeToSpeculativelyExecute(&I)) return false;
+    // The values may only flow on to the PHIs of the successor
+    for (const Use &U : I.uses()) {
+      auto User = cast<Instruction>(U.getUser());
+      if (User->getParent() == Dest) continue;
+      auto PN = dyn_cast<PHINode>(User);
+      if (!PN || PN->getParent() != Succ ||
+          PN->getIncomingBlock(U) != Dest)
+        return false;
+    }
+  }
+  return true;
+}
+
+
+bool PatmosSPSwitchLookup::lookupSwitch(SwitchInst *SI) {
+  BasicBlock *BB = SI->getParent();
+  Value *Cond = SI->getCondition();
+  if (SI->getNumCases() == 0) return false;
+
+  // Find the common successor all cases lead to
+  BasicBlock *DefaultDest = SI->getDefaultDest();
+  bool HasDefault = !isUnreachable(DefaultDest);
+  BasicBlock *Succ = nullptr;
+  SmallPtrSet<BasicBlock*, 16> Forwarders;
+  for (unsigned i = 0, e = SI->getNumSuccessors(); i != e; i++) {
+    BasicBlock *Dest = SI->getSuccessor(i);
+    if (Dest == DefaultDest && !HasDefault) {
+      // A case that is unreachable as well is left to LowerSwitch
+      if (i != 0) return false;
+      continue;
+    }
+
+    BasicBlock *Target = Dest;
+    if (isForwarder(Dest, BB)) {
+      Forwarders.insert(Dest);
+      Target = Dest->getTerminator()->getSuccessor(0);
+    }
+    if (Succ && Succ != Target) return false;
+    Succ = Target;
+  }
+  // The successor is reached from any case, or all cases are unreachable
+  if (!Succ || Succ == BB) return false;
+
+  auto getIncoming = [&](PHINode *PN, BasicBlock *Dest) {
+    return PN->getIncomingValueForBlock(Forwarders.count(Dest) ? Dest : BB);
+  };
+
+  // Collect the cases, the selected values are checked per PHI below
+  SmallVector<PHINode*, 4> PHIs;
+  for (PHINode &PN : Succ->phis()) {
+    PHIs.push_back(&PN);
+  }
+  APInt Min = SI->case_begin()->getCaseValue()->getValue();
+  APInt Max = Min;
+  for (auto Case : SI->cases()) {
+    const APInt &V = Case.getCaseValue()->getValue();
+    if (V.slt(Min)) Min = V;
+    if (V.sgt(Max)) Max = V;
+  }
+  uint64_t NumCases = SI->getNumCases();
+  uint64_t Size = (Max - Min).getLimitedValue(MaxTableSize + 1) + 1;
+  bool Dense = NumCases >= SPSwitchMinTable && Size <= MaxTableSize &&
+               NumCases * 100 >= Size * MinTableDensity;
+
+  // Decide on a table or selects for every PHI first
+  SmallVector<bool, 4> UseTable;
+  for (auto PN : PHIs) {
+    Value *Default = HasDefault ? getIncoming(PN, DefaultDest) : nullptr;
+    bool Table = Dense && (PN->getType()->isIntegerTy() ||
+                           PN->getType()->isFloatingPointTy() ||
+                           PN->getType()->isPointerTy());
+    MapVector<Value*, unsigned> Groups;
+    for (auto Case : SI->cases()) {
+      Value *V = getIncoming(PN, Case.getCaseSuccessor());
+      Table &= isTableValue(V);
+      Groups[V]++;
+    }
+    // Holes in the table need a constant default
+    if (Table && Size != NumCases && Default && !isTableValue(Default))
+      Table = false;
+    if (!Table) {
+      // Cases with the default value, or the largest group without a
+      // default, need no compare
+      unsigned Base = 0;
+      for (auto &G : Groups) {
+        if (Default ? G.first == Default : G.second > Base)
+          Base = G.second;
+      }
+      if (NumCases - Base > SPSwitchMaxSelects) return false;
+    }
+    UseTable.push_back(Table);
+  }
+
+  LLVM_DEBUG( dbgs() << "Lookup switch in '" << BB->getName() << "' of '"
+                << BB->getParent()->getName() << "': " << NumCases
+                << " cases, " << PHIs.size() << " values\n");
+
+  // Speculate the forwarding blocks in order of the switch
+  IRBuilder<> Builder(SI);
+  for (unsigned i = 0, e = SI->getNumSuccessors(); i != e; i++) {
+    BasicBlock *Dest = SI->getSuccessor(i);
+    if (!Forwarders.count(Dest) || Dest->size() == 1) continue;
+    while (&Dest->front() != Dest->getTerminator()) {
+      Instruction &I = Dest->front();
+      if (isa<DbgInfoIntrinsic>(I)) {
+        I.eraseFromParent();
+        continue;
+      }
+      I.moveBefore(SI);
+      NumSpeculated++; // STATISTIC
+    }
+  }
+
+  // The index into the tables, and whether it is within the table
+  Value *Index = nullptr, *InRange = nullptr;
+  if (is_contained(UseTable, true)) {
+    Index = Builder.CreateSub(Cond, Builder.getInt(Min), "switch.index");
+    if (HasDefault && !(Max - Min).isAllOnes()) {
+      InRange = Builder.CreateICmpULE(Index, Builder.getInt(Max - Min),
+                                      "switch.inrange");
+      // Keep the load within the table
+      Index = Builder.CreateSelect(InRange, Index,
+                                   ConstantInt::get(Index->getType(), 0));
+    }
+    Index = Builder.CreateZExtOrTrunc(Index, Builder.getInt32Ty());
+  }
+
+  SmallVector<Value*, 4> Results;
+  bool AnyTable = false, AnySelects = false;
+  for (unsigned p = 0, e = PHIs.size(); p != e; p++) {
+    PHINode *PN = PHIs[p];
+    Value *Default = HasDefault ? getIncoming(PN, DefaultDest) : nullptr;
+    if (UseTable[p]) {
+      MapVector<ConstantInt*, Value*> Cases;
+      for (auto Case : SI->cases()) {
+        Cases[Case.getCaseValue()] = getIncoming(PN, Case.getCaseSuccessor());
+      }
+      Results.push_back(buildTable(Builder, PN, Index, InRange, Min, Size,
+                                   Cases, Default));
+      AnyTable = true;
+      continue;
+    }
+
+    MapVector<Value*, SmallVector<ConstantInt*, 4>> Groups;
+    for (auto Case : SI->cases()) {
+      Value *V = getIncoming(PN, Case.getCaseSuccessor());
+      Groups[V].push_back(Case.getCaseValue());
+    }
+    Value *Base = Default;
+    if (!Base) {
+      unsigned Largest = 0;
+      for (auto &G : Groups) {
+        if (G.second.size() > Largest) {
+          Base = G.first;
+          Largest = G.second.size();
+        }
+      }
+    }
+    Groups.erase(Base);
+    Results.push_back(buildSelects(Builder, Cond, Groups, Base));
+    AnySelects = true;
+  }
+
+  // Branch to the successor only, the values are selected in BB now
+  for (unsigned p = 0, e = PHIs.size(); p != e; p++) {
+    PHINode *PN = PHIs[p];
+    for (auto Dest : Forwarders) {
+      PN->removeIncomingValue(Dest, false);
+    }
+    while (PN->getBasicBlockIndex(BB) >= 0) {
+      PN->removeIncomingValue(BB, false);
+    }
+    PN->addIncoming(Results[p], BB);
+  }
+  if (!HasDefault) {
+    DefaultDest->removePredecessor(BB);
+  }
+  BranchInst::Create(Succ, SI);
+  SI->eraseFromParent();
+
+  for (auto Dest : Forwarders) {
+    Dest->eraseFromParent();
+  }
+  if (!HasDefault && pred_empty(DefaultDest) &&
+      &DefaultDest->front() == DefaultDest->getTerminator()) {
+    DefaultDest->eraseFromParent();
+  }
+
+  if (AnyTable) NumSwitchTables++; // STATISTIC
+  if (AnySelects || !AnyTable) NumSwitchSelects++; // STATISTIC
+  return true;
+}
+
+
+Value *PatmosSPSwitchLookup::buildTable(IRBuilder<> &Builder, PHINode *PN,
+                                        Value *Index, Value *InRange,
+                                        const APInt &Min, uint64_t Size,
+                                        const MapVector<ConstantInt*, Value*>
+                                          &Cases,
+                                        Value *Default) {
+  Type *Ty = PN->getType();
+
+  // Holes take the default, or any value if there is none
+  Constant *Fill = Default ? cast<Constant>(Default)
+                           : cast<Constant>(Cases.front().second);
+  SmallVector<Constant*, 64> Entries(Size, Fill);
+  for (auto &Case : Cases) {
+    uint64_t Offset = (Case.first->getValue() - Min).getZExtValue();
+    Entries[Offset] = cast<Constant>(Case.second);
+  }
+
+  ArrayType *TableTy = ArrayType::get(Ty, Size);
+  Function *F = Builder.GetInsertBlock()->getParent();
+  auto Table = new GlobalVariable(*F->getParent(), TableTy, true,
+                                  GlobalValue::PrivateLinkage,
+                                  ConstantArray::get(TableTy, Entries),
+                                  F->getName() + ".switch.table");
+  Table->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  Value *Ptr = Builder.CreateInBoundsGEP(TableTy, Table,
+                                         {Builder.getInt32(0), Index});
+  Value *Load = Builder.CreateLoad(Ty, Ptr, PN->getName() + ".switch.load");
+  if (InRange) {
+    return Builder.CreateSelect(InRange, Load, Default,
+                                PN->getName() + ".switch");
+  }
+  return Load;
+}
+
+
+Value *PatmosSPSwitchLookup::buildSelects(IRBuilder<> &Builder, Value *Cond,
+                                          const MapVector<Value*,
+                                            SmallVector<ConstantInt*, 4>>
+                                            &Groups,
+                                          Value *Base) {
+  Value *Result = Base;
+  for (auto &G : Groups) {
+    Value *Test = nullptr;
+    for (auto C : G.second) {
+      Value *Eq = Builder.CreateICmpEQ(Cond, C);
+      Test = Test ? Builder.CreateOr(Test, Eq) : Eq;
+    }
+    Result = Builder.CreateSelect(Test, G.first, Result, "switch.select");
+  }
+  return Result;
+}
@@ -0,0 +1,308 @@
+//===-- PatmosSPTiming.cpp - Execution time of single-path code -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass computes the execution time of single-path functions in cycles.
+// It runs once the final code is known, i.e., after the delay slots have
+// been killed.
+//
+// Single-path code executes every instruction as often as the enclosing
+// loops are iterated, which is exactly their bound. The execution time of a
+// function is thus the sum of its bundles, weighted by the bounds of the
+// enclosing loops, plus the stall cycles of non-delayed control-flow
+// instructions and the execution time of its callees. All caches are assumed
+// to hit; the result is marked as a lower bound if the code contains inline
+// assembly, unbounded loops or calls to functions without known timing.
+//
+// The result is printed as comment at the function label, accumulated in
+// statistics and, if requested, written to a report with one line per
+// function.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosMachineFunctionInfo.h"
+#include "PatmosSinglePathInfo.h"
+#include "PatmosSubtarget.h"
+#include "PatmosTargetMachine.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-singlepath"
+
+STATISTIC(NumSPTimed,    "Number of single-path functions with computed timing");
+STATISTIC(NumSPInexact,  "Number of single-path functions with only a lower timing bound");
+STATISTIC(SPRootCycles,  "Sum of the execution cycles of all single-path roots");
+STATISTIC(SPMaxRootCycles, "Execution cycles of the longest single-path root");
+
+static cl::opt<bool> EnableSPTiming("mpatmos-sp-timing",
+  cl::init(false),
+  cl::desc("Compute the execution time of single-path functions and print "
+           "it as comment."),
+  cl::Hidden);
+
+static cl::opt<std::string> SPTimingReport("mpatmos-sp-timing-report",
+  cl::init(""),
+  cl::desc("Append the execution time of all single-path functions to the "
+           "given file (implies -mpatmos-sp-timing)."),
+  cl::Hidden);
+
+// anonymous namespace
+namespace {
+
+  /// The timing of a single function, excluding its callees.
+  struct SPFunctionTiming {
+    /// Cycles of the function itself
+    uint64_t Cycles = 0;
+    /// Callees, with the number of times they are called
+    std::map<const Function*, uint64_t> Calls;
+    /// False if Cycles is only a lower bound
+    bool Exact = true;
+    bool IsRoot = false;
+  };
+
+  class PatmosSPTiming : public MachineFunctionPass {
+  private:
+    /// Pass ID
+    static char ID;
+
+    const PatmosTargetMachine &TM;
+    const PatmosSubtarget &STC;
+    const PatmosInstrInfo *TII;
+
+    /// Timings of all functions seen so far
+    std::map<const Function*, SPFunctionTiming> Timings;
+
+    /// getStallCycles - Return the cycles the pipeline stalls after the
+    /// given instruction, i.e., for non-delayed control-flow instructions.
+    unsigned getStallCycles(const MachineInstr &MI) const;
+
+    /// getCallTarget - Return the function called by MI, or NULL.
+    const Function *getCallTarget(const MachineInstr &MI) const;
+
+    /// computeTiming - Compute the timing of MF, without its callees.
+    SPFunctionTiming computeTiming(MachineFunction &MF) const;
+
+    /// getTotalCycles - Return the cycles of F including all known callees.
+    /// Exact is cleared if any part of the result is only a lower bound.
+    uint64_t getTotalCycles(const Function *F, bool &Exact,
+                            std::map<const Function*, uint64_t> &Cache) const;
+
+  public:
+    /// PatmosSPTiming - Initialize with PatmosTargetMachine
+    PatmosSPTiming(const PatmosTargetMachine &tm) :
+      MachineFunctionPass(ID), TM(tm), STC(*tm.getSubtargetImpl()),
+      TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())) {}
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override {
+      return "Patmos Single-Path Timing";
+    }
+
+    /// getAnalysisUsage - Specify which passes this pass depends on
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<MachineLoopInfo>();
+      AU.setPreservesAll();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    /// runOnMachineFunction - Compute the timing of the given function.
+    bool runOnMachineFunction(MachineFunction &MF) override;
+
+    /// doFinalization - Compute the totals and write the report.
+    bool doFinalization(Module &M) override;
+  };
+
+  char PatmosSPTiming::ID = 0;
+} // end of anonymous namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// createPatmosSPTimingPass - Returns a new PatmosSPTiming
+/// \see PatmosSPTiming
+FunctionPass *llvm::createPatmosSPTimingPass(const PatmosTargetMachine &tm) {
+  return new PatmosSPTiming(tm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosSPTiming::runOnMachineFunction(MachineFunction &MF) {
+  if (!EnableSPTiming && SPTimingReport.empty()) return false;
+  if (!PatmosSinglePathInfo::isConverting(MF) &&
+      !PatmosSinglePathInfo::isShared(MF)) {
+    return false;
+  }
+
+  const Function *F = &MF.getFunction();
+  Timings[F] = computeTiming(MF);
+
+  // Callees that are emitted later are not known yet
+  bool Exact = true;
+  std::map<const Function*, uint64_t> Cache;
+  uint64_t Cycles = getTotalCycles(F, Exact, Cache);
+
+  LLVM_DEBUG( dbgs() << "[Single-Path] Timing of " << F->getName() << ": "
+                << (Exact ? "" : ">= ") << Cycles << " cycles\n");
+
+  MF.getInfo<PatmosMachineFunctionInfo>()->setSinglePathCycles(Cycles, Exact);
+  return false;
+}
+
+
+unsigned PatmosSPTiming::getStallCycles(const MachineInstr &MI) const {
+  if (!(MI.isBranch() || MI.isCall() || MI.isReturn()) || MI.hasDelaySlot()) {
+    return 0;
+  }
+
+  // Non-delayed instructions stall for their delay slots
+  switch (MI.getOpcode()) {
+  case Patmos::BRCFND:  case Patmos::BRCFNDu:
+  case Patmos::BRCFRND: case Patmos::BRCFRNDu:
+  case Patmos::BRCFTND: case Patmos::BRCFTNDu:
+  case Patmos::BRCFTOND: case Patmos::BRCFTONDu:
+    return STC.getCFLDelaySlotCycles(false);
+  default:
+    return STC.getCFLDelaySlotCycles(MI.isBranch() && !MI.isCall() &&
+                                     !MI.isReturn());
+  }
+}
+
+
+const Function *PatmosSPTiming::getCallTarget(const MachineInstr &MI) const {
+  if (MI.getNumOperands() < 3) return NULL;
+
+  const MachineOperand &MO = MI.getOperand(2);
+  if (MO.isGlobal()) {
+    return dyn_cast<Function>(MO.getGlobal());
+  } else if (MO.isSymbol()) {
+    const Module *M = MI.getParent()->getParent()->getFunction().getParent();
+    return M->getFunction(MO.getSymbolName());
+  }
+  return NULL;
+}
+
+
+SPFunctionTiming PatmosSPTiming::computeTiming(MachineFunction &MF) const {
+  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+
+  SPFunctionTiming T;
+  T.IsRoot = PatmosSinglePathInfo::isRoot(MF);
+
+  for (auto &MBB : MF) {
+    // Every block executes as often as the enclosing loops iterate
+    uint64_t Count = 1;
+    for (auto L = MLI.getLoopFor(&MBB); L; L = L->getParentLoop()) {
+      int Max = getLoopBounds(L->getHeader()).second;
+      if (Max < 0) {
+        LLVM_DEBUG( dbgs() << "  Loop header MBB#"
+                      << L->getHeader()->getNumber() << " has no bound\n");
+        T.Exact = false;
+        continue;
+      }
+      Count *= Max + 1;
+    }
+
+    uint64_t Cycles = 0;
+    for (auto &MI : MBB) {
+      if (TII->isPseudo(&MI)) continue;
+
+      Cycles++;
+      if (MI.isInlineAsm()) T.Exact = false;
+
+      MachineBasicBlock::instr_iterator II = MI.getIterator();
+      do {
+        Cycles += getStallCycles(*II);
+        if (II->isCall()) {
+          const Function *Target = getCallTarget(*II);
+          if (Target) {
+            T.Calls[Target] += Count;
+          } else {
+            T.Exact = false;
+          }
+        }
+        ++II;
+      } while (II != MBB.instr_end() && II->isBundledWithPred());
+    }
+    T.Cycles += Count * Cycles;
+  }
+  return T;
+}
+
+
+uint64_t PatmosSPTiming::getTotalCycles(const Function *F, bool &Exact,
+                            std::map<const Function*, uint64_t> &Cache) const {
+  auto T = Timings.find(F);
+  if (T == Timings.end()) {
+    Exact = false;
+    return 0;
+  }
+  if (!T->second.Exact) Exact = false;
+
+  auto Cached = Cache.find(F);
+  if (Cached != Cache.end()) return Cached->second;
+
+  uint64_t Cycles = T->second.Cycles;
+  for (auto &Call : T->second.Calls) {
+    Cycles += Call.second * getTotalCycles(Call.first, Exact, Cache);
+  }
+  Cache[F] = Cycles;
+  return Cycles;
+}
+
+
+bool PatmosSPTiming::doFinalization(Module &M) {
+  if (Timings.empty()) return false;
+
+  std::error_code err;
+  std::unique_ptr<raw_fd_ostream> Report;
+  if (!SPTimingReport.empty()) {
+    Report.reset(new raw_fd_ostream(SPTimingReport, err, sys::fs::OF_Append));
+    if (err) {
+      errs() << "Error: Failed to open single-path timing report '"
+             << SPTimingReport << "': " << err.message() << "\n";
+      Report.reset();
+    }
+  }
+
+  std::map<const Function*, uint64_t> Cache;
+  for (auto &Entry : Timings) {
+    const Function *F = Entry.first;
+    bool Exact = true;
+    uint64_t Cycles = getTotalCycles(F, Exact, Cache);
+
+    NumSPTimed++; // STATISTIC
+    if (!Exact) NumSPInexact++; // STATISTIC
+    if (Entry.second.IsRoot) {
+      SPRootCycles += Cycles; // STATISTIC
+      if (Cycles > SPMaxRootCycles) SPMaxRootCycles = Cycles; // STATISTIC
+    }
+
+    // <module>, <function>, <is root>, <own cycles>, <total cycles>, <exact>
+    if (Report) {
+      *Report << "\"" << M.getModuleIdentifier() << "\", ";
+      *Report << "\"" << F->getName() << "\", ";
+      *Report << (Entry.second.IsRoot ? 1 : 0) << ", ";
+      *Report << Entry.second.Cycles << ", " << Cycles << ", ";
+      *Report << (Exact ? 1 : 0) << "\n";
+    }
+  }
+  Timings.clear();
+  return false;
+}
@@ -0,0 +1,331 @@
+//===-- PatmosSPUnroll.cpp - Unroll loops of single-path code -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass unrolls innermost loops of functions marked for single-path
+// conversion.
+// Single-path loops always execute as many iterations as their bound, and
+// every iteration pays for the loop counter and the header predicates.
+// Loops whose unrolled size stays below a threshold are unrolled completely,
+// larger ones are unrolled by the largest factor that divides the bound, such
+// that the unrolled loop executes exactly the same number of copies of the
+// body as the original one.
+//
+// The copies keep their exit edges, so the transformation is valid for any
+// number of iterations up to the bound. The scope tree is rebuilt afterwards,
+// which gives every copy its own predicates.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Patmos.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosSinglePathInfo.h"
+#include "PatmosTargetMachine.h"
+#include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "patmos-singlepath"
+
+STATISTIC(NumSPFullyUnrolled,     "Number of single-path loops fully unrolled");
+STATISTIC(NumSPPartiallyUnrolled, "Number of single-path loops partially unrolled");
+STATISTIC(NumSPUnrollCopies,      "Number of loop body copies created by the single-path unroller");
+
+static cl::opt<unsigned> SPUnrollThreshold("mpatmos-sp-unroll-threshold",
+  cl::init(64),
+  cl::desc("Maximum number of instructions of a single-path loop after "
+           "unrolling (0 disables unrolling)."),
+  cl::Hidden);
+
+// anonymous namespace
+namespace {
+
+  /// A loop that may be unrolled, collected from the scope tree before the
+  /// CFG is changed.
+  struct UnrollCandidate {
+    MachineBasicBlock *Header;
+    MachineBasicBlock *Latch;
+    /// The blocks of the loop in layout order
+    std::vector<MachineBasicBlock*> Blocks;
+    /// Number of header executions
+    unsigned Bound;
+    /// Number of instructions of the loop body
+    unsigned Size;
+  };
+
+  class PatmosSPUnroll : public MachineFunctionPass {
+  private:
+    /// Pass ID
+    static char ID;
+
+    const PatmosTargetMachine &TM;
+    const PatmosInstrInfo *TII;
+
+    /// collectCandidate - Check whether the loop of the given scope can be
+    /// unrolled, and fill in the candidate if so.
+    bool collectCandidate(MachineFunction &MF, const SPScope *S,
+                          UnrollCandidate &C) const;
+
+    /// isFullyUnrollable - Whether the backedge of the last copy can be
+    /// removed, i.e., the latch also exits the loop.
+    bool isFullyUnrollable(const UnrollCandidate &C) const;
+
+    /// getUnrollFactor - Return the number of copies of the loop body, or 0
+    /// if the loop should not be unrolled.
+    unsigned getUnrollFactor(const UnrollCandidate &C) const;
+
+    /// unroll - Unroll the loop by the given factor. If the factor equals
+    /// the bound, the loop is removed.
+    void unroll(MachineFunction &MF, const UnrollCandidate &C,
+                unsigned Factor);
+
+  public:
+    /// PatmosSPUnroll - Initialize with PatmosTargetMachine
+    PatmosSPUnroll(const PatmosTargetMachine &tm) :
+      MachineFunctionPass(ID), TM(tm),
+      TII(static_cast<const PatmosInstrInfo*>(tm.getInstrInfo())) {}
+
+    /// getPassName - Return the pass' name.
+    StringRef getPassName() const override {
+      return "Patmos Single-Path Unroll";
+    }
+
+    /// getAnalysisUsage - Specify which passes this pass depends on
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<PatmosSinglePathInfo>();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    /// runOnMachineFunction - Unroll the loops of the given function.
+    bool runOnMachineFunction(MachineFunction &MF) override;
+  };
+
+  char PatmosSPUnroll::ID = 0;
+} // end of anonymous namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// createPatmosSPUnrollPass - Returns a new PatmosSPUnroll
+/// \see PatmosSPUnroll
+FunctionPass *llvm::createPatmosSPUnrollPass(const PatmosTargetMachine &tm) {
+  return new PatmosSPUnroll(tm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool PatmosSPUnroll::runOnMachineFunction(MachineFunction &MF) {
+  PatmosSinglePathInfo &PSPI = getAnalysis<PatmosSinglePathInfo>();
+  if (!PSPI.isConverting(MF) || SPUnrollThreshold == 0) return false;
+
+  // The scope tree is invalid as soon as the CFG changes, so collect all
+  // candidates first. Only innermost loops are unrolled, hence the
+  // candidates are disjoint.
+  std::vector<UnrollCandidate> Candidates;
+  SPScope *Root = PSPI.getRootScope();
+  for (auto I = df_begin(Root), E = df_end(Root); I != E; ++I) {
+    UnrollCandidate C;
+    if (collectCandidate(MF, *I, C)) {
+      Candidates.push_back(std::move(C));
+    }
+  }
+
+  bool changed = false;
+  for (auto &C : Candidates) {
+    unsigned Factor = getUnrollFactor(C);
+    if (Factor < 2) continue;
+
+    LLVM_DEBUG( dbgs() << "[Single-Path] Unroll loop MBB#"
+                  << C.Header->getNumber() << " in "
+                  << MF.getFunction().getName() << " (bound " << C.Bound
+                  << ", size " << C.Size << ") by " << Factor << "\n");
+    unroll(MF, C, Factor);
+    changed = true;
+  }
+  return changed;
+}
+
+
+bool PatmosSPUnroll::collectCandidate(MachineFunction &MF, const SPScope *S,
+                                      UnrollCandidate &C) const {
+  if (S->isTopLevel() || S->child_begin() != S->child_end() ||
+      !S->hasLoopBound()) {
+    return false;
+  }
+
+  C.Header = S->getHeader()->getMBB();
+  C.Latch = NULL;
+  C.Bound = S->getLoopBound();
+  C.Size = 0;
+  if (C.Bound < 2) return false;
+
+  std::set<const MachineBasicBlock*> InLoop;
+  for (auto block : S->getScopeBlocks()) {
+    InLoop.insert(block->getMBB());
+  }
+
+  for (auto Pred : C.Header->predecessors()) {
+    if (!InLoop.count(Pred)) continue;
+    // only loops with a single latch
+    if (C.Latch) return false;
+    C.Latch = Pred;
+  }
+  if (!C.Latch) return false;
+
+  for (auto &MBB : MF) {
+    if (!InLoop.count(&MBB)) continue;
+
+    if (MBB.hasAddressTaken() || MBB.isEHPad()) return false;
+
+    // the branches are rewritten in the copies
+    MachineBasicBlock *TBB = NULL, *FBB = NULL;
+    SmallVector<MachineOperand, 2> Cond;
+    if (TII->analyzeBranch(MBB, TBB, FBB, Cond)) return false;
+
+    for (auto &MI : MBB) {
+      if (MI.isNotDuplicable()) return false;
+      if (!MI.isMetaInstruction()) C.Size++;
+    }
+    C.Blocks.push_back(&MBB);
+  }
+  return true;
+}
+
+
+bool PatmosSPUnroll::isFullyUnrollable(const UnrollCandidate &C) const {
+  if (C.Latch->succ_size() != 2) return false;
+  for (auto Succ : C.Latch->successors()) {
+    if (Succ != C.Header &&
+        std::find(C.Blocks.begin(), C.Blocks.end(), Succ) != C.Blocks.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+unsigned PatmosSPUnroll::getUnrollFactor(const UnrollCandidate &C) const {
+  if (C.Size == 0) return 0;
+
+  unsigned MaxFactor = SPUnrollThreshold / C.Size;
+  if (C.Bound <= MaxFactor && isFullyUnrollable(C)) {
+    return C.Bound;
+  }
+
+  // Only factors dividing the bound, otherwise the last iteration of the
+  // unrolled loop would execute disabled copies.
+  for (unsigned Factor = std::min(MaxFactor, C.Bound / 2); Factor >= 2;
+       Factor--) {
+    if (C.Bound % Factor == 0) return Factor;
+  }
+  return 0;
+}
+
+
+void PatmosSPUnroll::unroll(MachineFunction &MF, const UnrollCandidate &C,
+                            unsigned Factor) {
+  // Remember the fall-through of every block before the layout changes
+  DenseMap<MachineBasicBlock*, MachineBasicBlock*> LayoutSucc;
+  for (auto MBB : C.Blocks) {
+    auto Next = std::next(MBB->getIterator());
+    LayoutSucc[MBB] = (Next != MF.end()) ? &*Next : NULL;
+  }
+
+  // Copies[c] maps the blocks of the loop to their c-th copy
+  std::vector<DenseMap<MachineBasicBlock*, MachineBasicBlock*>> Copies(Factor);
+  for (auto MBB : C.Blocks) {
+    Copies[0][MBB] = MBB;
+  }
+
+  // Place the copies after the loop, in the order of the original blocks
+  MachineBasicBlock *InsertAfter = C.Blocks.back();
+  for (unsigned c = 1; c < Factor; c++) {
+    for (auto MBB : C.Blocks) {
+      MachineBasicBlock *NewMBB = MF.CreateMachineBasicBlock();
+      MF.insert(std::next(InsertAfter->getIterator()), NewMBB);
+      InsertAfter = NewMBB;
+
+      for (auto &MI : *MBB) {
+        MF.cloneMachineInstrBundle(*NewMBB, NewMBB->end(), MI);
+      }
+      for (auto &LI : MBB->liveins()) {
+        NewMBB->addLiveIn(LI);
+      }
+      Copies[c][MBB] = NewMBB;
+    }
+    NumSPUnrollCopies++; // STATISTIC
+  }
+
+  // The backedges of each copy enter the next copy, the ones of the last
+  // copy the original header.
+  auto MapTarget = [&](unsigned c, MachineBasicBlock *MBB) {
+    if (MBB == C.Header) {
+      return Copies[(c + 1) % Factor][C.Header];
+    }
+    auto Found = Copies[c].find(MBB);
+    return (Found != Copies[c].end()) ? Found->second : MBB;
+  };
+
+  for (unsigned c = 1; c < Factor; c++) {
+    for (auto MBB : C.Blocks) {
+      MachineBasicBlock *NewMBB = Copies[c][MBB];
+      for (auto SI = MBB->succ_begin(), SE = MBB->succ_end(); SI != SE; ++SI) {
+        NewMBB->copySuccessor(MBB, SI);
+      }
+      for (auto Succ : MBB->successors()) {
+        NewMBB->replaceSuccessor(Succ, MapTarget(c, Succ));
+      }
+      for (auto &MI : NewMBB->terminators()) {
+        for (auto &MO : MI.operands()) {
+          if (MO.isMBB()) MO.setMBB(MapTarget(c, MO.getMBB()));
+        }
+      }
+    }
+  }
+  C.Latch->ReplaceUsesOfBlockWith(C.Header, MapTarget(0, C.Header));
+
+  if (Factor == C.Bound) {
+    // The backedge of the last copy is never taken, make it leave the loop
+    MachineBasicBlock *LastLatch = Copies[Factor - 1][C.Latch];
+    MachineBasicBlock *Exit = NULL;
+    for (auto Succ : LastLatch->successors()) {
+      if (Succ != C.Header) Exit = Succ;
+    }
+    assert(Exit && "Fully unrolled latch without exit");
+    DebugLoc DL = LastLatch->findBranchDebugLoc();
+    TII->removeBranch(*LastLatch);
+    LastLatch->removeSuccessor(C.Header);
+    TII->insertBranch(*LastLatch, Exit, NULL, ArrayRef<MachineOperand>(), DL,
+                      NULL);
+    NumSPFullyUnrolled++; // STATISTIC
+  } else {
+    // Every iteration of the unrolled loop executes Factor copies
+    auto Bounds = getLoopBounds(C.Header);
+    unsigned Min = Bounds.first > 0 ? (Bounds.first + Factor) / Factor - 1 : 0;
+    setLoopBounds(C.Header, Min, C.Bound / Factor - 1);
+    NumSPPartiallyUnrolled++; // STATISTIC
+  }
+
+  // Fix the fall-throughs that were broken by the new layout
+  for (unsigned c = 0; c < Factor; c++) {
+    for (auto MBB : C.Blocks) {
+      MachineBasicBlock *Succ = LayoutSucc[MBB];
+      Copies[c][MBB]->updateTerminator(Succ ? MapTarget(c, Succ) : NULL);
+    }
+  }
+}
+
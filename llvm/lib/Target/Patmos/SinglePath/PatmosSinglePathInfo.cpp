@@ -29,6 +29,7 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "PatmosSinglePathInfo.h"
@@ -100,6 +101,13 @@ bool PatmosSinglePathInfo::isMaybe(const MachineFunction &MF) {
   return PatmosSinglePathInfo::isMaybe(MF.getFunction());
 }
 
+bool PatmosSinglePathInfo::isShared(const Function &F) {
+  return F.hasFnAttribute("sp-shared");
+}
+bool PatmosSinglePathInfo::isShared(const MachineFunction &MF) {
+  return PatmosSinglePathInfo::isShared(MF.getFunction());
+}
+
 void PatmosSinglePathInfo::getRootNames(std::set<StringRef> &S) {
   S.insert( SPRootList.begin(), SPRootList.end() );
   S.erase("");
@@ -119,11 +127,16 @@ bool PatmosSinglePathInfo::doInitialization(Module &M) {
 
 
 bool PatmosSinglePathInfo::doFinalization(Module &M) {
+  releaseMemory();
+  return false;
+}
+
+
+void PatmosSinglePathInfo::releaseMemory() {
   if (Root) {
     delete Root;
     Root = NULL;
   }
-  return false;
 }
 
 void PatmosSinglePathInfo::getAnalysisUsage(AnalysisUsage &AU) const {
@@ -134,10 +147,7 @@ void PatmosSinglePathInfo::getAnalysisUsage(AnalysisUsage &AU) const {
 }
 
 bool PatmosSinglePathInfo::runOnMachineFunction(MachineFunction &MF) {
-  if (Root) {
-    delete Root;
-    Root = NULL;
-  }
+  releaseMemory();
 
   // only consider function actually marked for conversion
   auto curfunc = MF.getFunction().getName();
@@ -158,7 +168,11 @@ void PatmosSinglePathInfo::analyzeFunction(MachineFunction &MF) {
   // we could use a custom algorithm (e.g. Havlak's algorithm)
   // that also checks irreducibility.
   // build the SPScope tree
-  Root = SPScope::createSPScopeTree(MF, getAnalysis<MachineLoopInfo>(), TII);
+  {
+    PatmosPhaseScope T("sp-scope-tree", "Single-Path Scope Tree",
+                       MF.getName());
+    Root = SPScope::createSPScopeTree(MF, getAnalysis<MachineLoopInfo>(), TII);
+  }
 
   LLVM_DEBUG( print(dbgs()) );
 
@@ -78,6 +78,11 @@ namespace llvm {
       static bool isMaybe(const Function &F);
       static bool isMaybe(const MachineFunction &MF);
 
+      /// isShared - Return true if the function is called from single-path
+      /// code as is, because it is free of branches already.
+      static bool isShared(const Function &F);
+      static bool isShared(const MachineFunction &MF);
+
       /// getRootNames - Fill a set with the names of
       /// single-path root functions
       static void getRootNames(std::set<StringRef> &S);
@@ -97,6 +102,9 @@ namespace llvm {
       /// runOnMachineFunction - Run the SP converter on the given function.
       bool runOnMachineFunction(MachineFunction &MF) override;
 
+      /// releaseMemory - Free the SPScope tree once no pass needs it anymore
+      void releaseMemory() override;
+
       /// getPassName - Return the pass' name.
       StringRef getPassName() const override{
         return "Patmos Single-Path Info";
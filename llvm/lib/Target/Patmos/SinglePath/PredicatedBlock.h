@@ -12,10 +12,12 @@
 #ifndef TARGET_PATMOS_SINGLEPATH_PREDICATEDBLOCK_H_
 #define TARGET_PATMOS_SINGLEPATH_PREDICATEDBLOCK_H_
 
+#include "llvm/ADT/Optional.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
 #include "llvm/IR/Metadata.h"
-#include <map>
+#include <algorithm>
 #include <set>
+#include <vector>
 
 namespace llvm {
 
@@ -27,6 +29,12 @@ namespace llvm {
     typedef _PredicatedBlock<MachineBasicBlock, MachineInstr, MachineOperand> PredicatedBlock;
   public:
 
+    /// An instruction paired with the predicate it is predicated by.
+    typedef std::pair<const MachineInstr*, unsigned> InstrPredicate;
+
+    /// A successor block paired with the predicate guarding the branch to it.
+    typedef std::pair<const PredicatedBlock*, unsigned> SuccPredicate;
+
     /// A definition of a predicate that is defined by a block, I.e. at runtime,
     /// the predicate's true/false value is calculated in the block.
     struct Definition{
@@ -73,14 +81,9 @@ namespace llvm {
 
     /// Get the list of predicates the MBBs instructions
     /// are predicated by
-    std::set<unsigned> getBlockPredicates() const
+    const std::set<unsigned> &getBlockPredicates() const
     {
-      std::set<unsigned> result;
-      for(auto const &pair: InstrPred)
-      {
-        result.insert(pair.second);
-      }
-      return result;
+      return BlockPreds;
     }
 
     /// Sets all of the MBB's instructions to be predicated by the given predicate.
@@ -88,10 +91,17 @@ namespace llvm {
     void setPredicate(unsigned pred)
     {
       InstrPred.clear();
+      BlockPreds.clear();
       for( auto instr_iter = MBB->instr_begin(), end = MBB->instr_end(); instr_iter != end; instr_iter++){
-        MachineInstr* instr = &(*instr_iter);
-        assert(InstrPred.find(instr) == InstrPred.end());
-        InstrPred.insert(std::make_pair(instr, pred));
+        InstrPred.push_back(std::make_pair(&(*instr_iter), pred));
+      }
+      std::sort(InstrPred.begin(), InstrPred.end(), compareInstr);
+      assert(std::adjacent_find(InstrPred.begin(), InstrPred.end(),
+          [](const InstrPredicate &a, const InstrPredicate &b){
+            return a.first == b.first;
+          }) == InstrPred.end());
+      if(!InstrPred.empty()){
+        BlockPreds.insert(pred);
       }
 
       // Reassign successor predicates
@@ -100,10 +110,20 @@ namespace llvm {
       }
     }
 
-    std::map<const MachineInstr*, unsigned> getInstructionPredicates() const {
-      std::map<const MachineInstr*, unsigned> result;
-      result.insert(InstrPred.begin(), InstrPred.end());
-      return result;
+    /// Get the predicate of every instruction in this block (and the blocks
+    /// merged into it), ordered by instruction address.
+    const std::vector<InstrPredicate> &getInstructionPredicates() const {
+      return InstrPred;
+    }
+
+    /// Get the predicate of the given instruction, if it has been assigned one.
+    Optional<unsigned> getInstructionPredicate(const MachineInstr *instr) const {
+      auto found = std::lower_bound(InstrPred.begin(), InstrPred.end(),
+                                    std::make_pair(instr, 0u), compareInstr);
+      if(found != InstrPred.end() && found->first == instr){
+        return found->second;
+      }
+      return None;
     }
 
     void dump(raw_ostream& os, unsigned indent) const
@@ -145,10 +165,10 @@ namespace llvm {
       os.indent(indent) << MBB->getFullName() <<":\n";
       for( auto MI = MBB->instr_begin(), ME = MBB->getFirstInstrTerminator();
               MI != ME; ++MI) {
-        auto instructionPredicates = getInstructionPredicates();
+        auto instrPred = getInstructionPredicate(&*MI);
         os.indent(indent + 2) << "[" << &(*MI) << "](";
-        if(instructionPredicates.count(&*MI)){
-          os << getInstructionPredicates().at(&*MI);
+        if(instrPred){
+          os << *instrPred;
         }else{
           os << "-";
         }
@@ -159,10 +179,10 @@ namespace llvm {
       os.indent(indent + 2) << "-\n";
       for( auto MI = MBB->getFirstTerminator(), ME = MBB->end();
               MI != ME; ++MI) {
-        auto instructionPredicates = getInstructionPredicates();
+        auto instrPred = getInstructionPredicate(&*MI);
         os.indent(indent + 2) << "[" << &(*MI) << "](";
-        if(instructionPredicates.count(&*MI)){
-          os << getInstructionPredicates().at(&*MI);
+        if(instrPred){
+          os << *instrPred;
         }else{
           os << "-";
         }
@@ -174,12 +194,9 @@ namespace llvm {
     }
 
     /// Returns a list of definitions assigned to this block.
-    std::vector<Definition>
-    getDefinitions() const
+    const std::vector<Definition> &getDefinitions() const
     {
-      std::vector<Definition> result;
-      result.insert(result.end(), Definitions.begin(), Definitions.end());
-      return result;
+      return Definitions;
     }
 
     /// Add a predicate definition to this block, paired with the block that uses
@@ -195,9 +212,9 @@ namespace llvm {
     /// but are not part of the same loop.
     /// 'Exit' refers to the edge between this block and the 
     /// target 'exiting' the loop.
-    std::vector<const PredicatedBlock*> getExitTargets() const
+    const std::vector<const PredicatedBlock*> &getExitTargets() const
     {
-      return std::vector<const PredicatedBlock*>(ExitTargets.begin(), ExitTargets.end());
+      return ExitTargets;
     }
 
     /// Assign the given block as an exit target of this one.
@@ -215,12 +232,22 @@ namespace llvm {
     /// predicates, successors, definitions, etc. to this one.
     void merge(const PredicatedBlock* b2)
     {
-      InstrPred.insert(b2->InstrPred.begin(), b2->InstrPred.end());
+      // Both lists are sorted, so a merge keeps them sorted. On duplicates
+      // the predicate already in this block wins.
+      auto mid = InstrPred.insert(InstrPred.end(), b2->InstrPred.begin(), b2->InstrPred.end());
+      std::inplace_merge(InstrPred.begin(), mid, InstrPred.end(), compareInstr);
+      InstrPred.erase(std::unique(InstrPred.begin(), InstrPred.end(),
+          [](const InstrPredicate &a, const InstrPredicate &b){
+            return a.first == b.first;
+          }), InstrPred.end());
+      BlockPreds.insert(b2->BlockPreds.begin(), b2->BlockPreds.end());
       Definitions.insert(Definitions.end(), b2->Definitions.begin(), b2->Definitions.end());
       ExitTargets.insert(ExitTargets.end(), b2->ExitTargets.begin(), b2->ExitTargets.end());
       Remnants.insert(b2->Remnants.begin(), b2->Remnants.end());
       Remnants.insert(b2->getMBB());
-      Successors.insert(b2->Successors.begin(), b2->Successors.end());
+      for(auto &succ: b2->Successors){
+        addSuccessor(succ.first, succ.second);
+      }
     }
 
     /// Replace any reference to the first block by references to the second block.
@@ -238,36 +265,37 @@ namespace llvm {
         }
       }
 
-      auto found = std::find_if(Successors.begin(), Successors.end(),
-          [&](auto succ){return succ.first == oldBlock;});
+      auto found = findSuccessor(oldBlock);
       if(found != Successors.end()){
         auto pred = found->second;
         Successors.erase(found);
-        assert(std::find_if(Successors.begin(), Successors.end(),
-                          [&](auto succ){return succ.first == oldBlock;}) == Successors.end());
-        Successors.insert(std::make_pair(newBlock, pred));
+        assert(findSuccessor(oldBlock) == Successors.end());
+        addSuccessor(newBlock, pred);
       }
     }
 
     /// Gets the list of MBB that were bundled with this block using 'merge()'
 	/// or 'replaceMbb()'
-    std::set<MachineBasicBlock*> bundledMBBs() const 
+    const std::set<MachineBasicBlock*> &bundledMBBs() const
     {
-      return std::set<MachineBasicBlock*>(Remnants.begin(), Remnants.end());
+      return Remnants;
     }
 
     /// Adds the given block as a successor of this one with
     /// the given predicate guarding the branch leading to that block.
+    /// If the block is already a successor, its predicate is left unchanged.
     void addSuccessor(const PredicatedBlock *block, unsigned pred)
     {
-      Successors.insert(std::make_pair(block, pred));
+      if(findSuccessor(block) == Successors.end()){
+        Successors.push_back(std::make_pair(block, pred));
+      }
     }
 
     /// Gets all successors to this block with which predicates
     /// that dictate whether their respective branches are taken.
-    std::map<const PredicatedBlock*, unsigned> getSuccessors() const 
+    const std::vector<SuccPredicate> &getSuccessors() const
     {
-      return std::map<const PredicatedBlock*, unsigned>(Successors.begin(), Successors.end());
+      return Successors;
     }
 
     /// Replaces which MBB this block is managing.
@@ -291,8 +319,12 @@ namespace llvm {
     /// The MBBs that were bundled into this blocks MBB.
     std::set<MachineBasicBlock*> Remnants;
 
-    /// A mapping of which predicate each instruction is predicated by.
-    std::map<const MachineInstr*, unsigned> InstrPred;
+    /// Which predicate each instruction is predicated by, sorted by
+    /// instruction address such that lookups can use binary search.
+    std::vector<InstrPredicate> InstrPred;
+
+    /// The set of predicates used in 'InstrPred'.
+    std::set<unsigned> BlockPreds;
 
     /// A list of predicates that are defined by this block, I.e. at runtime
     /// the predicate's true/false value is calculated in this block.
@@ -300,8 +332,29 @@ namespace llvm {
 
     std::vector<const PredicatedBlock*> ExitTargets;
 
-    /// A map over successor blocks and which predicates take that branch.
-    std::map<const PredicatedBlock*, unsigned> Successors;
+    /// The successor blocks and which predicates take that branch.
+    /// Blocks rarely have more than two successors, so a plain list is
+    /// cheaper than a map.
+    std::vector<SuccPredicate> Successors;
+
+    static bool compareInstr(const InstrPredicate &a, const InstrPredicate &b)
+    {
+      return a.first < b.first;
+    }
+
+    typename std::vector<SuccPredicate>::iterator
+    findSuccessor(const PredicatedBlock *block)
+    {
+      return std::find_if(Successors.begin(), Successors.end(),
+          [&](const SuccPredicate &succ){return succ.first == block;});
+    }
+
+    typename std::vector<SuccPredicate>::const_iterator
+    findSuccessor(const PredicatedBlock *block) const
+    {
+      return std::find_if(Successors.begin(), Successors.end(),
+          [&](const SuccPredicate &succ){return succ.first == block;});
+    }
 
     void printMetaData(MachineInstr* instr, raw_ostream& os) const {
       for(int i = 0; i< instr->getNumOperands(); i++){
@@ -12,12 +12,13 @@
 //===----------------------------------------------------------------------===//
 #include "RAInfo.h"
 
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/DepthFirstIterator.h"
 
-#include <llvm/ADT/BitVector.h>
+#include "llvm/Support/MathExtras.h"
 #include <sstream>
 
 using namespace llvm;
@@ -29,10 +30,28 @@ STATISTIC( SPNumPredicates, "Number of predicates for single-path code");
 STATISTIC( PredSpillLocs, "Number of required spill bits for predicates");
 STATISTIC( NoSpillScopes,
                   "Number of SPScopes (loops) where S0 spill can be omitted");
+STATISTIC( PredSpillCost, "Estimated number of executed instructions spilling "
+                          "and reloading predicates");
+
+static cl::opt<bool> SPCostSpill("mpatmos-sp-cost-spill",
+    cl::init(true),
+    cl::desc("Choose which predicate to spill by the number of instructions "
+             "the spill costs, instead of only by the furthest next use"),
+    cl::Hidden);
+
+// The number of instructions to spill a predicate register (LWC, BCOPY, SWC)
+// and to reload it (LWC, BTESTI).
+static const unsigned SpillInstrs = 3;
+static const unsigned ReloadInstrs = 2;
+
+// The number of additional instructions a predicate definition costs if
+// the predicate is defined into a stack location instead of a register
+// (LWC, BCOPY, SWC instead of PMOV/PAND).
+static const unsigned StackDefInstrs = 2;
 
 ///////////////////////////////////////////////////////////////////////////////
 
-/// LiveRange - Class to hold live range information for a predicate in
+/// LiveRanges - Class to hold live range information for the predicates of
 /// an RAInfo object.
 /// A live range is a set of position, each of which is associated with a
 /// basic block in the scope being described. The first position in the
@@ -43,88 +62,173 @@ STATISTIC( NoSpillScopes,
 /// At any location, the predicate can be used and/or defined.
 /// Defining a predicate at a location means it gets its runtime value there,
 /// i.e. whether it is true or false.
-class LiveRange {
-friend class RAInfo;
+///
+/// The ranges of all predicates are stored as two dense bit-matrices (uses
+/// and defs) with a row per predicate and a column per position, such that
+/// the queries below scan a whole word of positions at a time.
+class LiveRanges {
 private:
+  typedef uint64_t WordType;
+  static const unsigned WordBits = 64;
+
+  // The number of positions in each range.
+  unsigned NumPositions;
+
+  // The number of words in each row of the matrices.
+  unsigned NumWords;
+
+  // The row of each predicate in the matrices.
+  std::map<unsigned, unsigned> Rows;
 
   // Where each predicate is used.
   // The position is the index of the block in the scope
   // except for the last one which doesn't have an associated block
-  BitVector uses;
+  std::vector<WordType> Uses;
 
   // Where each predicate is defined.
   // The position is the index of the block in the scope
   // except for the last one which doesn't have an associated block
-  BitVector defs;
-public:
-  // Add a use of the predicate associated with this range
-  // at the position given.
-  void addUse(long pos) { uses.set(pos); }
+  std::vector<WordType> Defs;
 
-  // Add a use of the predicate associated with this range
-  // at the position given.
-  void addDef(long pos) { defs.set(pos); }
+  const WordType *getRow(const std::vector<WordType> &M, unsigned pred) const {
+    auto found = Rows.find(pred);
+    assert(found != Rows.end() && "Predicate has no live range");
+    return &M[found->second * NumWords];
+  }
 
-  /// Constructs a new live range for a scope.
-  /// Must be given the number of FCFG blocks in the scope.
-  LiveRange(unsigned range){
-    range++; // We use 1 extra position that is not associated with a block
-    uses = BitVector(range);
-    defs = BitVector(range);
-  }
-  bool isUse(long pos) const { return uses.test(pos); }
-  bool isDef(long pos) const { return defs.test(pos); }
-  bool lastUse(long pos) const {
-    // test whether shifting out up to this use will result in an empty
-    // bitvector
-    // return (uses >> (pos+1LL)) == 0;
-    for (unsigned i = pos+1; i < uses.size(); i++) {
-      if (uses.test(i)) return false;
+  WordType *getOrCreateRow(std::vector<WordType> &M, unsigned pred) {
+    auto found = Rows.find(pred);
+    if (found == Rows.end()) {
+      found = Rows.insert(std::make_pair(pred, (unsigned) Rows.size())).first;
+      Uses.resize(Rows.size() * NumWords, 0);
+      Defs.resize(Rows.size() * NumWords, 0);
     }
-    return true;
-  }
-  bool hasDefBefore(long pos) const {
-    // 00000100000 pos
-    // 00000011111 before
-    // -> any common?
-    //return (defs & ((1LL << pos)-1LL)) != 0;
-    unsigned i = pos;
-    while (i-- > 0) {
-      if (defs.test(i)) return true;
+    return &M[found->second * NumWords];
+  }
+
+  static bool test(const WordType *row, unsigned pos) {
+    return (row[pos / WordBits] >> (pos % WordBits)) & 1;
+  }
+
+  // Returns the first set position at or after 'pos',
+  // or NumPositions if there is none.
+  unsigned findNext(const WordType *row, unsigned pos) const {
+    if (pos >= NumPositions) return NumPositions;
+    unsigned w = pos / WordBits;
+    WordType bits = row[w] & (~WordType(0) << (pos % WordBits));
+    while (!bits) {
+      if (++w == NumWords) return NumPositions;
+      bits = row[w];
     }
-    return false;
+    return w * WordBits + countTrailingZeros(bits);
   }
 
-  // check if there is any use before (and including) pos
-  bool anyUseBefore(long pos) const {
-    //return (uses & ((1LL << (pos+1LL))-1LL)) != 0;
-    for (unsigned i = 0; i <= pos; i++) {
-      if (uses.test(i)) return true;
+  // Returns whether any position before (excluding) 'end' is set.
+  bool anyBefore(const WordType *row, unsigned end) const {
+    assert(end <= NumPositions);
+    unsigned w = 0;
+    for (; (w + 1) * WordBits <= end; w++) {
+      if (row[w]) return true;
     }
-    return false;
+    unsigned rest = end % WordBits;
+    return rest && (row[w] & ((WordType(1) << rest) - 1));
+  }
+
+public:
+  /// Constructs the live ranges for a scope.
+  /// Must be given the number of FCFG blocks in the scope.
+  LiveRanges(unsigned range):
+    // We use 1 extra position that is not associated with a block
+    NumPositions(range + 1),
+    NumWords((NumPositions + WordBits - 1) / WordBits)
+  {}
+
+  // Add a use of the given predicate at the position given.
+  void addUse(unsigned pred, unsigned pos) {
+    assert(pos < NumPositions);
+    getOrCreateRow(Uses, pred)[pos / WordBits] |= WordType(1) << (pos % WordBits);
+  }
+
+  // Add a definition of the given predicate at the position given.
+  void addDef(unsigned pred, unsigned pos) {
+    assert(pos < NumPositions);
+    getOrCreateRow(Defs, pred)[pos / WordBits] |= WordType(1) << (pos % WordBits);
+  }
+
+  bool isUse(unsigned pred, unsigned pos) const {
+    return test(getRow(Uses, pred), pos);
+  }
+  bool isDef(unsigned pred, unsigned pos) const {
+    return test(getRow(Defs, pred), pos);
   }
-  bool hasNextUseBefore(long pos, const LiveRange &other) const {
-    assert(uses.size() == other.uses.size());
-    // this   ....10000|...
+
+  // Returns the number of positions where the predicate is defined.
+  unsigned numDefs(unsigned pred) const {
+    const WordType *row = getRow(Defs, pred);
+    unsigned count = 0;
+    for (unsigned w = 0; w < NumWords; w++) {
+      count += countPopulation(row[w]);
+    }
+    return count;
+  }
+
+  // Returns the number of positions in each range.
+  unsigned size() const { return NumPositions; }
+
+  // Returns the first position at or after 'pos' where the predicate is used.
+  // If there is none, the number of positions is returned.
+  unsigned nextUse(unsigned pred, unsigned pos) const {
+    return findNext(getRow(Uses, pred), pos);
+  }
+
+  // check whether there is no use after pos
+  bool lastUse(unsigned pred, unsigned pos) const {
+    return nextUse(pred, pos + 1) == NumPositions;
+  }
+
+  // check whether there is any definition before (excluding) pos
+  bool hasDefBefore(unsigned pred, unsigned pos) const {
+    return anyBefore(getRow(Defs, pred), pos);
+  }
+
+  // check whether there is any definition after (excluding) pos
+  bool hasDefAfter(unsigned pred, unsigned pos) const {
+    return findNext(getRow(Defs, pred), pos + 1) != NumPositions;
+  }
+
+  // check if there is any use before (and including) pos
+  bool anyUseBefore(unsigned pred, unsigned pos) const {
+    return anyBefore(getRow(Uses, pred), pos + 1);
+  }
+
+  // check whether the next use of 'pred' (at or after pos) comes strictly
+  // before the next use of 'other'
+  bool hasNextUseBefore(unsigned pred, unsigned pos, unsigned other) const {
+    // pred  ....10000|...
     // other ......1000|...   -> no
     //                ^pos
-    for (unsigned i = pos; i < uses.size(); i++) {
-      if (other.uses.test(i)) break;
-      if (uses.test(i)) return true;
-    }
-    return false;
+    auto next = nextUse(pred, pos);
+    return next != NumPositions && next < nextUse(other, pos);
   }
-  string str(void) const {
+
+  string str(unsigned pred) const {
     stringbuf buf;
     char kind[] = { '-', 'u', 'd', 'x' };
-    for (unsigned long i = 0; i < uses.size(); i++) {
+    for (unsigned i = 0; i < NumPositions; i++) {
       int x = 0;
-      if (uses.test(i)) x += 1;
-      if (defs.test(i)) x += 2;
+      if (isUse(pred, i)) x += 1;
+      if (isDef(pred, i)) x += 2;
       buf.sputc(kind[x]);
     }
     return buf.str();
   }
+
+  typedef std::map<unsigned, unsigned>::const_iterator iterator;
+
+  // Iterates over the predicates with a live range (as the 'first' member),
+  // in ascending order.
+  iterator begin() const { return Rows.begin(); }
+  iterator end() const { return Rows.end(); }
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -187,8 +291,7 @@ public:
   const unsigned MaxRegs;
 
   // The live ranges of predicates.
-  // Given a predicate x, then its live range is LRs[x]
-  std::map<unsigned, LiveRange> LRs;
+  LiveRanges LRs;
 
   // The definition location of each predicate.
   // Given the predicate x, its definition is DefLocs[x].
@@ -205,9 +308,15 @@ public:
   unsigned FirstUsableReg;
 
   /// The index of the first stack spill slot this instance can use.
-  /// The slots below the index are used by a parent scope.
+  /// The slots below the index are used by the ancestor scopes.
+  /// Sibling scopes are never active at the same time, so they
+  /// share the slots above their common parent's.
   unsigned FirstUsableStackSlot;
 
+  /// The estimated number of instructions executed by each activation
+  /// of the scope to spill and reload predicates.
+  unsigned SpillCost;
+
   /// Record to hold predicate use information for a MBB.
   struct UseLoc {
     /// Which register location to use as the predicate
@@ -231,11 +340,21 @@ public:
   // Map of MBB -> (map of Predicate ->UseLoc), for an SPScope
   map<const MachineBasicBlock*, std::map<unsigned, UseLoc>> UseLocs;
 
+  // The stack locations predicates were reloaded from in the current block.
+  // They are free from the next block on, so predicates with disjoint live
+  // ranges share their stack locations as well as their registers.
+  vector<Location> ReloadedLocs;
+
+  // The free stack locations, kept apart from the free registers since
+  // locations of different types compare equal.
+  set<Location> FreeStackLocs;
+
   bool NeedsScopeSpill;
 
   Impl(RAInfo *pub, SPScope *S, unsigned availRegs):
-    Pub(*pub), MaxRegs(availRegs), NumLocs(0), ChildrenMaxCumLocs(0),
-    FirstUsableReg(0), FirstUsableStackSlot(0),NeedsScopeSpill(true)
+    Pub(*pub), MaxRegs(availRegs), LRs(S->getNumberOfFcfgBlocks()), NumLocs(0), ChildrenMaxCumLocs(0),
+    FirstUsableReg(0), FirstUsableStackSlot(0), SpillCost(0),
+    NeedsScopeSpill(true)
   {
     createLiveRanges();
     assignLocations();
@@ -249,6 +368,12 @@ public:
       FreeLocs.erase(it);
       return *it;
     }
+    // Reuse a stack location instead of creating a new one
+    if (NumLocs >= MaxRegs && !FreeStackLocs.empty()) {
+      Location loc = *FreeStackLocs.begin();
+      FreeStackLocs.erase(FreeStackLocs.begin());
+      return loc;
+    }
     // Create a new location
     unsigned oldNumLocs = NumLocs++;
 
@@ -273,31 +398,22 @@ public:
 
   void createLiveRanges(void) {
 
-    auto
-    getOrCreateLRFor = [&](unsigned predicate){
-      if(LRs.find(predicate) == LRs.end()){
-        LRs.insert(std::make_pair(predicate, LiveRange(Pub.Scope->getNumberOfFcfgBlocks())));
-      }
-      assert(LRs.find(predicate) != LRs.end());
-      return &LRs.at(predicate);
-    };
-
     // create live range information for each predicate
     LLVM_DEBUG(dbgs() << " Create live-ranges for [MBB#"
                  << Pub.Scope->getHeader()->getMBB()->getNumber() << "]\n");
 
-    auto blocks = Pub.Scope->getBlocksTopoOrd();
+    auto &blocks = Pub.Scope->getBlocksTopoOrd();
 
     for (unsigned i = 0, e = blocks.size(); i < e; i++) {
       auto block = blocks[i];
-      auto preds = block->getBlockPredicates();
+      auto &preds = block->getBlockPredicates();
       // insert uses
       for(auto pred: preds){
-        getOrCreateLRFor(pred)->addUse(i);
+        LRs.addUse(pred, i);
       }
       // insert defs
       for(auto def: block->getDefinitions()){
-        getOrCreateLRFor(def.predicate)->addDef(i);
+        LRs.addDef(def.predicate, i);
       }
     }
     // add a use for header predicate
@@ -305,9 +421,9 @@ public:
     // TODO:(Emad) of the loop, therefore we say that the last block also uses P0? i.e. connecting
     // TODO:(Emad) the loop end with the start?
     if (!Pub.Scope->isTopLevel()) {
-      auto preds = Pub.Scope->getHeader()->getBlockPredicates();
+      auto &preds = Pub.Scope->getHeader()->getBlockPredicates();
       for(auto pred: preds){
-        getOrCreateLRFor(pred)->addUse(blocks.size());
+        LRs.addUse(pred, blocks.size());
       }
     }
   }
@@ -322,20 +438,24 @@ public:
     // map to keep track of locations of predicates during the scan
     map<unsigned, Location> curLocs;
 
-    auto blocks = Pub.Scope->getBlocksTopoOrd();
+    auto &blocks = Pub.Scope->getBlocksTopoOrd();
     for (unsigned i = 0, e = blocks.size(); i < e; i++) {
       auto block = blocks[i];
       MachineBasicBlock *MBB = block->getMBB();
 
       LLVM_DEBUG( dbgs() << "  MBB#" << MBB->getNumber() << ": " );
 
+      // the reloads of the previous block are done
+      FreeStackLocs.insert(ReloadedLocs.begin(), ReloadedLocs.end());
+      ReloadedLocs.clear();
+
       // (1) handle use
       handlePredUse(i, block, curLocs, FreeLocs);
 
       // (3) handle definitions in this basic block.
       //     if we need to get new locations for predicates (loc==-1),
       //     assign new ones in nearest-next-use order
-      auto definitions = block->getDefinitions();
+      auto &definitions = block->getDefinitions();
       if (!definitions.empty()) {
         vector<unsigned> order;
         for(auto def: definitions){
@@ -411,7 +531,7 @@ public:
 
   /// Unifies with parent, such that this RAInfo knows which registers it can use
   /// and where its spill slots are.
-  void unifyWithParent(const RAInfo::Impl &parent, int parentSpillLocCnt, bool topLevel){
+  void unifyWithParent(const RAInfo::Impl &parent, bool topLevel){
 
       // We can avoid a spill if the total number of locations
       // used by the parent, this instance, and any child is less
@@ -427,9 +547,12 @@ public:
         NeedsScopeSpill = false;
       }
 
-    if (NumLocs > MaxRegs) {
-      FirstUsableStackSlot = parentSpillLocCnt;
-    }
+    FirstUsableStackSlot = parent.FirstUsableStackSlot + parent.getNumSpillLocs();
+  }
+
+  /// The number of stack spill slots this instance needs.
+  unsigned getNumSpillLocs() const {
+    return (NumLocs > MaxRegs) ? NumLocs - MaxRegs : 0;
   }
 
   /// Unifies with child, such that this RAInfo knows how many locations will
@@ -450,6 +573,12 @@ public:
     // if previous location was not a register, we have to allocate
     // a register and/or possibly spill
     if (curUseLoc.isStack()) {
+      // a later definition still writes to the definition location
+      if (!LRs.hasDefAfter(usePred, blockIndex) &&
+          !(DefLocs.count(usePred) && DefLocs.at(usePred).isStack() &&
+            DefLocs.at(usePred).getLoc() == curUseLoc.getLoc())) {
+        ReloadedLocs.push_back(curUseLoc);
+      }
       auto useloc_newloc = handleIfNotInRegister(
           blockIndex, FreeLocs, curLocs, curUseLoc.getLoc());
       LLVM_DEBUG(
@@ -514,7 +643,7 @@ public:
       if (!(usePred == getHeaderPred() && Pub.Scope->isRootTopLevel())) {
         assert(block == Pub.Scope->getHeader() || i > 0);
 
-        if (LRs.at(usePred).lastUse(i)) {
+        if (LRs.lastUse(usePred, i)) {
           LLVM_DEBUG(dbgs() << "retire " << usePred << ". ");
           map<unsigned, Location>::iterator findCurUseLoc = curLocs.find(usePred);
           assert(findCurUseLoc != curLocs.end());
@@ -542,15 +671,14 @@ public:
       // spill and reassign
       // order predicates wrt furthest next use
       vector<unsigned> order;
-      for(auto pair: LRs){
-        auto pred = pair.first;
-        map<unsigned, Location>::iterator cj = curLocs.find(pred);
-        if (cj != curLocs.end() && cj->second.isRegister()) {
-          order.push_back(pred);
+      for(auto &pair: curLocs){
+        if (pair.second.isRegister()) {
+          order.push_back(pair.first);
         }
       }
       sortFurthestNextUse(blockIndex, order);
-      unsigned furthestPred = order.back();
+      unsigned furthestPred = SPCostSpill ? cheapestToSpill(blockIndex, order)
+                                          : order.back();
 
       Location newStackLoc = getAvailLoc(FreeLocs); // guaranteed to be a stack location, since there are no physicals free
       assert(newStackLoc.isStack());
@@ -563,7 +691,8 @@ public:
       UL.load = std::make_pair(true, stackLoc);
 
       // differentiate between already used and not yet used
-      if (LRs.at(furthestPred).anyUseBefore(blockIndex)) {
+      SpillCost += getSpillCost(furthestPred, blockIndex);
+      if (LRs.anyUseBefore(furthestPred, blockIndex)) {
         UL.spill = std::make_pair(true, newStackLoc.getLoc());
 
         LLVM_DEBUG( dbgs() << "Spilling predicate " << furthestPred << " to " << newStackLoc << "\n" );
@@ -590,9 +719,56 @@ public:
   /// Sorts the given vector of predicates according to the
   /// furthest next use from the given MBB position.
   void sortFurthestNextUse(unsigned pos, vector<unsigned>& order) {
-    std::sort(order.begin(), order.end(), [this, pos](int a, int b){
-      return LRs.at(a).hasNextUseBefore(pos, LRs.at(b));
-    });
+    // Find each next use once instead of in every comparison.
+    // Predicates without a next use compare equal, as with
+    // 'hasNextUseBefore()'.
+    vector<std::pair<unsigned, unsigned>> keyed;
+    for (auto pred: order) {
+      keyed.push_back(std::make_pair(LRs.nextUse(pred, pos), pred));
+    }
+    std::sort(keyed.begin(), keyed.end(),
+      [](const std::pair<unsigned, unsigned> &a,
+         const std::pair<unsigned, unsigned> &b){
+        return a.first < b.first;
+      });
+    for (unsigned i = 0, e = keyed.size(); i < e; i++) {
+      order[i] = keyed[i].second;
+    }
+  }
+
+  /// Returns the number of instructions it costs to move the given predicate
+  /// from its register to the stack at the given position and to reload
+  /// it at its next use.
+  unsigned getSpillCost(unsigned pred, unsigned pos) const {
+    if (LRs.anyUseBefore(pred, pos)) {
+      return SpillInstrs + ReloadInstrs;
+    }
+    // Not used yet: all its definitions are moved to the stack location
+    // instead of being spilled.
+    return StackDefInstrs * LRs.numDefs(pred) + ReloadInstrs;
+  }
+
+  /// Chooses the predicate to spill from the given predicates, which must be
+  /// ordered by furthest next use with the furthest in the back.
+  /// Predicates are compared on their spill cost per position
+  /// until their next use. Predicates used far away free a register for
+  /// longer, so are likely to cause fewer additional spills.
+  unsigned cheapestToSpill(unsigned pos, const vector<unsigned> &order) const {
+    assert(!order.empty());
+    unsigned best = order.back();
+    unsigned bestCost = getSpillCost(best, pos);
+    unsigned bestDist = LRs.nextUse(best, pos) - pos;
+    for (auto pred: order) {
+      unsigned cost = getSpillCost(pred, pos);
+      unsigned dist = LRs.nextUse(pred, pos) - pos;
+      // cost/dist < bestCost/bestDist
+      if ((uint64_t) cost * bestDist < (uint64_t) bestCost * dist) {
+        best = pred;
+        bestCost = cost;
+        bestDist = dist;
+      }
+    }
+    return best;
   }
 
   /// Returns the predicate used by the header of the scope that is represented
@@ -634,10 +810,10 @@ bool RAInfo::needsScopeSpill(void) const {
 }
 
 bool RAInfo::isFirstDef(const MachineBasicBlock *MBB, unsigned pred) const {
-  auto blocks = Scope->getBlocksTopoOrd();
+  auto &blocks = Scope->getBlocksTopoOrd();
   for(unsigned i=0; i< blocks.size(); i++) {
     if (blocks[i]->getMBB() == MBB) {
-      return !Priv->LRs.at(pred).hasDefBefore(i);
+      return !Priv->LRs.hasDefBefore(pred, i);
     }
   }
   return false;
@@ -686,11 +862,7 @@ tuple<RAInfo::LocType, unsigned> RAInfo::getDefLoc(unsigned pred) const {
 }
 
 unsigned RAInfo::neededSpillLocs(){
-  if(Priv->NumLocs < Priv->MaxRegs) {
-    return 0;
-  }else{
-    return Priv->NumLocs - Priv->MaxRegs;
-  }
+  return Priv->getNumSpillLocs();
 }
 
 void RAInfo::dump() const {
@@ -702,10 +874,10 @@ void RAInfo::dump(raw_ostream& os, unsigned indent) const{
          <<  "] depth=" << Scope->getDepth() << "\n";
 
   for(auto pair: Priv->LRs){
-    os.indent(indent) << "  LR(p" << pair.first << ") = [" << pair.second.str() << "]\n";
+    os.indent(indent) << "  LR(p" << pair.first << ") = [" << Priv->LRs.str(pair.first) << "]\n";
   }
 
-  auto blocks = Scope->getBlocksTopoOrd();
+  auto &blocks = Scope->getBlocksTopoOrd();
   for (unsigned i=0, e=blocks.size(); i<e; i++) {
     MachineBasicBlock *MBB = blocks[i]->getMBB();
     os.indent(indent) << "  " << i << "| MBB#" << MBB->getNumber();
@@ -737,7 +909,8 @@ void RAInfo::dump(raw_ostream& os, unsigned indent) const{
   os.indent(indent) << "  NumLocs:      " << Priv->NumLocs << "\n"
             "  CumLocs:      " << Priv->getCumLocs() << "\n"
             "  Offset:       " << Priv->FirstUsableReg  << "\n"
-            "  SpillOffset:  " << Priv->FirstUsableStackSlot  << "\n";
+            "  SpillOffset:  " << Priv->FirstUsableStackSlot  << "\n"
+            "  SpillCost:    " << Priv->SpillCost  << "\n";
 }
 
 std::map<const SPScope*, RAInfo> RAInfo::computeRegAlloc(SPScope *rootScope, unsigned AvailPredRegs){
@@ -764,18 +937,28 @@ std::map<const SPScope*, RAInfo> RAInfo::computeRegAlloc(SPScope *rootScope, uns
 
   // Visit all scopes in depth-first order to compute offsets:
   // - Offset is inherited during traversal
-  // - SpillOffset is assigned increased depth-first, from left to right
+  // - SpillOffset is inherited during traversal, on top of the parent's
+  //   spill slots, such that siblings share the same spill slots.
   unsigned spillLocCnt = 0;
+  std::map<const SPScope*, uint64_t> executions;
   for (auto iter = df_begin(rootScope), end = df_end(rootScope);
         iter!=end; ++iter) {
     auto scope = *iter;
     RAInfo &RI = RAInfos.at(scope);
 
+    // How often the scope is executed per activation of the root
+    uint64_t execs = 1;
     if (!scope->isTopLevel()) {
-       RI.Priv->unifyWithParent(*(RAInfos.at(scope->getParent()).Priv), spillLocCnt, scope->isTopLevel());
+       RI.Priv->unifyWithParent(*(RAInfos.at(scope->getParent()).Priv), scope->isTopLevel());
       if (!RI.needsScopeSpill()) NoSpillScopes++; // STATISTIC
+      execs = executions.at(scope->getParent()) *
+              (scope->hasLoopBound() ? scope->getLoopBound() : 1);
     }
-    spillLocCnt += RI.neededSpillLocs();
+    executions[scope] = execs;
+    PredSpillCost += execs * RI.Priv->SpillCost; // STATISTIC
+
+    spillLocCnt = std::max(spillLocCnt,
+                           RI.Priv->FirstUsableStackSlot + RI.neededSpillLocs());
     LLVM_DEBUG( RI.dump() );
   } // end df
 
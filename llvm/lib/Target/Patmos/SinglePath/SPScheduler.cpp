@@ -7,17 +7,33 @@
 //
 //===----------------------------------------------------------------------===//
 //
+// Every block of single-path code is split into regions, which end at
+// control-flow instructions and at instructions we cannot move (inline asm,
+// stack control, labels, instructions with side effects). Each region is
+// list-scheduled top-down using the operand latencies of the itineraries.
+//
+// Latencies are resolved across regions by remembering the last definition
+// of each register unit. At the end of a block, and at the end of the delay
+// slots of a control-flow instruction, all latencies are resolved, so all
+// NOPs are static and the execution time does not depend on the input data.
 //
 //===----------------------------------------------------------------------===//
 
 #include "SPScheduler.h"
+#include "PatmosInstrInfo.h"
+#include "PatmosSubtarget.h"
 
-#include "llvm/Support/Debug.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Debug.h"
 
 using namespace llvm;
 
 STATISTIC(SPInstructions,     "Number of instruction bundles in single-path code (both single and double)");
+STATISTIC(SPNOPs,             "Number of NOPs inserted in single-path code");
+STATISTIC(SPBundles,          "Number of bundles formed in single-path code");
+STATISTIC(SPFilledSlots,      "Number of delay slots filled in single-path code");
 
 char SPScheduler::ID = 0;
 
@@ -25,6 +41,552 @@ FunctionPass *llvm::createSPSchedulerPass(const PatmosTargetMachine &tm) {
   return new SPScheduler(tm);
 }
 
+namespace {
+
+  /// A node of the dependence graph of a region. This is either a single
+  /// instruction or a bundle created by the single-path bundling.
+  struct SPNode {
+    SmallVector<MachineInstr*, 2> Instrs;
+
+    /// Successor nodes with the latency of the dependence.
+    SmallVector<std::pair<unsigned, unsigned>, 8> Succs;
+
+    unsigned NumPreds = 0;
+
+    /// Earliest cycle the node may be issued in.
+    unsigned Earliest = 0;
+
+    /// Length of the longest latency path to the end of the region.
+    unsigned Height = 0;
+
+    /// Cycle the node is issued in.
+    unsigned Cycle = 0;
+
+    /// The node does not occupy an issue slot.
+    bool IsPseudo = false;
+
+    /// The node occupies all slots of a cycle.
+    bool FullWidth = false;
+
+    /// The node is a branch, call or return and ends the region.
+    bool IsCFL = false;
+  };
+
+  /// One cycle of a region schedule.
+  struct SPCycle {
+    /// Pseudo nodes, emitted in front of the issued nodes.
+    SmallVector<unsigned, 2> Pseudos;
+
+    /// Issued nodes, in slot order.
+    SmallVector<unsigned, 2> Slots;
+  };
+
+  /// The last definition of a register unit in an earlier region.
+  struct SPRegDef {
+    const MachineInstr *MI;
+    unsigned OpIdx;
+    unsigned Cycle;
+  };
+
+  class SPBlockScheduler {
+    const PatmosInstrInfo &TII;
+    const PatmosSubtarget &STC;
+    const TargetRegisterInfo &TRI;
+    const InstrItineraryData *ItinData;
+    MachineBasicBlock &MBB;
+    unsigned IssueWidth;
+
+    /// Cycle of the next emitted bundle, relative to the start of the block.
+    unsigned CurCycle = 0;
+
+    /// Defs of earlier regions, by register unit.
+    DenseMap<unsigned, SPRegDef> LastDefs;
+
+    /// The nodes and the schedule of the current region.
+    std::vector<SPNode> Nodes;
+    std::vector<SPCycle> Cycles;
+
+    /// Number of cycles of the current region that must be emitted, i.e.,
+    /// trailing cycles containing only pseudos do not get a NOP.
+    unsigned NumCycles = 0;
+
+  public:
+    SPBlockScheduler(const PatmosInstrInfo &tii, const PatmosSubtarget &stc,
+                     MachineBasicBlock &mbb, unsigned issueWidth)
+      : TII(tii), STC(stc), TRI(*stc.getRegisterInfo()),
+        ItinData(stc.getInstrItineraryData()), MBB(mbb),
+        IssueWidth(issueWidth) {}
+
+    void run();
+
+  private:
+    typedef SmallVector<MachineInstr*, 2> Unit;
+
+    static bool isCFL(const Unit &U) {
+      for (auto MI : U) {
+        if (MI->isBranch() || MI->isCall() || MI->isReturn())
+          return true;
+      }
+      return false;
+    }
+
+    /// Units that must stay in place and form a region on their own.
+    bool isBarrier(const Unit &U) const {
+      if (isCFL(U)) return false;
+      for (auto MI : U) {
+        if (MI->isInlineAsm() || MI->isLabel() || MI->isCFIInstruction() ||
+            TII.isStackControl(MI) || MI->hasUnmodeledSideEffects())
+          return true;
+      }
+      return false;
+    }
+
+    /// Latency between the def and the use of a register.
+    unsigned getLatency(const MachineInstr &Def, unsigned DefIdx,
+                        const MachineInstr &Use, unsigned UseIdx) const {
+      int Latency = TII.getOperandLatency(ItinData, Def, DefIdx, Use, UseIdx);
+      if (Latency < 0)
+        return getExitLatency(Def, DefIdx);
+      return std::max(Latency, 1);
+    }
+
+    /// Latency after which a def may be read by any instruction.
+    unsigned getExitLatency(const MachineInstr &Def, unsigned DefIdx) const {
+      return std::max(TII.getDefOperandLatency(ItinData, Def, DefIdx), 1);
+    }
+
+    unsigned getExitLatency(const SPNode &N) const;
+
+    void addEdge(unsigned From, unsigned To, unsigned Latency);
+
+    void buildNodes(ArrayRef<Unit> Units);
+    void buildDependencies();
+
+    /// Returns the best node ready in the given cycle, or -1. If Partner
+    /// is given, only nodes that can be bundled with it are considered.
+    int pickNode(ArrayRef<unsigned> Ready, unsigned Cycle, int Partner) const;
+
+    void scheduleNode(unsigned N, unsigned Cycle,
+                      SmallVectorImpl<unsigned> &Ready);
+
+    void listSchedule();
+
+    /// Places the CFL of the region and fills its delay slots.
+    void scheduleCFL(unsigned CFL);
+
+    void emit();
+
+    void scheduleRegion(ArrayRef<Unit> Units);
+
+    /// Emits NOPs until all defs of earlier regions are visible.
+    void resolveLatencies();
+  };
+}
+
+unsigned SPBlockScheduler::getExitLatency(const SPNode &N) const {
+  unsigned Latency = 0;
+  for (auto MI : N.Instrs) {
+    for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+      const MachineOperand &MO = MI->getOperand(i);
+      if (MO.isReg() && MO.getReg() && MO.isDef())
+        Latency = std::max(Latency, getExitLatency(*MI, i));
+    }
+  }
+  return Latency;
+}
+
+void SPBlockScheduler::addEdge(unsigned From, unsigned To, unsigned Latency) {
+  if (From == To) return;
+
+  // Pseudos are emitted in front of the bundle of their cycle, they must
+  // be issued after their real predecessors.
+  if (Nodes[From].IsPseudo) Latency = 0;
+  if (Nodes[To].IsPseudo)   Latency = Nodes[From].IsPseudo ? 0 : 1;
+  // The CFL gets a cycle on its own in front of the delay slots.
+  if (Nodes[To].IsCFL)      Latency = std::max(Latency, 1u);
+
+  Nodes[From].Succs.push_back(std::make_pair(To, Latency));
+  Nodes[To].NumPreds++;
+}
+
+void SPBlockScheduler::buildNodes(ArrayRef<Unit> Units) {
+  Nodes.clear();
+  Cycles.clear();
+  NumCycles = 0;
+
+  for (auto &U : Units) {
+    SPNode N;
+    N.Instrs = U;
+    N.Earliest = CurCycle;
+    N.IsCFL = isCFL(U);
+    N.IsPseudo = true;
+    N.FullWidth = U.size() > 1;
+    for (auto MI : U) {
+      N.IsPseudo &= TII.isPseudo(MI);
+      N.FullWidth |= TII.getIssueWidth(MI) >= IssueWidth;
+    }
+    Nodes.push_back(N);
+  }
+}
+
+void SPBlockScheduler::buildDependencies() {
+  struct LocalDef {
+    unsigned Node;
+    const MachineInstr *MI;
+    unsigned OpIdx;
+  };
+  DenseMap<unsigned, LocalDef> Defs;
+  DenseMap<unsigned, SmallVector<unsigned, 4>> Uses;
+  int LastStore = -1;
+  SmallVector<unsigned, 8> Loads;
+
+  for (unsigned N = 0; N < Nodes.size(); N++) {
+    SPNode &Node = Nodes[N];
+
+    // Memory dependencies. Calls and returns are ordered with all memory
+    // accesses.
+    bool IsStore = false, IsLoad = false;
+    for (auto MI : Node.Instrs) {
+      if (MI->mayStore() || MI->isCall() || MI->isReturn() ||
+          (MI->mayLoad() && MI->hasOrderedMemoryRef()))
+        IsStore = true;
+      else if (MI->mayLoad())
+        IsLoad = true;
+    }
+    if (IsStore) {
+      if (LastStore >= 0) addEdge(LastStore, N, 1);
+      for (auto L : Loads) addEdge(L, N, 0);
+      Loads.clear();
+      LastStore = N;
+    } else if (IsLoad) {
+      if (LastStore >= 0) addEdge(LastStore, N, 1);
+      Loads.push_back(N);
+    }
+
+    // Register uses
+    for (auto MI : Node.Instrs) {
+      for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+        const MachineOperand &MO = MI->getOperand(i);
+        if (!MO.isReg() || !MO.getReg() || !MO.isUse() || MO.isUndef())
+          continue;
+
+        for (MCRegUnitIterator RU(MO.getReg(), &TRI); RU.isValid(); ++RU) {
+          auto D = Defs.find(*RU);
+          if (D != Defs.end()) {
+            addEdge(D->second.Node, N,
+                    getLatency(*D->second.MI, D->second.OpIdx, *MI, i));
+          } else if (!Node.IsPseudo) {
+            auto C = LastDefs.find(*RU);
+            if (C != LastDefs.end()) {
+              Node.Earliest = std::max(Node.Earliest, C->second.Cycle +
+                          getLatency(*C->second.MI, C->second.OpIdx, *MI, i));
+            }
+          }
+          Uses[*RU].push_back(N);
+        }
+      }
+    }
+
+    // Register defs, bundles may define a register in both slots under
+    // disjoint predicates.
+    SmallVector<std::pair<unsigned, LocalDef>, 4> NewDefs;
+    for (auto MI : Node.Instrs) {
+      for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+        const MachineOperand &MO = MI->getOperand(i);
+        if (!MO.isReg() || !MO.getReg() || !MO.isDef())
+          continue;
+
+        for (MCRegUnitIterator RU(MO.getReg(), &TRI); RU.isValid(); ++RU) {
+          auto &UnitUses = Uses[*RU];
+          for (auto U : UnitUses) addEdge(U, N, 0);
+          UnitUses.clear();
+
+          auto D = Defs.find(*RU);
+          if (D != Defs.end()) {
+            addEdge(D->second.Node, N,
+                    getExitLatency(*D->second.MI, D->second.OpIdx));
+          } else if (!Node.IsPseudo) {
+            auto C = LastDefs.find(*RU);
+            if (C != LastDefs.end()) {
+              Node.Earliest = std::max(Node.Earliest, C->second.Cycle +
+                              getExitLatency(*C->second.MI, C->second.OpIdx));
+            }
+          }
+          NewDefs.push_back(std::make_pair(*RU, LocalDef{N, MI, i}));
+        }
+      }
+    }
+    for (auto &D : NewDefs) {
+      Defs[D.first] = D.second;
+    }
+  }
+
+  // Edges always point to later nodes.
+  for (unsigned N = Nodes.size(); N-- > 0; ) {
+    for (auto &S : Nodes[N].Succs) {
+      Nodes[N].Height = std::max(Nodes[N].Height,
+                                 S.second + Nodes[S.first].Height);
+    }
+  }
+}
+
+int SPBlockScheduler::pickNode(ArrayRef<unsigned> Ready, unsigned Cycle,
+                               int Partner) const {
+  int Best = -1;
+  for (auto N : Ready) {
+    const SPNode &Node = Nodes[N];
+    if (Node.IsPseudo || Node.Earliest > Cycle)
+      continue;
+
+    if (Partner >= 0) {
+      if (Node.FullWidth) continue;
+      const MachineInstr *A = Nodes[Partner].Instrs.front();
+      const MachineInstr *B = Node.Instrs.front();
+      if (!(TII.canIssueInSlot(A, 0) && TII.canIssueInSlot(B, 1)) &&
+          !(TII.canIssueInSlot(B, 0) && TII.canIssueInSlot(A, 1)))
+        continue;
+    }
+
+    // Prefer the longest path, then the original order.
+    if (Best < 0 || Node.Height > Nodes[Best].Height ||
+        (Node.Height == Nodes[Best].Height && N < (unsigned)Best))
+      Best = N;
+  }
+  return Best;
+}
+
+void SPBlockScheduler::scheduleNode(unsigned N, unsigned Cycle,
+                                    SmallVectorImpl<unsigned> &Ready) {
+  Nodes[N].Cycle = Cycle;
+  Ready.erase(std::find(Ready.begin(), Ready.end(), N));
+
+  for (auto &S : Nodes[N].Succs) {
+    SPNode &Succ = Nodes[S.first];
+    Succ.Earliest = std::max(Succ.Earliest, Cycle + S.second);
+    if (--Succ.NumPreds == 0 && !Succ.IsCFL)
+      Ready.push_back(S.first);
+  }
+}
+
+void SPBlockScheduler::listSchedule() {
+  SmallVector<unsigned, 16> Ready;
+  unsigned Remaining = 0;
+  for (unsigned N = 0; N < Nodes.size(); N++) {
+    if (Nodes[N].IsCFL) continue;
+    Remaining++;
+    if (Nodes[N].NumPreds == 0) Ready.push_back(N);
+  }
+
+  for (unsigned Cycle = CurCycle; Remaining; Cycle++) {
+    SPCycle C;
+
+    // Pseudos do not need a slot, release everything that depends on them.
+    for (bool Changed = true; Changed; ) {
+      Changed = false;
+      for (auto N : Ready) {
+        if (Nodes[N].IsPseudo && Nodes[N].Earliest <= Cycle) {
+          scheduleNode(N, Cycle, Ready);
+          C.Pseudos.push_back(N);
+          Remaining--;
+          Changed = true;
+          break;
+        }
+      }
+    }
+
+    int First = pickNode(Ready, Cycle, -1);
+    if (First >= 0) {
+      scheduleNode(First, Cycle, Ready);
+      C.Slots.push_back(First);
+      Remaining--;
+
+      int Second = Nodes[First].FullWidth ? -1 : pickNode(Ready, Cycle, First);
+      if (Second >= 0) {
+        scheduleNode(Second, Cycle, Ready);
+        if (TII.canIssueInSlot(Nodes[Second].Instrs.front(), 1) &&
+            TII.canIssueInSlot(Nodes[First].Instrs.front(), 0))
+          C.Slots.push_back(Second);
+        else
+          C.Slots.insert(C.Slots.begin(), Second);
+        Remaining--;
+        SPBundles++;
+      }
+      NumCycles = Cycles.size() + 1;
+    }
+
+    Cycles.push_back(C);
+  }
+}
+
+void SPBlockScheduler::scheduleCFL(unsigned CFL) {
+  unsigned Delay = 0;
+  for (auto MI : Nodes[CFL].Instrs) {
+    Delay = std::max(Delay, STC.getDelaySlotCycles(*MI));
+  }
+
+  // All defs must be visible at the end of the delay slots, the CFL target
+  // does not know about pending latencies.
+  unsigned CarriedEnd = 0;
+  for (auto &D : LastDefs) {
+    CarriedEnd = std::max(CarriedEnd, D.second.Cycle +
+                          getExitLatency(*D.second.MI, D.second.OpIdx));
+  }
+  SmallVector<unsigned, 16> ExitLatency(Nodes.size());
+  for (unsigned N = 0; N < Nodes.size(); N++) {
+    if (!Nodes[N].IsPseudo && N != CFL)
+      ExitLatency[N] = getExitLatency(Nodes[N]);
+  }
+
+  // Move the CFL as early as possible, at most Delay cycles may follow it.
+  unsigned Cycle = std::max(Nodes[CFL].Earliest,
+                            CurCycle + std::max(NumCycles, Delay) - Delay);
+  for (;; Cycle++) {
+    unsigned End = Cycle + 1 + Delay;
+    bool Fits = CarriedEnd <= End;
+    for (unsigned N = 0; Fits && N < Nodes.size(); N++) {
+      if (Nodes[N].IsPseudo || N == CFL) continue;
+      unsigned C = Nodes[N].Cycle >= Cycle ? Nodes[N].Cycle + 1
+                                           : Nodes[N].Cycle;
+      Fits = C + ExitLatency[N] <= End;
+    }
+    if (Fits) break;
+  }
+
+  for (auto &Node : Nodes) {
+    if (Node.Cycle >= Cycle) Node.Cycle++;
+  }
+  Nodes[CFL].Cycle = Cycle;
+
+  unsigned Idx = Cycle - CurCycle;
+  if (Cycles.size() < Idx) Cycles.resize(Idx);
+  SPCycle C;
+  C.Slots.push_back(CFL);
+  Cycles.insert(Cycles.begin() + Idx, C);
+
+  for (unsigned i = Idx + 1; i < NumCycles + 1; i++) {
+    if (!Cycles[i].Slots.empty()) SPFilledSlots++;
+  }
+
+  NumCycles = Idx + 1 + Delay;
+  if (Cycles.size() < NumCycles) Cycles.resize(NumCycles);
+}
+
+void SPBlockScheduler::emit() {
+  for (unsigned i = 0; i < Cycles.size(); i++) {
+    for (auto P : Cycles[i].Pseudos) {
+      for (auto MI : Nodes[P].Instrs)
+        MBB.insert(MBB.instr_end(), MI);
+    }
+
+    if (Cycles[i].Slots.empty()) {
+      if (i < NumCycles) {
+        TII.insertNoop(MBB, MBB.end());
+        SPNOPs++;
+        SPInstructions++;
+      }
+      continue;
+    }
+
+    bool First = true;
+    for (auto N : Cycles[i].Slots) {
+      for (auto MI : Nodes[N].Instrs) {
+        MBB.insert(MBB.instr_end(), MI);
+        if (!First) MI->bundleWithPred();
+        First = false;
+      }
+    }
+    SPInstructions++;
+  }
+}
+
+void SPBlockScheduler::scheduleRegion(ArrayRef<Unit> Units) {
+  buildNodes(Units);
+  buildDependencies();
+  listSchedule();
+  if (Nodes.back().IsCFL)
+    scheduleCFL(Nodes.size() - 1);
+
+  LLVM_DEBUG({
+    dbgs() << "Region schedule at cycle " << CurCycle << ":\n";
+    for (unsigned i = 0; i < Cycles.size(); i++) {
+      if (Cycles[i].Slots.empty() && i < NumCycles)
+        dbgs() << "  " << i << ": nop\n";
+      for (auto N : Cycles[i].Slots) {
+        for (auto MI : Nodes[N].Instrs)
+          dbgs() << "  " << i << ": " << *MI;
+      }
+    }
+  });
+
+  emit();
+
+  // Nodes are in program order, later defs override earlier ones.
+  for (auto &Node : Nodes) {
+    if (Node.IsPseudo) continue;
+    for (auto MI : Node.Instrs) {
+      for (unsigned i = 0; i < MI->getNumOperands(); i++) {
+        const MachineOperand &MO = MI->getOperand(i);
+        if (!MO.isReg() || !MO.getReg() || !MO.isDef())
+          continue;
+        for (MCRegUnitIterator RU(MO.getReg(), &TRI); RU.isValid(); ++RU) {
+          LastDefs[*RU] = SPRegDef{MI, i, Node.Cycle};
+        }
+      }
+    }
+  }
+
+  CurCycle += NumCycles;
+}
+
+void SPBlockScheduler::resolveLatencies() {
+  unsigned End = CurCycle;
+  for (auto &D : LastDefs) {
+    End = std::max(End, D.second.Cycle +
+                        getExitLatency(*D.second.MI, D.second.OpIdx));
+  }
+  for (; CurCycle < End; CurCycle++) {
+    TII.insertNoop(MBB, MBB.end());
+    SPNOPs++;
+    SPInstructions++;
+  }
+}
+
+void SPBlockScheduler::run() {
+  std::vector<Unit> Units;
+  for (auto I = MBB.instr_begin(), E = MBB.instr_end(); I != E; ) {
+    Units.emplace_back();
+    do {
+      Units.back().push_back(&*I);
+    } while ((I++)->isBundledWithSucc() && I != E);
+  }
+
+  // Take all instructions out of the block, they are reinserted in
+  // schedule order.
+  for (auto &U : Units) {
+    for (auto MI : U)
+      MBB.remove_instr(MI);
+  }
+
+  ArrayRef<Unit> AllUnits(Units);
+  for (unsigned Begin = 0; Begin < Units.size(); ) {
+    unsigned End = Begin + 1;
+    if (isBarrier(Units[Begin])) {
+      // Inline asm does not know about pending latencies.
+      if (Units[Begin].front()->isInlineAsm())
+        resolveLatencies();
+    } else if (!isCFL(Units[Begin])) {
+      while (End < Units.size() && !isBarrier(Units[End])) {
+        if (isCFL(Units[End++])) break;
+      }
+    }
+    scheduleRegion(AllUnits.slice(Begin, End - Begin));
+    Begin = End;
+  }
+
+  // Successors are scheduled without knowing about this block.
+  resolveLatencies();
+}
+
 bool SPScheduler::runOnMachineFunction(MachineFunction &mf){
 
   // Only schedule single-path function
@@ -34,23 +596,13 @@ bool SPScheduler::runOnMachineFunction(MachineFunction &mf){
 
   LLVM_DEBUG( dbgs() << "Running SPScheduler on function '" <<  mf.getName() << "'\n");
 
-  auto reduceAnalysis = &getAnalysis<PatmosSPReduce>();
-  auto rootScope = reduceAnalysis->RootScope;
+  auto rootScope = getAnalysis<PatmosSinglePathInfo>().getRootScope();
 
   for(auto mbbIter = mf.begin(), mbbEnd = mf.end(); mbbIter != mbbEnd; ++mbbIter){
     auto mbb = mbbIter;
     LLVM_DEBUG( errs() << "MBB: [" << *mbb << "]: #" << mbb->getNumber() << "\n");
 
-    for(auto instrIter = mbb->begin(), instrEnd = mbb->end();
-        instrIter != instrEnd; )
-    {
-      SPInstructions++;
-	  auto latency = calculateLatency(instrIter);
-	  for(auto i = 0; i<latency; i++){
-	    TM.getInstrInfo()->insertNoop(*mbb, std::next(instrIter));
-	  }
-	  instrIter = std::next(instrIter, 1+latency); // Make sure to skip the newly added noops
-    }
+    scheduleBlock(*mbb);
   }
 
   LLVM_DEBUG( dbgs() << "AFTER Single-Path Schedule\n"; mf.dump() );
@@ -61,20 +613,11 @@ bool SPScheduler::runOnMachineFunction(MachineFunction &mf){
   return true;
 }
 
-unsigned SPScheduler::calculateLatency(MachineBasicBlock::iterator instr) const{
-  if(instr->isBranch() || instr->isCall() || instr->isReturn()){
-    // We simply add 3 nops after any branch, call or return, as its
-    // the highest possible delay.
-    // The delay slot filler pass will remove most of these afterwards
-    return 3;
-  } else if (instr->mayLoad() || (instr->getOpcode() == Patmos::MUL) || (instr->getOpcode() == Patmos::MULU)){
-    return 1;
-    // TODO: make it cleverer, e.g. no reason for a nop
-    // if the next instruction does not use the loaded value.
-  } else {
-    return 0;
-  }
-}
-
-
+void SPScheduler::scheduleBlock(MachineBasicBlock &MBB) const {
+  const PatmosSubtarget &STC = *TM.getSubtargetImpl();
+  unsigned IssueWidth = STC.enableBundling(TM.getOptLevel()) ?
+                        STC.getSchedModel().IssueWidth : 1;
 
+  SPBlockScheduler Scheduler(*TM.getInstrInfo(), STC, MBB, IssueWidth);
+  Scheduler.run();
+}
@@ -7,6 +7,13 @@
 //
 //===----------------------------------------------------------------------===//
 //
+// List scheduler for single-path code.
+//
+// Single-path code has been linearized by PatmosSPReduce, i.e., every block
+// is executed regardless of the input data. The scheduler therefore only has
+// to fill the latencies of loads, multiplications and control-flow
+// instructions with independent work and to form dual-issue bundles, without
+// introducing any data-dependent stalls.
 //
 //===----------------------------------------------------------------------===//
 
@@ -41,7 +48,7 @@ public:
 
   /// getAnalysisUsage - Specify which passes this pass depends on
   void getAnalysisUsage(AnalysisUsage &AU) const override {
-    AU.addRequired<PatmosSPReduce>();
+    AU.addRequired<PatmosSinglePathInfo>();
     MachineFunctionPass::getAnalysisUsage(AU);
   }
 
@@ -49,13 +56,11 @@ private:
 
   const PatmosTargetMachine &TM;
 
-  /// Calculates the latency that must be observed between these two instructions.
-  /// E.g. if the first instruction loads a value into a register and the
-  /// second instruction uses that value the latency is 1, and there must be at
-  /// least 1 cycle between the two instructions.
-  /// If the instructions are part of bundles, the whole bundle is taken into
-  /// account.
-  unsigned calculateLatency(MachineBasicBlock::iterator) const;
+  /// Schedules the instructions of the given block.
+  /// Bundles created by the single-path bundling are kept together.
+  /// All latencies are resolved at the end of the block, so
+  /// successor blocks can be scheduled independently.
+  void scheduleBlock(MachineBasicBlock &MBB) const;
 
 };
 
@@ -13,11 +13,17 @@
 #include "PatmosSinglePathInfo.h"
 #include "PatmosSPBundling.h"
 #include "TargetInfo/PatmosTargetInfo.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineFunction.h"
 
 using namespace llvm;
 
+STATISTIC(ExactLoopBounds, "Number of single-path loops with an exact bound");
+
 /// Node - a node used internally in the scope to construct a forward CFG
 /// of the scope blocks
 class Node {
@@ -188,6 +194,9 @@ public:
   // loop bound. If negative, there is no loop bound. Otherwise, its value is the loop bound.
   int LoopBound;
 
+  // Whether the loop counter alone decides the exit, see hasExactLoopBound()
+  bool ExactBound;
+
   // Whether this scope is part of a root single-path function
   const bool RootFunc;
 
@@ -201,13 +210,30 @@ public:
   /// Number of predicates used
   unsigned PredCount;
 
+  /// The implementation of the top-level scope of the tree.
+  /// Only its instance maintains the block indexes below.
+  Impl *RootImpl;
+
+  /// Maps every MBB in the tree to the block managing it.
+  DenseMap<const MachineBasicBlock*, PredicatedBlock*> BlockIndex;
+
+  /// Maps every block in the tree to the deepest scope containing it.
+  DenseMap<const PredicatedBlock*, SPScope*> ScopeIndex;
+
+  /// Results of the public accessors, computed on first use.
+  /// Cleared by 'invalidate()' when the blocks or edges of the tree change.
+  Optional<std::vector<PredicatedBlock*>> TopoOrd;
+  Optional<std::vector<PredicatedBlock*>> FcfgBlocks;
+  Optional<std::set<const PredicatedBlock*>> SucceedingBlocks;
+
 //Constructors
   Impl(SPScope *pub, SPScope * parent, bool rootFunc, MachineLoop *loop,
       MachineBasicBlock *header, MachineFunction &MF, MachineLoopInfo &LI):
-    Pub(*pub), Parent(parent), LoopBound(-1), RootFunc(rootFunc),
-    PredCount(0)
+    Pub(*pub), Parent(parent), LoopBound(-1), ExactBound(false),
+    RootFunc(rootFunc),
+    PredCount(0), RootImpl(parent ? parent->Priv->RootImpl : this)
   {
-    Blocks.push_back(new PredicatedBlock(header));
+    addBlock(new PredicatedBlock(header));
 
     // add the rest of the MBBs to the scope
     for (auto FI=MF.begin(), FE=MF.end();
@@ -240,7 +266,7 @@ public:
         outedges = subscope->Priv->getOutEdges();
       } else {
         // simple block
-        auto succs = block->getSuccessors();
+        auto &succs = block->getSuccessors();
         for (auto si = succs.begin(),
               se = succs.end(); si != se; ++si) {
           outedges.insert(std::make_pair(block, si->first));
@@ -270,8 +296,10 @@ public:
           n.connect(ns, edge);
         } else {
           if (succ != Pub.getHeader()) {
-            // record exit edges
-            fcfg.toexit(n, edge);
+            // record exit edges, except the one of a loop with an exact
+            // bound, which leaves the latch together with the back edge
+            if (!ExactBound)
+              fcfg.toexit(n, edge);
           } else {
             // we don't need back edges recorded
             fcfg.toexit(n);
@@ -313,7 +341,7 @@ public:
       p = 0;
     }
 
-    auto blocks = Pub.getBlocksTopoOrd();
+    auto &blocks = Pub.getBlocksTopoOrd();
     for(auto block: blocks){
       CD_map_entry_t t = CD.at(block);
       int q=-1;
@@ -360,7 +388,7 @@ public:
     // Properly assign the Uses/Defs
     PredCount = K.size();
     // Assign predicates for each block in the fcfg of this scope
-    auto fcfgBlocks = Pub.getFcfgBlocks();
+    auto &fcfgBlocks = Pub.getFcfgBlocks();
     std::for_each(fcfgBlocks.begin(), fcfgBlocks.end(),
             [&](auto b){ b->setPredicate(blockPreds[b]); });
 
@@ -368,7 +396,7 @@ public:
       dbgs() << "Assigned predicates for each FCFG block:\n";
       for(auto block: fcfgBlocks){
         block->printID(dbgs().indent(2)) << "\t: ";
-        auto preds = block->getBlockPredicates();
+        auto &preds = block->getBlockPredicates();
         if(preds.size() == 0){
           dbgs() << "none";
         }else{
@@ -499,7 +527,7 @@ public:
 
   Edge getDual(Edge &e) const {
     auto src = e.first;
-    auto succs = src->getSuccessors();
+    auto &succs = src->getSuccessors();
     assert(succs.size() == 2);
     for (auto si = succs.begin(),
         se = succs.end(); si != se; ++si) {
@@ -526,8 +554,35 @@ public:
   void addMBB(MachineBasicBlock *MBB) {
 
     if (Blocks.front()->getMBB() != MBB) {
-      Blocks.push_back(new PredicatedBlock(MBB));
+      addBlock(new PredicatedBlock(MBB));
+    }
+  }
+
+  /// Adds the given block to this scope and the indexes of the tree.
+  void addBlock(PredicatedBlock *block) {
+    Blocks.push_back(block);
+    RootImpl->BlockIndex[block->getMBB()] = block;
+    RootImpl->ScopeIndex[block] = &Pub;
+  }
+
+  /// Drops the cached results of this scope and all its subscopes.
+  void invalidate() {
+    TopoOrd.reset();
+    FcfgBlocks.reset();
+    SucceedingBlocks.reset();
+    for(auto subscope: Subscopes){
+      subscope->Priv->invalidate();
+    }
+  }
+
+  /// Returns whether the given scope is this scope or nested inside it.
+  bool encloses(const SPScope *scope) const {
+    for(; scope; scope = scope->getParent()){
+      if(scope == &Pub){
+        return true;
+      }
     }
+    return false;
   }
 
   /// Returns the number of definitions the given predicate
@@ -541,7 +596,7 @@ public:
     // Don't check the subheaders since they can't define predicates
     // for this scope.
     for(auto b: Blocks){
-      auto defs = b->getDefinitions();
+      auto &defs = b->getDefinitions();
       if(std::find_if(defs.begin(), defs.end(), [&](auto def){
         return def.predicate == pred;
       }) != defs.end()){
@@ -555,11 +610,8 @@ public:
   /// in this scope. If not, NULL is returned.
   PredicatedBlock* getPredicated(const MachineBasicBlock *mbb)
   {
-    auto found = std::find_if(Blocks.begin(), Blocks.end(), [&](auto block){
-      return block->getMBB() == mbb;
-    });
-
-    return found != Blocks.end()? *found : NULL;
+    auto block = RootImpl->BlockIndex.lookup(mbb);
+    return block && RootImpl->ScopeIndex.lookup(block) == &Pub ? block : NULL;
   }
 
   /// Returns the PredicatedBlock of the given MBB, if it is either exclusively
@@ -587,7 +639,7 @@ public:
     std::set<std::pair<const PredicatedBlock*, const PredicatedBlock*>> outs;
 
     for(auto block: Blocks){
-      auto exits = block->getExitTargets();
+      auto &exits = block->getExitTargets();
       for(auto t: exits){
         outs.insert(std::make_pair(block,t));
       }
@@ -626,21 +678,8 @@ public:
   /// If the block is not part of any scope, return NULL.
   SPScope* findScopeOf(const PredicatedBlock *block) const
   {
-    // Look in this scope's blocks
-    if(std::find(Blocks.begin(), Blocks.end(), block) != Blocks.end()){
-      return &Pub;
-    }
-
-    // Otherwise, look through the subscopes
-    for(auto subscope: Subscopes){
-      auto inSubscope = subscope->Priv->findScopeOf(block);
-      if(inSubscope){
-        return inSubscope;
-      }
-    }
-
-    // Not found
-    return NULL;
+    auto scope = RootImpl->ScopeIndex.lookup(block);
+    return encloses(scope) ? scope : NULL;
   }
 
   void replaceUseOfBlockWith(PredicatedBlock* oldBlock, PredicatedBlock* newBlock){
@@ -697,11 +736,20 @@ SPScope::SPScope(SPScope *parent, MachineLoop &loop, MachineFunction &MF, Machin
     (*found)->addExitTarget(Priv->getPredicatedParent(edge.second));
   }
 
-  int bound_max = getLoopBounds(header).second;
+  auto bounds = getLoopBounds(header);
+  int bound_max = bounds.second;
   if( bound_max != -1) {
       Priv->LoopBound = bound_max + 1;
   }
 
+  // With min == max, the only exit edge is taken exactly when the counter
+  // runs out, if it leaves from the latch at the end of the last iteration
+  if (bound_max != -1 && bounds.first == bound_max && ExitEdges.size() == 1 &&
+      ExitEdges.front().first == loop.getLoopLatch()) {
+    Priv->ExactBound = true;
+    ExactLoopBounds++; // STATISTIC
+  }
+
   if(!hasLoopBound()) {
     report_fatal_error(
               "Single-path code generation failed! "
@@ -729,14 +777,17 @@ bool SPScope::isSubheader(const PredicatedBlock *block) const {
       [&](auto subscope){return subscope->isHeader(block);});
 }
 
-const std::set<const PredicatedBlock *> SPScope::getSucceedingBlocks() const {
-  std::set<const PredicatedBlock *> succblocks;
-  auto outEdges = Priv->getOutEdges();
-  for(auto edge: outEdges)
-  {
-    succblocks.insert(edge.second);
+const std::set<const PredicatedBlock *> &SPScope::getSucceedingBlocks() const {
+  if(!Priv->SucceedingBlocks){
+    std::set<const PredicatedBlock *> succblocks;
+    auto outEdges = Priv->getOutEdges();
+    for(auto edge: outEdges)
+    {
+      succblocks.insert(edge.second);
+    }
+    Priv->SucceedingBlocks = std::move(succblocks);
   }
-  return succblocks;
+  return *Priv->SucceedingBlocks;
 }
 
 void SPScope::walk(SPScopeWalker &walker) {
@@ -758,7 +809,7 @@ static void printUDInfo(raw_ostream& os, const PredicatedBlock *block) {
   os << "  u={";
   for(auto pred: block->getBlockPredicates()) os << pred << ", ";
   os << "}";
-  auto defs = block->getDefinitions();
+  auto &defs = block->getDefinitions();
   if (!defs.empty()) {
     os << " d=";
     for (auto def: defs) {
@@ -796,6 +847,8 @@ bool SPScope::isRootTopLevel() const { return Priv->RootFunc && isTopLevel(); }
 
 bool SPScope::hasLoopBound() const { return Priv->LoopBound >= 0; }
 
+bool SPScope::hasExactLoopBound() const { return Priv->ExactBound; }
+
 unsigned SPScope::getLoopBound() const {
   if( !hasLoopBound() ) {
     report_fatal_error(
@@ -808,25 +861,28 @@ unsigned SPScope::getLoopBound() const {
 
 PredicatedBlock *SPScope::getHeader() const { return Priv->Blocks.front(); }
 
-std::vector<PredicatedBlock*> SPScope::getScopeBlocks() const
+const std::vector<PredicatedBlock*> &SPScope::getScopeBlocks() const
 {
-  return std::vector<PredicatedBlock*>(Priv->Blocks);
+  return Priv->Blocks;
 }
 
-std::vector<PredicatedBlock*> SPScope::getBlocksTopoOrd() const
+const std::vector<PredicatedBlock*> &SPScope::getBlocksTopoOrd() const
 {
-  auto fcfg = Priv->buildfcfg();
-  // dfs the fcfg in postorder
-  std::vector<PredicatedBlock *> PO;
-  for (auto I = po_begin(&fcfg), E = po_end(&fcfg);
-      I != E; ++I) {
-    auto block = const_cast<PredicatedBlock*>((*I)->Block);
-    if (block) {
-      PO.push_back(block);
-    }
-  }
-  std::reverse(PO.begin(), PO.end());
-  return PO;
+  if(!Priv->TopoOrd){
+    auto fcfg = Priv->buildfcfg();
+    // dfs the fcfg in postorder
+    std::vector<PredicatedBlock *> PO;
+    for (auto I = po_begin(&fcfg), E = po_end(&fcfg);
+        I != E; ++I) {
+      auto block = const_cast<PredicatedBlock*>((*I)->Block);
+      if (block) {
+        PO.push_back(block);
+      }
+    }
+    std::reverse(PO.begin(), PO.end());
+    Priv->TopoOrd = std::move(PO);
+  }
+  return *Priv->TopoOrd;
 }
 
 unsigned SPScope::getNumberOfFcfgBlocks() const
@@ -836,12 +892,15 @@ unsigned SPScope::getNumberOfFcfgBlocks() const
       + Priv->Subscopes.size();
 }
 
-std::vector<PredicatedBlock*> SPScope::getFcfgBlocks() const
+const std::vector<PredicatedBlock*> &SPScope::getFcfgBlocks() const
 {
-  auto result = getScopeBlocks();
-  auto subheaders = Priv->getSubheaders();
-  result.insert(result.end(), subheaders.begin(), subheaders.end());
-  return result;
+  if(!Priv->FcfgBlocks){
+    auto result = getScopeBlocks();
+    auto subheaders = Priv->getSubheaders();
+    result.insert(result.end(), subheaders.begin(), subheaders.end());
+    Priv->FcfgBlocks = std::move(result);
+  }
+  return *Priv->FcfgBlocks;
 }
 
 SPScope::child_iterator SPScope::child_begin() const { return Priv->Subscopes.begin(); }
@@ -866,6 +925,58 @@ unsigned SPScope::getDepth() const { return (Priv->Parent == NULL)? 0 : Priv->Pa
 
 unsigned SPScope::getNumPredicates() const { return Priv->PredCount; }
 
+unsigned SPScope::getMaxLivePredicates() const
+{
+  // A predicate is live from its first use or definition to its last use,
+  // like the live ranges of RAInfo. The uses of a block retire their
+  // locations before its definitions take new ones, so a predicate defined
+  // at or after its last use keeps its location to the end of the scope.
+  auto &blocks = getBlocksTopoOrd();
+  unsigned end = blocks.size();
+  std::map<unsigned, std::pair<unsigned, unsigned>> ranges;
+  std::map<unsigned, unsigned> lastDef;
+  auto extend = [&](unsigned pred, unsigned pos){
+    auto found = ranges.find(pred);
+    if (found == ranges.end()) {
+      ranges[pred] = std::make_pair(pos, pos);
+    } else {
+      found->second.second = std::max(found->second.second, pos);
+    }
+  };
+  for (unsigned i = 0; i < end; i++) {
+    for(auto pred: blocks[i]->getBlockPredicates()){
+      extend(pred, i);
+    }
+    for(auto def: blocks[i]->getDefinitions()){
+      if (!ranges.count(def.predicate)) {
+        ranges[def.predicate] = std::make_pair(i, i);
+      }
+      lastDef[def.predicate] = i;
+    }
+  }
+  // the header predicate is used again by the next iteration
+  if (!isTopLevel()) {
+    for(auto pred: getHeader()->getBlockPredicates()){
+      extend(pred, end);
+    }
+  }
+  for (auto &pair: lastDef) {
+    auto &range = ranges[pair.first];
+    if (pair.second >= range.second) {
+      range.second = end;
+    }
+  }
+
+  unsigned maxLive = 0;
+  for (unsigned i = 0; i <= end; i++) {
+    unsigned live = std::count_if(ranges.begin(), ranges.end(), [&](auto &r){
+      return r.second.first <= i && i <= r.second.second;
+    });
+    maxLive = std::max(maxLive, live);
+  }
+  return maxLive;
+}
+
 bool SPScope::hasMultDefEdges(unsigned pred) const
 {
   return Priv->getNumDefs(pred) > 1;
@@ -894,6 +1005,8 @@ SPScope * SPScope::createSPScopeTree(MachineFunction &MF, MachineLoopInfo &LI, c
   }
 
   Root->Priv->assignSuccessors();
+  // Anything computed while the tree was built is missing the edges
+  Root->Priv->invalidate();
 
   LLVM_DEBUG({
       dbgs() << "Initial scope tree:\n";
@@ -917,7 +1030,7 @@ std::set<unsigned> SPScope::getAllPredicates() const
   std::set<unsigned> result;
 
   for(auto block: getFcfgBlocks()){
-    auto preds = block->getBlockPredicates();
+    auto &preds = block->getBlockPredicates();
     result.insert(preds.begin(), preds.end());
   }
 
@@ -930,39 +1043,28 @@ void SPScope::merge(PredicatedBlock* b1, PredicatedBlock* b2){
 
   Priv->replaceUseOfBlockWith(b2, b1);
 
-  // Removes b2 from the scope that it resides in (if called on 'this')
-  // Returns whether b2 was found in the tree and removed.
-  std::function<bool(SPScope*)> recursiveErase = [&](auto scope){
-    auto iter = std::find(scope->Priv->Blocks.begin(), scope->Priv->Blocks.end(), b2);
-    if(iter != scope->Priv->Blocks.end()){
-      scope->Priv->Blocks.erase(iter);
-      return true;
-    }else{
-      for(auto subscope: scope->Priv->Subscopes){
-        if(recursiveErase(subscope)){
-          return true;
-        }
-      }
-      return false;
-    }
-  };
+  // Remove b2 from the scope that it resides in
+  auto scope = Priv->findScopeOf(b2);
+  assert( scope && "Block not in scope tree\n" );
+  auto &blocks = scope->Priv->Blocks;
+  blocks.erase(std::find(blocks.begin(), blocks.end(), b2));
 
-  auto erased = recursiveErase(this);
-  assert( erased && "Block not in scope tree\n" );
+  auto root = Priv->RootImpl;
+  if(root->BlockIndex.lookup(b2->getMBB()) == b2){
+    root->BlockIndex.erase(b2->getMBB());
+  }
+  root->ScopeIndex.erase(b2);
+  root->invalidate();
 }
 
-PredicatedBlock* SPScope::findBlockOf(const MachineBasicBlock* mbb) const {
-  auto inScope = Priv->getPredicated(mbb);
+void SPScope::replaceMbb(PredicatedBlock* block, MachineBasicBlock* newMbb){
+  auto &index = Priv->RootImpl->BlockIndex;
+  index.erase(block->getMBB());
+  block->replaceMbb(newMbb);
+  index[newMbb] = block;
+}
 
-  if(!inScope){
-    for(auto subscope: Priv->Subscopes){
-      auto inSubscope = subscope->findBlockOf(mbb);
-      if(inSubscope){
-        return inSubscope;
-      }
-    }
-    return NULL;
-  }else{
-    return inScope;
-  }
+PredicatedBlock* SPScope::findBlockOf(const MachineBasicBlock* mbb) const {
+  auto block = Priv->RootImpl->BlockIndex.lookup(mbb);
+  return block && Priv->findScopeOf(block) ? block : NULL;
 }
@@ -90,7 +90,8 @@ namespace llvm {
 
       /// Returns all the blocks that succeed the loop represented by this scope.
       /// I.e. all the blocks that control may branch to after exiting the loop.
-      const std::set<const PredicatedBlock *> getSucceedingBlocks() const;
+      /// The result is cached until the tree changes.
+      const std::set<const PredicatedBlock *> &getSucceedingBlocks() const;
 
       /// Returns the nesting depth of the SPScope.
       /// The top-level scope has depth 0.
@@ -123,29 +124,42 @@ namespace llvm {
       /// Causes an error if the scope has no bound
       unsigned getLoopBound() const;
 
+      /// Returns whether the loop always iterates exactly its loop bound and
+      /// leaves through the only exit edge at its only latch, i.e., whether
+      /// the loop counter alone decides when to exit. The exit edge then
+      /// defines no predicate, the header keeps the predicate of the entry.
+      bool hasExactLoopBound() const;
+
       /// Walk this SPScope recursively
       void walk(SPScopeWalker &walker);
 
       /// Returns the number of unique predicates used by the blocks in this scope.
       unsigned getNumPredicates() const;
 
+      /// Returns the maximum number of predicates of this scope that are live
+      /// at the same block, i.e., the number of locations the predicates need
+      /// once those with disjoint live ranges share one.
+      /// Predicates of control equivalent blocks are the same already.
+      unsigned getMaxLivePredicates() const;
+
       /// Returns whether the given predicate is defined by more than one block in this scope.
       bool hasMultDefEdges(unsigned pred) const;
 
       /// Returns the blocks that are in this scope and all the subheaders of the scope.
       /// It is sorted in topological order.
-      std::vector<PredicatedBlock*> getBlocksTopoOrd() const;
+      /// The order is cached until the tree changes.
+      const std::vector<PredicatedBlock*> &getBlocksTopoOrd() const;
 
       /// Returns the number of blocks that are in this scope and
       /// are subheaders of the scope.
       unsigned getNumberOfFcfgBlocks() const;
 
       /// Returns this scope's blocks.
-      std::vector<PredicatedBlock*> getScopeBlocks() const;
+      const std::vector<PredicatedBlock*> &getScopeBlocks() const;
 
       /// Returns the blocks that are this scope or are subheaders of it.
       /// This is not sorted.
-      std::vector<PredicatedBlock*> getFcfgBlocks() const;
+      const std::vector<PredicatedBlock*> &getFcfgBlocks() const;
 
       /// Dump state of this scope and its subscopes recursively
       void dump(raw_ostream& os, unsigned indent, bool recursive) const;
@@ -158,6 +172,8 @@ namespace llvm {
 
       /// Returns the deepest scope, starting from this scope, containing
       /// the given block.
+      /// The lookup goes through an index of the whole tree and takes
+      /// constant time.
       /// If the block is not part of any scope, it causes an error.
       SPScope* findScopeOf(const PredicatedBlock *) const;
 
@@ -175,6 +191,12 @@ namespace llvm {
       /// Merges the second block into the first and removes the it from the list of blocks.
       void merge(PredicatedBlock* b1, PredicatedBlock* b2);
 
+      /// Makes the given block manage the given MBB instead of its current one.
+      /// See 'PredicatedBlock::replaceMbb()'.
+      /// Must be used instead of calling the block directly, such that
+      /// 'findBlockOf()' stays up to date.
+      void replaceMbb(PredicatedBlock* block, MachineBasicBlock* newMbb);
+
     private:
       class Impl;
       /// We use the PIMPL pattern to implement the private
@@ -10,6 +10,7 @@
 #include "PatmosTargetInfo.h"
 #include "TargetInfo/PatmosTargetInfo.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Constants.h"
@@ -30,37 +31,92 @@ void llvm::getMBBIRName(const MachineBasicBlock *MBB,
   bb_ir_label.toVector(result);
 }
 
+/// readLoopBounds - Read the loop bounds of the loop ID of a terminator.
+static std::pair<int,int> readLoopBounds(const Instruction *Term,
+                                         const MachineBasicBlock *MBB) {
+  auto loop_meta = Term->getMetadata("llvm.loop");
+  if (!loop_meta)
+    return std::make_pair(-1, -1);
+
+  // We ignore the first metadata operand, as it is always a self-reference
+  // in "llvm.loop".
+  for(int i = 1, end = loop_meta->getNumOperands(); i < end; i++) {
+    auto meta_op_node = dyn_cast<llvm::MDNode>(loop_meta->getOperand(i).get());
+    if (!meta_op_node || meta_op_node->getNumOperands() != 3)
+      continue;
+    auto name = dyn_cast_or_null<MDString>(meta_op_node->getOperand(0));
+    if( name && name->getString() == "llvm.loop.bound") {
+      auto min_node = mdconst::dyn_extract_or_null<ConstantInt>(
+                        meta_op_node->getOperand(1));
+      auto max_node = mdconst::dyn_extract_or_null<ConstantInt>(
+                        meta_op_node->getOperand(2));
+      if (!min_node || !max_node)
+        report_fatal_error("Invalid loop bounds in MBB: '" + MBB->getName() +
+                           "'!");
+      return std::make_pair(min_node->getZExtValue(),
+                            max_node->getZExtValue());
+    }
+  }
+  return std::make_pair(-1, -1);
+}
+
 std::pair<int,int> llvm::getLoopBounds(const MachineBasicBlock * MBB) {
-  if(MBB && MBB->getBasicBlock()) {
-    if (auto loop_meta = MBB->getBasicBlock()->getTerminator()->getMetadata("llvm.loop")) {
-      // We ignore the first metadata operand, as it is always a self-reference
-      // in "llvm.loop".
-      for(int i = 1, end = loop_meta->getNumOperands(); i < end; i++) {
-        auto meta_op_node = dyn_cast<llvm::MDNode>(loop_meta->getOperand(i).get());
-        if( meta_op_node->getNumOperands() >= 1 ){
-          auto name = cast_or_null<MDString>(meta_op_node->getOperand(0));
-          if( name && name->getString() == "llvm.loop.bound") {
-            auto min_node = cast_or_null<ValueAsMetadata>(meta_op_node->getOperand(1))->getValue();
-            auto max_node = cast_or_null<ValueAsMetadata>(meta_op_node->getOperand(2))->getValue();
-            if(min_node && max_node &&
-               min_node->getType()->isIntegerTy() &&
-               max_node->getType()->isIntegerTy()
-             ) {
-              auto min = ((llvm::ConstantInt*) min_node)->getZExtValue();
-              auto max = ((llvm::ConstantInt*) max_node)->getZExtValue();
+  if (!MBB || !MBB->getBasicBlock())
+    return std::make_pair(-1, -1);
+  const BasicBlock *Header = MBB->getBasicBlock();
 
-              return std::make_pair(min, max);
-            } else {
-              report_fatal_error(
-                        "Invalid loop bounds in MBB: '" +
-                        MBB->getName() + "'!");
-            }
-          }
-        }
+  // The bound is either attached to the terminator of the header, by the
+  // frontend for loops testing their condition first and by the single-path
+  // passes, or is part of the loop ID on the latches, which the loop passes
+  // keep up to date when they rotate, peel or unroll the loop. A copy on
+  // the header may be stale, both are upper bounds, use the tighter one.
+  std::pair<int,int> Bounds = readLoopBounds(Header->getTerminator(), MBB);
+  for (const BasicBlock *Pred : predecessors(Header)) {
+    const Instruction *Term = Pred->getTerminator();
+    if (Pred == Header || !Term)
+      continue;
+    std::pair<int,int> Latch = readLoopBounds(Term, MBB);
+    if (Latch.second < 0)
+      continue;
+    if (Bounds.second < 0) {
+      Bounds = Latch;
+    } else {
+      Bounds.first = std::min(Bounds.first, Latch.first);
+      Bounds.second = std::min(Bounds.second, Latch.second);
+    }
+  }
+  return Bounds;
+}
+
+void llvm::setLoopBounds(const MachineBasicBlock *MBB, unsigned Min,
+                         unsigned Max) {
+  Instruction *Term = const_cast<BasicBlock*>(MBB->getBasicBlock())
+                        ->getTerminator();
+  LLVMContext &Ctx = Term->getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Metadata *BoundOps[] = {
+    MDString::get(Ctx, "llvm.loop.bound"),
+    ValueAsMetadata::get(ConstantInt::get(Int32Ty, Min)),
+    ValueAsMetadata::get(ConstantInt::get(Int32Ty, Max))
+  };
+
+  // Replace the old bound, keep any other loop properties
+  SmallVector<Metadata *, 4> Ops(1);
+  if (MDNode *LoopID = Term->getMetadata("llvm.loop")) {
+    for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; i++) {
+      auto Op = dyn_cast<MDNode>(LoopID->getOperand(i).get());
+      auto Name = (Op && Op->getNumOperands() > 0) ?
+                    dyn_cast<MDString>(Op->getOperand(0)) : NULL;
+      if (!Name || Name->getString() != "llvm.loop.bound") {
+        Ops.push_back(LoopID->getOperand(i).get());
       }
     }
   }
-  return std::make_pair(-1, -1);
+  Ops.push_back(MDNode::get(Ctx, BoundOps));
+  MDNode *NewLoopID = MDNode::get(Ctx, Ops);
+  NewLoopID->replaceOperandWith(0, NewLoopID); // First op points to itself.
+
+  Term->setMetadata("llvm.loop", NewLoopID);
 }
 
 
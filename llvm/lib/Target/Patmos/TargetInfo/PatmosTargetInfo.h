@@ -26,14 +26,19 @@ Target &getThePatmosTarget();
 void getMBBIRName(const MachineBasicBlock *MBB,
                          SmallString<128> &result);
 
-/// Extracts loop bound information from the metadata of the block
-/// terminator, if available.
+/// Extracts loop bound information from the metadata of the terminator of
+/// the loop header, or of the latches branching back to it, if available.
 ///
 /// The first element is the minimum iteration count.
 /// The second element is the maximum iteration count.
 /// If a bound is not available, -1 is returned.
 std::pair<int,int> getLoopBounds(const MachineBasicBlock * MBB);
 
+/// Attach new loop bounds to the metadata of the block terminator, replacing
+/// any previous bounds and keeping other loop properties.
+/// The bounds are read again by getLoopBounds.
+void setLoopBounds(const MachineBasicBlock *MBB, unsigned Min, unsigned Max);
+
 } // namespace llvm
 
 #endif // LLVM_LIB_TARGET_PATMOS_TARGETINFO_PATMOSTARGETINFO_H
@@ -1312,12 +1312,22 @@ static LoopUnrollResult tryToUnrollLoop(
   if (UnrollResult == LoopUnrollResult::Unmodified)
     return LoopUnrollResult::Unmodified;
 
+  // The unrolled loop and its remainder keep the loop bound of the original
+  // loop, which counts the iterations of the original body.
+  if (UnrollResult != LoopUnrollResult::FullyUnrolled)
+    updateLoopBound(L, 0, UP.Count);
+
   if (RemainderLoop) {
     Optional<MDNode *> RemainderLoopID =
         makeFollowupLoopID(OrigLoopID, {LLVMLoopUnrollFollowupAll,
                                         LLVMLoopUnrollFollowupRemainder});
     if (RemainderLoopID.hasValue())
       RemainderLoop->setLoopID(RemainderLoopID.getValue());
+
+    // the remainder executes less than UP.Count iterations
+    unsigned Min, Max;
+    if (UP.Count > 1 && getLoopBound(RemainderLoop, Min, Max))
+      setLoopBound(RemainderLoop, 0, std::min(Max, UP.Count - 2));
   }
 
   if (UnrollResult != LoopUnrollResult::FullyUnrolled) {
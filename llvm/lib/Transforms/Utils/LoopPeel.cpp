@@ -901,6 +901,9 @@ bool llvm::peelLoop(Loop *L, unsigned PeelCount, LoopInfo *LI,
     AlreadyPeeled = *Peeled;
   addStringMetadataToLoop(L, PeeledCountMetaData, AlreadyPeeled + PeelCount);
 
+  // The peeled iterations no longer count towards the loop bound.
+  updateLoopBound(L, PeelCount, 1);
+
   if (Loop *ParentLoop = L->getParentLoop())
     L = ParentLoop;
 
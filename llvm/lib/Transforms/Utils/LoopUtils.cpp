@@ -255,6 +255,76 @@ void llvm::addStringMetadataToLoop(Loop *TheLoop, const char *StringMD,
   TheLoop->setLoopID(NewLoopID);
 }
 
+/// Returns the "llvm.loop.bound" node of the loop ID, if any.
+static MDNode *findLoopBound(MDNode *LoopID) {
+  if (!LoopID)
+    return nullptr;
+  for (unsigned i = 1, ie = LoopID->getNumOperands(); i < ie; ++i) {
+    MDNode *Node = dyn_cast<MDNode>(LoopID->getOperand(i));
+    if (!Node || Node->getNumOperands() != 3)
+      continue;
+    MDString *S = dyn_cast<MDString>(Node->getOperand(0));
+    if (S && S->getString() == "llvm.loop.bound")
+      return Node;
+  }
+  return nullptr;
+}
+
+bool llvm::getLoopBound(const Loop *TheLoop, unsigned &Min, unsigned &Max) {
+  MDNode *Node = findLoopBound(TheLoop->getLoopID());
+  if (!Node)
+    return false;
+  ConstantInt *MinMD =
+      mdconst::extract_or_null<ConstantInt>(Node->getOperand(1));
+  ConstantInt *MaxMD =
+      mdconst::extract_or_null<ConstantInt>(Node->getOperand(2));
+  if (!MinMD || !MaxMD)
+    return false;
+  Min = MinMD->getZExtValue();
+  Max = MaxMD->getZExtValue();
+  return true;
+}
+
+void llvm::setLoopBound(Loop *TheLoop, unsigned Min, unsigned Max) {
+  LLVMContext &Context = TheLoop->getHeader()->getContext();
+  SmallVector<Metadata *, 4> MDs(1);
+  MDNode *LoopID = TheLoop->getLoopID();
+  MDNode *Bound = findLoopBound(LoopID);
+  if (LoopID)
+    for (unsigned i = 1, ie = LoopID->getNumOperands(); i < ie; ++i)
+      if (LoopID->getOperand(i) != Bound)
+        MDs.push_back(LoopID->getOperand(i));
+
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Metadata *Vals[] = {
+      MDString::get(Context, "llvm.loop.bound"),
+      ConstantAsMetadata::get(ConstantInt::get(Int32Ty, Min)),
+      ConstantAsMetadata::get(ConstantInt::get(Int32Ty, Max))};
+  MDs.push_back(MDNode::get(Context, Vals));
+  MDNode *NewLoopID = MDNode::get(Context, MDs);
+  NewLoopID->replaceOperandWith(0, NewLoopID);
+  TheLoop->setLoopID(NewLoopID);
+}
+
+void llvm::updateLoopBound(Loop *TheLoop, unsigned PeelCount,
+                           unsigned UnrollCount) {
+  unsigned Min, Max;
+  if (!getLoopBound(TheLoop, Min, Max) || UnrollCount == 0)
+    return;
+
+  // the peeled iterations are taken off the front, the loop is not entered
+  // at all if there are no more left
+  Min = Min > PeelCount ? Min - PeelCount : 0;
+  Max = Max > PeelCount ? Max - PeelCount : 0;
+
+  // Of the N + 1 executions of the header, ceil((N + 1) / UnrollCount) remain
+  // if all exits are retained, at least floor((N + 1) / UnrollCount) with a
+  // remainder loop.
+  uint64_t MinIters = ((uint64_t)Min + 1) / UnrollCount;
+  uint64_t MaxIters = ((uint64_t)Max + UnrollCount) / UnrollCount;
+  setLoopBound(TheLoop, MinIters ? MinIters - 1 : 0, MaxIters - 1);
+}
+
 Optional<ElementCount>
 llvm::getOptionalElementCountLoopAttribute(const Loop *TheLoop) {
   Optional<int> Width =
@@ -551,7 +551,8 @@ public:
   // Pass identification, replacement for typeid
   static char ID;
 
-  LowerSwitchLegacyPass() : FunctionPass(ID) {
+  LowerSwitchLegacyPass(std::function<bool(const Function &)> Ftor = nullptr)
+      : FunctionPass(ID), PredicateFtor(std::move(Ftor)) {
     initializeLowerSwitchLegacyPassPass(*PassRegistry::getPassRegistry());
   }
 
@@ -560,6 +561,10 @@ public:
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<LazyValueInfoWrapperPass>();
   }
+
+private:
+  /// Only lower the switches of the functions this predicate holds for.
+  std::function<bool(const Function &)> PredicateFtor;
 };
 
 } // end anonymous namespace
@@ -577,11 +582,15 @@ INITIALIZE_PASS_END(LowerSwitchLegacyPass, "lowerswitch",
                     "Lower SwitchInst's to branches", false, false)
 
 // createLowerSwitchPass - Interface to this file...
-FunctionPass *llvm::createLowerSwitchPass() {
-  return new LowerSwitchLegacyPass();
+FunctionPass *
+llvm::createLowerSwitchPass(std::function<bool(const Function &)> Ftor) {
+  return new LowerSwitchLegacyPass(std::move(Ftor));
 }
 
 bool LowerSwitchLegacyPass::runOnFunction(Function &F) {
+  if (PredicateFtor && !PredicateFtor(F))
+    return false;
+
   LazyValueInfo *LVI = &getAnalysis<LazyValueInfoWrapperPass>().getLVI();
   auto *ACT = getAnalysisIfAvailable<AssumptionCacheTracker>();
   AssumptionCache *AC = ACT ? &ACT->getAssumptionCache(F) : nullptr;
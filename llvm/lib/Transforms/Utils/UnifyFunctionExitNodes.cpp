@@ -22,8 +22,9 @@ using namespace llvm;
 
 char UnifyFunctionExitNodesLegacyPass::ID = 0;
 
-UnifyFunctionExitNodesLegacyPass::UnifyFunctionExitNodesLegacyPass()
-    : FunctionPass(ID) {
+UnifyFunctionExitNodesLegacyPass::UnifyFunctionExitNodesLegacyPass(
+    std::function<bool(const Function &)> Ftor)
+    : FunctionPass(ID), PredicateFtor(std::move(Ftor)) {
   initializeUnifyFunctionExitNodesLegacyPassPass(
       *PassRegistry::getPassRegistry());
 }
@@ -31,8 +32,9 @@ UnifyFunctionExitNodesLegacyPass::UnifyFunctionExitNodesLegacyPass()
 INITIALIZE_PASS(UnifyFunctionExitNodesLegacyPass, "mergereturn",
                 "Unify function exit nodes", false, false)
 
-Pass *llvm::createUnifyFunctionExitNodesPass() {
-  return new UnifyFunctionExitNodesLegacyPass();
+Pass *llvm::createUnifyFunctionExitNodesPass(
+    std::function<bool(const Function &)> Ftor) {
+  return new UnifyFunctionExitNodesLegacyPass(std::move(Ftor));
 }
 
 void UnifyFunctionExitNodesLegacyPass::getAnalysisUsage(
@@ -114,6 +116,9 @@ bool unifyReturnBlocks(Function &F) {
 // all returns to unconditional branches to this new basic block. Also, unify
 // all unreachable blocks.
 bool UnifyFunctionExitNodesLegacyPass::runOnFunction(Function &F) {
+  if (PredicateFtor && !PredicateFtor(F))
+    return false;
+
   bool Changed = false;
   Changed |= unifyUnreachableBlocks(F);
   Changed |= unifyReturnBlocks(F);
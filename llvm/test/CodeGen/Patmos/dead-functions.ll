@@ -0,0 +1,54 @@
+; RUN: llc < %s -mpatmos-singlepath=root -mpatmos-eliminate-dead-functions \
+; RUN:   | FileCheck %s --implicit-check-not=unused_
+; RUN: llc < %s -mpatmos-singlepath=root | FileCheck %s --check-prefix=KEEP
+
+; Uncalled local functions are removed, also if only removed functions call
+; them. Externally visible and address-taken functions are kept.
+
+target triple = "patmos-unknown-unknown-elf"
+
+@fptr = global i32 (i32)* @address_taken
+
+; CHECK-DAG: {{^}}root:
+; CHECK-DAG: {{^}}live:
+; CHECK-DAG: {{^}}address_taken:
+; CHECK-DAG: {{^}}extern_uncalled:
+
+; KEEP-DAG: {{^}}unused_a:
+; KEEP-DAG: {{^}}unused_b:
+
+define internal i32 @live(i32 %x) noinline {
+entry:
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define internal i32 @address_taken(i32 %x) noinline {
+entry:
+  %r = mul i32 %x, 3
+  ret i32 %r
+}
+
+define internal i32 @unused_b(i32 %x) noinline {
+entry:
+  %r = sub i32 %x, 5
+  ret i32 %r
+}
+
+define internal i32 @unused_a(i32 %x) noinline {
+entry:
+  %r = call i32 @unused_b(i32 %x)
+  ret i32 %r
+}
+
+define i32 @extern_uncalled(i32 %x) noinline {
+entry:
+  %r = xor i32 %x, 7
+  ret i32 %r
+}
+
+define i32 @root(i32 %x) {
+entry:
+  %r = call i32 @live(i32 %x)
+  ret i32 %r
+}
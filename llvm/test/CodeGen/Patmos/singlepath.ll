@@ -0,0 +1,76 @@
+; RUN: llc < %s -mpatmos-singlepath=root -mpatmos-sp-inline-threshold=0 \
+; RUN:   | FileCheck %s
+; RUN: llc < %s -mattr=+dual-issue -mpatmos-singlepath=root \
+; RUN:   -mpatmos-sp-inline-threshold=0 | FileCheck %s --check-prefix=BUNDLE
+; RUN: llc < %s -mattr=+dual-issue -mpatmos-singlepath=root \
+; RUN:   -mpatmos-sp-inline-threshold=0 -mpatmos-sp-bundling-pairing=positional \
+; RUN:   | FileCheck %s --check-prefix=BUNDLE
+
+; Single-path code has no branches besides the back edges of its loops. The
+; conditional code is predicated, the loops always take their bound. With
+; dual issue, the bundling merges the alternatives of a condition and pairs
+; their instructions.
+
+target triple = "patmos-unknown-unknown-elf"
+
+; The clone called from single-path code is branch-free.
+; CHECK-LABEL: {{^}}helper_sp_:
+; CHECK-NOT: {{[[:space:]]}}br{{(nd)?[[:space:]]}}
+; CHECK: ({{!?}}p{{[1-7]}})
+; CHECK-NOT: {{[[:space:]]}}br{{(nd)?[[:space:]]}}
+; CHECK: ret
+; BUNDLE-LABEL: {{^}}helper_sp_:
+; BUNDLE: {{^[[:space:]]*\{}}
+; BUNDLE: ret
+define i32 @helper(i32 %a, i32 %b) noinline {
+entry:
+  %c = icmp slt i32 %a, %b
+  br i1 %c, label %then, label %else
+
+then:
+  %x = mul i32 %a, %b
+  br label %end
+
+else:
+  %y = sub i32 %a, %b
+  %z = shl i32 %y, 2
+  br label %end
+
+end:
+  %r = phi i32 [ %x, %then ], [ %z, %else ]
+  ret i32 %r
+}
+
+; The root calls the clone, the conditional code of its loop is predicated.
+; CHECK-LABEL: {{^}}root:
+; CHECK: call{{(nd)?}}{{ +}}helper_sp_
+; CHECK: ({{!?}}p{{[1-7]}})
+; CHECK: ret
+define i32 @root(i32 %a, i32 %b, i32 %n) {
+entry:
+  %h = call i32 @helper(i32 %a, i32 %b)
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %s = phi i32 [ %h, %entry ], [ %s.next, %latch ]
+  %odd = and i32 %i, 1
+  %c = icmp eq i32 %odd, 0
+  br i1 %c, label %even, label %latch, !llvm.loop !0
+
+even:
+  %t = add i32 %s, %i
+  br label %latch
+
+latch:
+  %s.next = phi i32 [ %t, %even ], [ %s, %loop ]
+  %i.next = add i32 %i, 1
+  %done = icmp uge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop, !llvm.loop !0
+
+exit:
+  ret i32 %s.next
+}
+
+!0 = distinct !{!0, !1}
+!1 = !{!"llvm.loop.bound", i32 0, i32 15}
@@ -0,0 +1,37 @@
+; RUN: llc < %s -mpatmos-enable-stack-cache-analysis \
+; RUN:   -mpatmos-ilp-solver-external=false | FileCheck %s
+; RUN: llc < %s | FileCheck %s --check-prefix=NOSCA
+
+; The analysis runs on the whole program rooted at _start and solves its
+; ILPs with the built-in solver. The callee of the call in @caller has no
+; stack cache frame, the frame of @caller thus is never spilled and the
+; ensure after the call is removed.
+
+target triple = "patmos-unknown-unknown-elf"
+
+define i32 @leaf(i32 %x) noinline {
+entry:
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+; CHECK-LABEL: {{^}}caller:
+; CHECK: call{{(nd)?}}{{ +}}leaf
+; CHECK-NOT: sens
+; CHECK: ret
+; NOSCA-LABEL: {{^}}caller:
+; NOSCA: call{{(nd)?}}{{ +}}leaf
+; NOSCA: sens
+; NOSCA: ret
+define i32 @caller(i32 %x) noinline {
+entry:
+  %r = call i32 @leaf(i32 %x)
+  %s = mul i32 %r, %x
+  ret i32 %s
+}
+
+define void @_start() noinline {
+entry:
+  %r = call i32 @caller(i32 3)
+  ret void
+}
@@ -0,0 +1,66 @@
+; RUN: llc < %s -mpatmos-enable-tail-calls | FileCheck %s
+; RUN: llc < %s | FileCheck %s --check-prefix=NOTAIL
+
+; Calls in tail position branch to the callee after the epilogue if all
+; arguments are passed in registers. The callee returns to the caller's
+; caller, so there is neither a return nor an ensure after the branch.
+
+target triple = "patmos-unknown-unknown-elf"
+
+declare i32 @callee(i32)
+declare i32 @callee7(i32, i32, i32, i32, i32, i32, i32)
+declare i32 @variadic(i32, ...)
+
+; CHECK-LABEL: {{^}}direct:
+; CHECK-NOT: call
+; CHECK: brcf{{ +}}callee
+; CHECK-NOT: sens
+; CHECK-NOT: ret
+; NOTAIL-LABEL: {{^}}direct:
+; NOTAIL: call{{(nd)?}}{{ +}}callee
+; NOTAIL: ret
+define i32 @direct(i32 %x) {
+entry:
+  %a = add i32 %x, 1
+  %r = tail call i32 @callee(i32 %a)
+  ret i32 %r
+}
+
+; CHECK-LABEL: {{^}}indirect:
+; CHECK-NOT: call
+; CHECK: brcf{{ +}}r{{[0-9]+}}
+; CHECK-NOT: ret
+define i32 @indirect(i32 (i32)* %f, i32 %x) {
+entry:
+  %r = tail call i32 %f(i32 %x)
+  ret i32 %r
+}
+
+; The seventh argument is passed on the shadow stack of the caller.
+; CHECK-LABEL: {{^}}stack_args:
+; CHECK: call{{(nd)?}}{{ +}}callee7
+; CHECK: ret
+define i32 @stack_args(i32 %x) {
+entry:
+  %r = tail call i32 @callee7(i32 %x, i32 1, i32 2, i32 3, i32 4, i32 5,
+                              i32 6)
+  ret i32 %r
+}
+
+; CHECK-LABEL: {{^}}vararg:
+; CHECK: call{{(nd)?}}{{ +}}variadic
+; CHECK: ret
+define i32 @vararg(i32 %x) {
+entry:
+  %r = tail call i32 (i32, ...) @variadic(i32 %x, i32 2)
+  ret i32 %r
+}
+
+; CHECK-LABEL: {{^}}not_tail:
+; CHECK: call{{(nd)?}}{{ +}}callee
+; CHECK: ret
+define i32 @not_tail(i32 %x) {
+entry:
+  %r = call i32 @callee(i32 %x)
+  ret i32 %r
+}
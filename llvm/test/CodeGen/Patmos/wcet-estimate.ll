@@ -0,0 +1,109 @@
+; RUN: llc < %s -mpatmos-wcet-estimate | FileCheck %s
+; RUN: rm -f %t
+; RUN: llc < %s -mpatmos-wcet-report=%t -o /dev/null
+; RUN: FileCheck %s --check-prefix=REPORT < %t
+
+; Functions are estimated bottom-up in the call graph. Loops without a bound,
+; recursion and inline assembly leave the estimate unbounded, as well as
+; calls to functions with an unbounded estimate.
+
+target triple = "patmos-unknown-unknown-elf"
+
+; CHECK-LABEL: {{^}}straight:
+; CHECK: WCET estimate: {{[0-9]+}} cycles
+define i32 @straight(i32 %a, i32 %b) noinline {
+entry:
+  %x = add i32 %a, %b
+  %y = mul i32 %x, %a
+  ret i32 %y
+}
+
+; CHECK-LABEL: {{^}}caller:
+; CHECK: WCET estimate: {{[0-9]+}} cycles
+define i32 @caller(i32 %a) noinline {
+entry:
+  %r = call i32 @straight(i32 %a, i32 3)
+  ret i32 %r
+}
+
+; CHECK-LABEL: {{^}}bounded:
+; CHECK: WCET estimate: {{[0-9]+}} cycles
+define i32 @bounded(i32 %n) noinline {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %s.next = add i32 %s, %i
+  %i.next = add i32 %i, 1
+  %c = icmp ult i32 %i.next, %n
+  br i1 %c, label %loop, label %exit, !llvm.loop !0
+
+exit:
+  ret i32 %s.next
+}
+
+; CHECK-LABEL: {{^}}unbounded:
+; CHECK: WCET estimate: unbounded
+define i32 @unbounded(i32 %n) noinline {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %s.next = add i32 %s, %i
+  %i.next = add i32 %i, 1
+  %c = icmp ult i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
+
+; CHECK-LABEL: {{^}}recursive:
+; CHECK: WCET estimate: unbounded
+define i32 @recursive(i32 %n) noinline {
+entry:
+  %c = icmp eq i32 %n, 0
+  br i1 %c, label %exit, label %rec
+
+rec:
+  %m = sub i32 %n, 1
+  %r = call i32 @recursive(i32 %m)
+  %s = add i32 %r, %n
+  br label %exit
+
+exit:
+  %v = phi i32 [ 0, %entry ], [ %s, %rec ]
+  ret i32 %v
+}
+
+; CHECK-LABEL: {{^}}calls_unbounded:
+; CHECK: WCET estimate: unbounded
+define i32 @calls_unbounded(i32 %n) noinline {
+entry:
+  %r = call i32 @recursive(i32 %n)
+  ret i32 %r
+}
+
+; CHECK-LABEL: {{^}}inline_asm:
+; CHECK: WCET estimate: unbounded
+define void @inline_asm() noinline {
+entry:
+  call void asm sideeffect "nop", ""()
+  ret void
+}
+
+; <module>, <function>, <cycles or -1 if unbounded>, <bytes>
+; REPORT-DAG: "straight", {{[1-9][0-9]*}}, {{[1-9][0-9]*}}
+; REPORT-DAG: "caller", {{[1-9][0-9]*}}, {{[1-9][0-9]*}}
+; REPORT-DAG: "bounded", {{[1-9][0-9]*}}, {{[1-9][0-9]*}}
+; REPORT-DAG: "unbounded", -1, {{[1-9][0-9]*}}
+; REPORT-DAG: "recursive", -1, {{[1-9][0-9]*}}
+; REPORT-DAG: "calls_unbounded", -1, {{[1-9][0-9]*}}
+; REPORT-DAG: "inline_asm", -1, {{[1-9][0-9]*}}
+
+!0 = distinct !{!0, !1}
+!1 = !{!"llvm.loop.bound", i32 0, i32 99}
@@ -909,6 +909,19 @@ static uint64_t dumpARMELFData(uint64_t SectionAddr, uint64_t Index,
   return 1;
 }
 
+/// dumpPatmosFStart - Print the size of the Patmos function Name, which the
+/// .fstart directive emits in front of it.
+static uint64_t dumpPatmosFStart(uint64_t SectionAddr, uint64_t Index,
+                                 ArrayRef<uint8_t> Bytes, StringRef Name,
+                                 raw_ostream &OS) {
+  uint32_t Size = support::endian::read32be(Bytes.data() + Index);
+  OS << format("%8" PRIx64 ":\t", SectionAddr + Index);
+  dumpBytes(Bytes.slice(Index, 4), OS);
+  OS << "\t.word\t" << format_hex(Size, 10) << "\t# .fstart " << Name << ", "
+     << Size << " bytes";
+  return 4;
+}
+
 static void dumpELFData(uint64_t SectionAddr, uint64_t Index, uint64_t End,
                         ArrayRef<uint8_t> Bytes) {
   // print out data up to 8 bytes at a time in hex and ascii
@@ -1428,9 +1441,18 @@ static void disassembleObject(const Target *TheTarget, const ObjectFile *Obj,
           }
         }
 
+        // Patmos emits the size of a function in front of it, print it as
+        // data instead of decoding it as an instruction.
+        bool DumpPatmosFStart = Obj->getArch() == Triple::patmos &&
+                                Index + 4 == End && SI + 1 < SE &&
+                                Symbols[SI + 1].Type == ELF::STT_FUNC;
+
         if (DumpARMELFData) {
           Size = dumpARMELFData(SectionAddr, Index, End, Obj, Bytes,
                                 MappingSymbols, FOS);
+        } else if (DumpPatmosFStart) {
+          Size = dumpPatmosFStart(SectionAddr, Index, Bytes,
+                                  Symbols[SI + 1].Name, FOS);
         } else {
           // When -z or --disassemble-zeroes are given we always dissasemble
           // them. Otherwise we might want to skip zero bytes we see.
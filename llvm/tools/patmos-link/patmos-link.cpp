@@ -0,0 +1,1393 @@
+//===- patmos-link.cpp - Final link of Patmos executables -----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This utility performs the bitcode part of the final link of Patmos
+// executables within a single process and on a single module, i.e., what the
+// Patmos driver otherwise does by a chain of llvm-link, opt and llc jobs:
+//
+//  1. link the program's bitcode files,
+//  2. link the start-up code and internalize the program,
+//  3. link the standard libraries,
+//  4. optimize the whole program,
+//  5. link the compiler runtime, and
+//  6. generate an object file, which is then linked by ld.lld.
+//
+// It may be invoked in the following manner:
+//  patmos-link -O2 -crt crt0.o -lib libc.a -rt librt.a a.bc b.bc -o x.o
+//
+// If several outputs are given, the module is split and code is generated for
+// the partitions in parallel, unless the code generator needs to see the whole
+// program, e.g., for the stack cache analysis.
+//
+// The members of the standard libraries are linked like by an archive linker:
+// only members defining a symbol that the program uses, or that must be kept
+// public, are read and linked. Their symbol tables serve as summaries, so the
+// bodies of unused library functions are never materialized, which bounds
+// the size of the whole-program module by the size of the program's closure.
+// The members of the compiler runtime are linked the same way, keeping those
+// that define a library call the code generator may emit for the program.
+//
+// With -cache-dir=<dir>, the object files of the partitions are cached, keyed
+// by their bitcode and the options of the code generator. Partitions holding
+// only library functions, which are the same for many programs, are then
+// compiled only once. The modules after linking the libraries and after
+// linking the runtime are cached as well, keyed by the contents of all files
+// linked up to then, such that unchanged links skip the linking and the
+// optimization.
+//
+// With -strip-debug, the debug information is dropped after linking the
+// libraries and the runtime, such that neither the optimization nor the code
+// generator carry the debug metadata of, e.g., the standard libraries into a
+// program compiled without debug information.
+//
+// With -keep-public, no symbol is internalized, for the native objects of
+// separately compiled programs that ld.lld links with the output. Together
+// with -link-all-members and without program inputs, the output then holds
+// the start-up code and all of the libraries, which is generated and cached
+// only once.
+//
+// With -split-dwarf-file=<name>, given once per output, the DWARF of the
+// partition is split into .dwo sections named <name>, which are written to the
+// file given by -split-dwarf-output=<file>, or kept in the object file
+// otherwise. Such objects are not cached.
+//
+// With -save-temps=<prefix>, the module is written to <prefix>.<stage>.bc
+// after each stage, such that the result of all stages can be inspected.
+//
+// With -server=<socket>, patmos-link does not link but serves the links
+// requested by patmos-link -connect=<socket> on a local socket, until killed.
+// The server keeps the libraries and the symbols of their members resident,
+// such that a link reads only the members it needs, and runs each link in a
+// forked process, which writes to the standard output and error of the client
+// and whose exit status the client returns. The client links by itself if no
+// server runs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/CodeGen/TargetLowering.h"
+#include "llvm/CodeGen/TargetSubtargetInfo.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/VCSRevision.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+#include <memory>
+#include <utility>
+
+#ifdef LLVM_ON_UNIX
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+using namespace llvm;
+
+static codegen::RegisterCodeGenFlags CGF;
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::ZeroOrMore,
+                                            cl::desc("<input bitcode files>"));
+
+static cl::list<std::string>
+    OutputFilenames("o", cl::OneOrMore, cl::value_desc("filename"),
+                    cl::desc("Output object filename, given once per code "
+                             "generation partition"));
+
+static cl::list<std::string>
+    CRTFiles("crt", cl::ZeroOrMore, cl::value_desc("filename"),
+             cl::desc("Start-up code linked before the program, which is "
+                      "internalized"));
+
+static cl::list<std::string>
+    LibFiles("lib", cl::ZeroOrMore, cl::value_desc("filename"),
+             cl::desc("Library linked with the internalized program"));
+
+static cl::list<std::string>
+    OverrideLibFiles("override-lib", cl::ZeroOrMore,
+                     cl::value_desc("filename"),
+                     cl::desc("Library linked after -lib, which can override "
+                              "previously defined symbols"));
+
+static cl::list<std::string>
+    RTFiles("rt", cl::ZeroOrMore, cl::value_desc("filename"),
+            cl::desc("Runtime library linked after the optimization"));
+
+static cl::opt<char>
+    OptLevel("O", cl::Prefix, cl::ZeroOrMore, cl::init('0'),
+             cl::desc("Optimization level. [-O0, -O1, -O2, -O3, -Os or -Oz] "
+                      "(default = '-O0')"));
+
+static cl::opt<std::string>
+    SaveTemps("save-temps", cl::value_desc("prefix"),
+              cl::desc("Write the module after each stage to "
+                       "<prefix>.<stage>.bc"));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir", cl::value_desc("directory"),
+             cl::desc("Cache the object files of the code generation "
+                      "partitions in the given directory"));
+
+static cl::opt<bool>
+    LinkAllMembers("link-all-members",
+                   cl::desc("Link all members of the -lib and -rt libraries, "
+                            "not only the needed ones"));
+
+static cl::opt<bool>
+    KeepPublic("keep-public",
+               cl::desc("Do not internalize the linked symbols, for the "
+                        "native objects linked with the output"));
+
+static cl::opt<bool>
+    StripDebug("strip-debug",
+               cl::desc("Strip the debug information of the linked module"));
+
+static cl::list<std::string>
+    SplitDwarfFiles("split-dwarf-file", cl::ZeroOrMore,
+                    cl::value_desc("name"),
+                    cl::desc("Split the DWARF into .dwo sections named "
+                             "<name>, given once per output"));
+
+static cl::list<std::string>
+    SplitDwarfOutputs("split-dwarf-output", cl::ZeroOrMore,
+                      cl::value_desc("filename"),
+                      cl::desc("Write the .dwo sections to <filename>, given "
+                               "once per output"));
+
+static cl::opt<std::string>
+    ServerSocket("server", cl::value_desc("socket"),
+                 cl::desc("Serve the links requested by -connect on the "
+                          "given socket, keeping the libraries resident"));
+
+static cl::opt<std::string>
+    ConnectSocket("connect", cl::value_desc("socket"),
+                  cl::desc("Let the server on the given socket link, or "
+                           "link directly if it does not run"));
+
+static cl::opt<bool> Verbose("v",
+                             cl::desc("Print information about actions taken"));
+
+static cl::opt<bool> NoVerify("disable-verify",
+                              cl::desc("Do not run the verifier"), cl::Hidden);
+
+static ExitOnError ExitOnErr;
+
+/// The options of the code generator, in the order given, for the keys of
+/// cached object files.
+static std::string CodeGenOptions;
+
+namespace {
+struct PatmosLinkDiagnosticHandler : public DiagnosticHandler {
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    switch (DI.getSeverity()) {
+    case DS_Error:
+      WithColor::error();
+      break;
+    case DS_Warning:
+      WithColor::warning();
+      break;
+    case DS_Remark:
+    case DS_Note:
+      return false;
+    }
+
+    DiagnosticPrinterRawOStream DP(errs());
+    DI.print(DP);
+    errs() << '\n';
+    return true;
+  }
+};
+
+/// An input of a link stage, either a file or the module of the previous
+/// stage.
+struct LinkInput {
+  std::string Filename;
+  std::unique_ptr<Module> M;
+  unsigned Flags;
+
+  LinkInput(StringRef Filename, unsigned Flags = Linker::Flags::None)
+    : Filename(Filename.str()), Flags(Flags) {}
+  LinkInput(std::unique_ptr<Module> M, unsigned Flags = Linker::Flags::None)
+    : M(std::move(M)), Flags(Flags) {}
+};
+} // anonymous namespace
+
+/// Load the bitcode file or the bitcode archive Filename, linking all archive
+/// members into one module.
+static std::unique_ptr<Module> loadFile(StringRef Filename,
+                                        LLVMContext &Context) {
+  std::unique_ptr<MemoryBuffer> Buffer =
+      ExitOnErr(errorOrToExpected(MemoryBuffer::getFileOrSTDIN(Filename)));
+  SMDiagnostic Err;
+
+  if (identify_magic(Buffer->getBuffer()) != file_magic::archive) {
+    if (Verbose)
+      errs() << "Loading '" << Filename << "'\n";
+    std::unique_ptr<Module> M =
+        getLazyIRModule(std::move(Buffer), Err, Context);
+    if (!M)
+      Err.print("patmos-link", errs());
+    return M;
+  }
+
+  if (Verbose)
+    errs() << "Reading library archive file '" << Filename << "'\n";
+  Error E = Error::success();
+  object::Archive Archive(*Buffer, E);
+  ExitOnErr(std::move(E));
+
+  auto Result = std::make_unique<Module>("ArchiveModule", Context);
+  Linker L(*Result);
+  for (const object::Archive::Child &C : Archive.children(E)) {
+    MemoryBufferRef MemBuf = ExitOnErr(C.getMemoryBufferRef());
+    if (identify_magic(MemBuf.getBuffer()) != file_magic::bitcode) {
+      WithColor::error() << "member of archive '" << Filename
+                         << "' is not a bitcode file: '"
+                         << ExitOnErr(C.getName()) << "'\n";
+      return nullptr;
+    }
+
+    std::unique_ptr<Module> M = getLazyIRModule(
+        MemoryBuffer::getMemBuffer(MemBuf, false), Err, Context);
+    if (!M) {
+      Err.print("patmos-link", errs());
+      return nullptr;
+    }
+    if (L.linkInModule(std::move(M)))
+      return nullptr;
+  }
+  ExitOnErr(std::move(E));
+  return Result;
+}
+
+/// Link Inputs into a new module, the same way llvm-link does. If
+/// Internalize is set, the symbols of all but the first input are
+/// internalized unless they are used by the previous inputs.
+static std::unique_ptr<Module> linkStage(LLVMContext &Context, StringRef Stage,
+                                         std::vector<LinkInput> &Inputs,
+                                         bool Internalize) {
+  // the module of the previous stage is linked into without copying it, if
+  // it comes first
+  auto I = Inputs.begin(), E = Inputs.end();
+  std::unique_ptr<Module> Composite;
+  if (I != E && I->M)
+    Composite = std::move((I++)->M);
+  else
+    Composite = std::make_unique<Module>("patmos-link", Context);
+  Linker L(*Composite);
+
+  bool First = I == Inputs.begin();
+  for (; I != E; ++I) {
+    std::unique_ptr<Module> M = I->M ? std::move(I->M)
+                                     : loadFile(I->Filename, Context);
+    if (!M) {
+      WithColor::error() << "loading file '" << I->Filename << "'\n";
+      return nullptr;
+    }
+    ExitOnErr(M->materializeMetadata());
+
+    if (Verbose)
+      errs() << "Linking in '" << M->getModuleIdentifier() << "'\n";
+
+    bool Err;
+    if (Internalize && !First) {
+      Err = L.linkInModule(std::move(M), I->Flags,
+                           [](Module &M, const StringSet<> &GVS) {
+        internalizeModule(M, [&GVS](const GlobalValue &GV) {
+          return !GV.hasName() || (GVS.count(GV.getName()) == 0);
+        });
+      });
+    } else {
+      Err = L.linkInModule(std::move(M), I->Flags);
+    }
+    if (Err)
+      return nullptr;
+
+    First = false;
+  }
+
+  if (!NoVerify && verifyModule(*Composite, &errs())) {
+    WithColor::error() << Stage << ": linked module is broken!\n";
+    return nullptr;
+  }
+  return Composite;
+}
+
+/// Return the file given by -internalize-public-api-file, or an empty string.
+static std::string getPublicAPIFile() {
+  StringMap<cl::Option *> &Opts = cl::getRegisteredOptions();
+  auto File = Opts.find("internalize-public-api-file");
+  if (File == Opts.end())
+    return "";
+  return static_cast<cl::opt<std::string> *>(File->second)->getValue();
+}
+
+/// Collect the symbols that must be kept public, as given to the
+/// internalization by -internalize-public-api-file and
+/// -internalize-public-api-list.
+static void collectPublicSymbols(StringSet<> &Symbols) {
+  StringMap<cl::Option *> &Opts = cl::getRegisteredOptions();
+
+  std::string Filename = getPublicAPIFile();
+  if (!Filename.empty()) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buf =
+        MemoryBuffer::getFile(Filename);
+    if (Buf) {
+      for (line_iterator I(*Buf->get(), true), E; I != E; ++I)
+        Symbols.insert(*I);
+    }
+  }
+
+  auto List = Opts.find("internalize-public-api-list");
+  if (List != Opts.end()) {
+    for (const std::string &Name :
+         *static_cast<cl::list<std::string> *>(List->second))
+      Symbols.insert(Name);
+  }
+}
+
+namespace {
+/// A member of a library, with the symbols it defines, from which it is
+/// decided whether the member is needed without loading it again.
+struct LibraryMember {
+  MemoryBufferRef Buffer;
+
+  /// The names of the non-local symbols the member defines.
+  std::vector<std::string> Defined;
+
+  /// Whether the member has constructors or used globals, i.e., globals with
+  /// appending linkage, which are always kept.
+  bool Appending = false;
+};
+
+/// A library read for linking, kept in Libraries until the file changes.
+struct Library {
+  std::unique_ptr<MemoryBuffer> Buffer;
+  sys::TimePoint<> ModificationTime;
+  uint64_t Size = 0;
+  std::vector<LibraryMember> Members;
+};
+} // anonymous namespace
+
+/// The libraries read so far, by absolute path. With -server, the libraries
+/// read by the server stay resident for all requests.
+static StringMap<Library> Libraries;
+
+/// Return the library Filename, reading it and the symbols of its members
+/// unless it is read already and did not change since, or null on errors.
+static const Library *getLibrary(StringRef Filename) {
+  SmallString<128> Path(Filename);
+  sys::fs::make_absolute(Path);
+
+  sys::fs::file_status Status;
+  bool HasStatus = !sys::fs::status(Path, Status);
+  auto I = Libraries.find(Path);
+  if (I != Libraries.end() && HasStatus &&
+      I->second.ModificationTime == Status.getLastModificationTime() &&
+      I->second.Size == Status.getSize())
+    return &I->second;
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+      MemoryBuffer::getFile(Path);
+  if (!BufferOrErr) {
+    WithColor::error() << "cannot read '" << Filename << "': "
+                       << BufferOrErr.getError().message() << '\n';
+    return nullptr;
+  }
+
+  Library Lib;
+  Lib.Buffer = std::move(*BufferOrErr);
+  if (HasStatus) {
+    Lib.ModificationTime = Status.getLastModificationTime();
+    Lib.Size = Status.getSize();
+  }
+
+  std::vector<MemoryBufferRef> Refs;
+  MemoryBufferRef Buffer = Lib.Buffer->getMemBufferRef();
+  if (identify_magic(Buffer.getBuffer()) == file_magic::archive) {
+    Error E = Error::success();
+    object::Archive Archive(Buffer, E);
+    if (!E) {
+      for (const object::Archive::Child &C : Archive.children(E)) {
+        Expected<MemoryBufferRef> Ref = C.getMemoryBufferRef();
+        if (!Ref) {
+          E = Ref.takeError();
+          break;
+        }
+        Refs.push_back(*Ref);
+      }
+    }
+    if (E) {
+      WithColor::error() << "cannot read archive '" << Filename << "': "
+                         << toString(std::move(E)) << '\n';
+      return nullptr;
+    }
+  } else {
+    Refs.push_back(Buffer);
+  }
+
+  // the symbols are read from lazily loaded modules, in a context that is
+  // dropped afterwards
+  LLVMContext Context;
+  for (MemoryBufferRef Ref : Refs) {
+    Expected<std::unique_ptr<Module>> M = getLazyBitcodeModule(Ref, Context);
+    if (!M) {
+      WithColor::error() << "cannot read '" << Ref.getBufferIdentifier()
+                         << "' of '" << Filename << "': "
+                         << toString(M.takeError()) << '\n';
+      return nullptr;
+    }
+
+    LibraryMember Member;
+    Member.Buffer = Ref;
+    for (const GlobalValue &GV : (*M)->global_values()) {
+      if (GV.hasAppendingLinkage())
+        Member.Appending = true;
+      else if (!GV.isDeclarationForLinker() && !GV.hasLocalLinkage())
+        Member.Defined.push_back(GV.getName().str());
+    }
+    Lib.Members.push_back(std::move(Member));
+  }
+
+  Library &Entry = Libraries[Path];
+  Entry = std::move(Lib);
+  return &Entry;
+}
+
+/// Return true if the library member Src needs to be linked into Dest, i.e.,
+/// if it defines a symbol that Dest uses (or defines, if Src overrides), or a
+/// public symbol that Dest does not define yet.
+static bool isMemberNeeded(const LibraryMember &Src, const Module &Dest,
+                           const StringSet<> &PublicSymbols, bool Override) {
+  // constructors and used globals are always kept
+  if (Src.Appending)
+    return true;
+
+  for (const std::string &Name : Src.Defined) {
+    const GlobalValue *DGV = Dest.getNamedValue(Name);
+    if (!DGV) {
+      if (PublicSymbols.count(Name))
+        return true;
+    } else if (Override || DGV->isDeclarationForLinker() ||
+               DGV->isWeakForLinker()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Collect the names of the library calls the code generator may emit for
+/// the functions of M, which the runtime must provide even though M does not
+/// refer to them yet.
+static void collectLibcallNames(const Module &M, const TargetMachine &TM,
+                                StringSet<> &Symbols) {
+  SmallPtrSet<const TargetLowering *, 2> Visited;
+  for (const Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    const TargetSubtargetInfo *STI = TM.getSubtargetImpl(F);
+    const TargetLowering *TLI = STI ? STI->getTargetLowering() : nullptr;
+    if (!TLI || !Visited.insert(TLI).second)
+      continue;
+
+    for (unsigned LC = 0; LC != RTLIB::UNKNOWN_LIBCALL; ++LC)
+      if (const char *Name = TLI->getLibcallName(RTLIB::Libcall(LC)))
+        Symbols.insert(Name);
+  }
+}
+
+/// Link the needed members of the libraries Libs into M, until no more
+/// members are needed. Members defining one of PublicSymbols are needed even
+/// if M does not use the symbol.
+static bool linkLibraries(Module &M, std::vector<LinkInput> &Libs,
+                          const StringSet<> &PublicSymbols, StringRef Stage) {
+  LLVMContext &Context = M.getContext();
+
+  // decide on the symbols of the members, only the needed members are loaded
+  // into the context of M, their bodies lazily
+  std::vector<std::pair<const LibraryMember *, unsigned>> Members;
+  for (LinkInput &Lib : Libs) {
+    const Library *L = getLibrary(Lib.Filename);
+    if (!L) {
+      WithColor::error() << "loading file '" << Lib.Filename << "'\n";
+      return false;
+    }
+    for (const LibraryMember &Member : L->Members)
+      Members.emplace_back(&Member, Lib.Flags);
+  }
+
+  // linking a member may make others needed, link until a fixpoint. As with
+  // an archive linker, a member needed only after an overriding member was
+  // linked must not define the overridden symbols again.
+  Linker L(M);
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (auto &Member : Members) {
+      if (!Member.first)
+        continue;
+
+      bool Override = Member.second & Linker::Flags::OverrideFromSrc;
+      if (!isMemberNeeded(*Member.first, M, PublicSymbols, Override))
+        continue;
+
+      SMDiagnostic Err;
+      std::unique_ptr<Module> Src = getLazyIRModule(
+          MemoryBuffer::getMemBuffer(Member.first->Buffer, false), Err,
+          Context);
+      if (!Src) {
+        Err.print("patmos-link", errs());
+        return false;
+      }
+      Member.first = nullptr;
+
+      if (Verbose)
+        errs() << "Linking in '" << Src->getModuleIdentifier() << "'\n";
+      ExitOnErr(Src->materializeMetadata());
+      if (L.linkInModule(std::move(Src), Member.second))
+        return false;
+      Changed = true;
+    }
+  }
+
+  if (!NoVerify && verifyModule(M, &errs())) {
+    WithColor::error() << Stage << ": linked module is broken!\n";
+    return false;
+  }
+  return true;
+}
+
+/// Write M to <SaveTemps>.<Stage>.bc if -save-temps is given.
+static void saveTemps(const Module &M, StringRef Stage) {
+  if (SaveTemps.empty())
+    return;
+
+  std::string Filename = SaveTemps + "." + Stage.str() + ".bc";
+  std::error_code EC;
+  ToolOutputFile Out(Filename, EC, sys::fs::OF_None);
+  if (EC) {
+    WithColor::error() << EC.message() << '\n';
+    exit(1);
+  }
+  WriteBitcodeToFile(M, Out.os());
+  Out.keep();
+}
+
+/// Optimize the whole program like `opt -O<n> -internalize -globaldce`.
+static void optimize(Module &M, TargetMachine &TM) {
+  OptimizationLevel Level;
+  switch (OptLevel) {
+  case '1': Level = OptimizationLevel::O1; break;
+  case '2': Level = OptimizationLevel::O2; break;
+  case '3': Level = OptimizationLevel::O3; break;
+  case 's': Level = OptimizationLevel::Os; break;
+  case 'z': Level = OptimizationLevel::Oz; break;
+  default: return;
+  }
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassBuilder PB(&TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // the symbols to keep are given by -internalize-public-api-file
+  ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(Level);
+  if (!KeepPublic)
+    MPM.addPass(InternalizePass());
+  MPM.addPass(GlobalDCEPass());
+  if (!NoVerify)
+    MPM.addPass(VerifierPass());
+
+  if (Verbose)
+    errs() << "Optimizing '" << M.getModuleIdentifier() << "'\n";
+  MPM.run(M, MAM);
+}
+
+/// Create the target machine for the target triple TT, splitting the DWARF
+/// into .dwo sections named SplitDwarfFile, if not empty.
+static std::unique_ptr<TargetMachine>
+createTargetMachine(StringRef TT, StringRef SplitDwarfFile = "") {
+  Triple TheTriple(TT);
+  if (TheTriple.getTriple().empty())
+    TheTriple.setTriple(sys::getDefaultTargetTriple());
+
+  std::string Error;
+  const Target *TheTarget =
+      TargetRegistry::lookupTarget(codegen::getMArch(), TheTriple, Error);
+  if (!TheTarget) {
+    WithColor::error() << Error;
+    exit(1);
+  }
+
+  // llc does not support -Os/-Oz, they use -O2 instead
+  CodeGenOpt::Level OLvl;
+  switch (OptLevel) {
+  case '0': OLvl = CodeGenOpt::None; break;
+  case '1': OLvl = CodeGenOpt::Less; break;
+  case '3': OLvl = CodeGenOpt::Aggressive; break;
+  default: OLvl = CodeGenOpt::Default; break;
+  }
+
+  TargetOptions Options = codegen::InitTargetOptionsFromCodeGenFlags(TheTriple);
+  Options.MCOptions.SplitDwarfFile = SplitDwarfFile.str();
+  std::unique_ptr<TargetMachine> TM(TheTarget->createTargetMachine(
+      TheTriple.getTriple(), codegen::getCPUStr(), codegen::getFeaturesStr(),
+      Options, codegen::getExplicitRelocModel(),
+      codegen::getExplicitCodeModel(), OLvl));
+  assert(TM && "Could not allocate target machine!");
+  return TM;
+}
+
+/// Options of the code generator that need to see all functions of the
+/// program, such that the module must not be split.
+static const char *const WholeProgramOptions[] = {
+  "mpatmos-enable-stack-cache-analysis",
+  "mpatmos-function-order",
+  "mpatmos-serialize",
+  "mpatmos-wcet-estimate",
+  "mpatmos-wcet-report",
+};
+
+/// Return true if an option is given to the code generator that needs to see
+/// the whole program at once.
+static bool requiresWholeProgram() {
+  StringMap<cl::Option *> &Opts = cl::getRegisteredOptions();
+  for (const char *Name : WholeProgramOptions) {
+    auto I = Opts.find(Name);
+    if (I != Opts.end() && I->second->getNumOccurrences())
+      return true;
+  }
+  return false;
+}
+
+/// Generate code for M into OS, and the .dwo sections into DwoOS, if not null.
+static bool generateCode(Module &M, TargetMachine &TM, raw_pwrite_stream &OS,
+                         raw_pwrite_stream *DwoOS = nullptr) {
+  legacy::PassManager PM;
+  TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+  PM.add(new TargetLibraryInfoWrapperPass(TLII));
+  if (TM.addPassesToEmitFile(PM, OS, DwoOS, CGFT_ObjectFile, NoVerify)) {
+    WithColor::error() << "target does not support generation of object "
+                          "files\n";
+    return false;
+  }
+
+  PM.run(M);
+  return true;
+}
+
+/// Collect the options given on the command line that may change the
+/// generated code, i.e., all but inputs, outputs and the options of the
+/// link stages.
+static void collectCodeGenOptions(int argc, char **argv) {
+  static const char *const LinkOptions[] = {
+    "-crt", "-lib", "-override-lib", "-rt", "-save-temps", "-cache-dir",
+    "-internalize-public-api-file", "--internalize-public-api-file", "-v",
+    "-split-dwarf-file", "-split-dwarf-output", "-server", "-connect",
+  };
+
+  for (int i = 1; i < argc; i++) {
+    StringRef Arg(argv[i]);
+    if (Arg == "-o") {
+      i++;
+      continue;
+    }
+    if (!Arg.startswith("-") || Arg.startswith("-o="))
+      continue;
+    if (llvm::is_contained(LinkOptions, Arg.split('=').first))
+      continue;
+
+    CodeGenOptions += Arg.str();
+    CodeGenOptions += '\0';
+  }
+}
+
+/// Return the name of the cached object file for the partition BC.
+static std::string getCachePath(StringRef BC) {
+  SHA1 Hasher;
+  Hasher.update(LLVM_VERSION_STRING);
+#ifdef LLVM_REVISION
+  Hasher.update(LLVM_REVISION);
+#endif
+  Hasher.update(CodeGenOptions);
+  Hasher.update(BC);
+
+  SmallString<128> Path(CacheDir);
+  sys::path::append(Path, "patmos-" + toHex(Hasher.final()) + ".o");
+  return std::string(Path.str());
+}
+
+/// Store the object file Obj in the cache at CachePath. Failures are
+/// ignored, the object is then simply generated again next time.
+static void storeCached(StringRef CachePath, StringRef Obj) {
+  int FD;
+  SmallString<128> TmpPath;
+  if (sys::fs::createUniqueFile(CachePath + ".tmp-%%%%%%", FD, TmpPath))
+    return;
+
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Obj;
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TmpPath);
+      return;
+    }
+  }
+
+  // rename is atomic, concurrent links see either no or a complete file
+  if (sys::fs::rename(TmpPath, CachePath))
+    sys::fs::remove(TmpPath);
+}
+
+/// Return the cache key of the module after Stage, which is computed from the
+/// key of the previous stage and the contents of the files linked by Stage.
+static std::string getStageKey(StringRef Stage, StringRef PrevKey,
+                               ArrayRef<std::string> Files) {
+  SHA1 Hasher;
+  Hasher.update(LLVM_VERSION_STRING);
+#ifdef LLVM_REVISION
+  Hasher.update(LLVM_REVISION);
+#endif
+  Hasher.update(CodeGenOptions);
+  Hasher.update(Stage);
+  Hasher.update(PrevKey);
+  for (const std::string &File : Files) {
+    std::unique_ptr<MemoryBuffer> Buffer =
+        ExitOnErr(errorOrToExpected(MemoryBuffer::getFileOrSTDIN(File)));
+    Hasher.update(Buffer->getBuffer());
+  }
+  return toHex(Hasher.final());
+}
+
+/// Return the name of the cached module with the given stage key.
+static std::string getStagePath(StringRef Key) {
+  SmallString<128> Path(CacheDir);
+  sys::path::append(Path, "patmos-" + Key + ".bc");
+  return std::string(Path.str());
+}
+
+/// Load the module cached for the stage key, or return null.
+static std::unique_ptr<Module> loadStage(LLVMContext &Context,
+                                         StringRef Key) {
+  std::string Path = getStagePath(Key);
+  if (!sys::fs::exists(Path))
+    return nullptr;
+
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(Path, Err, Context);
+  if (M && Verbose)
+    errs() << "Reusing cached module '" << Path << "'\n";
+  return M;
+}
+
+/// Cache M for the stage key.
+static void storeStage(const Module &M, StringRef Key) {
+  SmallString<0> BC;
+  raw_svector_ostream BCOS(BC);
+  WriteBitcodeToFile(M, BCOS);
+  storeCached(getStagePath(Key), BC);
+}
+
+/// Return the name of the .dwo sections of output I, or an empty string if the
+/// DWARF is not split.
+static StringRef getSplitDwarfFile(unsigned I) {
+  return SplitDwarfFiles.empty() ? StringRef() : StringRef(SplitDwarfFiles[I]);
+}
+
+/// Generate code for the partition, given as bitcode BC, into OS, and the
+/// .dwo sections named SplitDwarfFile into DwoOS, using the cache if enabled.
+/// This runs on its own thread and context.
+static void emitPartition(StringRef BC, StringRef TT, raw_pwrite_stream &OS,
+                          StringRef SplitDwarfFile, raw_pwrite_stream *DwoOS) {
+  // the objects refer to their .dwo files by name, they are never cached
+  std::string CachePath;
+  if (!CacheDir.empty() && SplitDwarfFile.empty()) {
+    CachePath = getCachePath(BC);
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Cached =
+        MemoryBuffer::getFile(CachePath);
+    if (Cached) {
+      OS << (*Cached)->getBuffer();
+      return;
+    }
+  }
+
+  LLVMContext Ctx;
+  Expected<std::unique_ptr<Module>> MOrErr =
+      parseBitcodeFile(MemoryBufferRef(BC, "<split-module>"), Ctx);
+  if (!MOrErr)
+    report_fatal_error("Failed to read bitcode of partition");
+
+  SmallString<0> Obj;
+  raw_svector_ostream ObjOS(Obj);
+  std::unique_ptr<TargetMachine> TM = createTargetMachine(TT, SplitDwarfFile);
+  if (!generateCode(**MOrErr, *TM, ObjOS, DwoOS))
+    report_fatal_error("Failed to generate code of partition");
+
+  OS << Obj;
+  if (!CachePath.empty())
+    storeCached(CachePath, Obj);
+}
+
+/// Generate the object files for M, one per output.
+static bool emitObjects(Module &M, TargetMachine &TM) {
+  std::vector<std::unique_ptr<ToolOutputFile>> Outs;
+  SmallVector<raw_pwrite_stream *, 8> OSs;
+  for (const std::string &Filename : OutputFilenames) {
+    std::error_code EC;
+    Outs.push_back(std::make_unique<ToolOutputFile>(Filename, EC,
+                                                    sys::fs::OF_None));
+    if (EC) {
+      WithColor::error() << EC.message() << '\n';
+      return false;
+    }
+    OSs.push_back(&Outs.back()->os());
+  }
+
+  if ((!SplitDwarfFiles.empty() &&
+       SplitDwarfFiles.size() != OutputFilenames.size()) ||
+      (!SplitDwarfOutputs.empty() &&
+       SplitDwarfOutputs.size() != SplitDwarfFiles.size())) {
+    WithColor::error() << "-split-dwarf-file and -split-dwarf-output must be "
+                          "given once per output\n";
+    return false;
+  }
+
+  SmallVector<raw_pwrite_stream *, 8> DwoOSs(OSs.size(), nullptr);
+  for (unsigned i = 0, e = SplitDwarfOutputs.size(); i != e; ++i) {
+    std::error_code EC;
+    Outs.push_back(std::make_unique<ToolOutputFile>(SplitDwarfOutputs[i], EC,
+                                                    sys::fs::OF_None));
+    if (EC) {
+      WithColor::error() << EC.message() << '\n';
+      return false;
+    }
+    DwoOSs[i] = &Outs.back()->os();
+  }
+
+  codegen::setFunctionAttributes(codegen::getCPUStr(),
+                                 codegen::getFeaturesStr(), M);
+
+  bool WholeProgram = requiresWholeProgram();
+  if (OSs.size() > 1 && WholeProgram)
+    WithColor::warning() << "code generation needs the whole program, "
+                            "generating a single partition\n";
+
+  if (OSs.size() == 1 || WholeProgram) {
+    if (Verbose)
+      errs() << "Generating code for '" << M.getModuleIdentifier() << "'\n";
+
+    if (CacheDir.empty()) {
+      if (!generateCode(M, TM, *OSs[0], DwoOSs[0]))
+        return false;
+    } else {
+      SmallString<0> BC;
+      raw_svector_ostream BCOS(BC);
+      WriteBitcodeToFile(M, BCOS);
+      emitPartition(BC, M.getTargetTriple(), *OSs[0], getSplitDwarfFile(0),
+                    DwoOSs[0]);
+    }
+
+    // keep the remaining outputs valid for the linker
+    for (unsigned i = 1, e = OSs.size(); i != e; ++i) {
+      Module Empty("patmos-link-empty", M.getContext());
+      Empty.setTargetTriple(M.getTargetTriple());
+      Empty.setDataLayout(M.getDataLayout());
+      std::unique_ptr<TargetMachine> EmptyTM =
+          createTargetMachine(M.getTargetTriple(), getSplitDwarfFile(i));
+      if (!generateCode(Empty, *EmptyTM, *OSs[i], DwoOSs[i]))
+        return false;
+    }
+  } else {
+    if (Verbose)
+      errs() << "Generating code for '" << M.getModuleIdentifier() << "' in "
+             << OSs.size() << " partitions\n";
+
+    // the partitions are serialized on this thread and parsed again into
+    // separate contexts by the threads, like splitCodeGen does
+    std::string TT = M.getTargetTriple();
+    ThreadPool Pool(hardware_concurrency(OSs.size()));
+    unsigned NumPartitions = 0;
+
+    // the partitions are linked by ld.lld, local symbols may be promoted
+    SplitModule(M, OSs.size(), [&](std::unique_ptr<Module> MPart) {
+      SmallString<0> BC;
+      raw_svector_ostream BCOS(BC);
+      WriteBitcodeToFile(*MPart, BCOS);
+
+      unsigned I = NumPartitions++;
+      raw_pwrite_stream *OS = OSs[I], *DwoOS = DwoOSs[I];
+      StringRef SplitDwarfFile = getSplitDwarfFile(I);
+      Pool.async([TT, OS, DwoOS, SplitDwarfFile](const SmallString<0> &BC) {
+        emitPartition(BC, TT, *OS, SplitDwarfFile, DwoOS);
+      }, std::move(BC));
+    }, /*PreserveLocals=*/false);
+
+    Pool.wait();
+  }
+
+  for (std::unique_ptr<ToolOutputFile> &Out : Outs)
+    Out->keep();
+  return true;
+}
+
+/// Perform the link given by the command line.
+static int linkMain(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "Patmos final link\n");
+  collectCodeGenOptions(argc, argv);
+
+  LLVMContext Context;
+  Context.setDiagnosticHandler(
+      std::make_unique<PatmosLinkDiagnosticHandler>(), true);
+  Context.enableDebugTypeODRUniquing();
+
+  // find the last stage whose result is cached, the program is linked and
+  // optimized again only if its inputs changed
+  std::string Link3Key, Link4Key;
+  std::unique_ptr<Module> M;
+  bool Optimized = false;
+  if (!CacheDir.empty()) {
+    if (std::error_code EC = sys::fs::create_directories(CacheDir)) {
+      WithColor::error() << "cannot create cache directory '" << CacheDir
+                         << "': " << EC.message() << '\n';
+      return 1;
+    }
+
+    std::vector<std::string> Libs(LibFiles.begin(), LibFiles.end());
+    Libs.insert(Libs.end(), OverrideLibFiles.begin(), OverrideLibFiles.end());
+    std::string APIFile = getPublicAPIFile();
+    if (!APIFile.empty())
+      Libs.push_back(APIFile);
+
+    std::string Key = getStageKey("link1", "", InputFilenames);
+    Key = getStageKey("link2", Key, CRTFiles);
+    Link3Key = getStageKey("link3", Key, Libs);
+    Link4Key = getStageKey("link4", Link3Key, RTFiles);
+
+    M = loadStage(Context, Link4Key);
+    Optimized = M != nullptr;
+    if (!M)
+      M = loadStage(Context, Link3Key);
+  }
+
+  std::vector<LinkInput> Inputs;
+  if (!M) {
+    // link the program
+    for (const std::string &File : InputFilenames)
+      Inputs.emplace_back(File);
+    M = linkStage(Context, "link1", Inputs, false);
+    if (!M)
+      return 1;
+    saveTemps(*M, "link1");
+
+    // link the start-up code, hiding the program's symbols to allow
+    // redefinition of symbols of the standard library
+    Inputs.clear();
+    for (const std::string &File : CRTFiles)
+      Inputs.emplace_back(File);
+    Inputs.emplace_back(std::move(M));
+    M = linkStage(Context, "link2", Inputs, !KeepPublic);
+    if (!M)
+      return 1;
+    saveTemps(*M, "link2");
+
+    // link the standard libraries
+    Inputs.clear();
+    if (LinkAllMembers)
+      Inputs.emplace_back(std::move(M));
+    for (const std::string &File : LibFiles)
+      Inputs.emplace_back(File);
+    for (const std::string &File : OverrideLibFiles)
+      Inputs.emplace_back(File, Linker::Flags::OverrideFromSrc);
+    StringSet<> PublicSymbols;
+    collectPublicSymbols(PublicSymbols);
+    if (LinkAllMembers)
+      M = linkStage(Context, "link3", Inputs, false);
+    else if (!linkLibraries(*M, Inputs, PublicSymbols, "link3"))
+      M.reset();
+    if (!M)
+      return 1;
+    if (StripDebug)
+      StripDebugInfo(*M);
+    saveTemps(*M, "link3");
+    if (!CacheDir.empty())
+      storeStage(*M, Link3Key);
+  }
+
+  std::unique_ptr<TargetMachine> TM =
+      createTargetMachine(M->getTargetTriple(), getSplitDwarfFile(0));
+  M->setDataLayout(TM->createDataLayout());
+
+  if (!Optimized) {
+    optimize(*M, *TM);
+    saveTemps(*M, "opt");
+
+    // link the compiler runtime, whose library calls must be available to
+    // the code generator
+    StringSet<> Libcalls;
+    collectLibcallNames(*M, *TM, Libcalls);
+    Inputs.clear();
+    if (LinkAllMembers)
+      Inputs.emplace_back(std::move(M));
+    for (const std::string &File : RTFiles)
+      Inputs.emplace_back(File);
+    if (LinkAllMembers)
+      M = linkStage(Context, "link4", Inputs, false);
+    else if (!linkLibraries(*M, Inputs, Libcalls, "link4"))
+      M.reset();
+    if (!M)
+      return 1;
+    if (StripDebug)
+      StripDebugInfo(*M);
+    saveTemps(*M, "link4");
+    if (!CacheDir.empty())
+      storeStage(*M, Link4Key);
+  }
+
+  return emitObjects(*M, *TM) ? 0 : 1;
+}
+
+#ifdef LLVM_ON_UNIX
+/// Return the value of the option -<Name>=<value> or -<Name> <value> among
+/// the arguments, or an empty string.
+static StringRef getOptionValue(int argc, char **argv, StringRef Name) {
+  for (int i = 1; i < argc; i++) {
+    StringRef Arg(argv[i]);
+    if (!Arg.consume_front("-"))
+      continue;
+    Arg.consume_front("-");
+    if (Arg == Name && i + 1 < argc)
+      return argv[i + 1];
+    if (Arg.consume_front(Name) && Arg.consume_front("="))
+      return Arg;
+  }
+  return "";
+}
+
+/// Fill the address of the socket Path, return false if it is too long.
+static bool getSocketAddress(StringRef Path, sockaddr_un &Addr) {
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (Path.size() >= sizeof(Addr.sun_path)) {
+    WithColor::error() << "socket path '" << Path << "' is too long\n";
+    return false;
+  }
+  memcpy(Addr.sun_path, Path.data(), Path.size());
+  return true;
+}
+
+static bool writeAll(int FD, const void *Data, size_t Size) {
+  const char *P = static_cast<const char *>(Data);
+  while (Size) {
+    ssize_t N = write(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+static bool readAll(int FD, void *Data, size_t Size) {
+  char *P = static_cast<char *>(Data);
+  while (Size) {
+    ssize_t N = read(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+/// Read the libraries of a request into Libraries ahead of the link, such that
+/// they stay resident in the server for later requests. Requests are linked
+/// by forked processes, whose reads are lost.
+static void readLibraries(StringRef CWD, const std::vector<std::string> &Args) {
+  for (size_t i = 1; i < Args.size(); i++) {
+    StringRef Arg(Args[i]);
+    if (!Arg.consume_front("-"))
+      continue;
+    Arg.consume_front("-");
+
+    StringRef Name, Value;
+    std::tie(Name, Value) = Arg.split('=');
+    if (Name != "lib" && Name != "override-lib" && Name != "rt")
+      continue;
+    if (!Arg.contains('=')) {
+      if (i + 1 == Args.size())
+        break;
+      Value = Args[++i];
+    }
+
+    SmallString<128> Path(Value);
+    sys::fs::make_absolute(CWD, Path);
+    getLibrary(Path);
+  }
+}
+
+/// Link the request received on the connection Conn, in a forked process
+/// writing to the standard output and error of the client.
+static void serveRequest(int Sock, int Conn) {
+  // the request is "<size><cwd>\0<arg>\0...", with the standard output and
+  // error of the client passed along with the size
+  uint32_t Size;
+  int FDs[2] = {-1, -1};
+  char Control[CMSG_SPACE(sizeof(FDs))];
+  iovec IOV = {&Size, sizeof(Size)};
+  msghdr Msg = {};
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  if (recvmsg(Conn, &Msg, MSG_WAITALL) != sizeof(Size))
+    return;
+  for (cmsghdr *C = CMSG_FIRSTHDR(&Msg); C; C = CMSG_NXTHDR(&Msg, C))
+    if (C->cmsg_level == SOL_SOCKET && C->cmsg_type == SCM_RIGHTS &&
+        C->cmsg_len == CMSG_LEN(sizeof(FDs)))
+      memcpy(FDs, CMSG_DATA(C), sizeof(FDs));
+
+  std::string Payload(Size, '\0');
+  if (FDs[0] < 0 || FDs[1] < 0 || !readAll(Conn, &Payload[0], Size)) {
+    for (int FD : FDs)
+      if (FD >= 0)
+        close(FD);
+    return;
+  }
+
+  SmallVector<StringRef, 32> Fields;
+  StringRef(Payload).split(Fields, '\0');
+  std::string CWD = Fields.front().str();
+  std::vector<std::string> Args;
+  for (StringRef Field : makeArrayRef(Fields).drop_front())
+    Args.push_back(Field.str());
+  if (!Args.empty() && Args.back().empty())
+    Args.pop_back();
+  if (Args.empty()) {
+    close(FDs[0]);
+    close(FDs[1]);
+    return;
+  }
+
+  readLibraries(CWD, Args);
+
+  // a waiting process reports the exit status of the link to the client,
+  // such that the server accepts the next request right away
+  pid_t Waiter = fork();
+  if (Waiter == 0) {
+    close(Sock);
+    signal(SIGCHLD, SIG_DFL);
+    pid_t Worker = fork();
+    if (Worker == 0) {
+      close(Conn);
+      dup2(FDs[0], STDOUT_FILENO);
+      dup2(FDs[1], STDERR_FILENO);
+      close(FDs[0]);
+      close(FDs[1]);
+      if (chdir(CWD.c_str())) {
+        WithColor::error() << "cannot change to directory '" << CWD << "'\n";
+        _exit(1);
+      }
+
+      std::vector<char *> Argv;
+      for (std::string &Arg : Args)
+        Argv.push_back(&Arg[0]);
+      Argv.push_back(nullptr);
+      int Ret = linkMain(Args.size(), Argv.data());
+      outs().flush();
+      errs().flush();
+      _exit(Ret);
+    }
+
+    int32_t Ret = 1;
+    int Status;
+    if (Worker > 0 && waitpid(Worker, &Status, 0) == Worker) {
+      if (WIFEXITED(Status))
+        Ret = WEXITSTATUS(Status);
+      else if (WIFSIGNALED(Status))
+        Ret = 128 + WTERMSIG(Status);
+    }
+    writeAll(Conn, &Ret, sizeof(Ret));
+    _exit(0);
+  }
+
+  close(FDs[0]);
+  close(FDs[1]);
+}
+
+/// Serve link requests on the socket Path until killed.
+static int runServer(StringRef Path) {
+  sockaddr_un Addr;
+  if (!getSocketAddress(Path, Addr))
+    return 1;
+
+  int Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(Addr.sun_path);
+  if (Sock < 0 || bind(Sock, (sockaddr *)&Addr, sizeof(Addr)) ||
+      listen(Sock, SOMAXCONN)) {
+    WithColor::error() << "cannot listen on '" << Path << "': "
+                       << strerror(errno) << '\n';
+    return 1;
+  }
+
+  // the waiting processes are not waited for
+  signal(SIGCHLD, SIG_IGN);
+
+  while (true) {
+    int Conn = accept(Sock, nullptr, nullptr);
+    if (Conn < 0) {
+      if (errno == EINTR)
+        continue;
+      WithColor::error() << "cannot accept on '" << Path << "': "
+                         << strerror(errno) << '\n';
+      return 1;
+    }
+    serveRequest(Sock, Conn);
+    close(Conn);
+  }
+}
+
+/// Let the server on the socket Path link, return true and the exit status of
+/// the link in Ret if it did.
+static bool runClient(StringRef Path, int argc, char **argv, int &Ret) {
+  sockaddr_un Addr;
+  if (!getSocketAddress(Path, Addr))
+    return false;
+
+  int Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Sock < 0)
+    return false;
+  if (connect(Sock, (sockaddr *)&Addr, sizeof(Addr))) {
+    close(Sock);
+    return false;
+  }
+
+  // send the arguments without -connect, the server links them as given
+  SmallString<256> Payload;
+  if (sys::fs::current_path(Payload)) {
+    close(Sock);
+    return false;
+  }
+  Payload.push_back('\0');
+  for (int i = 0; i < argc; i++) {
+    StringRef Arg(argv[i]);
+    if (Arg == "-connect" || Arg == "--connect") {
+      i++;
+      continue;
+    }
+    if (Arg.startswith("-connect=") || Arg.startswith("--connect="))
+      continue;
+    Payload += Arg;
+    Payload.push_back('\0');
+  }
+
+  uint32_t Size = Payload.size();
+  int FDs[2] = {STDOUT_FILENO, STDERR_FILENO};
+  char Control[CMSG_SPACE(sizeof(FDs))] = {};
+  iovec IOV = {&Size, sizeof(Size)};
+  msghdr Msg = {};
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  cmsghdr *C = CMSG_FIRSTHDR(&Msg);
+  C->cmsg_level = SOL_SOCKET;
+  C->cmsg_type = SCM_RIGHTS;
+  C->cmsg_len = CMSG_LEN(sizeof(FDs));
+  memcpy(CMSG_DATA(C), FDs, sizeof(FDs));
+
+  outs().flush();
+  errs().flush();
+  int32_t Status;
+  bool Sent = sendmsg(Sock, &Msg, 0) == sizeof(Size) &&
+              writeAll(Sock, Payload.data(), Payload.size());
+  if (!Sent || !readAll(Sock, &Status, sizeof(Status))) {
+    close(Sock);
+    // the link may have written its output already, do not link again
+    if (!Sent)
+      return false;
+    WithColor::error() << "server on '" << Path << "' failed\n";
+    Ret = 1;
+    return true;
+  }
+  close(Sock);
+  Ret = Status;
+  return true;
+}
+#endif
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  InitializeAllAsmParsers();
+
+#ifdef LLVM_ON_UNIX
+  // the server and the client do not parse the command line, which the links
+  // of the server parse once per request
+  StringRef Server = getOptionValue(argc, argv, "server");
+  if (!Server.empty())
+    return runServer(Server);
+
+  StringRef Connect = getOptionValue(argc, argv, "connect");
+  int Ret;
+  if (!Connect.empty() && runClient(Connect, argc, argv, Ret))
+    return Ret;
+#endif
+
+  return linkMain(argc, argv);
+}
@@ -0,0 +1,125 @@
+//===- patmos-pml-convert.cpp - Convert between YAML and binary PML -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This utility converts the machine code PML exported by
+// -mpatmos-serialize between its YAML and its binary encoding, see
+// lib/Target/Patmos/PML/PatmosPML.h. The encoding of the input is detected,
+// the output uses the other one unless -to is given:
+//  patmos-pml-convert x.pml -o x.pmlb
+//  patmos-pml-convert x.pmlb -o x.pml
+//
+// With -summary, the functions of a binary document are listed from their
+// records only, without decoding their blocks and instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PML/PatmosPML.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+
+using namespace llvm;
+
+enum PMLFormat { PML_Auto, PML_YAML, PML_Binary };
+
+static cl::opt<std::string>
+    InputFilename(cl::Positional, cl::desc("<input file>"), cl::init("-"));
+
+static cl::opt<std::string>
+    OutputFilename("o", cl::desc("Output filename"), cl::init("-"),
+                   cl::value_desc("filename"));
+
+static cl::opt<PMLFormat> OutputFormat(
+    "to", cl::desc("Encoding of the output"), cl::init(PML_Auto),
+    cl::values(clEnumValN(PML_YAML, "yaml", "YAML, as read by platin"),
+               clEnumValN(PML_Binary, "binary", "Compact binary encoding")));
+
+static cl::opt<bool>
+    Summary("summary",
+            cl::desc("List the functions of a binary document instead of "
+                     "converting it"));
+
+static ExitOnError ExitOnErr;
+
+/// printSummary - List the functions of a binary document from their
+/// records.
+static void printSummary(const pml::BinaryReader &R, raw_ostream &OS) {
+  OS << "triple: " << R.getTriple() << "\n"
+     << "functions: " << R.getNumFunctions() << "\n"
+     << "loop bounds: " << R.getNumLoopBounds() << "\n";
+  for (unsigned i = 0; i < R.getNumFunctions(); i++) {
+    const pml::BinaryFunction *BF = ExitOnErr(R.getFunction(i));
+    OS << "  " << BF->Name << " " << ExitOnErr(R.getString(BF->MapsTo))
+       << ": " << BF->NumBlocks << " blocks, " << BF->NumInstructions
+       << " instructions, " << BF->NumSubfunctions << " subfunctions\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Convert between YAML and binary PML\n");
+
+  std::unique_ptr<MemoryBuffer> Buffer = ExitOnErr(
+      errorOrToExpected(MemoryBuffer::getFileOrSTDIN(InputFilename)));
+  bool IsBinary = pml::BinaryReader::isBinary(Buffer->getBuffer());
+
+  if (Summary && !IsBinary) {
+    WithColor::error() << "-summary requires a binary PML document\n";
+    return 1;
+  }
+
+  PMLFormat Format = OutputFormat;
+  if (Format == PML_Auto)
+    Format = IsBinary ? PML_YAML : PML_Binary;
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC,
+                     Format == PML_Binary && !Summary ? sys::fs::OF_None
+                                                      : sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error() << "cannot open '" << OutputFilename
+                       << "': " << EC.message() << '\n';
+    return 1;
+  }
+
+  pml::Document Doc;
+  if (IsBinary) {
+    pml::BinaryReader R =
+        ExitOnErr(pml::BinaryReader::create(Buffer->getMemBufferRef()));
+    if (Summary) {
+      printSummary(R, Out.os());
+      Out.keep();
+      return 0;
+    }
+    ExitOnErr(R.read(Doc));
+  } else {
+    ExitOnErr(pml::readYAML(Buffer->getBuffer(), Doc));
+  }
+
+  if (Format == PML_Binary) {
+    // the binary writer patches its header, which needs a seekable stream
+    SmallString<0> Result;
+    raw_svector_ostream OS(Result);
+    pml::BinaryWriter W(OS);
+    ExitOnErr(W.write(Doc));
+    Out.os() << Result;
+  } else {
+    pml::YAMLWriter W(Out.os());
+    ExitOnErr(W.write(Doc));
+  }
+
+  Out.keep();
+  return 0;
+}
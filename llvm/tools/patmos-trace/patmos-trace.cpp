@@ -0,0 +1,656 @@
+//===- patmos-trace.cpp - Correlate Patmos simulator traces with code -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This utility maps the program counters of a simulator trace of a Patmos
+// executable to its functions, basic blocks, loops and method cache regions,
+// and reports:
+//
+//  - the hotspots, i.e., the functions and blocks executing most cycles,
+//  - the number of entries and iterations of every loop, and
+//  - the misses of a FIFO method cache, by region and by the function
+//    transferring control to the missing region.
+//
+// It may be invoked in the following manner:
+//  patmos-trace a.out trace.txt -asm a.s -top 30
+//
+// The trace has one line per executed bundle, with its address in hex,
+// optionally followed by the cycle in decimal, e.g., as given by the traces
+// or PC logs of pasim. Lines that do not start with an address, e.g., the
+// messages of the simulator, are skipped. The trace is memory-mapped and
+// scanned once, such that traces of several GB are processed at the speed of
+// reading them. Without cycles, every bundle is counted as one cycle.
+//
+// Functions are taken from the function symbols of the executable, blocks
+// from the symbols of -mpatmos-enable-bb-symbols, if it was given. The code is
+// disassembled to find the loops, i.e., the targets of backward branches, and
+// the method cache regions, i.e., the function symbols and the targets of
+// calls and brcf, together with their .fstart size words. With -asm, the
+// maximum loop bounds are read from the 'Loop bound' comments that the
+// AsmPrinter emits for the blocks of -mpatmos-enable-bb-symbols, and loops
+// exceeding their bound are marked.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <deque>
+
+using namespace llvm;
+using namespace llvm::object;
+
+static cl::opt<std::string> ExecutableFilename(cl::Positional, cl::Required,
+                                               cl::desc("<executable>"));
+
+static cl::opt<std::string> TraceFilename(cl::Positional, cl::init("-"),
+                                          cl::desc("<trace>"));
+
+static cl::opt<std::string>
+    OutputFilename("o", cl::desc("Output filename"), cl::init("-"),
+                   cl::value_desc("filename"));
+
+static cl::opt<std::string>
+    AsmFilename("asm", cl::value_desc("filename"),
+                cl::desc("Read the loop bounds from the assembly of the "
+                         "program, compiled with -mpatmos-enable-bb-symbols"));
+
+static cl::opt<unsigned> Top("top", cl::init(20),
+                             cl::desc("Number of rows of the hotspot tables, "
+                                      "0 for all"));
+
+static cl::opt<unsigned>
+    MethodCacheSize("mcache-size", cl::init(4096),
+                    cl::desc("Size of the simulated method cache in bytes"));
+
+static cl::opt<unsigned>
+    MethodCacheMethods("mcache-methods", cl::init(16),
+                       cl::desc("Maximum number of regions in the simulated "
+                                "method cache"));
+
+static ExitOnError ExitOnErr;
+
+namespace {
+/// The index of no function, block, region or loop.
+static const unsigned NoIndex = ~0u;
+
+/// CodeRange - A function, block or method cache region of the executable,
+/// with its profile.
+struct CodeRange {
+  std::string Name;
+  uint64_t Start, Size;
+  uint64_t Cycles = 0, Bundles = 0;
+  uint64_t Accesses = 0, Misses = 0, MissesCaused = 0;
+
+  CodeRange(StringRef Name, uint64_t Start, uint64_t Size)
+    : Name(Name.str()), Start(Start), Size(Size) {}
+};
+
+/// Loop - A loop, recovered from the backward branches to its header. The
+/// body is assumed to span from the header to the delay slots of the last
+/// backward branch.
+struct Loop {
+  uint64_t Header, End;
+  unsigned Function;
+  int Bound = -1;
+  uint64_t Entries = 0, Iterations = 0;
+  uint64_t MinIterations = ~0ull, MaxIterations = 0, Current = 0;
+
+  Loop(uint64_t Header, uint64_t End, unsigned Function)
+    : Header(Header), End(End), Function(Function) {}
+
+  bool contains(uint64_t PC) const { return PC >= Header && PC < End; }
+
+  /// finishEntry - Record the iterations of the current entry, if any.
+  void finishEntry() {
+    if (!Current)
+      return;
+    MinIterations = std::min(MinIterations, Current);
+    MaxIterations = std::max(MaxIterations, Current);
+    Current = 0;
+  }
+};
+
+/// Location - The function, block, region and loop header of a code word.
+struct Location {
+  unsigned Function = NoIndex, Block = NoIndex;
+  unsigned Region = NoIndex, Loop = NoIndex;
+};
+
+/// Program - The code of the executable, indexed by word address.
+class Program {
+  uint64_t Base = 0;
+  std::vector<Location> Map;
+
+public:
+  std::vector<CodeRange> Functions, Blocks, Regions;
+  std::vector<Loop> Loops;
+
+  /// Load the symbols and disassemble the code of Obj.
+  Error load(const ELFObjectFileBase &Obj);
+
+  /// Attach the bounds of the blocks named in Bounds to the loops.
+  void setLoopBounds(const StringMap<int> &Bounds);
+
+  /// Return the location of PC, or null if PC is not in the code.
+  const Location *lookup(uint64_t PC) const {
+    uint64_t Index = (PC - Base) / 4;
+    return PC >= Base && Index < Map.size() ? &Map[Index] : nullptr;
+  }
+
+private:
+  /// Assign Index to Field of the words of [Start, End).
+  void fill(uint64_t Start, uint64_t End, unsigned Location::*Field,
+            unsigned Index);
+};
+
+/// MethodCache - A FIFO cache of variable-sized method cache regions.
+class MethodCache {
+  std::deque<unsigned> Entries;
+  std::vector<bool> Cached;
+  uint64_t Used = 0;
+
+public:
+  explicit MethodCache(unsigned NumRegions) : Cached(NumRegions) {}
+
+  /// access - Fetch the region, return true on a miss.
+  bool access(unsigned Region, const std::vector<CodeRange> &Regions);
+};
+} // anonymous namespace
+
+void Program::fill(uint64_t Start, uint64_t End, unsigned Location::*Field,
+                   unsigned Index) {
+  Start = std::max(Start, Base);
+  End = std::min(End, Base + Map.size() * 4);
+  for (uint64_t PC = Start; PC < End; PC += 4)
+    Map[(PC - Base) / 4].*Field = Index;
+}
+
+/// Return true if the code generator's opcode name, without the suffixes of
+/// the non-delayed and the unconditional variants, is Name.
+static bool isOpcode(StringRef Opcode, StringRef Name) {
+  Opcode.consume_back("u");
+  Opcode.consume_back("ND");
+  return Opcode == Name;
+}
+
+Error Program::load(const ELFObjectFileBase &Obj) {
+  std::string Error;
+  Triple TheTriple("patmos-unknown-unknown-elf");
+  const Target *T = TargetRegistry::lookupTarget("", TheTriple, Error);
+  if (!T)
+    return createStringError(inconvertibleErrorCode(), Error);
+
+  MCTargetOptions MCOptions;
+  std::unique_ptr<MCRegisterInfo> MRI(T->createMCRegInfo(TheTriple.str()));
+  std::unique_ptr<MCAsmInfo> MAI(
+      T->createMCAsmInfo(*MRI, TheTriple.str(), MCOptions));
+  std::unique_ptr<MCSubtargetInfo> STI(
+      T->createMCSubtargetInfo(TheTriple.str(), "", ""));
+  std::unique_ptr<MCInstrInfo> MII(T->createMCInstrInfo());
+  MCContext Ctx(TheTriple, MAI.get(), MRI.get(), STI.get());
+  std::unique_ptr<MCDisassembler> DisAsm(T->createMCDisassembler(*STI, Ctx));
+  if (!DisAsm)
+    return createStringError(inconvertibleErrorCode(),
+                             "no disassembler for Patmos");
+
+  // the map spans all code sections
+  struct CodeSection {
+    uint64_t Address;
+    ArrayRef<uint8_t> Bytes;
+  };
+  std::vector<CodeSection> Sections;
+  uint64_t Lo = ~0ull, Hi = 0;
+  for (const SectionRef &S : Obj.sections()) {
+    if (!S.isText() || !S.getSize())
+      continue;
+    StringRef Contents = ExitOnErr(S.getContents());
+    Sections.push_back({S.getAddress(), arrayRefFromStringRef(Contents)});
+    Lo = std::min(Lo, S.getAddress());
+    Hi = std::max(Hi, S.getAddress() + S.getSize());
+  }
+  if (Sections.empty())
+    return createStringError(inconvertibleErrorCode(), "no code sections");
+  Base = Lo & ~3ull;
+  Map.resize((Hi - Base + 3) / 4);
+
+  auto readWord = [&](uint64_t Address, uint32_t &Word) {
+    for (const CodeSection &S : Sections)
+      if (Address >= S.Address && Address + 4 <= S.Address + S.Bytes.size()) {
+        Word = support::endian::read32be(&S.Bytes[Address - S.Address]);
+        return true;
+      }
+    return false;
+  };
+
+  // functions are all named function symbols, blocks the symbols of
+  // -mpatmos-enable-bb-symbols, which are named #function#block#number
+  std::vector<uint64_t> RegionStarts, SymbolStarts;
+  for (const ELFSymbolRef &Sym : Obj.symbols()) {
+    StringRef Name = ExitOnErr(Sym.getName());
+    uint64_t Address = ExitOnErr(Sym.getAddress());
+    if (Name.empty() || Address < Lo || Address >= Hi)
+      continue;
+    if (Name.startswith("#")) {
+      Blocks.emplace_back(Name, Address, Sym.getSize());
+    } else if (ExitOnErr(Sym.getType()) == SymbolRef::ST_Function) {
+      RegionStarts.push_back(Address);
+      if (!Name.startswith(".L"))
+        Functions.emplace_back(Name, Address, Sym.getSize());
+    }
+    SymbolStarts.push_back(Address);
+  }
+  llvm::sort(SymbolStarts);
+
+  // functions are filled outermost first, blocks are never nested
+  llvm::sort(Functions, [](const CodeRange &A, const CodeRange &B) {
+    return A.Start < B.Start || (A.Start == B.Start && A.Size > B.Size);
+  });
+  for (unsigned i = 0, e = Functions.size(); i != e; ++i)
+    fill(Functions[i].Start, Functions[i].Start + Functions[i].Size,
+         &Location::Function, i);
+  for (unsigned i = 0, e = Blocks.size(); i != e; ++i)
+    fill(Blocks[i].Start, Blocks[i].Start + Blocks[i].Size, &Location::Block,
+         i);
+
+  // decode the code, restarting at every symbol in case data was decoded
+  // as a long instruction
+  DenseMap<uint64_t, uint64_t> LoopEnds;
+  for (const CodeSection &S : Sections) {
+    uint64_t Size;
+    for (uint64_t Offset = 0; Offset + 4 <= S.Bytes.size(); Offset += Size) {
+      uint64_t PC = S.Address + Offset;
+      MCInst Inst;
+      if (DisAsm->getInstruction(Inst, Size, S.Bytes.slice(Offset), PC,
+                                 nulls()) != MCDisassembler::Success) {
+        Size = 4;
+        continue;
+      }
+      auto Next = std::upper_bound(SymbolStarts.begin(), SymbolStarts.end(),
+                                   PC);
+      if (Next != SymbolStarts.end() && *Next < PC + Size)
+        Size = *Next - PC;
+
+      if (!Inst.getNumOperands() || !Inst.getOperand(Inst.getNumOperands() -
+                                                     1).isImm())
+        continue;
+      int64_t Imm = Inst.getOperand(Inst.getNumOperands() - 1).getImm();
+      StringRef Opcode = MII->getName(Inst.getOpcode());
+
+      // the targets are word addresses, relative to the branch for br
+      if (isOpcode(Opcode, "BR")) {
+        uint64_t Target = PC + Imm * 4;
+        if (Target <= PC) {
+          // the body includes the delay slots of the branch, up to two
+          // bundles of at most 8 bytes
+          uint64_t &End = LoopEnds[Target];
+          End = std::max(End, PC + Size + 16);
+        }
+      } else if (isOpcode(Opcode, "BRCF") || isOpcode(Opcode, "TCBRCF") ||
+                 isOpcode(Opcode, "CALL")) {
+        RegionStarts.push_back(Imm * 4);
+      }
+    }
+  }
+
+  // the regions start with the .fstart size word before their first
+  // instruction, later regions end earlier ones
+  llvm::sort(RegionStarts);
+  RegionStarts.erase(std::unique(RegionStarts.begin(), RegionStarts.end()),
+                     RegionStarts.end());
+  for (unsigned i = 0, e = RegionStarts.size(); i != e; ++i) {
+    uint64_t Start = RegionStarts[i];
+    uint32_t Size;
+    if (!readWord(Start - 4, Size) || !Size || Start + Size > Hi)
+      continue;
+
+    const Location *L = lookup(Start);
+    std::string Name = L && L->Function != NoIndex
+                           ? Functions[L->Function].Name
+                           : "<unknown>";
+    if (L && L->Function != NoIndex && Functions[L->Function].Start != Start)
+      Name += "+0x" + utohexstr(Start - Functions[L->Function].Start, true);
+
+    uint64_t End = Start + Size;
+    if (i + 1 != e)
+      End = std::min(End, RegionStarts[i + 1]);
+    fill(Start, End, &Location::Region, Regions.size());
+    Regions.emplace_back(Name, Start, Size);
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> Headers(LoopEnds.begin(),
+                                                     LoopEnds.end());
+  llvm::sort(Headers);
+  for (const auto &H : Headers) {
+    const Location *L = lookup(H.first);
+    if (!L || L->Function == NoIndex)
+      continue;
+    fill(H.first, H.first + 4, &Location::Loop, Loops.size());
+    Loops.emplace_back(H.first, H.second, L->Function);
+  }
+  return Error::success();
+}
+
+void Program::setLoopBounds(const StringMap<int> &Bounds) {
+  for (Loop &L : Loops) {
+    const Location *Loc = lookup(L.Header);
+    if (Loc->Block != NoIndex && Blocks[Loc->Block].Start == L.Header)
+      L.Bound = Bounds.lookup(Blocks[Loc->Block].Name);
+  }
+}
+
+bool MethodCache::access(unsigned Region,
+                         const std::vector<CodeRange> &Regions) {
+  if (Cached[Region])
+    return false;
+
+  uint64_t Size = Regions[Region].Size;
+  while (!Entries.empty() &&
+         (Used + Size > MethodCacheSize ||
+          Entries.size() >= MethodCacheMethods)) {
+    Cached[Entries.front()] = false;
+    Used -= Regions[Entries.front()].Size;
+    Entries.pop_front();
+  }
+  Entries.push_back(Region);
+  Cached[Region] = true;
+  Used += Size;
+  return true;
+}
+
+/// Read the maximum loop bounds of the blocks from the 'Loop bound: [min, max]'
+/// comments following their symbols in the assembly file Filename.
+static StringMap<int> readLoopBounds(StringRef Filename) {
+  std::unique_ptr<MemoryBuffer> Buffer =
+      ExitOnErr(errorOrToExpected(MemoryBuffer::getFile(Filename)));
+
+  StringMap<int> Bounds;
+  StringRef Block;
+  for (line_iterator I(*Buffer); !I.is_at_end(); ++I) {
+    StringRef Line = I->trim();
+    if (Line.startswith("\"#") && Line.endswith("\":")) {
+      Block = Line.drop_front().drop_back(2);
+    } else if (Line.startswith("#")) {
+      StringRef Bound = Line;
+      int Max;
+      if (Block.empty() || !Bound.consume_front("#") ||
+          !(Bound = Bound.ltrim()).consume_front("Loop bound: ["))
+        continue;
+      Bound = Bound.split(',').second.split(']').first.trim();
+      if (!Bound.getAsInteger(10, Max))
+        Bounds[Block] = Max;
+    } else if (!Line.empty() && !Line.startswith(".") &&
+               !Line.endswith(":")) {
+      // the comment follows the symbol before the first instruction
+      Block = StringRef();
+    }
+  }
+  return Bounds;
+}
+
+/// Parse the address and the cycle of a trace line starting at P, return
+/// false if the line has no address. P is advanced to the next line.
+static bool parseTraceLine(const char *&P, const char *End, uint64_t &PC,
+                           uint64_t &Cycle, bool &HasCycle) {
+  while (P != End && (*P == ' ' || *P == '\t'))
+    ++P;
+  if (End - P > 2 && P[0] == '0' && (P[1] == 'x' || P[1] == 'X'))
+    P += 2;
+
+  const char *Start = P;
+  PC = 0;
+  unsigned Digit;
+  while (P != End && (Digit = hexDigitValue(*P)) != -1U) {
+    PC = PC << 4 | Digit;
+    ++P;
+  }
+  bool Valid = P != Start && (P == End || *P == ' ' || *P == '\t' ||
+                              *P == '\n' || *P == '\r');
+
+  HasCycle = false;
+  if (Valid) {
+    while (P != End && (*P == ' ' || *P == '\t'))
+      ++P;
+    Cycle = 0;
+    Start = P;
+    while (P != End && *P >= '0' && *P <= '9')
+      Cycle = Cycle * 10 + (*P++ - '0');
+    HasCycle = P != Start;
+  }
+
+  P = static_cast<const char *>(memchr(P, '\n', End - P));
+  P = P ? P + 1 : End;
+  return Valid;
+}
+
+/// Print the Top ranges of Ranges with the most cycles.
+static void printHotspots(raw_ostream &OS, StringRef Title,
+                          const std::vector<CodeRange> &Ranges,
+                          uint64_t TotalCycles) {
+  std::vector<const CodeRange *> Sorted;
+  for (const CodeRange &R : Ranges)
+    if (R.Bundles)
+      Sorted.push_back(&R);
+  if (Sorted.empty())
+    return;
+  llvm::stable_sort(Sorted, [](const CodeRange *A, const CodeRange *B) {
+    return A->Cycles > B->Cycles;
+  });
+  if (Top && Sorted.size() > Top)
+    Sorted.resize(Top);
+
+  OS << "\n" << Title << "\n"
+     << "        cycles       %        bundles  name\n";
+  for (const CodeRange *R : Sorted)
+    OS << format("%14" PRIu64 " %6.2f%% %14" PRIu64 "  %s\n", R->Cycles,
+                 TotalCycles ? 100.0 * R->Cycles / TotalCycles : 0.0,
+                 R->Bundles, R->Name.c_str());
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+  InitializeAllTargetInfos();
+  InitializeAllTargetMCs();
+  InitializeAllDisassemblers();
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Correlate Patmos simulator traces with code\n");
+
+  OwningBinary<Binary> Bin = ExitOnErr(createBinary(ExecutableFilename));
+  auto *Obj = dyn_cast<ELFObjectFileBase>(Bin.getBinary());
+  if (!Obj || Obj->getArch() != Triple::patmos) {
+    WithColor::error() << "'" << ExecutableFilename
+                       << "' is not a Patmos executable\n";
+    return 1;
+  }
+
+  Program P;
+  ExitOnErr(P.load(*Obj));
+  if (!AsmFilename.empty())
+    P.setLoopBounds(readLoopBounds(AsmFilename));
+
+  // the trace is mapped, not read, unless it is given on stdin
+  std::unique_ptr<MemoryBuffer> Trace = ExitOnErr(errorOrToExpected(
+      MemoryBuffer::getFileOrSTDIN(TraceFilename, /*IsText=*/false,
+                                   /*RequiresNullTerminator=*/false)));
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error() << "cannot open '" << OutputFilename
+                       << "': " << EC.message() << '\n';
+    return 1;
+  }
+
+  MethodCache MC(P.Regions.size());
+  uint64_t TotalCycles = 0, Bundles = 0, Unknown = 0, Accesses = 0;
+  uint64_t PrevPC = 0, PrevCycle = 0;
+  const Location *Prev = nullptr;
+  bool HasPrev = false;
+
+  // the cycles of a bundle are only known once the next one is issued
+  auto account = [&](const Location *L, uint64_t Cycles) {
+    TotalCycles += Cycles;
+    if (!L || L->Function == NoIndex) {
+      Unknown += Cycles;
+      return;
+    }
+    P.Functions[L->Function].Cycles += Cycles;
+    if (L->Block != NoIndex)
+      P.Blocks[L->Block].Cycles += Cycles;
+  };
+
+  const char *Cur = Trace->getBufferStart(), *End = Trace->getBufferEnd();
+  while (Cur != End) {
+    uint64_t PC, Cycle;
+    bool HasCycle;
+    if (!parseTraceLine(Cur, End, PC, Cycle, HasCycle))
+      continue;
+
+    const Location *L = P.lookup(PC);
+    if (HasPrev)
+      account(Prev, HasCycle && Cycle > PrevCycle ? Cycle - PrevCycle : 1);
+    Bundles++;
+
+    if (L) {
+      if (L->Function != NoIndex)
+        P.Functions[L->Function].Bundles++;
+      if (L->Block != NoIndex)
+        P.Blocks[L->Block].Bundles++;
+
+      if (L->Loop != NoIndex) {
+        Loop &Lp = P.Loops[L->Loop];
+        if (!HasPrev || !Lp.contains(PrevPC)) {
+          Lp.finishEntry();
+          Lp.Entries++;
+        }
+        Lp.Current++;
+        Lp.Iterations++;
+      }
+
+      // a region is fetched whenever control enters it from another one
+      if (L->Region != NoIndex && (!Prev || Prev->Region != L->Region)) {
+        CodeRange &R = P.Regions[L->Region];
+        R.Accesses++;
+        Accesses++;
+        if (MC.access(L->Region, P.Regions)) {
+          R.Misses++;
+          if (Prev && Prev->Function != NoIndex)
+            P.Functions[Prev->Function].MissesCaused++;
+        }
+      }
+    }
+
+    Prev = L;
+    PrevPC = PC;
+    PrevCycle = HasCycle ? Cycle : PrevCycle + 1;
+    HasPrev = true;
+  }
+  if (HasPrev)
+    account(Prev, 1);
+  for (Loop &L : P.Loops)
+    L.finishEntry();
+
+  raw_ostream &OS = Out.os();
+  OS << "trace: " << Bundles << " bundles, " << TotalCycles << " cycles, "
+     << Unknown << " cycles outside of functions\n";
+
+  printHotspots(OS, "Functions", P.Functions, TotalCycles);
+  printHotspots(OS, "Blocks", P.Blocks, TotalCycles);
+
+  bool HasLoops = llvm::any_of(P.Loops, [](const Loop &L) {
+    return L.Entries;
+  });
+  if (HasLoops) {
+    OS << "\nLoops\n"
+       << "   entries   iterations      min        avg      max    bound  "
+          "header\n";
+    for (const Loop &L : P.Loops) {
+      if (!L.Entries)
+        continue;
+      const CodeRange &F = P.Functions[L.Function];
+      std::string Header = F.Name + "+0x" + utohexstr(L.Header - F.Start,
+                                                      true);
+      std::string Bound = L.Bound < 0 ? "-" : std::to_string(L.Bound);
+      OS << format("%10" PRIu64 " %12" PRIu64 " %8" PRIu64 " %10.1f %8" PRIu64
+                   " %8s  %s%s\n", L.Entries, L.Iterations, L.MinIterations,
+                   (double)L.Iterations / L.Entries, L.MaxIterations,
+                   Bound.c_str(), Header.c_str(),
+                   L.Bound >= 0 && L.MaxIterations > (uint64_t)L.Bound ?
+                     "  (exceeds bound)" : "");
+    }
+  }
+
+  if (Accesses) {
+    uint64_t Misses = 0, Bytes = 0;
+    std::vector<const CodeRange *> Missing;
+    for (const CodeRange &R : P.Regions) {
+      Misses += R.Misses;
+      Bytes += R.Misses * R.Size;
+      if (R.Misses)
+        Missing.push_back(&R);
+    }
+    llvm::stable_sort(Missing, [](const CodeRange *A, const CodeRange *B) {
+      return A->Misses * A->Size > B->Misses * B->Size;
+    });
+    if (Top && Missing.size() > Top)
+      Missing.resize(Top);
+
+    OS << "\nMethod cache (" << MethodCacheSize << " bytes, "
+       << MethodCacheMethods << " regions): " << Accesses << " accesses, "
+       << Misses << " misses, " << Bytes << " bytes fetched\n"
+       << "    misses        bytes   accesses     size  region\n";
+    for (const CodeRange *R : Missing)
+      OS << format("%10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %8" PRIu64
+                   "  %s\n", R->Misses, R->Misses * R->Size, R->Accesses,
+                   R->Size, R->Name.c_str());
+
+    std::vector<const CodeRange *> Causing;
+    for (const CodeRange &F : P.Functions)
+      if (F.MissesCaused)
+        Causing.push_back(&F);
+    llvm::stable_sort(Causing, [](const CodeRange *A, const CodeRange *B) {
+      return A->MissesCaused > B->MissesCaused;
+    });
+    if (Top && Causing.size() > Top)
+      Causing.resize(Top);
+
+    OS << "\nMethod cache misses by the function transferring control\n"
+       << "    misses  function\n";
+    for (const CodeRange *F : Causing)
+      OS << format("%10" PRIu64 "  %s\n", F->MissesCaused, F->Name.c_str());
+  }
+
+  Out.keep();
+  return 0;
+}
@@ -0,0 +1,197 @@
+//===- PatmosILPSolverTest.cpp - Tests of the built-in ILP solver ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+#include "PatmosILPSolver.h"
+
+using namespace llvm;
+
+namespace {
+
+/// A solver that counts how often it is asked and returns a fixed value.
+class CountingSolver : public PatmosILPSolver {
+public:
+  unsigned &Calls;
+
+  CountingSolver(unsigned &calls) : Calls(calls) {}
+
+  bool solve(StringRef LP, double &Objective) override {
+    Calls++;
+    Objective = 42;
+    return true;
+  }
+};
+
+/// Solve the LP with the built-in solver, return false if it fails.
+bool solve(StringRef LP, double &Objective) {
+  return createPatmosBuiltinILPSolver()->solve(LP, Objective);
+}
+
+TEST(PatmosILPSolverTest, IntegralRelaxation) {
+  // the optimal vertex (3, 1) of the relaxation is integral
+  double Objective;
+  ASSERT_TRUE(solve("Maximize\n"
+                    " 3 x + 2 y\n"
+                    "Subject To\n"
+                    "c1: x + y <= 4\n"
+                    "c2: x + 3 y <= 6\n"
+                    "c3: x <= 3\n"
+                    "Generals\n"
+                    "x\n"
+                    "y\n"
+                    "End\n", Objective));
+  EXPECT_DOUBLE_EQ(11, Objective);
+}
+
+TEST(PatmosILPSolverTest, FractionalRelaxation) {
+  // the relaxation has its optimum 2.8 at (1.8, 2.8)
+  double Objective;
+  ASSERT_TRUE(solve("Maximize\n"
+                    " y\n"
+                    "Subject To\n"
+                    "c1: - x + y <= 1\n"
+                    "c2: 3 x + 2 y <= 12\n"
+                    "c3: 2 x + 3 y <= 12\n"
+                    "Generals\n"
+                    "x\n"
+                    "y\n"
+                    "End\n", Objective));
+  EXPECT_DOUBLE_EQ(2, Objective);
+}
+
+TEST(PatmosILPSolverTest, BinaryKnapsack) {
+  // the relaxation takes two thirds of b, the optimum takes a and b
+  double Objective;
+  ASSERT_TRUE(solve("Maximize\n"
+                    " 10 a + 13 b + 7 c + 8 d\n"
+                    "Subject To\n"
+                    "weight: 4 a + 6 b + 3 c + 5 d <= 11\n"
+                    "Binaries\n"
+                    "a\n"
+                    "b\n"
+                    "c\n"
+                    "d\n"
+                    "End\n", Objective));
+  EXPECT_DOUBLE_EQ(23, Objective);
+}
+
+TEST(PatmosILPSolverTest, MinimizeWithEqualityAndFreeVariable) {
+  double Objective;
+  ASSERT_TRUE(solve("Minimize\n"
+                    " x - y\n"
+                    "Subject To\n"
+                    "sum: x + y = 10\n"
+                    "diff: x - y >= -4\n"
+                    "Bounds\n"
+                    "x free\n"
+                    "y <= 20\n"
+                    "Generals\n"
+                    "x\n"
+                    "y\n"
+                    "End\n", Objective));
+  EXPECT_DOUBLE_EQ(-4, Objective);
+}
+
+TEST(PatmosILPSolverTest, VariableBounds) {
+  double Objective;
+  ASSERT_TRUE(solve("Minimize\n"
+                    " x + 2 y\n"
+                    "Subject To\n"
+                    "c1: x + y >= 1.5\n"
+                    "Bounds\n"
+                    "2 <= x <= 5\n"
+                    "-3 <= y\n"
+                    "Generals\n"
+                    "y\n"
+                    "End\n", Objective));
+  // y = -3 is limited by c1 to x >= 4.5
+  EXPECT_DOUBLE_EQ(-1.5, Objective);
+}
+
+TEST(PatmosILPSolverTest, FlowProblem) {
+  // the shape of the stack cache analysis ILPs: a weighted path from the
+  // entry e through a loop l executed at most 3 times per entry
+  double Objective;
+  ASSERT_TRUE(solve("\\ paths over a call graph\n"
+                    "Maximize\n"
+                    " + 5 e_a + 2 a_l + 7 l_b + 1 a_b\n"
+                    "Subject To\n"
+                    "path:\te_a >= 1\n"
+                    "entry:\te_a = 1\n"
+                    "in_a:\te_a - a_l - a_b = 0\n"
+                    "in_b:\tl_b + a_b - e_a = 0\n"
+                    "loop:\tl_b - a_l = 0\n"
+                    "bound:\tl_b - 3 e_a <= 0\n"
+                    "Generals\n"
+                    "e_a\n"
+                    "a_l\n"
+                    "l_b\n"
+                    "a_b\n"
+                    "End\n", Objective));
+  EXPECT_DOUBLE_EQ(14, Objective);
+}
+
+TEST(PatmosILPSolverTest, Infeasible) {
+  double Objective;
+  EXPECT_FALSE(solve("Maximize\n"
+                     " x\n"
+                     "Subject To\n"
+                     "c1: x >= 3\n"
+                     "c2: x <= 2\n"
+                     "End\n", Objective));
+}
+
+TEST(PatmosILPSolverTest, IntegerInfeasible) {
+  double Objective;
+  EXPECT_FALSE(solve("Maximize\n"
+                     " x\n"
+                     "Subject To\n"
+                     "c1: 2 x = 3\n"
+                     "Generals\n"
+                     "x\n"
+                     "End\n", Objective));
+}
+
+TEST(PatmosILPSolverTest, Unbounded) {
+  double Objective;
+  EXPECT_FALSE(solve("Maximize\n"
+                     " x + y\n"
+                     "Subject To\n"
+                     "c1: x - y <= 1\n"
+                     "End\n", Objective));
+}
+
+TEST(PatmosILPSolverTest, FallbackNotUsedWithinLimits) {
+  unsigned Calls = 0;
+  std::unique_ptr<PatmosILPSolver> Solver(createPatmosBuiltinILPSolver(
+                         std::unique_ptr<PatmosILPSolver>(
+                           new CountingSolver(Calls))));
+
+  double Objective;
+  ASSERT_TRUE(Solver->solve("Maximize\n"
+                            " x\n"
+                            "Subject To\n"
+                            "c1: x <= 7\n"
+                            "Generals\n"
+                            "x\n"
+                            "End\n", Objective));
+  EXPECT_DOUBLE_EQ(7, Objective);
+
+  // infeasible ILPs are not passed on either
+  EXPECT_FALSE(Solver->solve("Maximize\n"
+                             " x\n"
+                             "Subject To\n"
+                             "c1: 2 x = 3\n"
+                             "Generals\n"
+                             "x\n"
+                             "End\n", Objective));
+  EXPECT_EQ(0u, Calls);
+}
+
+} // end anonymous namespace
@@ -0,0 +1,33 @@
+/* CRC-32 of a message, bytewise with a lookup table built at run time. */
+
+#define SIZE 256
+
+static unsigned char message[SIZE];
+static unsigned table[256];
+
+static void init(void) {
+  unsigned i, j;
+  #pragma loopbound min 256 max 256
+  for (i = 0; i < SIZE; i++)
+    message[i] = (unsigned char)(i * 7 + 3);
+
+  #pragma loopbound min 256 max 256
+  for (i = 0; i < 256; i++) {
+    unsigned c = i;
+    #pragma loopbound min 8 max 8
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+}
+
+unsigned bench(void) {
+  unsigned i, crc = 0xFFFFFFFFu;
+  init();
+  #pragma loopbound min 256 max 256
+  for (i = 0; i < SIZE; i++)
+    crc = table[(crc ^ message[i]) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+int main(void) { return bench() & 0x7F; }
@@ -0,0 +1,35 @@
+/* A 32-tap FIR filter over a block of fixed-point samples. */
+
+#define TAPS 32
+#define SAMPLES 128
+
+static int coeffs[TAPS];
+static int input[SAMPLES + TAPS];
+static int output[SAMPLES];
+
+static void init(void) {
+  int i;
+  #pragma loopbound min 32 max 32
+  for (i = 0; i < TAPS; i++)
+    coeffs[i] = (i < TAPS / 2 ? i : TAPS - i) * 512;
+  #pragma loopbound min 160 max 160
+  for (i = 0; i < SAMPLES + TAPS; i++)
+    input[i] = (int)(((unsigned)i * 1103515245u + 12345u) >> 16) & 0xFFF;
+}
+
+int bench(void) {
+  int i, j, sum = 0;
+  init();
+  #pragma loopbound min 128 max 128
+  for (i = 0; i < SAMPLES; i++) {
+    int acc = 0;
+    #pragma loopbound min 32 max 32
+    for (j = 0; j < TAPS; j++)
+      acc += coeffs[j] * input[i + j];
+    output[i] = acc >> 15;
+    sum += output[i];
+  }
+  return sum;
+}
+
+int main(void) { return bench() & 0x7F; }
@@ -0,0 +1,37 @@
+/* Multiplication of two square integer matrices. */
+
+#define N 16
+
+static int a[N][N], b[N][N], c[N][N];
+
+static void init(void) {
+  int i, j;
+  #pragma loopbound min 16 max 16
+  for (i = 0; i < N; i++) {
+    #pragma loopbound min 16 max 16
+    for (j = 0; j < N; j++) {
+      a[i][j] = i + j;
+      b[i][j] = i - j;
+    }
+  }
+}
+
+int bench(void) {
+  int i, j, k, sum = 0;
+  init();
+  #pragma loopbound min 16 max 16
+  for (i = 0; i < N; i++) {
+    #pragma loopbound min 16 max 16
+    for (j = 0; j < N; j++) {
+      int acc = 0;
+      #pragma loopbound min 16 max 16
+      for (k = 0; k < N; k++)
+        acc += a[i][k] * b[k][j];
+      c[i][j] = acc;
+      sum += acc;
+    }
+  }
+  return sum;
+}
+
+int main(void) { return bench() & 0x7F; }
@@ -0,0 +1,37 @@
+/* Insertion sort of a pseudo-random array. */
+
+#define SIZE 64
+
+static int data[SIZE];
+
+static void init(void) {
+  int i;
+  unsigned seed = 42;
+  #pragma loopbound min 64 max 64
+  for (i = 0; i < SIZE; i++) {
+    seed = seed * 1103515245u + 12345u;
+    data[i] = (int)(seed >> 16) & 0x7FFF;
+  }
+}
+
+int bench(void) {
+  int i, j, sorted = 1;
+  init();
+  #pragma loopbound min 63 max 63
+  for (i = 1; i < SIZE; i++) {
+    int key = data[i];
+    j = i - 1;
+    #pragma loopbound min 0 max 63
+    while (j >= 0 && data[j] > key) {
+      data[j + 1] = data[j];
+      j--;
+    }
+    data[j + 1] = key;
+  }
+  #pragma loopbound min 63 max 63
+  for (i = 1; i < SIZE; i++)
+    sorted &= data[i - 1] <= data[i];
+  return sorted;
+}
+
+int main(void) { return !bench(); }
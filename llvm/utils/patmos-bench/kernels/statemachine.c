@@ -0,0 +1,58 @@
+/* A protocol state machine driven by a stream of input symbols. */
+
+#define STEPS 512
+
+enum state { IDLE, HEADER, LENGTH, PAYLOAD, CHECKSUM, ERROR };
+
+static unsigned char symbols[STEPS];
+
+static void init(void) {
+  int i;
+  #pragma loopbound min 512 max 512
+  for (i = 0; i < STEPS; i++)
+    symbols[i] = (unsigned char)((i * 37 + 11) ^ (i >> 3));
+}
+
+int bench(void) {
+  enum state s = IDLE;
+  int i, length = 0, check = 0, frames = 0, errors = 0;
+  init();
+  #pragma loopbound min 512 max 512
+  for (i = 0; i < STEPS; i++) {
+    unsigned char sym = symbols[i];
+    switch (s) {
+    case IDLE:
+      if (sym == 0x7E || (sym & 0xF0) == 0x70)
+        s = HEADER;
+      break;
+    case HEADER:
+      s = (sym & 0x80) ? ERROR : LENGTH;
+      check = sym;
+      break;
+    case LENGTH:
+      length = sym & 0x0F;
+      check ^= sym;
+      s = length ? PAYLOAD : CHECKSUM;
+      break;
+    case PAYLOAD:
+      check ^= sym;
+      if (--length == 0)
+        s = CHECKSUM;
+      break;
+    case CHECKSUM:
+      if ((unsigned char)check == sym)
+        frames++;
+      else
+        errors++;
+      s = IDLE;
+      break;
+    case ERROR:
+      errors++;
+      s = IDLE;
+      break;
+    }
+  }
+  return frames * 256 + errors;
+}
+
+int main(void) { return bench() & 0x7F; }
@@ -0,0 +1,456 @@
+#!/usr/bin/env python3
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===----------------------------------------------------------------------===#
+#
+# Measure the code generation of the Patmos backend on a set of kernels:
+#  - the compile time of llc, in total and per pass, from -time-passes,
+#  - the code size, from the .text sections of the object file,
+#  - the number of subfunctions, i.e., method cache regions, the fill rate
+#    of the bundles, the ratio of NOPs, and the words reserved and ensured in
+#    the stack cache, from the assembly,
+#  - the static cycle estimate of -mpatmos-wcet-report,
+#  - the cycles executed by pasim, if it and a Patmos newlib are available.
+# Every kernel is compiled with the option sets of CONFIGS, by default in
+# normal and in single-path mode, with its function 'bench' as single-path
+# root. With --config all, also with the stack cache analysis and with small
+# and large caches.
+#
+# The kernels are the C files of the kernels directory, plus large functions
+# generated by this script, which stress the compile time of the passes.
+#
+# With --baseline, the results are compared with those of an earlier run,
+# e.g., before an upstream merge, and the script fails if one of them got
+# worse by more than the threshold.
+#
+# The results have the same keys for every kernel and option set, metrics
+# that are not available are null. SCHEMA_VERSION is increased whenever keys
+# are renamed or change their meaning.
+#
+# ===----------------------------------------------------------------------===#
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+TRIPLE = 'patmos-unknown-unknown-elf'
+SCHEMA_VERSION = 1
+
+# The option sets, with the arguments of llc and those of pasim to simulate
+# the hardware the options assume.
+CONFIGS = (('normal', [], []),
+           ('singlepath', ['-mpatmos-singlepath=bench'], []),
+           ('sca', ['-mpatmos-enable-stack-cache-analysis'], []),
+           ('small-caches', ['-mpatmos-method-cache-size=1024',
+                             '-mpatmos-stack-cache-size=512'],
+            ['--mcsize=1024', '--scsize=512']),
+           ('large-caches', ['-mpatmos-method-cache-size=16384',
+                             '-mpatmos-stack-cache-size=8192'],
+            ['--mcsize=16384', '--scsize=8192']))
+DEFAULT_CONFIGS = ('normal', 'singlepath')
+KERNEL_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                          'kernels')
+
+# The metrics compared with the baseline, with the threshold option they use.
+METRICS = (('code_size', 'threshold'),
+           ('wcet', 'threshold'),
+           ('cycles', 'threshold'),
+           ('nops', 'threshold'),
+           ('ensured_words', 'threshold'),
+           ('compile_time', 'time_threshold'),
+           ('patmos_time', 'time_threshold'))
+
+# The counts taken from the assembly, see asm_metrics.
+ASM_METRICS = ('subfunctions', 'instructions', 'bundles', 'nops', 'reserves',
+               'reserved_words', 'ensures', 'ensured_words')
+
+
+def generate_branches(size):
+    """A long chain of data dependent branches, in a single bounded loop."""
+    lines = ['/* Generated by patmos-bench.py: %d branches. */' % size,
+             '',
+             'static int input[16];',
+             '',
+             'int bench(void) {',
+             '  int i, acc = 1;',
+             '  #pragma loopbound min 16 max 16',
+             '  for (i = 0; i < 16; i++)',
+             '    input[i] = i * 2654435761u >> 7;',
+             '  #pragma loopbound min 4 max 4',
+             '  for (i = 0; i < 4; i++) {']
+    for k in range(size):
+        lines.append('    if ((input[%d] ^ acc) & %d)' %
+                     (k % 16, 1 << (k % 5)))
+        lines.append('      acc += input[%d] * %d;' % ((k * 7) % 16, k + 1))
+        lines.append('    else')
+        lines.append('      acc ^= input[%d] >> %d;' % ((k * 3) % 16, k % 7))
+    lines += ['  }',
+              '  return acc;',
+              '}',
+              '',
+              'int main(void) { return bench() & 0x7F; }',
+              '']
+    return '\n'.join(lines)
+
+
+def generate_switch(size):
+    """A state machine with many states, as one large switch."""
+    lines = ['/* Generated by patmos-bench.py: %d states. */' % size,
+             '',
+             'int bench(void) {',
+             '  unsigned i, state = 0, acc = 0;',
+             '  #pragma loopbound min 1024 max 1024',
+             '  for (i = 0; i < 1024; i++) {',
+             '    switch (state) {']
+    for k in range(size):
+        lines.append('    case %d:' % k)
+        lines.append('      acc = acc * %d + i;' % (2 * k + 3))
+        lines.append('      state = (acc >> %d) %% %d;' % (k % 11, size))
+        lines.append('      break;')
+    lines += ['    default:',
+              '      state = 0;',
+              '    }',
+              '  }',
+              '  return (int)acc;',
+              '}',
+              '',
+              'int main(void) { return bench() & 0x7F; }',
+              '']
+    return '\n'.join(lines)
+
+
+def find_tool(name, explicit, llc):
+    """Return the given tool, the one next to llc or the one on the path."""
+    if explicit:
+        return explicit
+    candidate = os.path.join(os.path.dirname(os.path.abspath(llc)), name)
+    if os.path.isfile(candidate) and os.access(candidate, os.X_OK):
+        return candidate
+    return shutil.which(name)
+
+
+def run(cmd, **kwargs):
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True, **kwargs)
+    if proc.returncode != 0:
+        raise RuntimeError('%s failed:\n%s' % (' '.join(cmd), proc.stderr))
+    return proc
+
+
+def parse_pass_times(report):
+    """Return the wall time of every pass of a -time-passes report."""
+    times = {}
+    in_report = False
+    row = re.compile(r'^\s*((?:\d+\.\d+\s+\(\s*\d+\.\d+%\)\s+)+)(\S.*?)\s*$')
+    for line in report.splitlines():
+        if 'Pass execution timing report' in line:
+            in_report = True
+            continue
+        if not in_report:
+            continue
+        if line.startswith('===') and times:
+            break
+        m = row.match(line)
+        if m:
+            wall = float(re.findall(r'\d+\.\d+', m.group(1))[-2])
+            name = re.sub(r' #\d+$', '', m.group(2))
+            times[name] = times.get(name, 0.0) + wall
+    return times
+
+
+def parse_wcet_report(path):
+    """Return the estimates of -mpatmos-wcet-report, -1 if unbounded."""
+    estimates = {}
+    if not os.path.exists(path):
+        return estimates
+    with open(path) as f:
+        for line in f:
+            fields = [x.strip().strip('"') for x in line.split(',')]
+            if len(fields) >= 3:
+                estimates[fields[1]] = int(fields[2])
+    return estimates
+
+
+def asm_metrics(path):
+    """Return the static metrics of the assembly of a kernel. A bundle, or a
+    single instruction, is issued as a group of up to two instructions."""
+    m = dict.fromkeys(ASM_METRICS, 0)
+    groups = 0
+    in_bundle = False
+    guard = re.compile(r'^\(\s*!?\$p\d+\s*\)\s*')
+    with open(path) as f:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if line.startswith('.fstart'):
+                m['subfunctions'] += 1
+            if not line or line.startswith('.') or line.endswith(':'):
+                continue
+            if line.startswith('{'):
+                groups += 1
+                m['bundles'] += 1
+                in_bundle = True
+                line = line[1:].strip()
+            elif not in_bundle:
+                groups += 1
+            if line.endswith('}'):
+                in_bundle = False
+                line = line[:-1].strip()
+
+            fields = guard.sub('', line).split()
+            if not fields:
+                continue
+            m['instructions'] += 1
+            op = fields[0]
+            if op == 'nop':
+                m['nops'] += 1
+            elif op in ('sres', 'sens') and len(fields) > 1:
+                kind = 'reserve' if op == 'sres' else 'ensure'
+                m[kind + 's'] += 1
+                try:
+                    m[kind + 'd_words'] += int(fields[1], 0)
+                except ValueError:
+                    pass
+
+    m['bundle_fill'] = (m['instructions'] / (2.0 * groups)) if groups else None
+    m['nop_ratio'] = (float(m['nops']) / m['instructions']
+                      if m['instructions'] else None)
+    return m
+
+
+def code_size(size_tool, obj):
+    """Return the size of the .text sections of an object file."""
+    out = run([size_tool, '-A', obj]).stdout
+    total = 0
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith('.text'):
+            total += int(fields[1], 0)
+    return total
+
+
+def simulate(args, src, config, work):
+    """Return the cycles executed by pasim, or None if the kernel could not
+    be linked or simulated."""
+    _, llc_args, pasim_args = config
+    elf = os.path.join(work, 'a.elf')
+    cmd = [args.clang, '--target=' + TRIPLE, '-O2', src, '-o', elf]
+    for a in llc_args + args.llc_arg:
+        cmd += ['-mllvm', a]
+    try:
+        run(cmd)
+    except RuntimeError as e:
+        if not args.quiet:
+            print('warning: cannot link %s, no cycles: %s' % (src, e),
+                  file=sys.stderr)
+        return None
+
+    proc = subprocess.run([args.pasim, '-V'] + pasim_args + [elf],
+                          stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    m = re.search(r'Cycles\s*:?\s*(\d+)', proc.stdout)
+    return int(m.group(1)) if m else None
+
+
+def empty_result():
+    """Return a result with all keys, none of them measured."""
+    r = dict.fromkeys(('compile_time', 'patmos_time', 'code_size', 'wcet',
+                       'cycles', 'bundle_fill', 'nop_ratio', 'error'))
+    r.update(dict.fromkeys(ASM_METRICS))
+    r['passes'] = {}
+    r['functions'] = {}
+    return r
+
+
+def measure(args, name, src, config):
+    work = os.path.join(args.work_dir, name, config[0])
+    os.makedirs(work, exist_ok=True)
+    ll = os.path.join(work, name + '.ll')
+    obj = os.path.join(work, name + '.o')
+    asm = os.path.join(work, name + '.s')
+    report = os.path.join(work, 'wcet.csv')
+
+    run([args.clang, '--target=' + TRIPLE, '-O2', '-ffreestanding', '-S',
+         '-emit-llvm', src, '-o', ll])
+
+    base = [args.llc, '-O2', ll] + config[1] + args.llc_arg
+    llc = base + ['-filetype=obj', '-time-passes', '-o', obj,
+                  '-mpatmos-wcet-report=' + report]
+
+    # the minimum over all runs is the least affected by the load of the host
+    passes = None
+    for _ in range(args.repeat):
+        if os.path.exists(report):
+            os.remove(report)
+        times = parse_pass_times(run(llc).stderr)
+        if passes is None:
+            passes = times
+        else:
+            for p, t in times.items():
+                passes[p] = min(passes.get(p, t), t)
+
+    # the assembly of the same code, for the static metrics
+    run(base + ['-filetype=asm', '-o', asm])
+
+    result = empty_result()
+    result.update({
+        'compile_time': passes.pop('Total', sum(passes.values())),
+        'patmos_time': sum(t for p, t in passes.items()
+                           if 'Patmos' in p or 'Single-Path' in p),
+        'passes': passes,
+        'code_size': code_size(args.size, obj),
+        'functions': parse_wcet_report(report),
+    })
+    result.update(asm_metrics(asm))
+    wcet = result['functions'].get('bench', -1)
+    result['wcet'] = wcet if wcet >= 0 else None
+    if args.pasim:
+        result['cycles'] = simulate(args, src, config, work)
+    return result
+
+
+def compare(args, results, baseline):
+    """Print the metrics that got worse than in the baseline and return
+    their number."""
+    regressions = 0
+    for key, base in sorted(baseline.items()):
+        cur = results.get(key)
+        if cur is None:
+            continue
+        for metric, threshold in METRICS:
+            old, new = base.get(metric), cur.get(metric)
+            if not old or new is None:
+                continue
+            change = 100.0 * (new - old) / old
+            if change > getattr(args, threshold):
+                print('regression: %s %s: %s -> %s (%+.1f%%)' %
+                      (key, metric, old, new, change))
+                regressions += 1
+    return regressions
+
+
+def print_table(results):
+    def fmt(value, spec='%s'):
+        return spec % value if value is not None else '-'
+
+    print('%-32s %10s %10s %8s %6s %6s %6s %10s %10s' %
+          ('benchmark', 'llc (s)', 'patmos (s)', 'size', 'subfn', 'fill',
+           'nops', 'wcet', 'cycles'))
+    for key, r in sorted(results.items()):
+        if r['error']:
+            print('%-32s failed' % key)
+            continue
+        print('%-32s %10.4f %10.4f %8d %6d %6s %6s %10s %10s' %
+              (key, r['compile_time'], r['patmos_time'], r['code_size'],
+               r['subfunctions'], fmt(r['bundle_fill'], '%.2f'),
+               fmt(r['nop_ratio'], '%.2f'), fmt(r['wcet']),
+               fmt(r['cycles'])))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Measure the Patmos backend on a set of kernels")
+    parser.add_argument('--llc', required=True, help='the llc to measure')
+    parser.add_argument('--clang', help='the clang to compile the kernels '
+                        '(default: next to llc)')
+    parser.add_argument('--size', help='the llvm-size to measure the code '
+                        '(default: next to llc)')
+    parser.add_argument('--pasim', help='the simulator to count the cycles '
+                        '(default: pasim on the path, if any)')
+    parser.add_argument('--no-pasim', action='store_true',
+                        help='do not simulate the kernels')
+    parser.add_argument('--work-dir', default='patmos-bench.work',
+                        help='the directory for the intermediate files')
+    parser.add_argument('-o', '--output', default='patmos-bench.json',
+                        help='the file to write the results to')
+    parser.add_argument('--baseline',
+                        help='the results of an earlier run to compare with')
+    parser.add_argument('--threshold', type=float, default=1.0,
+                        help='the tolerated increase of the code size and '
+                        'cycles, in percent (default: 1)')
+    parser.add_argument('--time-threshold', type=float, default=10.0,
+                        help='the tolerated increase of the compile time, '
+                        'in percent (default: 10)')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='the number of runs of llc per kernel '
+                        '(default: 3)')
+    parser.add_argument('--large-size', type=int, default=400,
+                        help='the size of the generated functions '
+                        '(default: 400, 0 for none)')
+    parser.add_argument('--filter', default='',
+                        help='only run the kernels matching the regex')
+    parser.add_argument('--config', action='append',
+                        choices=[c[0] for c in CONFIGS] + ['all'],
+                        help='compile with the given option set, or all of '
+                        'them (default: %s)' % ', '.join(DEFAULT_CONFIGS))
+    parser.add_argument('--llc-arg', action='append', default=[],
+                        help='an additional argument of llc')
+    parser.add_argument('-q', '--quiet', action='store_true')
+    args = parser.parse_args()
+
+    args.clang = find_tool('clang', args.clang, args.llc)
+    args.size = find_tool('llvm-size', args.size, args.llc)
+    if not args.clang or not args.size:
+        parser.error('cannot find clang or llvm-size, use --clang and --size')
+    args.pasim = None if args.no_pasim else (args.pasim or
+                                             shutil.which('pasim'))
+    args.repeat = max(args.repeat, 1)
+    names = args.config or DEFAULT_CONFIGS
+    configs = [c for c in CONFIGS if 'all' in names or c[0] in names]
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    kernels = []
+    for f in sorted(os.listdir(KERNEL_DIR)):
+        if f.endswith('.c'):
+            kernels.append((f[:-2], os.path.join(KERNEL_DIR, f)))
+    if args.large_size > 0:
+        for name, generate in (('large-branches', generate_branches),
+                               ('large-switch', generate_switch)):
+            src = os.path.join(args.work_dir, name + '.c')
+            with open(src, 'w') as f:
+                f.write(generate(args.large_size))
+            kernels.append((name, src))
+
+    results = {}
+    for name, src in kernels:
+        if not re.search(args.filter, name):
+            continue
+        for config in configs:
+            if not args.quiet:
+                print('%s (%s)' % (name, config[0]), file=sys.stderr)
+            # a failing option set, e.g., an unbounded stack cache analysis,
+            # does not abort the others
+            try:
+                result = measure(args, name, src, config)
+            except RuntimeError as e:
+                print('error: %s' % e, file=sys.stderr)
+                result = empty_result()
+                result['error'] = str(e)
+            results['%s/%s' % (name, config[0])] = result
+
+    with open(args.output, 'w') as f:
+        json.dump({'schema': SCHEMA_VERSION,
+                   'llc': os.path.abspath(args.llc),
+                   'configs': dict((c[0], {'llc': c[1] + args.llc_arg,
+                                           'pasim': c[2]})
+                                   for c in configs),
+                   'results': results}, f, indent=2, sort_keys=True)
+
+    print_table(results)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)['results']
+        if compare(args, results, baseline):
+            return 1
+    return 1 if any(r['error'] for r in results.values()) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+# ===----------------------------------------------------------------------===#
+#
+# Tune the parameters of the function splitter and the stack cache for an
+# application. Every configuration of the parameters is compiled by llc, and
+# measured by
+#  - the code size, the sum of the functions of -mpatmos-wcet-report,
+#  - the static cycle estimate of the root function, from the same report,
+#    or the cycles executed by pasim with --pasim.
+# The script then prints the Pareto front of code size versus cycles, i.e.,
+# the configurations no other configuration beats in both.
+#
+# The configurations are all combinations of the values of the parameters,
+# or, with --samples, a random subset of them. The values of a parameter are
+# given by --param, e.g., --param preferred-subfunction-size=128,256,512.
+#
+# The stack cache size is a parameter of the hardware as well, pasim must be
+# configured to match it, see --pasim-arg. The sources are compiled as one
+# program, module-level options like -mpatmos-singlepath are given by
+# --llc-arg.
+#
+# ===----------------------------------------------------------------------===#
+
+import argparse
+import importlib.util
+import itertools
+import json
+import os
+import random
+import re
+import subprocess
+import sys
+
+# the helpers of the benchmark suite
+_spec = importlib.util.spec_from_file_location(
+    'patmos_bench', os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                 'patmos-bench.py'))
+bench = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(bench)
+
+# The parameters of llc, without the -mpatmos- prefix, with their values to
+# try by default.
+PARAMS = (('preferred-subfunction-size', (128, 256, 512, 1024)),
+          ('preferred-scc-size', (0, 256, 512)),
+          ('max-subfunction-size', (512, 1024, 2048)),
+          ('stack-cache-size', (1024, 2048, 4096)),
+          ('split-call-blocks', ('true', 'false')))
+
+
+def parse_params(args):
+    """Return the parameters with their values, the defaults replaced by
+    those given on the command line."""
+    params = dict(PARAMS)
+    for p in args.param:
+        name, sep, values = p.partition('=')
+        name = name[len('mpatmos-'):] if name.startswith('mpatmos-') else name
+        if not sep or not values:
+            raise SystemExit('error: expected <name>=<values>, got ' + p)
+        params[name] = tuple(values.split(','))
+    for name in args.fix:
+        params.pop(name, None)
+    return params
+
+
+def configurations(args, params):
+    """Return the configurations to measure, as dictionaries."""
+    names = sorted(params)
+    space = [dict(zip(names, v))
+             for v in itertools.product(*(params[n] for n in names))]
+    if args.samples and args.samples < len(space):
+        space = random.Random(args.seed).sample(space, args.samples)
+    return space
+
+
+def options(config):
+    return ['-mpatmos-%s=%s' % (n, v) for n, v in sorted(config.items())]
+
+
+def measure(args, lls, srcs, config, work):
+    """Return the code size and the cycles of a configuration, the cycles are
+    None if they have no bound. Raise a RuntimeError if it cannot be
+    compiled."""
+    os.makedirs(work, exist_ok=True)
+    report = os.path.join(work, 'wcet.csv')
+    if os.path.exists(report):
+        os.remove(report)
+    for i, ll in enumerate(lls):
+        bench.run([args.llc, '-O2', '-filetype=obj', ll,
+                   '-o', os.path.join(work, '%d.o' % i),
+                   '-mpatmos-wcet-report=' + report] +
+                  options(config) + args.llc_arg)
+
+    size, wcet = 0, None
+    with open(report) as f:
+        for line in f:
+            fields = [x.strip().strip('"') for x in line.split(',')]
+            if len(fields) < 4:
+                raise RuntimeError('llc does not report the code size')
+            size += int(fields[3])
+            if fields[1] == args.root:
+                wcet = int(fields[2])
+    if wcet is not None and wcet < 0:
+        wcet = None
+    result = {'code_size': size, 'wcet': wcet}
+
+    if args.pasim:
+        elf = os.path.join(work, 'a.elf')
+        cmd = [args.clang, '--target=' + bench.TRIPLE, '-O2'] + srcs
+        for opt in options(config) + args.llc_arg:
+            cmd += ['-mllvm', opt]
+        bench.run(cmd + ['-o', elf])
+        proc = subprocess.run([args.pasim, '-V'] + args.pasim_arg + [elf],
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              universal_newlines=True)
+        m = re.search(r'Cycles\s*:?\s*(\d+)', proc.stdout)
+        result['cycles'] = int(m.group(1)) if m else None
+    else:
+        result['cycles'] = result['wcet']
+    return result
+
+
+def pareto_front(points):
+    """Return the points not dominated by another one, by code size."""
+    front = []
+    for p in sorted(points, key=lambda p: (p['code_size'], p['cycles'])):
+        if not front or p['cycles'] < front[-1]['cycles']:
+            front.append(p)
+    return front
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Tune the function splitter and stack cache parameters "
+                    "of the Patmos backend for an application")
+    parser.add_argument('sources', nargs='+',
+                        help='the C or LLVM IR files of the application')
+    parser.add_argument('--llc', required=True, help='the llc to use')
+    parser.add_argument('--clang', help='the clang to compile the sources '
+                        '(default: next to llc)')
+    parser.add_argument('--root', default='main',
+                        help='the function whose cycles are minimized '
+                        '(default: main)')
+    parser.add_argument('--param', action='append', default=[],
+                        help='the values of a parameter, <name>=<v1>,<v2>,...')
+    parser.add_argument('--fix', action='append', default=[],
+                        help='do not vary the given parameter')
+    parser.add_argument('--samples', type=int, default=0,
+                        help='measure only this many random configurations '
+                        '(default: all)')
+    parser.add_argument('--seed', type=int, default=0,
+                        help='the seed of the random configurations')
+    parser.add_argument('--pasim', help='count the cycles by the given '
+                        'simulator instead of the static estimate')
+    parser.add_argument('--pasim-arg', action='append', default=[],
+                        help='an additional argument of pasim')
+    parser.add_argument('--llc-arg', action='append', default=[],
+                        help='an additional argument of llc')
+    parser.add_argument('--work-dir', default='patmos-tune.work',
+                        help='the directory for the intermediate files')
+    parser.add_argument('-o', '--output', default='patmos-tune.json',
+                        help='the file to write all results to')
+    parser.add_argument('-q', '--quiet', action='store_true')
+    args = parser.parse_args()
+
+    args.clang = bench.find_tool('clang', args.clang, args.llc)
+    if not args.clang:
+        parser.error('cannot find clang, use --clang')
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    srcs = [os.path.abspath(s) for s in args.sources]
+    lls = []
+    for i, src in enumerate(srcs):
+        if src.endswith(('.ll', '.bc')):
+            lls.append(src)
+            continue
+        ll = os.path.join(args.work_dir, 'src%d.ll' % i)
+        bench.run([args.clang, '--target=' + bench.TRIPLE, '-O2', '-S',
+                   '-emit-llvm', src, '-o', ll])
+        lls.append(ll)
+    if args.pasim and any(s.endswith(('.ll', '.bc')) for s in srcs):
+        parser.error('--pasim needs the C sources')
+
+    params = parse_params(args)
+    space = configurations(args, params)
+    results = []
+    for i, config in enumerate(space):
+        if not args.quiet:
+            print('[%d/%d] %s' % (i + 1, len(space), ' '.join(options(config))),
+                  file=sys.stderr)
+        try:
+            r = measure(args, lls, srcs, config,
+                        os.path.join(args.work_dir, str(i)))
+        except RuntimeError as e:
+            if not args.quiet:
+                print('warning: skipped: %s' % e, file=sys.stderr)
+            continue
+        r['config'] = config
+        results.append(r)
+
+    with open(args.output, 'w') as f:
+        json.dump({'llc': os.path.abspath(args.llc), 'root': args.root,
+                   'params': params, 'results': results}, f, indent=2,
+                  sort_keys=True)
+
+    bounded = [r for r in results if r['cycles'] is not None]
+    if not bounded:
+        print('error: no configuration with bounded cycles of ' + args.root,
+              file=sys.stderr)
+        return 1
+
+    print('%10s %12s  %s' % ('size', 'cycles', 'configuration'))
+    for r in pareto_front(bounded):
+        print('%10d %12d  %s' % (r['code_size'], r['cycles'],
+                                 ' '.join(options(r['config']))))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())